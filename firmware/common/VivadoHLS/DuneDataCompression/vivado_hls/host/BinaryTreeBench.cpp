@@ -0,0 +1,601 @@
+// -*-Mode: C++;-*-
+
+
+/* ---------------------------------------------------------------------- *//*!
+ *
+ *  @file     BinaryTreeBench.cpp
+ *  @brief    Validates and times the table driven binary tree encoding,
+ *            BTE.cpp, and decoding, BTD.c
+ *  @verbatim
+ *                               Copyright 2018
+ *                                    by
+ *
+ *                       The Board of Trustees of the
+ *                    Leland Stanford Junior University.
+ *                           All rights reserved.
+ *
+ *  @endverbatim
+ *
+ *  @par Facility:
+ *  DUNE
+ *
+ *  @author
+ *  russell@slac.stanford.edu
+ *
+ *  @par Date created:
+ *  2018.07.31
+ *
+ * @par Credits:
+ * SLAC
+ *
+\* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *\
+
+   HISTORY
+   -------
+
+   DATE       WHO WHAT
+   ---------- --- ---------------------------------------------------------
+   2018.07.31 jjr Created
+
+\* ---------------------------------------------------------------------- */
+
+
+
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'DUNE Data compression'.
+// It is subject to the license terms in the LICENSE.txt file found in the
+// top-level directory of this distribution and at:
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html.
+// No part of 'DUNE Data compression', including this file,
+// may be copied, modified, propagated, or distributed except according to
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+
+
+/* ---------------------------------------------------------------------- *\
+
+   The reference is the bit at a time implementation the tables replaced,
+   kept here verbatim less its debug prints.
+
+   Checks
+     - every 16-bit mask: BTD_shortDecode of every 16-bit input in every
+       scheme
+     - every 32-bit mask, or with -q n, 2^(32-n) masks spread over the
+       32 bits plus those confined to either half: the pattern, size and
+       encoding of the mask and the decoding of its encoding, in its
+       own scheme and the others, must all match the reference and the
+       decoding must restore the mask
+
+   Then the reference and the tables are timed on random histogram
+   occupancy masks.
+
+\* ---------------------------------------------------------------------- */
+
+
+#define __STDC_FORMAT_MACROS
+
+#include "BTE.h"
+#include "BTD.h"
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+
+
+/* ---------------------------------------------------------------------- */
+static inline uint64_t now_ns ()
+{
+   struct timespec ts;
+   clock_gettime (CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *\
+ |
+ | The reference encoder
+ |
+\* ---------------------------------------------------------------------- */
+static unsigned int ref_encode (unsigned int e,
+                                unsigned int w,
+                                unsigned int p1,
+                                unsigned int p3)
+{
+   for (int idx = 0; idx < 16; idx++, w <<= 2)
+   {
+       unsigned int x = w & 0xc0000000;
+       if (x)
+       {
+           if (x == p1)  { e <<= 1; }
+           else
+           {
+               e <<= 2;
+               e  |= 2;
+               if (x == p3) e |= 1;
+           }
+       }
+   }
+
+   return e;
+}
+
+
+static unsigned int ref_wordEncode (unsigned int w,
+                                    unsigned int p,
+                                    unsigned int scheme_size)
+{
+   unsigned int e;
+   int     scheme = scheme_size >> 16;
+
+   if (scheme == 0) return w;
+
+   unsigned int p3 = 0xc0000000;
+   if (scheme == 3) p3 = 0x80000000;
+
+   scheme <<= 30;
+   e = ref_encode (0, p, scheme, p3);
+   e = ref_encode (e, w, scheme, p3);
+
+   return e << (32 - (scheme_size & 0xffff));
+}
+
+
+static unsigned int ref_wordPrepare (unsigned int w)
+{
+   unsigned int l5 = w;
+   unsigned int l4 = l5 | (l5 >>  1);
+   unsigned int l3 = l4 | (l4 >>  2);
+   unsigned int l2 = l3 | (l3 >>  4);
+   unsigned int l1 = l2 | (l2 >>  8);
+   unsigned int  p;
+
+   p  = (((l1 >> 15) & 2) | (l1 & 1)) << 30;
+
+   p |= ((l2 >> (24-3) & 0x8)
+     |   (l2 >> (16-2) & 0x4)
+     |   (l2 >> ( 8-1) & 0x2)
+     |   (l2 >> (   0) & 0x1)) << 26;
+
+   p |= ((l3 >> (28-7) & 0x80)
+     |   (l3 >> (24-6) & 0x40)
+     |   (l3 >> (20-5) & 0x20)
+     |   (l3 >> (16-4) & 0x10)
+     |   (l3 >> (12-3) & 0x08)
+     |   (l3 >> ( 8-2) & 0x04)
+     |   (l3 >> ( 4-1) & 0x02)
+     |   (l3 >> (   0) & 0x01)) << 18;
+
+   p |= ((l4 >> (30-15) & 0x8000)
+     |   (l4 >> (28-14) & 0x4000)
+     |   (l4 >> (26-13) & 0x2000)
+     |   (l4 >> (24-12) & 0x1000)
+     |   (l4 >> (22-11) & 0x0800)
+     |   (l4 >> (20-10) & 0x0400)
+     |   (l4 >> (18- 9) & 0x0200)
+     |   (l4 >> (16- 8) & 0x0100)
+     |   (l4 >> (14- 7) & 0x0080)
+     |   (l4 >> (12- 6) & 0x0040)
+     |   (l4 >> (10- 5) & 0x0020)
+     |   (l4 >> ( 8- 4) & 0x0010)
+     |   (l4 >> ( 6- 3) & 0x0008)
+     |   (l4 >> ( 4- 2) & 0x0004)
+     |   (l4 >> ( 2- 1) & 0x0002)
+     |   (l4 >> (    0) & 0x0001)) << 2;
+
+   return p;
+}
+
+
+static unsigned int ref_wordSize (unsigned int w, unsigned int p)
+{
+   int cnts   = 0;
+   int min    = 0;
+   int scheme = 0;
+
+   if (w == 0) return 32;
+
+   for (int idx = 0; idx < 16; idx++)
+   {
+       unsigned int x =   p & 3;
+       unsigned int y =  (w & 3);
+
+       cnts += (1 << 8*x);
+       cnts += (1 << 8*y);
+
+       p >>= 2;
+       w >>= 2;
+   }
+
+   int cnt_01 = (cnts >>  8) & 0xff;
+   int cnt_10 = (cnts >> 16) & 0xff;
+   int cnt_11 = (cnts >> 24) & 0xff;
+
+   int tot_01 = cnt_01 + 2 * (cnt_10 + cnt_11);
+   int tot_10 = cnt_10 + 2 * (cnt_11 + cnt_01);
+   int tot_11 = cnt_11 + 2 * (cnt_01 + cnt_10);
+
+   min    = 32     < tot_01 ? (scheme=0, 32)     : (scheme=1, tot_01);
+   min    = tot_10 < min    ? (scheme=2, tot_10) : min;
+   min    = tot_11 < min    ? (scheme=3, tot_11) : min;
+
+   return (scheme << 16) | min;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *\
+ |
+ | The reference decoder, BTD_wordDecode and BTD_shortDecode differed
+ | only in the initial output mask and the width of the first level
+ |
+\* ---------------------------------------------------------------------- */
+#define LKUP(_0, _10, _11)  (_10 << 0) | (_11 << 2) | (_0 << 4)
+
+static unsigned int ref_decode (unsigned int      w,
+                                unsigned int scheme,
+                                unsigned int      o,
+                                int            bits,
+                                int          *nbits)
+{
+   unsigned int lkup;
+
+   if      (scheme == 1)  lkup = LKUP (1, 2, 3);
+   else if (scheme == 2)  lkup = LKUP (2, 1, 3);
+   else                   lkup = LKUP (3, 1, 2);
+
+   int          node0 = lkup >> 4;
+   int              n = 0;
+   unsigned int    m1 = o;
+
+   do
+   {
+       unsigned int   m = m1;
+       unsigned int tmp = o;
+       m1 = m & (m << bits);
+
+       do
+       {
+           int b  = __builtin_clz (tmp);
+           int node;
+
+           if ((signed int)w >= 0)
+           {
+               node = node0;
+               n   += 1;
+               w  <<= 1;
+           }
+           else
+           {
+               node = (lkup >> ((w >> (30 - 1)) & 2) & 3);
+               n   += 2;
+               w  <<=2;
+           }
+
+           if ( (node & 1) == 0) o &= ~(m1 >> (b + bits));
+           if ( (node & 2) == 0) o &= ~(m1 >>  b);
+
+           tmp &= ~m >> b;
+       }
+       while (tmp);
+   }
+   while (bits >>= 1);
+
+   *nbits = n;
+   return o;
+}
+
+
+static unsigned int ref_wordDecode (unsigned int w, unsigned int scheme, int *nbits)
+{
+   if (scheme == 0) { *nbits = 32; return w; }
+   return ref_decode (w, scheme, 0xffffffff, 16, nbits);
+}
+
+
+static unsigned int ref_shortDecode (unsigned short s, unsigned int scheme, int *nbits)
+{
+   if (scheme == 0) { *nbits = 16; return s; }
+   return ref_decode (s << 16, scheme, 0xffff0000, 8, nbits) >> 16;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Checks every 16-bit input to BTD_shortDecode in every scheme
+  \return The number of mismatches
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static uint64_t check_short ()
+{
+   uint64_t nerrs = 0;
+
+   for (unsigned int scheme = 0; scheme < 4; scheme++)
+   {
+      for (unsigned int s = 0; s < 0x10000; s++)
+      {
+         int          rn, tn;
+         unsigned int ro = ref_shortDecode (s, scheme, &rn);
+         unsigned int to = BTD_shortDecode (s, scheme, &tn);
+         if (ro != to || rn != tn)
+         {
+            if (nerrs++ < 10)
+            {
+               printf ("Short   %4.4x scheme %u: ref %4.4x/%d table %4.4x/%d\n",
+                       s, scheme, ro, rn, to, tn);
+            }
+         }
+      }
+   }
+
+   return nerrs;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Checks the encoding and decoding of one 32-bit mask
+  \return The number of mismatches
+
+  \param[in] w  The mask
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline int check_word (unsigned int w)
+{
+   unsigned int rp = ref_wordPrepare (w);
+   unsigned int tp = BTE_wordPrepare (w);
+   unsigned int rs = ref_wordSize    (w, rp);
+   unsigned int ts = BTE_wordSize    (w, tp);
+   int       nerrs = 0;
+   static int nprint = 0;
+
+   if (rp != tp || rs != ts)
+   {
+      nerrs += 1;
+      if (nprint++ < 10)
+      {
+         printf ("Prepare %8.8x: ref %8.8x/%5.5x table %8.8x/%5.5x\n",
+                 w, rp, rs, tp, ts);
+      }
+      return nerrs;
+   }
+
+   if (w == 0) return 0;
+
+   // Encode with each scheme, all must match, the best must round trip
+   for (unsigned int scheme = 0; scheme < 4; scheme++)
+   {
+      unsigned int ss = (scheme << 16) | (rs & 0xffff);
+      unsigned int re = ref_wordEncode (w, rp, ss);
+      unsigned int te = BTE_wordEncode (w, tp, ss);
+
+      int          rn, tn;
+      unsigned int rd = ref_wordDecode (re, scheme, &rn);
+      unsigned int td = BTD_wordDecode (te, scheme, &tn);
+
+      bool bad = re != te || rd != td || rn != tn;
+      if (scheme == (rs >> 16)) bad |= td != w || tn != (int)(rs & 0xffff);
+      nerrs += bad;
+      if (bad && nprint++ < 10)
+      {
+         printf ("Word    %8.8x scheme %u: ref %8.8x -> %8.8x/%d"
+                 " table %8.8x -> %8.8x/%d\n",
+                 w, scheme, re, rd, rn, te, td, tn);
+      }
+   }
+
+   return nerrs;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Returns a histogram occupancy like mask, a run of set bits
+          followed by sparse ones
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static unsigned int occupancy ()
+{
+   int          nrun = lrand48 () % 24;
+   unsigned int mask = nrun ? 0xffffffffu >> (32 - nrun) : 0;
+   for (int i = nrun; i < 32; i++)
+   {
+      if ((lrand48 () & 7) == 0) mask |= 1u << i;
+   }
+
+   return mask ? mask : 1;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief Prints one timing line
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static void report (char const *what, int n, int niter, uint64_t rns, uint64_t tns)
+{
+   double count = (double)n * niter;
+   printf ("%-8s reference %7.2f Mwords/s  table %7.2f Mwords/s  %5.2fx\n",
+           what,
+           count / (rns * 1.e-3), count / (tns * 1.e-3),
+           (double)rns / tns);
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief Times the reference and the tables on the same masks
+
+  \param[in] n      The number of masks
+  \param[in] niter  The number of passes over them
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static void bench (int n, int niter)
+{
+   unsigned int *masks = (unsigned int *)malloc (n * sizeof (*masks));
+   unsigned int *pats  = (unsigned int *)malloc (n * sizeof (*pats));
+   unsigned int *sizes = (unsigned int *)malloc (n * sizeof (*sizes));
+   unsigned int *encs  = (unsigned int *)malloc (n * sizeof (*encs));
+   unsigned int  sum   = 0;
+
+   for (int i = 0; i < n; i++)
+   {
+      masks[i] = occupancy ();
+      pats [i] = BTE_wordPrepare (masks[i]);
+      sizes[i] = BTE_wordSize    (masks[i], pats[i]);
+      encs [i] = BTE_wordEncode  (masks[i], pats[i], sizes[i]);
+   }
+
+   printf ("Timing: %d occupancy masks, %d passes\n", n, niter);
+
+   // Prepare + size + encode, as done per channel
+   uint64_t beg = now_ns ();
+   for (int iter = 0; iter < niter; iter++)
+   {
+      for (int i = 0; i < n; i++)
+      {
+         unsigned int p  = ref_wordPrepare (masks[i]);
+         unsigned int ss = ref_wordSize    (masks[i], p);
+         sum += ref_wordEncode (masks[i], p, ss);
+      }
+   }
+   uint64_t rns = now_ns () - beg;
+
+   beg = now_ns ();
+   for (int iter = 0; iter < niter; iter++)
+   {
+      for (int i = 0; i < n; i++)
+      {
+         unsigned int p  = BTE_wordPrepare (masks[i]);
+         unsigned int ss = BTE_wordSize    (masks[i], p);
+         sum += BTE_wordEncode (masks[i], p, ss);
+      }
+   }
+   report ("encode", n, niter, rns, now_ns () - beg);
+
+   beg = now_ns ();
+   for (int iter = 0; iter < niter; iter++)
+   {
+      for (int i = 0; i < n; i++)
+      {
+         int nbits;
+         sum += ref_wordDecode (encs[i], sizes[i] >> 16, &nbits) + nbits;
+      }
+   }
+   rns = now_ns () - beg;
+
+   beg = now_ns ();
+   for (int iter = 0; iter < niter; iter++)
+   {
+      for (int i = 0; i < n; i++)
+      {
+         int nbits;
+         sum += BTD_wordDecode (encs[i], sizes[i] >> 16, &nbits) + nbits;
+      }
+   }
+   report ("decode", n, niter, rns, now_ns () - beg);
+
+   // Keeps the loops from being optimized away
+   if (sum == 0x5a5a5a5a) printf ("\n");
+
+   free (encs);
+   free (sizes);
+   free (pats);
+   free (masks);
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Main entry point
+  \retval 0, the tables match the reference
+  \retval 1, a mismatch was found
+
+  \param[in] argc The count of command line arguments
+  \param[in] argv The vector of command line arguments
+                                                                          */
+/* ---------------------------------------------------------------------- */
+int main (int argc, char *const argv[])
+{
+   int quick = 0;
+   int n     = 1 << 16;
+   int niter = 100;
+   int c;
+
+   while ( (c = getopt (argc, argv, "q:n:i:")) != EOF)
+   {
+      if      (c == 'q') quick = strtol (optarg, NULL, 0);
+      else if (c == 'n') n     = strtol (optarg, NULL, 0);
+      else if (c == 'i') niter = strtol (optarg, NULL, 0);
+      else
+      {
+         printf ("Usage: BinaryTreeBench [-q log2 (mask stride)]"
+                 " [-n masks] [-i passes]\n");
+         return -1;
+      }
+   }
+
+   if (quick < 0 || quick > 31 || n <= 0 || niter <= 0)
+   {
+      printf ("Invalid -q, -n or -i\n");
+      return -1;
+   }
+
+   uint64_t nerrs = check_short ();
+   printf ("Short: all 65536 inputs x 4 schemes %s\n", nerrs ? "FAILED" : "ok");
+
+
+   // ------------------------------------------------------------
+   // With -q, an odd multiplier spreads the masks checked over all
+   // 32 bits and every mask confined to either half is added
+   // ------------------------------------------------------------
+   uint64_t nmasks = 1ULL << (32 - quick);
+   uint64_t nwerrs = 0;
+   for (uint64_t i = 0; i < nmasks; i++)
+   {
+      unsigned int w = quick ? (unsigned int)(i * 0x9e3779b1u) : i;
+      nwerrs += check_word (w);
+   }
+   for (unsigned int s = 0; quick && s < 0x10000; s++)
+   {
+      nwerrs += check_word (s) + check_word (s << 16);
+   }
+   printf ("Words: %" PRIu64 " masks %s\n", nmasks, nwerrs ? "FAILED" : "ok");
+
+   srand48 (1);
+   bench (n, niter);
+
+   return nerrs || nwerrs ? 1 : 0;
+}
+/* ---------------------------------------------------------------------- */
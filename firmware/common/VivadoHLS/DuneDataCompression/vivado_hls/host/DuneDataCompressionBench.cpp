@@ -0,0 +1,954 @@
+// -*-Mode: C++;-*-
+
+
+/* ---------------------------------------------------------------------- *//*!
+ *
+ *  @file     DuneDataCompressionBench.cpp
+ *  @brief    Host benchmark of the DUNE compression C++ model
+ *  @verbatim
+ *                               Copyright 2018
+ *                                    by
+ *
+ *                       The Board of Trustees of the
+ *                    Leland Stanford Junior University.
+ *                           All rights reserved.
+ *
+ *  @endverbatim
+ *
+ *  @par Facility:
+ *  DUNE
+ *
+ *  @author
+ *  russell@slac.stanford.edu
+ *
+ *  @par Date created:
+ *  2018.07.27
+ *
+ * @par Credits:
+ * SLAC
+ *
+\* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *\
+
+   HISTORY
+   -------
+
+   DATE       WHO WHAT
+   ---------- --- ---------------------------------------------------------
+   2018.08.17 jjr Reports the percentage of channels sent raw, -X fails
+                  a run sending more
+   2018.07.31 jjr Added -o to append the results to a trend file, -l to
+                  label them and -A for saturating tracks. Reports the
+                  largest packet against MODULE_K_MAXSIZE_OB.
+   2018.07.31 jjr Added -g to generate the ADCs with WibGenerate.h
+   2018.07.30 jjr Reports the time to fill a packet, the packet length is
+                  a build choice, see the Makefile's sizes target
+   2018.07.29 jjr Added -s to compare with the software encoder
+   2018.07.28 jjr Added -R to compare with the histogram models carried
+                  across packets
+   2018.07.27 jjr Added -P to compare the predictors on the same packets
+                  and -c for a synthetic common mode
+   2018.07.27 jjr Created
+
+\* ---------------------------------------------------------------------- */
+
+
+
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'DUNE Data compression'.
+// It is subject to the license terms in the LICENSE.txt file found in the
+// top-level directory of this distribution and at:
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html.
+// No part of 'DUNE Data compression', including this file,
+// may be copied, modified, propagated, or distributed except according to
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+
+
+#define __STDC_FORMAT_MACROS
+
+#include "DuneDataCompressionCore.h"
+#include "DuneDataCompressionTypes.h"
+#include "WibFrame.h"
+#include "AxisIO_test.h"
+
+// The software decoder, used to check the round trip, and the
+// software encoder, which must produce the same packets
+#include "WibDecode.h"
+#include "WibEncode.h"
+
+// The readout's packet geometry, from the same PACKET_B_NSAMPLES
+#include "PacketGeometry.h"
+
+// The synthetic data generator shared with the software tools
+#include "WibGenerate.h"
+
+static_assert (ReadoutGeometry::NSamples == PACKET_K_NSAMPLES,
+               "Readout and model packet lengths differ");
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <fcntl.h>
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+ *
+ *  \struct _Trend
+ *  \brief  Where the machine readable results go, one CSV line per
+ *          encoder and predictor
+ *
+\* ---------------------------------------------------------------------- */
+typedef struct _Trend
+{
+   FILE          *fp;  /*!< The trend file, NULL if none                  */
+   char const *input;  /*!< The label of the input, the first column      */
+}
+Trend;
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- */
+/* Local Prototypes                                                       */
+/* ---------------------------------------------------------------------- */
+static uint64_t         now_ns ();
+static double            gauss ();
+static void     fill_synthetic (uint16_t adcs[PACKET_K_NSAMPLES][MODULE_K_NCHANNELS],
+                                double                                      noise,
+                                double                                         cm,
+                                int                                          seed);
+static int           read_adcs (int                                            fd,
+                                uint16_t adcs[PACKET_K_NSAMPLES][MODULE_K_NCHANNELS]);
+static int               drain (uint64_t                                     *buf,
+                                int                                         maxn64,
+                                AxisOut                                     &mAxis);
+static int             compare (uint16_t const                              *dcd,
+                                uint16_t const adcs[PACKET_K_NSAMPLES][MODULE_K_NCHANNELS],
+                                int                                       ipacket);
+static int           count_raw (uint64_t const                              *pkt,
+                                int                                           n64);
+static void             record (Trend const                                *trend,
+                                char const                               *encoder,
+                                int                                     predictor,
+                                uint32_t                                   resync,
+                                int                                      npackets,
+                                uint64_t                                    nbits,
+                                int                                        maxn64,
+                                double                                       rate,
+                                int                                         nerrs);
+static int                 run (uint16_t const (*adcs)[PACKET_K_NSAMPLES][MODULE_K_NCHANNELS],
+                                int                                      npackets,
+                                int                                     predictor,
+                                uint32_t                                   resync,
+                                bool                                        check,
+                                double                                     maxraw,
+                                int                                      nthreads,
+                                Trend const                                *trend,
+                                uint64_t                                   *nbits);
+static int            software (uint16_t const (*adcs)[PACKET_K_NSAMPLES][MODULE_K_NCHANNELS],
+                                int                                      npackets,
+                                int                                     predictor,
+                                int                                      nthreads,
+                                uint64_t const                              *pkts,
+                                int const                                   *n64s,
+                                double                                     hlsRate,
+                                Trend const                                *trend);
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+ *
+ *  \brief  Returns the current monotonic time in nanoseconds
+ *
+\* ---------------------------------------------------------------------- */
+static uint64_t now_ns ()
+{
+   struct timespec ts;
+   clock_gettime (CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+ *
+ *  \brief  Returns a normally distributed random number
+ *
+\* ---------------------------------------------------------------------- */
+static double gauss ()
+{
+   double u1 = (lrand48 () + 1.0) / 2147483649.0;
+   double u2 =  lrand48 ()        / 2147483648.0;
+   return sqrt (-2.0 * log (u1)) * cos (2.0 * M_PI * u2);
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+ *
+ *   \brief Fills one packet of ADCs with a per channel pedestal, gaussian
+ *          noise, a common mode shared by each group of 16 channels and
+ *          an occasional pulse
+ *
+ *   \param[out]  adcs  The ADCs, time-major as the WIB frames carry them
+ *   \param[in]  noise  The RMS of the noise, in ADC counts
+ *   \param[in]     cm  The RMS of the common mode, in ADC counts
+ *   \param[in]   seed  The seed for the per channel pedestals, held fixed
+ *                      so that the pedestals do not change between packets
+ *
+\* ---------------------------------------------------------------------- */
+static void fill_synthetic (uint16_t adcs[PACKET_K_NSAMPLES][MODULE_K_NCHANNELS],
+                            double                                      noise,
+                            double                                         cm,
+                            int                                          seed)
+{
+   unsigned short xsubi[3] = { 0x330e, (unsigned short)seed, 0 };
+   static double  cms[MODULE_K_NCHANNELS / 16][PACKET_K_NSAMPLES];
+
+   for (int igroup = 0; igroup < MODULE_K_NCHANNELS / 16; igroup++)
+   {
+      for (int it = 0; it < PACKET_K_NSAMPLES; it++)
+      {
+         cms[igroup][it] = cm * gauss ();
+      }
+   }
+
+   for (int ichan = 0; ichan < MODULE_K_NCHANNELS; ichan++)
+   {
+      double ped   = 400 + (nrand48 (xsubi) % 1600);
+      int    pulse = lrand48 () % (4 * PACKET_K_NSAMPLES);
+
+      for (int it = 0; it < PACKET_K_NSAMPLES; it++)
+      {
+         double adc = ped + noise * gauss () + cms[ichan / 16][it];
+
+         int dt = it - pulse;
+         if (dt >= 0 && dt < 32) adc += 1200.0 * dt * exp (-dt / 4.0) / 4.0;
+
+         if (adc < 0)     adc = 0;
+         if (adc > 0xfff) adc = 0xfff;
+         adcs[it][ichan] = (uint16_t)adc;
+      }
+   }
+
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+ *
+ *   \brief  Reads one packet of ADCs from a file in the test bench format
+ *   \retval 1, if a full packet was read
+ *   \retval 0, at the end of the file
+ *
+ *   \param[in]    fd  The file descriptor of the ADC file
+ *   \param[out] adcs  The ADCs
+ *
+\* ---------------------------------------------------------------------- */
+static int read_adcs (int                                            fd,
+                      uint16_t adcs[PACKET_K_NSAMPLES][MODULE_K_NCHANNELS])
+{
+   size_t  nbytes = sizeof (uint16_t) * PACKET_K_NSAMPLES * MODULE_K_NCHANNELS;
+   ssize_t  nread = read (fd, adcs, nbytes);
+   return nread == (ssize_t)nbytes;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+ *
+ *   \brief  Drains the output AXI stream
+ *   \return The number of 64-bit words drained or -1 if the packet
+ *           overflowed the buffer
+ *
+ *   \param[out]    buf  The buffer to receive the data
+ *   \param[in]  maxn64  The size of the buffer, in 64-bit words
+ *   \param[in]   mAxis  The output AXI stream
+ *
+\* ---------------------------------------------------------------------- */
+static int drain (uint64_t *buf, int maxn64, AxisOut &mAxis)
+{
+   int n64 = 0;
+   while (!mAxis.empty ())
+   {
+      AxisOut_t out = mAxis.read ();
+      if (n64 >= maxn64) return -1;
+      buf[n64++] = out.data;
+   }
+
+   return n64;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+ *
+ *   \brief  Compares the decoded ADCs with the originals
+ *   \return The number of mismatches
+ *
+ *   \param[in]     dcd  The decoded ADCs, channel-major
+ *   \param[in]    adcs  The original ADCs, time-major
+ *   \param[in] ipacket  The packet number, for the error messages
+ *
+\* ---------------------------------------------------------------------- */
+static int compare (uint16_t const                              *dcd,
+                    uint16_t const adcs[PACKET_K_NSAMPLES][MODULE_K_NCHANNELS],
+                    int                                       ipacket)
+{
+   int nerrs = 0;
+
+   for (int ichan = 0; ichan < MODULE_K_NCHANNELS; ichan++)
+   {
+      for (int it = 0; it < PACKET_K_NSAMPLES; it++)
+      {
+         uint16_t got = dcd[ichan * PACKET_K_NSAMPLES + it];
+         if (got != adcs[it][ichan] && nerrs++ < 10)
+         {
+            printf ("Error packet %d chan:tick %3d:%4d %3.3" PRIx16 " != %3.3" PRIx16 "\n",
+                    ipacket, ichan, it, got, adcs[it][ichan]);
+         }
+      }
+   }
+
+   return nerrs;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+ *
+ *   \brief  Counts the channels of a packet that were sent raw
+ *   \return The number of raw channels, 0 if the TOC is not valid
+ *
+ *   \param[in]  pkt  The packet
+ *   \param[in]  n64  Its length, in 64-bit words
+ *
+\* ---------------------------------------------------------------------- */
+static int count_raw (uint64_t const *pkt, int n64)
+{
+   WibDecodeToc toc;
+   if (wibDecode_toc (&toc, pkt, n64) != WIBDECODE_K_OK) return 0;
+
+   int nraw = 0;
+   for (int ichan = 0; ichan < toc.nchans; ichan++)
+   {
+      if (wibDecode_isRaw (pkt, n64, toc.offsets[ichan])) nraw++;
+   }
+
+   return nraw;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+ *
+ *   \brief  Appends one result to the trend file
+ *
+ *   \param[in]     trend  The trend file and input label
+ *   \param[in]   encoder  "model" or "software"
+ *   \param[in] predictor  The predictor, a PREDICTOR_K value
+ *   \param[in]    resync  The histogram model resynchronization period
+ *   \param[in]  npackets  The number of packets
+ *   \param[in]     nbits  The total number of output bits
+ *   \param[in]    maxn64  The largest packet, in 64-bit words
+ *   \param[in]      rate  The rate, in packets/s
+ *   \param[in]     nerrs  The number of errors, round trip, differences
+ *                         or packets larger than MODULE_K_MAXSIZE_OB
+ *
+ *   \par
+ *    The columns are
+ *
+ *        input,encoder,predictor,resync,nsamples,nchannels,packets,
+ *        bits_per_sample,max_n64,maxsize_ob,packets_per_s,errors
+ *
+ *    The header is written when the file is empty, so successive runs
+ *    append to the same file and can be plotted against each other.
+ *
+\* ---------------------------------------------------------------------- */
+static void record (Trend const  *trend,
+                    char const *encoder,
+                    int       predictor,
+                    uint32_t     resync,
+                    int        npackets,
+                    uint64_t      nbits,
+                    int          maxn64,
+                    double         rate,
+                    int           nerrs)
+{
+   if (trend == NULL || trend->fp == NULL) return;
+
+   if (ftell (trend->fp) == 0)
+   {
+      fprintf (trend->fp,
+               "input,encoder,predictor,resync,nsamples,nchannels,packets,"
+               "bits_per_sample,max_n64,maxsize_ob,packets_per_s,errors\n");
+   }
+
+   double nsamples = (double)npackets * PACKET_K_NSAMPLES * MODULE_K_NCHANNELS;
+   fprintf (trend->fp, "%s,%s,%d,%u,%d,%d,%d,%.4f,%d,%d,%.1f,%d\n",
+            trend->input,
+            encoder,
+            predictor,
+            resync,
+            PACKET_K_NSAMPLES,
+            MODULE_K_NCHANNELS,
+            npackets,
+            nbits / nsamples,
+            maxn64,
+            MODULE_K_MAXSIZE_OB,
+            rate,
+            nerrs);
+   fflush (trend->fp);
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+ *
+ *   \brief  Compresses a set of packets with one predictor and reports
+ *           the rate, bits per sample and the compression ratio
+ *   \return The number of round trip errors
+ *
+ *   \param[in]      adcs  The packets of ADCs
+ *   \param[in]  npackets  The number of packets
+ *   \param[in] predictor  The predictor, a PREDICTOR_K value
+ *   \param[in]    resync  The histogram model resynchronization period,
+ *                         0 to send all histograms in full
+ *   \param[in]     check  If true, check the round trip
+ *   \param[in]    maxraw  If not negative, the largest percentage of the
+ *                         channels that may be sent raw, more is an error
+ *   \param[in]  nthreads  If non-zero, the number of threads to run the
+ *                         software encoder with. Its packets must be
+ *                         the same as the model's. Only done when all
+ *                         histograms are sent in full, \a resync = 0.
+ *   \param[in]     trend  Where to record the results, may be NULL
+ *   \param[out]    nbits  Returned as the total number of output bits
+ *
+ *   \par
+ *    Only the call to DuneDataCompressionCore is timed, the filling of
+ *    the input stream and the draining and checking of the output are
+ *    not. Outside of synthesis the model traces its output words and
+ *    checks each histogram encoding, so the rate is that of the model
+ *    as built for C simulation.
+ *
+ *    A packet larger than MODULE_K_MAXSIZE_OB, the size the firmware
+ *    reserves for one, is counted as an error. Without HISTOGRAM_MODEL_RAW
+ *    this is not a bound and is not checked.
+ *
+\* ---------------------------------------------------------------------- */
+static int run (uint16_t const (*adcs)[PACKET_K_NSAMPLES][MODULE_K_NCHANNELS],
+                int                                            npackets,
+                int                                           predictor,
+                uint32_t                                         resync,
+                bool                                              check,
+                double                                           maxraw,
+                int                                            nthreads,
+                Trend const                                      *trend,
+                uint64_t                                         *nbits)
+{
+   static uint16_t  dcd[MODULE_K_NCHANNELS * PACKET_K_NSAMPLES];
+   static uint64_t  buf[MODULE_K_MAXSIZE_OB + 0x800];
+   int const       maxn64 = sizeof (buf) / sizeof (*buf);
+
+   // The model's packets are kept for the software encoder comparison
+   bool           keep = nthreads > 0 && resync == 0;
+   uint64_t      *pkts = keep ? (uint64_t *)malloc (npackets * sizeof (buf))  : NULL;
+   int           *n64s = keep ? (int      *)malloc (npackets * sizeof (int))  : NULL;
+
+   // The decoder's saved models start out empty, as the encoder's do
+   static WibDecodeModels models;
+   memset (&models, 0, sizeof (models));
+
+   // The streams are drained after each packet, so they are reused
+   static Source              src;
+   static MyStreamOut mAxis ("Out");
+   ModuleIdx_t      moduleIdx = 1;
+   ModuleConfig          config = ModuleConfig  ();
+   MonitorModule        monitor = MonitorModule ();
+   uint64_t       timestamp = 0x00800000LL;
+   uint64_t         elapsed = 0;
+   int                worst = 0;
+   int                nerrs = 0;
+   uint64_t            nraw = 0;
+
+   config.init      = -1;
+   config.mode      = MODE_K_COMPRESS;
+   config.predictor = predictor;
+   config.resync    = resync;
+   *nbits           = 0;
+
+   for (int ipacket = 0; ipacket < npackets; ipacket++)
+   {
+      for (int isample = 0; isample < PACKET_K_NSAMPLES; isample++)
+      {
+         src.fill_frame (timestamp, (uint16_t *)adcs[ipacket][isample], 1, 0, isample);
+         timestamp += 25;
+      }
+      src.drainCheck ();
+
+
+      // -------------------
+      // Compress the packet
+      // -------------------
+      uint64_t beg = now_ns ();
+      DuneDataCompressionCore (src.m_src, mAxis, moduleIdx, config, monitor);
+      elapsed    += now_ns () - beg;
+      config.init = 0;
+
+      int n64 = drain (buf, maxn64, mAxis);
+      if (n64 < 0)
+      {
+         printf ("Error packet %d overflowed the output buffer\n", ipacket);
+         free (pkts);
+         free (n64s);
+         return nerrs + 1;
+      }
+
+      *nbits += 64 * (uint64_t)n64;
+      nraw   += count_raw (buf, n64);
+
+      if (n64 > worst) worst = n64;
+      if (HISTOGRAM_MODEL_RAW && n64 > MODULE_K_MAXSIZE_OB)
+      {
+         printf ("Error packet %d is %d words, more than the %d reserved\n",
+                 ipacket, n64, MODULE_K_MAXSIZE_OB);
+         nerrs += 1;
+      }
+
+      if (keep)
+      {
+         memcpy (pkts + ipacket * maxn64, buf, n64 * sizeof (*buf));
+         n64s[ipacket] = n64;
+      }
+
+
+      // ---------------------------------------------
+      // Check the round trip with the software decoder
+      // ---------------------------------------------
+      if (check)
+      {
+         WibDecodeToc toc;
+         int status = wibDecode_packet (dcd, PACKET_K_NSAMPLES, buf, n64, &toc,
+                                       &models);
+         if (status)
+         {
+            printf ("Error packet %d decode status %d\n", ipacket, status);
+            nerrs += 1;
+         }
+         else if (toc.predictor != predictor)
+         {
+            printf ("Error packet %d TOC predictor %d != %d\n",
+                    ipacket, toc.predictor, predictor);
+            nerrs += 1;
+         }
+         else
+         {
+            nerrs += compare (dcd, adcs[ipacket], ipacket);
+         }
+      }
+   }
+
+
+   static char const *Names[PREDICTOR_K_COUNT] =
+   { "previous", "order2", "median", "common" };
+
+   double nsamples = (double)npackets * PACKET_K_NSAMPLES * MODULE_K_NCHANNELS;
+   double   nbytes = (double)npackets * PACKET_K_NSAMPLES * sizeof (WibFrame);
+   double     secs = elapsed * 1.e-9;
+   double      raw = 100.0 * nraw / ((double)npackets * MODULE_K_NCHANNELS);
+
+   if (maxraw >= 0 && raw > maxraw)
+   {
+      printf ("Error %.1f%% of the channels were sent raw, more than %.1f%%\n",
+              raw, maxraw);
+      nerrs += 1;
+   }
+
+   printf ("%-9s %6u %7.3f %7.2f %7.2f %9.1f %9.2f %5.1f%% %5.1f%%  %s\n",
+           Names[predictor],
+           resync,
+           *nbits / nsamples,
+           12.0 * nsamples / *nbits,
+           8.0  * nbytes   / *nbits,
+           npackets / secs,
+           secs * 1.e3 / npackets,
+           100.0 * worst / MODULE_K_MAXSIZE_OB,
+           raw,
+           check ? (nerrs ? "FAILED" : "ok") : "not checked");
+
+   record (trend, "model", predictor, resync, npackets, *nbits, worst,
+           npackets / secs, nerrs);
+
+   if (keep)
+   {
+      nerrs += software (adcs, npackets, predictor, nthreads, pkts, n64s,
+                         npackets / secs, trend);
+   }
+
+   free (pkts);
+   free (n64s);
+   return nerrs;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+ *
+ *   \brief  Compresses the same packets with the software encoder and
+ *           checks that they are identical to the model's
+ *   \return The number of packets that differ
+ *
+ *   \param[in]      adcs  The packets of ADCs
+ *   \param[in]  npackets  The number of packets
+ *   \param[in] predictor  The predictor, a PREDICTOR_K value
+ *   \param[in]  nthreads  The number of encoding threads
+ *   \param[in]      pkts  The model's packets, MODULE_K_MAXSIZE_OB +
+ *                         0x800 words apart
+ *   \param[in]      n64s  Their lengths, in 64-bit words
+ *   \param[in]   hlsRate  The model's rate, in packets/s
+ *   \param[in]     trend  Where to record the results, may be NULL
+ *
+ *   \par
+ *    The WIB header words and status are taken from the model's
+ *    packets. All packets are handed to the pool as one set, which is
+ *    repeated a few times so that the time is not dominated by the
+ *    start up of the threads.
+ *
+\* ---------------------------------------------------------------------- */
+static int software (uint16_t const (*adcs)[PACKET_K_NSAMPLES][MODULE_K_NCHANNELS],
+                     int                                            npackets,
+                     int                                           predictor,
+                     int                                            nthreads,
+                     uint64_t const                                    *pkts,
+                     int const                                         *n64s,
+                     double                                          hlsRate,
+                     Trend const                                       *trend)
+{
+   int const     pitch = MODULE_K_MAXSIZE_OB + 0x800;
+   int const    maxn64 = WIBENCODE_K_MAXN64 (MODULE_K_NCHANNELS, PACKET_K_NSAMPLES, 32);
+   WibEncodeJob  *jobs = (WibEncodeJob *)malloc (npackets * sizeof (*jobs));
+   uint64_t      *outs = (uint64_t     *)malloc (npackets * maxn64 * sizeof (*outs));
+   int const   nrepeat = 4;
+   uint64_t    elapsed = 0;
+   uint64_t      nbits = 0;
+   uint64_t       nraw = 0;
+   int           worst = 0;
+   int           ndiff = 0;
+
+   WibEncodePool pool;
+   wibEncodePool_create (&pool, nthreads);
+
+   for (int ipacket = 0; ipacket < npackets; ipacket++)
+   {
+      uint64_t const *pkt = pkts + ipacket * pitch;
+      WibEncodeJob   *job = jobs + ipacket;
+      job->pkt       = outs + ipacket * maxn64;
+      job->maxn64    = maxn64;
+      job->adcs      = &adcs[ipacket][0][0];
+      job->pitch     = MODULE_K_NCHANNELS;
+      job->nchans    = MODULE_K_NCHANNELS;
+      job->nsamples  = PACKET_K_NSAMPLES;
+      job->predictor = predictor;
+      job->hdrs      = pkt + 1;
+      job->nhdrs     = ((pkt[0] >> 8) & 0xffff) - 1;
+      job->status    = pkt[0] >> 32;
+   }
+
+   for (int irepeat = 0; irepeat < nrepeat; irepeat++)
+   {
+      uint64_t beg = now_ns ();
+      wibEncodePool_encode (&pool, jobs, npackets);
+      elapsed += now_ns () - beg;
+   }
+
+   for (int ipacket = 0; ipacket < npackets; ipacket++)
+   {
+      WibEncodeJob const *job = jobs + ipacket;
+      int                 n64 = n64s[ipacket];
+      nbits += 64 * (uint64_t)job->n64;
+      nraw  += count_raw (job->pkt, job->n64);
+      if ((int)job->n64 > worst) worst = job->n64;
+
+      if ((int)job->n64 != n64
+      ||  memcmp (job->pkt, pkts + ipacket * pitch, n64 * sizeof (uint64_t)))
+      {
+         if (ndiff++ < 10)
+         {
+            printf ("Error packet %d software encoding differs, %u:%d words\n",
+                    ipacket, job->n64, n64);
+         }
+      }
+   }
+
+   wibEncodePool_destroy (&pool);
+
+   double nsamples = (double)npackets * PACKET_K_NSAMPLES * MODULE_K_NCHANNELS;
+   double   nbytes = (double)npackets * PACKET_K_NSAMPLES * sizeof (WibFrame);
+   double     secs = elapsed * 1.e-9 / nrepeat;
+   char    threads[16];
+   snprintf (threads, sizeof (threads), "%dT", nthreads);
+
+   printf ("%-9s %6s %7.3f %7.2f %7.2f %9.1f %9.2f %5.1f%% %5.1f%%  %s, %.1fx model\n",
+           "software",
+           threads,
+           nbits / nsamples,
+           12.0 * nsamples / nbits,
+           8.0  * nbytes   / nbits,
+           npackets / secs,
+           secs * 1.e3 / npackets,
+           100.0 * worst / MODULE_K_MAXSIZE_OB,
+           100.0 * nraw / ((double)npackets * MODULE_K_NCHANNELS),
+           ndiff ? "DIFFERS" : "identical",
+           npackets / secs / hlsRate);
+
+   record (trend, "software", predictor, 0, npackets, nbits, worst,
+           npackets / secs, ndiff);
+
+   free (outs);
+   free (jobs);
+   return ndiff;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+ *
+ *   \brief  Drives the compression model with synthetic or recorded
+ *           packets, once for each of the requested predictors and,
+ *           if -R is given, again with the histogram models carried
+ *           across packets. The software encoder is compared with the
+ *           model unless -s 0 is given. With -o the results are also
+ *           appended to a CSV file for tracking over time.
+ *
+ *   \param[in] argc The  count of command line arguments
+ *   \param[in] argv The vector of command line arguments
+ *
+ *   \par
+ *    All packets are read or generated up front so that every predictor
+ *    sees exactly the same input. The model's std::cout tracing is muted
+ *    unless -v is given, the results are reported with printf.
+ *
+\* ---------------------------------------------------------------------- */
+int main (int argc, char *const argv[])
+{
+   int         npackets = 16;
+   double         noise = 3.0;
+   double            cm = 0.0;
+   char const *filename = NULL;
+   char const    *plist = "0";
+   bool           check = true;
+   bool           quiet = true;
+   bool        generate = false;
+   double     amplitude = 0.0;
+   char const  *trendfn = NULL;
+   char const    *label = NULL;
+   uint32_t      resync = 0;
+   int         nthreads = 1;
+   double        maxraw = -1;
+   int c;
+
+   while ( (c = getopt (argc, argv, "p:r:c:a:P:R:s:gA:o:l:X:xv")) != EOF)
+   {
+      if      (c == 'p') npackets = strtol (optarg, NULL, 0);
+      else if (c == 'r') noise    = strtod (optarg, NULL);
+      else if (c == 'c') cm       = strtod (optarg, NULL);
+      else if (c == 'a') filename = optarg;
+      else if (c == 'P') plist    = optarg;
+      else if (c == 'R') resync   = strtoul (optarg, NULL, 0);
+      else if (c == 's') nthreads = strtol  (optarg, NULL, 0);
+      else if (c == 'g') generate = true;
+      else if (c == 'A') amplitude= strtod  (optarg, NULL);
+      else if (c == 'o') trendfn  = optarg;
+      else if (c == 'l') label    = optarg;
+      else if (c == 'X') maxraw   = strtod  (optarg, NULL);
+      else if (c == 'x') check    = false;
+      else if (c == 'v') quiet    = false;
+      else
+      {
+         printf ("Usage: DuneDataCompressionBench [-p npackets] [-r noise rms]"
+                 " [-c common mode rms] [-a adcfile] [-P predictors]"
+                 " [-R resync] [-s nthreads] [-g] [-A amplitude]"
+                 " [-o trendfile] [-l label] [-X maxraw] [-x] [-v]\n"
+                 "  -a  Read the ADCs from a test bench file, uint16_t[%d][%d]"
+                 " per packet\n"
+                 "  -P  Comma separated list of predictors, 0-%d, default 0\n"
+                 "  -R  Also run with the histogram models carried across\n"
+                 "      packets, all sent in full every resync packets\n"
+                 "  -s  Threads for the software encoder, default 1,"
+                 " 0 to skip it\n"
+                 "  -g  Generate the ADCs with WibGenerate.h, coherent\n"
+                 "      noise in groups of 16, tracks and stuck codes\n"
+                 "  -A  With -g, the mean track pulse height, large values\n"
+                 "      saturate the ADCs\n"
+                 "  -o  Append the results to this CSV file\n"
+                 "  -l  Label the results in the CSV file, default the input\n"
+                 "  -X  Fail if more than this percentage of the channels\n"
+                 "      are sent raw\n"
+                 "  -x  Do not check the round trip\n"
+                 "  -v  Keep the model's diagnostic output\n",
+                 PACKET_K_NSAMPLES, MODULE_K_NCHANNELS, PREDICTOR_K_COUNT - 1);
+         return -1;
+      }
+   }
+
+   if (npackets <= 0)
+   {
+      printf ("Error: no packets requested\n");
+      return -1;
+   }
+
+
+   // -----------------------------
+   // Get all the ADCs up front
+   // -----------------------------
+   typedef uint16_t Packet[PACKET_K_NSAMPLES][MODULE_K_NCHANNELS];
+   Packet *adcs = (Packet *)malloc (npackets * sizeof (Packet));
+
+   if (filename)
+   {
+      int fd = open (filename, O_RDONLY);
+      if (fd < 0)
+      {
+         printf ("Error: could not open %s\n", filename);
+         free (adcs);
+         return -1;
+      }
+
+      int n;
+      for (n = 0; n < npackets; n++)
+      {
+         if (!read_adcs (fd, adcs[n])) break;
+      }
+      close (fd);
+      npackets = n;
+   }
+   else if (generate)
+   {
+      WibGenerateConfig cfg;
+      WibGenerate       gen;
+
+      wibGenerateConfig_init (&cfg);
+      cfg.noise             = noise;
+      cfg.coherent          = cm;
+      cfg.stuck_fraction    = 0.05;
+      cfg.stuck_probability = 0.02;
+      if (amplitude > 0) cfg.track_amplitude = amplitude;
+      if (wibGenerate_init (&gen, &cfg) != 0)
+      {
+         printf ("Error: can not generate noise %.1f, common mode %.1f\n",
+                 noise, cm);
+         free (adcs);
+         return -1;
+      }
+
+      for (int n = 0; n < npackets; n++)
+      {
+         for (int it = 0; it < PACKET_K_NSAMPLES; it++)
+         {
+            wibGenerate_adcs (&gen, adcs[n][it]);
+         }
+      }
+   }
+   else
+   {
+      srand48 (1);
+      for (int n = 0; n < npackets; n++)
+      {
+         fill_synthetic (adcs[n], noise, cm, 1);
+      }
+   }
+
+   if (npackets == 0)
+   {
+      printf ("Error: no packets processed\n");
+      free (adcs);
+      return -1;
+   }
+
+
+   Trend trend;
+   trend.input = label    ? label
+               : filename ? filename
+               : generate ? "WibGenerate" : "synthetic";
+   trend.fp    = NULL;
+   if (trendfn)
+   {
+      trend.fp = fopen (trendfn, "a");
+      if (trend.fp == NULL)
+      {
+         printf ("Error: could not open %s\n", trendfn);
+         free (adcs);
+         return -1;
+      }
+   }
+
+   printf ("Input:     %s, %d packets x %d channels x %d samples\n"
+           "Latency:   %.1f us to fill a packet, plus its ms/packet below\n"
+           "Predictor resync bits/smp ratio12 ratioWF packets/s ms/packet  worst    raw  round trip\n",
+           trend.input,
+           npackets, MODULE_K_NCHANNELS, PACKET_K_NSAMPLES,
+           1.e-3 * ReadoutGeometry::Ticks * TimingClockTicks::CLOCK_PERIOD);
+
+   std::streambuf *sav = std::cout.rdbuf ();
+   if (quiet) std::cout.rdbuf (NULL);
+
+   int nerrs = 0;
+   for (char const *p = plist; *p; )
+   {
+      char *end;
+      long predictor = strtol (p, &end, 0);
+      if (end == p || predictor < 0 || predictor >= PREDICTOR_K_COUNT)
+      {
+         printf ("Error: bad predictor list %s\n", plist);
+         nerrs += 1;
+         break;
+      }
+
+      uint64_t full;
+      nerrs += run (adcs, npackets, predictor, 0, check, maxraw, nthreads,
+                    &trend, &full);
+
+      if (resync)
+      {
+         uint64_t same;
+         nerrs += run (adcs, npackets, predictor, resync, check, maxraw, 0,
+                       &trend, &same);
+         printf ("%-9s saved %.1f bits/packet, %.2f%%\n", "",
+                 ((double)full - (double)same) / npackets,
+                 100.0 * ((double)full - (double)same) / full);
+      }
+
+      p      = *end == ',' ? end + 1 : end;
+   }
+
+   std::cout.rdbuf (sav);
+   std::cout.clear ();
+   if (trend.fp) fclose (trend.fp);
+   free (adcs);
+
+   return nerrs ? 1 : 0;
+}
+/* ---------------------------------------------------------------------- */
@@ -0,0 +1,78 @@
+// -*-Mode: C++;-*-
+
+#ifndef _HOST_AP_AXI_SDATA_H_
+#define _HOST_AP_AXI_SDATA_H_
+
+
+/* ---------------------------------------------------------------------- *//*!
+ *
+ *  @file     ap_axi_sdata.h
+ *  @brief    Lightweight host stand-in for the Vivado HLS AXI stream
+ *            side-channel structures
+ *  @verbatim
+ *                               Copyright 2018
+ *                                    by
+ *
+ *                       The Board of Trustees of the
+ *                    Leland Stanford Junior University.
+ *                           All rights reserved.
+ *
+ *  @endverbatim
+ *
+ *  @par Facility:
+ *  DUNE
+ *
+ *  @author
+ *  <russell@slac.stanford.edu>
+ *
+ *  @par Date created:
+ *  2018/07/27
+ *
+ * @par Credits:
+ * SLAC
+ *
+\* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *\
+
+   HISTORY
+   -------
+
+   DATE       WHO WHAT
+   ---------- --- ---------------------------------------------------------
+   2018.07.27 jjr Created
+
+\* ---------------------------------------------------------------------- */
+
+
+#include "ap_int.h"
+
+
+template<int D, int U, int TI, int TD>
+struct ap_axis
+{
+   ap_int<D>    data;
+   ap_uint<D/8> keep;
+   ap_uint<D/8> strb;
+   ap_uint<U>   user;
+   ap_uint<1>   last;
+   ap_uint<TI>  id;
+   ap_uint<TD>  dest;
+};
+
+
+template<int D, int U, int TI, int TD>
+struct ap_axiu
+{
+   ap_uint<D>   data;
+   ap_uint<D/8> keep;
+   ap_uint<D/8> strb;
+   ap_uint<U>   user;
+   ap_uint<1>   last;
+   ap_uint<TI>  id;
+   ap_uint<TD>  dest;
+};
+
+#endif
@@ -0,0 +1,589 @@
+// -*-Mode: C++;-*-
+
+#ifndef _HOST_AP_INT_H_
+#define _HOST_AP_INT_H_
+
+
+/* ---------------------------------------------------------------------- *//*!
+ *
+ *  @file     ap_int.h
+ *  @brief    Lightweight host stand-in for the Vivado HLS arbitrary
+ *            precision integer types, ap_int<W> and ap_uint<W>
+ *  @verbatim
+ *                               Copyright 2018
+ *                                    by
+ *
+ *                       The Board of Trustees of the
+ *                    Leland Stanford Junior University.
+ *                           All rights reserved.
+ *
+ *  @endverbatim
+ *
+ *  @par Facility:
+ *  DUNE
+ *
+ *  @author
+ *  <russell@slac.stanford.edu>
+ *
+ *  @par Date created:
+ *  2018/07/27
+ *
+ * @par Credits:
+ * SLAC
+ *
+\* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *\
+
+   HISTORY
+   -------
+
+   DATE       WHO WHAT
+   ---------- --- ---------------------------------------------------------
+   2018.07.27 jjr Created
+
+\* ---------------------------------------------------------------------- */
+
+
+/* ---------------------------------------------------------------------- *\
+
+   This only covers what the compression sources use and is meant to
+   let them be built and profiled with a plain g++, it is not a general
+   replacement for the Xilinx headers.
+
+   Widths up to 128 bits are supported. Values are held in the smallest
+   native integer that fits and are always kept truncated to W bits,
+   (sign extended for ap_int).
+
+   Arithmetic, bitwise and comparison operators are done by converting
+   to a native signed integer wide enough to hold the value exactly.
+   This reproduces the ap_int rule that results grow to hold the exact
+   answer, (e.g. the difference of two ap_uint's can be negative), for
+   everything the sources do. As in Vivado, the shift operators and
+   ~ keep the width of the operand, and assignment truncates.
+
+\* ---------------------------------------------------------------------- */
+
+
+// The Xilinx headers bring these in and the sources depend on it
+#include <iostream>
+#include <iomanip>
+#include <stdint.h>
+#include <string.h>
+
+
+namespace ap_host
+{
+   typedef          __int128  int128_t;
+   typedef unsigned __int128 uint128_t;
+
+   /* ------------------------------------------------------------------- */
+   /* A 3-way type selector, T0 if C0, else T1 if C1, else T2             */
+   /* ------------------------------------------------------------------- */
+   template<bool C0, typename T0, bool C1, typename T1, typename T2>
+   struct conditional_t                    { typedef T2 type; };
+
+   template<bool C1, typename T0, typename T1, typename T2>
+   struct conditional_t<true, T0, C1, T1, T2>  { typedef T0 type; };
+
+   template<typename T0, typename T1, typename T2>
+   struct conditional_t<false, T0, true, T1, T2> { typedef T1 type; };
+
+
+   /* ------------------------------------------------------------------- */
+   /* Selects the storage and the conversion types for a given width      */
+   /* ------------------------------------------------------------------- */
+   template<int W, bool S, bool Wide = (W > 64)> struct types;
+
+   template<int W> struct types<W, false, false>
+   {
+      typedef uint64_t store_t;
+      typedef typename
+      conditional_t<(W < 32), int,
+                    (W < 64), long long,
+                              unsigned long long>::type conv_t;
+   };
+
+   template<int W> struct types<W, true, false>
+   {
+      typedef int64_t  store_t;
+      typedef typename
+      conditional_t<(W <= 32), int,
+                    true,      long long,
+                               long long>::type conv_t;
+   };
+
+   template<int W> struct types<W, false, true>
+   {
+      typedef uint128_t store_t;
+      typedef typename
+      conditional_t<(W < 128), int128_t,
+                    true,      uint128_t,
+                               uint128_t>::type conv_t;
+   };
+
+   template<int W> struct types<W, true, true>
+   {
+      typedef int128_t store_t;
+      typedef int128_t  conv_t;
+   };
+}
+
+
+
+template<int W, bool S> class ap_int_base;
+template<int W>         class ap_uint;
+template<int W>         class ap_int;
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+ *
+ *  \class ap_bit_ref
+ *  \brief Reference to a single bit, the result of x[i]
+ *
+\* ---------------------------------------------------------------------- */
+template<int W, bool S>
+class ap_bit_ref
+{
+public:
+   ap_bit_ref (ap_int_base<W,S> &v, int idx) : m_v (v), m_idx (idx) { }
+
+   operator bool  () const { return m_v.test (m_idx); }
+   bool operator ~() const { return !m_v.test (m_idx); }
+   bool operator !() const { return !m_v.test (m_idx); }
+
+   ap_bit_ref &operator = (unsigned long long val)
+   {
+      m_v.set (m_idx, val != 0);
+      return *this;
+   }
+
+   ap_bit_ref &operator = (ap_bit_ref const &rhs)
+   {
+      m_v.set (m_idx, (bool)rhs);
+      return *this;
+   }
+
+   template<int W2, bool S2>
+   ap_bit_ref &operator = (ap_bit_ref<W2,S2> const &rhs)
+   {
+      m_v.set (m_idx, (bool)rhs);
+      return *this;
+   }
+
+private:
+   ap_int_base<W,S> &m_v;
+   int             m_idx;
+};
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+ *
+ *  \class ap_range_ref
+ *  \brief Reference to the bits hi:lo, the result of x(hi,lo) or
+ *         x.range (hi, lo)
+ *
+\* ---------------------------------------------------------------------- */
+template<int W, bool S>
+class ap_range_ref
+{
+public:
+   typedef typename ap_host::types<W,false>::store_t store_t;
+   typedef typename ap_host::types<W,false>::conv_t   conv_t;
+
+   ap_range_ref (ap_int_base<W,S> &v, int hi, int lo) :
+      m_v (v), m_hi (hi), m_lo (lo) { }
+
+   operator conv_t       () const { return get (); }
+   store_t     get       () const { return m_v.get_range (m_hi, m_lo); }
+   unsigned    to_uint   () const { return get (); }
+   uint64_t    to_uint64 () const { return get (); }
+   int         length    () const { return m_hi - m_lo + 1; }
+
+   ap_range_ref &operator = (unsigned long long val)
+   {
+      m_v.set_range (m_hi, m_lo, val);
+      return *this;
+   }
+
+   ap_range_ref &operator = (ap_range_ref const &rhs)
+   {
+      m_v.set_range (m_hi, m_lo, rhs.get ());
+      return *this;
+   }
+
+   template<int W2, bool S2>
+   ap_range_ref &operator = (ap_int_base<W2,S2> const &rhs)
+   {
+      m_v.set_range (m_hi, m_lo, rhs.V);
+      return *this;
+   }
+
+   template<int W2, bool S2>
+   ap_range_ref &operator = (ap_range_ref<W2,S2> const &rhs)
+   {
+      m_v.set_range (m_hi, m_lo, rhs.get ());
+      return *this;
+   }
+
+private:
+   ap_int_base<W,S> &m_v;
+   int              m_hi;
+   int              m_lo;
+};
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+ *
+ *  \class ap_int_base
+ *  \brief The common implementation of ap_int and ap_uint
+ *
+\* ---------------------------------------------------------------------- */
+template<int W, bool S>
+class ap_int_base
+{
+public:
+   typedef typename ap_host::types<W,S>::store_t store_t;
+   typedef typename ap_host::types<W,S>::conv_t   conv_t;
+   typedef ap_host::uint128_t                    ubig_t;
+
+   static const int width = W;
+
+   // --------------------------------------------
+   // Truncates to W bits, sign extending if signed
+   // --------------------------------------------
+   static store_t trunc (ubig_t v)
+   {
+      if (W < 128)
+      {
+         ubig_t mask = (((ubig_t)1) << (W < 128 ? W : 0)) - 1;
+         v &= mask;
+         if (S && (v >> (W - 1)) & 1) v |= ~mask;
+      }
+      return (store_t)v;
+   }
+
+   ap_int_base () : V (0) { }
+
+   template<int W2, bool S2>
+   ap_int_base (ap_int_base<W2,S2> const &v) : V (trunc ((ubig_t)v.V)) { }
+
+   template<int W2, bool S2>
+   ap_int_base (ap_range_ref<W2,S2> const &v) : V (trunc (v.get ())) { }
+
+   template<int W2, bool S2>
+   ap_int_base (ap_bit_ref<W2,S2> const &v) : V ((bool)v) { }
+
+   ap_int_base (bool                 v) : V (v)                       { }
+   ap_int_base (char                 v) : V (trunc ((ubig_t)v))       { }
+   ap_int_base (signed char          v) : V (trunc ((ubig_t)v))       { }
+   ap_int_base (unsigned char        v) : V (trunc ((ubig_t)v))       { }
+   ap_int_base (short                v) : V (trunc ((ubig_t)v))       { }
+   ap_int_base (unsigned short       v) : V (trunc ((ubig_t)v))       { }
+   ap_int_base (int                  v) : V (trunc ((ubig_t)v))       { }
+   ap_int_base (unsigned int         v) : V (trunc ((ubig_t)v))       { }
+   ap_int_base (long                 v) : V (trunc ((ubig_t)v))       { }
+   ap_int_base (unsigned long        v) : V (trunc ((ubig_t)v))       { }
+   ap_int_base (long long            v) : V (trunc ((ubig_t)v))       { }
+   ap_int_base (unsigned long long   v) : V (trunc ((ubig_t)v))       { }
+   ap_int_base (ap_host::int128_t    v) : V (trunc ((ubig_t)v))       { }
+   ap_int_base (ap_host::uint128_t   v) : V (trunc (v))               { }
+   ap_int_base (double               v) : V (trunc ((ubig_t)(long long)v)) { }
+
+
+   // ----------------------------
+   // Conversion to native integers
+   // ----------------------------
+   operator conv_t () const { return (conv_t)V; }
+
+   int                 to_int    () const { return (int)V;                }
+   unsigned int        to_uint   () const { return (unsigned int)V;       }
+   long long           to_int64  () const { return (long long)V;          }
+   unsigned long long  to_uint64 () const { return (unsigned long long)V; }
+   long                to_long   () const { return (long)V;               }
+   unsigned long       to_ulong  () const { return (unsigned long)V;      }
+   bool                to_bool   () const { return V != 0;                }
+   static int          length    ()       { return W;                     }
+
+
+   // ------------------
+   // Bit level accesss
+   // ------------------
+   bool test  (int idx) const { return ((ubig_t)V >> idx) & 1; }
+   void set   (int idx)       { set (idx, true);  }
+   void clear (int idx)       { set (idx, false); }
+   void set   (int idx, bool val)
+   {
+      ubig_t v = (ubig_t)V & ~((ubig_t)1 << idx);
+      V = trunc (v | ((ubig_t)val << idx));
+   }
+
+   ap_bit_ref<W,S>   operator [] (int idx)         { return ap_bit_ref<W,S> (*this, idx); }
+   bool              operator [] (int idx) const   { return test (idx); }
+
+   store_t get_range (int hi, int lo) const
+   {
+      int    n = hi - lo + 1;
+      ubig_t v = (ubig_t)V >> lo;
+      if (n < 128) v &= (((ubig_t)1) << n) - 1;
+      return (store_t)v;
+   }
+
+   void set_range (int hi, int lo, ubig_t val)
+   {
+      int    n    = hi - lo + 1;
+      ubig_t mask = n < 128 ? (((ubig_t)1) << n) - 1 : ~(ubig_t)0;
+      ubig_t v    = (ubig_t)V & ~(mask << lo);
+      V = trunc (v | ((val & mask) << lo));
+   }
+
+   ap_range_ref<W,S> range       (int hi, int lo)  { return ap_range_ref<W,S> (*this, hi, lo); }
+   ap_range_ref<W,S> operator () (int hi, int lo)  { return ap_range_ref<W,S> (*this, hi, lo); }
+   ap_range_ref<W,S> range       ()                { return ap_range_ref<W,S> (*this, W-1, 0); }
+   store_t           range       (int hi, int lo) const { return get_range (hi, lo); }
+   store_t           operator () (int hi, int lo) const { return get_range (hi, lo); }
+
+   bool or_reduce  () const { return V != 0; }
+   bool and_reduce () const { return (ubig_t)trunc (~(ubig_t)V) == 0 || (S && V == -1); }
+
+   int countLeadingZeros () const
+   {
+      ubig_t v = (ubig_t)V;
+      if (W < 128) v &= (((ubig_t)1) << (W < 128 ? W : 0)) - 1;
+      int n = 0;
+      for (int idx = W - 1; idx >= 0; idx--)
+      {
+         if ((v >> idx) & 1) break;
+         n += 1;
+      }
+      return n;
+   }
+
+   ap_int_base reverse () const
+   {
+      ubig_t v = 0;
+      for (int idx = 0; idx < W; idx++)
+      {
+         v |= (((ubig_t)V >> idx) & 1) << (W - 1 - idx);
+      }
+      ap_int_base r;
+      r.V = trunc (v);
+      return r;
+   }
+
+
+   // -----------------------------------------------------
+   // Operators that keep the width of the operand
+   // -----------------------------------------------------
+   ap_int_base operator ~ () const
+   {
+      ap_int_base r;
+      r.V = trunc (~(ubig_t)V);
+      return r;
+   }
+
+   ap_int_base operator << (int n) const
+   {
+      ap_int_base r;
+      if      (n <  0)   r.V = (*this >> -n).V;
+      else if (n >= W)   r.V = 0;
+      else               r.V = trunc ((ubig_t)V << n);
+      return r;
+   }
+
+   ap_int_base operator >> (int n) const
+   {
+      ap_int_base r;
+      if      (n <  0)   r.V = (*this << -n).V;
+      else if (n >= W)   r.V = (S && V < 0) ? -1 : 0;
+      else               r.V = S ? trunc ((ubig_t)(V >> n))
+                                 : trunc ((ubig_t)V >> n);
+      return r;
+   }
+
+   ap_int_base operator << (unsigned n) const { return *this << (int)n; }
+   ap_int_base operator >> (unsigned n) const { return *this >> (int)n; }
+
+   template<int W2, bool S2>
+   ap_int_base operator << (ap_int_base<W2,S2> const &n) const { return *this << (int)n.V; }
+
+   template<int W2, bool S2>
+   ap_int_base operator >> (ap_int_base<W2,S2> const &n) const { return *this >> (int)n.V; }
+
+
+   // -------------------------------------
+   // Assignment operators, these truncate
+   // -------------------------------------
+   #define AP_HOST_ASSIGN_OP(_op)                                          \
+   template<typename T>                                                    \
+   ap_int_base &operator _op##= (T const &rhs)                             \
+   {                                                                       \
+      *this = ap_int_base ((conv_t)V _op rhs);                             \
+      return *this;                                                        \
+   }
+
+   AP_HOST_ASSIGN_OP(+)
+   AP_HOST_ASSIGN_OP(-)
+   AP_HOST_ASSIGN_OP(*)
+   AP_HOST_ASSIGN_OP(/)
+   AP_HOST_ASSIGN_OP(%)
+   AP_HOST_ASSIGN_OP(&)
+   AP_HOST_ASSIGN_OP(|)
+   AP_HOST_ASSIGN_OP(^)
+   #undef AP_HOST_ASSIGN_OP
+
+   ap_int_base &operator <<= (int n) { *this = *this << n; return *this; }
+   ap_int_base &operator >>= (int n) { *this = *this >> n; return *this; }
+
+   ap_int_base &operator ++ ()    { *this = ap_int_base ((ubig_t)V + 1); return *this; }
+   ap_int_base &operator -- ()    { *this = ap_int_base ((ubig_t)V - 1); return *this; }
+   ap_int_base  operator ++ (int) { ap_int_base t = *this; ++*this; return t; }
+   ap_int_base  operator -- (int) { ap_int_base t = *this; --*this; return t; }
+
+public:
+   store_t V;
+};
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- */
+template<int W>
+class ap_uint : public ap_int_base<W,false>
+{
+public:
+   typedef ap_int_base<W,false> Base;
+
+   ap_uint () { }
+
+   template<typename T>
+   ap_uint (T const &v) : Base (v) { }
+
+   ap_uint (ap_int_base<W,false> const &v) : Base (v) { }
+
+   ap_uint operator ~  ()      const { return Base::operator ~  ();  }
+   ap_uint operator << (int n) const { return Base::operator << (n); }
+   ap_uint operator >> (int n) const { return Base::operator >> (n); }
+   ap_uint operator << (unsigned n) const { return Base::operator << ((int)n); }
+   ap_uint operator >> (unsigned n) const { return Base::operator >> ((int)n); }
+   ap_uint reverse     ()      const { return Base::reverse     ();  }
+
+   template<int W2, bool S2>
+   ap_uint operator << (ap_int_base<W2,S2> const &n) const { return *this << (int)n.V; }
+
+   template<int W2, bool S2>
+   ap_uint operator >> (ap_int_base<W2,S2> const &n) const { return *this >> (int)n.V; }
+};
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- */
+template<int W>
+class ap_int : public ap_int_base<W,true>
+{
+public:
+   typedef ap_int_base<W,true> Base;
+
+   ap_int () { }
+
+   template<typename T>
+   ap_int (T const &v) : Base (v) { }
+
+   ap_int (ap_int_base<W,true> const &v) : Base (v) { }
+
+   ap_int operator ~  ()      const { return Base::operator ~  ();  }
+   ap_int operator << (int n) const { return Base::operator << (n); }
+   ap_int operator >> (int n) const { return Base::operator >> (n); }
+   ap_int operator << (unsigned n) const { return Base::operator << ((int)n); }
+   ap_int operator >> (unsigned n) const { return Base::operator >> ((int)n); }
+   ap_int reverse     ()      const { return Base::reverse     ();  }
+
+   template<int W2, bool S2>
+   ap_int operator << (ap_int_base<W2,S2> const &n) const { return *this << (int)n.V; }
+
+   template<int W2, bool S2>
+   ap_int operator >> (ap_int_base<W2,S2> const &n) const { return *this >> (int)n.V; }
+};
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+ *
+ *  \brief Concatenation, (hi, lo)
+ *
+ *  Only the rvalue form is provided. A range reference contributes the
+ *  bits it selects, so, as in Vivado, the static width of the result may
+ *  exceed the number of bits actually filled.
+ *
+\* ---------------------------------------------------------------------- */
+namespace ap_host
+{
+   template<int W1, int W2> struct concat_t
+   {
+      typedef ap_uint<(W1 + W2 < 128) ? W1 + W2 : 128> type;
+   };
+
+   inline uint128_t concat (uint128_t hi, uint128_t lo, int nlo)
+   {
+      return nlo < 128 ? (hi << nlo) | lo : lo;
+   }
+}
+
+template<int W1, bool S1, int W2, bool S2>
+inline typename ap_host::concat_t<W1,W2>::type
+operator , (ap_int_base<W1,S1> const &hi, ap_int_base<W2,S2> const &lo)
+{
+   return ap_host::concat (hi.get_range (W1-1, 0), lo.get_range (W2-1, 0), W2);
+}
+
+template<int W1, bool S1, int W2, bool S2>
+inline typename ap_host::concat_t<W1,W2>::type
+operator , (ap_range_ref<W1,S1> const &hi, ap_int_base<W2,S2> const &lo)
+{
+   return ap_host::concat (hi.get (), lo.get_range (W2-1, 0), W2);
+}
+
+template<int W1, bool S1, int W2, bool S2>
+inline typename ap_host::concat_t<W1,W2>::type
+operator , (ap_int_base<W1,S1> const &hi, ap_range_ref<W2,S2> const &lo)
+{
+   return ap_host::concat (hi.get_range (W1-1, 0), lo.get (), lo.length ());
+}
+
+template<int W1, bool S1, int W2, bool S2>
+inline typename ap_host::concat_t<W1,W2>::type
+operator , (ap_range_ref<W1,S1> const &hi, ap_range_ref<W2,S2> const &lo)
+{
+   return ap_host::concat (hi.get (), lo.get (), lo.length ());
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- */
+template<int W, bool S>
+inline std::ostream &operator << (std::ostream &os, ap_int_base<W,S> const &v)
+{
+   if (W > 64) return os << (unsigned long long)v.V;
+   if (S)      return os << (long long)v.V;
+   else        return os << (unsigned long long)v.V;
+}
+
+template<int W, bool S>
+inline std::ostream &operator << (std::ostream &os, ap_range_ref<W,S> const &v)
+{
+   return os << (unsigned long long)v.get ();
+}
+/* ---------------------------------------------------------------------- */
+
+
+#endif
@@ -0,0 +1,117 @@
+// -*-Mode: C++;-*-
+
+#ifndef _HOST_HLS_STREAM_H_
+#define _HOST_HLS_STREAM_H_
+
+
+/* ---------------------------------------------------------------------- *//*!
+ *
+ *  @file     hls_stream.h
+ *  @brief    Lightweight host stand-in for the Vivado HLS hls::stream
+ *  @verbatim
+ *                               Copyright 2018
+ *                                    by
+ *
+ *                       The Board of Trustees of the
+ *                    Leland Stanford Junior University.
+ *                           All rights reserved.
+ *
+ *  @endverbatim
+ *
+ *  @par Facility:
+ *  DUNE
+ *
+ *  @author
+ *  <russell@slac.stanford.edu>
+ *
+ *  @par Date created:
+ *  2018/07/27
+ *
+ * @par Credits:
+ * SLAC
+ *
+\* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *\
+
+   HISTORY
+   -------
+
+   DATE       WHO WHAT
+   ---------- --- ---------------------------------------------------------
+   2018.07.27 jjr Created
+
+\* ---------------------------------------------------------------------- */
+
+
+/* ---------------------------------------------------------------------- *\
+
+   As in the Vivado C simulation, a stream is an unbounded FIFO. Reading
+   an empty stream is a fatal error, in the simulation it would hang.
+
+\* ---------------------------------------------------------------------- */
+
+
+#include <deque>
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+
+
+namespace hls
+{
+
+template<typename T>
+class stream
+{
+public:
+   stream ()                 : m_name ("stream") { }
+   stream (char const *name) : m_name (name)     { }
+
+   bool   empty () const { return m_q.empty (); }
+   bool   full  () const { return false;        }
+   size_t size  () const { return m_q.size  (); }
+
+   void write (T const &v) { m_q.push_back (v); }
+
+   T read ()
+   {
+      if (m_q.empty ())
+      {
+         fprintf (stderr, "hls::stream '%s' read while empty\n",
+                  m_name.c_str ());
+         abort ();
+      }
+
+      T v = m_q.front ();
+      m_q.pop_front ();
+      return v;
+   }
+
+   void read (T &v) { v = read (); }
+
+   bool read_nb (T &v)
+   {
+      if (m_q.empty ()) return false;
+      v = read ();
+      return true;
+   }
+
+   bool write_nb (T const &v) { write (v); return true; }
+
+   void operator >> (T       &v) { v = read (); }
+   void operator << (T const &v) { write (v);   }
+
+private:
+   stream (stream const &);
+   stream &operator = (stream const &);
+
+   std::string   m_name;
+   std::deque<T>    m_q;
+};
+
+}
+
+#endif
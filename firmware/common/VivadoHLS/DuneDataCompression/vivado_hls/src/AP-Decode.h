@@ -67,6 +67,8 @@
  *
  * DATE       WHO WHAT
  * ---------- --- ---------------------------------------------------------
+ * 2018.07.30 jjr The code value width follows PACKET_B_NSAMPLES when it
+ *                is given
  * 2016.05.19 jjr Adapted for dune usage
  *
 \* ---------------------------------------------------------------------- */
@@ -74,16 +76,23 @@
 
 /*
  * This must match PACKET_B_NSAMPLES, but since that definition resides in
- * FPGA Vivado world, really don't wish to import it to the offline world
+ * FPGA Vivado world, really don't wish to import it to the offline world.
+ * Builds for shorter packets give PACKET_B_NSAMPLES on the command line.
  */
+#ifdef  PACKET_B_NSAMPLES
+  #define APD_K_NBITS   (PACKET_B_NSAMPLES+2)
+#else
+  #define APD_K_NBITS   (10+2)
+#endif
+
 #ifdef  APC_K_NBITS
 
-  #if APC_K_NBITS != 12
-  #error "APC_K_NBITS previously defined, but != 12, the only legitimate value"
+  #if APC_K_NBITS != APD_K_NBITS
+  #error "APC_K_NBITS previously defined, but != PACKET_B_NSAMPLES + 2"
   #endif
 
 #else
-  #define APC_K_NBITS   (10+2)
+  #define APC_K_NBITS   APD_K_NBITS
 #endif
 
 #include "AP-Common.h"
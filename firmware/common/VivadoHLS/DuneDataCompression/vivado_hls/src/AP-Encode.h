@@ -20,6 +20,11 @@
  *
  * DATE     WHO WHAT
  * -------- --- ---------------------------------------------------------
+ * 08.17.18 jjr The raw channels are compiled in only if HISTOGRAM_MODEL_RAW
+ * 08.16.18 jjr APE_encode sends a channel raw if coding would not pay
+ * 07.30.18 jjr The code value types follow PACKET_B_NSAMPLES
+ * 07.28.18 jjr APE_encode may code with the channel's saved model
+ * 07.27.18 jjr APE_encode takes the modular flag, for the predictors
  * 08.17.10 jjr Eliminated local copy of FFS.ih in favor of PBI version
  * 01.14.09 jjr In the encode and encode_list routines, rephrased the 
  *              auto-increment expressions on the cast values. The newer
@@ -41,6 +46,7 @@
 #include "AP-Common.h"
 #include "BitStream64.h"
 #include "Histogram-Encode.cpp"
+#include "HistogramModel.h"
 
 #include <stdint.h>
 #include <ap_int.h>
@@ -69,12 +75,12 @@
 
 
 /* ---------------------------------------------------------------------- */
-typedef ap_uint<10>          APE_table_t;
-typedef ap_uint<10+2>        APE_cv_t;
-typedef ap_uint<10+3>        APE_range_t;
-typedef ap_uint<10 + (10+2)> APE_scaled_t;
-typedef ap_int<10+3>         APE_xscv_t; /* Extended signed reverseo of cv_t */
-typedef ap_uint<4>           APE_cvcnt_t;
+typedef ap_uint<PACKET_B_NSAMPLES>                  APE_table_t;
+typedef ap_uint<APC_K_NBITS>                        APE_cv_t;
+typedef ap_uint<APC_K_NBITS+1>                      APE_range_t;
+typedef ap_uint<PACKET_B_NSAMPLES + APC_K_NBITS>    APE_scaled_t;
+typedef ap_int<APC_K_NBITS+1>                       APE_xscv_t; /* Extended signed reverseo of cv_t */
+typedef ap_uint<4>                                  APE_cvcnt_t;
 /* ---------------------------------------------------------------------- */
 
 
@@ -88,7 +94,7 @@ typedef ap_uint<4>           APE_cvcnt_t;
 struct APE_instruction
 {
    ap_uint< 4>     m_nbits; /*!< The number of valid bits in m_bits       */
-   ap_uint<12>      m_bits; /*!< The bit pattern to insert                */
+   APE_cv_t         m_bits; /*!< The bit pattern to insert                */
    ap_uint< 8>  m_npending; /*!< The number of pending bits               */
 };
 /* ---------------------------------------------------------------------- */
@@ -221,13 +227,13 @@ public:
 #define APE_checkerStatement(_statement) _statement
 /* ---------------------------------------------------------------------- */
 bool encode_check (APE_etxOut                         &etx,
-                   Histogram const                   &hist,
+                   HistogramModel const             &model,
                    Symbol_t  const syms[PACKET_K_NSAMPLES]);
 /* ---------------------------------------------------------------------- */
 #else
 /* ---------------------------------------------------------------------- */
 #define APE_checkerStatement(_statement)
-#define encode_check(_etx, _hist,_syms) failure
+#define encode_check(_etx, _model,_syms) failure
 
 /* ---------------------------------------------------------------------- */
 #endif   /* APE_CHECKER                                                   */
@@ -350,12 +356,27 @@ static int inline APE_finish (APE_etxOut &etxOut, APE_etx &etx)
   \param   table  The encoding table
   \param    syms  The array  of symbols to encode
   \param   nsyms  The number of symbols
+  \param modular  If true, the differences are taken modulo the ADC
+                  range, see Predictor.h
+  \param   model  The channel's saved model. It is replaced by this
+                  histogram when the histogram is sent in full.
+  \param   reuse  If true, the saved model may be used in place of
+                  sending the histogram, see HistogramModel.h
+
+  \par
+   If the estimated cost of coding the channel, or the coded channel
+   itself, is no smaller than its raw samples, the channel is instead
+   sent raw, HISTOGRAM_FORMAT_K_RAW. This bounds a channel's size at
+   HistogramModel::rawBits (). This is done only if HISTOGRAM_MODEL_RAW.
                                                                           */
 /* ---------------------------------------------------------------------- */
 static int APE_encode  (APE_etxOut        &etxOut,
                         Histogram    const  &hist,
                         Symbol_t     const  *syms,
-                        int                 nsyms)
+                        int                 nsyms,
+                        bool              modular,
+                        HistogramModel     &model,
+                        bool                reuse)
 {
    #pragma HLS INLINE off
    APE_etx etx;
@@ -368,8 +389,27 @@ static int APE_encode  (APE_etxOut        &etxOut,
    //APE_instruction *instruction = instructions;
 
    // Setup the APE decoding context
-   AdcIn_t prv = *syms++;
-   hist.encode (etxOut.ha, etx.ha, table, prv);
+   Symbol_t const *beg = syms;
+   AdcIn_t         prv = *syms++;
+   int             fmt = model.choose (hist, reuse);
+#if HISTOGRAM_MODEL_RAW
+   if (fmt == HISTOGRAM_FORMAT_K_RAW)
+   {
+      HistogramModel::raw (etxOut.ha, etx.ha, beg);
+      etx.ba.transfer (etxOut.ba);
+      if (!reuse) model.m_valid = false;
+      return 0;
+   }
+   else
+#endif
+   if (fmt == HISTOGRAM_FORMAT_K_SAME)
+   {
+      model.encode (etxOut.ha, etx.ha, table, prv, hist);
+   }
+   else
+   {
+      hist.encode (etxOut.ha, etx.ha, table, prv);
+   }
    etx.nhist = etx.ha.m_idx;   /// DEBUG
    ////APE_dumpStatement (hist.print (0));
 
@@ -392,7 +432,8 @@ static int APE_encode  (APE_etxOut        &etxOut,
 
        Histogram::Symbol_t ovr;
        AdcIn_t             cur = *syms++;
-       Histogram::Symbol_t sym = Histogram::symbol (cur, prv);
+       Histogram::Symbol_t sym = modular ? Histogram::symbol_mod (cur, prv)
+                                         : Histogram::symbol     (cur, prv);
        Histogram::Idx_t    idx = Histogram::idx    (sym, ovr);
        prv = cur;
 
@@ -608,6 +649,28 @@ static int APE_encode  (APE_etxOut        &etxOut,
    etx.ha.transfer (etxOut.ha);
    APE_finish (etxOut, etx);
 
+
+   // --------------------------------------------------------
+   // The estimate is not exact, if the coding did not pay off
+   // discard it and send the samples. The model is saved only
+   // if the histogram really was sent.
+   // --------------------------------------------------------
+#if HISTOGRAM_MODEL_RAW
+   if (etx.ha.m_idx + etx.ba.m_idx > HistogramModel::rawBits ())
+   {
+      etx.ha = BitStream64 ();
+      etx.ba = BitStream64 ();
+      HistogramModel::raw (etxOut.ha, etx.ha, beg);
+      etx.ba.transfer (etxOut.ba);
+      if (!reuse) model.m_valid = false;
+   }
+   else
+#endif
+   if (fmt == HISTOGRAM_FORMAT_K_FULL)
+   {
+      model.save (table);
+   }
+
    return nsyms;
 }
 /* ---------------------------------------------------------------------- */
@@ -877,7 +940,7 @@ inline void APE_cv::reduce_hi (APE_cvcnt_t nreduce, APE_cv_t hi_mask)
    //
    // This method is allows the timing to be met.
    // ---------------------------------------------------------
-   APE_xscv_t r (1 << 12);    // Set the sign bit
+   APE_xscv_t r (1 << APC_K_NBITS);    // Set the sign bit
    APE_xscv_t tmp = m_hi.reverse ();
 
    r    |= tmp;  ///m_hi.reverse ();   // Or in the reversed value
@@ -21,6 +21,8 @@
  *
  * DATE     WHO WHAT
  * -------- --- ---------------------------------------------------------
+ * 07.31.18 jjr Decode a byte of the input per table lookup, a level of
+ *              the tree at a time. The output is unchanged.
  * 08.17.10 jjr Eliminated local copy of FFS.ih in favor of PBI version
  *
 \* ---------------------------------------------------------------------- */
@@ -34,6 +36,180 @@
 #endif
 
 
+/* --------------------------------------------------------------------- *//*!
+
+  \var   BtdSymbols
+  \brief The symbols that start in a byte of encoded bits
+
+  Indexed by the next 8 encoded bits, each entry holds
+
+  \verbatim
+     Bits  0-15  The class of each complete symbol, 2 bits each, the
+                 first in bits 14-15. The class is the index of the
+                 symbol's pattern in the LKUP word,
+                   0 = 10,  1 = 11,  2 = 0
+     Bits 16-19  The number of complete symbols, 3-8
+     Bits 20-51  The number of bits used by the first 1-8 symbols,
+                 4 bits each, the first in bits 20-23
+  \endverbatim
+
+  A 1 in the last bit starts a symbol completed by the next byte, so
+  is not counted.
+                                                                         */
+/* --------------------------------------------------------------------- */
+static const unsigned long long BtdSymbols[256] =
+{
+   0x876543218aaaaULL, 0x076543217aaa8ULL, 0x086543217aaa0ULL, 0x086543217aaa4ULL,
+   0x087543217aa88ULL, 0x007543216aa80ULL, 0x087543217aa98ULL, 0x007543216aa90ULL,
+   0x087643217aa28ULL, 0x007643216aa20ULL, 0x008643216aa00ULL, 0x008643216aa10ULL,
+   0x087643217aa68ULL, 0x007643216aa60ULL, 0x008643216aa40ULL, 0x008643216aa50ULL,
+   0x087653217a8a8ULL, 0x007653216a8a0ULL, 0x008653216a880ULL, 0x008653216a890ULL,
+   0x008753216a820ULL, 0x000753215a800ULL, 0x008753216a860ULL, 0x000753215a840ULL,
+   0x087653217a9a8ULL, 0x007653216a9a0ULL, 0x008653216a980ULL, 0x008653216a990ULL,
+   0x008753216a920ULL, 0x000753215a900ULL, 0x008753216a960ULL, 0x000753215a940ULL,
+   0x087654217a2a8ULL, 0x007654216a2a0ULL, 0x008654216a280ULL, 0x008654216a290ULL,
+   0x008754216a220ULL, 0x000754215a200ULL, 0x008754216a260ULL, 0x000754215a240ULL,
+   0x008764216a0a0ULL, 0x000764215a080ULL, 0x000864215a000ULL, 0x000864215a040ULL,
+   0x008764216a1a0ULL, 0x000764215a180ULL, 0x000864215a100ULL, 0x000864215a140ULL,
+   0x087654217a6a8ULL, 0x007654216a6a0ULL, 0x008654216a680ULL, 0x008654216a690ULL,
+   0x008754216a620ULL, 0x000754215a600ULL, 0x008754216a660ULL, 0x000754215a640ULL,
+   0x008764216a4a0ULL, 0x000764215a480ULL, 0x000864215a400ULL, 0x000864215a440ULL,
+   0x008764216a5a0ULL, 0x000764215a580ULL, 0x000864215a500ULL, 0x000864215a540ULL,
+   0x0876543178aa8ULL, 0x0076543168aa0ULL, 0x0086543168a80ULL, 0x0086543168a90ULL,
+   0x0087543168a20ULL, 0x0007543158a00ULL, 0x0087543168a60ULL, 0x0007543158a40ULL,
+   0x00876431688a0ULL, 0x0007643158880ULL, 0x0008643158800ULL, 0x0008643158840ULL,
+   0x00876431689a0ULL, 0x0007643158980ULL, 0x0008643158900ULL, 0x0008643158940ULL,
+   0x00876531682a0ULL, 0x0007653158280ULL, 0x0008653158200ULL, 0x0008653158240ULL,
+   0x0008753158080ULL, 0x0000753148000ULL, 0x0008753158180ULL, 0x0000753148100ULL,
+   0x00876531686a0ULL, 0x0007653158680ULL, 0x0008653158600ULL, 0x0008653158640ULL,
+   0x0008753158480ULL, 0x0000753148400ULL, 0x0008753158580ULL, 0x0000753148500ULL,
+   0x0876543179aa8ULL, 0x0076543169aa0ULL, 0x0086543169a80ULL, 0x0086543169a90ULL,
+   0x0087543169a20ULL, 0x0007543159a00ULL, 0x0087543169a60ULL, 0x0007543159a40ULL,
+   0x00876431698a0ULL, 0x0007643159880ULL, 0x0008643159800ULL, 0x0008643159840ULL,
+   0x00876431699a0ULL, 0x0007643159980ULL, 0x0008643159900ULL, 0x0008643159940ULL,
+   0x00876531692a0ULL, 0x0007653159280ULL, 0x0008653159200ULL, 0x0008653159240ULL,
+   0x0008753159080ULL, 0x0000753149000ULL, 0x0008753159180ULL, 0x0000753149100ULL,
+   0x00876531696a0ULL, 0x0007653159680ULL, 0x0008653159600ULL, 0x0008653159640ULL,
+   0x0008753159480ULL, 0x0000753149400ULL, 0x0008753159580ULL, 0x0000753149500ULL,
+   0x0876543272aa8ULL, 0x0076543262aa0ULL, 0x0086543262a80ULL, 0x0086543262a90ULL,
+   0x0087543262a20ULL, 0x0007543252a00ULL, 0x0087543262a60ULL, 0x0007543252a40ULL,
+   0x00876432628a0ULL, 0x0007643252880ULL, 0x0008643252800ULL, 0x0008643252840ULL,
+   0x00876432629a0ULL, 0x0007643252980ULL, 0x0008643252900ULL, 0x0008643252940ULL,
+   0x00876532622a0ULL, 0x0007653252280ULL, 0x0008653252200ULL, 0x0008653252240ULL,
+   0x0008753252080ULL, 0x0000753242000ULL, 0x0008753252180ULL, 0x0000753242100ULL,
+   0x00876532626a0ULL, 0x0007653252680ULL, 0x0008653252600ULL, 0x0008653252640ULL,
+   0x0008753252480ULL, 0x0000753242400ULL, 0x0008753252580ULL, 0x0000753242500ULL,
+   0x0087654260aa0ULL, 0x0007654250a80ULL, 0x0008654250a00ULL, 0x0008654250a40ULL,
+   0x0008754250880ULL, 0x0000754240800ULL, 0x0008754250980ULL, 0x0000754240900ULL,
+   0x0008764250280ULL, 0x0000764240200ULL, 0x0000864240000ULL, 0x0000864240100ULL,
+   0x0008764250680ULL, 0x0000764240600ULL, 0x0000864240400ULL, 0x0000864240500ULL,
+   0x0087654261aa0ULL, 0x0007654251a80ULL, 0x0008654251a00ULL, 0x0008654251a40ULL,
+   0x0008754251880ULL, 0x0000754241800ULL, 0x0008754251980ULL, 0x0000754241900ULL,
+   0x0008764251280ULL, 0x0000764241200ULL, 0x0000864241000ULL, 0x0000864241100ULL,
+   0x0008764251680ULL, 0x0000764241600ULL, 0x0000864241400ULL, 0x0000864241500ULL,
+   0x0876543276aa8ULL, 0x0076543266aa0ULL, 0x0086543266a80ULL, 0x0086543266a90ULL,
+   0x0087543266a20ULL, 0x0007543256a00ULL, 0x0087543266a60ULL, 0x0007543256a40ULL,
+   0x00876432668a0ULL, 0x0007643256880ULL, 0x0008643256800ULL, 0x0008643256840ULL,
+   0x00876432669a0ULL, 0x0007643256980ULL, 0x0008643256900ULL, 0x0008643256940ULL,
+   0x00876532662a0ULL, 0x0007653256280ULL, 0x0008653256200ULL, 0x0008653256240ULL,
+   0x0008753256080ULL, 0x0000753246000ULL, 0x0008753256180ULL, 0x0000753246100ULL,
+   0x00876532666a0ULL, 0x0007653256680ULL, 0x0008653256600ULL, 0x0008653256640ULL,
+   0x0008753256480ULL, 0x0000753246400ULL, 0x0008753256580ULL, 0x0000753246500ULL,
+   0x0087654264aa0ULL, 0x0007654254a80ULL, 0x0008654254a00ULL, 0x0008654254a40ULL,
+   0x0008754254880ULL, 0x0000754244800ULL, 0x0008754254980ULL, 0x0000754244900ULL,
+   0x0008764254280ULL, 0x0000764244200ULL, 0x0000864244000ULL, 0x0000864244100ULL,
+   0x0008764254680ULL, 0x0000764244600ULL, 0x0000864244400ULL, 0x0000864244500ULL,
+   0x0087654265aa0ULL, 0x0007654255a80ULL, 0x0008654255a00ULL, 0x0008654255a40ULL,
+   0x0008754255880ULL, 0x0000754245800ULL, 0x0008754255980ULL, 0x0000754245900ULL,
+   0x0008764255280ULL, 0x0000764245200ULL, 0x0000864245000ULL, 0x0000864245100ULL,
+   0x0008764255680ULL, 0x0000764245600ULL, 0x0000864245400ULL, 0x0000864245500ULL
+};
+/* --------------------------------------------------------------------- */
+
+
+
+
+/* --------------------------------------------------------------------- *//*!
+
+  \fn     unsigned int decode (unsigned int      w,
+                                unsigned int   lkup,
+                                int         nlevels,
+                                int          *nbits)
+  \brief  Decodes a tree of \a nlevels levels below the root from the
+          left justified bits of \a w
+  \return The lowest level, right justified, 2^nlevels bits
+
+  \param      w   The encoded bits, left justified
+  \param   lkup   The patterns of the scheme, see LKUP
+  \param nlevels  The number of levels below the root
+  \param  nbits   Returns the number of bits decoded.
+
+  The tree is breadth first, so the symbols of a level are those of
+  the set bits of the level above, most significant first. They are
+  taken from the input a byte at a time, BtdSymbols giving up to 8 of
+  them at once without testing each symbol's first bit. Each is then
+  turned into its 2-bit pattern and placed under its parent, last
+  symbol first, the parents being found with ctz. The number of set
+  bits in the patterns is the number of symbols in the next level.
+                                                                         */
+/* --------------------------------------------------------------------- */
+static __inline unsigned int decode (unsigned int     w,
+                                     unsigned int  lkup,
+                                     int        nlevels,
+                                     int         *nbits)
+{
+   unsigned int  level = 1;    /* The root, implicitly non-zero */
+   int           nsyms = 1;
+   int               n = 0;
+
+   while (nlevels--)
+   {
+       /* Gather the classes of this level's symbols */
+       unsigned int classes = 0;
+       int          left    = nsyms;
+
+       do
+       {
+           unsigned long long sym = BtdSymbols[w >> 24];
+           int               have = (sym >> 16) & 0xf;
+           int               take = have < left ? have : left;
+           int               used = (sym >> (16 + 4 * take)) & 0xf;
+
+           classes = (classes << (2 * take))
+                   | ((unsigned int)(sym & 0xffff) >> (16 - 2 * take));
+           w     <<= used;
+           n      += used;
+           left   -= take;
+       }
+       while (left);
+
+
+       /* Place the patterns under the set bits of the level above */
+       unsigned int next = 0;
+       nsyms = 0;
+       do
+       {
+           int          bit = __builtin_ctz (level);
+           unsigned int val = (lkup >> (2 * (classes & 3))) & 3;
+
+           next    |= val << (2 * bit);
+           nsyms   += (val + 1) >> 1;
+           classes >>= 2;
+           level   &= level - 1;
+       }
+       while (level);
+
+       level = next;
+   }
+
+   *nbits = n;
+   return level;
+}
+/* --------------------------------------------------------------------- */
+
+
+
+
 /* --------------------------------------------------------------------- *//*!
 
   \fn     unsigned int BTD_wordDecode  (unsigned int      w,
@@ -51,13 +227,6 @@ extern unsigned int BTD_wordDecode  (unsigned int w,
                                      unsigned int scheme,
                                      int         *nbits)
 {
-   int             n;
-   int             b;
-   int          node;
-   int         node0;
-   int          bits;
-   unsigned int   m1;
-   unsigned int    o;
    unsigned int lkup;
 
 
@@ -65,146 +234,22 @@ extern unsigned int BTD_wordDecode  (unsigned int w,
    if (scheme == 0) { *nbits = 32; return w; }
 
 
-
    /*
-    |
-    |  Algorithm is to first expand the bits in w according to the
-    |  indicated encoding scheme.
+    |  The encoded patterns of each scheme
     |
     |     Scheme     0    10   11
     |          1    01    10   11
     |          2    10    01   11
     |          3    11    01   10
     |
-    |  This is done by indexing an 'array' stored in an integer mask
-    |  Each element is 2 bits wide
-    |
-    |  Bits 0,1 = pattern for 10 code
-    |  Bits 2,3 = pattern for 11 code
-    |  Bits 4,5 = pattern for  0 code.
-    |
-    |  The first symbol extracted gives the binary tree code for the halfwords
-    |
-    |  One should set the output word to
-    |
-    |         01 => 00000000 00000000 11111111 11111111
-    |         10 => 11111111 11111111 00000000 00000000
-    |         11 => 11111111 11111111 11111111 11111111
-    |
-    |  The next symbol gives the binary tree code for the next 2 bytes.
-    |  One should scan the word, looking for the first set bit, this
-    |  is the top bit of the byte to be inserted. Lets take the 01
-    |  case as an example
-    |
-    |  t = o;
-    |  b = FFSL (t);   // b = 16;
-    |
-    |  If the symbol is
-    |
-    |        01 => 00000000 00000000 00000000 11111111
-    |        10 => 00000000 00000000 11111111 00000000
-    |        11 => 00000000 00000000 11111111 11111111
-    |
-    |  One should now eliminated the next 16  bits in the pattern.
-    |
-    |  t &= ~0xffff0000 >> b;  // t = 0;
-    |  if (t != 0) extract next symbol
-    |
-    |
-    |
+    |  The root's symbol gives the halfwords, the next level the bytes,
+    |  then the nibbles, the bit pairs and finally the bits.
    */
    if      (scheme == 1)  lkup = LKUP (1, 2, 3);
    else if (scheme == 2)  lkup = LKUP (2, 1, 3);
    else                   lkup = LKUP (3, 1, 2);
 
-
-   /* Get the node value when the extract symbol = 0 */
-   node0 = lkup >> 4;
-
-
-   /*
-    | Initialize
-    |   The number of bits consumed from the input word  to 0
-    |   The output word to all bits set.
-    |
-    | As the values a each node are discovered, the bit fields corresponding
-    | to the width at the level being processed are cleared. After all the
-    | levels are processed, the bits left standing represent the value of
-    | decoded word;
-   */
-   n = 0;
-   o = 0xffffffff;
-
-
-   m1   = 0xffffffff; /* Bits controlled by the next node                  */
-   bits = 16;         /* Next level controls fate of 16 bits at each node  */
-
-   do
-   {
-       unsigned int   m;
-       unsigned int tmp;
-
-
-       /* Mask representing the number of bits at each node */
-       m  = m1;
-       m1 = m & (m << bits);
-
-
-       tmp = o;
-       do
-       {
-
-           /* Find the next set of bits to be dealt with */
-           b  = __builtin_clz (tmp);
-
-
-           /* Get the value at this node. */
-           if ((signed int)w >= 0)
-           {
-               /* Next bit is a 0, value is the node0 value */
-               node = node0;
-               n   += 1;
-               w  <<= 1;
-
-           }
-           else
-           {
-               /*
-                | Next bit is a 1, use the value of the next bit to
-                | find the value at this node. The index bit is in
-                | bit position (little endian counting) 30. So shift
-                | it down 30 to get it in the LSb, then shift it
-                | up by 1, (multiple by 2) to get an index. This looks
-                | like at lot of code, but it should reduce to two
-                | rwlimn instructions.
-                |
-               */
-               node = (lkup >> ((w >> (30 - 1)) & 2) & 3);
-               n   += 2;
-               w  <<=2;
-           }
-
-           /*
-            | Eliminate the bits in the output mask associated with
-            | a controlling bit of 0.
-           */
-           if ( (node & 1) == 0) o &= ~(m1 >> (b + bits));
-           if ( (node & 2) == 0) o &= ~(m1 >>  b);
-
-
-           /* Eliminate these bits from consideration */
-           tmp &= ~m >> b;
-
-           /* If no more bits at this level, continue to the next level */
-       }
-       while (tmp);
-
-   }
-   while (bits >>= 1);
-
-
-   *nbits = n;
-   return o;
+   return decode (w, lkup, 5, nbits);
 }
 /* --------------------------------------------------------------------- */
 
@@ -228,162 +273,21 @@ extern unsigned int BTD_shortDecode  (unsigned short int s,
                                       unsigned int  scheme,
                                       int           *nbits)
 {
-    
-   int             n;
-   int             b;
-   int          node;
-   int         node0;
-   int          bits;
-   unsigned int    w;
-   unsigned int   m1;
-   unsigned int    o;
    unsigned int lkup;
 
 
    /*  If the encoding scheme is 0, just return the 16 bits */
    if (scheme == 0) { *nbits = 16; return s; }
 
-   /* Left justify the pattern */
-   w = s << 16;
 
    /*
-    |
-    |  Algorithm is to first expand the bits in w according to the
-    |  indicated encoding scheme.
-    |
-    |     Scheme     0    10   11
-    |          1    01    10   11
-    |          2    10    01   11
-    |          3    11    01   10
-    |
-    |  This is done by indexing an 'array' stored in an integer mask
-    |  Each element is 2 bits wide
-    |
-    |  Bits 0,1 = pattern for 10 code
-    |  Bits 2,3 = pattern for 11 code
-    |  Bits 4,5 = pattern for  0 code.
-    |
-    |  The first symbol extracted gives the binary tree code for the bytes
-    |
-    |  One should set the output word to
-    |
-    |         01 => 00000000 11111111 
-    |         10 => 11111111 00000000
-    |         11 => 11111111 11111111
-    |
-    |  The next symbol gives the binary tree code for the next 2 nibbles
-    |  One should scan the word, looking for the first set bit, this
-    |  is the top bit of the byte to be inserted. Lets take the 01
-    |  case as an example
-    |
-    |  t = o;
-    |  b = FFSL (t);   // b = 16;
-    |
-    |  If the symbol is
-    |
-    |        01 => 00000000 11111111
-    |        10 => 11111111 00000000
-    |        11 => 11111111 11111111
-    |
-    |  One should now eliminated the next 8 bits in the pattern.
-    |
-    |  t &= ~0xff000000 >> b;  // t = 0;
-    |  if (t != 0) extract next symbol
-    |
-    |
-    |
+    |  As for BTD_wordDecode, but the root's symbol gives the bytes
+    |  and there is one less level.
    */
    if      (scheme == 1)  lkup = LKUP (1, 2, 3);
    else if (scheme == 2)  lkup = LKUP (2, 1, 3);
    else                   lkup = LKUP (3, 1, 2);
 
-
-   /* Get the node value when the extract symbol = 0 */
-   node0 = lkup >> 4;
-
-
-   /*
-    | Initialize
-    |   The number of bits consumed from the input word  to 0
-    |   The output word to all bits set.
-    |
-    | As the values a each node are discovered, the bit fields corresponding
-    | to the width at the level being processed are cleared. After all the
-    | levels are processed, the bits left standing represent the value of
-    | decoded word;
-   */
-   n = 0;
-   o = 0xffff0000;
-
-
-   m1   = 0xffff0000; /* Bits controlled by the next node                  */
-   bits = 8;          /* Next level controls fate of 8 bits at each node  */
-
-   do
-   {
-       unsigned int   m;
-       unsigned int tmp;
-
-
-       /* Mask representing the number of bits at each node */
-       m  = m1;
-       m1 = m & (m << bits);
-
-
-       tmp = o;
-       do
-       {
-
-           /* Find the next set of bits to be dealt with */
-           b  = __builtin_clz (tmp);
-
-
-           /* Get the value at this node. */
-           if ((signed int)w >= 0)
-           {
-               /* Next bit is a 0, value is the node0 value */
-               node = node0;
-               n   += 1;
-               w  <<= 1;
-
-           }
-           else
-           {
-               /*
-                | Next bit is a 1, use the value of the next bit to
-                | find the value at this node. The index bit is in
-                | bit position (little endian counting) 30. So shift
-                | it down 30 to get it in the LSb, then shift it
-                | up by 1, (multiple by 2) to get an index. This looks
-                | like at lot of code, but it should reduce to two
-                | rwlimn instructions.
-                |
-               */
-               node = (lkup >> ((w >> (30 - 1)) & 2) & 3);
-               n   += 2;
-               w  <<=2;
-           }
-
-           /*
-            | Eliminate the bits in the output mask associated with
-            | a controlling bit of 0.
-           */
-           if ( (node & 1) == 0) o &= ~(m1 >> (b + bits));
-           if ( (node & 2) == 0) o &= ~(m1 >>  b);
-
-
-           /* Eliminate these bits from consideration */
-           tmp &= ~m >> b;
-
-           /* If no more bits at this level, continue to the next level */
-       }
-       while (tmp);
-
-   }
-   while (bits >>= 1);
-
-
-   *nbits = n;
-   return o >> 16;
+   return decode ((unsigned int)s << 16, lkup, 4, nbits);
 }
 /* --------------------------------------------------------------------- */
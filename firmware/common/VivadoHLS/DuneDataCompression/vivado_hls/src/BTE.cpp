@@ -29,6 +29,21 @@
 /* --------------------------------------------------------------------- */
 
 
+
+/* ---------------------------------------------------------------------- *\
+ *
+ * HISTORY
+ * -------
+ *
+ * DATE     WHO WHAT
+ * -------- --- ---------------------------------------------------------
+ * 07.31.18 jjr Encode a byte of patterns per table lookup, form the
+ *              pattern levels by packing pair ORs and count the
+ *              patterns with popcounts. The output is unchanged.
+ *
+\* ---------------------------------------------------------------------- */
+
+
 #include <stdio.h>
 #include "BTE.h"
 
@@ -43,64 +58,115 @@
 #endif
 
 
-static __inline unsigned int encode (unsigned int e,
-				     unsigned int w,
-				     unsigned int p1,
-				     unsigned int p3);
+static __inline unsigned int canonical (unsigned int w, int scheme);
+static __inline unsigned int encode    (unsigned int e, unsigned int w);
+
+
+/* --------------------------------------------------------------------- *//*!
+
+  \var   BteCode
+  \brief The encoding of 4 canonical 2-bit patterns, a byte at a time
+
+  Indexed by a byte of canonical patterns, most significant pair first,
+  each entry is the number of bits in the upper byte and the encoded bits,
+  right justified, in the lower byte. The canonical patterns are those of
+  scheme 1, 00 = nothing, 01 = 0, 10 = 10, 11 = 11.
+                                                                         */
+/* --------------------------------------------------------------------- */
+static const unsigned short BteCode[256] =
+{
+   0x0000, 0x0100, 0x0202, 0x0203, 0x0100, 0x0200, 0x0302, 0x0303,
+   0x0202, 0x0304, 0x040a, 0x040b, 0x0203, 0x0306, 0x040e, 0x040f,
+   0x0100, 0x0200, 0x0302, 0x0303, 0x0200, 0x0300, 0x0402, 0x0403,
+   0x0302, 0x0404, 0x050a, 0x050b, 0x0303, 0x0406, 0x050e, 0x050f,
+   0x0202, 0x0304, 0x040a, 0x040b, 0x0304, 0x0408, 0x0512, 0x0513,
+   0x040a, 0x0514, 0x062a, 0x062b, 0x040b, 0x0516, 0x062e, 0x062f,
+   0x0203, 0x0306, 0x040e, 0x040f, 0x0306, 0x040c, 0x051a, 0x051b,
+   0x040e, 0x051c, 0x063a, 0x063b, 0x040f, 0x051e, 0x063e, 0x063f,
+   0x0100, 0x0200, 0x0302, 0x0303, 0x0200, 0x0300, 0x0402, 0x0403,
+   0x0302, 0x0404, 0x050a, 0x050b, 0x0303, 0x0406, 0x050e, 0x050f,
+   0x0200, 0x0300, 0x0402, 0x0403, 0x0300, 0x0400, 0x0502, 0x0503,
+   0x0402, 0x0504, 0x060a, 0x060b, 0x0403, 0x0506, 0x060e, 0x060f,
+   0x0302, 0x0404, 0x050a, 0x050b, 0x0404, 0x0508, 0x0612, 0x0613,
+   0x050a, 0x0614, 0x072a, 0x072b, 0x050b, 0x0616, 0x072e, 0x072f,
+   0x0303, 0x0406, 0x050e, 0x050f, 0x0406, 0x050c, 0x061a, 0x061b,
+   0x050e, 0x061c, 0x073a, 0x073b, 0x050f, 0x061e, 0x073e, 0x073f,
+   0x0202, 0x0304, 0x040a, 0x040b, 0x0304, 0x0408, 0x0512, 0x0513,
+   0x040a, 0x0514, 0x062a, 0x062b, 0x040b, 0x0516, 0x062e, 0x062f,
+   0x0304, 0x0408, 0x0512, 0x0513, 0x0408, 0x0510, 0x0622, 0x0623,
+   0x0512, 0x0624, 0x074a, 0x074b, 0x0513, 0x0626, 0x074e, 0x074f,
+   0x040a, 0x0514, 0x062a, 0x062b, 0x0514, 0x0628, 0x0752, 0x0753,
+   0x062a, 0x0754, 0x08aa, 0x08ab, 0x062b, 0x0756, 0x08ae, 0x08af,
+   0x040b, 0x0516, 0x062e, 0x062f, 0x0516, 0x062c, 0x075a, 0x075b,
+   0x062e, 0x075c, 0x08ba, 0x08bb, 0x062f, 0x075e, 0x08be, 0x08bf,
+   0x0203, 0x0306, 0x040e, 0x040f, 0x0306, 0x040c, 0x051a, 0x051b,
+   0x040e, 0x051c, 0x063a, 0x063b, 0x040f, 0x051e, 0x063e, 0x063f,
+   0x0306, 0x040c, 0x051a, 0x051b, 0x040c, 0x0518, 0x0632, 0x0633,
+   0x051a, 0x0634, 0x076a, 0x076b, 0x051b, 0x0636, 0x076e, 0x076f,
+   0x040e, 0x051c, 0x063a, 0x063b, 0x051c, 0x0638, 0x0772, 0x0773,
+   0x063a, 0x0774, 0x08ea, 0x08eb, 0x063b, 0x0776, 0x08ee, 0x08ef,
+   0x040f, 0x051e, 0x063e, 0x063f, 0x051e, 0x063c, 0x077a, 0x077b,
+   0x063e, 0x077c, 0x08fa, 0x08fb, 0x063f, 0x077e, 0x08fe, 0x08ff
+};
+/* --------------------------------------------------------------------- */
+
+
 
 /* --------------------------------------------------------------------- *//*!
 
-  \fn    unsigned int encode (unsigned int e,
-                              unsigned int w,
-                              unsigned int p1,
-                              unsigned int p3)
-  \brief Encodes the input word \a w into the output word \a e.
+  \fn    unsigned int canonical (unsigned int w, int scheme)
+  \brief Maps the 2-bit patterns of \a w onto those of scheme 1
+
+  \param w       The word of 16 2-bit patterns
+  \param scheme  The encoding scheme, 1, 2 or 3
+
+  The pattern that \a scheme encodes as 0 becomes 01, the one it
+  encodes as 10 becomes 10 and the one it encodes as 11 becomes 11, so
+  that a single table, BteCode, serves all schemes.
+
+  \verbatim
+     Scheme 1:  identity
+     Scheme 2:  01 <-> 10,          hi' = lo,      lo' = hi
+     Scheme 3:  01->10 10->11 11->01, hi' = hi ^ lo, lo' = hi
+  \endverbatim
+                                                                         */
+/* --------------------------------------------------------------------- */
+static __inline unsigned int canonical (unsigned int w, int scheme)
+{
+   unsigned int hi = (w >> 1) & 0x55555555;
+   unsigned int lo =  w       & 0x55555555;
+
+   if (scheme == 2) return (lo        << 1) | hi;
+   if (scheme == 3) return ((hi ^ lo) << 1) | hi;
+   return w;
+}
+/* --------------------------------------------------------------------- */
+
+
+
+/* --------------------------------------------------------------------- *//*!
+
+  \fn    unsigned int encode (unsigned int e, unsigned int w)
+  \brief Encodes the canonical patterns of \a w into the output word \a e.
 
   \param e   The current encoded word
-  \param w   The new set of 32 bits to add
-  \param p1  The pattern to associate with the encoding pattern 0
-  \param p3  The pattern to associate with the encoding pattern 3
-
-  The routine encodes 2 bits at a time, extracting the 2 bits from the
-  2 most significant bits of the input word \e w. These 2 bits are
-  compared to \a p1. If they are equal, a single bit, 0, is loaded into
-  the LSB of the output word and the output word is shifted left 1 bit.
-  If these 2 are equal to \e p3, an encoding pattern of 2 bits is shifted
-  into the LSB of the output word. If the pattern is 0, no bits are
-  inserted. Finally if the pattern is not 0, p1, or p3, the pattern
-  10 is inserted.
+  \param w   The new set of 16 canonical 2-bit patterns to add
+
+  The patterns are taken from the most significant end, 4 at a time.
+  Each 01 shifts a 0 into the LSB of the output word, each 10 or 11
+  shifts in 10 or 11 respectively and each 00 nothing.
                                                                          */
 /* --------------------------------------------------------------------- */
-static unsigned int encode (unsigned int e,
-                            unsigned int w,
-                            unsigned int p1,
-                            unsigned int p3)
+static __inline unsigned int encode (unsigned int e, unsigned int w)
 {
    int idx;
 
-   PRINTF (("e = %8.8x w = %8.8x P1 = %8.8x  P3 = %8.8x\n", e, w,  p1, p3));
-   
-   for (idx = 0; idx < 16; idx++, w <<= 2)
+   PRINTF (("e = %8.8x w = %8.8x\n", e, w));
+
+   for (idx = 0; idx < 4; idx++, w <<= 8)
    {
-       int x = w & 0xc0000000;
-       PRINTF (("w = %8.8x X = %8.8x adding ", w, x));
-       
-       if (x)
-       {
-           if (x == p1)  { e <<= 1;  PRINTF ((" a 0 ", e)); }
-           else 
-           {
-               /* Make some room, and shift in either 0b10 or 0b01 */
-               e <<= 2;
-               e  |= 2;
-               if (x == p3) { e |= 1; PRINTF ((" a 3 ")); }
-               else                   PRINTF ((" a 2 "));
-                 
-           }
-       }
-       else PRINTF ((" none"));
-       
-       PRINTF ((" e = %8.8x\n", e));
+       unsigned int code = BteCode[w >> 24];
+       e = (e << (code >> 8)) | (code & 0xff);
    }
 
    return e;
@@ -149,14 +215,8 @@ unsigned int BTE_wordEncode (unsigned int w,
     |     10 = 2,10    10 = 1,0       10 = 2,11
     |     11 = 3,11    11 = 2,11      11 = 1,0
    */
-   {
-       unsigned int p3 = 0xc0000000;
-       if (scheme == 3) p3 = 0x80000000;
-
-       scheme <<= 30;
-       e = encode (0, p, scheme, p3);
-       e = encode (e, w, scheme, p3);       
-   }
+   e = encode (0, canonical (p, scheme));
+   e = encode (e, canonical (w, scheme));
 
    
    /* Left justify the encoded word */
@@ -167,6 +227,30 @@ unsigned int BTE_wordEncode (unsigned int w,
 
 
 
+/* --------------------------------------------------------------------- *//*!
+
+  \fn    unsigned int bte_pack (unsigned int w)
+  \brief ORs each of the 16 pairs of bits of \a w and packs the results
+         into the low 16 bits, pair i into bit i
+
+  \param  w  The word
+  \return    The packed ORs
+                                                                         */
+/* --------------------------------------------------------------------- */
+static __inline unsigned int bte_pack (unsigned int w)
+{
+   w = (w | (w >> 1)) & 0x55555555;
+   w = (w | (w >> 1)) & 0x33333333;
+   w = (w | (w >> 2)) & 0x0f0f0f0f;
+   w = (w | (w >> 4)) & 0x00ff00ff;
+   w = (w | (w >> 8)) & 0x0000ffff;
+   return w;
+}
+/* --------------------------------------------------------------------- */
+
+
+
+
 /* --------------------------------------------------------------------- *//*!
 
   \fn    unsigned int BTE_wordPrepare (unsigned int w)
@@ -249,119 +333,31 @@ unsigned int BTE_wordPrepare (unsigned int w)
    unsigned int l2;
    unsigned int l3;
    unsigned int l4;
-   unsigned int l5;
    unsigned int  p;
 
    /*
-    |  FEDCBA9876543210fedcba9876543210
-    |   FEDCBA9876543210fedcba987654321
-    |                   
-    |  L4
-    |   E C A 8 6 4 2 0 e c a 8 6 4 2 0
-    |   F D B 9 7 5 3 1 f d b 9 7 5 3 1
-    |
+    | Each level is the one below with every pair of bits ORed into one
+    | bit and the results packed, so
     |
-    |  L3
-    |     C   8   4   0   c   8   4   0
-    |     D   9   5   1   d   9   5   1
-    |     E   A   6   2   e   a   6   2
-    |     F   B   7   3   f   b   7   3
-    |
-    |  L2
-    |         8       0       8       0
-    |         9       1       9       1
-    |         A       2       a       2
-    |         B       3       b       3
-    |         C       4       c       4
-    |         D       5       d       5
-    |         E       6       e       6
-    |         F       7       f       7
-    |
-    |  L1
-    |                 0               0
-    |                 1               1
-    |                 2               2
-    |                 3               3
-    |                 4               4
-    |                 5               5
-    |                 6               6
-    |                 7               7
-    |                 8               8
-    |                 9               9
-    |                 A               a
-    |                 B               b
-    |                 C               c
-    |                 D               d
-    |                 E               e
-    |                 F               f
-    |
-    |  L0
-    |   Well, you get the idea, its the OR of all the bits
-    |   Its not really necessary since this original value
-    |   is checked for a non-zero value.
+    |  L4, 16 bits, bit i is set if bits 2i, 2i+1 of the word  are
+    |  L3,  8 bits, bit i is set if bits 2i, 2i+1 of L4        are
+    |  L2,  4 bits, ...
+    |  L1,  2 bits, ...
     |
+    | The pair ORs are done for all 16 pairs at once and packed with
+    | shifts, rather than gathered a bit at a time.
    */
+   l4 = bte_pack (w);
+   l3 = bte_pack (l4);
+   l2 = bte_pack (l3);
+   l1 = bte_pack (l2);
 
-   l5 = w;
-   l4 = l5 | (l5 >>  1);   /* 2 bit    OR, every other bit */
-   l3 = l4 | (l4 >>  2);   /* Nibble   OR, every 4rth  bit */
-   l2 = l3 | (l3 >>  4);   /* Byte     OR, every 8th   bit */
-   l1 = l2 | (l2 >>  8);   /* Halfword OR, every 16th  bit */
-
-   PRINTF ((" Bit      OR = %8.8x\n"
-            " 2 Bit    OR = %8.8x\n"
-            " Nibble   OR = %8.8x\n"
-            " Byte     OR = %8.8x\n"
-            " Halfword OR = %8.8x\n",
-            l5,
-            l4 & 0x55555555,
-            l3 & 0x11111111,
-            l2 & 0x01010101,
-            l1 & 0x00010001));
-
-
-
-   /* L1 - Halfword level   */
-   p  = (((l1 >> 15) & 2) | (l1 & 1)) << 30;
-
-   /* L2 - Byte level   */
-   p |= ((l2 >> (24-3) & 0x8)
-     |   (l2 >> (16-2) & 0x4)
-     |   (l2 >> ( 8-1) & 0x2)
-     |   (l2 >> (   0) & 0x1)) << 26;
-
-   /* l3 - Nibble level */
-   p |= ((l3 >> (28-7) & 0x80)
-     |   (l3 >> (24-6) & 0x40)
-     |   (l3 >> (20-5) & 0x20)
-     |   (l3 >> (16-4) & 0x10)
-     |   (l3 >> (12-3) & 0x08)
-     |   (l3 >> ( 8-2) & 0x04)
-     |   (l3 >> ( 4-1) & 0x02)
-     |   (l3 >> (   0) & 0x01)) << 18;
-
-   /* L4 - 2-bit  level */
-   p |= ((l4 >> (30-15) & 0x8000)
-     |   (l4 >> (28-14) & 0x4000)
-     |   (l4 >> (26-13) & 0x2000)
-     |   (l4 >> (24-12) & 0x1000)
-     |   (l4 >> (22-11) & 0x0800)
-     |   (l4 >> (20-10) & 0x0400)
-     |   (l4 >> (18- 9) & 0x0200)
-     |   (l4 >> (16- 8) & 0x0100)
-     |   (l4 >> (14- 7) & 0x0080)
-     |   (l4 >> (12- 6) & 0x0040)
-     |   (l4 >> (10- 5) & 0x0020)
-     |   (l4 >> ( 8- 4) & 0x0010)
-     |   (l4 >> ( 6- 3) & 0x0008)
-     |   (l4 >> ( 4- 2) & 0x0004)
-     |   (l4 >> ( 2- 1) & 0x0002)
-     |   (l4 >> (    0) & 0x0001)) << 2;
+   p  = (l1 << 30) | (l2 << 26) | (l3 << 18) | (l4 << 2);
 
    PRINTF (("BTE pattern = %8.8x\n", p));
-   
-      
-   return p; 
+
+
+   return p;
 }
 /* --------------------------------------------------------------------- */
 
@@ -393,64 +389,41 @@ unsigned int BTE_wordPrepare (unsigned int w)
 /* --------------------------------------------------------------------- */
 unsigned int BTE_wordSize (unsigned int w, unsigned int p)
 {
-   int cnts   = 0;
    int min    = 0;
    int scheme = 0;
 
    if (w == 0) return 32;
    else
    {
-       int idx;
-       
-       for (idx = 0; idx < 16; idx++)
-       {
-           unsigned int x =   p & 3;
-           unsigned int y =  (w & 3);
-
-           cnts += (1 << 8*x);
-           cnts += (1 << 8*y);
-           
-           p >>= 2;
-           w >>= 2;
-       }
-       
-       {
-           int tot_00;
-           int tot_11;
-           int tot_01;
-           int tot_10;
-
-           /* Extract the counts from the 4 bytes */
-           int cnt_00 = (cnts >>  0) & 0xff;
-           int cnt_01 = (cnts >>  8) & 0xff;
-           int cnt_10 = (cnts >> 16) & 0xff;
-           int cnt_11 = (cnts >> 24) & 0xff;
-
-           /* Compute the sums for the 3 different encoding schemes */
-           tot_00 = cnt_00 + cnt_01 + cnt_10 + cnt_11;
-           tot_01 = cnt_01 + 2 * (cnt_10 + cnt_11);           
-           tot_10 = cnt_10 + 2 * (cnt_11 + cnt_01);           
-           tot_11 = cnt_11 + 2 * (cnt_01 + cnt_10);
-
-           /* Find the minimum */
-           min    = 32     < tot_01 ? (scheme=0, 32)     : (scheme=1, tot_01);
-           min    = tot_10 < min    ? (scheme=2, tot_10) : min;
-           min    = tot_11 < min    ? (scheme=3, tot_11) : min;
-           
-
-              
-           PRINTF (("Encode count = %d\n"
-                   "Raw Counts = %2d %2d %2d %2d = %2d\n"
-                   "W  0,1,2,2 = %2d %2d %2d %2d = %2d\n"
-                   "W  0,2,1,2 = %2d %2d %2d %2d = %2d\n"
-                   "W  0,2,2,1 = %2d %2d %2d %2d = %2d\n",
-                   min,
-                     cnt_00,   cnt_01,   cnt_10,   cnt_11, tot_00,
-                   0*cnt_00, 1*cnt_01, 2*cnt_10, 2*cnt_11, tot_01,
-                   0*cnt_00, 2*cnt_01, 1*cnt_10, 2*cnt_11, tot_10,
-                   0*cnt_00, 2*cnt_01, 2*cnt_10, 1*cnt_11, tot_11));
-       }
-       
+       /*
+        | The number of each pattern is the population count of the
+        | pairs' low and high bits combined, the 00s are not needed.
+       */
+       unsigned int plo =  p       & 0x55555555;
+       unsigned int phi = (p >> 1) & 0x55555555;
+       unsigned int wlo =  w       & 0x55555555;
+       unsigned int whi = (w >> 1) & 0x55555555;
+
+       int cnt_01 = __builtin_popcount (plo & ~phi) + __builtin_popcount (wlo & ~whi);
+       int cnt_10 = __builtin_popcount (phi & ~plo) + __builtin_popcount (whi & ~wlo);
+       int cnt_11 = __builtin_popcount (phi &  plo) + __builtin_popcount (whi &  wlo);
+
+       /* Compute the sums for the 3 different encoding schemes */
+       int tot_01 = cnt_01 + 2 * (cnt_10 + cnt_11);
+       int tot_10 = cnt_10 + 2 * (cnt_11 + cnt_01);
+       int tot_11 = cnt_11 + 2 * (cnt_01 + cnt_10);
+
+       /* Find the minimum */
+       min    = 32     < tot_01 ? (scheme=0, 32)     : (scheme=1, tot_01);
+       min    = tot_10 < min    ? (scheme=2, tot_10) : min;
+       min    = tot_11 < min    ? (scheme=3, tot_11) : min;
+
+       PRINTF (("Encode count = %d\n"
+                "Counts 01 10 11 = %2d %2d %2d\n"
+                "Totals 01 10 11 = %2d %2d %2d\n",
+                min,
+                cnt_01, cnt_10, cnt_11,
+                tot_01, tot_10, tot_11));
    }
 
    return (scheme << 16) | min;
@@ -42,6 +42,8 @@
    DATE       WHO WHAT
    ---------- --- ---------------------------------------------------------
    2018.04.18 jjr Created, split off from DuneDataCompressionTypes.h
+   2018.07.27 jjr Added the predictor selection
+   2018.07.28 jjr Added the histogram model resynchronization period
    
 \* ---------------------------------------------------------------------- */
 
@@ -66,6 +68,24 @@ enum MODE_K
 /* ---------------------------------------------------------------------- */
 
 
+/* ---------------------------------------------------------------------- *//*!
+ *
+ *   \enum  PREDICTOR_K
+ *   \brief Enumeration of the predictors used to form the symbols when
+ *          compressing. See Predictor.h for their definitions.
+ *
+\* ---------------------------------------------------------------------- */
+enum PREDICTOR_K
+{
+   PREDICTOR_K_PREVIOUS = 0,  /*!< The previous sample, first difference */
+   PREDICTOR_K_ORDER2   = 1,  /*!< Second order, linear extrapolation     */
+   PREDICTOR_K_MEDIAN   = 2,  /*!< Median of the time/channel neighbours  */
+   PREDICTOR_K_COMMON   = 3,  /*!< Previous sample + ASIC common mode     */
+   PREDICTOR_K_COUNT    = 4   /*!< The number of predictors               */
+};
+/* ---------------------------------------------------------------------- */
+
+
 /* ---------------------------------------------------------------------- *//*!
  *
  *  \typedef Mode_t
@@ -107,6 +127,18 @@ public:
                                                    packet, units = 64bit
                                                    words                  */
    ChannelConfig    chns[MODULE_K_NCHANNELS]; /*!< Per channel config     */
+   uint32_t                       predictor;  /*!< Compression predictor,
+                                                   a PREDICTOR_K value.
+                                                   Placed last so as not
+                                                   to move the registers
+                                                   of the fields above    */
+   uint32_t                          resync;  /*!< If 0, every packet sends
+                                                   all its histograms.
+                                                   Else a channel may code
+                                                   with the previous
+                                                   packet's model, but
+                                                   every resync'th packet
+                                                   sends all histograms   */
 };
 /* ---------------------------------------------------------------------- */
 
@@ -336,7 +336,9 @@ static int compress_test (int               fd,
    ////print_monitor (expMonitor, monitor, 0,-1);
 
    // Ignore the first time flag;
-   config.init = -1;
+   config.init      = -1;
+   config.predictor = PREDICTOR_K_PREVIOUS;
+   config.resync    = 0;
    uint64_t timestamp = 0x00800000LL;
 
    for (int ipacket = 0; ipacket < NPackets; ipacket++)
@@ -493,8 +495,10 @@ static void configure_hls (Source            &src,
                            MonitorModule &monitor)
 {
    // This is suppose to do the configuration
-   config.init  = true;
-   config.mode  = MODE_K_COPY;
+   config.init      = true;
+   config.mode      = MODE_K_COPY;
+   config.predictor = PREDICTOR_K_PREVIOUS;
+   config.resync    = 0;
    config.limit = 1 + 30 * PACKET_K_NSAMPLES + 1;
 
 
@@ -918,6 +922,20 @@ static int chan_decode (uint64_t const *buf, int nbuf, int position, bool printi
    _bfu_put (bfu, buf[position>>6], position);
 
 
+   // A raw channel, HISTOGRAM_FORMAT_K_RAW, is its 32 bit header
+   // followed by the remaining samples, 12 bits each
+   int rawpos = position;
+   if (_bfu_extractR (bfu, buf, rawpos, 4) == 2)
+   {
+      position += 32 + 12 * (PACKET_K_NSAMPLES - 1);
+      std::cout << "Raw Channel Total Bits " << std::setfill (' ') << std::setw (8)
+                << std::hex << position << ':' << ((position + 63 )>> 6) << "  "
+                << nbuf << std::endl;
+      return position;
+   }
+   _bfu_put (bfu, buf[position>>6], position);
+
+
    int          nbins;
    int            sym;
    int        novrflw;
@@ -1455,7 +1473,9 @@ int main (int argc, char *const argv[])
 
 
    // This is suppose to do the configuration
-   config.init = true;
+   config.init      = true;
+   config.predictor = PREDICTOR_K_PREVIOUS;
+   config.resync    = 0;
    DuneDataCompressionCore(sAxis, mAxis, moduleIdx, config, status);
    config.init = false;
 
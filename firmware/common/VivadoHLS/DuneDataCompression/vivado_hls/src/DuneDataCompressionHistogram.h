@@ -55,6 +55,7 @@
    DATE       WHO WHAT
    ---------- --- ---------------------------------------------------------
    2016.06.22 jjr Isolated from DuneDataCompresssion.cpp
+   2018.07.27 jjr Added symbol_mod for use with the predictors
 
 \* ---------------------------------------------------------------------- */
 
@@ -153,6 +154,7 @@ public:
    uint32_t     integrate_and_size ();
 
    static Symbol_t symbol          (AdcIn_t cur, AdcIn_t prv);
+   static Symbol_t symbol_mod      (AdcIn_t cur, AdcIn_t prv);
    static    Idx_t idx             (Symbol_t symbol, Symbol_t &ovr);
 
 public:
@@ -388,6 +390,36 @@ inline Histogram::Symbol_t Histogram::symbol (AdcIn_t cur, AdcIn_t prv)
 /* ----------------------------------------------------------------------- */
 
 
+/* ----------------------------------------------------------------------- *//*!
+ *
+ *  \brief  Calculates the symbol with the difference taken modulo the ADC
+ *          range, \e i.e. confined to -2048 to 2047
+ *  \return The symbol
+ *
+ *  \param[in]  cur  The current  ADC value
+ *  \param[in]  prv  The previous ADC value or its prediction
+ *
+ *  \par
+ *   Used with all but the default predictor, where the differences
+ *   themselves are carried modulo the ADC range, see Predictor.h.
+\* ---------------------------------------------------------------------- */
+inline Histogram::Symbol_t Histogram::symbol_mod (AdcIn_t cur, AdcIn_t prv)
+{
+#  pragma HLS inline
+
+   Histogram::Symbol_t sym;
+
+   ap_int<ADC_B_NBITS> d = prv - cur;
+   int diff = ((int)d << 1) | 1;
+
+   if (diff < 0) sym = -diff + 1;
+   else          sym =  diff;
+
+   return sym;
+}
+/* ----------------------------------------------------------------------- */
+
+
 /* ----------------------------------------------------------------------- *//*!
  *
  *  \brief  Limits the symbol to be within the range of the histogram index
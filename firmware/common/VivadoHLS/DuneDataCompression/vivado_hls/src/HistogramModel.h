@@ -0,0 +1,451 @@
+// -*-Mode: C++;-*-
+
+#ifndef _DUNE_DATA_COMPRESSION_HISTOGRAM_MODEL_H_
+#define _DUNE_DATA_COMPRESSION_HISTOGRAM_MODEL_H_
+
+
+/* ---------------------------------------------------------------------- *//*!
+ *
+ *  @file     HistogramModel.h
+ *  @brief    Carries a channel's coding model from one packet to the next
+ *  @verbatim
+ *                               Copyright 2018
+ *                                    by
+ *
+ *                       The Board of Trustees of the
+ *                    Leland Stanford Junior University.
+ *                           All rights reserved.
+ *
+ *  @endverbatim
+ *
+ *  @par Facility:
+ *  DUNE
+ *
+ *  @author
+ *  <russell@slac.stanford.edu>
+ *
+ *  @par Date created:
+ *  2018/07/28
+ *
+ * @par Credits:
+ * SLAC
+ *
+ *  @par
+ *  Normally each channel's histogram is sent in full and used as the
+ *  arithmetic coder's model. For quiet channels the histogram can be a
+ *  large part of the channel's bits. When adaptive models are enabled,
+ *  the model of the last fully sent histogram is kept and a channel may
+ *  instead send a short header, format HISTOGRAM_FORMAT_K_SAME, telling
+ *  the decoder to code with its saved model:
+ *
+ *     Format(4)=1 | NBins-1(8) | 0(4) | First ADC(12) | NOvrBits(4)
+ *                 | NOverflows(PACKET_B_NSAMPLES)
+ *
+ *  The overflow values and arithmetic coded symbols follow as usual.
+ *  The count of overflows is explicit since the saved model's bin 0
+ *  need not match this packet's.
+ *
+ *  This is compiled in only if HISTOGRAM_MODEL_REUSE, see Parameters.h,
+ *  which it is not for synthesis.
+ *
+ *  The saved model is used only if every symbol of this packet has a
+ *  non-zero probability in it and the estimated cost, header plus the
+ *  symbols coded with the saved probabilities, is less than that of
+ *  the full histogram plus the symbols coded with their own.
+ *
+ *  A channel whose coded size would exceed that of its raw samples, white
+ *  noise or a channel with many large overflows, is instead sent as its
+ *  samples packed 12 bits each, format HISTOGRAM_FORMAT_K_RAW:
+ *
+ *     Format(4)=2 | NBins-1(8) | 0(4) | First ADC(12) | 0(4)
+ *                 | ADC[1..N-1](12 each)
+ *
+ *  This too is compiled in only if HISTOGRAM_MODEL_RAW, which it is not
+ *  for synthesis.
+ *
+ *  The values are those the coder would have seen, so, for the modular
+ *  predictors, the running sum of the prediction errors. This caps a
+ *  channel at rawBits (), giving the packet a hard upper bound, see
+ *  MODULE_K_MAXSIZE_OB. The choice is first made from the estimated cost,
+ *  the smaller of the full and saved model costs plus the overflows. As
+ *  the estimate is not exact, APE_encode also falls back to raw if the
+ *  coded channel turns out to be larger. A raw channel leaves the saved
+ *  model unchanged, except in a packet where all histograms must be sent
+ *  in full. There it drops the model, so that a decoder starting with
+ *  that packet is never asked to use a model it has not seen.
+ *
+\* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *\
+
+   HISTORY
+   -------
+
+   DATE       WHO WHAT
+   ---------- --- ---------------------------------------------------------
+   2018.08.17 jjr The entropy is for PACKET_K_NSAMPLES rather than 1024
+                  samples. The raw channels are only chosen and sent if
+                  HISTOGRAM_MODEL_RAW
+   2018.08.17 jjr The saved model is only used and its costs only kept
+                  if HISTOGRAM_MODEL_REUSE
+   2018.08.16 jjr Added HISTOGRAM_FORMAT_K_RAW, choose returns the format
+   2018.07.28 jjr Created
+
+\* ---------------------------------------------------------------------- */
+
+
+#include "DuneDataCompressionHistogram.h"
+#include "BitStream64.h"
+
+
+/* ---------------------------------------------------------------------- *//*!
+ *
+ *   \enum  HISTOGRAM_FORMAT_K
+ *   \brief The values of the histogram header's format field
+ *
+\* ---------------------------------------------------------------------- */
+enum HISTOGRAM_FORMAT_K
+{
+   HISTOGRAM_FORMAT_K_FULL = 0, /*!< The histogram bins follow            */
+   HISTOGRAM_FORMAT_K_SAME = 1, /*!< Use the channel's saved model        */
+   HISTOGRAM_FORMAT_K_RAW  = 2  /*!< The samples follow, 12 bits each     */
+};
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+ *
+ *  \class HistogramModel
+ *  \brief The saved model of one channel
+ *
+ *  The costs are in units of 1/1024 bits. The cost of a symbol in bin i
+ *  is log2 (PACKET_K_NSAMPLES / p[i]), p[i] being the saved count of bin
+ *  i. An empty bin has cost 0, marking symbols that cannot be coded with
+ *  the model.
+ *
+\* ---------------------------------------------------------------------- */
+class HistogramModel
+{
+public:
+   typedef ap_uint<14> Cost_t;
+   typedef ap_uint<32> Bits_t;
+
+public:
+   void   save   (Histogram::Table const table[Histogram::NBins+1]);
+   int    choose (Histogram const &hist, bool reuse) const;
+   void   encode (OStream                           &ostream,
+                  BitStream64                          &bs64,
+                  Histogram::Table       table[Histogram::NBins+1],
+                  AdcIn_t                              first,
+                  Histogram const                      &hist) const;
+
+   Bits_t sameCost (Histogram const &hist) const;
+
+   static void   raw      (OStream &ostream, BitStream64 &bs64, AdcIn_t const *syms);
+   static Bits_t entropy  (Histogram::Entry_t cnt);
+   static Bits_t fullBits (Histogram const &hist);
+   static Bits_t sameBits ();
+   static Bits_t rawBits  ();
+
+public:
+   Histogram::Table m_table[Histogram::NBins+1]; /*!< Saved cumulative    */
+   Cost_t           m_cost [Histogram::NBins];   /*!< Cost per symbol     */
+   bool             m_valid;                     /*!< Have a saved model  */
+};
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+ *
+ *  \brief Saves the cumulative table of a fully sent histogram
+ *
+ *  \param[in] table  The cumulative table filled by Histogram::encode
+ *
+\* ---------------------------------------------------------------------- */
+inline void HistogramModel::save (Histogram::Table const table[Histogram::NBins+1])
+{
+   #pragma HLS INLINE
+
+   HISTOGRAM_MODEL_SAVE_LOOP:
+   for (int ibin = 0; ibin <= Histogram::NBins; ibin++)
+   {
+      #pragma HLS PIPELINE
+      m_table[ibin] = table[ibin];
+      if (HISTOGRAM_MODEL_REUSE && ibin < Histogram::NBins)
+      {
+         int p        = table[ibin + 1] - table[ibin];
+         m_cost[ibin] = p ? (entropy (p) * (1024 / Histogram::NBins)) / p : 0;
+      }
+   }
+
+   m_valid = true;
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+ *
+ *  \brief  The entropy of the symbols in a bin
+ *  \return cnt log2 (PACKET_K_NSAMPLES / cnt), in units of 1/NBins bits
+ *
+ *  \param[in]  cnt  The number of symbols in the bin
+ *
+ *  \par
+ *   ETable is for 1024 sample packets, cnt log2 (1024 / cnt). The coder
+ *   normalizes to PACKET_K_NSAMPLES, so each symbol of a shorter packet
+ *   costs 10 - PACKET_B_NSAMPLES bits less. With cnt less than the
+ *   number of samples, the result is never negative.
+ *
+\* ---------------------------------------------------------------------- */
+inline HistogramModel::Bits_t HistogramModel::entropy (Histogram::Entry_t cnt)
+{
+   #pragma HLS INLINE
+
+   return Bits_t (ETable[cnt])
+        - Bits_t (cnt) * ((10 - PACKET_B_NSAMPLES) * Histogram::NBins);
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+ *
+ *  \brief  Estimates the cost of fully sending a histogram and coding
+ *          its symbols with it
+ *  \return The cost, in units of 1/1024 bits
+ *
+ *  \param[in] hist  The histogram
+ *
+ *  \par
+ *   The histogram's cost is exact, it follows Histogram::encode, the
+ *   cost of the coded symbols is their entropy.
+ *
+\* ---------------------------------------------------------------------- */
+inline HistogramModel::Bits_t HistogramModel::fullBits (Histogram const &hist)
+{
+   #pragma HLS INLINE
+
+   Histogram::Entry_t maxcnt = hist.m_maxcnt;
+   int                 mbits = maxcnt.length () - maxcnt.countLeadingZeros ();
+   ap_uint<10>         total = 0;
+   Bits_t              hbits = 4 + 8 + 4 + 12 + 4;
+   Bits_t              ebits = 0;
+
+   HISTOGRAM_MODEL_FULL_LOOP:
+   for (int ibin = 0; ibin < Histogram::NBins; ibin++)
+   {
+      #pragma HLS PIPELINE
+      ap_uint<10>       left = PACKET_K_NSAMPLES - 1 - total;
+      int              nbits = left.length () - left.countLeadingZeros ();
+      Histogram::Entry_t cnt = hist.m_omask.test (ibin)
+                             ? hist.m_bins[ibin]
+                             : Histogram::Entry_t (0);
+
+      hbits += nbits >= mbits ? mbits : nbits;
+      ebits += entropy (cnt);
+      total += cnt;
+   }
+
+   return (hbits << 10) + ebits * (1024 / Histogram::NBins);
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+ *
+ *  \brief  The number of bits in a HISTOGRAM_FORMAT_K_SAME header
+ *
+\* ---------------------------------------------------------------------- */
+inline HistogramModel::Bits_t HistogramModel::sameBits ()
+{
+   return 4 + 8 + 4 + 12 + 4 + PACKET_B_NSAMPLES;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+ *
+ *  \brief  The number of bits in a HISTOGRAM_FORMAT_K_RAW channel
+ *
+\* ---------------------------------------------------------------------- */
+inline HistogramModel::Bits_t HistogramModel::rawBits ()
+{
+   return 4 + 8 + 4 + 12 + 4 + 12 * (PACKET_K_NSAMPLES - 1);
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+ *
+ *  \brief  Decides how to send this packet's channel
+ *  \retval HISTOGRAM_FORMAT_K_FULL, send the histogram in full
+ *  \retval HISTOGRAM_FORMAT_K_SAME, code with the saved model
+ *  \retval HISTOGRAM_FORMAT_K_RAW,  send the samples uncoded
+ *
+ *  \param[in]  hist  This packet's histogram
+ *  \param[in] reuse  If false, the saved model may not be used, either
+ *                    adaptive models are disabled or this is a packet
+ *                    where all histograms must be sent in full
+ *
+\* ---------------------------------------------------------------------- */
+inline int HistogramModel::choose (Histogram const &hist, bool reuse) const
+{
+   #pragma HLS INLINE
+
+#if HISTOGRAM_MODEL_REUSE || HISTOGRAM_MODEL_RAW
+   Bits_t              full = fullBits (hist);
+   int                  fmt = HISTOGRAM_FORMAT_K_FULL;
+
+   if (HISTOGRAM_MODEL_REUSE && reuse && m_valid && sameCost (hist) < full)
+   {
+      full = sameCost (hist);
+      fmt  = HISTOGRAM_FORMAT_K_SAME;
+   }
+
+#if HISTOGRAM_MODEL_RAW
+   // The overflows cost the same with either model
+   Histogram::Entry_t novr = hist.m_omask.test (0)
+                           ? hist.m_bins[0]
+                           : Histogram::Entry_t (0);
+   Bits_t             obits = Bits_t (novr * hist.m_nobits) << 10;
+
+   if (full + obits >= (rawBits () << 10)) fmt = HISTOGRAM_FORMAT_K_RAW;
+#endif
+
+   return fmt;
+#else
+   return HISTOGRAM_FORMAT_K_FULL;
+#endif
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+ *
+ *  \brief  Estimates the cost of coding this packet's symbols with the
+ *          saved model
+ *  \return The cost, in units of 1/1024 bits, the maximum if a symbol
+ *          cannot be coded with the saved model
+ *
+ *  \param[in]  hist  This packet's histogram
+ *
+\* ---------------------------------------------------------------------- */
+inline HistogramModel::Bits_t HistogramModel::sameCost (Histogram const &hist) const
+{
+   #pragma HLS INLINE
+
+   Bits_t same = sameBits () << 10;
+   bool   ok   = true;
+
+   HISTOGRAM_MODEL_CHOOSE_LOOP:
+   for (int ibin = 0; ibin < Histogram::NBins; ibin++)
+   {
+      #pragma HLS PIPELINE
+      Histogram::Entry_t cnt = hist.m_omask.test (ibin)
+                             ? hist.m_bins[ibin]
+                             : Histogram::Entry_t (0);
+      if (cnt && m_cost[ibin] == 0) ok = false;
+      same += cnt * m_cost[ibin];
+   }
+
+   return ok ? same : Bits_t (0xffffffff);
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+ *
+ *  \brief Encodes a HISTOGRAM_FORMAT_K_SAME header and provides the
+ *         saved model as the coding table
+ *
+ *  \param[in:out] ostream  The histogram/overflow output stream
+ *  \param[in:out]    bs64  The encoding bit stream
+ *  \param[out]      table  Returned as the saved cumulative table
+ *  \param[in]       first  The first ADC
+ *  \param[in]        hist  This packet's histogram, supplies the number
+ *                          of overflows and their width
+ *
+\* ---------------------------------------------------------------------- */
+inline void HistogramModel::encode (OStream                          &ostream,
+                                    BitStream64                         &bs64,
+                                    Histogram::Table table[Histogram::NBins+1],
+                                    AdcIn_t                             first,
+                                    Histogram const                     &hist) const
+{
+   #pragma HLS INLINE
+
+   int                 nobits = hist.m_nobits;
+   int               firstAdc = first;
+   Histogram::Entry_t    novr = hist.m_omask.test (0)
+                              ? hist.m_bins[0]
+                              : Histogram::Entry_t (0);
+
+   ap_uint<4+8+4+12+4> bits =  (HISTOGRAM_FORMAT_K_SAME << 28)   // 28   4
+                            | ((Histogram::NBins - 1)  << 20)   // 20,  8
+                            |  (firstAdc               <<  4)   //  4, 12
+                            |  (nobits                 <<  0);  //  0,  4
+
+   bs64.insert (ostream, bits, 4 + 8 + 4 + 12 + 4);
+   bs64.insert (ostream, novr, PACKET_B_NSAMPLES);
+
+   HISTOGRAM_MODEL_TABLE_LOOP:
+   for (int ibin = 0; ibin <= Histogram::NBins; ibin++)
+   {
+      #pragma HLS PIPELINE
+      table[ibin] = m_table[ibin];
+   }
+
+   bs64.transfer (ostream);
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+/* ---------------------------------------------------------------------- *//*!
+ *
+ *  \brief Encodes a HISTOGRAM_FORMAT_K_RAW channel, the header and the
+ *         samples, 12 bits each
+ *
+ *  \param[in:out] ostream  The histogram/overflow output stream
+ *  \param[in:out]    bs64  The encoding bit stream, empty on entry
+ *  \param[in]       syms  The PACKET_K_NSAMPLES values the coder sees
+ *
+\* ---------------------------------------------------------------------- */
+inline void HistogramModel::raw (OStream         &ostream,
+                                 BitStream64        &bs64,
+                                 AdcIn_t const      *syms)
+{
+   #pragma HLS INLINE
+
+   int                firstAdc = syms[0];
+   ap_uint<4+8+4+12+4> bits =  (HISTOGRAM_FORMAT_K_RAW << 28)   // 28   4
+                            | ((Histogram::NBins - 1) << 20)   // 20,  8
+                            |  (firstAdc              <<  4);  //  4, 12
+
+   bs64.insert (ostream, bits, 4 + 8 + 4 + 12 + 4);
+
+   HISTOGRAM_MODEL_RAW_LOOP:
+   for (int idx = 1; idx < PACKET_K_NSAMPLES; idx++)
+   {
+      #pragma HLS PIPELINE
+      bs64.insert (ostream, syms[idx] & 0xfff, 12);
+   }
+
+   bs64.transfer (ostream);
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+#endif
@@ -66,6 +66,7 @@ static void   write_toc (AxisOut                                    &mAxis,
                          int                                          &odx,
                          int                                        nchans,
                          int                                      nsamples,
+                         Predictor_t                             predictor,
                          ChannelOffset_t                         offsets[]);
 
 static void write_adcs (AxisBitStream                               &bAxis,
@@ -85,6 +86,9 @@ static inline void
                         Histogram                                  &hist1,
                         Histogram                                  &hist2,
                         Histogram                                  &hist3,
+                        bool                                      modular,
+                        HistogramModel                          models[4],
+                        bool                                        reuse,
                         int                                         ichan);
 
 static __inline void encode4 (APE_etxOut                          *etx,
@@ -96,6 +100,9 @@ static __inline void encode4 (APE_etxOut                          *etx,
                               AdcIn_t         adcs1[PACKET_K_NSAMPLES],
                               AdcIn_t         adcs2[PACKET_K_NSAMPLES],
                               AdcIn_t         adcs3[PACKET_K_NSAMPLES],
+                              bool                            modular,
+                              HistogramModel                models[4],
+                              bool                              reuse,
                               int                               ichan);
 
 static void             writeN (AxisBitStream                       &bAxis,
@@ -109,7 +116,10 @@ static void             writeN (AxisBitStream                       &bAxis,
 static void             encode (APE_etxOut                           &etx,
                                 Histogram                           &hist,
                                 AdcIn_t           adcs[PACKET_K_NSAMPLES],
-                                int                                nadcs);
+                                int                                nadcs,
+                                bool                             modular,
+                                HistogramModel                    &model,
+                                bool                               reuse);
 
 static void               pack (AxisBitStream                      &baxis,
                                 AxisOut                            &mAxis,
@@ -206,7 +216,7 @@ static void  write_packet (AxisOut                               &mAxis,
    ////offsets[NCHANS]   = bAxis.m_idx;
    offsets[NCHANS+1] = 0;
    odx = (offsets[NCHANS] + 63) >> 6;
-   write_toc (mAxis, odx, NCHANS, PACKET_K_NSAMPLES, offsets);
+   write_toc (mAxis, odx, NCHANS, PACKET_K_NSAMPLES, cmpCtx.predictor, offsets);
 
    // -----------------------------------------------------------------
    // The header has been removed. Before, information in this header
@@ -248,6 +258,7 @@ static void  write_packet (AxisOut                               &mAxis,
  *   \param[in:out]      odx  The current 64-bit output index
  *   \param[    in]   nchans  The number of channels
  *   \param[    in] nsamples  The number of samples per channel
+ *   \param[    in]predictor  The predictor used to form the symbols
  *   \param[    in]  offsets  The bit offsets for each channel
  *
 \* ---------------------------------------------------------------------- */
@@ -255,6 +266,7 @@ static void   write_toc (AxisOut                       &mAxis,
                          int                             &odx,
                          int                           nchans,
                          int                         nsamples,
+                         Predictor_t                predictor,
                          ChannelOffset_t            offsets[])
 {
    #pragma HLS INLINE
@@ -282,11 +294,12 @@ static void   write_toc (AxisOut                       &mAxis,
    // ------------------------------------------------------------------------------
    // Pack the trailer
    // ----------------
-   //         | Rsvd | #Channels-1 | #Samples-1 | Layout | Len64 | RecType | TlrFmt
-   //  # Bits |  12  |         12  |         12 |      4 |    16 |       4 |      4
-   //  Offset |  52  |         40  |         28 |     24 |     8 |       4 |      0
-   // ------------------------------------------------------------------------------
-   w64 = ((uint64_t)(nchans - 1)  << 40) |((uint64_t)(nsamples - 1) << 28)
+   //         | Rsvd | Predictor | #Channels-1 | #Samples-1 | Layout | Len64 | RecType | TlrFmt
+   //  # Bits |   8  |        4  |         12  |         12 |      4 |    16 |       4 |      4
+   //  Offset |  56  |       52  |         40  |         28 |     24 |     8 |       4 |      0
+   // ----------------------------------------------------------------------------------------
+   w64 = ((uint64_t)predictor     << 52)
+       | ((uint64_t)(nchans - 1)  << 40) |((uint64_t)(nsamples - 1) << 28)
        | (0 << 24) | ((((nchans + 2) / 2) + 1) << 8) | (TocRecType << 4) | (HeaderFmt << 0);
 
    commit (mAxis, odx, true, w64, 0, 0);
@@ -306,6 +319,14 @@ static void   write_toc (AxisOut                       &mAxis,
  *  \param[out]  offsets  The starting bit offset for each channel
  *  \param[ in]   cmpCtx  The per channeel compression context
  *
+ *  \par
+ *   The channels' saved histogram models, see HistogramModel.h, live
+ *   here since they must survive from one packet to the next. Each
+ *   write_adcs4 reads and updates 4 consecutive models, so they are
+ *   partitioned by 4. Only if HISTOGRAM_MODEL_REUSE are they kept from
+ *   one packet to the next, else they only hold the model each channel
+ *   was coded with, for the checker.
+ *
 \* ---------------------------------------------------------------------- */
 static inline void
        write_adcs (AxisBitStream                                       &bAxis,
@@ -315,6 +336,19 @@ static inline void
 {
    #pragma HLS INLINE
 
+#if HISTOGRAM_MODEL_REUSE
+   // --------------------------------------------------------------
+   // No reset is needed, the first packet after an initialization
+   // does not reuse the models and sets every model's m_valid flag.
+   // --------------------------------------------------------------
+   static HistogramModel Models[MODULE_K_NCHANNELS];
+   #pragma HLS RESET           variable=Models off
+   #pragma HLS ARRAY_PARTITION variable=Models cyclic factor=4
+#else
+   HistogramModel        Models[MODULE_K_NCHANNELS];
+   #pragma HLS ARRAY_PARTITION variable=Models cyclic factor=4
+#endif
+
    // Diagnostic printout
    write_adcs_print (cmpCtx.adcs.sg0,
                      cmpCtx.adcs.sg1,
@@ -333,6 +367,9 @@ static inline void
                    cmpCtx.hists.sg1[isg],
                    cmpCtx.hists.sg2[isg],
                    cmpCtx.hists.sg3[isg],
+                   cmpCtx.predictor != PREDICTOR_K_PREVIOUS,
+                   &Models[isg * 4],
+                   cmpCtx.reuse,
                    isg * 4);
    }
 
@@ -362,6 +399,9 @@ static inline void
                     Histogram                                 &hist1,
                     Histogram                                 &hist2,
                     Histogram                                 &hist3,
+                    bool                                     modular,
+                    HistogramModel                         models[4],
+                    bool                                       reuse,
                     int                                        ichan)
 {
    #pragma HLS INLINE /// STRIP 2018-07-01 off -- With inline on it fails at chan 4
@@ -381,6 +421,9 @@ static inline void
     encode4 (container.etxOut,
              hist0, hist1, hist2, hist3,
              adcs0, adcs1, adcs2, adcs3,
+             modular,
+             models,
+             reuse,
              ichan);
 
    writeN  (bAxis, mAxis, &offsets[ichan], container.etxOut, NPARALLEL, NSERIAL, ichan);
@@ -399,16 +442,19 @@ static __inline void encode4 (APE_etxOut                          *etx,
                               AdcIn_t        adcs1[PACKET_K_NSAMPLES],
                               AdcIn_t        adcs2[PACKET_K_NSAMPLES],
                               AdcIn_t        adcs3[PACKET_K_NSAMPLES],
+                              bool                            modular,
+                              HistogramModel                models[4],
+                              bool                              reuse,
                               int                               ichan)
 {
    #pragma HLS INLINE off
    #pragma HLS DATAFLOW
 
 
-   encode (etx[0], hists0, adcs0, PACKET_K_NSAMPLES);
-   encode (etx[1], hists1, adcs1, PACKET_K_NSAMPLES);
-   encode (etx[2], hists2, adcs2, PACKET_K_NSAMPLES);
-   encode (etx[3], hists3, adcs3, PACKET_K_NSAMPLES);
+   encode (etx[0], hists0, adcs0, PACKET_K_NSAMPLES, modular, models[0], reuse);
+   encode (etx[1], hists1, adcs1, PACKET_K_NSAMPLES, modular, models[1], reuse);
+   encode (etx[2], hists2, adcs2, PACKET_K_NSAMPLES, modular, models[2], reuse);
+   encode (etx[3], hists3, adcs3, PACKET_K_NSAMPLES, modular, models[3], reuse);
 
 
    #if CHECKER
@@ -421,35 +467,35 @@ static __inline void encode4 (APE_etxOut                          *etx,
          write_sizes_print (ichan, etx[idx].ba.m_cidx, etx[idx].ha.m_cidx);
       }
 
-      bool failure0 = encode_check (etx[0], hists0, adcs0);
+      bool failure0 = encode_check (etx[0], models[0], adcs0);
       if  (failure0)
       {
-         APE_encode (etx[0], hists0, adcs0, PACKET_K_NSAMPLES);
-         encode_check (etx[0], hists0, adcs0);
+         APE_encode (etx[0], hists0, adcs0, PACKET_K_NSAMPLES, modular, models[0], false);
+         encode_check (etx[0], models[0], adcs0);
 
       }
 
-      bool failure1 = encode_check (etx[1], hists1, adcs1);
+      bool failure1 = encode_check (etx[1], models[1], adcs1);
       if  (failure1)
       {
-         APE_encode (etx[1], hists1, adcs1, PACKET_K_NSAMPLES);
-         encode_check (etx[1], hists1, adcs1);
+         APE_encode (etx[1], hists1, adcs1, PACKET_K_NSAMPLES, modular, models[1], false);
+         encode_check (etx[1], models[1], adcs1);
 
       }
 
-      bool failure2 = encode_check (etx[2], hists2, adcs2);
+      bool failure2 = encode_check (etx[2], models[2], adcs2);
       if  (failure2)
       {
-         APE_encode (etx[2], hists2, adcs2, PACKET_K_NSAMPLES);
-         encode_check (etx[2], hists2, adcs2);
+         APE_encode (etx[2], hists2, adcs2, PACKET_K_NSAMPLES, modular, models[2], false);
+         encode_check (etx[2], models[2], adcs2);
 
       }
 
-      bool failure3 = encode_check (etx[3], hists3, adcs3);
+      bool failure3 = encode_check (etx[3], models[3], adcs3);
       if  (failure3)
       {
-         APE_encode (etx[3], hists3, adcs3, PACKET_K_NSAMPLES);
-         encode_check (etx[3], hists3, adcs3);
+         APE_encode (etx[3], hists3, adcs3, PACKET_K_NSAMPLES, modular, models[3], false);
+         encode_check (etx[3], models[3], adcs3);
       }
 
       if (failure0 || failure1 || failure2 || failure3)
@@ -470,16 +516,23 @@ static __inline void encode4 (APE_etxOut                          *etx,
  *   \param[ in]  hist  The encoding frequency distribution
  *   \param[ in]  adcs  The ADCs to be encoded
  *   \param[ in] nadcs  The number of ADCs to be encoded
+ *   \param[ in]modular  If true, the differences are taken modulo the
+ *                       ADC range, see Predictor.h
+ *   \param[in:out]model  The channel's saved histogram model
+ *   \param[ in]  reuse  If true, the saved model may be used
  *
 \* ---------------------------------------------------------------------- */
 static void encode (APE_etxOut                        &etx,
                     Histogram                        &hist,
                     AdcIn_t        adcs[PACKET_K_NSAMPLES],
-                    int                             nadcs)
+                    int                             nadcs,
+                    bool                          modular,
+                    HistogramModel                 &model,
+                    bool                            reuse)
 {
   #pragma HLS INLINE
 
-   APE_encode (etx, hist, adcs, PACKET_K_NSAMPLES);
+   APE_encode (etx, hist, adcs, PACKET_K_NSAMPLES, modular, model, reuse);
 
 }
 /* ---------------------------------------------------------------------- */
@@ -757,19 +810,23 @@ static bool decode_data (uint16_t      dadcs[PACKET_K_NSAMPLES],
                          uint64_t  const                  *ebuf,
                          BFU                              &obfu,
                          uint64_t const                   *obuf,
-                         Histogram const                  &hist,
+                         HistogramModel const            &model,
                          AdcIn_t const  adcs[PACKET_K_NSAMPLES])
 {
-   // Integrate the histogram
+   // ----------------------------------------------------------------
+   // The model the channel was coded with. Whether the histogram was
+   // sent in full or not, it is now the channel's saved model.
+   // ----------------------------------------------------------------
    APD_table_t table[Histogram::NBins + 2];
-   int  cnt  = hist.m_lastgt0 + 1;
+   int  cnt  = 0;
+   for (int idx = 0; idx < Histogram::NBins; idx++)
+   {
+      if (model.m_table[idx + 1] != model.m_table[idx]) cnt = idx + 1;
+   }
    table[0]  = cnt;
-   int total = 0;
-   for (int idx = 1;; idx++)
+   for (int idx = 1; idx <= cnt + 1; idx++)
    {
-      table[idx] = total;
-      if (idx > cnt) break;
-      total     += hist.m_omask.test (idx -1) ? hist.m_bins[idx-1] : Histogram::Entry_t (0);
+      table[idx] = model.m_table[idx - 1];
    }
 
    uint16_t bins[Histogram::NBins];
@@ -777,7 +834,45 @@ static bool decode_data (uint16_t      dadcs[PACKET_K_NSAMPLES],
    int   novrflw;
 
    int       prv;
-   int oposition = hist_decode (bins, &nbins, &prv, &novrflw, obfu, obuf);
+   int oposition;
+
+   int position = _bfu_get_pos (obfu);
+   int      fmt = _bfu_extractR (obfu, obuf, position, 4);
+   if (fmt == HISTOGRAM_FORMAT_K_RAW)
+   {
+      // The samples follow the header, 12 bits each
+                  _bfu_extractR (obfu, obuf, position,  8);
+                  _bfu_extractR (obfu, obuf, position,  4);
+      prv       = _bfu_extractR (obfu, obuf, position, 12);
+                  _bfu_extractR (obfu, obuf, position,  4);
+
+      int Nerrs = 0;
+      for (int idy = 0; idy < PACKET_K_NSAMPLES; idy++)
+      {
+         dadcs[idy] = idy ? _bfu_extractR (obfu, obuf, position, 12) : prv;
+         if (dadcs[idy] != adcs[idy])
+         {
+            std::cout << std::endl << "Error @" << std::hex << idy << " raw" << std::endl;
+            if (Nerrs++ > 20) return true;
+         }
+      }
+
+      return Nerrs != 0;
+   }
+   else if (fmt == HISTOGRAM_FORMAT_K_SAME)
+   {
+      nbins     = _bfu_extractR (obfu, obuf, position,  8) + 1;
+                  _bfu_extractR (obfu, obuf, position,  4);
+      prv       = _bfu_extractR (obfu, obuf, position, 12);
+      novrflw   = _bfu_extractR (obfu, obuf, position,  4);
+                  _bfu_extractR (obfu, obuf, position, PACKET_B_NSAMPLES);
+      oposition = position;
+   }
+   else
+   {
+      _bfu_put (obfu, obuf[0], 0);
+      oposition = hist_decode (bins, &nbins, &prv, &novrflw, obfu, obuf);
+   }
 
 
    APD_dtx dtx;
@@ -788,7 +883,7 @@ static bool decode_data (uint16_t      dadcs[PACKET_K_NSAMPLES],
    uint16_t sym = prv;
    for (int idy = 0; ; idy++)
    {
-      dadcs[idy] = prv;
+      dadcs[idy] = prv & 0xfff;
       APD_dumpStatement (print_decoded (sym, idy));
 
       if (dadcs[idy] != adcs[idy])
@@ -873,7 +968,7 @@ void restore (OStream &ostream, uint64_t *buf, int nbuf)
    return;
 }
 
-bool encode_check (APE_etxOut &etx, Histogram const &hist, AdcIn_t const adcs[PACKET_K_NSAMPLES])
+bool encode_check (APE_etxOut &etx, HistogramModel const &model, AdcIn_t const adcs[PACKET_K_NSAMPLES])
 {
    static uint64_t hbuf[PACKET_K_NSAMPLES/(sizeof (uint64_t) / sizeof (int16_t))];
    static uint64_t ebuf[PACKET_K_NSAMPLES/(sizeof (uint64_t) / sizeof (int16_t)) + Histogram::NBins * 10/64 + 10];
@@ -891,7 +986,7 @@ bool encode_check (APE_etxOut &etx, Histogram const &hist, AdcIn_t const adcs[PA
 
 
    uint16_t dadcs[PACKET_K_NSAMPLES];
-   bool failure = decode_data (dadcs, ebfu, ebuf, hbfu, hbuf, hist, adcs);
+   bool failure = decode_data (dadcs, ebfu, ebuf, hbfu, hbuf, model, adcs);
 
    restore (etx.ha, hbuf, hcnt);
    restore (etx.ba, ebuf, ecnt);
@@ -42,6 +42,15 @@
 
    DATE       WHO WHAT
    ---------- --- ---------------------------------------------------------
+   2018.08.17 jjr Added HISTOGRAM_MODEL_RAW, the raw channels are left out
+                  of synthesis, MODULE_K_MAXSIZE_OB is only a bound with it
+   2018.08.17 jjr Added HISTOGRAM_MODEL_REUSE, the saved histogram models
+                  are left out of synthesis
+   2018.08.16 jjr Added MODULE_K_MAXSIZE_CHANNEL, MODULE_K_MAXSIZE_OB is now
+                  a hard bound, channels are never larger than raw
+   2018.07.30 jjr The packet length may be set at compile time, giving
+                  PACKET_B_NSAMPLES, e.g. -DPACKET_B_NSAMPLES=8 for 256
+                  sample packets. PACKET_K_NSAMPLES is derived from it.
    2018.04.18 jjr Created, split off from DuneDataCompressionTypes.h
    
 \* ---------------------------------------------------------------------- */
@@ -101,7 +110,8 @@
 /* ---------------------------------------------------------------------- *//*!
  *
  *  \def    PACKET_B_NSAMPLES
- *  \brief  The number of ADCs per packet, expressed in bits
+ *  \brief  The number of ADCs per packet, expressed in bits. This
+ *          defaults to 10 but may be given on the command line.
  *
  *  \def    PACKET_K_NSAMPLES
  *  \brief  The number of ADCs per packet
@@ -110,9 +120,68 @@
  *  \brief The number of ADCs per packet, expressed as a bit mask
  *
 \* ---------------------------------------------------------------------- */
+#ifndef PACKET_B_NSAMPLES
 #define PACKET_B_NSAMPLES   10
-#define PACKET_K_NSAMPLES 1024
+#endif
+
+#define PACKET_K_NSAMPLES (1 << PACKET_B_NSAMPLES)
 #define PACKET_M_NSAMPLES (PACKET_K_NSAMPLES - 1)
+
+#if PACKET_B_NSAMPLES < 8 || PACKET_B_NSAMPLES > 10
+#error "PACKET_B_NSAMPLES must be 8, 9 or 10, 256, 512 or 1024 samples"
+#endif
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+ *
+ *  \def    HISTOGRAM_MODEL_REUSE
+ *  \brief  If non-zero, a channel may code with the model of the last
+ *          histogram it sent in full, see HistogramModel.h.
+ *
+ *  \par
+ *          The saved models are state carried from one packet to the
+ *          next and have not been through C-synthesis. Until they are
+ *          shown to meet the II and the timing, they are left out of the
+ *          synthesized design, which then sends every histogram in full,
+ *          as if config.resync were 0. Define this as 1 to include them.
+ *
+\* ---------------------------------------------------------------------- */
+#if     !defined(HISTOGRAM_MODEL_REUSE)
+#if     !defined(__SYNTHESIS__)
+#define HISTOGRAM_MODEL_REUSE 1
+#else
+#define HISTOGRAM_MODEL_REUSE 0
+#endif
+#endif
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+ *
+ *  \def    HISTOGRAM_MODEL_RAW
+ *  \brief  If non-zero, a channel that would not compress is sent raw,
+ *          see HistogramModel.h, bounding its size at
+ *          MODULE_K_MAXSIZE_CHANNEL.
+ *
+ *  \par
+ *          The choice costs a pass over the histogram and the fallback a
+ *          second copy of the channel's samples, neither of which has
+ *          been through C-synthesis. As with HISTOGRAM_MODEL_REUSE, they
+ *          are left out of the synthesized design until they are shown
+ *          to meet the II and the timing. Without them a channel is
+ *          always coded and MODULE_K_MAXSIZE_OB is not a bound.
+ *
+\* ---------------------------------------------------------------------- */
+#if     !defined(HISTOGRAM_MODEL_RAW)
+#if     !defined(__SYNTHESIS__)
+#define HISTOGRAM_MODEL_RAW 1
+#else
+#define HISTOGRAM_MODEL_RAW 0
+#endif
+#endif
 /* ---------------------------------------------------------------------- */
 
 
@@ -122,12 +191,32 @@
  *  \def    MODULE_K_MAXSIZE_IB
  *  \brief  Maximum size of an inbound frame
  *
+ *  \def    MODULE_K_MAXSIZE_CHANNEL
+ *  \brief  Maximum size, in bits, of one compressed channel. A channel
+ *          that would be larger is sent raw, its 32 bit header followed
+ *          by the remaining samples, 12 bits each, see HistogramModel.h.
+ *          This holds only if HISTOGRAM_MODEL_RAW.
+ *
  *  \def    MODULE_K_MAXSIZE_OB
- *  \brief  Maximum size of an outbound packet
+ *  \brief  Maximum size, in 64-bit words, of an outbound packet. If
+ *          HISTOGRAM_MODEL_RAW, this is a hard bound, the sum of
+ *            - the record header, the WIB header words and exceptions,
+ *              at most 1 + (7 + 6 * 32) + 32/4 words, see PacketContext
+ *            - every channel at MODULE_K_MAXSIZE_CHANNEL
+ *            - the table of contents, 32 bits per channel plus the
+ *              trailer word
+ *            - the 2 word epilogue
  *
 \* ---------------------------------------------------------------------- */
 #define MODULE_K_MAXSIZE_IB  (sizeof (WibFrame) / sizeof (uint64_t))
-#define MODULE_K_MAXSIZE_OB  (MODULE_K_NCHANNELS * PACKET_K_NSAMPLES/4 + 100)
+
+#define MODULE_K_MAXSIZE_CHANNEL  (32 + 12 * (PACKET_K_NSAMPLES - 1))
+
+#define MODULE_K_MAXSIZE_OB                                                \
+        ((1 + (7 + 6 * 32) + 32/4)                                         \
+       + (MODULE_K_NCHANNELS * MODULE_K_MAXSIZE_CHANNEL + 63) / 64         \
+       + ((MODULE_K_NCHANNELS + 2) / 2 + 1)                                \
+       + 2)
 /* ---------------------------------------------------------------------- */
 
 #endif
\ No newline at end of file
@@ -0,0 +1,203 @@
+// -*-Mode: C++;-*-
+
+#ifndef _DUNE_DATA_COMPRESSION_PREDICTOR_H_
+#define _DUNE_DATA_COMPRESSION_PREDICTOR_H_
+
+
+/* ---------------------------------------------------------------------- *//*!
+ *
+ *  @file     Predictor.h
+ *  @brief    The predictors used to form the symbols to be compressed
+ *  @verbatim
+ *                               Copyright 2018
+ *                                    by
+ *
+ *                       The Board of Trustees of the
+ *                    Leland Stanford Junior University.
+ *                           All rights reserved.
+ *
+ *  @endverbatim
+ *
+ *  @par Facility:
+ *  DUNE
+ *
+ *  @author
+ *  <russell@slac.stanford.edu>
+ *
+ *  @par Date created:
+ *  2018/07/27
+ *
+ * @par Credits:
+ * SLAC
+ *
+ *  @par
+ *  Each ADC is coded as its difference from a prediction. The default,
+ *  PREDICTOR_K_PREVIOUS, predicts the previous sample on the same
+ *  channel, \e i.e. the first difference. The others are
+ *
+ *    - PREDICTOR_K_ORDER2  2 x[c][t-1] - x[c][t-2]
+ *    - PREDICTOR_K_MEDIAN  The median of a = x[c][t-1], b = x[c-1][t]
+ *                          and a + b - x[c-1][t-1]
+ *    - PREDICTOR_K_COMMON  x[c][t-1] plus the common mode of the channel's
+ *                          ASIC, estimated from the changes, x[t]-x[t-1],
+ *                          of up to 3 of the lower numbered channels in
+ *                          the same group of PREDICTOR_K_NGROUP channels
+ *
+ *  Predictions only use lower numbered channels, so a decoder that
+ *  restores the channels in order has everything it needs. Predictions
+ *  are clamped to the ADC range. The first sample of a channel is not
+ *  predicted, it is carried as the seed.
+ *
+ *  For all but the default, the difference is taken modulo the ADC range
+ *  (see Histogram::symbol_mod) and the value stored for the encoder is
+ *  the running sum of these differences, again modulo the ADC range.
+ *  The encoder's first difference of this sequence then reproduces the
+ *  prediction error, and a decoder's running sum, masked to 12 bits,
+ *  reproduces the sequence. The packet TOC carries the predictor so the
+ *  decoder can undo the prediction.
+ *
+\* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *\
+
+   HISTORY
+   -------
+
+   DATE       WHO WHAT
+   ---------- --- ---------------------------------------------------------
+   2018.07.27 jjr Created
+
+\* ---------------------------------------------------------------------- */
+
+
+#include "Config.h"
+#include "DuneDataCompressionTypes.h"
+
+
+/* ---------------------------------------------------------------------- *//*!
+ *
+ *  \def   PREDICTOR_K_NGROUP
+ *  \brief The number of consecutive channels sharing a common mode, that
+ *         is one front-end ASIC
+ *
+\* ---------------------------------------------------------------------- */
+#define PREDICTOR_K_NGROUP 16
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+ *
+ *  \typedef Predictor_t
+ *  \brief   The predictor, one of the PREDICTOR_K values
+ *
+\* ---------------------------------------------------------------------- */
+typedef ap_uint<4> Predictor_t;
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+ *
+ *  \brief  Clamps a prediction to the ADC range
+ *  \return The clamped prediction
+ *
+ *  \param[in]  p  The prediction
+ *
+\* ---------------------------------------------------------------------- */
+static inline int predictor_clamp (int p)
+{
+   #pragma HLS INLINE
+   return p < 0 ? 0 : p > (1 << ADC_B_NBITS) - 1 ? (1 << ADC_B_NBITS) - 1 : p;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+ *
+ *  \brief  Returns the median of 3 values
+ *  \return The median
+ *
+\* ---------------------------------------------------------------------- */
+static inline int predictor_median3 (int a, int b, int c)
+{
+   #pragma HLS INLINE
+   int lo = a < b ? a : b;
+   int hi = a < b ? b : a;
+   return c <= lo ? lo : c >= hi ? hi : c;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+ *
+ *  \brief  Predicts the ADC of channel \a ichan on the current sample
+ *  \return The prediction
+ *
+ *  \param[in] predictor  The predictor
+ *  \param[in]     ichan  The channel number
+ *  \param[in]    iframe  The sample number, must be > 0
+ *  \param[in]       cur  The ADCs of all channels for the current sample.
+ *                        Only channels below \a ichan are used.
+ *  \param[in]        x1  The ADCs of all channels, previous sample
+ *  \param[in]        x2  The ADCs of all channels, sample before that.
+ *                        Not used when \a iframe == 1.
+ *
+\* ---------------------------------------------------------------------- */
+static inline AdcIn_t predict (Predictor_t               predictor,
+                               int                           ichan,
+                               int                          iframe,
+                               AdcIn_t const cur[MODULE_K_NCHANNELS],
+                               AdcIn_t const  x1[MODULE_K_NCHANNELS],
+                               AdcIn_t const  x2[MODULE_K_NCHANNELS])
+{
+   #pragma HLS INLINE
+
+   int prv = x1[ichan];
+   int   p = prv;
+
+   if (predictor == PREDICTOR_K_ORDER2)
+   {
+      if (iframe > 1) p = 2 * prv - (int)x2[ichan];
+   }
+   else if (predictor == PREDICTOR_K_MEDIAN)
+   {
+      if (ichan > 0)
+      {
+         int a = prv;
+         int b = cur[ichan - 1];
+         p     = predictor_median3 (a, b, a + b - (int)x1[ichan - 1]);
+      }
+   }
+   else if (predictor == PREDICTOR_K_COMMON)
+   {
+      int n = ichan % PREDICTOR_K_NGROUP;
+      if (n > 0)
+      {
+         int d1 = (int)cur[ichan - 1] - (int)x1[ichan - 1];
+         int cm = d1;
+         if (n == 2)
+         {
+            int d2 = (int)cur[ichan - 2] - (int)x1[ichan - 2];
+            cm     = (d1 + d2) >> 1;
+         }
+         else if (n > 2)
+         {
+            int d2 = (int)cur[ichan - 2] - (int)x1[ichan - 2];
+            int d3 = (int)cur[ichan - 3] - (int)x1[ichan - 3];
+            cm     = predictor_median3 (d1, d2, d3);
+         }
+         p = prv + cm;
+      }
+   }
+
+   return predictor_clamp (p);
+}
+/* ---------------------------------------------------------------------- */
+
+
+#endif
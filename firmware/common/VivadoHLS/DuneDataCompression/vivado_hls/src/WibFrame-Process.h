@@ -81,11 +81,17 @@
    DATE       WHO WHAT
    ---------- --- ---------------------------------------------------------
    2018.04.23 jjr Created
+   2018.07.27 jjr Added the selectable predictors
+   2018.07.28 jjr Added the histogram model reuse flag
+   2018.08.17 jjr Partitioned and pipelined the predictor arrays and loops,
+                  the predictors are left out of synthesis, PROCESS_PREDICT
+   2018.08.17 jjr The resync countdown is kept only if HISTOGRAM_MODEL_REUSE
 
 \* ---------------------------------------------------------------------- */
 
 #include "Parameters.h"
 #include "DuneDataCompressionHistogram.h"
+#include "Predictor.h"
 
 
 //// STRIP typedef Histogram::Symbol_t Symbol_t;
@@ -108,6 +114,22 @@ typedef AdcIn_t Symbol_t;
 #endif
 
 
+/* ======================================================================== */
+/* PREDICTORS                                                               */
+/* Only the default predictor, the first difference, has been through       */
+/* C-synthesis. Until the others are shown to meet the II and the timing,   */
+/* they are left out of the synthesized design, which then always uses     */
+/* the first difference. Define PROCESS_PREDICT as 1 to include them.       */
+/* ------------------------------------------------------------------------ */
+#if     !defined(PROCESS_PREDICT)
+#if     !defined(__SYNTHESIS__)
+#define PROCESS_PREDICT 1
+#else
+#define PROCESS_PREDICT 0
+#endif
+#endif
+
+
 #if    PROCESS_PRINT_ADCS
 static void print_adcs (AdcIn_t const adcs0[PACKET_K_NSAMPLES],
                         AdcIn_t const adcs1[PACKET_K_NSAMPLES],
@@ -371,8 +393,10 @@ public:
 \* ------------------------------------------------------------------------ */
 struct CompressionContext
 {
-   Adcs        adcs;
-   Histograms hists;
+   Adcs             adcs;
+   Histograms      hists;
+   Predictor_t predictor;  /*!< The predictor used to form the symbols  */
+   bool            reuse;  /*!< Saved histogram models may be used      */
 };
 /* ------------------------------------------------------------------------ */
 
@@ -395,6 +419,8 @@ static inline void        process4 (AdcIn_t   adcs0[PACKET_K_NSAMPLES],
                                     Histogram                    &hist3,
                                     Histogram               histsLcl[4],
                                     AdcIn_t                      prv[4],
+                                    AdcIn_t const                prd[4],
+                                    bool                        modular,
                                     Adc48_t                      adcs48,
                                     int                          iframe,
                                     int                           ichan);
@@ -543,6 +569,92 @@ static void process_frame
    }
 
 
+   // --------------------------------------------------------------
+   // For all but the default predictor, form the predictions first.
+   // A prediction may depend on the current ADCs of lower numbered
+   // channels, so all the ADCs of this frame are extracted up front.
+   // X1 and X2 hold the ADCs of the previous 2 frames.
+   //
+   // These are partitioned like Prv. The symbol loop reads Prd 8
+   // channels at a time, and a prediction reads up to 3 lower
+   // numbered channels of Cur and X1.
+   // --------------------------------------------------------------
+   AdcIn_t       Prd[MODULE_K_NCHANNELS];
+   #pragma HLS ARRAY_PARTITION variable=Prd cyclic factor=8
+
+#if PROCESS_PREDICT
+   static AdcIn_t X1[MODULE_K_NCHANNELS];
+   #pragma HLS RESET           variable=X1 off
+   #pragma HLS ARRAY_PARTITION variable=X1 cyclic factor=8
+
+   static AdcIn_t X2[MODULE_K_NCHANNELS];
+   #pragma HLS RESET           variable=X2 off
+   #pragma HLS ARRAY_PARTITION variable=X2 cyclic factor=8
+
+   AdcIn_t       Cur[MODULE_K_NCHANNELS];
+   #pragma HLS ARRAY_PARTITION variable=Cur cyclic factor=8
+
+   Predictor_t predictor = config.predictor;
+#else
+   Predictor_t predictor = PREDICTOR_K_PREVIOUS;
+#endif
+   bool          modular = predictor != PREDICTOR_K_PREVIOUS;
+   cmpCtx.predictor      = predictor;
+
+
+   // ----------------------------------------------------------------
+   // Count down the packets to the next one where all the histograms
+   // are sent in full. Every resync'th packet can be decoded without
+   // any knowledge of the preceding packets, as can the first one
+   // after an initialization.
+   // ----------------------------------------------------------------
+#if HISTOGRAM_MODEL_REUSE
+   static uint32_t Countdown = 0;
+   #pragma HLS RESET variable=Countdown
+
+   if (iframe == 0)
+   {
+      if (config.init || config.resync == 0) Countdown = 0;
+      cmpCtx.reuse = Countdown != 0;
+      Countdown    = Countdown ? Countdown - 1 : config.resync - 1;
+   }
+#else
+   cmpCtx.reuse = false;
+#endif
+
+#if PROCESS_PREDICT
+   if (modular)
+   {
+      PROCESS_PREDICT_EXTRACT_LOOP:
+      for (int ichan = 0; ichan < MODULE_K_NCHANNELS; ichan += 4)
+      {
+         #pragma HLS PIPELINE
+         Adc48_t adc4   = adcs8[ichan >> 3] >> ((ichan & 4) ? 48 : 0);
+         Cur[ichan + 0] = extract_adc0 (adc4);
+         Cur[ichan + 1] = extract_adc1 (adc4);
+         Cur[ichan + 2] = extract_adc2 (adc4);
+         Cur[ichan + 3] = extract_adc3 (adc4);
+      }
+
+      PROCESS_PREDICT_LOOP:
+      for (int ichan = 0; ichan < MODULE_K_NCHANNELS; ichan++)
+      {
+         #pragma HLS PIPELINE
+         Prd[ichan] = iframe ? predict (predictor, ichan, iframe, Cur, X1, X2)
+                             : Cur[ichan];
+      }
+
+      PROCESS_PREDICT_SHIFT_LOOP:
+      for (int ichan = 0; ichan < MODULE_K_NCHANNELS; ichan++)
+      {
+         #pragma HLS UNROLL factor=8
+         X2[ichan] = X1[ichan];
+         X1[ichan] = Cur[ichan];
+      }
+   }
+#endif
+
+
    // -----------------------------------------------------------
    // Access the 12-bit ADCs, form the symbols and histogram them
    // -----------------------------------------------------------
@@ -567,6 +679,8 @@ static void process_frame
 
                 &HistsLcl[ichan],
                 &Prv[ichan],
+                &Prd[ichan],
+                modular,
                 adc4,
                 iframe,
                 ichan);
@@ -586,6 +700,8 @@ static void process_frame
 
                 &HistsLcl[ichan],
                 &Prv[ichan],
+                &Prd[ichan],
+                modular,
                 adc4,
                 iframe,
                 ichan);
@@ -618,6 +734,12 @@ static void process_frame
  *   \param[in:out]    prv  The previous values of the 4 ADCs. After
  *                          being used to form the differences they
  *                          are replaced by the current ADC values.
+ *   \param[in]        prd  The predictions of the 4 ADCs, only used
+ *                          if \a modular is true
+ *   \param[in]    modular  If true, the symbol is the difference from
+ *                          the prediction, taken modulo the ADC range,
+ *                          and the running sum of these differences is
+ *                          stored in place of the ADC, see Predictor.h
  *   \param[in]      adcs4  The 4 x 12 input ADCs
  *
  *  \param[in]      iframe  The frame number
@@ -634,6 +756,8 @@ static void process4 (AdcIn_t adcs0[PACKET_K_NSAMPLES],
                       Histogram                  &hist3,
                       Histogram             histsLcl[4],
                       AdcIn_t                    prv[4],
+                      AdcIn_t const              prd[4],
+                      bool                      modular,
                       Adc48_t                     adcs4,
                       int                        iframe,
                       int                         ichan)
@@ -704,6 +828,23 @@ static void process4 (AdcIn_t adcs0[PACKET_K_NSAMPLES],
       Histogram::Symbol_t sym2 = Histogram::symbol (adc2, prv2);
       Histogram::Symbol_t sym3 = Histogram::symbol (adc3, prv3);
 
+      // ---------------------------------------------------------
+      // With a predictor, use the difference from the prediction
+      // and replace the ADC by the running sum of the differences
+      // ---------------------------------------------------------
+      if (modular)
+      {
+         sym0 = Histogram::symbol_mod (adc0, prd[0]);
+         sym1 = Histogram::symbol_mod (adc1, prd[1]);
+         sym2 = Histogram::symbol_mod (adc2, prd[2]);
+         sym3 = Histogram::symbol_mod (adc3, prd[3]);
+
+         adc0 = prv0 + adc0 - prd[0];
+         adc1 = prv1 + adc1 - prd[1];
+         adc2 = prv2 + adc2 - prd[2];
+         adc3 = prv3 + adc3 - prd[3];
+      }
+
       // -----------------------------
       // Update the encoding histogram
       // -----------------------------
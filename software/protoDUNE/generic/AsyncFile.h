@@ -0,0 +1,684 @@
+//-----------------------------------------------------------------------------
+// File          : AsyncFile.h
+// Author        : JJ Russell  <russell@slac.stanford.edu>
+// Created       : 08/22/2018
+// Project       : General Purpose
+//-----------------------------------------------------------------------------
+// Description :
+// Asynchronous, double/quad buffered file writer for the data receivers.
+//
+// The caller copies its records into one of a small number of large, page
+// aligned blocks. A full block is handed to the kernel and the caller moves
+// on to the next one, only waiting if every block is still being written.
+// So a slow disk shows up as a filling queue rather than as back pressure
+// on the network.
+//
+// Where the file system allows it, each file is opened O_DIRECT and the
+// blocks are submitted with Linux native AIO (io_submit), so the data does
+// not pass through, nor evict anything from, the page cache. Otherwise the
+// blocks are written with pwrite by the writer's own thread. The same
+// thread reaps the AIO completions, closes files that have been rotated
+// out and opens the next file ahead of time, so none of that is done on
+// the caller's thread.
+//
+// Since O_DIRECT writes must be whole sectors, the last block of a file is
+// padded and the file is truncated back to its true size once that write
+// completes.
+//
+// Whether a file is O_DIRECT is kept with the file, not in the
+// configuration, since the writer thread may open the next file while the
+// caller is filling blocks for the current one.
+//
+// Files are created with mode 0666, less the umask, as CommLink always did.
+//
+// Files are rotated on size and/or age. The rotation is only done between
+// records, asyncFile_writeRecord, so a record never straddles two files.
+// When rotating, the files are named <name>.1, <name>.2, ..., otherwise
+// just <name>.
+//
+// The time from the submission to the completion of every block write is
+// kept in a histogram, binned in powers of 2 microseconds.
+//
+// Usable from both C and C++. The writing functions may be called from any
+// thread, but the records from different threads are only kept whole if
+// the calls are serialized by the caller.
+//-----------------------------------------------------------------------------
+// This file is part of 'SLAC Generic DAQ Software'.
+// It is subject to the license terms in the LICENSE.txt file found in the
+// top-level directory of this distribution and at:
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html.
+// No part of 'SLAC Generic DAQ Software', including this file,
+// may be copied, modified, propagated, or distributed except according to
+// the terms contained in the LICENSE.txt file.
+// Proprietary and confidential to SLAC.
+//-----------------------------------------------------------------------------
+// Modification history :
+// 08/22/2018: created
+// 08/23/2018: O_DIRECT is kept per file, files are created 0666 again
+//-----------------------------------------------------------------------------
+#ifndef __ASYNC_FILE_H__
+#define __ASYNC_FILE_H__
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <linux/aio_abi.h>
+
+// Only exposed by fcntl.h with _GNU_SOURCE, which C sources may not define
+#ifndef O_DIRECT
+#define O_DIRECT __O_DIRECT
+#endif
+
+#define ASYNCFILE_K_ALIGN    4096               // O_DIRECT alignment
+#define ASYNCFILE_K_BLKSIZE  (16 * 1024 * 1024) // Default block size
+#define ASYNCFILE_K_NBLKS    4                  // Default number of blocks
+#define ASYNCFILE_K_NBINS    32                 // Latency histogram bins
+#define ASYNCFILE_K_NAMESIZE 256                // Maximum file name length
+
+// The states of a block
+enum AsyncFileBlkState {
+   ASYNCFILE_K_FREE     = 0,  // Available to be filled
+   ASYNCFILE_K_QUEUED   = 1,  // Waiting for the writer thread's pwrite
+   ASYNCFILE_K_INFLIGHT = 2   // Submitted to the kernel
+};
+
+// Configuration, asyncFileCfg_init fills in the defaults
+typedef struct {
+   uint32_t   blkSize;  // Size of each block, rounded up to ASYNCFILE_K_ALIGN
+   uint32_t     nblks;  // Number of blocks
+   uint64_t  maxBytes;  // Rotate once a file reaches this size, 0 = never
+   uint32_t maxSeconds; // Rotate once a file is this old, 0 = never
+   char        direct;  // Use O_DIRECT and AIO, if the file system allows
+   char        append;  // Append to existing files instead of truncating
+} AsyncFileCfg;
+
+// One output file
+typedef struct _AsyncFileOut {
+   int                       fd;  // File descriptor
+   uint32_t             pending;  // Number of block writes outstanding
+   uint64_t                size;  // True size, the file is truncated to this
+   uint64_t              nbytes;  // Bytes written this session
+   uint32_t                 seq;  // Rotation sequence number
+   char                  direct;  // Opened O_DIRECT
+   struct _AsyncFileOut   *next;  // Link on the retired list
+} AsyncFileOut;
+
+// One block
+typedef struct {
+   uint8_t             *data;  // ASYNCFILE_K_ALIGN aligned
+   uint32_t             used;  // Bytes filled
+   uint32_t           nwrite;  // Bytes written, used rounded up if O_DIRECT
+   uint64_t           offset;  // File offset of data[0]
+   AsyncFileOut         *out;  // The file being written to
+   int                 state;  // AsyncFileBlkState
+   struct timespec submitted;  // For the latency histogram
+   struct iocb            cb;  // The AIO control block
+} AsyncFileBlk;
+
+// Statistics
+typedef struct {
+   uint64_t    nbytes;  // Bytes accepted
+   uint64_t  nwritten;  // Bytes written, including any padding
+   uint64_t   nwrites;  // Number of block writes
+   uint32_t    nfiles;  // Number of files opened
+   uint32_t nbuffered;  // Of these, the ones O_DIRECT was refused for
+   uint32_t    nwaits;  // Times the caller waited for a free block
+   uint32_t    nsyncs;  // Times io_submit failed, written inline instead
+   uint32_t maxLatency; // Longest block write, microseconds
+   uint32_t hist[ASYNCFILE_K_NBINS]; // Block writes taking <= 2**bin usec
+} AsyncFileStats;
+
+// The writer
+typedef struct {
+   pthread_mutex_t       lock;
+   pthread_cond_t       freed;  // A block became free
+   pthread_cond_t        work;  // The writer thread has something to do
+   pthread_t           thread;
+   char                   run;
+   char                   aio;  // Using AIO, else pwrite in the thread
+   char               prepare;  // Open the next file ahead of time
+   aio_context_t          ctx;
+   AsyncFileCfg           cfg;
+   AsyncFileBlk         *blks;
+   uint32_t              fill;  // Block being filled
+   uint32_t              head;  // Next block to pwrite
+   int                barrier;  // Block that must complete before the next
+   uint32_t             clean;  // Bytes of the block being filled already written
+   uint32_t          inflight;  // Number of AIO writes outstanding
+   AsyncFileOut          *out;  // Current file
+   AsyncFileOut         *next;  // Next file, if opened ahead of time
+   AsyncFileOut      *retired;  // Rotated out, waiting to be closed
+   time_t              opened;  // When the current file was opened
+   int                  error;  // The first write error
+   AsyncFileStats       stats;
+   char name[ASYNCFILE_K_NAMESIZE];
+} AsyncFile;
+
+
+// The AIO system calls, not wrapped by glibc
+static inline int asyncFile_ioSetup (unsigned nr, aio_context_t *ctx) {
+   return syscall(__NR_io_setup, nr, ctx);
+}
+
+static inline int asyncFile_ioDestroy (aio_context_t ctx) {
+   return syscall(__NR_io_destroy, ctx);
+}
+
+static inline int asyncFile_ioSubmit (aio_context_t ctx, long nr, struct iocb **cbs) {
+   return syscall(__NR_io_submit, ctx, nr, cbs);
+}
+
+static inline int asyncFile_ioGetevents (aio_context_t ctx, long min, long max,
+                                         struct io_event *events) {
+   return syscall(__NR_io_getevents, ctx, min, max, events, NULL);
+}
+
+
+// Default configuration, 4 x 16MB blocks, direct, no rotation
+static inline void asyncFileCfg_init ( AsyncFileCfg *cfg ) {
+   memset(cfg, 0, sizeof(*cfg));
+   cfg->blkSize = ASYNCFILE_K_BLKSIZE;
+   cfg->nblks   = ASYNCFILE_K_NBLKS;
+   cfg->direct  = 1;
+}
+
+// Name of the file with the specified rotation sequence number
+static inline void asyncFile_name ( AsyncFile const *af, uint32_t seq, char *name ) {
+   if ( af->cfg.maxBytes || af->cfg.maxSeconds )
+      snprintf(name, ASYNCFILE_K_NAMESIZE + 16, "%s.%u", af->name, seq);
+   else
+      snprintf(name, ASYNCFILE_K_NAMESIZE + 16, "%s", af->name);
+}
+
+// Open one output file. Falls back to buffered I/O if O_DIRECT is refused.
+// Only reads the configuration, so it may be called without the lock.
+static inline AsyncFileOut *asyncFile_create ( AsyncFile *af, uint32_t seq, int *error ) {
+   char name[ASYNCFILE_K_NAMESIZE + 16];
+   int  flags  = O_CREAT | (af->cfg.append ? O_RDWR : O_WRONLY | O_TRUNC);
+   int  mode   = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH;
+   int  fd     = -1;
+   char direct = af->cfg.direct;
+
+   asyncFile_name(af, seq, name);
+
+   if ( direct ) {
+      fd = open(name, flags | O_DIRECT, mode);
+      if ( fd < 0 && errno == EINVAL ) direct = 0;
+   }
+   if ( fd < 0 && !direct ) fd = open(name, flags, mode);
+   if ( fd < 0 ) {
+      *error = errno;
+      return(NULL);
+   }
+
+   AsyncFileOut *out = (AsyncFileOut *)calloc(1, sizeof(*out));
+   struct stat   st;
+   out->fd     = fd;
+   out->seq    = seq;
+   out->direct = direct;
+   out->size    = (af->cfg.append && fstat(fd, &st) == 0) ? st.st_size : 0;
+   return(out);
+}
+
+// Discard a file that was opened ahead of time but never used
+static inline void asyncFile_discard ( AsyncFile *af, AsyncFileOut *out ) {
+   char name[ASYNCFILE_K_NAMESIZE + 16];
+   asyncFile_name(af, out->seq, name);
+   close(out->fd);
+   if ( out->size == 0 ) unlink(name);
+   free(out);
+}
+
+// Make a file the current one. When appending, the file's last partial
+// sector is read back so that the first O_DIRECT write can rewrite it.
+// Called with the lock held and the block being filled empty.
+static inline int asyncFile_begin ( AsyncFile *af, AsyncFileOut *out ) {
+   AsyncFileBlk *blk  = af->blks + af->fill;
+   uint32_t      tail = out->direct ? (out->size & (ASYNCFILE_K_ALIGN - 1)) : 0;
+
+   blk->used   = 0;
+   blk->offset = out->size - tail;
+
+   if ( tail ) {
+      ssize_t nread = pread(out->fd, blk->data, ASYNCFILE_K_ALIGN, blk->offset);
+      if ( nread < (ssize_t)tail ) return(nread < 0 ? errno : EIO);
+      blk->used = tail;
+   }
+
+   af->clean   = blk->used;
+   af->out     = out;
+   af->opened  = time(NULL);
+   af->barrier = -1;
+   af->stats.nfiles++;
+   if ( !out->direct ) af->stats.nbuffered++;
+   return(0);
+}
+
+// Account for a completed block write. Called with the lock held.
+static inline void asyncFile_complete ( AsyncFile *af, AsyncFileBlk *blk, long res ) {
+   struct timespec now;
+   clock_gettime(CLOCK_MONOTONIC, &now);
+
+   uint64_t usec = (now.tv_sec  - blk->submitted.tv_sec) * 1000000ULL
+                 + (now.tv_nsec - blk->submitted.tv_nsec) / 1000;
+   uint32_t bin  = 0;
+   while ( bin < ASYNCFILE_K_NBINS - 1 && (1ULL << bin) < usec ) bin++;
+
+   af->stats.hist[bin]++;
+   af->stats.nwrites++;
+   if ( usec > af->stats.maxLatency ) af->stats.maxLatency = usec;
+
+   if ( res == (long)blk->nwrite ) af->stats.nwritten += res;
+   else if ( af->error == 0 ) af->error = res < 0 ? -res : EIO;
+
+   if ( blk->state == ASYNCFILE_K_INFLIGHT ) af->inflight--;
+   blk->out->pending--;
+   blk->state = ASYNCFILE_K_FREE;
+
+   pthread_cond_broadcast(&af->freed);
+   pthread_cond_signal(&af->work);
+}
+
+// Write a block in full, retrying on short writes
+static inline long asyncFile_pwrite ( AsyncFileBlk const *blk ) {
+   uint32_t left = blk->nwrite;
+   while ( left ) {
+      ssize_t nwrote = pwrite(blk->out->fd,
+                              blk->data   + blk->nwrite - left, left,
+                              blk->offset + blk->nwrite - left);
+      if ( nwrote < 0 ) {
+         if ( errno == EINTR ) continue;
+         return(-errno);
+      }
+      left -= nwrote;
+   }
+   return(blk->nwrite);
+}
+
+// Wait for a block to become free. Called with the lock held.
+static inline void asyncFile_wait ( AsyncFile *af, AsyncFileBlk *blk ) {
+   if ( blk->state == ASYNCFILE_K_FREE ) return;
+   af->stats.nwaits++;
+   while ( blk->state != ASYNCFILE_K_FREE ) pthread_cond_wait(&af->freed, &af->lock);
+}
+
+// Hands off the block being filled and moves on to the next one.
+//
+// If tail is set, the next block continues the same file. With O_DIRECT,
+// a partially filled block must be written out to the end of its last
+// sector, so that sector is also copied to the start of the next block
+// and rewritten from there. That write must not complete before this
+// one, so it waits on this block, the barrier, before being submitted.
+//
+// Called with the lock held.
+static inline void asyncFile_submit ( AsyncFile *af, int tail ) {
+   AsyncFileBlk *blk  = af->blks + af->fill;
+   uint32_t      used = blk->used;
+
+   if ( used == 0 ) return;
+
+   if ( af->barrier >= 0 ) {
+      asyncFile_wait(af, af->blks + af->barrier);
+      af->barrier = -1;
+   }
+
+   blk->nwrite = used;
+   if ( af->out->direct ) {
+      blk->nwrite = (used + ASYNCFILE_K_ALIGN - 1) & ~(ASYNCFILE_K_ALIGN - 1);
+      memset(blk->data + used, 0, blk->nwrite - used);
+   }
+
+   blk->out = af->out;
+   blk->out->pending++;
+   clock_gettime(CLOCK_MONOTONIC, &blk->submitted);
+
+   if ( af->aio ) {
+      struct iocb *cb = &blk->cb;
+      memset(cb, 0, sizeof(*cb));
+      cb->aio_data       = (uint64_t)(uintptr_t)blk;
+      cb->aio_lio_opcode = IOCB_CMD_PWRITE;
+      cb->aio_fildes     = blk->out->fd;
+      cb->aio_buf        = (uint64_t)(uintptr_t)blk->data;
+      cb->aio_nbytes     = blk->nwrite;
+      cb->aio_offset     = blk->offset;
+
+      blk->state = ASYNCFILE_K_INFLIGHT;
+      af->inflight++;
+
+      // The kernel refused it, e.g. EAGAIN, write it here rather than lose it
+      if ( asyncFile_ioSubmit(af->ctx, 1, &cb) != 1 ) {
+         af->stats.nsyncs++;
+         asyncFile_complete(af, blk, asyncFile_pwrite(blk));
+      }
+      else pthread_cond_signal(&af->work);
+   }
+   else {
+      blk->state = ASYNCFILE_K_QUEUED;
+      pthread_cond_signal(&af->work);
+   }
+
+   // Move on to the next block
+   uint32_t      idx  = af->fill;
+   AsyncFileBlk *nxt  = af->blks + (idx + 1) % af->cfg.nblks;
+   uint32_t      keep = (tail && blk->out->direct) ? (used & (ASYNCFILE_K_ALIGN - 1)) : 0;
+
+   asyncFile_wait(af, nxt);
+   memcpy(nxt->data, blk->data + used - keep, keep);
+   nxt->used   = keep;
+   nxt->offset = blk->offset + used - keep;
+   af->fill    = (idx + 1) % af->cfg.nblks;
+   af->barrier = keep ? (int)idx : -1;
+   af->clean   = keep;
+}
+
+// Takes a retired file whose writes have all completed off the list.
+// Called with the lock held.
+static inline AsyncFileOut *asyncFile_reap ( AsyncFile *af ) {
+   AsyncFileOut **prv = &af->retired;
+   for ( AsyncFileOut *out = *prv; out; prv = &out->next, out = *prv ) {
+      if ( out->pending == 0 ) {
+         *prv = out->next;
+         return(out);
+      }
+   }
+   return(NULL);
+}
+
+// The writer thread
+static inline void *asyncFile_run ( void *arg ) {
+   AsyncFile      *af = (AsyncFile *)arg;
+   struct io_event events[64];
+   AsyncFileOut   *out;
+
+   pthread_mutex_lock(&af->lock);
+   while ( 1 ) {
+
+      // Close the rotated out files, truncating away any O_DIRECT padding
+      if ( (out = asyncFile_reap(af)) != NULL ) {
+         pthread_mutex_unlock(&af->lock);
+         if ( ftruncate(out->fd, out->size) != 0 )
+            fprintf(stderr, "AsyncFile: Error %d truncating output\n", errno);
+         close(out->fd);
+         free(out);
+         pthread_mutex_lock(&af->lock);
+         continue;
+      }
+
+      // Open the next file so that the rotation does not wait on it
+      if ( af->prepare && af->out ) {
+         int      error;
+         uint32_t seq = af->out->seq + 1;
+
+         af->prepare = 0;
+         pthread_mutex_unlock(&af->lock);
+         out = asyncFile_create(af, seq, &error);
+         pthread_mutex_lock(&af->lock);
+
+         if ( out && af->out && af->next == NULL && af->out->seq + 1 == seq ) af->next = out;
+         else if ( out ) asyncFile_discard(af, out);
+         continue;
+      }
+
+      // Reap the AIO completions
+      if ( af->aio && af->inflight ) {
+         long max = af->cfg.nblks < 64 ? af->cfg.nblks : 64;
+         pthread_mutex_unlock(&af->lock);
+         int n = asyncFile_ioGetevents(af->ctx, 1, max, events);
+         pthread_mutex_lock(&af->lock);
+         for ( int idx = 0; idx < n; idx++ )
+            asyncFile_complete(af, (AsyncFileBlk *)(uintptr_t)events[idx].data, events[idx].res);
+         continue;
+      }
+
+      // Or write the queued blocks, in order
+      AsyncFileBlk *blk = af->blks + af->head;
+      if ( !af->aio && blk->state == ASYNCFILE_K_QUEUED ) {
+         pthread_mutex_unlock(&af->lock);
+         long res = asyncFile_pwrite(blk);
+         pthread_mutex_lock(&af->lock);
+         asyncFile_complete(af, blk, res);
+         af->head = (af->head + 1) % af->cfg.nblks;
+         continue;
+      }
+
+      if ( !af->run ) break;
+      pthread_cond_wait(&af->work, &af->lock);
+   }
+   pthread_mutex_unlock(&af->lock);
+
+   return(NULL);
+}
+
+// Open the writer and its first file. Returns 0 or an errno.
+static inline int asyncFile_open ( AsyncFile *af, char const *name, AsyncFileCfg const *cfg ) {
+   int error = 0;
+
+   memset(af, 0, sizeof(*af));
+   af->cfg         = *cfg;
+   af->cfg.blkSize = (cfg->blkSize + ASYNCFILE_K_ALIGN - 1) & ~(ASYNCFILE_K_ALIGN - 1);
+   af->barrier     = -1;
+   if ( af->cfg.blkSize == 0 ) af->cfg.blkSize = ASYNCFILE_K_BLKSIZE;
+   if ( af->cfg.nblks   <  2 ) af->cfg.nblks   = 2;
+   snprintf(af->name, sizeof(af->name), "%s", name);
+
+   af->out = asyncFile_create(af, 1, &error);
+   if ( af->out == NULL ) return(error);
+
+   af->blks = (AsyncFileBlk *)calloc(af->cfg.nblks, sizeof(*af->blks));
+   for ( uint32_t idx = 0; idx < af->cfg.nblks; idx++ ) {
+      void *data;
+      if ( posix_memalign(&data, ASYNCFILE_K_ALIGN, af->cfg.blkSize) ) {
+         error = ENOMEM;
+         break;
+      }
+      af->blks[idx].data = (uint8_t *)data;
+   }
+
+   // Only worth it when bypassing the page cache, else io_submit blocks
+   if ( error == 0 && af->out->direct ) af->aio = asyncFile_ioSetup(af->cfg.nblks, &af->ctx) == 0;
+   if ( error == 0 ) error = asyncFile_begin(af, af->out);
+
+   if ( error == 0 ) {
+      pthread_mutex_init(&af->lock, NULL);
+      pthread_cond_init(&af->freed, NULL);
+      pthread_cond_init(&af->work, NULL);
+      af->run = 1;
+      if ( (error = pthread_create(&af->thread, NULL, asyncFile_run, af)) == 0 ) return(0);
+   }
+
+   // Failed, undo what was done
+   if ( af->aio ) asyncFile_ioDestroy(af->ctx);
+   for ( uint32_t idx = 0; idx < af->cfg.nblks; idx++ ) free(af->blks[idx].data);
+   free(af->blks);
+   close(af->out->fd);
+   free(af->out);
+   af->out  = NULL;
+   af->blks = NULL;
+   return(error);
+}
+
+// Copy pieces into the blocks. Called with the lock held.
+static inline void asyncFile_copy ( AsyncFile *af, struct iovec const *iov, int niov ) {
+   for ( int idx = 0; idx < niov; idx++ ) {
+      uint8_t const *src  = (uint8_t const *)iov[idx].iov_base;
+      size_t         left = iov[idx].iov_len;
+
+      af->out->size     += left;
+      af->out->nbytes   += left;
+      af->stats.nbytes  += left;
+
+      while ( left ) {
+         AsyncFileBlk *blk = af->blks + af->fill;
+         size_t        n   = af->cfg.blkSize - blk->used;
+         if ( n > left ) n = left;
+
+         memcpy(blk->data + blk->used, src, n);
+         blk->used += n;
+         src       += n;
+         left      -= n;
+
+         if ( blk->used == af->cfg.blkSize ) asyncFile_submit(af, 0);
+      }
+   }
+}
+
+// Is a rotation due before writing a record of this size? Lock held.
+static inline int asyncFile_isDue ( AsyncFile const *af, uint64_t nbytes ) {
+   if ( af->out->nbytes == 0 ) return(0);
+   if ( af->cfg.maxBytes   && af->out->nbytes + nbytes > af->cfg.maxBytes ) return(1);
+   if ( af->cfg.maxSeconds && time(NULL) - af->opened >= (time_t)af->cfg.maxSeconds ) return(1);
+   return(0);
+}
+
+// Closes out the current file and starts the next. Called with the lock held.
+static inline int asyncFile_next ( AsyncFile *af ) {
+   int           error = 0;
+   AsyncFileOut *out   = af->next;
+
+   asyncFile_submit(af, 0);
+
+   // The file just handed off cannot be continued, so this is fatal
+   if ( out == NULL ) out = asyncFile_create(af, af->out->seq + 1, &error);
+   if ( out == NULL ) return(af->error = error);
+
+   af->out->next = af->retired;
+   af->retired   = af->out;
+   af->next      = NULL;
+   af->prepare   = 1;
+   pthread_cond_signal(&af->work);
+
+   if ( (error = asyncFile_begin(af, out)) != 0 ) af->error = error;
+   return(error);
+}
+
+// Append, to the current file, without regard to rotation. Returns 0 or
+// the errno of the first failed write.
+static inline int asyncFile_writev ( AsyncFile *af, struct iovec const *iov, int niov ) {
+   pthread_mutex_lock(&af->lock);
+   int error = af->error;
+   if ( error == 0 ) asyncFile_copy(af, iov, niov);
+   pthread_mutex_unlock(&af->lock);
+   return(error);
+}
+
+static inline int asyncFile_write ( AsyncFile *af, void const *data, size_t nbytes ) {
+   struct iovec iov;
+   iov.iov_base = (void *)data;
+   iov.iov_len  = nbytes;
+   return(asyncFile_writev(af, &iov, 1));
+}
+
+// Append one record, first rotating to the next file if this one is full
+// or old enough. Returns 0 or an errno.
+static inline int asyncFile_writeRecord ( AsyncFile *af, struct iovec const *iov, int niov ) {
+   uint64_t nbytes = 0;
+   for ( int idx = 0; idx < niov; idx++ ) nbytes += iov[idx].iov_len;
+
+   pthread_mutex_lock(&af->lock);
+   int error = af->error;
+   if ( error == 0 && asyncFile_isDue(af, nbytes) ) error = asyncFile_next(af);
+   if ( error == 0 ) asyncFile_copy(af, iov, niov);
+   pthread_mutex_unlock(&af->lock);
+   return(error);
+}
+
+// Is a rotation due before writing a record of this size? For callers
+// that must finish off a file, e.g. with an index, before rotating.
+static inline int asyncFile_due ( AsyncFile *af, uint64_t nbytes ) {
+   pthread_mutex_lock(&af->lock);
+   int due = asyncFile_isDue(af, nbytes);
+   pthread_mutex_unlock(&af->lock);
+   return(due);
+}
+
+// Rotate to the next file now. Returns 0 or an errno.
+static inline int asyncFile_rotate ( AsyncFile *af ) {
+   pthread_mutex_lock(&af->lock);
+   int error = af->error;
+   if ( error == 0 ) {
+      error = ( af->cfg.maxBytes || af->cfg.maxSeconds ) ? asyncFile_next(af) : EINVAL;
+   }
+   pthread_mutex_unlock(&af->lock);
+   return(error);
+}
+
+// Start writing what has been accumulated, e.g. when the data stops.
+// The current file stays open. Does nothing if nothing has been added
+// since the last flush, so it is cheap to call periodically.
+static inline void asyncFile_flush ( AsyncFile *af ) {
+   pthread_mutex_lock(&af->lock);
+   if ( af->out && af->blks[af->fill].used > af->clean ) asyncFile_submit(af, 1);
+   pthread_mutex_unlock(&af->lock);
+}
+
+// The current file descriptor
+static inline int asyncFile_fd ( AsyncFile *af ) {
+   return(af->out ? af->out->fd : -1);
+}
+
+// Write what remains, wait for it and close the file. Returns 0 or the
+// errno of the first failed write.
+static inline int asyncFile_close ( AsyncFile *af ) {
+   if ( af->out == NULL ) return(0);
+
+   pthread_mutex_lock(&af->lock);
+   asyncFile_submit(af, 0);
+   af->out->next = af->retired;
+   af->retired   = af->out;
+   af->out       = NULL;
+   af->run       = 0;
+   pthread_cond_signal(&af->work);
+   pthread_mutex_unlock(&af->lock);
+
+   pthread_join(af->thread, NULL);
+
+   if ( af->next ) asyncFile_discard(af, af->next);
+   if ( af->aio  ) asyncFile_ioDestroy(af->ctx);
+   for ( uint32_t idx = 0; idx < af->cfg.nblks; idx++ ) free(af->blks[idx].data);
+   free(af->blks);
+
+   pthread_mutex_destroy(&af->lock);
+   pthread_cond_destroy(&af->freed);
+   pthread_cond_destroy(&af->work);
+
+   af->next = NULL;
+   af->blks = NULL;
+   return(af->error);
+}
+
+// Print the statistics and the write latency histogram, either while
+// open or, for the final numbers, after closing
+static inline void asyncFile_print ( AsyncFile *af, FILE *fp ) {
+   AsyncFileStats stats;
+
+   if ( af->blks != NULL ) {
+      pthread_mutex_lock(&af->lock);
+      stats = af->stats;
+      pthread_mutex_unlock(&af->lock);
+   }
+   else stats = af->stats;
+
+   fprintf(fp, "Writer %s (%s): %" PRIu64 " bytes %" PRIu64 " writes %u files"
+               " %u waits %u inline, max latency %u usec\n",
+           af->name, af->aio ? "direct, aio" : (stats.nbuffered < stats.nfiles ? "direct" : "buffered"),
+           stats.nbytes, stats.nwrites, stats.nfiles,
+           stats.nwaits, stats.nsyncs, stats.maxLatency);
+
+   fprintf(fp, "  Latency (usec <=):");
+   for ( int bin = 0; bin < ASYNCFILE_K_NBINS; bin++ ) {
+      if ( stats.hist[bin] ) fprintf(fp, " %" PRIu64 ":%u", (uint64_t)1 << bin, stats.hist[bin]);
+   }
+   fputc('\n', fp);
+}
+
+#endif
@@ -17,6 +17,9 @@
 //-----------------------------------------------------------------------------
 // Modification history :
 // 04/12/2011: created
+// 08/22/2018: jjr, data file written through an AsyncFile, rotation
+//             included, so that the disk no longer holds up the data thread
+// 08/23/2018: jjr, the data file is only flushed after a second without data
 //-----------------------------------------------------------------------------
 
 #include <CommLink.h>
@@ -110,11 +113,13 @@ void CommLink::dataHandler() {
    uint32_t   xmlSize;
    uint32_t   wrSize;
    bool       idle;
+   time_t     lastData;
    uint32_t   sum;
 
    // Store time
    time(&ltime);
    ctime        = ltime;
+   lastData     = ltime;
    dataRxCount_ = 0;
    xmlCount     = xmlReqCnt_;
    sum = 0;
@@ -145,13 +150,7 @@ void CommLink::dataHandler() {
                dataSharedWrite ((DataSharedMemory *)smem_, xmlSize, (const uint8_t *)xmlReqEntry_.c_str(), wrSize );
 
             // Data file is open
-            pthread_mutex_lock(&fileMutex_);
-            if ( dataFileFd_ >= 0 ) {
-               this->checkFileSize();
-               fileSize_ += buffWrite(dataFileFd_,&xmlSize,4);
-               fileSize_ += buffWrite(dataFileFd_,xmlReqEntry_.c_str(),wrSize);
-            }
-            pthread_mutex_unlock(&fileMutex_);
+            fileWrite(xmlSize,xmlReqEntry_.c_str(),wrSize);
          }
          xmlCount = xmlReqCnt_;
          xmlRespCnt_++;
@@ -177,14 +176,7 @@ void CommLink::dataHandler() {
             dataSharedWrite ((DataSharedMemory *)smem_, size, (uint8_t *)buff, size*4 );
 
          // File is open
-         pthread_mutex_lock(&fileMutex_);
-         if ( dataFileFd_ >= 0 ) {
-            this->checkFileSize();
-            fileSize_ += buffWrite(dataFileFd_,&size,4);
-            fileSize_ += buffWrite(dataFileFd_,buff,size*4);
-            dataFileCount_++;
-         }
-         pthread_mutex_unlock(&fileMutex_);
+         if ( fileWrite(size,buff,size*4) ) dataFileCount_++;
          sum += size * 4;
          dataRxCount_++;
          delete dat;
@@ -198,7 +190,6 @@ void CommLink::dataHandler() {
                     << ", TotCount = " << dec << dataRxCount_
                     << ", FileCount = " << dec << dataFileCount_ 
                     << ", BW = " << (sum / 1e6)
-                    << ", lastWr = " << dec << lastWrite_
                     << ", Buffer Depth = " << dec << dataQueue_.entryCnt() << endl;
                sum = 0;
                ltime = ctime;
@@ -206,7 +197,20 @@ void CommLink::dataHandler() {
          }
          idle = false;
       }
-      if ( idle ) dataThreadWait(1000);
+      if ( ! idle ) time(&lastData);
+      else {
+
+         // Push out what the file writer holds once nothing has arrived for
+         // over a second. Flushing a partial O_DIRECT block waits on the
+         // previous write, so it is not done on every idle pass.
+         if ( time(NULL) - lastData > 1 ) {
+            pthread_mutex_lock(&fileMutex_);
+            if ( asyncFile_ != NULL ) asyncFile_flush(asyncFile_);
+            pthread_mutex_unlock(&fileMutex_);
+         }
+
+         dataThreadWait(1000);
+      }
    }
 }
 
@@ -237,7 +241,7 @@ Data* CommLink::pollDataQueue(uint32_t wait) {
 CommLink::CommLink ( ) {
    debug_           = false;
    dataSource_      = 0;
-   dataFileFd_      = -1;
+   asyncFile_       = NULL;
    dataFile_        = "";
    maxSize_         = 0;
    dataNetFd_       = -1;
@@ -272,11 +276,7 @@ CommLink::CommLink ( ) {
    xmlStoreEn_      = true;
    toDisable_       = false;
    smem_            = NULL;
-   fileSize_        = 0;
-   buffWriteEn_     = false;
    buffWriteSize_   = 0;
-   buffWriteData_   = NULL;
-   buffWriteTotal_  = 0;
 
    pthread_mutex_init(&reqMutex_,NULL);
    pthread_mutex_init(&ioMutex_,NULL);
@@ -293,7 +293,7 @@ CommLink::CommLink ( ) {
 CommLink::~CommLink () { 
    close();
    if ( smem_ != NULL ) dataSharedClose((DataSharedMemory*)smem_);
-   if ( buffWriteData_ != NULL ) free(buffWriteData_);
+   if ( asyncFile_ != NULL ) closeDataFile();
 }
 
 // Open link and start threads
@@ -360,69 +360,38 @@ void CommLink::close () {
    }
 }
 
-// Open data file
-int32_t CommLink::checkFileSize() {
-   char buffer[10];
-   string locName;
-   stringstream tmp;
-
-   if ( maxSize_ == 0 ) return(0);
-
-   if ( fileSize_ > maxSize_ ) {
-      buffWrite(dataFileFd_,NULL,0); // Flush buffer
-      ::close(dataFileFd_);
-      dataFileFd_  = -1;
-      fileSize_   = 0;
-
-      fileCount_ += 1;
-      sprintf(buffer,".%i",fileCount_);
-      locName = dataFile_;
-      locName.append(buffer);
-
-      dataFileFd_ = ::open(locName.c_str(),O_RDWR|O_CREAT|O_APPEND,S_IRUSR|S_IWUSR|S_IRGRP|S_IWGRP|S_IROTH|S_IWOTH);
-
-      // Status
-      tmp.str("");
-      tmp << "CommLink::checkFileSize -> ";
-      if ( dataFileFd_ < 0 ) tmp << "Error opening data file ";
-      else tmp << "Opened data file ";
-      tmp << locName << endl;
-
-      // Debug result
-      if ( debug_ ) cout << tmp.str();
-
-      return(dataFileFd_);
-   }
-   else return(0);
-}
-
 // Open data file
 void CommLink::openDataFile (string file, uint32_t maxSize) {
    stringstream tmp;
    string locName;
+   AsyncFileCfg cfg;
+   int ret;
 
    pthread_mutex_lock(&fileMutex_);
 
-   fileSize_ = 0;
    dataFile_ = file;
    maxSize_  = maxSize;
    locName = dataFile_;
+   if (maxSize_ > 0) locName.append(".1");
 
-   if (maxSize_ > 0) {
-      locName.append(".1");
-      fileCount_ = 1;
-   }
-   else {
-      fileCount_ = 0;
-   }
+   // Appended to, rotated to file.2, file.3, ... when maxSize is reached
+   asyncFileCfg_init(&cfg);
+   if ( buffWriteSize_ > 0 ) cfg.blkSize = buffWriteSize_;
+   cfg.maxBytes = maxSize_;
+   cfg.append   = 1;
 
    // Open the file
-   dataFileFd_ = ::open(locName.c_str(),O_RDWR|O_CREAT|O_APPEND,S_IRUSR|S_IWUSR|S_IRGRP|S_IWGRP|S_IROTH|S_IWOTH);
+   asyncFile_ = new AsyncFile;
+   ret = asyncFile_open(asyncFile_,dataFile_.c_str(),&cfg);
+   if ( ret != 0 ) {
+      delete asyncFile_;
+      asyncFile_ = NULL;
+   }
 
    // Status
    tmp.str("");
    tmp << "CommLink::openDataFile -> ";
-   if ( dataFileFd_ < 0 ) tmp << "Error opening data file ";
+   if ( asyncFile_ == NULL ) tmp << "Error opening data file ";
    else tmp << "Opened data file ";
    tmp << locName << endl;
 
@@ -433,22 +402,28 @@ void CommLink::openDataFile (string file, uint32_t maxSize) {
    pthread_mutex_unlock(&fileMutex_);
 
    // Status
-   if ( dataFileFd_ < 0 ) throw(tmp.str());
+   if ( asyncFile_ == NULL ) throw(tmp.str());
 }
 
 // Close data file
 void CommLink::closeDataFile () {
+   int ret = 0;
+
    pthread_mutex_lock(&fileMutex_);
-   buffWrite(dataFileFd_,NULL,0); // Flush buffer
-   ::close(dataFileFd_);
-   dataFileFd_  = -1;
-   fileSize_    = 0;
+   if ( asyncFile_ != NULL ) {
+      ret = asyncFile_close(asyncFile_);
+      if ( debug_ ) asyncFile_print(asyncFile_,stdout);
+      delete asyncFile_;
+      asyncFile_ = NULL;
+   }
    pthread_mutex_unlock(&fileMutex_);
 
    if ( debug_ ) {
       cout << "CommLink::closeDataFile -> "
            << "Closed data file " << dataFile_
-           << ", Count = " << dec << dataFileCount_ << endl;
+           << ", Count = " << dec << dataFileCount_;
+      if ( ret != 0 ) cout << ", Write error = " << dec << ret;
+      cout << endl;
    }
    dataFileCount_ = 0;
 }
@@ -1057,47 +1032,25 @@ void CommLink::mainThreadWakeup() {
    pthread_cond_signal(&mainCondition_);
 }
 
-// Enable buffered writes
+// Set the size of the data file's write blocks, applies to the next open
 void CommLink::enableWriteBuffer ( uint32_t size ) {
-   buffWriteEn_    = true;
-   buffWriteSize_  = size;
-   buffWriteTotal_ = 0;
-
-   stringstream err;
-   err.str("");
-
-   buffWriteData_  = (uint8_t *)malloc(size);
-
-   if ( buffWriteData_ == NULL ) {
-      buffWriteEn_    = false;
-      buffWriteSize_  = 0;
-      err << "CommLink::enableWriteBuffer -> Failed to create write buffer" << endl;
-      if ( debug_ ) cout << err.str();
-      throw(err.str());
-   }
+   buffWriteSize_ = size;
 }
 
-// Internal write function
-ssize_t CommLink::buffWrite(int fd, const void *buf, size_t count) {
+// Internal write function, one record, a 32-bit header and its data.
+// Returns true if the record was written.
+bool CommLink::fileWrite(uint32_t header, const void *buf, size_t count) {
+   struct iovec iov[2];
+   bool   ret = false;
 
-   // Buffer is disabled, and count is not zero, raw write
-   if (buffWriteEn_ == false && count > 0) {
-      lastWrite_ = count;
-      return(write(fd,buf,count));
-   }
+   iov[0].iov_base = &header;
+   iov[0].iov_len  = 4;
+   iov[1].iov_base = (void *)buf;
+   iov[1].iov_len  = count;
 
-   // Buffer has data and write is zero (flush) or new size is larger than buffer size
-   if ( ( buffWriteTotal_ > 0 ) && ( ( count == 0 ) || ((count + buffWriteTotal_) > buffWriteSize_ ))) {
-      lastWrite_ = buffWriteTotal_;
-      write(fd,buffWriteData_,buffWriteTotal_);
-      buffWriteTotal_ = 0;
-   }
-
-   // Append to buffer if non zero
-   if ( buffWriteEn_ && count > 0 ) {
-      memcpy(buffWriteData_ + buffWriteTotal_, buf, count);
-      buffWriteTotal_ += count;
-   }
-   return(count);
+   pthread_mutex_lock(&fileMutex_);
+   if ( asyncFile_ != NULL ) ret = (asyncFile_writeRecord(asyncFile_,iov,2) == 0);
+   pthread_mutex_unlock(&fileMutex_);
+   return(ret);
 }
 
@@ -18,6 +18,8 @@
 //-----------------------------------------------------------------------------
 // Modification history :
 // 04/12/2011: created
+// 08/22/2018: jjr, data file written through an AsyncFile, rotation
+//             included, so that the disk no longer holds up the data thread
 //-----------------------------------------------------------------------------
 #ifndef __COMM_LINK_H__
 #define __COMM_LINK_H__
@@ -30,6 +32,7 @@
 #include <sys/time.h>
 #include <time.h>
 #include <CommQueue.h>
+#include <AsyncFile.h>
 #include <stdio.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
@@ -63,12 +66,9 @@ class CommLink {
       CommQueue dataQueue_;
 
       // Data file status
-      int32_t dataFileFd_;
+      AsyncFile *asyncFile_;
       string dataFile_;
       uint32_t maxSize_;
-      uint32_t fileCount_; 
-      uint32_t fileSize_; 
-      uint32_t lastWrite_;
 
       // Data network status
       struct sockaddr_in net_addr_;
@@ -177,17 +177,11 @@ class CommLink {
       // Timeout disable flag
       bool toDisable_;
 
-      // Buffered write enable
-      bool      buffWriteEn_;
+      // Data file write block size, 0 = AsyncFile default
       uint32_t  buffWriteSize_;
-      uint8_t * buffWriteData_;
-      uint32_t  buffWriteTotal_;
-
-      // Internal file re-open
-      int32_t checkFileSize();
 
       // Internal write function
-      ssize_t buffWrite(int fd, const void *buf, size_t count);
+      bool fileWrite(uint32_t header, const void *buf, size_t count);
 
    public:
 
@@ -364,7 +358,7 @@ class CommLink {
       //! Function for polling the queue when the RX Thread is disabled
       Data* pollDataQueue(uint32_t wait = 0);
 
-      // Enable buffered writes
+      // Set the size of the data file's write blocks
       void enableWriteBuffer ( uint32_t size );
 };
 
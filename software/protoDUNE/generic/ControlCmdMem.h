@@ -18,12 +18,25 @@
 //-----------------------------------------------------------------------------
 // Modification history :
 // 01/11/2012: created
+// 08/29/2018: Queue of outstanding commands with futex wakeups, the single
+//             command calls are kept on top of it
+// 08/30/2018: Layout magic word checked when mapping, the single command
+//             claims slot 0 like the queue does, no padding of the XML
+//-----------------------------------------------------------------------------
+// Commands are passed through a queue of slots. A client claims a free slot,
+// fills it, makes it ready and wakes the server. The server runs the ready
+// slots in the order they were made ready and wakes the client when its
+// slot is done. Both sides sleep on futexes, so nobody polls and a client
+// can keep several commands outstanding. Slot 0 belongs to the original
+// single command calls, controlCmdSetCommand and controlCmdGetResult.
 //-----------------------------------------------------------------------------
 #ifndef __CONTROL_CMD_MEM_H__
 #define __CONTROL_CMD_MEM_H__
 
 #ifndef RTEMS
 #include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #endif
 
 #include <sys/stat.h>
@@ -34,6 +47,7 @@
 #include <time.h>
 #include <sys/time.h>
 #include <stdint.h>
+#include <limits.h>
 
 // Sizes
 #define CONTROL_CMD_STR_SIZE  1024
@@ -57,15 +71,40 @@
 #define CONTROL_CMD_TYPE_SET_REGISTER  6 // Three Args, Device Path, register name and value, No Result
 #define CONTROL_CMD_TYPE_GET_REGISTER  7 // Two Args, Device Path, register name, Result is value
 
-typedef struct {
+// Command queue, slot 0 is used by controlCmdSetCommand
+#define CONTROL_CMD_QUEUE_SIZE  8
 
-   // Commands
-   uint8_t      cmdRdyCount;
-   uint8_t      cmdAckCount;
+// Layout magic, set by controlCmdInit. Change it with ControlCmdMemory.
+#define CONTROL_CMD_MAGIC       0x434d4451 // 'CMDQ'
+
+// Slot states
+#define CONTROL_CMD_SLOT_FREE    0 // Can be claimed by a client
+#define CONTROL_CMD_SLOT_CLAIMED 1 // Being filled by a client
+#define CONTROL_CMD_SLOT_READY   2 // Waiting for the server
+#define CONTROL_CMD_SLOT_BUSY    3 // Being run by the server
+#define CONTROL_CMD_SLOT_DONE    4 // Result is ready for the client
+#define CONTROL_CMD_SLOT_ABANDON 5 // Client gave up, server frees it when done
+
+typedef struct {
+   uint32_t     state;   // CONTROL_CMD_SLOT_*, also the client's futex
+   uint32_t     ticket;  // Order in which the slot was made ready
    uint8_t      cmdType;
    char         cmdArgA[CONTROL_CMD_ARGA_SIZE];
    char         cmdArgB[CONTROL_CMD_ARGB_SIZE];
    char         cmdResult[CONTROL_CMD_RESULT_SIZE];
+   char         cmdError[CONTROL_CMD_ERROR_SIZE];
+} ControlCmdSlot;
+
+typedef struct {
+
+   // Layout, CONTROL_CMD_MAGIC once initialized by the server
+   uint32_t       magic;
+
+   // Commands
+   uint32_t       reqFutex;   // Bumped each time a slot is made ready
+   uint32_t       reqTicket;  // Next ticket
+   int32_t        srvSlot;    // Slot taken by controlCmdGetCommand, -1 if none
+   ControlCmdSlot slot[CONTROL_CMD_QUEUE_SIZE];
 
    // Error, Config and Status 
    char         errorBuffer[CONTROL_CMD_ERROR_SIZE];
@@ -81,18 +120,26 @@ typedef struct {
 
 #ifndef RTEMS
 
-// Open and map shared memory
-inline int32_t controlCmdOpenAndMap ( ControlCmdMemory **ptr, const char *system, uint32_t id, int32_t uid=-1 ) {
-   int32_t  smemFd;
-   char     shmName[CONTROL_CMD_NAME_SIZE];
+// Name of the shared memory
+inline void controlCmdName ( char *shmName, const char *system, uint32_t id, int32_t uid=-1 ) {
    int32_t  lid;
 
    // ID to use?
    if ( uid == -1 ) lid = getuid();
    else lid = uid;
 
+   snprintf(shmName,CONTROL_CMD_NAME_SIZE,"control_cmd.%i.%s.%i",lid,system,id);
+}
+
+// Open and map shared memory. Returns -3 if it has another layout, left by
+// a server built with a different ControlCmdMemory.
+inline int32_t controlCmdOpenAndMap ( ControlCmdMemory **ptr, const char *system, uint32_t id, int32_t uid=-1 ) {
+   int32_t  smemFd;
+   char     shmName[CONTROL_CMD_NAME_SIZE];
+   uint32_t magic;
+
    // Generate shared memory
-   sprintf(shmName,"control_cmd.%i.%s.%i",lid,system,id);
+   controlCmdName(shmName,system,id,uid);
 
    // Attempt to open existing shared memory
    if ( (smemFd = shm_open(shmName, O_RDWR, (S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH)) ) < 0 ) {
@@ -107,10 +154,29 @@ inline int32_t controlCmdOpenAndMap ( ControlCmdMemory **ptr, const char *system
       ftruncate(smemFd, sizeof(ControlCmdMemory));
    }
 
+   // A segment of another size has another layout, one of none was only
+   // just created by someone else
+   struct stat st;
+   if ( fstat(smemFd, &st) == 0 && st.st_size == 0 ) ftruncate(smemFd, sizeof(ControlCmdMemory));
+   else if ( st.st_size != (off_t)sizeof(ControlCmdMemory) ) {
+      close(smemFd);
+      *ptr = NULL;
+      return(-3);
+   }
+
    // Map the shared memory
    if((*ptr = (ControlCmdMemory *)mmap(0, sizeof(ControlCmdMemory),
               (PROT_READ | PROT_WRITE), MAP_SHARED, smemFd, 0)) == MAP_FAILED) return(-2);
 
+   // As does one with another magic, 0 is one the server has yet to init
+   magic = __atomic_load_n(&(*ptr)->magic, __ATOMIC_ACQUIRE);
+   if ( magic != 0 && magic != CONTROL_CMD_MAGIC ) {
+      munmap(*ptr, sizeof(ControlCmdMemory));
+      close(smemFd);
+      *ptr = NULL;
+      return(-3);
+   }
+
    // Store name
    strncpy((*ptr)->sharedName,shmName,CONTROL_CMD_NAME_SIZE);
    (*ptr)->sharedName[CONTROL_CMD_NAME_SIZE-1] = '\0';
@@ -131,70 +197,238 @@ inline void controlCmdClose ( ControlCmdMemory *ptr ) {
 
 // Init data structure, called by ControlServer
 inline void controlCmdInit ( ControlCmdMemory *ptr ) {
-   memset(ptr->cmdArgA, 0, CONTROL_CMD_ARGA_SIZE);
-   memset(ptr->cmdArgB, 0, CONTROL_CMD_ARGB_SIZE);
-   memset(ptr->cmdResult, 0, CONTROL_CMD_RESULT_SIZE);
+   uint32_t x;
+
+   for (x=0; x < CONTROL_CMD_QUEUE_SIZE; x++) {
+      memset(ptr->slot[x].cmdArgA, 0, CONTROL_CMD_ARGA_SIZE);
+      memset(ptr->slot[x].cmdArgB, 0, CONTROL_CMD_ARGB_SIZE);
+      memset(ptr->slot[x].cmdResult, 0, CONTROL_CMD_RESULT_SIZE);
+      memset(ptr->slot[x].cmdError, 0, CONTROL_CMD_ERROR_SIZE);
+      ptr->slot[x].cmdType = 0;
+      ptr->slot[x].ticket  = 0;
+      __atomic_store_n(&ptr->slot[x].state, CONTROL_CMD_SLOT_FREE, __ATOMIC_RELEASE);
+   }
    memset(ptr->errorBuffer, 0, CONTROL_CMD_ERROR_SIZE);
    memset(ptr->xmlStatusBuffer, 0, CONTROL_CMD_STATUS_SIZE);
    memset(ptr->xmlConfigBuffer, 0, CONTROL_CMD_CONFIG_SIZE);
    memset(ptr->xmlPerStatusBuffer, 0, CONTROL_CMD_STATUS_SIZE);
 
-   ptr->cmdType     = 0;
-   ptr->cmdRdyCount = 0;
-   ptr->cmdAckCount = 0;
+   ptr->reqTicket = 0;
+   ptr->srvSlot   = -1;
+   __atomic_store_n(&ptr->magic, CONTROL_CMD_MAGIC, __ATOMIC_RELEASE);
 }
 
-// Send command
-inline void controlCmdSetCommand ( ControlCmdMemory *ptr, uint8_t cmdType, const char *argA, const char *argB ) {
-   if ( argA != NULL ) {
-      strncpy(ptr->cmdArgA,argA,CONTROL_CMD_ARGA_SIZE);
-      ptr->cmdArgA[CONTROL_CMD_ARGA_SIZE-1] = '\0';
+// Wait while *addr is val, timeout in milliseconds, 0 = forever
+inline void controlCmdFutexWait ( uint32_t *addr, uint32_t val, uint32_t timeout ) {
+   struct timespec ts;
+
+   ts.tv_sec  = timeout / 1000;
+   ts.tv_nsec = (timeout % 1000) * 1000000;
+   syscall(SYS_futex, addr, FUTEX_WAIT, val, (timeout == 0) ? NULL : &ts, NULL, 0);
+}
+
+// Wake everybody waiting on addr
+inline void controlCmdFutexWake ( uint32_t *addr ) {
+   syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+// Copy a string into a buffer of size bytes, without strncpy's padding
+inline void controlCmdCopy ( char *dst, const char *src, uint32_t size ) {
+   size_t len = strnlen(src,size-1);
+   memcpy(dst,src,len);
+   dst[len] = '\0';
+}
+
+// Fill a claimed slot, make it ready and wake the server
+inline void controlCmdPost ( ControlCmdMemory *ptr, uint32_t idx, uint8_t cmdType, const char *argA, const char *argB ) {
+   ControlCmdSlot *slot = &ptr->slot[idx];
+
+   if ( argA != NULL ) controlCmdCopy(slot->cmdArgA,argA,CONTROL_CMD_ARGA_SIZE);
+   if ( argB != NULL ) controlCmdCopy(slot->cmdArgB,argB,CONTROL_CMD_ARGB_SIZE);
+   slot->cmdResult[0] = '\0';
+   slot->cmdError[0]  = '\0';
+   slot->cmdType      = cmdType;
+   slot->ticket       = __atomic_fetch_add(&ptr->reqTicket, 1, __ATOMIC_RELAXED);
+
+   __atomic_store_n(&slot->state, CONTROL_CMD_SLOT_READY, __ATOMIC_RELEASE);
+   __atomic_add_fetch(&ptr->reqFutex, 1, __ATOMIC_SEQ_CST);
+   controlCmdFutexWake(&ptr->reqFutex);
+}
+
+// Queue a command. Returns the slot to wait on or -1 if all are in use.
+inline int32_t controlCmdSubmit ( ControlCmdMemory *ptr, uint8_t cmdType, const char *argA, const char *argB ) {
+   uint32_t x;
+   uint32_t state;
+
+   for (x=1; x < CONTROL_CMD_QUEUE_SIZE; x++) {
+      state = CONTROL_CMD_SLOT_FREE;
+      if ( __atomic_compare_exchange_n(&ptr->slot[x].state, &state, CONTROL_CMD_SLOT_CLAIMED,
+                                       false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED) ) {
+         controlCmdPost(ptr,x,cmdType,argA,argB);
+         return(x);
+      }
+   }
+   return(-1);
+}
+
+// Wait for a queued command and free its slot, timeout in milliseconds,
+// 0 = forever. Copies its result and error, either may be NULL. Returns 1
+// when done or 0 on a timeout, in which case the command is withdrawn if
+// the server has not started it.
+inline int32_t controlCmdWait ( ControlCmdMemory *ptr, int32_t idx, char *result, char *error, uint32_t timeout ) {
+   ControlCmdSlot *slot = &ptr->slot[idx];
+   struct timeval  now;
+   struct timeval  sum;
+   struct timeval  add;
+   uint32_t        state;
+   int32_t         left;
+
+   gettimeofday(&now,NULL);
+   add.tv_sec  = (timeout / 1000);
+   add.tv_usec = (timeout % 1000) * 1000;
+   timeradd(&now,&add,&sum);
+
+   while ( (state = __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE)) != CONTROL_CMD_SLOT_DONE ) {
+      left = 0;
+      if ( timeout != 0 ) {
+         gettimeofday(&now,NULL);
+         timersub(&sum,&now,&add);
+         left = add.tv_sec * 1000 + add.tv_usec / 1000;
+         if ( add.tv_sec < 0 || left <= 0 ) {
+
+            // Withdraw it, or leave it for the server to free
+            if ( __atomic_compare_exchange_n(&slot->state, &state, CONTROL_CMD_SLOT_FREE,
+                                             false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) ) return(0);
+            state = CONTROL_CMD_SLOT_BUSY;
+            if ( __atomic_compare_exchange_n(&slot->state, &state, CONTROL_CMD_SLOT_ABANDON,
+                                             false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) ) return(0);
+            continue;
+         }
+      }
+      controlCmdFutexWait(&slot->state,state,left);
    }
-   if ( argB != NULL ) {
-      strncpy(ptr->cmdArgB,argB,CONTROL_CMD_ARGB_SIZE);
-      ptr->cmdArgB[CONTROL_CMD_ARGB_SIZE-1] = '\0';
+
+   if ( result != NULL ) strcpy(result,slot->cmdResult);
+   if ( error  != NULL ) strcpy(error,slot->cmdError);
+
+   if ( idx != 0 ) __atomic_store_n(&slot->state, CONTROL_CMD_SLOT_FREE, __ATOMIC_RELEASE);
+   return(1);
+}
+
+// Take the command that has been ready longest, called by the server.
+// Returns its slot or -1 if none is ready.
+inline int32_t controlCmdNext ( ControlCmdMemory *ptr, uint8_t *cmdType, char **argA, char **argB ) {
+   uint32_t x;
+   int32_t  idx = -1;
+
+   for (x=0; x < CONTROL_CMD_QUEUE_SIZE; x++) {
+      if ( __atomic_load_n(&ptr->slot[x].state, __ATOMIC_ACQUIRE) == CONTROL_CMD_SLOT_READY &&
+           ( idx < 0 || (int32_t)(ptr->slot[x].ticket - ptr->slot[idx].ticket) < 0 ) ) idx = x;
    }
+   if ( idx < 0 ) return(-1);
+
+   // A client withdrawing it meanwhile wins
+   uint32_t state = CONTROL_CMD_SLOT_READY;
+   if ( ! __atomic_compare_exchange_n(&ptr->slot[idx].state, &state, CONTROL_CMD_SLOT_BUSY,
+                                      false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED) ) return(controlCmdNext(ptr,cmdType,argA,argB));
+
+   *cmdType = ptr->slot[idx].cmdType;
+   *argA    = ptr->slot[idx].cmdArgA;
+   *argB    = ptr->slot[idx].cmdArgB;
+   return(idx);
+}
+
+// Finish a command and wake its client, called by the server.
+// Either result or error may be NULL.
+inline void controlCmdComplete ( ControlCmdMemory *ptr, int32_t idx, const char *result, const char *error ) {
+   ControlCmdSlot *slot = &ptr->slot[idx];
+   uint32_t        state = CONTROL_CMD_SLOT_BUSY;
+
+   if ( result != NULL ) controlCmdCopy(slot->cmdResult,result,CONTROL_CMD_RESULT_SIZE);
+   if ( error  != NULL ) controlCmdCopy(slot->cmdError,error,CONTROL_CMD_ERROR_SIZE);
+
+   // An abandoned slot is freed instead
+   if ( ! __atomic_compare_exchange_n(&slot->state, &state, CONTROL_CMD_SLOT_DONE,
+                                      false, __ATOMIC_RELEASE, __ATOMIC_RELAXED) )
+      __atomic_store_n(&slot->state, CONTROL_CMD_SLOT_FREE, __ATOMIC_RELEASE);
+
+   controlCmdFutexWake(&slot->state);
+}
+
+// Wait until a command may have been queued since *seen was taken, called
+// by the server. Timeout in milliseconds, 0 = forever. Returns 1 if so.
+inline int32_t controlCmdWaitRequest ( ControlCmdMemory *ptr, uint32_t *seen, uint32_t timeout ) {
+   uint32_t now;
+
+   if ( (now = __atomic_load_n(&ptr->reqFutex, __ATOMIC_ACQUIRE)) == *seen ) {
+      controlCmdFutexWait(&ptr->reqFutex,*seen,timeout);
+      now = __atomic_load_n(&ptr->reqFutex, __ATOMIC_ACQUIRE);
+   }
+   if ( now == *seen ) return(0);
+   *seen = now;
+   return(1);
+}
+
+// Send command, using slot 0. The slot is claimed like a queued one, once
+// the server is no longer running the previous command. A previous command
+// the server has yet to take is replaced, as it always was. If the server
+// does not let go within 10 seconds it is taken anyway.
+inline void controlCmdSetCommand ( ControlCmdMemory *ptr, uint8_t cmdType, const char *argA, const char *argB ) {
+   ControlCmdSlot *slot = &ptr->slot[0];
+   uint32_t        state;
+   uint32_t        waited = 0;
+
    strcpy(ptr->errorBuffer,"");
 
-   ptr->cmdType = cmdType;
- 
-   ptr->cmdRdyCount++;
+   while ( 1 ) {
+      state = __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE);
+      if ( state == CONTROL_CMD_SLOT_FREE || state == CONTROL_CMD_SLOT_DONE || state == CONTROL_CMD_SLOT_READY ) {
+         if ( __atomic_compare_exchange_n(&slot->state, &state, CONTROL_CMD_SLOT_CLAIMED,
+                                          false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED) ) break;
+      }
+      else if ( waited >= 10000 ) {
+         __atomic_store_n(&slot->state, CONTROL_CMD_SLOT_CLAIMED, __ATOMIC_RELAXED);
+         break;
+      }
+      else {
+         controlCmdFutexWait(&slot->state,state,10);
+         waited += 10;
+      }
+   }
+   controlCmdPost(ptr,0,cmdType,argA,argB);
 }
 
-// Check for pending command
+// Check for pending command, it stays pending until acked
 inline int32_t controlCmdGetCommand ( ControlCmdMemory *ptr, uint8_t *cmdType, char **argA, char **argB ) {
-   if ( ptr->cmdRdyCount == ptr->cmdAckCount ) return(0);
-   else {
-      ptr->cmdArgA[CONTROL_CMD_ARGA_SIZE-1] = '\0';
-      ptr->cmdArgB[CONTROL_CMD_ARGB_SIZE-1] = '\0';
-
-      *cmdType = ptr->cmdType;
-      *argA    = ptr->cmdArgA;
-      *argB    = ptr->cmdArgB;
-      return(1);
-   }
+   if ( ptr->srvSlot < 0 && (ptr->srvSlot = controlCmdNext(ptr,cmdType,argA,argB)) < 0 ) return(0);
+
+   *cmdType = ptr->slot[ptr->srvSlot].cmdType;
+   *argA    = ptr->slot[ptr->srvSlot].cmdArgA;
+   *argB    = ptr->slot[ptr->srvSlot].cmdArgB;
+   return(1);
 }
 
 // Command Set Result
 inline void controlCmdSetResult ( ControlCmdMemory *ptr, const char *result ) {
-   if ( result != NULL ) {
-      strncpy(ptr->cmdResult,result,CONTROL_CMD_RESULT_SIZE);
-      ptr->cmdResult[CONTROL_CMD_RESULT_SIZE-1] = '\0';
-   }
+   if ( result != NULL && ptr->srvSlot >= 0 )
+      controlCmdCopy(ptr->slot[ptr->srvSlot].cmdResult,result,CONTROL_CMD_RESULT_SIZE);
 }
 
 // Command ack
 inline void controlCmdAckCommand ( ControlCmdMemory *ptr ) {
-   ptr->cmdAckCount = ptr->cmdRdyCount;
+   if ( ptr->srvSlot >= 0 ) controlCmdComplete(ptr,ptr->srvSlot,NULL,ptr->errorBuffer);
+   ptr->srvSlot = -1;
 }
 
 // Wait for command completion
 inline int32_t controlCmdGetResult ( ControlCmdMemory *ptr, char *result ) {
-   if ( ptr->cmdRdyCount != ptr->cmdAckCount ) return(0);
+   uint32_t state = __atomic_load_n(&ptr->slot[0].state, __ATOMIC_ACQUIRE);
+
+   if ( state != CONTROL_CMD_SLOT_DONE && state != CONTROL_CMD_SLOT_FREE ) return(0);
    else { 
       if ( result != NULL ) {
-         ptr->cmdResult[CONTROL_CMD_RESULT_SIZE-1] = '\0';
-         strncpy(result,ptr->cmdResult,CONTROL_CMD_RESULT_SIZE);
+         ptr->slot[0].cmdResult[CONTROL_CMD_RESULT_SIZE-1] = '\0';
+         strncpy(result,ptr->slot[0].cmdResult,CONTROL_CMD_RESULT_SIZE);
       }
       return(1);
    }
@@ -205,24 +439,27 @@ inline int32_t controlCmdGetResultTimeout ( ControlCmdMemory *ptr, char *result,
    struct timeval now;
    struct timeval sum;
    struct timeval add;
+   uint32_t       state;
 
    gettimeofday(&now,NULL);
    add.tv_sec =  (timeout / 1000);
-   add.tv_usec = (timeout % 1000);
+   add.tv_usec = (timeout % 1000) * 1000;
    timeradd(&now,&add,&sum);
 
    while ( ! controlCmdGetResult(ptr,result) ) {
       gettimeofday(&now,NULL);
       if ( timercmp(&now,&sum,>) ) return(0);
-      usleep(1000); // Wait 1 millisecond
+      timersub(&sum,&now,&add);
+      state = __atomic_load_n(&ptr->slot[0].state, __ATOMIC_ACQUIRE);
+      if ( state != CONTROL_CMD_SLOT_DONE && state != CONTROL_CMD_SLOT_FREE )
+         controlCmdFutexWait(&ptr->slot[0].state,state,add.tv_sec * 1000 + add.tv_usec / 1000 + 1);
    }
    return(1);
 }
 
 // Set Config
 inline void controlCmdSetConfig ( ControlCmdMemory *ptr, const char *config ) {
-   strncpy(ptr->xmlConfigBuffer,config,CONTROL_CMD_CONFIG_SIZE);
-   ptr->xmlConfigBuffer[CONTROL_CMD_CONFIG_SIZE-1] = '\0';
+   controlCmdCopy(ptr->xmlConfigBuffer,config,CONTROL_CMD_CONFIG_SIZE);
 }
 
 // Get Config
@@ -233,8 +470,7 @@ inline const char * controlCmdGetConfig ( ControlCmdMemory *ptr ) {
 
 // Set Status
 inline void controlCmdSetStatus ( ControlCmdMemory *ptr, const char *status ) {
-   strncpy(ptr->xmlStatusBuffer,status,CONTROL_CMD_STATUS_SIZE);
-   ptr->xmlStatusBuffer[CONTROL_CMD_STATUS_SIZE-1] = '\0';
+   controlCmdCopy(ptr->xmlStatusBuffer,status,CONTROL_CMD_STATUS_SIZE);
 }
 
 // Get Status
@@ -244,8 +480,7 @@ inline const char * controlCmdGetStatus ( ControlCmdMemory *ptr ) {
 }
 
 inline void controlCmdSetPerStatus ( ControlCmdMemory *ptr, const char *status ) {
-   strncpy(ptr->xmlPerStatusBuffer,status,CONTROL_CMD_STATUS_SIZE);
-   ptr->xmlPerStatusBuffer[CONTROL_CMD_STATUS_SIZE-1] = '\0';
+   controlCmdCopy(ptr->xmlPerStatusBuffer,status,CONTROL_CMD_STATUS_SIZE);
 }
 
 // Get Status
@@ -256,8 +491,7 @@ inline const char * controlCmdGetPerStatus ( ControlCmdMemory *ptr ) {
 
 // Set Error 
 inline void controlCmdSetError ( ControlCmdMemory *ptr, const char *error ) {
-   strncpy(ptr->errorBuffer,error,CONTROL_CMD_ERROR_SIZE);
-   ptr->errorBuffer[CONTROL_CMD_ERROR_SIZE-1] = '\0';
+   controlCmdCopy(ptr->errorBuffer,error,CONTROL_CMD_ERROR_SIZE);
 }
 
 // Get Error
@@ -268,6 +502,7 @@ inline const char * controlCmdGetError ( ControlCmdMemory *ptr ) {
 
 #else 
 
+inline void controlCmdName ( char *shmName, const char *system, uint32_t id, int32_t uid=-1 ) { shmName[0] = '\0'; }
 inline int32_t controlCmdOpenAndMap ( ControlCmdMemory **ptr, const char *system, uint32_t id, int32_t uid=-1 ) { return -1; }
 inline void controlCmdClose ( ControlCmdMemory *ptr ) { }
 inline void controlCmdInit ( ControlCmdMemory *ptr ) { }
@@ -277,6 +512,11 @@ inline void controlCmdSetResult ( ControlCmdMemory *ptr, const char *result ) {
 inline void controlCmdAckCommand ( ControlCmdMemory *ptr ) { }
 inline int32_t controlCmdGetResult ( ControlCmdMemory *ptr, char *result ) { return 0; }
 inline int32_t controlCmdGetResultTimeout ( ControlCmdMemory *ptr, char *result, int32_t timeout ) { return 0; }
+inline int32_t controlCmdSubmit ( ControlCmdMemory *ptr, uint8_t cmdType, const char *argA, const char *argB ) { return -1; }
+inline int32_t controlCmdWait ( ControlCmdMemory *ptr, int32_t idx, char *result, char *error, uint32_t timeout ) { return 0; }
+inline int32_t controlCmdNext ( ControlCmdMemory *ptr, uint8_t *cmdType, char **argA, char **argB ) { return -1; }
+inline void controlCmdComplete ( ControlCmdMemory *ptr, int32_t idx, const char *result, const char *error ) { }
+inline int32_t controlCmdWaitRequest ( ControlCmdMemory *ptr, uint32_t *seen, uint32_t timeout ) { return 0; }
 inline void controlCmdSetConfig ( ControlCmdMemory *ptr, const char *config ) { }
 inline const char * controlCmdGetConfig ( ControlCmdMemory *ptr ) { return NULL; }
 inline void controlCmdSetStatus ( ControlCmdMemory *ptr, const char *status ) { }
@@ -18,6 +18,8 @@
 //-----------------------------------------------------------------------------
 // Modification history :
 // 08/29/2011: created
+// 08/29/2018: Shared memory commands are queued and wake the server
+// 08/30/2018: One poll per batch of shared memory commands
 //-----------------------------------------------------------------------------
 #include <System.h>
 #include <ControlServer.h>
@@ -26,6 +28,7 @@
 #include <stdint.h>
 #include <inttypes.h>
 #include <signal.h>
+#include <fcntl.h>
 using namespace std;
 
 // Constructor
@@ -46,26 +49,73 @@ ControlServer::ControlServer ( ) {
 
    smem_ = NULL;
 
+   wakeFd_[0]  = -1;
+   wakeFd_[1]  = -1;
+   wakeEnable_ = false;
+
    signal(SIGPIPE, SIG_IGN);
 }
 
 // DeConstructor
 ControlServer::~ControlServer ( ) {
+   if ( wakeEnable_ ) {
+      wakeEnable_ = false;
+      pthread_join(wakeThread_,NULL);
+   }
+   if ( wakeFd_[0] >= 0 ) close(wakeFd_[0]);
+   if ( wakeFd_[1] >= 0 ) close(wakeFd_[1]);
    if ( smem_ != NULL ) controlCmdClose(smem_);
    stopListen();
 }
 
+// Shared memory command wakeup thread
+void *ControlServer::wakeRun ( void *t ) {
+   ControlServer *ti = (ControlServer *)t;
+   uint32_t       seen = 0;
+
+   // Checks the stop flag every 100 milliseconds
+   while ( ti->wakeEnable_ ) {
+      if ( controlCmdWaitRequest(ti->smem_,&seen,100) ) {
+         if ( write(ti->wakeFd_[1],"",1) < 0 ) { } // Full pipe is already a wakeup
+      }
+   }
+   pthread_exit(NULL);
+   return(NULL);
+}
+
 // Enable shared 
 void ControlServer::enableSharedMemory ( string system, uint32_t id ) {
 
-   // Attempt to open and init shared memory
-   if ( (smemFd_ = controlCmdOpenAndMap ( &smem_ , system.c_str(), id )) < 0 ) {
+   // Attempt to open and init shared memory, replacing one left with
+   // another layout
+   if ( (smemFd_ = controlCmdOpenAndMap ( &smem_ , system.c_str(), id )) == -3 ) {
+      char shmName[CONTROL_CMD_NAME_SIZE];
+      controlCmdName(shmName,system.c_str(),id);
+      shm_unlink(shmName);
+      smemFd_ = controlCmdOpenAndMap ( &smem_ , system.c_str(), id );
+   }
+   if ( smemFd_ < 0 ) {
       smem_ = NULL;
       throw string("ControlServer::ControlServer -> Failed to open shared memory");
    }
 
    // Init shared memory
    controlCmdInit(smem_);
+
+   // Start the thread waking receive for new commands
+   if ( pipe(wakeFd_) < 0 ) {
+      wakeFd_[0] = -1;
+      wakeFd_[1] = -1;
+      throw string("ControlServer::enableSharedMemory -> Failed to create wakeup pipe");
+   }
+   fcntl(wakeFd_[0],F_SETFL,O_NONBLOCK);
+   fcntl(wakeFd_[1],F_SETFL,O_NONBLOCK);
+
+   wakeEnable_ = true;
+   if ( pthread_create(&wakeThread_,NULL,wakeRun,this) ) {
+      wakeEnable_ = false;
+      throw string("ControlServer::enableSharedMemory -> Failed to create wakeup thread");
+   }
 }
 
 // Set debug flag
@@ -156,13 +206,16 @@ void ControlServer::receive ( uint32_t selectPeriod, uint32_t pollPeriod, bool *
    stringstream   msg;
    uint32_t       x;
    int32_t        y;
-   string         pmsg;
    uint8_t        cmdType;
    char         * cmdArgA;
    char         * cmdArgB;
    bool           tcpPend;
    bool           indPend[MaxClients_];
-   bool           shmPend;
+   int32_t        shmSlot;
+   string         shmResult;
+   string         shmError;
+   uint32_t       shmCount;
+   bool           shmPoll;
    int32_t        pollCycles;
    int32_t        pollCount;
 
@@ -180,7 +233,6 @@ void ControlServer::receive ( uint32_t selectPeriod, uint32_t pollPeriod, bool *
 
       pollCount++;
       tcpPend = false;
-      shmPend = false;
 
       // Setup for listen call
       FD_ZERO(&fdset);
@@ -190,13 +242,17 @@ void ControlServer::receive ( uint32_t selectPeriod, uint32_t pollPeriod, bool *
          if ( servFd_ > maxFd ) maxFd = servFd_;
       }
       for ( x=0; x < MaxClients_; x++ ) {
+         indPend[x] = false;
          if ( connFd_[x] >= 0 ) {
             FD_SET(connFd_[x],&fdset);
             if ( connFd_[x] > maxFd ) maxFd = connFd_[x];
-            indPend[x] = false;
          }
          else rxData_[x].str("");
       }
+      if ( wakeFd_[0] >= 0 ) {
+         FD_SET(wakeFd_[0],&fdset);
+         if ( wakeFd_[0] > maxFd ) maxFd = wakeFd_[0];
+      }
 
       // Call select
       tval.tv_sec  = 0;
@@ -206,6 +262,11 @@ void ControlServer::receive ( uint32_t selectPeriod, uint32_t pollPeriod, bool *
       // Something is ready
       if ( ret > 0 ) {
 
+         // Shared memory command wakeup, the commands are picked up below
+         if ( wakeFd_[0] >= 0 && FD_ISSET(wakeFd_[0],&fdset) ) {
+            while ( read(wakeFd_[0],buffer_,sizeof(buffer_)) > 0 ) { }
+         }
+
          // server socket is ready
          if ( servFd_ >= 0 && FD_ISSET(servFd_,&fdset)  ) {
 
@@ -297,99 +358,131 @@ void ControlServer::receive ( uint32_t selectPeriod, uint32_t pollPeriod, bool *
          }
       }
 
-      // Shared memory commands
-      if ( smem_ != NULL && controlCmdGetCommand(smem_,&cmdType,&cmdArgA,&cmdArgB) ) {
+      // Poll if timeout or tcp command, ahead of the shared memory commands
+      // so that they are not handed errors from the tcp commands
+      if ( tcpPend || (pollCount >= pollCycles) ) {
+         pollSystem(indPend);
+         pollCount = 0;
+      }
+
+      // Shared memory commands. Each one that can change state or fail is
+      // handed back the errors it added. The poll that updates the status
+      // and config is done once, after the batch or before a read that
+      // follows such a command, and sets the error buffer for the batch.
+      shmCount = 0;
+      shmPoll  = false;
+      while ( smem_ != NULL && shmCount < CONTROL_CMD_QUEUE_SIZE &&
+              (shmSlot = controlCmdNext(smem_,&cmdType,&cmdArgA,&cmdArgB)) >= 0 ) {
          if ( debug_ ) cout << "ControlServer::receive -> Processing shared memory command type " << dec << cmdType << endl;
-         vars_.clear();
-
-         // Process Command
-         switch(cmdType) {
-
-            // One arg,  XML string, No Result
-            case CONTROL_CMD_TYPE_SEND_XML :
-               system_->parseXmlString(cmdArgA);
-               controlCmdSetResult(smem_,"");
-               break;
-
-            // Two args, Config Variable and String Value, No Result
-            case CONTROL_CMD_TYPE_SET_CONFIG :
-               sprintf(xmlCmd_,"<system><config>%s</config></system>\n",vars_.setXml(cmdArgA,cmdArgB).c_str());
-               system_->parseXmlString(xmlCmd_);
-               controlCmdSetResult(smem_,"");
-               break;
-
-            // One Arg, Config Variable, Result is Value
-            case CONTROL_CMD_TYPE_GET_CONFIG :
-               vars_.parse("config",controlCmdGetConfig(smem_));
-               controlCmdSetResult(smem_,vars_.get(cmdArgA).c_str());
-               break;
-
-            // One Arg, Status Variable, Result is Value
-            case CONTROL_CMD_TYPE_GET_STATUS :
-               vars_.parse("status",controlCmdGetStatus(smem_));
-               vars_.parse("status",controlCmdGetPerStatus(smem_));
-               controlCmdSetResult(smem_,vars_.get(cmdArgA).c_str());
-               break;
-
-            // Two Args, Device Path and command, No Result
-            case CONTROL_CMD_TYPE_EXEC_COMMAND  :
-               sprintf(xmlCmd_,"<system><command>%s</command></system>\n",vars_.setXml(cmdArgA,cmdArgB).c_str());
-               system_->parseXmlString(xmlCmd_);
-               controlCmdSetResult(smem_,"");
-               break;
-
-            // Three Args, Device Path, register name and value, No Result
-            case CONTROL_CMD_TYPE_SET_REGISTER :
-               sprintf(regStr_,"%s:WriteRegister",cmdArgA);
-               sprintf(xmlCmd_,"<system><command>%s</command></system>\n",vars_.setXml(regStr_,cmdArgB).c_str());
-               system_->parseXmlString(xmlCmd_);
-               controlCmdSetResult(smem_,"");
-               break;
-
-            // Two Args, Device Path, register name, Result is value
-            case CONTROL_CMD_TYPE_GET_REGISTER :
-               sprintf(regStr_,"%s:ReadRegister",cmdArgA);
-               sprintf(xmlCmd_,"<system><command>%s</command></system>\n",vars_.setXml(regStr_,cmdArgB).c_str());
-               system_->parseXmlString(xmlCmd_);
-               vars_.parse("status",system_->statusString(true,false,true,true).c_str());
-               sprintf(regStr_,"%s:ReadRegisterResult",cmdArgA);
-               controlCmdSetResult(smem_,vars_.get(regStr_).c_str());
-               break;
-
-            default:
-               controlCmdSetResult(smem_,"");
-               break;
+         shmCount++;
+
+         if ( cmdType == CONTROL_CMD_TYPE_GET_CONFIG || cmdType == CONTROL_CMD_TYPE_GET_STATUS ) {
+            if ( shmPoll ) {
+               controlCmdSetError(smem_,"");
+               pollSystem(indPend);
+               pollCount = 0;
+               shmPoll   = false;
+            }
+            shmResult = shmCommand(cmdType,cmdArgA,cmdArgB);
+            controlCmdComplete(smem_,shmSlot,shmResult.c_str(),"");
+         }
+         else {
+            shmError  = system_->pendingErrors();
+            shmResult = shmCommand(cmdType,cmdArgA,cmdArgB);
+            shmError  = system_->pendingErrors().substr(shmError.length());
+            controlCmdComplete(smem_,shmSlot,shmResult.c_str(),shmError.c_str());
+            shmPoll = true;
          }
-         shmPend = true;
       }
-
-      // Poll if timeout or xml or tcp command
-      if ( shmPend || tcpPend || (pollCount >= pollCycles) ) {
-         pmsg = system_->poll(smem_);
+      if ( shmPoll ) {
+         controlCmdSetError(smem_,"");
+         pollSystem(indPend);
          pollCount = 0;
+      }
+      if ( debug_ && shmCount > 0 ) cout << "ControlServer::receive -> Done Processing shared memory message" << endl;
+   } while ( stop != NULL && *stop == false );
+}
 
-         // Ack pending command
-         if ( shmPend ) {
-            if ( debug_ ) cout << "ControlServer::receive -> Done Processing shared memory message" << endl;
-            controlCmdAckCommand(smem_);
-         }
 
-         // Send message
-         if ( pmsg != "" ) {
-            msg.str("");
-            msg << pmsg << "\f";
+// Poll the system and send the resulting message to the clients
+void ControlServer::pollSystem ( bool *indPend ) {
+   stringstream msg;
+   string       pmsg;
+   uint32_t     x;
 
-            for ( x=0; x < MaxClients_; x++ ) {
-               if ( connFd_[x] >= 0 ) {
-                  if ( (!quietMode_[x]) || indPend[x] ) sendData(x,msg.str().c_str(),msg.str().length());
-               }
-            }
+   pmsg = system_->poll(smem_);
+
+   // Send message
+   if ( pmsg != "" ) {
+      msg.str("");
+      msg << pmsg << "\f";
+
+      for ( x=0; x < MaxClients_; x++ ) {
+         if ( connFd_[x] >= 0 ) {
+            if ( (!quietMode_[x]) || indPend[x] ) sendData(x,msg.str().c_str(),msg.str().length());
          }
+         indPend[x] = false;
       }
-   } while ( stop != NULL && *stop == false );
+   }
 }
 
 
+// Run a shared memory command
+string ControlServer::shmCommand ( uint8_t cmdType, const char *cmdArgA, const char *cmdArgB ) {
+   vars_.clear();
+
+   // Process Command
+   switch(cmdType) {
+
+      // One arg,  XML string, No Result
+      case CONTROL_CMD_TYPE_SEND_XML :
+         system_->parseXmlString(cmdArgA);
+         return("");
+
+      // Two args, Config Variable and String Value, No Result
+      case CONTROL_CMD_TYPE_SET_CONFIG :
+         sprintf(xmlCmd_,"<system><config>%s</config></system>\n",vars_.setXml(cmdArgA,cmdArgB).c_str());
+         system_->parseXmlString(xmlCmd_);
+         return("");
+
+      // One Arg, Config Variable, Result is Value
+      case CONTROL_CMD_TYPE_GET_CONFIG :
+         vars_.parse("config",controlCmdGetConfig(smem_));
+         return(vars_.get(cmdArgA));
+
+      // One Arg, Status Variable, Result is Value
+      case CONTROL_CMD_TYPE_GET_STATUS :
+         vars_.parse("status",controlCmdGetStatus(smem_));
+         vars_.parse("status",controlCmdGetPerStatus(smem_));
+         return(vars_.get(cmdArgA));
+
+      // Two Args, Device Path and command, No Result
+      case CONTROL_CMD_TYPE_EXEC_COMMAND  :
+         sprintf(xmlCmd_,"<system><command>%s</command></system>\n",vars_.setXml(cmdArgA,cmdArgB).c_str());
+         system_->parseXmlString(xmlCmd_);
+         return("");
+
+      // Three Args, Device Path, register name and value, No Result
+      case CONTROL_CMD_TYPE_SET_REGISTER :
+         sprintf(regStr_,"%s:WriteRegister",cmdArgA);
+         sprintf(xmlCmd_,"<system><command>%s</command></system>\n",vars_.setXml(regStr_,cmdArgB).c_str());
+         system_->parseXmlString(xmlCmd_);
+         return("");
+
+      // Two Args, Device Path, register name, Result is value
+      case CONTROL_CMD_TYPE_GET_REGISTER :
+         sprintf(regStr_,"%s:ReadRegister",cmdArgA);
+         sprintf(xmlCmd_,"<system><command>%s</command></system>\n",vars_.setXml(regStr_,cmdArgB).c_str());
+         system_->parseXmlString(xmlCmd_);
+         vars_.parse("status",system_->statusString(true,false,true,true).c_str());
+         sprintf(regStr_,"%s:ReadRegisterResult",cmdArgA);
+         return(vars_.get(regStr_));
+
+      default:
+         return("");
+   }
+}
+
 void ControlServer::sendData ( uint32_t idx, const char *buffer, uint32_t size ) {
    int32_t  ret;
    uint32_t sent;
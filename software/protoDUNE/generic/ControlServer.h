@@ -31,6 +31,8 @@
 #include <sys/time.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <pthread.h>
+#include <atomic>
 #include <ControlCmdMem.h>
 #include <XmlVariables.h>
 #include <stdint.h>
@@ -68,9 +70,16 @@ class ControlServer {
       System *system_;
 
       // Shared memory
-      uint32_t          smemFd_;
+      int32_t           smemFd_;
       ControlCmdMemory *smem_;
 
+      // Turns shared memory command futex wakeups into a readable pipe
+      // so they end the select in receive
+      int32_t           wakeFd_[2];
+      pthread_t         wakeThread_;
+      std::atomic<bool> wakeEnable_;
+      static void *wakeRun ( void *t );
+
       // Poll Variables
       char   buffer_[9001];
       char   xmlCmd_[9001];
@@ -82,6 +91,12 @@ class ControlServer {
 
       void sendData ( uint32_t idx, const char *buffer, uint32_t size );
 
+      // Run a shared memory command, returns its result
+      string shmCommand ( uint8_t cmdType, const char *cmdArgA, const char *cmdArgB );
+
+      // Poll the system and send the resulting message to the clients
+      void pollSystem ( bool *indPend );
+
    public:
 
       //! Constructor
@@ -6,148 +6,396 @@
 //-----------------------------------------------------------------------------
 // Description :
 // Shared memory for live display
+//
+// The shared memory holds a ring of variable length frames written by one
+// writer and read by any number of independent readers. The writer never
+// waits for the readers. Each frame is stored contiguously behind a small
+// record header carrying its sequence number, so a reader can hand out a
+// pointer into the ring instead of a copy and can tell how many frames it
+// missed.
+//
+// Positions in the ring are 64 bit byte counts that only ever increase:
+//    head - the end of the last published frame
+//    tail - the start of the oldest frame not yet being overwritten
+//
+// Before overwriting the oldest frames the writer moves tail past them, so
+// tail works as the sequence of a seqlock. A reader that finds its frame
+// below tail, either before or after using it, knows it was overwritten.
+// A reader that is idle can sleep on a futex that the writer bumps after
+// every frame.
+//
+// The ring is placed on hugetlbfs, /dev/hugepages, when that is mounted and
+// has room, otherwise in POSIX shared memory with transparent huge pages
+// requested.
 //-----------------------------------------------------------------------------
 // This file is part of 'SLAC Generic DAQ Software'.
-// It is subject to the license terms in the LICENSE.txt file found in the 
-// top-level directory of this distribution and at: 
-//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
-// No part of 'SLAC Generic DAQ Software', including this file, 
-// may be copied, modified, propagated, or distributed except according to 
+// It is subject to the license terms in the LICENSE.txt file found in the
+// top-level directory of this distribution and at:
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html.
+// No part of 'SLAC Generic DAQ Software', including this file,
+// may be copied, modified, propagated, or distributed except according to
 // the terms contained in the LICENSE.txt file.
 // Proprietary and confidential to SLAC.
 //-----------------------------------------------------------------------------
 // Modification history :
 // 01/11/2013: created
+// 08/28/2018: Variable length, multi-reader ring with overrun detection,
+//             hugepage backing, futex wait and zero-copy reads
 //-----------------------------------------------------------------------------
 #ifndef __DATA_SHARED_MEM_H__
 #define __DATA_SHARED_MEM_H__
 
 #ifndef RTEMS
 #include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #endif
 
 #include <sys/stat.h>
-#include <fcntl.h>   
-#include <string.h>   
+#include <fcntl.h>
+#include <string.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <limits.h>
+#include <time.h>
 
-#define DATA_BUFF_SIZE 2097152
-#define DATA_BUFF_CNT  20
-#define DATA_NAME_SIZE 200
+// Total size of the shared memory, a multiple of the 2 MB huge page size
+#ifndef DATA_SHARED_SIZE
+#define DATA_SHARED_SIZE  (64 * 1024 * 1024)
+#endif
+
+#define DATA_SHARED_MAGIC   0x52534444  // 'DDSR'
+#define DATA_SHARED_VERSION 2
+#define DATA_SHARED_HDR     4096        // Bytes in front of the ring
+#define DATA_SHARED_ALIGN   64          // Alignment of each record
+#define DATA_SHARED_HUGE    "/dev/hugepages/"
+#define DATA_NAME_SIZE      200
 
+// Record types
+#define DATA_REC_FRAME 1
+#define DATA_REC_PAD   2
+
+// Header of each record in the ring, the frame follows it
 typedef struct {
+   uint64_t seq;      // Frame sequence number, from 0
+   uint32_t len;      // Bytes in the record, including this header
+   uint32_t type;     // DATA_REC_FRAME or DATA_REC_PAD
+   uint32_t flag;     // Writer's flag for the frame
+   uint32_t count;    // Bytes in the frame
+   uint32_t spare[2];
+} DataSharedRecord;
+
+typedef struct {
+
+   // Fixed at initialization
+   uint32_t magic;
+   uint32_t version;
+   uint32_t generation;   // Incremented by each dataSharedInit
+   uint32_t hugePages;    // Backed by hugetlbfs
+   uint64_t size;         // Bytes in the ring
+   char     sharedName[DATA_NAME_SIZE];
+
+   // Written by the writer only
+   uint64_t head    __attribute__ ((aligned (64)));
+   uint64_t tail;
+   uint64_t last;         // Start of the last published frame
+   uint64_t wrCount;      // Frames written
+   uint64_t dropCount;    // Frames too large for the ring
+   uint32_t futex;        // Bumped after each frame
 
-   uint32_t wrAddr;
-   uint32_t wrCount;
-   uint32_t wrAddrLast;
-   uint32_t wrCountLast;
-   char         sharedName[DATA_NAME_SIZE];
-   uint8_t  buffer[DATA_BUFF_CNT][DATA_BUFF_SIZE];
+   // Written by the readers
+   uint32_t waiters __attribute__ ((aligned (64)));
+
+   // The ring, following the header page
+   uint8_t  buffer[] __attribute__ ((aligned (DATA_SHARED_HDR)));
 
 } DataSharedMemory;
 
+// Cursor of one reader, private to the reader
+typedef struct {
+   uint64_t pos;          // Start of the next record to read
+   uint64_t cur;          // Start of the record last returned
+   uint64_t seq;          // Sequence number expected next, ~0 if unknown
+   uint64_t frames;       // Frames returned
+   uint64_t missed;       // Frames overwritten before being read or used
+   uint32_t generation;   // Generation the cursor belongs to
+   uint32_t synced;       // Cursor has been positioned
+} DataSharedReader;
+
 
 #ifndef RTEMS
 
+// Location of the record at ring position pos
+inline DataSharedRecord *dataSharedRecord ( DataSharedMemory *ptr, uint64_t pos ) {
+   return((DataSharedRecord *)(ptr->buffer + (pos % ptr->size)));
+}
+
+// Create or open the backing file, on hugetlbfs if possible
+inline int32_t dataSharedOpenFile ( const char *shmName, uint32_t *huge ) {
+   int32_t  fd;
+   char     path[DATA_NAME_SIZE+20];
+   mode_t   mode = (S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+
+   snprintf(path,sizeof(path),"%s%s",DATA_SHARED_HUGE,shmName);
+
+   // Attempt to open existing shared memory, wherever it was created
+   *huge = 1;
+   if ( (fd = open(path, O_RDWR)) >= 0 ) return(fd);
+   *huge = 0;
+   if ( (fd = shm_open(shmName, O_RDWR, mode)) >= 0 ) return(fd);
+
+   // Otherwise create it, preferring huge pages
+   *huge = 1;
+   if ( (fd = open(path, (O_CREAT | O_RDWR), mode)) >= 0 ) {
+      void *addr = MAP_FAILED;
+
+      // The huge pages are only reserved when mapped, so see that they are there
+      if ( ftruncate(fd, DATA_SHARED_SIZE) == 0 )
+         addr = mmap(0, DATA_SHARED_SIZE, (PROT_READ | PROT_WRITE), MAP_SHARED, fd, 0);
+      if ( addr != MAP_FAILED ) {
+         munmap(addr, DATA_SHARED_SIZE);
+         fchmod(fd, mode);
+         return(fd);
+      }
+      ::close(fd);
+      unlink(path);
+   }
+
+   *huge = 0;
+   if ( (fd = shm_open(shmName, (O_CREAT | O_RDWR), mode)) < 0 ) return(-1);
+
+   // Force permissions regardless of umask
+   fchmod(fd, mode);
+
+   // Set the size of the shared memory segment
+   if ( ftruncate(fd, DATA_SHARED_SIZE) != 0 ) {
+      ::close(fd);
+      return(-1);
+   }
+   return(fd);
+}
+
 // Open and map shared memory
 inline int32_t dataSharedOpenAndMap ( DataSharedMemory **ptr, const char *system, int32_t id, int32_t uid=-1 ) {
    int32_t       smemFd;
-   char          shmName[200];
+   char          shmName[DATA_NAME_SIZE];
    int32_t       lid;
+   uint32_t      huge;
+   struct stat   st;
+   void        * addr;
 
    // ID to use?
    if ( uid == -1 ) lid = getuid();
    else lid = uid;
 
    // Generate shared memory
-   sprintf(shmName,"data_shared.%i.%s.%i",lid,system,id);
+   snprintf(shmName,DATA_NAME_SIZE,"data_shared.%i.%s.%i",lid,system,id);
 
-   // Attempt to open existing shared memory
-   if ( (smemFd = shm_open(shmName, O_RDWR, (S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH)) ) < 0 ) {
+   if ( (smemFd = dataSharedOpenFile(shmName,&huge)) < 0 ) return(-1);
 
-      // Otherwise open and create shared memory
-      if ( (smemFd = shm_open(shmName, (O_CREAT | O_RDWR), (S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH)) ) < 0 ) return(-1);
+   // Map whatever size the creator gave it
+   if ( fstat(smemFd,&st) != 0 || st.st_size <= DATA_SHARED_HDR ) return(-2);
 
-      // Force permissions regardless of umask
-      fchmod(smemFd, (S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH));
-    
-      // Set the size of the shared memory segment
-      ftruncate(smemFd, sizeof(DataSharedMemory));
-   }
+   if ( (addr = mmap(0, st.st_size, (PROT_READ | PROT_WRITE), MAP_SHARED, smemFd, 0)) == MAP_FAILED ) return(-2);
 
-   // Map the shared memory
-   if((*ptr = (DataSharedMemory *)mmap(0, sizeof(DataSharedMemory),
-              (PROT_READ | PROT_WRITE), MAP_SHARED, smemFd, 0)) == MAP_FAILED) return(-2);
+#ifdef MADV_HUGEPAGE
+   if ( ! huge ) madvise(addr, st.st_size, MADV_HUGEPAGE);
+#endif
+
+   *ptr = (DataSharedMemory *)addr;
 
-   // Store name
-   strcpy((*ptr)->sharedName,shmName);
+   // Store name, size and backing for dataSharedInit and dataSharedClose
+   if ( (*ptr)->magic != DATA_SHARED_MAGIC ) {
+      strcpy((*ptr)->sharedName,shmName);
+      (*ptr)->size      = st.st_size - DATA_SHARED_HDR;
+      (*ptr)->hugePages = huge;
+   }
 
    return(smemFd);
 }
 
 // Close shared memory
 inline void dataSharedClose ( DataSharedMemory *ptr ) {
-   char shmName[200];
+   char shmName[DATA_NAME_SIZE+20];
 
-   // Get shared name
-   strcpy(shmName,ptr->sharedName);
-
-   // Unlink
-   shm_unlink(shmName);
+   // Unlink from wherever it was created
+   if ( ptr->hugePages ) {
+      snprintf(shmName,sizeof(shmName),"%s%s",DATA_SHARED_HUGE,ptr->sharedName);
+      unlink(shmName);
+   }
+   else shm_unlink(ptr->sharedName);
 }
 
-// Init data structure, called by ControlServer
+// Init data structure, called by the writer
 inline void dataSharedInit ( DataSharedMemory *ptr ) {
-   ptr->wrAddr      = 0;
-   ptr->wrAddrLast  = 0;
-   ptr->wrCount     = 0;
-   ptr->wrCountLast = 0;
+
+   // Readers that see the magic vanish stop reading until it is back
+   __atomic_store_n(&ptr->magic, 0, __ATOMIC_RELEASE);
+
+   ptr->version   = DATA_SHARED_VERSION;
+   ptr->head      = 0;
+   ptr->tail      = 0;
+   ptr->last      = 0;
+   ptr->wrCount   = 0;
+   ptr->dropCount = 0;
+   ptr->generation++;
+
+   __atomic_store_n(&ptr->magic, DATA_SHARED_MAGIC, __ATOMIC_RELEASE);
 }
 
-// Write to shared buffer
+// Write a frame of count bytes to the shared buffer
 inline void dataSharedWrite ( DataSharedMemory *ptr, uint32_t flag, const uint8_t *data, uint32_t count ) {
-   if ( (count+1) < DATA_BUFF_SIZE ) {
-      ptr->wrAddrLast  = ptr->wrAddr;
-      ptr->wrCountLast = ptr->wrCount;
+   DataSharedRecord *rec;
+   uint64_t size = ptr->size;
+   uint64_t seq  = ptr->wrCount;
+   uint64_t len  = (sizeof(DataSharedRecord) + count + DATA_SHARED_ALIGN - 1) & ~(uint64_t)(DATA_SHARED_ALIGN - 1);
+   uint64_t head = ptr->head;
+   uint64_t tail = ptr->tail;
+   uint64_t off  = head % size;
+   uint64_t pad;
+   uint64_t end;
+
+   // Frames that would leave no room for others are counted; the gap in the
+   // sequence numbers tells the readers they missed one
+   if ( len > size / 2 ) {
+      ptr->dropCount++;
+      __atomic_store_n(&ptr->wrCount, seq + 1, __ATOMIC_RELEASE);
+      return;
+   }
 
-      uint32_t *u32 = (uint32_t *)ptr->buffer[ptr->wrAddr];
+   // A frame never wraps, the end of the ring is padded instead
+   pad = (off + len > size) ? (size - off) : 0;
+   end = head + pad + len;
 
-      *u32 = flag;
-      //*((int32_t *)ptr->buffer[ptr->wrAddr]) = flag;
+   // Retire the frames about to be overwritten before touching them
+   if ( end - tail > size ) {
+      while ( end - tail > size ) tail += dataSharedRecord(ptr,tail)->len;
+      __atomic_store_n(&ptr->tail, tail, __ATOMIC_RELAXED);
+      __atomic_thread_fence(__ATOMIC_RELEASE);
+   }
 
-      memcpy(&(ptr->buffer[ptr->wrAddr][4]),data,count);
+   if ( pad ) {
+      rec = dataSharedRecord(ptr,head);
+      rec->seq   = seq;
+      rec->len   = pad;
+      rec->type  = DATA_REC_PAD;
+      rec->flag  = 0;
+      rec->count = 0;
+   }
+
+   rec = dataSharedRecord(ptr,head + pad);
+   rec->seq   = seq;
+   rec->len   = len;
+   rec->type  = DATA_REC_FRAME;
+   rec->flag  = flag;
+   rec->count = count;
+   memcpy(rec + 1,data,count);
+
+   // Publish, last after head so a reader never sees last beyond head
+   __atomic_store_n(&ptr->wrCount, seq + 1,    __ATOMIC_RELAXED);
+   __atomic_store_n(&ptr->head,    end,        __ATOMIC_RELEASE);
+   __atomic_store_n(&ptr->last,    head + pad, __ATOMIC_RELEASE);
+
+   // Wake sleeping readers
+   __atomic_add_fetch(&ptr->futex, 1, __ATOMIC_SEQ_CST);
+   if ( __atomic_load_n(&ptr->waiters, __ATOMIC_SEQ_CST) != 0 )
+      syscall(SYS_futex, &ptr->futex, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
 
-      ptr->wrCount++;
-      ptr->wrAddr++;
-      if ( ptr->wrAddr == DATA_BUFF_CNT ) ptr->wrAddr = 0;
+// Init a reader's cursor, the first read returns the newest frame
+inline void dataSharedReaderInit ( DataSharedReader *rd ) {
+   memset(rd,0,sizeof(DataSharedReader));
+   rd->seq = ~(uint64_t)0;
+}
+
+// Position a reader's cursor at the newest frame when it is new or the
+// writer has re-initialized. Returns 0 if the writer has not initialized.
+inline int32_t dataSharedSync ( DataSharedMemory *ptr, DataSharedReader *rd ) {
+   uint32_t gen;
+
+   if ( __atomic_load_n(&ptr->magic, __ATOMIC_ACQUIRE) != DATA_SHARED_MAGIC ) return(0);
+
+   gen = __atomic_load_n(&ptr->generation, __ATOMIC_ACQUIRE);
+   if ( ! rd->synced || rd->generation != gen ) {
+      rd->pos        = __atomic_load_n(&ptr->last, __ATOMIC_ACQUIRE);
+      rd->seq        = ~(uint64_t)0;
+      rd->generation = gen;
+      rd->synced     = 1;
    }
+   return(1);
 }
 
-// Read from shared buffer
-inline int32_t dataSharedRead ( DataSharedMemory *ptr, uint32_t *rdAddr, uint32_t *rdCount, uint32_t *flag, uint8_t **data ) {
+// Get the next frame without copying it. Returns 1 with the frame's flag,
+// location and size, or 0 if there is none. The frame stays in the ring and
+// must be checked with dataSharedReadValid once it has been used.
+inline int32_t dataSharedReadNext ( DataSharedMemory *ptr, DataSharedReader *rd, uint32_t *flag, uint8_t **data, uint32_t *count ) {
+   DataSharedRecord rec;
+   uint64_t         head;
+
+   if ( ! dataSharedSync(ptr,rd) ) return(0);
 
-   // Detect if reader is ahead of writer or too far behind writer
-   if ( (*rdCount == 0 && ptr->wrCount != 0) || ( *rdCount > ptr->wrCount ) || ( (ptr->wrCount - *rdCount) >= (DATA_BUFF_CNT/2) ) ) {
-      printf("Adjusting pointers. wrAddr=%i, wrCount=%i, wrAddrLast=%i, wrCountLast=%i, rdAddr=%i, rdCount=%i\n",ptr->wrAddr,ptr->wrCount,
-         ptr->wrAddrLast,ptr->wrCountLast,*rdAddr,*rdCount);
-      *rdAddr  = ptr->wrAddrLast;
-      *rdCount = ptr->wrCountLast;
+   while ( 1 ) {
+      head = __atomic_load_n(&ptr->head, __ATOMIC_ACQUIRE);
+      if ( rd->pos >= head ) return(0);
+
+      // Overrun, skip to the oldest frame still there
+      if ( rd->pos < __atomic_load_n(&ptr->tail, __ATOMIC_ACQUIRE) )
+         rd->pos = __atomic_load_n(&ptr->tail, __ATOMIC_ACQUIRE);
+
+      rec = *dataSharedRecord(ptr,rd->pos);
+
+      // The header is only good if it was not being overwritten meanwhile
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      if ( rd->pos < __atomic_load_n(&ptr->tail, __ATOMIC_RELAXED) ) continue;
+
+      if ( rec.type == DATA_REC_PAD ) {
+         rd->pos += rec.len;
+         continue;
+      }
+
+      if ( rd->seq != ~(uint64_t)0 ) rd->missed += rec.seq - rd->seq;
+      rd->seq  = rec.seq + 1;
+      rd->cur  = rd->pos;
+      rd->pos += rec.len;
+      rd->frames++;
+
+      *flag  = rec.flag;
+      *count = rec.count;
+      *data  = (uint8_t *)(dataSharedRecord(ptr,rd->cur) + 1);
+      return(1);
    }
+}
 
-   if ( *rdCount == ptr->wrCount ) return(0);
+// Check that the frame last returned by dataSharedReadNext was not
+// overwritten while it was being used. Returns 1 if it is intact.
+inline int32_t dataSharedReadValid ( DataSharedMemory *ptr, DataSharedReader *rd ) {
+   __atomic_thread_fence(__ATOMIC_ACQUIRE);
+   if ( rd->cur >= __atomic_load_n(&ptr->tail, __ATOMIC_RELAXED) ) return(1);
+   rd->missed++;
+   return(0);
+}
 
-   uint32_t *u32 = (uint32_t *)ptr->buffer[*rdAddr];
-   *flag = *u32;
+// Wait up to timeout microseconds for a frame, 0 waits forever.
+// Returns 1 if there is a frame to read.
+inline int32_t dataSharedWait ( DataSharedMemory *ptr, DataSharedReader *rd, uint32_t timeout ) {
+   struct timespec ts;
+   uint32_t        val;
+   int32_t         ready;
 
-   //*flag = *((uint32_t *)ptr->buffer[*rdAddr]);
-   *data = &(ptr->buffer[*rdAddr][4]);
+   ts.tv_sec  = timeout / 1000000;
+   ts.tv_nsec = (timeout % 1000000) * 1000;
 
-   (*rdCount)++;
-   (*rdAddr)++;
-   if ( *rdAddr == DATA_BUFF_CNT ) *rdAddr = 0;
-   return(1);
+   val = __atomic_load_n(&ptr->futex, __ATOMIC_SEQ_CST);
+   __atomic_add_fetch(&ptr->waiters, 1, __ATOMIC_SEQ_CST);
+
+   ready = dataSharedSync(ptr,rd) && rd->pos < __atomic_load_n(&ptr->head, __ATOMIC_SEQ_CST);
+   if ( ! ready )
+      syscall(SYS_futex, &ptr->futex, FUTEX_WAIT, val, (timeout == 0) ? NULL : &ts, NULL, 0);
+
+   __atomic_sub_fetch(&ptr->waiters, 1, __ATOMIC_SEQ_CST);
+
+   return(dataSharedSync(ptr,rd) && rd->pos < __atomic_load_n(&ptr->head, __ATOMIC_ACQUIRE));
 }
 
 #else
@@ -156,9 +404,12 @@ inline int32_t dataSharedRead ( DataSharedMemory *ptr, uint32_t *rdAddr, uint32_
 inline int32_t  dataSharedOpenAndMap ( DataSharedMemory **ptr, const char *system, int32_t id, int32_t uid=-1 ) { return -1;}
 inline void dataSharedClose ( DataSharedMemory *ptr ) {}
 inline void dataSharedInit ( DataSharedMemory *ptr ) {}
-inline void dataSharedWrite ( DataSharedMemory *ptr, int32_t flag, const char *data, int32_t count ) {}
-inline int32_t  dataSharedRead ( DataSharedMemory *ptr, uint32_t *rdAddr, uint32_t *rdCount, uint32_t *flag, char **data ) { return(1); }
+inline void dataSharedWrite ( DataSharedMemory *ptr, uint32_t flag, const uint8_t *data, uint32_t count ) {}
+inline void dataSharedReaderInit ( DataSharedReader *rd ) {}
+inline int32_t dataSharedSync ( DataSharedMemory *ptr, DataSharedReader *rd ) { return(0); }
+inline int32_t dataSharedReadNext ( DataSharedMemory *ptr, DataSharedReader *rd, uint32_t *flag, uint8_t **data, uint32_t *count ) { return(0); }
+inline int32_t dataSharedReadValid ( DataSharedMemory *ptr, DataSharedReader *rd ) { return(0); }
+inline int32_t dataSharedWait ( DataSharedMemory *ptr, DataSharedReader *rd, uint32_t timeout ) { return(0); }
 
 #endif
 #endif
-
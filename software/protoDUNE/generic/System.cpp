@@ -18,6 +18,7 @@
 //-----------------------------------------------------------------------------
 // Modification history :
 // 04/12/2011: created
+// 08/30/2018: pendingErrors, the errors not yet sent by poll
 //-----------------------------------------------------------------------------
 
 
@@ -697,6 +698,11 @@ string System::localState () {
 }
 
 //! Method to return state string
+// Errors not yet sent
+string System::pendingErrors() {
+   return(errorBuffer_);
+}
+
 string System::poll(ControlCmdMemory *cmem) {
    uint32_t     curr;
    uint32_t     rate;
@@ -18,6 +18,7 @@
 //-----------------------------------------------------------------------------
 // Modification history :
 // 04/12/2011: created
+// 08/30/2018: pendingErrors, the errors not yet sent by poll
 //-----------------------------------------------------------------------------
 #ifndef __SYSTEM_H__
 #define __SYSTEM_H__
@@ -158,6 +159,13 @@ class System : public Device {
       //! Poll system level status and process return messages
       string poll(ControlCmdMemory *cmem = NULL);
 
+      //! Return the errors recorded since the last poll
+      /*!
+       * Errors are appended, so the ones an operation adds follow the
+       * length this had before it.
+      */
+      string pendingErrors();
+
       //! Return structure string
       /*! 
        * \param hidden Set true to include hidden variables & commands
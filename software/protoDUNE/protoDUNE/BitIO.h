@@ -0,0 +1,514 @@
+// -*-Mode: C;-*-
+
+#ifndef PDD_BITIO_H
+#define PDD_BITIO_H
+
+/* ---------------------------------------------------------------------- *//*!
+ *
+ *  @file     BitIO.h
+ *  @brief    Bit stream writer and reader for the MSB first, 64-bit word
+ *            streams of the compressed WIB packets
+ *  @verbatim
+ *                               Copyright 2018
+ *                                    by
+ *
+ *                       The Board of Trustees of the
+ *                    Leland Stanford Junior University.
+ *                           All rights reserved.
+ *
+ *  @endverbatim
+ *
+ *  @par Facility:
+ *  pdd
+ *
+ *  @author
+ *  <russell@slac.stanford.edu>
+ *
+ *  @par Date created:
+ *  <2018/07/31>
+ *
+ * @par Credits:
+ * SLAC
+ *
+\* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *\
+
+   HISTORY
+   -------
+
+   DATE       WHO WHAT
+   ---------- --- ---------------------------------------------------------
+   2018.07.31 jjr Created, replaces the bit stuffing of WibEncode.h and
+                  the staging window of wibDecode_channelFast
+
+\* ---------------------------------------------------------------------- */
+
+
+/* ---------------------------------------------------------------------- *\
+
+   The streams are the ones the firmware's BitStream64 writes and BFU
+   reads: bits are stuffed MSB first into native 64-bit words, so a
+   field never needs its bytes swapped, only its words shifted.
+
+   The writer keeps the word the stream is currently in, its valid bits
+   MSB justified. An insert of up to 64 bits ors the top of the field
+   into it, stores it, full or not, and keeps either it or, if it
+   filled, the rest of the field as the next word. There is no test of
+   whether the word filled, only a select, so there is no data
+   dependent branch, and the last store of a word is always its
+   complete value. A flush stores the word the last insert ended in.
+
+   The reader keeps only the bit position. A field of up to 64 bits is
+   formed from the two words the position lies in, so there is no
+   staging window to refill and no test of whether it needs it: the
+   only loop carried dependency is the position itself, the loads hang
+   off it and overlap. Words past the end of the stream read as 0, a
+   test that is only ever taken on a corrupt stream, so it is always
+   predicted.
+
+\* ---------------------------------------------------------------------- */
+
+
+#include <inttypes.h>
+#include <string.h>
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \struct _BitWriter
+  \brief   Writes bits MSB first into 64-bit words
+                                                                          *//*!
+  \typedef BitWriter
+  \brief   Typedef for struct _BitWriter
+                                                                          */
+/* ---------------------------------------------------------------------- */
+typedef struct _BitWriter
+{
+   uint64_t   *buf;  /*!< The output buffer                               */
+   uint32_t    n64;  /*!< Its capacity in 64-bit words                    */
+   uint32_t    idx;  /*!< The current bit index                           */
+   uint64_t    acc;  /*!< The current word, its idx & 0x3f valid bits
+                          MSB justified                                   */
+}
+BitWriter;
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \struct _BitReader
+  \brief   Reads bits MSB first from 64-bit words
+                                                                          *//*!
+  \typedef BitReader
+  \brief   Typedef for struct _BitReader
+                                                                          */
+/* ---------------------------------------------------------------------- */
+typedef struct _BitReader
+{
+   uint64_t const *buf;  /*!< The input buffer                            */
+   uint32_t        n64;  /*!< Its length in 64-bit words                  */
+   uint32_t        pos;  /*!< The current bit position                    */
+}
+BitReader;
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *\
+ *
+ * PROTOTYPES
+ *
+\* ---------------------------------------------------------------------- */
+static inline void     bitWriter_init    (BitWriter            *bw,
+                                          uint64_t            *buf,
+                                          uint32_t             n64,
+                                          uint32_t             idx);
+
+static inline void     bitWriter_insert  (BitWriter            *bw,
+                                          uint64_t            bits,
+                                          int                nbits);
+
+static inline void     bitWriter_insertN (BitWriter            *bw,
+                                          uint16_t const     *vals,
+                                          int                    n,
+                                          int                nbits);
+
+static inline void     bitWriter_follow  (BitWriter            *bw,
+                                          int                  bit,
+                                          uint32_t        npending);
+
+static inline void     bitWriter_copy    (BitWriter            *bw,
+                                          uint64_t const      *src,
+                                          uint32_t           nbits);
+
+static inline uint32_t bitWriter_flush   (BitWriter            *bw);
+
+static inline void     bitReader_init    (BitReader            *br,
+                                          uint64_t const      *buf,
+                                          uint32_t             n64,
+                                          uint32_t             pos);
+
+static inline uint64_t bitReader_peek    (BitReader const      *br,
+                                          int                nbits);
+
+static inline void     bitReader_skip    (BitReader            *br,
+                                          int                nbits);
+
+static inline uint64_t bitReader_read    (BitReader            *br,
+                                          int                nbits);
+
+static inline uint32_t bitReader_pos     (BitReader const      *br);
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief Initializes a writer to start at bit \a idx
+
+  \param[out]  bw  The writer
+  \param[in]  buf  The output buffer
+  \param[in]  n64  Its capacity in 64-bit words. Bits past this are
+                   counted but dropped.
+  \param[in]  idx  The starting bit index. If this is not on a word
+                   boundary, the leading bits of that word are
+                   written as 0.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline void bitWriter_init (BitWriter *bw,
+                                   uint64_t *buf,
+                                   uint32_t  n64,
+                                   uint32_t  idx)
+{
+   bw->buf = buf;
+   bw->n64 = n64;
+   bw->idx = idx;
+   bw->acc = 0;
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief Inserts \a nbits of \a bits into the bit stream
+
+  \param[in,out]  bw  The writer
+  \param[in]    bits  The right justified bits to insert, bits above
+                      \a nbits are ignored
+  \param[in]   nbits  The number of bits to insert, 0-64
+
+  \par
+   The shifts are split or masked where a shift by the full 64 bits
+   would otherwise be needed, an empty field or an empty word.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline void bitWriter_insert (BitWriter *bw,
+                                     uint64_t bits,
+                                     int     nbits)
+{
+   uint32_t idx  = bw->idx;
+   int      used = idx & 0x3f;
+   uint32_t iw   = idx >> 6;
+   uint64_t fld  = (bits << ((64 - nbits) & 0x3f)) & -(uint64_t)(nbits != 0);
+   uint64_t acc  = bw->acc | (fld >> used);
+   uint64_t rest = (fld << 1) << (63 - used);
+
+   if (iw < bw->n64) bw->buf[iw] = acc;
+
+   bw->acc = used + nbits >= 64 ? rest : acc;
+   bw->idx = idx + nbits;
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief Inserts \a n fields of the same width
+
+  \param[in,out]  bw  The writer
+  \param[in]    vals  The fields, right justified
+  \param[in]       n  The number of fields
+  \param[in]   nbits  The width of each field, 0-16
+
+  \par
+   Fields are gathered into a 64-bit word as long as they fit, so that
+   there is one insert per word rather than per field.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline void bitWriter_insertN (BitWriter        *bw,
+                                      uint16_t const *vals,
+                                      int               n,
+                                      int           nbits)
+{
+   if (nbits == 0) return;
+
+   int      per  = 64 / nbits;
+   uint64_t mask = (1ULL << nbits) - 1;
+
+   while (n > 0)
+   {
+      int      k    = n < per ? n : per;
+      uint64_t word = 0;
+      for (int i = 0; i < k; i++)
+      {
+         word = (word << nbits) | (vals[i] & mask);
+      }
+
+      bitWriter_insert (bw, word, k * nbits);
+      vals += k;
+      n    -= k;
+   }
+
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief Inserts \a bit followed by \a npending copies of its complement
+
+  \param[in,out]     bw  The writer
+  \param[in]        bit  The bit
+  \param[in]   npending  The number of pending bits
+
+  \par
+   The bit and up to 63 pending bits go in as one field, only runs
+   longer than that, which are rare, take more.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline void bitWriter_follow (BitWriter  *bw,
+                                     int        bit,
+                                     uint32_t npending)
+{
+   int      n    = npending > 63 ? 63 : npending;
+   uint64_t fill = bit ? 0 : ~0ULL;
+
+   bitWriter_insert (bw, ((uint64_t)bit << n) | (fill & ((1ULL << n) - 1)), n + 1);
+   npending -= n;
+
+   while (npending)
+   {
+      n = npending > 64 ? 64 : npending;
+      bitWriter_insert (bw, fill, n);
+      npending -= n;
+   }
+
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief Appends a bit string of \a nbits
+
+  \param[in,out]  bw  The writer
+  \param[in]     src  The bit string, MSB first in 64-bit words
+  \param[in]   nbits  The number of bits to append
+
+  \par
+   When the writer is on a word boundary, the whole words are just
+   copied.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline void bitWriter_copy (BitWriter       *bw,
+                                   uint64_t const *src,
+                                   uint32_t      nbits)
+{
+   uint32_t n64  = nbits >> 6;
+   int      nrem = nbits & 0x3f;
+
+   if ((bw->idx & 0x3f) == 0)
+   {
+      uint32_t iw = bw->idx >> 6;
+      uint32_t nw = iw >= bw->n64    ? 0
+                  : bw->n64 - iw < n64 ? bw->n64 - iw
+                  : n64;
+
+      memcpy (bw->buf + iw, src, nw * sizeof (*src));
+      bw->idx += n64 << 6;
+   }
+   else
+   {
+      for (uint32_t iw = 0; iw < n64; iw++)
+      {
+         bitWriter_insert (bw, src[iw], 64);
+      }
+   }
+
+   if (nrem) bitWriter_insert (bw, src[n64] >> (64 - nrem), nrem);
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Completes the bit stream
+  \return The bit index
+
+  \param[in,out]  bw  The writer
+
+  \par
+   An insert stores the word it started in, so only when the last one
+   crossed into a new word does that word remain to be stored.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline uint32_t bitWriter_flush (BitWriter *bw)
+{
+   uint32_t idx  = bw->idx;
+   int      used = idx & 0x3f;
+   uint32_t iw   = idx >> 6;
+
+   if (used && iw < bw->n64)
+   {
+      bw->buf[iw] = bw->acc;
+   }
+
+   return idx;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Loads word \a iw, 0 if past the end of the stream
+  \return The word
+
+  \param[in]  br  The reader
+  \param[in]  iw  The word index
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline uint64_t bitReader_load (BitReader const *br, uint32_t iw)
+{
+   return iw < br->n64 ? br->buf[iw] : 0;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief Initializes a reader to start at bit \a pos
+
+  \param[out]  br  The reader
+  \param[in]  buf  The bit stream
+  \param[in]  n64  The number of 64-bit words in the bit stream. Bits
+                   past this are read as 0
+  \param[in]  pos  The starting bit position
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline void bitReader_init (BitReader       *br,
+                                   uint64_t const *buf,
+                                   uint32_t        n64,
+                                   uint32_t        pos)
+{
+   br->buf = buf;
+   br->n64 = n64;
+   br->pos = pos;
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Returns the next \a nbits without consuming them
+  \return The bits, right justified
+
+  \param[in]    br  The reader
+  \param[in] nbits  The number of bits, 0-64
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline uint64_t bitReader_peek (BitReader const *br, int nbits)
+{
+   uint32_t pos = br->pos;
+   uint32_t iw  = pos >> 6;
+   int      ib  = pos & 0x3f;
+   uint64_t w0  = bitReader_load (br, iw);
+   uint64_t w1  = bitReader_load (br, iw + 1);
+   uint64_t top = (w0 << ib) | ((w1 >> 1) >> (63 - ib));
+
+   return (top >> ((64 - nbits) & 0x3f)) & -(uint64_t)(nbits != 0);
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief Consumes \a nbits
+
+  \param[in,out] br  The reader
+  \param[in]  nbits  The number of bits, 0-64
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline void bitReader_skip (BitReader *br, int nbits)
+{
+   br->pos += nbits;
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Reads \a nbits
+  \return The bits, right justified
+
+  \param[in,out] br  The reader
+  \param[in]  nbits  The number of bits, 0-64
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline uint64_t bitReader_read (BitReader *br, int nbits)
+{
+   uint64_t bits = bitReader_peek (br, nbits);
+   bitReader_skip (br, nbits);
+   return bits;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Returns the current bit position
+  \return The bit position
+
+  \param[in] br  The reader
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline uint32_t bitReader_pos (BitReader const *br)
+{
+   return br->pos;
+}
+/* ---------------------------------------------------------------------- */
+
+#endif
@@ -0,0 +1,1239 @@
+// -*-Mode: C;-*-
+
+#ifndef PDD_CAPTUREFILE_H
+#define PDD_CAPTUREFILE_H
+
+/* ---------------------------------------------------------------------- *//*!
+ *
+ *  @file     CaptureFile.h
+ *  @brief    Indexed, memory-mappable file format for captured fragments
+ *  @verbatim
+ *                               Copyright 2018
+ *                                    by
+ *
+ *                       The Board of Trustees of the
+ *                    Leland Stanford Junior University.
+ *                           All rights reserved.
+ *
+ *  @endverbatim
+ *
+ *  @par Facility:
+ *  pdd
+ *
+ *  @author
+ *  <russell@slac.stanford.edu>
+ *
+ *  @par Date created:
+ *  <2018/07/23>
+ *
+ * @par Credits:
+ * SLAC
+ *
+\* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *\
+
+   HISTORY
+   -------
+
+   DATE       WHO WHAT
+   ---------- --- ---------------------------------------------------------
+   2018.08.22 jjr Added captureWriter_openAsync, writing through an
+                  AsyncFile. When that rotates, each file is finished
+                  with its index and footer and the next begins with a
+                  new header, so every file stands on its own
+   2018.08.20 jjr Added captureWriter_writevId so that a built event, the
+                  fragments from several sources, can be written as one
+                  record without first copying it together
+   2018.07.23 jjr Created
+
+\* ---------------------------------------------------------------------- */
+
+
+/* ---------------------------------------------------------------------- *\
+
+   FILE LAYOUT
+   -----------
+   All quantities are little-endian and every record begins on a 64-bit
+   boundary, so that, once mapped, fragments can be accessed in place.
+
+     +--------------------------------+
+     | CaptureFileHeader              |  Fixed 64 bytes
+     +--------------------------------+
+     | CaptureRecord (Fragment)       |  Repeated, interleaved with
+     |   fragment bytes (8 aligned)   |  the checkpoints
+     +--------------------------------+
+     | CaptureRecord (Checkpoint)     |  Every 'interval' fragments
+     |   CaptureIndexBody             |  Entries since the previous
+     |   CaptureIndexEntry [n]        |  checkpoint
+     +--------------------------------+
+     |   ....                         |
+     +--------------------------------+
+     | CaptureRecord (Index)          |  Written when closed, all
+     |   CaptureIndexBody             |  the entries in the file
+     |   CaptureIndexEntry [n]        |
+     +--------------------------------+
+     | CaptureFileFooter              |  Fixed 32 bytes
+     +--------------------------------+
+
+   The body of a fragment record is either a single fragment or a built
+   event, the fragments of several sources with the same trigger, back
+   to back. Each begins with its Header0, whose size delimits it. The
+   index entry's contributor mask tells which sources are present.
+
+   When written through a rotating AsyncFile, each file in the series
+   is a complete capture file in its own right, with its own header,
+   index and footer. The index offsets are relative to that file.
+
+   A reader first looks for the footer. If it is missing, (e.g. the
+   writer died), the checkpoints are collected by hopping from record
+   to record and any fragments after the last checkpoint are indexed
+   directly from their pdd::Header0 and Identifier words.
+
+\* ---------------------------------------------------------------------- */
+
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+#include "AsyncFile.h"
+
+
+#define CAPTURE_K_MAGIC     0x3154504143445050ULL /*!< "PPDCAPT1"          */
+#define CAPTURE_K_FOOTER    0x3158444943445050ULL /*!< "PPDCIDX1"          */
+#define CAPTURE_K_VERSION   1
+#define CAPTURE_K_INTERVAL  1024  /*!< Default checkpoint interval        */
+#define CAPTURE_K_PATTERN   0x8b309e  /*!< pdd::fragment::Pattern         */
+#define CAPTURE_K_MAXIOV    64    /*!< Maximum pieces of a gathered write */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \enum  CaptureRecordType
+  \brief Enumerates the types of records in a capture file
+                                                                          */
+/* ---------------------------------------------------------------------- */
+enum CaptureRecordType
+{
+   CAPTURE_K_FRAGMENT   = 1,  /*!< A captured fragment                     */
+   CAPTURE_K_CHECKPOINT = 2,  /*!< Partial index of the recent fragments   */
+   CAPTURE_K_INDEX      = 3   /*!< Full index, written when closed         */
+};
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \struct _CaptureFileHeader
+  \brief   The header at the beginning of every capture file
+                                                                          */
+/* ---------------------------------------------------------------------- */
+struct _CaptureFileHeader
+{
+   uint64_t    magic;  /*!< Always CAPTURE_K_MAGIC                        */
+   uint32_t  version;  /*!< Version of the capture format                 */
+   uint32_t    nhdr;  /*!< Size, in bytes, of this header                */
+   uint32_t interval;  /*!< Number of fragments between checkpoints       */
+   uint32_t   source;  /*!< Identifies the writer, user defined           */
+   uint64_t  created;  /*!< Creation time, seconds since the epoch        */
+   uint64_t    rsvd[4];/*!< Reserved for future use                       */
+};
+/* ---------------------------------------------------------------------- */
+typedef struct _CaptureFileHeader CaptureFileHeader;
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \struct _CaptureRecord
+  \brief   Prefixes every record following the file header
+                                                                          */
+/* ---------------------------------------------------------------------- */
+struct _CaptureRecord
+{
+   uint32_t     type;  /*!< The record type, a CaptureRecordType          */
+   uint32_t     rsvd;  /*!< Reserved, must be 0                           */
+   uint64_t   nbytes;  /*!< Size of the body, in bytes, excluding padding */
+};
+/* ---------------------------------------------------------------------- */
+typedef struct _CaptureRecord CaptureRecord;
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \struct _CaptureIndexEntry
+  \brief   Locates and identifies one fragment
+                                                                          */
+/* ---------------------------------------------------------------------- */
+struct _CaptureIndexEntry
+{
+   uint64_t      offset;  /*!< File offset of the fragment's first byte   */
+   uint32_t      nbytes;  /*!< Size of the fragment in bytes              */
+   uint32_t    sequence;  /*!< Trigger sequence number                    */
+   uint64_t   timestamp;  /*!< Trigger timestamp                          */
+   uint64_t contributors; /*!< Bit mask of the contributing sources       */
+};
+/* ---------------------------------------------------------------------- */
+typedef struct _CaptureIndexEntry CaptureIndexEntry;
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \struct _CaptureIndexBody
+  \brief   The fixed portion of a checkpoint or index record
+                                                                          */
+/* ---------------------------------------------------------------------- */
+struct _CaptureIndexBody
+{
+   uint64_t     previous; /*!< File offset of the previous checkpoint
+                               record, 0 if none                          */
+   uint32_t        first; /*!< Fragment number of the first entry         */
+   uint32_t     nentries; /*!< Number of entries that follow              */
+};
+/* ---------------------------------------------------------------------- */
+typedef struct _CaptureIndexBody CaptureIndexBody;
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \struct _CaptureFileFooter
+  \brief   The last 32 bytes of a cleanly closed capture file
+                                                                          */
+/* ---------------------------------------------------------------------- */
+struct _CaptureFileFooter
+{
+   uint64_t        index;  /*!< File offset of the full index record      */
+   uint64_t   checkpoint;  /*!< File offset of the last checkpoint        */
+   uint64_t    nentries;   /*!< Total number of fragments                 */
+   uint64_t       magic;   /*!< Always CAPTURE_K_FOOTER                   */
+};
+/* ---------------------------------------------------------------------- */
+typedef struct _CaptureFileFooter CaptureFileFooter;
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \struct _CaptureWriter
+  \brief   The context used to write a capture file
+                                                                          */
+/* ---------------------------------------------------------------------- */
+struct _CaptureWriter
+{
+   int                        fd;  /*!< The output file descriptor        */
+   AsyncFile              *async;  /*!< If not NULL, write through this   */
+   uint32_t               source;  /*!< The writer's identifier           */
+   uint32_t             interval;  /*!< Fragments between checkpoints     */
+   uint32_t           checkpoint;  /*!< Index of first unckeckpointed entry*/
+   uint64_t               offset;  /*!< Current file offset               */
+   uint64_t                 last;  /*!< Offset of the last checkpoint     */
+   uint32_t             nentries;  /*!< Number of entries in the index    */
+   uint32_t             mentries;  /*!< Allocated size of the index       */
+   CaptureIndexEntry    *entries;  /*!< The accumulated index             */
+};
+/* ---------------------------------------------------------------------- */
+typedef struct _CaptureWriter CaptureWriter;
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \struct _CaptureReader
+  \brief   The context used to read a memory mapped capture file
+                                                                          */
+/* ---------------------------------------------------------------------- */
+struct _CaptureReader
+{
+   uint8_t const          *base;  /*!< Base address of the mapped file    */
+   size_t                nbytes;  /*!< Size of the mapped file            */
+   CaptureFileHeader const *hdr;  /*!< The file header                    */
+   CaptureIndexEntry const *entries; /*!< The index                       */
+   uint32_t            nentries;  /*!< Number of index entries            */
+   int                recovered;  /*!< If != 0, the index was rebuilt     */
+   CaptureIndexEntry     *owned;  /*!< The rebuilt index, if allocated    */
+};
+/* ---------------------------------------------------------------------- */
+typedef struct _CaptureReader CaptureReader;
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- */
+/* PROTOTYPES                                                             */
+/* ---------------------------------------------------------------------- */
+static inline int    capture_identify      (uint8_t const      *fragment,
+                                            uint32_t              nbytes,
+                                            uint32_t           *sequence,
+                                            uint64_t          *timestamp);
+
+static inline int    captureWriter_open    (CaptureWriter        *writer,
+                                            char const         *filename,
+                                            uint32_t            interval,
+                                            uint32_t              source);
+
+static inline int    captureWriter_openAsync
+                                           (CaptureWriter        *writer,
+                                            AsyncFile             *async,
+                                            uint32_t            interval,
+                                            uint32_t              source);
+
+static inline int    captureWriter_write   (CaptureWriter        *writer,
+                                            void const         *fragment,
+                                            uint32_t              nbytes,
+                                            uint64_t        contributors);
+
+static inline int    captureWriter_writeId (CaptureWriter        *writer,
+                                            void const         *fragment,
+                                            uint32_t              nbytes,
+                                            uint32_t            sequence,
+                                            uint64_t           timestamp,
+                                            uint64_t        contributors);
+
+static inline int    captureWriter_writevId(CaptureWriter        *writer,
+                                            struct iovec const     *iov,
+                                            int                    niov,
+                                            uint32_t            sequence,
+                                            uint64_t           timestamp,
+                                            uint64_t        contributors);
+
+static inline int    captureWriter_finish  (CaptureWriter        *writer);
+
+static inline int    captureWriter_close   (CaptureWriter        *writer);
+
+
+static inline int    captureReader_open    (CaptureReader        *reader,
+                                            char const         *filename);
+
+static inline void   captureReader_close   (CaptureReader        *reader);
+
+static inline uint8_t const *
+                     captureReader_fragment(CaptureReader const  *reader,
+                                            uint32_t               index,
+                                            uint32_t             *nbytes);
+
+static inline int    captureReader_findSequence
+                                           (CaptureReader const  *reader,
+                                            uint32_t            sequence);
+
+static inline int    captureReader_findTimestamp
+                                           (CaptureReader const  *reader,
+                                            uint64_t           timestamp);
+
+static inline void   captureReader_advise  (CaptureReader const  *reader,
+                                            uint32_t               first,
+                                            uint32_t                 cnt);
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Extracts the trigger sequence number and timestamp from a
+          data fragment
+  \retval == 0, successfully identified
+  \retval != 0, not a recognizable data fragment
+
+  \param[in]   fragment  The fragment, beginning with its Header0
+  \param[in]     nbytes  The number of bytes in the fragment
+  \param[out]  sequence  The trigger sequence number
+  \param[out] timestamp  The trigger timestamp
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline int capture_identify (uint8_t const  *fragment,
+                                    uint32_t          nbytes,
+                                    uint32_t       *sequence,
+                                    uint64_t      *timestamp)
+{
+   uint64_t const *d64 = (uint64_t const *)fragment;
+
+   if (nbytes < 3 * sizeof (uint64_t) || (d64[0] >> 40) != CAPTURE_K_PATTERN)
+   {
+      *sequence  = 0;
+      *timestamp = 0;
+      return -1;
+   }
+
+   // -----------------------------------------------------------
+   // Header0 is followed by the Identifier, whose upper 32 bits
+   // are the sequence number. The next word is the timestamp.
+   // -----------------------------------------------------------
+   *sequence  = d64[1] >> 32;
+   *timestamp = d64[2];
+
+   return 0;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Writes a buffer, retrying on short writes
+  \retval == 0, success
+  \retval != 0, the errno of the failure
+
+  \param[in]     fd  The file descriptor
+  \param[in]    iov  The buffers to write
+  \param[in]   niov  The number of buffers
+  \param[in] nbytes  The total number of bytes
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline int capture_writev (int                 fd,
+                                  struct iovec      *iov,
+                                  int               niov,
+                                  size_t          nbytes)
+{
+   while (nbytes)
+   {
+      ssize_t nwrote = writev (fd, iov, niov);
+      if (nwrote < 0)
+      {
+         if (errno == EINTR) continue;
+         return errno;
+      }
+
+      nbytes -= nwrote;
+
+      // Advance past the fully written buffers
+      while (niov && (size_t)nwrote >= iov->iov_len)
+      {
+         nwrote -= iov->iov_len;
+         iov    += 1;
+         niov   -= 1;
+      }
+
+      if (niov)
+      {
+         iov->iov_base  = (uint8_t *)iov->iov_base + nwrote;
+         iov->iov_len  -= nwrote;
+      }
+   }
+
+   return 0;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Writes a buffer to the capture file, either directly or through
+          the writer's AsyncFile
+  \retval == 0, success
+  \retval != 0, the errno of the failure
+
+  \param[in] writer  The capture writer
+  \param[in]    iov  The buffers to write
+  \param[in]   niov  The number of buffers
+  \param[in] nbytes  The total number of bytes
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline int captureWriter_put (CaptureWriter *writer,
+                                     struct iovec     *iov,
+                                     int              niov,
+                                     size_t         nbytes)
+{
+   if (writer->async) return asyncFile_writev (writer->async, iov, niov);
+   else               return capture_writev   (writer->fd,    iov, niov, nbytes);
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Writes an index record, either a checkpoint or the full index
+  \retval == 0, success
+  \retval != 0, the errno of the failure
+
+  \param[in] writer  The capture writer
+  \param[in]   type  The record type, CAPTURE_K_CHECKPOINT or _INDEX
+  \param[in]  first  The first entry to write
+  \param[in]    cnt  The number of entries to write
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline int captureWriter_index (CaptureWriter *writer,
+                                       uint32_t         type,
+                                       uint32_t        first,
+                                       uint32_t          cnt)
+{
+   CaptureRecord    rec;
+   CaptureIndexBody body;
+
+   body.previous = writer->last;
+   body.first    = first;
+   body.nentries = cnt;
+
+   rec.type      = type;
+   rec.rsvd      = 0;
+   rec.nbytes    = sizeof (body) + cnt * sizeof (CaptureIndexEntry);
+
+
+   struct iovec iov[3];
+   iov[0].iov_base = &rec;
+   iov[0].iov_len  = sizeof (rec);
+   iov[1].iov_base = &body;
+   iov[1].iov_len  = sizeof (body);
+   iov[2].iov_base = writer->entries + first;
+   iov[2].iov_len  = cnt * sizeof (CaptureIndexEntry);
+
+   size_t nbytes = sizeof (rec) + rec.nbytes;
+   int    status = captureWriter_put (writer, iov, 3, nbytes);
+   if (status) return status;
+
+   if (type == CAPTURE_K_CHECKPOINT)
+   {
+      writer->last       = writer->offset;
+      writer->checkpoint = first + cnt;
+   }
+
+   writer->offset += nbytes;
+   return 0;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Writes the file header and resets the index, the start of each
+          capture file
+  \retval == 0, success
+  \retval != 0, the errno of the failure
+
+  \param[in] writer  The capture writer
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline int captureWriter_header (CaptureWriter *writer)
+{
+   CaptureFileHeader hdr;
+   memset (&hdr, 0, sizeof (hdr));
+   hdr.magic    = CAPTURE_K_MAGIC;
+   hdr.version  = CAPTURE_K_VERSION;
+   hdr.nhdr     = sizeof (hdr);
+   hdr.interval = writer->interval;
+   hdr.source   = writer->source;
+   hdr.created  = time (NULL);
+
+   struct iovec iov;
+   iov.iov_base = &hdr;
+   iov.iov_len  = sizeof (hdr);
+
+   int status = captureWriter_put (writer, &iov, 1, sizeof (hdr));
+   if (status) return status;
+
+   writer->offset     = sizeof (hdr);
+   writer->last       = 0;
+   writer->checkpoint = 0;
+   writer->nentries   = 0;
+
+   return 0;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Creates a capture file and writes its header
+  \retval == 0, success
+  \retval != 0, the errno of the failure
+
+  \param[out]  writer  The capture writer to initialize
+  \param[in] filename  The name of the file to create
+  \param[in] interval  The number of fragments between checkpoints.
+                       If 0, CAPTURE_K_INTERVAL is used
+  \param[in]   source  A user defined identifier of the writer
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline int captureWriter_open (CaptureWriter    *writer,
+                                      char const     *filename,
+                                      uint32_t        interval,
+                                      uint32_t          source)
+{
+   memset (writer, 0, sizeof (*writer));
+   writer->fd       = -1;
+   writer->interval = interval ? interval : CAPTURE_K_INTERVAL;
+   writer->source   = source;
+
+   int fd = creat (filename, S_IRUSR | S_IWUSR
+                           | S_IRGRP | S_IWGRP
+                           | S_IROTH);
+   if (fd < 0) return errno;
+
+   writer->fd = fd;
+   int status = captureWriter_header (writer);
+   if (status)
+   {
+      close (fd);
+      writer->fd = -1;
+      return status;
+   }
+
+   writer->mentries = writer->interval;
+   writer->entries  = (CaptureIndexEntry *)
+                      malloc (writer->mentries * sizeof (*writer->entries));
+
+   return 0;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Begins a capture file written through an already open
+          AsyncFile, rather than written directly
+  \retval == 0, success
+  \retval != 0, the errno of the failure
+
+  \param[out]  writer  The capture writer to initialize
+  \param[in]    async  The asynchronous writer, which remains owned by
+                       the caller and must be closed after the capture
+                       writer
+  \param[in] interval  The number of fragments between checkpoints.
+                       If 0, CAPTURE_K_INTERVAL is used
+  \param[in]   source  A user defined identifier of the writer
+
+  \par
+   If the AsyncFile rotates, the rotation is done here, between
+   fragments, so that each file is finished with its index and footer.
+   The writer's fd is that of the current file and only indicates that
+   the writer is open; it must not be written to.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline int captureWriter_openAsync (CaptureWriter    *writer,
+                                           AsyncFile         *async,
+                                           uint32_t        interval,
+                                           uint32_t          source)
+{
+   memset (writer, 0, sizeof (*writer));
+   writer->fd       = -1;
+   writer->async    = async;
+   writer->interval = interval ? interval : CAPTURE_K_INTERVAL;
+   writer->source   = source;
+
+   int status = captureWriter_header (writer);
+   if (status) return status;
+
+   writer->fd       = asyncFile_fd (async);
+   writer->mentries = writer->interval;
+   writer->entries  = (CaptureIndexEntry *)
+                      malloc (writer->mentries * sizeof (*writer->entries));
+
+   return 0;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Appends a fragment, extracting its sequence number and
+          timestamp from its Identifier
+  \retval == 0, success
+  \retval != 0, the errno of the failure
+
+  \param[in]       writer  The capture writer
+  \param[in]     fragment  The fragment to write
+  \param[in]       nbytes  The number of bytes in the fragment
+  \param[in] contributors  Bit mask of the contributing sources
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline int captureWriter_write (CaptureWriter       *writer,
+                                       void const        *fragment,
+                                       uint32_t             nbytes,
+                                       uint64_t       contributors)
+{
+   uint32_t  sequence;
+   uint64_t timestamp;
+
+   capture_identify ((uint8_t const *)fragment, nbytes, &sequence, &timestamp);
+
+   return captureWriter_writeId (writer,
+                                 fragment,
+                                 nbytes,
+                                 sequence,
+                                 timestamp,
+                                 contributors);
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Appends a fragment with an explicit identification
+  \retval == 0, success
+  \retval != 0, the errno of the failure
+
+  \param[in]       writer  The capture writer
+  \param[in]     fragment  The fragment to write
+  \param[in]       nbytes  The number of bytes in the fragment
+  \param[in]     sequence  The trigger sequence number
+  \param[in]    timestamp  The trigger timestamp
+  \param[in] contributors  Bit mask of the contributing sources
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline int captureWriter_writeId (CaptureWriter     *writer,
+                                         void const      *fragment,
+                                         uint32_t           nbytes,
+                                         uint32_t         sequence,
+                                         uint64_t        timestamp,
+                                         uint64_t     contributors)
+{
+   struct iovec iov;
+   iov.iov_base = (void *)fragment;
+   iov.iov_len  = nbytes;
+
+   return captureWriter_writevId (writer,
+                                  &iov,
+                                  1,
+                                  sequence,
+                                  timestamp,
+                                  contributors);
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Appends one record gathered from several pieces, typically the
+          fragments of a built event
+  \retval == 0, success
+  \retval != 0, the errno of the failure
+
+  \param[in]       writer  The capture writer
+  \param[in]          iov  The pieces, written back to back
+  \param[in]         niov  The number of pieces, at most CAPTURE_K_MAXIOV
+  \param[in]     sequence  The trigger sequence number
+  \param[in]    timestamp  The trigger timestamp
+  \param[in] contributors  Bit mask of the contributing sources
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline int captureWriter_writevId (CaptureWriter     *writer,
+                                          struct iovec const   *iov,
+                                          int                  niov,
+                                          uint32_t         sequence,
+                                          uint64_t        timestamp,
+                                          uint64_t     contributors)
+{
+   static uint64_t const Pad = 0;
+
+   if (niov > CAPTURE_K_MAXIOV) return EINVAL;
+
+
+   // -------------------------------------------
+   // Grow the index by doubling, if necessary
+   // -------------------------------------------
+   if (writer->nentries == writer->mentries)
+   {
+      uint32_t       mentries = 2 * writer->mentries;
+      CaptureIndexEntry  *tmp = (CaptureIndexEntry *)
+                                realloc (writer->entries,
+                                         mentries * sizeof (*tmp));
+      if (tmp == NULL) return ENOMEM;
+
+      writer->entries  = tmp;
+      writer->mentries = mentries;
+   }
+
+
+   // ------------------------------------------------------
+   // The record header, the pieces and the padding go out
+   // in a single writev
+   // ------------------------------------------------------
+   uint64_t nbytes = 0;
+   for (int idx = 0; idx < niov; idx++) nbytes += iov[idx].iov_len;
+
+   CaptureRecord rec;
+   rec.type   = CAPTURE_K_FRAGMENT;
+   rec.rsvd   = 0;
+   rec.nbytes = nbytes;
+
+   struct iovec viov[CAPTURE_K_MAXIOV + 2];
+   int          npad = (-nbytes) & 0x7;
+   int          nvec = 0;
+   viov[nvec].iov_base   = &rec;
+   viov[nvec++].iov_len  = sizeof (rec);
+   for (int idx = 0; idx < niov; idx++) viov[nvec++] = iov[idx];
+   if (npad)
+   {
+      viov[nvec].iov_base  = (void *)&Pad;
+      viov[nvec++].iov_len = npad;
+   }
+
+   size_t total  = sizeof (rec) + nbytes + npad;
+   int    status;
+
+
+   // -----------------------------------------------------------
+   // Roll over to the next file, if the AsyncFile's size or age
+   // limit is reached, finishing this one off first
+   // -----------------------------------------------------------
+   if (writer->async && asyncFile_due (writer->async, total))
+   {
+      if ((status = captureWriter_finish (writer))         != 0) return status;
+      if ((status = asyncFile_rotate     (writer->async))  != 0) return status;
+      if ((status = captureWriter_header (writer))         != 0) return status;
+      writer->fd = asyncFile_fd (writer->async);
+   }
+
+   status = captureWriter_put (writer, viov, nvec, total);
+   if (status) return status;
+
+
+   CaptureIndexEntry *entry = writer->entries + writer->nentries++;
+   entry->offset       = writer->offset + sizeof (rec);
+   entry->nbytes       = nbytes;
+   entry->sequence     = sequence;
+   entry->timestamp    = timestamp;
+   entry->contributors = contributors;
+
+   writer->offset += total;
+
+
+   // ---------------------------------------------
+   // Checkpoint the index of the recent fragments
+   // ---------------------------------------------
+   uint32_t pending = writer->nentries - writer->checkpoint;
+   if (pending >= writer->interval)
+   {
+      status = captureWriter_index (writer,
+                                    CAPTURE_K_CHECKPOINT,
+                                    writer->checkpoint,
+                                    pending);
+   }
+
+   return status;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Writes the full index and footer, finishing the current file
+  \retval == 0, success
+  \retval != 0, the errno of the failure
+
+  \param[in] writer  The capture writer
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline int captureWriter_finish (CaptureWriter *writer)
+{
+   uint64_t index  = writer->offset;
+   int      status = captureWriter_index (writer,
+                                          CAPTURE_K_INDEX,
+                                          0,
+                                          writer->nentries);
+   if (status) return status;
+
+   CaptureFileFooter footer;
+   footer.index      = index;
+   footer.checkpoint = writer->last;
+   footer.nentries   = writer->nentries;
+   footer.magic      = CAPTURE_K_FOOTER;
+
+   struct iovec iov;
+   iov.iov_base = &footer;
+   iov.iov_len  = sizeof (footer);
+   return captureWriter_put (writer, &iov, 1, sizeof (footer));
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Writes the full index and footer, then closes the file
+  \retval == 0, success
+  \retval != 0, the errno of the failure
+
+  \param[in] writer  The capture writer
+
+  \par
+   A file written through an AsyncFile is left to its owner to close.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline int captureWriter_close (CaptureWriter *writer)
+{
+   if (writer->fd < 0) return 0;
+
+   int status = captureWriter_finish (writer);
+
+   if (writer->async == NULL) close (writer->fd);
+   free  (writer->entries);
+
+   writer->fd       = -1;
+   writer->entries  = NULL;
+   writer->nentries = 0;
+
+   return status;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Rebuilds the index of a file that was not cleanly closed
+  \retval == 0, success
+  \retval != 0, the errno of the failure
+
+  \param[in] reader  The capture reader
+
+  \par
+   The file is walked record by record. Only the record headers are
+   touched, so this is a series of hops rather than a full scan. The
+   checkpoints, if any, are used as is, the fragments that follow the
+   last checkpoint are identified directly.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline int captureReader_recover (CaptureReader *reader)
+{
+   uint32_t        mentries = 1024;
+   uint32_t        nentries = 0;
+   CaptureIndexEntry *owned = (CaptureIndexEntry *)
+                              malloc (mentries * sizeof (*owned));
+   if (owned == NULL) return ENOMEM;
+
+   uint64_t offset = reader->hdr->nhdr;
+   while (offset + sizeof (CaptureRecord) <= reader->nbytes)
+   {
+      CaptureRecord const *rec = (CaptureRecord const *)(reader->base + offset);
+      uint64_t           nbody = (rec->nbytes + 7) & ~7ULL;
+      uint64_t            body = offset + sizeof (*rec);
+
+      // Stop at a truncated record
+      if (body + nbody > reader->nbytes) break;
+
+      if (rec->type == CAPTURE_K_FRAGMENT)
+      {
+         if (nentries == mentries)
+         {
+            mentries *= 2;
+            CaptureIndexEntry *tmp = (CaptureIndexEntry *)
+                                     realloc (owned, mentries * sizeof (*tmp));
+            if (tmp == NULL) { free (owned); return ENOMEM; }
+            owned = tmp;
+         }
+
+         CaptureIndexEntry *entry = owned + nentries++;
+         entry->offset       = body;
+         entry->nbytes       = rec->nbytes;
+         entry->contributors = 0;
+         capture_identify (reader->base + body,
+                           rec->nbytes,
+                           &entry->sequence,
+                           &entry->timestamp);
+      }
+      else if (rec->type == CAPTURE_K_CHECKPOINT)
+      {
+         // ---------------------------------------------------
+         // Replace the fragments just identified with the
+         // checkpointed entries, these carry the contributors
+         // ---------------------------------------------------
+         CaptureIndexBody  const *ib = (CaptureIndexBody const *)
+                                       (reader->base + body);
+         CaptureIndexEntry const *ie = (CaptureIndexEntry const *)(ib + 1);
+         if (ib->first + ib->nentries == nentries)
+         {
+            memcpy (owned + ib->first, ie, ib->nentries * sizeof (*ie));
+         }
+      }
+      else if (rec->type != CAPTURE_K_INDEX)
+      {
+         break;
+      }
+
+      offset = body + nbody;
+   }
+
+   reader->owned     = owned;
+   reader->entries   = owned;
+   reader->nentries  = nentries;
+   reader->recovered = 1;
+
+   return 0;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Maps a capture file and locates its index
+  \retval == 0, success
+  \retval != 0, the errno of the failure, EINVAL if not a capture file
+
+  \param[out]   reader  The capture reader to initialize
+  \param[in]  filename  The name of the file to open
+
+  \par
+   The file is mapped read-only and shared, so any number of readers,
+   in any number of processes, can access it concurrently.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline int captureReader_open (CaptureReader   *reader,
+                                      char const    *filename)
+{
+   memset (reader, 0, sizeof (*reader));
+
+   int fd = open (filename, O_RDONLY);
+   if (fd < 0) return errno;
+
+   struct stat st;
+   if (fstat (fd, &st) < 0)
+   {
+      int status = errno;
+      close (fd);
+      return status;
+   }
+
+   if ((size_t)st.st_size < sizeof (CaptureFileHeader))
+   {
+      close (fd);
+      return EINVAL;
+   }
+
+   void *base = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+   close (fd);
+   if (base == MAP_FAILED) return errno;
+
+
+   reader->base   = (uint8_t const *)base;
+   reader->nbytes = st.st_size;
+   reader->hdr    = (CaptureFileHeader const *)base;
+
+   if (reader->hdr->magic != CAPTURE_K_MAGIC)
+   {
+      captureReader_close (reader);
+      return EINVAL;
+   }
+
+
+   // --------------------------------------------
+   // Use the trailing index if cleanly closed
+   // --------------------------------------------
+   CaptureFileFooter const *footer = (CaptureFileFooter const *)
+                        (reader->base + reader->nbytes - sizeof (*footer));
+
+   if (footer->magic == CAPTURE_K_FOOTER
+   &&  footer->index + sizeof (CaptureRecord)
+                     + sizeof (CaptureIndexBody) <= reader->nbytes)
+   {
+      CaptureRecord    const *rec = (CaptureRecord const *)
+                                    (reader->base + footer->index);
+      CaptureIndexBody const *ib  = (CaptureIndexBody const *)(rec + 1);
+
+      if (rec->type == CAPTURE_K_INDEX && ib->nentries == footer->nentries)
+      {
+         reader->entries  = (CaptureIndexEntry const *)(ib + 1);
+         reader->nentries = ib->nentries;
+         return 0;
+      }
+   }
+
+   int status = captureReader_recover (reader);
+   if (status) captureReader_close (reader);
+
+   return status;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief Unmaps the file and releases any allocated resources
+
+  \param[in] reader  The capture reader
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline void captureReader_close (CaptureReader *reader)
+{
+   if (reader->base)  munmap ((void *)reader->base, reader->nbytes);
+   if (reader->owned) free   (reader->owned);
+
+   memset (reader, 0, sizeof (*reader));
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Returns a pointer to a fragment within the mapped file
+  \return Pointer to the fragment, NULL if \a index is out of range
+
+  \param[in]  reader  The capture reader
+  \param[in]   index  The fragment number
+  \param[out] nbytes  If non-NULL, returned as the fragment's size
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline uint8_t const *captureReader_fragment (CaptureReader const *reader,
+                                                     uint32_t              index,
+                                                     uint32_t            *nbytes)
+{
+   if (index >= reader->nentries) return NULL;
+
+   CaptureIndexEntry const *entry = reader->entries + index;
+   if (nbytes) *nbytes = entry->nbytes;
+
+   return reader->base + entry->offset;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Locates the fragment with the specified trigger sequence number
+  \retval >= 0, the fragment number
+  \retval  < 0, no such fragment
+
+  \param[in]   reader  The capture reader
+  \param[in] sequence  The trigger sequence number to locate
+
+  \par
+   Sequence numbers are nominally increasing, so a binary search is
+   tried first. If this fails, (e.g. the sequence wrapped or a run was
+   restarted in the same file), a linear search is done.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline int captureReader_findSequence (CaptureReader const *reader,
+                                              uint32_t           sequence)
+{
+   CaptureIndexEntry const *entries = reader->entries;
+   uint32_t                      lo = 0;
+   uint32_t                      hi = reader->nentries;
+
+   while (lo < hi)
+   {
+      uint32_t mid = lo + (hi - lo) / 2;
+      if (entries[mid].sequence < sequence) lo = mid + 1;
+      else                                  hi = mid;
+   }
+
+   if (lo < reader->nentries && entries[lo].sequence == sequence) return lo;
+
+   for (uint32_t idx = 0; idx < reader->nentries; idx++)
+   {
+      if (entries[idx].sequence == sequence) return idx;
+   }
+
+   return -1;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Locates the first fragment whose trigger timestamp is at or
+          after the specified timestamp
+  \retval >= 0, the fragment number
+  \retval  < 0, all fragments are earlier
+
+  \param[in]    reader  The capture reader
+  \param[in] timestamp  The timestamp to locate
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline int captureReader_findTimestamp (CaptureReader const *reader,
+                                               uint64_t          timestamp)
+{
+   CaptureIndexEntry const *entries = reader->entries;
+   uint32_t                      lo = 0;
+   uint32_t                      hi = reader->nentries;
+
+   while (lo < hi)
+   {
+      uint32_t mid = lo + (hi - lo) / 2;
+      if (entries[mid].timestamp < timestamp) lo = mid + 1;
+      else                                    hi = mid;
+   }
+
+   return lo < reader->nentries ? (int)lo : -1;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief Advises the kernel that a range of fragments will be read
+         sequentially, so they can be read ahead
+
+  \param[in] reader  The capture reader
+  \param[in]  first  The first fragment of the range
+  \param[in]    cnt  The number of fragments in the range
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline void captureReader_advise (CaptureReader const *reader,
+                                         uint32_t              first,
+                                         uint32_t                cnt)
+{
+   if (first >= reader->nentries || cnt == 0) return;
+   if (first + cnt > reader->nentries) cnt = reader->nentries - first;
+
+   CaptureIndexEntry const *beg = reader->entries + first;
+   CaptureIndexEntry const *end = beg + cnt - 1;
+
+   long     pgsize = sysconf (_SC_PAGESIZE);
+   uint64_t    off = beg->offset & ~(uint64_t)(pgsize - 1);
+   uint64_t    len = end->offset + end->nbytes - off;
+
+   madvise ((void *)(reader->base + off), len, MADV_SEQUENTIAL);
+   madvise ((void *)(reader->base + off), len, MADV_WILLNEED);
+
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+#endif
@@ -15,6 +15,25 @@
 //
 //       DATE WHO WHAT
 // ---------- --- -------------------------------------------------------
+// 2018.08.17 jjr Compressed packets larger than NBytesCompressedMax are no
+//                longer dropped, the synthesized firmware does not yet
+//                send raw channels, so this is not a bound
+// 2018.08.17 jjr The header frame dump steps by WibFrameLayout::N64PerFrame
+// 2018.08.17 jjr Only the transposed packets have their event window
+//                indices trimmed, the WIB frame and compressed packets
+//                again report -1 when the window extends beyond the data
+// 2018.08.16 jjr Compressed packets larger than the hard bound on their
+//                size, ReadoutGeometry::NBytesCompressedMax, are counted
+//                as receive errors and dropped. DaqBuffer::open warns if
+//                the data DMA buffers are too small to hold one.
+// 2018.08.15 jjr The packet length and WIB frame layout now come from
+//                ReadoutGeometry, PacketGeometry.h, so shorter packets
+//                are a compile time choice, -DPACKET_B_NSAMPLES=n
+// 2018.08.14 jjr The event window's beginning and ending indices are now
+//                trimmed to the data that is present rather than being
+//                set to -1 when the window extends beyond it.  This
+//                lets consumers of the transposed, channel-major packets
+//                slice the waveforms directly with the range record.
 // 2018.08.13 jjr Corrected display of WIB id getWibIdentifiers.  The 
 //                slot number was masked to only 2 bits.  This was only
 //                a display issue.
@@ -98,6 +117,7 @@
 #include "DaqBuffer.h"
 #include "FrameBuffer.h"
 #include "TimingClockTicks.h"
+#include "PacketGeometry.h"
 #include <AxisDriver.h>
 #include "AxiBufChecker.h"
 #include "Headers.hh"
@@ -1996,27 +2016,29 @@ inline void FrameDiagnostics::dump_headerFrame (void const *data,
 {
    ////if (!m_dataFrameDump[dest].declare ()) return;
 
+   int const     n64 = WibFrameLayout::N64PerFrame;
+   int const  tsWord = WibFrameLayout::TsWord;
    uint64_t const *s = (uint64_t const *)data;
    int            ns = nbytes / sizeof (*s);
 
    s  += 1;
    ns -= 2;
 
-   uint64_t expected = s[1];
+   uint64_t expected = s[tsWord];
 
-   for (int idx = 0; idx < ns; idx += 30)
+   for (int idx = 0; idx < ns; idx += n64)
    {
-      uint64_t ts = s[idx+1];
+      uint64_t ts = s[idx+tsWord];
 
       // --------------------------------------------
       // If not as expected dump +-3 around the error
       // --------------------------------------------
       if (ts < expected)
       {
-         uint64_t expa = s[idx - 3 * 30 + 1];
-         for (int  idy = idx - 3*30; idy <= idx + 3*30; idy += 30)
+         uint64_t expa = s[idx - 3 * n64 + tsWord];
+         for (int  idy = idx - 3*n64; idy <= idx + 3*n64; idy += n64)
          {
-            uint64_t tsa = s[idy+1];
+            uint64_t tsa = s[idy+tsWord];
 
             printf ("%5x"
                     " %16.16" PRIx64 " %16.16" PRIx64 " %16.16" PRIx64 ""
@@ -2056,9 +2078,8 @@ inline void FrameDiagnostics::check_dataFrame (uint64_t const *data,
                                                unsigned int    dest,
                                                int           sample)
 {
-#  define N64_PER_FRAME 30
-#  define NBYTES (unsigned int)(((N64_PER_FRAME * 1024) + 1  + 1) \
-                * sizeof (uint64_t))
+#  define N64_PER_FRAME ReadoutGeometry::N64PerFrame
+#  define NBYTES (unsigned int)ReadoutGeometry::NBytesWibPacket
 
    if (!m_dataFrameCheck[dest].declare ()) return;
 
@@ -2508,6 +2529,20 @@ bool DaqBuffer::open (string devPath)
          this->close ();
          return false;
       }
+
+      // -------------------------------------------------------------
+      // A compressed packet may be as large as all its channels raw.
+      // This is only a bound if the firmware sends the channels that
+      // do not compress raw, which the synthesized design does not yet
+      // do, so larger packets are still accepted.
+      // -------------------------------------------------------------
+      if (_dataDma._bSize < ReadoutGeometry::NBytesCompressedMax)
+      {
+         fprintf (stderr,
+                  "DaqBuffer::open -> Warning: Data dma buffers of %8i bytes"
+                  " are smaller than the largest compressed packet, %8i\n",
+                  _dataDma._bSize, (int)ReadoutGeometry::NBytesCompressedMax);
+      }
    }
 
 
@@ -3002,7 +3037,7 @@ static void checkTimestamps (uint64_t const *data, int dest)
       }
    }
 
-   NextTimestamp[dest] = got + TimingTicks::PER_FRAME;
+   NextTimestamp[dest] = got + ReadoutGeometry::Ticks;
    return;
 }
 /* ---------------------------------------------------------------------- */
@@ -3917,7 +3952,7 @@ void DaqBuffer::rxRun ()
                                             timestampRange[1]);
 
             int64_t dt = timestampRange[1] - timestampRange[0];
-            if (dt != TimingClockTicks::PER_FRAME)
+            if (dt != ReadoutGeometry::Ticks)
             {
                fb->m_body.addStatus (FrameBuffer::Missing);
                fprintf (stderr, 
@@ -4709,6 +4744,10 @@ static uint32_t getIndex (List<FrameBuffer>::Node const *node,
                           uint64_t                        win,
                           uint16_t                     pktIdx);
 
+static uint32_t getTrimmedIndex (List<FrameBuffer>::Node const *node,
+                                 uint64_t                        win,
+                                 uint16_t                     pktIdx);
+
 
 static unsigned int addRanges (pdd::fragment::tpc::Ranges *ranges,
                                int                           ictb,
@@ -4744,13 +4783,14 @@ static unsigned int addRanges (pdd::fragment::tpc::Ranges *ranges,
 
    // -------------------------------------------------------------
    // Calculate the index to the first, last and trigger timesamples
-   // in the window
+   // in the window.  For transposed packets, the beginning and
+   // ending are trimmed to the data that is present.
    // WARNING: This assumes that this occur in the specified nodes.
    // -------------------------------------------------------------
-   uint32_t idxBeg = getIndex (first, winBeg, 0);
+   uint32_t idxBeg = getTrimmedIndex (first, winBeg, 0);
    //fprintf (stderr, "\nBegin   index[%d] %8.8" PRIx32 "\n", ictb, idxBeg);
 
-   uint32_t idxEnd = getIndex (last,  winEnd, event->m_npkts[ictb] - 1);
+   uint32_t idxEnd = getTrimmedIndex (last,  winEnd, event->m_npkts[ictb] - 1);
    //fprintf (stderr, "\nEnd     index[%d] %8.8" PRIx32 "\n", ictb, idxEnd);
 
    uint32_t idxTrg;
@@ -4838,7 +4878,7 @@ static uint32_t getIndex (List<FrameBuffer>::Node const *node,
       {
          /*
           * uint64_t const *p64  = node->m_body.getBaseAddr64 ();
-          * uint64_t const *pBeg = p64 + 30 * idx + 2;
+          * uint64_t const *pBeg = p64 + WibFrameLayout::N64PerFrame * idx + 2;
           * uint64_t       tsPkt = pBeg[0];
           * fprintf (stderr,
           *        "Idx: %6d Beg: %16.16" PRIx64 " vs %16.16" PRIx64 "\n",
@@ -4857,6 +4897,54 @@ static uint32_t getIndex (List<FrameBuffer>::Node const *node,
 
 
 
+/* ---------------------------------------------------------------------- *//*!
+
+   \brief  Find the index of the WIB frame at a window boundary, trimming
+           the window to the data in the packet
+   \return An integer containing two bit fields, one for the packet index
+           and one for the index of WIB frame.
+
+   \param[in]   node The first or last node of the event
+   \param[in]    win The beginning or ending time of the event window
+   \param[in] pktIdx The index of the packet
+
+   \par
+    For transposed packets this is getIndex, except that a time before the
+    packet's first sample gives its first sample and a time after the
+    packet's last sample gives its last sample. This happens when the event
+    window extends beyond the data that was buffered. The WIB frame and
+    compressed packets are left to getIndex, as before.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static uint32_t getTrimmedIndex (List<FrameBuffer>::Node const *node,
+                                 uint64_t                        win,
+                                 uint16_t                     pktIdx)
+{
+   if (node == NULL)
+   {
+      fprintf (stderr, "Error node = NULL\n");
+      return -1;
+   }
+
+   uint64_t    tlr = FrameBuffer::getTrailer (node->m_body.getBaseAddr64 (),
+                                              node->m_body.getReadSize   ());
+   uint64_t pktBeg = node->m_body._ts_range[0];
+   uint64_t pktEnd = node->m_body._ts_range[1];
+
+   if (FrameBuffer::getDataType (tlr) == FrameBuffer::DataType::Transposed
+   &&  pktEnd > pktBeg)
+   {
+      if      (win <  pktBeg) win = pktBeg;
+      else if (win >= pktEnd) win = pktEnd - TimingClockTicks::PER_SAMPLE;
+   }
+
+   return getIndex (node, win, pktIdx);
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
 /* ---------------------------------------------------------------------- */
 static inline uint32_t addHeaderOrigin (TxMsg              *msg,
                                         HeaderAndOrigin *hdrOrg,
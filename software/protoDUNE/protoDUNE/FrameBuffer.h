@@ -20,6 +20,9 @@
 //
 //       DATE WHO WHAT 
 // ---------- --- ------------------------------------------------------------
+// 2018.08.15 jjr The WIB frame layout now comes from PacketGeometry.h
+// 2018.08.14 jjr Added the transposed record type to getWibIdentifier and
+//                getTimestampRange, see WibTransposed.h for its layout
 // 2018.08.13 jjr Corrected WIB mask from 0x3ff -> 0x7ff in getWibIdentifier
 // 2018.08.09 jjr Corrected locating the WIB id.  This is different for raw
 //                WIB frame data and compressed data.
@@ -37,6 +40,7 @@
 #define __FRAME_BUFFER_H__
 
 #include "TimingClockTicks.h"
+#include "PacketGeometry.h"
 
 #include <stdint.h>
 #include <inttypes.h>
@@ -148,6 +152,9 @@ public:
    static void        getCompressedTimestampRange (uint64_t   range[2],
                                                    uint64_t const *d64);
 
+   static void        getTransposedTimestampRange (uint64_t   range[2],
+                                                   uint64_t const *d64);
+
 
    static void          getWibFrameTimestampRange (uint64_t   range[2],
                                                    uint64_t const *d64,
@@ -537,7 +544,8 @@ inline bool FrameBuffer::getWibIdentifier (uint16_t      *wibId,
          *wibId = (d64[0] >> 13) & 0x7ff;
          return true;
       }
-      else if (dataType == DataType::Compressed)
+      else if (dataType == DataType::Compressed ||
+               dataType == DataType::Transposed)
       {
          *wibId = (d64[1] >> 13) & 0x7ff;
          return true;
@@ -579,6 +587,10 @@ inline bool FrameBuffer::getTimestampRange (uint64_t     range[2],
          //// fprintf (stderr, "TpcData:Compress:");
          getCompressedTimestampRange (range, d64);
       }
+      else if (recType == DataType::Transposed)
+      {
+         getTransposedTimestampRange (range, d64);
+      }
       else if (recType == FrameBuffer::DataType::WibFrame)
       {
          //// fprintf (stderr, "TpcData:WibFrame:");
@@ -639,6 +651,31 @@ inline void FrameBuffer::getCompressedTimestampRange (uint64_t   range[2],
 
 
 
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief   Gets the timestamp range of a transposed packet
+  
+  \param[in]  range The timestamp range of this packet
+  \param[in]    d64 64-bit pointer to the data packet
+
+  \par
+   The header record carries the timestamps of the first and last WIB
+   frames in words 2 and 3, see WibTransposed.h.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+inline void FrameBuffer::getTransposedTimestampRange (uint64_t   range[2],
+                                                      uint64_t const *d64)
+{
+   range[0] = d64[2];
+   range[1] = d64[3] + TimingClockTicks::PER_SAMPLE;
+
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
 /* ---------------------------------------------------------------------- *//*!
 
   \brief   Hokey routine to get the timestamp range of the packet.
@@ -662,7 +699,7 @@ inline void FrameBuffer::getWibFrameTimestampRange(uint64_t     range[2],
    // Locate the timestamp in the first WIB frame.  Since the data starts
    // with the WIB frame, the timestamp is in word #1 (starting from 0).
    // -----------------------------------------------------=-------------
-   uint64_t  begin = d64[1];
+   uint64_t  begin = d64[WibFrameLayout::TsWord];
 
 
    // -------------------------------------------------------------------
@@ -670,8 +707,8 @@ inline void FrameBuffer::getWibFrameTimestampRange(uint64_t     range[2],
    // Add the number of clock ticks per time sample to get the
    // ending time.
    // -------------------------------------------------------------------
-   d64 += nbytes/sizeof (uint64_t) - 30 - 1 - 1;
-   uint64_t end = d64[1] + TimingClockTicks::PER_SAMPLE;
+   d64 += WibFrameLayout::lastFrame (nbytes);
+   uint64_t end = d64[WibFrameLayout::TsWord] + TimingClockTicks::PER_SAMPLE;
 
 
    #if 0
@@ -0,0 +1,191 @@
+#ifndef __PACKET_GEOMETRY_H__
+#define __PACKET_GEOMETRY_H__
+
+
+///////////////////////////////////////////////////////////////////////////
+// This file is part of 'DUNE Development Software'.
+// It is subject to the license terms in the LICENSE.txt file found in the
+// top-level directory of this distribution and at:
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html.
+// No part of 'DUNE Development Software', including this file,
+// may be copied, modified, propagated, or distributed except according to
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+
+
+
+// ----------------------------------------------------------------------
+//
+// HISTORY
+//
+//       DATE WHO WHAT
+// ---------- --- -------------------------------------------------------
+// 2018.08.17 jjr N64CompressedMax is not yet a bound on the firmware
+// 2018.08.17 jjr Added static_asserts instantiating each packet length
+// 2018.08.16 jjr Added N64CompressedMax, the hard bound on the size of a
+//                compressed packet
+// 2018.07.30 jjr Created, gathers the packet length, channel count and
+//                WIB frame layout previously spread as literals through
+//                FrameBuffer.h and DaqBuffer.cpp
+// ----------------------------------------------------------------------
+
+
+#include "TimingClockTicks.h"
+#include <stdint.h>
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+   \def    PACKET_B_NSAMPLES
+   \brief  The number of time samples in a packet, expressed in bits
+
+   \par
+    This is the same flag that sets the packet length of the firmware's
+    compression model (Parameters.h), so that one -DPACKET_B_NSAMPLES=n
+    configures both the model and the software readout. Only 8, 9 and
+    10, i.e. 256, 512 and 1024 samples, are supported.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+#ifndef PACKET_B_NSAMPLES
+#define PACKET_B_NSAMPLES 10
+#endif
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+   \class  WibFrameLayout
+   \brief  The layout of WIB frames as they are delivered by the firmware
+                                                                          */
+/* ---------------------------------------------------------------------- */
+class WibFrameLayout
+{
+public:
+   /* ------------------------------------------------------------------- *//*!
+
+     \enum  Constants
+     \brief The constants describing the frame layout
+                                                                          */
+   /* ------------------------------------------------------------------- */
+   enum Constants
+   {
+      N64PerFrame =  30, /*!< Number of 64-bit words in a WIB frame       */
+      NChannels   = 128, /*!< Number of channels in a WIB frame           */
+      TsWord      =   1, /*!< Index of the timestamp word in a frame      */
+      N64Trailer  =   2, /*!< Number of transport trailer words           */
+      N64HdrMax   = 1 + 7 + 6 * 32 + 32 / 4,
+                         /*!< Maximum number of 64-bit words in the
+                              header of a compressed packet, the record
+                              header, WIB header words and 32 exceptions*/
+   };
+   /* ------------------------------------------------------------------- */
+
+
+   /* ------------------------------------------------------------------- *//*!
+
+      \brief  The 64-bit word offset of the last frame in a packet
+      \return The 64-bit word offset of the last frame
+
+      \param[in] nbytes  The number of bytes in the packet as read,
+                         i.e. including the transport trailer
+                                                                          */
+   /* ------------------------------------------------------------------- */
+   constexpr static inline uint32_t lastFrame (uint32_t nbytes)
+   {
+      return nbytes / sizeof (uint64_t) - N64PerFrame - N64Trailer;
+   }
+   /* ------------------------------------------------------------------- */
+};
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+   \class  PacketGeometry
+   \brief  The geometry of a packet of \a NSAMPLES time samples
+                                                                          */
+/* ---------------------------------------------------------------------- */
+template<int NSAMPLES>
+class PacketGeometry : public WibFrameLayout
+{
+public:
+   static_assert (NSAMPLES == 256 || NSAMPLES == 512 || NSAMPLES == 1024,
+                  "Packets must be 256, 512 or 1024 samples");
+
+   /* ------------------------------------------------------------------- *//*!
+
+     \enum  Constants
+     \brief The constants describing the packet
+                                                                          */
+   /* ------------------------------------------------------------------- */
+   enum Constants
+   {
+      NSamples     = NSAMPLES,
+                            /*!< Number of time samples in a packet       */
+      N64WibPacket = N64PerFrame * NSAMPLES + N64Trailer,
+                            /*!< Size, in 64-bit words, of a packet of
+                                 WIB frames, including the trailer        */
+      NBytesWibPacket = N64WibPacket * sizeof (uint64_t),
+                            /*!< Size, in bytes, of a packet of WIB frames*/
+      N64CompressedMax = N64HdrMax
+                       + (NChannels * (32 + 12 * (NSAMPLES - 1)) + 63) / 64
+                       + (NChannels + 2) / 2 + 1
+                       + N64Trailer,
+                            /*!< Maximum size, in 64-bit words, of a
+                                 compressed packet, including the
+                                 trailer. A channel that would not
+                                 compress is sent raw, 12 bits a sample,
+                                 so this is the model's hard bound,
+                                 MODULE_K_MAXSIZE_OB. The synthesized
+                                 firmware does not yet send raw channels,
+                                 see HISTOGRAM_MODEL_RAW, so its packets
+                                 may be larger                            */
+      NBytesCompressedMax = N64CompressedMax * sizeof (uint64_t),
+                            /*!< Maximum size, in bytes, of a compressed
+                                 packet                                   */
+      Ticks        = TimingClockTicks::PER_SAMPLE * NSAMPLES,
+                            /*!< Elapsed time, in ticks, of a packet      */
+   };
+   /* ------------------------------------------------------------------- */
+};
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+   \brief  Compile checks of every supported packet length
+
+   \par
+    Only the length selected by PACKET_B_NSAMPLES is otherwise
+    instantiated, these keep the other two compiling. A compressed packet,
+    even with every channel sent raw, is smaller than its WIB frames.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static_assert (PacketGeometry< 256>::N64CompressedMax < PacketGeometry< 256>::N64WibPacket
+            && PacketGeometry< 256>::Ticks == 256 * TimingClockTicks::PER_SAMPLE,
+               "PacketGeometry<256> is inconsistent");
+
+static_assert (PacketGeometry< 512>::N64CompressedMax < PacketGeometry< 512>::N64WibPacket
+            && PacketGeometry< 512>::Ticks == 512 * TimingClockTicks::PER_SAMPLE,
+               "PacketGeometry<512> is inconsistent");
+
+static_assert (PacketGeometry<1024>::N64CompressedMax < PacketGeometry<1024>::N64WibPacket
+            && PacketGeometry<1024>::Ticks == 1024 * TimingClockTicks::PER_SAMPLE,
+               "PacketGeometry<1024> is inconsistent");
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+   \typedef ReadoutGeometry
+   \brief   The packet geometry that the readout is built for
+                                                                          */
+/* ---------------------------------------------------------------------- */
+typedef PacketGeometry<(1 << PACKET_B_NSAMPLES)> ReadoutGeometry;
+/* ---------------------------------------------------------------------- */
+
+#endif
@@ -20,6 +20,8 @@
 //
 //       DATE WHO WHAT
 // ---------- --- -------------------------------------------------------
+// 2018.08.17 jjr Removed PER_FRAME, the packet time now comes from
+//                ReadoutGeometry::Ticks
 // 2018.07.24 jjr Separated from DaqBuffer.h
 // ----------------------------------------------------------------------
 
@@ -48,8 +50,6 @@ public:
       PER_SAMPLE      = 25, /* Number of clock ticks between ADC samples  */
       SAMPLE_PERIOD   = CLOCK_PERIOD * PER_SAMPLE,
                             /*!< Number of nanoseconds between ADC samples*/
-      PER_FRAME       = PER_SAMPLE * 1024,
-                            /*!< Elapsed time, in ticks, in a 1024 packet */
    };
    /* ------------------------------------------------------------------- */
 
@@ -0,0 +1,1527 @@
+// -*-Mode: C;-*-
+
+#ifndef PDD_WIBDECODE_H
+#define PDD_WIBDECODE_H
+
+/* ---------------------------------------------------------------------- *//*!
+ *
+ *  @file     WibDecode.h
+ *  @brief    Decodes the histogram + arithmetic coded WIB packets produced
+ *            by the firmware's compression module into channel-major
+ *            16-bit waveforms
+ *  @verbatim
+ *                               Copyright 2018
+ *                                    by
+ *
+ *                       The Board of Trustees of the
+ *                    Leland Stanford Junior University.
+ *                           All rights reserved.
+ *
+ *  @endverbatim
+ *
+ *  @par Facility:
+ *  pdd
+ *
+ *  @author
+ *  <russell@slac.stanford.edu>
+ *
+ *  @par Date created:
+ *  <2018/07/26>
+ *
+ * @par Credits:
+ * SLAC
+ *
+\* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *\
+
+   HISTORY
+   -------
+
+   DATE       WHO WHAT
+   ---------- --- ---------------------------------------------------------
+   2018.08.16 jjr Added the raw channels, format 2
+   2018.07.31 jjr wibDecode_channelFast reads the coded symbols and the
+                  overflows with BitIO.h's BitReader
+   2018.07.29 jjr wibDecode_predict takes the sample pitch, so the
+                  encoder can use it on time-major frames
+   2018.07.28 jjr Added the saved histogram models, format 1 histograms
+   2018.07.27 jjr Added the predictors, the TOC carries which one was
+                  used and wibDecode_unpredict undoes it
+   2018.07.27 jjr Added wibDecode_channelFast, a table driven decoder,
+                  now used by wibDecode_packet and the pool
+   2018.07.26 jjr Created
+
+\* ---------------------------------------------------------------------- */
+
+
+/* ---------------------------------------------------------------------- *\
+
+   PACKET LAYOUT
+   -------------
+   This is what the firmware's write_packet (PacketWrite.h) produces.
+   All bit streams are stuffed MSB first into 64-bit words and all bit
+   offsets are relative to the first word of the packet.
+
+     Word 0       Record header
+                     status(32) | #exc(8) | n64(16) | RecType=1 | Fmt=3
+                  followed by the WIB header and exception words, n64
+                  includes the record header word itself.
+
+     Bit  n64*64  The channels, back-to-back with no padding. Each is
+
+                    Histogram header (32 bits)
+                       Format(4)=0 | NBins-1(8) | MBits(4)
+                                   | First ADC(12) | NOvrBits(4)
+                    The NBins bins, bin i is min (nbits (left), MBits)
+                    bits, where left is the number of symbols not yet
+                    accounted for, nsamples - 1 initially.  Once left
+                    reaches 0, no bits are used.
+                    Bins[0] overflow values of NOvrBits each
+                    The arithmetic coded symbols
+
+                  or, when the firmware's adaptive models are enabled,
+                  a channel may instead use the histogram it last sent
+                  in full. Its header is then
+
+                    Format(4)=1 | NBins-1(8) | 0(4)
+                                | First ADC(12) | NOvrBits(4)
+                    NOverflows (log2 (nsamples) bits)
+
+                  followed by the overflow values and symbols as above.
+                  Every so many packets all channels send their
+                  histograms in full, from there on a decoder has all
+                  it needs.
+
+                  A channel that would not compress, e.g. white noise,
+                  is sent raw, its header
+
+                    Format(4)=2 | NBins-1(8) | 0(4)
+                                | First ADC(12) | 0(4)
+
+                  followed by the remaining nsamples - 1 values, 12 bits
+                  each. These are the values the coder would have seen,
+                  z[t] below, so a channel is never larger than
+                  32 + 12 * (nsamples - 1) bits. A raw channel leaves
+                  the saved model unchanged.
+
+     Toc          Starts on the next 64-bit boundary, pairs of 32-bit
+                  bit offsets, channel i is in the low half of word
+                  i/2 if i is even. Offset[nchans] is the end of the
+                  last channel.
+                  Trailer
+                    Rsvd(8)|Predictor(4)|NChans-1(12)|NSamples-1(12)|0(4)
+                           |n64(16)|RecType=2(4)|Fmt=3(4)
+                  n64 includes the trailer word.
+
+     Epilogue     Status/Identifier and packet trailer. These may or may
+                  not be present depending on how the packet was
+                  transported.
+
+   SYMBOLS
+   -------
+   The symbol for an ADC is formed from the difference with its
+   predecessor, d = prv - cur, as 2d+1 if d >= 0 and -2d if d < 0.
+   Symbols >= NBins go into bin 0 with the excess, sym - NBins, stored
+   as an overflow value.  The histogram doubles as the cumulative
+   probability table for the arithmetic coder, so that the coder's
+   normalization is log2 (nsamples) and its code value is 2 bits wider.
+
+   PREDICTORS
+   ----------
+   With the default predictor, 0, the predecessor is the previous ADC.
+   With the others, it is a prediction that may use the previous two
+   samples of the channel and the current and previous samples of the
+   lower numbered channels (see wibDecode_predict). The difference is
+   then taken modulo 4096 and what is coded is z[t], the running sum of
+   these differences, z[0] = x[0], modulo 4096.  The channel decoders
+   return z[t]; wibDecode_unpredict turns it back into x[t].
+
+\* ---------------------------------------------------------------------- */
+
+
+#include "BitIO.h"
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+#define WIBDECODE_K_NBINS         32  /*!< Histogram bins                 */
+#define WIBDECODE_K_MAXCHANNELS  128  /*!< Maximum channels in a packet   */
+#define WIBDECODE_K_MAXSAMPLES  1024  /*!< Maximum samples per channel    */
+#define WIBDECODE_K_HDRFMT         3  /*!< Record header format           */
+#define WIBDECODE_K_HDRRECTYPE     1  /*!< WIB header record type         */
+#define WIBDECODE_K_TOCRECTYPE     2  /*!< TOC trailer record type        */
+#define WIBDECODE_K_FMTFULL        0  /*!< Histogram sent in full         */
+#define WIBDECODE_K_FMTSAME        1  /*!< Histogram is the saved model   */
+#define WIBDECODE_K_FMTRAW         2  /*!< Samples sent uncoded           */
+#define WIBDECODE_K_NPREDICTORS    4  /*!< Number of defined predictors   */
+#define WIBDECODE_K_NGROUP        16  /*!< Channels sharing common mode   */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \enum  WibDecodeError
+  \brief Enumerates the reasons a packet or channel fails to decode
+                                                                          */
+/* ---------------------------------------------------------------------- */
+enum WibDecodeError
+{
+   WIBDECODE_K_OK      =  0, /*!< Success                                 */
+   WIBDECODE_K_NOTOC   = -1, /*!< No TOC trailer found                    */
+   WIBDECODE_K_BADTOC  = -2, /*!< TOC geometry or offsets inconsistent    */
+   WIBDECODE_K_BADHIST = -3, /*!< Histogram header or contents invalid    */
+   WIBDECODE_K_LENGTH  = -4, /*!< Decoded length disagrees with the TOC   */
+   WIBDECODE_K_PITCH   = -5, /*!< Output pitch < the number of samples    */
+   WIBDECODE_K_NOMODEL = -6  /*!< Uses a saved model that is not present */
+};
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \struct _WibDecodeToc
+  \brief   The validated table of contents of a compressed packet
+                                                                          *//*!
+  \typedef WibDecodeToc
+  \brief   Typedef for struct _WibDecodeToc
+                                                                          */
+/* ---------------------------------------------------------------------- */
+typedef struct _WibDecodeToc
+{
+   uint32_t const *offsets; /*!< nchans + 1 channel bit offsets           */
+   uint32_t           ndata; /*!< 64-bit words preceding the TOC          */
+   int               nchans; /*!< The number of channels                  */
+   int             nsamples; /*!< The number of samples per channel       */
+   int            predictor; /*!< The predictor, 0 = previous sample      */
+}
+WibDecodeToc;
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \struct _WibDecodeHist
+  \brief   A channel's decoded histogram
+                                                                          *//*!
+  \typedef WibDecodeHist
+  \brief   Typedef for struct _WibDecodeHist
+                                                                          */
+/* ---------------------------------------------------------------------- */
+typedef struct _WibDecodeHist
+{
+   uint16_t table[WIBDECODE_K_NBINS + 1]; /*!< Cumulative bin counts     */
+   uint32_t                         opos; /*!< Overflow values bit offset*/
+   int                             first; /*!< The first ADC             */
+   int                             nbins; /*!< The number of bins        */
+   int                              last; /*!< The last non-empty bin    */
+   int                            nobits; /*!< Bits per overflow value   */
+}
+WibDecodeHist;
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \struct _WibDecodeModels
+  \brief   The saved histogram models of a stream of packets, one per
+           channel
+                                                                          *//*!
+  \typedef WibDecodeModels
+  \brief   Typedef for struct _WibDecodeModels
+
+   Only the table, nbins and last of each are used. A model with nbins
+   = 0 is absent. Zero the structure before the first packet.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+typedef struct _WibDecodeModels
+{
+   WibDecodeHist hists[WIBDECODE_K_MAXCHANNELS]; /*!< Per channel model  */
+}
+WibDecodeModels;
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \struct _WibDecodeJob
+  \brief   Describes one packet to be decoded
+                                                                          *//*!
+  \typedef WibDecodeJob
+  \brief   Typedef for struct _WibDecodeJob
+                                                                          */
+/* ---------------------------------------------------------------------- */
+typedef struct _WibDecodeJob
+{
+   uint16_t            *adcs; /*!< Output, adcs[ichan*pitch + t]          */
+   int                 pitch; /*!< Distance, in ADCs, between channels    */
+   uint64_t const       *pkt; /*!< The compressed packet                  */
+   uint32_t              n64; /*!< Its length in 64-bit words             */
+   WibDecodeModels   *models; /*!< The stream's saved models, may be NULL */
+   WibDecodeToc          toc; /*!< Returned, the packet's TOC             */
+   int volatile       status; /*!< Returned, the first error, if any      */
+   int volatile        nerrs; /*!< Returned, the number of failed channels*/
+}
+WibDecodeJob;
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \struct _WibDecodePool
+  \brief   A pool of threads that decode the channels of a set of packets
+           in parallel
+                                                                          *//*!
+  \typedef WibDecodePool
+  \brief   Typedef for struct _WibDecodePool
+
+   The calling thread participates in the decoding, so a pool of
+   nthreads - 1 workers gives nthreads decoding threads.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+typedef struct _WibDecodePool
+{
+   pthread_t           *threads; /*!< The worker threads                  */
+   int                 nworkers; /*!< The number of worker threads        */
+   pthread_mutex_t        mutex; /*!< Protects the dispatch variables     */
+   pthread_cond_t         start; /*!< Signals a new set of jobs           */
+   pthread_cond_t          done; /*!< Signals all workers finished        */
+   unsigned          generation; /*!< Bumped for each new set of jobs     */
+   int                  nactive; /*!< Workers still on the current set    */
+   int                     stop; /*!< Set to terminate the workers        */
+   WibDecodeJob           *jobs; /*!< The current set of jobs             */
+   int                    njobs; /*!< The number of jobs                  */
+   int                   nitems; /*!< Total number of channels to decode  */
+   int volatile            next; /*!< The next channel to be claimed      */
+}
+WibDecodePool;
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- */
+/* PROTOTYPES                                                             */
+/* ---------------------------------------------------------------------- */
+static inline int  wibDecode_toc          (WibDecodeToc             *toc,
+                                           uint64_t const           *pkt,
+                                           uint32_t                  n64);
+
+static inline int  wibDecode_channel      (uint16_t                *adcs,
+                                           uint64_t const           *buf,
+                                           uint32_t                  n64,
+                                           uint32_t                  beg,
+                                           uint32_t                  end,
+                                           int                  nsamples,
+                                           WibDecodeHist           *model);
+
+static inline int  wibDecode_channelFast  (uint16_t                *adcs,
+                                           uint64_t const           *buf,
+                                           uint32_t                  n64,
+                                           uint32_t                  beg,
+                                           uint32_t                  end,
+                                           int                  nsamples,
+                                           WibDecodeHist           *model);
+
+static inline void wibDecode_unpredict    (uint16_t                *adcs,
+                                           int                     pitch,
+                                           int                    nchans,
+                                           int                  nsamples,
+                                           int                 predictor);
+
+static inline int  wibDecode_packet       (uint16_t                *adcs,
+                                           int                     pitch,
+                                           uint64_t const           *pkt,
+                                           uint32_t                  n64,
+                                           WibDecodeToc             *toc,
+                                           WibDecodeModels       *models);
+
+static inline int  wibDecodePool_create   (WibDecodePool           *pool,
+                                           int                  nthreads);
+
+static inline int  wibDecodePool_decode   (WibDecodePool           *pool,
+                                           WibDecodeJob            *jobs,
+                                           int                     njobs);
+
+static inline void wibDecodePool_destroy  (WibDecodePool           *pool);
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Extracts a right justified field of up to 32 bits
+  \return The field
+
+  \param[in]     buf  The bit stream
+  \param[in]     n64  The number of 64-bit words in the bit stream. Bits
+                      past this are read as 0
+  \param[in,out] pos  The bit position, advanced by \a nbits
+  \param[in]   nbits  The number of bits to extract, 0-32
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline uint32_t wibDecode_extract (uint64_t const *buf,
+                                          uint32_t        n64,
+                                          uint32_t       *pos,
+                                          int           nbits)
+{
+   if (nbits == 0) return 0;
+
+   uint32_t   p = *pos;
+   uint32_t  iw = p >> 6;
+   int       ib = p & 0x3f;
+   uint64_t  w0 = iw     < n64 ? buf[iw]     : 0;
+   uint64_t  w1 = iw + 1 < n64 ? buf[iw + 1] : 0;
+   uint64_t   w = ib ? (w0 << ib) | (w1 >> (64 - ib)) : w0;
+
+   *pos = p + nbits;
+   return w >> (64 - nbits);
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Returns the 64 bits starting at bit \a pos, MSB justified
+
+  \param[in] buf  The bit stream
+  \param[in] n64  The number of 64-bit words in the bit stream. Bits
+                   past this are read as 0
+  \param[in] pos  The bit position
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline uint64_t wibDecode_peek (uint64_t const *buf,
+                                       uint32_t        n64,
+                                       uint32_t        pos)
+{
+   uint32_t  iw = pos >> 6;
+   int       ib = pos & 0x3f;
+   uint64_t  w0 = iw     < n64 ? buf[iw]     : 0;
+   uint64_t  w1 = iw + 1 < n64 ? buf[iw + 1] : 0;
+
+   return ib ? (w0 << ib) | (w1 >> (64 - ib)) : w0;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Locates and validates the packet's table of contents
+  \retval WIBDECODE_K_OK      if valid
+  \retval WIBDECODE_K_NOTOC   if no TOC trailer could be found
+  \retval WIBDECODE_K_BADTOC  if the TOC is inconsistent with the packet
+
+  \param[out] toc  The validated TOC
+  \param[in]  pkt  The compressed packet, starting with its record header
+  \param[in]  n64  The length of the packet in 64-bit words
+
+  \par
+   The TOC trailer is either the last word of the packet or, if the
+   epilogue was kept, the third to last.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline int wibDecode_toc (WibDecodeToc    *toc,
+                                 uint64_t const  *pkt,
+                                 uint32_t         n64)
+{
+   if (n64 < 2) return WIBDECODE_K_NOTOC;
+
+   // ---------------------------------------------------------
+   // The record header must be the WIB header record and the
+   // first channel must start immediately after it.
+   // ---------------------------------------------------------
+   uint64_t  hdr = pkt[0];
+   uint32_t nhdr = (hdr >> 8) & 0xffff;
+   if ( (hdr        & 0xf) != WIBDECODE_K_HDRFMT
+     || ((hdr >> 4) & 0xf) != WIBDECODE_K_HDRRECTYPE
+     || nhdr == 0 || nhdr >= n64)
+   {
+      return WIBDECODE_K_BADTOC;
+   }
+
+
+   static const int Candidates[2] = { 1, 3 };
+   for (int idx = 0; idx < 2; idx++)
+   {
+      if (n64 < (uint32_t)Candidates[idx]) break;
+
+      uint32_t  itlr = n64 - Candidates[idx];
+      uint64_t   tlr = pkt[itlr];
+      if ( (tlr        & 0xf) != WIBDECODE_K_HDRFMT
+        || ((tlr >> 4) & 0xf) != WIBDECODE_K_TOCRECTYPE)
+      {
+         continue;
+      }
+
+      int    predictor =  (tlr >> 52) & 0xf;
+      int       nchans = ((tlr >> 40) & 0xfff) + 1;
+      int     nsamples = ((tlr >> 28) & 0xfff) + 1;
+      uint32_t    ntoc =  (tlr >>  8) & 0xffff;
+
+      // --------------------------------------------------------------
+      // Only power of 2 sample counts are encoded, the arithmetic
+      // coder's normalization is the log2 of the number of samples.
+      // --------------------------------------------------------------
+      if ( nchans   > WIBDECODE_K_MAXCHANNELS
+        || nsamples > WIBDECODE_K_MAXSAMPLES
+        || nsamples < 2
+        || (nsamples & (nsamples - 1))
+        || ntoc != (uint32_t)((nchans + 2) / 2 + 1)
+        || ntoc  > itlr + 1
+        || predictor >= WIBDECODE_K_NPREDICTORS)
+      {
+         return WIBDECODE_K_BADTOC;
+      }
+
+      uint32_t         ndata = itlr + 1 - ntoc;
+      uint32_t const *offsets = (uint32_t const *)(pkt + ndata);
+
+
+      // ----------------------------------------------------------
+      // The offsets must start at the end of the header record,
+      // be non-decreasing and the last must end in the word just
+      // before the TOC.
+      // ----------------------------------------------------------
+      if (offsets[0] != nhdr * 64)
+      {
+         return WIBDECODE_K_BADTOC;
+      }
+
+      for (int ichan = 0; ichan < nchans; ichan++)
+      {
+         if (offsets[ichan + 1] < offsets[ichan]) return WIBDECODE_K_BADTOC;
+      }
+
+      if ( ((offsets[nchans] + 63) >> 6) != ndata)
+      {
+         return WIBDECODE_K_BADTOC;
+      }
+
+      toc->offsets  = offsets;
+      toc->ndata    = ndata;
+      toc->nchans   = nchans;
+      toc->nsamples  = nsamples;
+      toc->predictor = predictor;
+
+      return WIBDECODE_K_OK;
+   }
+
+   return WIBDECODE_K_NOTOC;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Restores the ADC difference from its symbol
+  \return The difference to add to the previous ADC
+
+  \param[in] sym  The symbol
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline int wibDecode_restore (int sym)
+{
+   return (sym & 1) ? -(sym >> 1) : (sym >> 1);
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Decodes a channel's histogram header, its bins and locates its
+          overflow values
+  \retval WIBDECODE_K_OK       if successful
+  \retval WIBDECODE_K_BADHIST  if the histogram is invalid
+  \retval WIBDECODE_K_LENGTH   if the overflow values run past \a end
+  \retval WIBDECODE_K_NOMODEL  if the channel uses its saved model and
+                               there is none
+
+  \param[out]    hist  The decoded histogram
+  \param[in]      buf  The packet
+  \param[in]      n64  The number of 64-bit words that may be read
+  \param[in,out]  pos  The bit offset of the channel, returned as the
+                       bit offset of its arithmetic coded symbols
+  \param[in]      end  The bit offset of the next channel
+  \param[in] nsamples  The number of samples, a power of 2
+  \param[in]    model  The channel's saved model, may be NULL
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline int wibDecode_histogram (WibDecodeHist       *hist,
+                                       uint64_t const       *buf,
+                                       uint32_t              n64,
+                                       uint32_t             *pos,
+                                       uint32_t              end,
+                                       int              nsamples,
+                                       WibDecodeHist const *model)
+{
+   // ---------------------------
+   // Decode the histogram header
+   // ---------------------------
+   int format   = wibDecode_extract (buf, n64, pos,  4);
+   int nbins    = wibDecode_extract (buf, n64, pos,  8) + 1;
+   int mbits    = wibDecode_extract (buf, n64, pos,  4);
+   hist->first  = wibDecode_extract (buf, n64, pos, 12);
+   hist->nobits = wibDecode_extract (buf, n64, pos,  4);
+   hist->nbins  = nbins;
+
+   if (nbins != WIBDECODE_K_NBINS) return WIBDECODE_K_BADHIST;
+
+
+   // ---------------------------------------------------------------
+   // Coded with the saved model, only the count of overflows is sent
+   // ---------------------------------------------------------------
+   if (format == WIBDECODE_K_FMTSAME)
+   {
+      if (model == NULL || model->nbins != nbins) return WIBDECODE_K_NOMODEL;
+
+      int novr = wibDecode_extract (buf, n64, pos, 31 - __builtin_clz (nsamples));
+      if (novr > nsamples - 1) return WIBDECODE_K_BADHIST;
+
+      memcpy (hist->table, model->table, sizeof (hist->table));
+      hist->last = model->last;
+      hist->opos = *pos;
+      *pos      += novr * hist->nobits;
+      if (*pos > end) return WIBDECODE_K_LENGTH;
+
+      return WIBDECODE_K_OK;
+   }
+
+   if (format != WIBDECODE_K_FMTFULL) return WIBDECODE_K_BADHIST;
+
+
+   // ------------------------------------------------------------
+   // Decode the bins directly into the cumulative table.
+   // table[nbins] is the total and must be nsamples - 1
+   // ------------------------------------------------------------
+   uint16_t *table = hist->table;
+   int       left  = nsamples - 1;
+   int       nbits = mbits;
+   int       total = 0;
+   int       last  = 0;
+   int       novr  = 0;
+
+   for (int ibin = 0; ibin < nbins; ibin++)
+   {
+      int cnts = left ? wibDecode_extract (buf, n64, pos, nbits) : 0;
+      if (cnts > left) return WIBDECODE_K_BADHIST;
+
+      table[ibin] = total;
+      total      += cnts;
+      left       -= cnts;
+      if (cnts)      last = ibin;
+      if (ibin == 0) novr = cnts;
+
+      nbits = left ? 32 - __builtin_clz (left) : 0;
+      if (nbits > mbits) nbits = mbits;
+   }
+   table[nbins] = total;
+   hist->last   = last;
+
+   if (left != 0) return WIBDECODE_K_BADHIST;
+
+
+   // --------------------------------------------------
+   // The overflow values precede the arithmetic coded
+   // symbols, one for each entry in bin 0
+   // --------------------------------------------------
+   hist->opos = *pos;
+   *pos      += novr * hist->nobits;
+   if (*pos > end) return WIBDECODE_K_LENGTH;
+
+   return WIBDECODE_K_OK;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Updates a channel's saved model after decoding it
+  \return The decoding status, \a status
+
+  \param[out]  model  The channel's saved model, may be NULL
+  \param[in]    hist  The histogram the channel was decoded with
+  \param[in]  status  The decoding status
+
+  \par
+   A channel that fails to decode leaves no model, so that later
+   packets referring to it fail, rather than being decoded with a
+   model the encoder never had, until the histogram is sent again.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline int wibDecode_model (WibDecodeHist        *model,
+                                   WibDecodeHist const   *hist,
+                                   int                  status)
+{
+   if (model)
+   {
+      if (status) model->nbins = 0;
+      else       *model        = *hist;
+   }
+
+   return status;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Tests whether a channel was sent raw, format 2
+  \retval != 0, the channel is raw, decode it with wibDecode_raw
+  \retval == 0, the channel is coded
+
+  \param[in]  buf  The packet
+  \param[in]  n64  The number of 64-bit words that may be read
+  \param[in]  beg  The bit offset of the channel
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline int wibDecode_isRaw (uint64_t const *buf,
+                                   uint32_t        n64,
+                                   uint32_t        beg)
+{
+   return (wibDecode_peek (buf, n64, beg) >> 60) == WIBDECODE_K_FMTRAW;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Decodes a raw channel, its header and 12-bit samples
+  \retval WIBDECODE_K_OK       if successful
+  \retval WIBDECODE_K_BADHIST  if the header is invalid
+  \retval WIBDECODE_K_LENGTH   if the channel's length does not agree
+                               with the TOC
+
+  \param[out]     adcs  The \a nsamples decoded ADCs
+  \param[in]       buf  The packet
+  \param[in]       n64  The number of 64-bit words that may be read
+  \param[in]       beg  The bit offset of the channel
+  \param[in]       end  The bit offset of the next channel
+  \param[in]  nsamples  The number of samples, a power of 2
+
+  \par
+   The channel's saved model, if any, is left as is, the encoder did
+   not replace its own.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline int wibDecode_raw (uint16_t        *adcs,
+                                 uint64_t const   *buf,
+                                 uint32_t          n64,
+                                 uint32_t          beg,
+                                 uint32_t          end,
+                                 int          nsamples)
+{
+   uint32_t pos = beg + 4;
+   int    nbins = wibDecode_extract (buf, n64, &pos,  8) + 1;
+                  wibDecode_extract (buf, n64, &pos,  4);
+   adcs[0]      = wibDecode_extract (buf, n64, &pos, 12);
+                  wibDecode_extract (buf, n64, &pos,  4);
+
+   if (nbins != WIBDECODE_K_NBINS) return WIBDECODE_K_BADHIST;
+   if (end - beg != 32 + 12 * (uint32_t)(nsamples - 1))
+   {
+      return WIBDECODE_K_LENGTH;
+   }
+
+   for (int isample = 1; isample < nsamples; isample++)
+   {
+      adcs[isample] = wibDecode_extract (buf, n64, &pos, 12);
+   }
+
+   return WIBDECODE_K_OK;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Decodes one channel
+  \retval WIBDECODE_K_OK       if successful
+  \retval WIBDECODE_K_BADHIST  if the histogram is invalid
+  \retval WIBDECODE_K_LENGTH   if the number of bits decoded does not
+                               agree with the TOC
+  \retval WIBDECODE_K_NOMODEL  if the channel uses a saved model and
+                               \a model is absent
+
+  \param[out]     adcs  The \a nsamples decoded ADCs
+  \param[in]       buf  The packet
+  \param[in]       n64  The number of 64-bit words that may be read
+  \param[in]       beg  The bit offset of the channel
+  \param[in]       end  The bit offset of the next channel
+  \param[in]  nsamples  The number of samples, a power of 2
+  \param[in,out] model  The channel's saved model, NULL if the stream
+                        does not use them. Updated with this packet's.
+
+  \par
+   This is a straight port of the test bench's decode_data and
+   APD_decode (apdtemplate.h), using the same linear search of the
+   cumulative table. It is kept as the reference for
+   wibDecode_channelFast.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline int wibDecode_channel (uint16_t        *adcs,
+                                     uint64_t const   *buf,
+                                     uint32_t          n64,
+                                     uint32_t          beg,
+                                     uint32_t          end,
+                                     int          nsamples,
+                                     WibDecodeHist    *model)
+{
+   if (wibDecode_isRaw (buf, n64, beg))
+   {
+      return wibDecode_raw (adcs, buf, n64, beg, end, nsamples);
+   }
+
+   WibDecodeHist hist;
+   uint32_t      pos = beg;
+
+   int status = wibDecode_histogram (&hist, buf, n64, &pos, end, nsamples, model);
+   if (status) return wibDecode_model (model, &hist, status);
+
+   uint16_t const *table = hist.table;
+   int             nbins = hist.nbins;
+   int             last  = hist.last;
+   int             prv   = hist.first;
+   uint32_t        opos  = hist.opos;
+
+
+   // ------------------------------------------------
+   // Set up the arithmetic decoder, the code value is
+   // 2 bits wider than the normalization
+   // ------------------------------------------------
+   int      norm  = 31 - __builtin_clz (nsamples);
+   int      cbits = norm + 2;
+   uint32_t all   = (1 << cbits) - 1;
+   uint32_t q1    =  1 << (cbits - 2);
+   uint32_t half  =  2 * q1;
+   uint32_t q3    =  3 * q1;
+
+   uint32_t lo    = 0;
+   uint32_t hi    = all;
+   uint32_t value = wibDecode_extract (buf, n64, &pos, cbits);
+   uint32_t iw    = pos >> 6;
+   int      togo  = 64 - (pos & 0x3f);
+   uint64_t word  = iw < n64 ? buf[iw] : 0;
+   uint32_t nrenorm = 0;
+
+   adcs[0] = prv;
+   for (int isample = 1; isample < nsamples; isample++)
+   {
+      uint32_t range = hi - lo + 1;
+      uint32_t cum   = (((value - lo + 1) << norm) - 1) / range;
+
+      // Same search as lookup_bot
+      int sym;
+      if (table[last] <= cum)
+      {
+         sym = last;
+      }
+      else
+      {
+         sym = 1;
+         while (table[sym] <= cum) sym++;
+         sym -= 1;
+      }
+
+      hi = lo + ((range * table[sym + 1]) >> norm) - 1;
+      lo = lo + ((range * table[sym    ]) >> norm);
+
+      while (1)
+      {
+         if      (hi <  half) { }
+         else if (lo >= half) { value -= half; lo -= half; hi -= half; }
+         else if (lo >= q1 && hi < q3)
+                              { value -= q1;   lo -= q1;   hi -= q1;   }
+         else                 break;
+
+         lo      = (lo << 1)     & all;
+         hi      = (hi << 1 | 1) & all;
+
+         if (togo == 0)
+         {
+            iw  += 1;
+            word = iw < n64 ? buf[iw] : 0;
+            togo = 64;
+         }
+         togo   -= 1;
+         value   = ((value << 1) | ((word >> togo) & 1)) & all;
+         nrenorm += 1;
+      }
+
+
+      // -------------------------------------------------
+      // Symbol 0 is the overflow bin, the actual symbol is
+      // NBins + the next overflow value
+      // -------------------------------------------------
+      if (sym == 0)
+      {
+         sym = nbins + wibDecode_extract (buf, n64, &opos, hist.nobits);
+      }
+
+      prv            += wibDecode_restore (sym);
+      adcs[isample]   = prv & 0xfff;
+   }
+
+
+   // ---------------------------------------------------------------
+   // The encoder emits one bit per renormalization plus 2 more when
+   // flushing, (the final bit plus its follow bit). pos is still just
+   // past the initial cbits of the code value.
+   // ---------------------------------------------------------------
+   status = pos - cbits + nrenorm + 2 != end ? WIBDECODE_K_LENGTH
+                                             : WIBDECODE_K_OK;
+
+   return wibDecode_model (model, &hist, status);
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief Fills the table of reciprocals used to replace the division by
+         the code range
+
+  \par
+   With m = ceil (2**34 / d), (n * m) >> 34 == n / d exactly for all
+   n < d * 2**10 and d <= 2**12, which covers every numerator and range
+   the coder can produce. The ranges at the start of a symbol are always
+   > nsamples, so entries below 5, which would not fit in 32 bits, are
+   never used when nsamples >= 4.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static uint32_t       WibDecode_recip[4 * WIBDECODE_K_MAXSAMPLES + 1];
+static pthread_once_t WibDecode_recipOnce = PTHREAD_ONCE_INIT;
+
+static void wibDecode_recipInit (void)
+{
+   for (uint32_t d = 5; d <= 4 * WIBDECODE_K_MAXSAMPLES; d++)
+   {
+      WibDecode_recip[d] = ((1ULL << 34) + d - 1) / d;
+   }
+
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Decodes one channel using precomputed tables and renormalizing
+          all the bits of a symbol at once
+  \retval WIBDECODE_K_OK       if successful
+  \retval WIBDECODE_K_BADHIST  if the histogram is invalid
+  \retval WIBDECODE_K_LENGTH   if the number of bits decoded does not
+                               agree with the TOC
+  \retval WIBDECODE_K_NOMODEL  if the channel uses a saved model and
+                               \a model is absent
+
+  \param[out]     adcs  The \a nsamples decoded ADCs
+  \param[in]       buf  The packet
+  \param[in]       n64  The number of 64-bit words that may be read
+  \param[in]       beg  The bit offset of the channel
+  \param[in]       end  The bit offset of the next channel
+  \param[in]  nsamples  The number of samples, a power of 2
+  \param[in,out] model  The channel's saved model, NULL if the stream
+                        does not use them. Updated with this packet's.
+
+  \par
+   This produces exactly the same output and status as wibDecode_channel
+   for any input, valid or not, but replaces
+
+     - the search of the cumulative table by a direct cum -> symbol
+       map built from the histogram
+     - the division forming cum by a multiply with a precomputed
+       reciprocal of the range
+     - the bit-at-a-time renormalization loop by counting the number of
+       expand low/high steps (the leading bits lo and hi agree on)
+       followed by the number of expand middle steps (the following
+       bits where lo is 1 and hi is 0) and shifting them all in at once
+       from a BitReader (BitIO.h) window.
+
+  \par
+   Each expand middle step subtracts Q1 before the shift. Modulo the
+   code value width this just toggles the top bit, and each step shifts
+   the previous toggle out, so any number of them amounts to a single
+   toggle of the top bit after the shift.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline int wibDecode_channelFast (uint16_t        *adcs,
+                                         uint64_t const   *buf,
+                                         uint32_t          n64,
+                                         uint32_t          beg,
+                                         uint32_t          end,
+                                         int          nsamples,
+                                         WibDecodeHist    *model)
+{
+   // The reciprocals are only exact for ranges >= 5
+   if (nsamples < 4)
+   {
+      return wibDecode_channel (adcs, buf, n64, beg, end, nsamples, model);
+   }
+   pthread_once (&WibDecode_recipOnce, wibDecode_recipInit);
+
+   if (wibDecode_isRaw (buf, n64, beg))
+   {
+      return wibDecode_raw (adcs, buf, n64, beg, end, nsamples);
+   }
+
+   WibDecodeHist hist;
+   uint32_t      pos = beg;
+
+   int status = wibDecode_histogram (&hist, buf, n64, &pos, end, nsamples, model);
+   if (status) return wibDecode_model (model, &hist, status);
+
+   uint16_t const *table = hist.table;
+   int             nbins = hist.nbins;
+   int             last  = hist.last;
+   int             prv   = hist.first;
+   BitReader       ovr;
+   bitReader_init (&ovr, buf, n64, hist.opos);
+
+
+   // ---------------------------------------------------------------
+   // Map every cumulative count to its symbol, this is what
+   // lookup_bot finds. Every non-empty bin owns its counts and the
+   // maximum, nsamples - 1, belongs to the last non-empty bin.
+   // ---------------------------------------------------------------
+   uint8_t syms[WIBDECODE_K_MAXSAMPLES];
+   for (int ibin = 0; ibin <= last; ibin++)
+   {
+      int cnts = table[ibin + 1] - table[ibin];
+      if (cnts) memset (syms + table[ibin], ibin, cnts);
+   }
+   syms[nsamples - 1] = last;
+
+
+   // ------------------------------------------------
+   // Set up the arithmetic decoder, the code value is
+   // 2 bits wider than the normalization
+   // ------------------------------------------------
+   int      norm     = 31 - __builtin_clz (nsamples);
+   int      cbits    = norm + 2;
+   uint32_t all      = (1 << cbits) - 1;
+   uint32_t half     =  1 << (cbits - 1);
+   uint32_t sentinel =  1 << (31 - cbits);
+   uint32_t apos     = pos;
+
+   BitReader br;
+   bitReader_init (&br, buf, n64, pos);
+
+   uint32_t value   = bitReader_read (&br, cbits);
+   uint32_t lo      = 0;
+   uint32_t hi      = all;
+   uint32_t nrenorm = 0;
+
+   adcs[0] = prv;
+   for (int isample = 1; isample < nsamples; isample++)
+   {
+      // ------------------------------------------------------------
+      // A value outside [lo, hi] can only come from a corrupt stream.
+      // It gives a cum beyond the table which lookup_bot maps to the
+      // last symbol.
+      // ------------------------------------------------------------
+      uint32_t range = hi - lo + 1;
+      uint32_t num   = ((value - lo + 1) << norm) - 1;
+      int      sym   = num < (range << norm)
+                     ? syms[(num * (uint64_t)WibDecode_recip[range]) >> 34]
+                     : last;
+
+      hi = lo + ((range * table[sym + 1]) >> norm) - 1;
+      lo = lo + ((range * table[sym    ]) >> norm);
+
+
+      // ------------------------------------------------------
+      // k1 expand low/high steps, then k3 expand middle steps
+      // ------------------------------------------------------
+      int      k1 = __builtin_clz (((lo ^ hi) << (32 - cbits)) | sentinel);
+      uint32_t l1 = lo <<  k1;
+      uint32_t h1 = (hi << k1) | ((1 << k1) - 1);
+      int      k3 = __builtin_clz (~((l1 & ~h1) << (33 - cbits)));
+      int      k  = k1 + k3;
+      uint32_t tg = k3 ? half : 0;
+
+      lo = ((l1 << k3) & all) ^ tg;
+      hi = (((h1 << k3) | ((1 << k3) - 1)) & all) ^ tg;
+
+      uint32_t bits = bitReader_read (&br, k);
+      nrenorm += k;
+      value    = (((value << k) | bits) & all) ^ tg;
+
+
+      // -------------------------------------------------
+      // Symbol 0 is the overflow bin, the actual symbol is
+      // NBins + the next overflow value
+      // -------------------------------------------------
+      if (sym == 0)
+      {
+         sym = nbins + bitReader_read (&ovr, hist.nobits);
+      }
+
+      prv            += wibDecode_restore (sym);
+      adcs[isample]   = prv & 0xfff;
+   }
+
+
+   status = apos + nrenorm + 2 != end ? WIBDECODE_K_LENGTH
+                                      : WIBDECODE_K_OK;
+
+   return wibDecode_model (model, &hist, status);
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Returns the median of 3 values
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline int wibDecode_median3 (int a, int b, int c)
+{
+   int lo = a < b ? a : b;
+   int hi = a < b ? b : a;
+   return c <= lo ? lo : c >= hi ? hi : c;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Forms the firmware's prediction of an ADC, see Predictor.h
+  \return The prediction, clamped to 0-4095
+
+  \param[in]      adcs  The restored ADCs, only samples before \a t of
+                        channel \a ichan and samples up to and including
+                        \a t of the lower numbered channels are used
+  \param[in]     pitch  The distance, in ADCs, between channels
+  \param[in]    tpitch  The distance, in ADCs, between samples, 1 for
+                        channel-major waveforms. The encoder works on
+                        time-major frames.
+  \param[in]     ichan  The channel
+  \param[in]         t  The sample, must be > 0
+  \param[in] predictor  The predictor, from the TOC
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline int wibDecode_predict (uint16_t const *adcs,
+                                     int            pitch,
+                                     int           tpitch,
+                                     int            ichan,
+                                     int                t,
+                                     int        predictor)
+{
+   uint16_t const *x = adcs + ichan * pitch + t * tpitch;
+   int           prv = x[-tpitch];
+   int             p = prv;
+
+   if (predictor == 1)
+   {
+      if (t > 1) p = 2 * prv - x[-2 * tpitch];
+   }
+   else if (predictor == 2)
+   {
+      if (ichan > 0)
+      {
+         uint16_t const *b = x - pitch;
+         p = wibDecode_median3 (prv, b[0], prv + b[0] - b[-tpitch]);
+      }
+   }
+   else if (predictor == 3)
+   {
+      int n = ichan % WIBDECODE_K_NGROUP;
+      if (n > 0)
+      {
+         uint16_t const *c1 = x - pitch;
+         int             d1 = c1[0] - c1[-tpitch];
+         int             cm = d1;
+         if (n == 2)
+         {
+            uint16_t const *c2 = c1 - pitch;
+            cm = (d1 + c2[0] - c2[-tpitch]) >> 1;
+         }
+         else if (n > 2)
+         {
+            uint16_t const *c2 = c1 - pitch;
+            uint16_t const *c3 = c2 - pitch;
+            cm = wibDecode_median3 (d1, c2[0] - c2[-tpitch], c3[0] - c3[-tpitch]);
+         }
+         p = prv + cm;
+      }
+   }
+
+   return p < 0 ? 0 : p > 0xfff ? 0xfff : p;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Undoes the predictor, in place, on a packet's decoded channels
+
+  \param[in,out] adcs  On input, the channel decoders' output, z[t], on
+                       output the ADCs
+  \param[in]    pitch  The distance, in ADCs, between channels
+  \param[in]   nchans  The number of channels
+  \param[in] nsamples  The number of samples per channel
+  \param[in]predictor  The predictor, from the TOC.  Nothing is done for
+                       the default, 0.
+
+  \par
+   The channels must be restored in ascending order, a prediction can
+   use the already restored ADCs of the lower numbered channels.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline void wibDecode_unpredict (uint16_t   *adcs,
+                                        int        pitch,
+                                        int       nchans,
+                                        int     nsamples,
+                                        int    predictor)
+{
+   if (predictor == 0) return;
+
+   for (int ichan = 0; ichan < nchans; ichan++)
+   {
+      uint16_t *x = adcs + ichan * pitch;
+      int    zprv = x[0];
+
+      for (int t = 1; t < nsamples; t++)
+      {
+         int z = x[t];
+         int p = wibDecode_predict (adcs, pitch, 1, ichan, t, predictor);
+         x[t]  = (p + z - zprv) & 0xfff;
+         zprv  = z;
+      }
+   }
+
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Decodes all the channels of a packet in the calling thread
+  \return The first error encountered or WIBDECODE_K_OK. Channels that
+          fail to decode are left with undefined contents, but decoding
+          continues with the next channel.
+
+  \param[out] adcs  The output array, channel \a ichan, tick \a t is
+                    stored at adcs[ichan * pitch + t]
+  \param[in] pitch  The distance, in ADCs, between channels, must be
+                    >= the number of samples
+  \param[in]   pkt  The compressed packet
+  \param[in]   n64  The length of the packet in 64-bit words
+  \param[out]  toc  If non-NULL, returned as the packet's TOC
+  \param[in,out]
+              models  If non-NULL, the stream's saved histogram models,
+                      updated with this packet's. Packets of a stream
+                      that uses them must be decoded in order.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline int wibDecode_packet (uint16_t        *adcs,
+                                    int             pitch,
+                                    uint64_t const   *pkt,
+                                    uint32_t          n64,
+                                    WibDecodeToc     *toc,
+                                    WibDecodeModels *models)
+{
+   WibDecodeToc lcl;
+   if (toc == NULL) toc = &lcl;
+
+   int status = wibDecode_toc (toc, pkt, n64);
+   if (status)                  return status;
+   if (pitch < toc->nsamples)   return WIBDECODE_K_PITCH;
+
+   for (int ichan = 0; ichan < toc->nchans; ichan++)
+   {
+      int err = wibDecode_channelFast (adcs + ichan * pitch,
+                                       pkt, toc->ndata,
+                                       toc->offsets[ichan],
+                                       toc->offsets[ichan + 1],
+                                       toc->nsamples,
+                                       models ? &models->hists[ichan] : NULL);
+      if (err && status == 0) status = err;
+   }
+
+   wibDecode_unpredict (adcs, pitch, toc->nchans, toc->nsamples, toc->predictor);
+
+   return status;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief Claims and decodes channels until the current set is exhausted
+
+  \param[in] pool  The decoding pool
+
+  \par
+   Channels are numbered consecutively across the jobs. Since the claim
+   counter only increases, each thread can walk its job cursor forward.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline void wibDecodePool_work (WibDecodePool *pool)
+{
+   WibDecodeJob *jobs = pool->jobs;
+   int         nitems = pool->nitems;
+   int           ijob = 0;
+   int           base = 0;
+
+   while (1)
+   {
+      int item = __sync_fetch_and_add (&pool->next, 1);
+      if (item >= nitems) break;
+
+      while (item >= base + jobs[ijob].toc.nchans)
+      {
+         base += jobs[ijob].toc.nchans;
+         ijob += 1;
+      }
+
+      WibDecodeJob       *job = jobs + ijob;
+      WibDecodeToc const *toc = &job->toc;
+      int               ichan = item - base;
+      WibDecodeHist    *model = job->models ? &job->models->hists[ichan] : NULL;
+      int                 err = wibDecode_channelFast (job->adcs + ichan * job->pitch,
+                                                       job->pkt, toc->ndata,
+                                                       toc->offsets[ichan],
+                                                       toc->offsets[ichan + 1],
+                                                       toc->nsamples, model);
+      if (err)
+      {
+         __sync_bool_compare_and_swap (&job->status, 0, err);
+         __sync_fetch_and_add         (&job->nerrs,  1);
+      }
+   }
+
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  The worker thread's body
+
+  \param[in] arg  The decoding pool
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline void *wibDecodePool_run (void *arg)
+{
+   WibDecodePool *pool = (WibDecodePool *)arg;
+   unsigned       seen = 0;
+
+   pthread_mutex_lock (&pool->mutex);
+   while (1)
+   {
+      while (pool->generation == seen && !pool->stop)
+      {
+         pthread_cond_wait (&pool->start, &pool->mutex);
+      }
+      if (pool->stop) break;
+
+      seen = pool->generation;
+      pthread_mutex_unlock (&pool->mutex);
+
+      wibDecodePool_work (pool);
+
+      pthread_mutex_lock (&pool->mutex);
+      if (--pool->nactive == 0) pthread_cond_signal (&pool->done);
+   }
+   pthread_mutex_unlock (&pool->mutex);
+
+   return NULL;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Creates a pool of decoding threads
+  \retval 0  if successful
+  \retval <0 if a thread could not be created
+
+  \param[out]    pool  The pool to create
+  \param[in] nthreads  The number of decoding threads, including the
+                       caller's. 1 decodes everything in the caller.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline int wibDecodePool_create (WibDecodePool *pool, int nthreads)
+{
+   memset (pool, 0, sizeof (*pool));
+   pthread_mutex_init (&pool->mutex, NULL);
+   pthread_cond_init  (&pool->start, NULL);
+   pthread_cond_init  (&pool->done,  NULL);
+
+   int nworkers = nthreads > 1 ? nthreads - 1 : 0;
+   if (nworkers)
+   {
+      pool->threads = (pthread_t *)malloc (nworkers * sizeof (*pool->threads));
+   }
+
+   for (int idx = 0; idx < nworkers; idx++)
+   {
+      if (pthread_create (&pool->threads[idx], NULL, wibDecodePool_run, pool))
+      {
+         wibDecodePool_destroy (pool);
+         return -1;
+      }
+      pool->nworkers += 1;
+   }
+
+   return 0;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Decodes a set of packets, spreading their channels over the
+          pool's threads
+  \return The number of packets with an error. The per packet error
+          is in each job's status.
+
+  \param[in]  pool  The decoding pool
+  \param[in]  jobs  The packets to decode
+  \param[in] njobs  The number of packets
+
+  \par
+   A packet coded with saved models needs the previous packet of its
+   stream decoded first, so a set of jobs may hold at most one packet
+   of each stream whose jobs have non-NULL models.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline int wibDecodePool_decode (WibDecodePool *pool,
+                                        WibDecodeJob  *jobs,
+                                        int           njobs)
+{
+   // -----------------------------------------------------------------
+   // Validate the TOCs up front, packets that fail contribute nothing
+   // -----------------------------------------------------------------
+   int nitems = 0;
+   for (int ijob = 0; ijob < njobs; ijob++)
+   {
+      WibDecodeJob *job = jobs + ijob;
+      job->nerrs  = 0;
+      job->status = wibDecode_toc (&job->toc, job->pkt, job->n64);
+      if (job->status == 0 && job->pitch < job->toc.nsamples)
+      {
+         job->status = WIBDECODE_K_PITCH;
+      }
+
+      if (job->status) job->toc.nchans = 0;
+      nitems += job->toc.nchans;
+   }
+
+   pthread_mutex_lock (&pool->mutex);
+   pool->jobs       = jobs;
+   pool->njobs      = njobs;
+   pool->nitems     = nitems;
+   pool->next       = 0;
+   pool->nactive    = pool->nworkers;
+   pool->generation += 1;
+   pthread_cond_broadcast (&pool->start);
+   pthread_mutex_unlock   (&pool->mutex);
+
+   wibDecodePool_work (pool);
+
+   pthread_mutex_lock (&pool->mutex);
+   while (pool->nactive) pthread_cond_wait (&pool->done, &pool->mutex);
+   pthread_mutex_unlock (&pool->mutex);
+
+
+   // ----------------------------------------------------------------
+   // Undoing a predictor crosses channels, so it waits for the whole
+   // packet. This is a cheap pass compared to the decoding.
+   // ----------------------------------------------------------------
+   int nbad = 0;
+   for (int ijob = 0; ijob < njobs; ijob++)
+   {
+      WibDecodeJob *job = jobs + ijob;
+      wibDecode_unpredict (job->adcs, job->pitch, job->toc.nchans,
+                           job->toc.nsamples, job->toc.predictor);
+      if (job->status) nbad += 1;
+   }
+
+   return nbad;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief Stops the pool's threads and frees its resources
+
+  \param[in] pool  The pool to destroy
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline void wibDecodePool_destroy (WibDecodePool *pool)
+{
+   pthread_mutex_lock     (&pool->mutex);
+   pool->stop = 1;
+   pthread_cond_broadcast (&pool->start);
+   pthread_mutex_unlock   (&pool->mutex);
+
+   for (int idx = 0; idx < pool->nworkers; idx++)
+   {
+      pthread_join (pool->threads[idx], NULL);
+   }
+
+   free (pool->threads);
+   pthread_cond_destroy  (&pool->done);
+   pthread_cond_destroy  (&pool->start);
+   pthread_mutex_destroy (&pool->mutex);
+
+   pool->threads  = NULL;
+   pool->nworkers = 0;
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+#endif
@@ -0,0 +1,1707 @@
+// -*-Mode: C;-*-
+
+#ifndef PDD_WIBENCODE_H
+#define PDD_WIBENCODE_H
+
+/* ---------------------------------------------------------------------- *//*!
+ *
+ *  @file     WibEncode.h
+ *  @brief    Reference software encoder producing the same compressed
+ *            WIB packets as the firmware's compression module
+ *  @verbatim
+ *                               Copyright 2018
+ *                                    by
+ *
+ *                       The Board of Trustees of the
+ *                    Leland Stanford Junior University.
+ *                           All rights reserved.
+ *
+ *  @endverbatim
+ *
+ *  @par Facility:
+ *  pdd
+ *
+ *  @author
+ *  <russell@slac.stanford.edu>
+ *
+ *  @par Date created:
+ *  <2018/07/26>
+ *
+ * @par Credits:
+ * SLAC
+ *
+\* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *\
+
+   HISTORY
+   -------
+
+   DATE       WHO WHAT
+   ---------- --- ---------------------------------------------------------
+   2018.08.17 jjr The raw choice's entropy is for nsamples, not 1024
+   2018.08.16 jjr A channel that would not compress is sent raw, as the
+                  firmware does, WIBENCODE_K_MAXN64 is now a hard bound
+   2018.07.31 jjr The bit stuffing is now BitIO.h's BitWriter, the
+                  channels are appended with bitWriter_copy
+   2018.07.29 jjr Added wibEncode_packetFast and the WibEncodePool, a
+                  block-wise encoder producing the same bits
+   2018.07.26 jjr Created
+
+\* ---------------------------------------------------------------------- */
+
+
+/* ---------------------------------------------------------------------- *\
+
+   This follows the firmware step for step, Histogram::bump,
+   Histogram::encode, APE_encode and write_packet, but uses the
+   straight-forward reduction of the code value limits that the
+   firmware's APE_checker uses to verify its own. It is meant as the
+   reference for testing the decoders and as a source of test packets,
+   not for speed.  See WibDecode.h for a description of the layout.
+
+   wibEncode_packetFast produces the same packets but is meant for
+   compressing in software, where there is no firmware compression or
+   when re-compressing archived data. It works on time-major ADCs, as
+   the WIB frames deliver them, in blocks of 16 channels, one front-end
+   ASIC:
+
+     - The symbols of the 16 channels are formed a sample at a time
+       with SIMD and the running maximum of the overflows is kept the
+       same way.
+     - The channels are histogrammed from the stored symbols, each
+       channel has its own bins so there are no conflicting updates.
+     - 4 channels are arithmetic coded at a time, each into its own bit
+       stream, so that their independent dependency chains overlap.
+       The code value limits are renormalized in one step for all the
+       leading bits that agree rather than bit by bit.
+
+   The channels are then appended to the packet.  The WibEncodePool
+   spreads the blocks of a set of packets over a number of threads.
+   Unlike the reference, the fast encoder supports the predictors, but
+   like it, always sends the histograms in full.
+
+   Both send a channel raw, format 2, when the firmware would, that is
+   when HistogramModel::choose's estimate of its coded size, from
+   the same table of entropies, is no smaller than the raw size, or
+   when the coded channel turns out to be larger than that.
+
+\* ---------------------------------------------------------------------- */
+
+
+#include "WibDecode.h"
+#include "BitIO.h"
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined (__SSE2__)
+#define WIBENCODE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#if defined (__ARM_NEON__) || defined (__ARM_NEON)
+#define WIBENCODE_NEON 1
+#include <arm_neon.h>
+#endif
+
+
+#define WIBENCODE_K_BLOCK  16  /*!< Channels per block, one front-end ASIC  */
+#define WIBENCODE_K_NCODE   4  /*!< Channels arithmetic coded at once       */
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \def   WIBENCODE_K_RAWBITS
+  \brief The size, in bits, of a raw channel of \a _nsamples samples.
+         No channel is larger.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+#define WIBENCODE_K_RAWBITS(_nsamples) (32u + 12u * ((_nsamples) - 1))
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \def   WIBENCODE_K_MAXN64
+  \brief The upper limit on the size, in 64-bit words, of a packet of
+         \a _nchans channels of \a _nsamples samples with \a _nhdrs
+         WIB header words
+                                                                          */
+/* ---------------------------------------------------------------------- */
+#define WIBENCODE_K_MAXN64(_nchans, _nsamples, _nhdrs)                     \
+        ((_nhdrs) + 1 + ((_nchans) + 2) / 2 + 1 + 2                        \
+        + ((_nchans) * WIBENCODE_K_RAWBITS (_nsamples) + 63) / 64)
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \def   WIBENCODE_K_CHANNELN64
+  \brief A safe upper limit on the size, in 64-bit words, of one channel
+         of \a _nsamples samples as coded, before it is checked against
+         its raw size
+                                                                          */
+/* ---------------------------------------------------------------------- */
+#define WIBENCODE_K_CHANNELN64(_nsamples)                                  \
+        ((32 + 32 * 10 + ((_nsamples) - 1) * (13 + 14) + 64 + 63) / 64)
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \typedef WibEncodeBits
+  \brief   A bit stuffer, bits are stuffed MSB first into 64-bit words,
+           see BitIO.h
+                                                                          */
+/* ---------------------------------------------------------------------- */
+typedef BitWriter WibEncodeBits;
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \struct _WibEncodeBlock
+  \brief   The encoded channels of one block, each in its own bit stream
+                                                                          *//*!
+  \typedef WibEncodeBlock
+  \brief   Typedef for struct _WibEncodeBlock
+                                                                          */
+/* ---------------------------------------------------------------------- */
+typedef struct _WibEncodeBlock
+{
+   uint64_t bufs[WIBENCODE_K_BLOCK][WIBENCODE_K_CHANNELN64 (WIBDECODE_K_MAXSAMPLES)];
+                                            /*!< The encoded channels     */
+   uint32_t nbits[WIBENCODE_K_BLOCK];       /*!< Their lengths, in bits   */
+}
+WibEncodeBlock;
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \struct _WibEncodeJob
+  \brief   One packet to be encoded by the WibEncodePool
+                                                                          *//*!
+  \typedef WibEncodeJob
+  \brief   Typedef for struct _WibEncodeJob
+                                                                          */
+/* ---------------------------------------------------------------------- */
+typedef struct _WibEncodeJob
+{
+   uint64_t             *pkt; /*!< The output packet                      */
+   uint32_t           maxn64; /*!< Its size in 64-bit words               */
+   uint16_t const      *adcs; /*!< Input, adcs[t*pitch + ichan]           */
+   int                 pitch; /*!< Distance, in ADCs, between samples     */
+   int                nchans; /*!< The number of channels                 */
+   int              nsamples; /*!< The number of samples, a power of 2    */
+   int             predictor; /*!< The predictor, 0 = previous sample     */
+   uint64_t const      *hdrs; /*!< The WIB header words                   */
+   int                 nhdrs; /*!< The number of header words             */
+   uint32_t           status; /*!< The summary status                     */
+   uint32_t              n64; /*!< Returned, the packet length, 0 if it
+                                   did not fit                            */
+}
+WibEncodeJob;
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \struct _WibEncodePool
+  \brief   A pool of threads sharing the encoding of sets of packets
+                                                                          *//*!
+  \typedef WibEncodePool
+  \brief   Typedef for struct _WibEncodePool
+                                                                          */
+/* ---------------------------------------------------------------------- */
+typedef struct _WibEncodePool
+{
+   pthread_t           *threads; /*!< The worker threads                  */
+   int                 nworkers; /*!< The number of worker threads        */
+   pthread_mutex_t        mutex; /*!< Protects the dispatch variables     */
+   pthread_cond_t         start; /*!< Signals a new set of jobs           */
+   pthread_cond_t          done; /*!< Signals all workers finished        */
+   unsigned          generation; /*!< Bumped for each new set of jobs     */
+   int                  nactive; /*!< Workers still on the current set    */
+   int                     stop; /*!< Set to terminate the workers        */
+   WibEncodeJob           *jobs; /*!< The current set of jobs             */
+   int                    njobs; /*!< The number of jobs                  */
+   int                   nitems; /*!< Total number of blocks to encode    */
+   int volatile            next; /*!< The next block to be claimed        */
+   WibEncodeBlock       *blocks; /*!< The encoded blocks, one per item    */
+   int                  nblocks; /*!< The number allocated                */
+}
+WibEncodePool;
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- */
+/* PROTOTYPES                                                             */
+/* ---------------------------------------------------------------------- */
+static inline uint32_t wibEncode_channel (WibEncodeBits           *bs,
+                                          uint16_t const        *adcs,
+                                          int                nsamples);
+
+static inline uint32_t wibEncode_packet  (uint64_t               *pkt,
+                                          uint32_t            maxn64,
+                                          uint16_t const        *adcs,
+                                          int                   pitch,
+                                          int                  nchans,
+                                          int                nsamples,
+                                          uint64_t const        *hdrs,
+                                          int                   nhdrs,
+                                          uint32_t             status);
+
+static inline void     wibEncode_block   (WibEncodeBlock         *blk,
+                                          uint16_t const        *adcs,
+                                          int                   pitch,
+                                          int                  ichan0,
+                                          int                  nchans,
+                                          int                nsamples,
+                                          int               predictor);
+
+static inline uint32_t wibEncode_packetFast
+                                         (uint64_t               *pkt,
+                                          uint32_t            maxn64,
+                                          uint16_t const        *adcs,
+                                          int                   pitch,
+                                          int                  nchans,
+                                          int                nsamples,
+                                          int               predictor,
+                                          uint64_t const        *hdrs,
+                                          int                   nhdrs,
+                                          uint32_t             status);
+
+static inline int      wibEncodePool_create  (WibEncodePool     *pool,
+                                              int            nthreads);
+static inline int      wibEncodePool_encode  (WibEncodePool     *pool,
+                                              WibEncodeJob      *jobs,
+                                              int               njobs);
+static inline void     wibEncodePool_destroy (WibEncodePool     *pool);
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief Inserts \a nbits of \a bits into the bit stream
+
+  \param[in,out]  bs  The bit stream
+  \param[in]    bits  The right justified bits to insert
+  \param[in]   nbits  The number of bits to insert, 0-64
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline void wibEncodeBits_insert (WibEncodeBits *bs,
+                                         uint64_t     bits,
+                                         int         nbits)
+{
+   bitWriter_insert (bs, bits, nbits);
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief Inserts \a bit followed by \a npending copies of its complement
+
+  \param[in,out]     bs  The bit stream
+  \param[in]        bit  The bit
+  \param[in]   npending  The number of pending bits
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline void wibEncodeBits_follow (WibEncodeBits *bs,
+                                         int            bit,
+                                         uint32_t  npending)
+{
+   bitWriter_follow (bs, bit, npending);
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Flushes any partially filled word to the output buffer
+  \return The bit index
+
+  \param[in,out]  bs  The bit stream
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline uint32_t wibEncodeBits_flush (WibEncodeBits *bs)
+{
+   return bitWriter_flush (bs);
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Returns the number of significant bits in \a val
+  \return The number of significant bits
+
+  \param[in] val  The value
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline int wibEncode_nbits (uint32_t val)
+{
+   return val ? 32 - __builtin_clz (val) : 0;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Forms the symbol to be encoded, same as Histogram::symbol
+  \return The symbol
+
+  \param[in] cur  The current  ADC
+  \param[in] prv  The previous ADC
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline int wibEncode_symbol (int cur, int prv)
+{
+   int diff = ((prv - cur) * 2) | 1;
+   return diff < 0 ? -diff + 1 : diff;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief The firmware's ETable (DuneDataCompressionHistogram.h) for 32
+         bins, entry n is n log2 (1024 / n) in units of 1/32 bits,
+         rounded. The entries are copied rather than computed, a few
+         differ by 1 from any formula, and the choice of a raw channel
+         must match the firmware's exactly.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static const uint16_t WibEncode_etable[WIBDECODE_K_MAXSAMPLES] =
+{
+       0,   320,   576,   808,  1024,  1229,  1424,  1611,  /*    0 -    7 */
+    1792,  1967,  2137,  2302,  2463,  2621,  2774,  2925,  /*    8 -   15 */
+    3072,  3216,  3358,  3497,  3634,  3768,  3901,  4031,  /*   16 -   23 */
+    4159,  4285,  4409,  4532,  4653,  4772,  4889,  5005,  /*   24 -   31 */
+    5120,  5233,  5345,  5455,  5564,  5672,  5779,  5884,  /*   32 -   39 */
+    5988,  6091,  6193,  6293,  6393,  6492,  6589,  6686,  /*   40 -   47 */
+    6782,  6876,  6970,  7063,  7154,  7245,  7336,  7425,  /*   48 -   55 */
+    7513,  7601,  7688,  7774,  7859,  7943,  8027,  8110,  /*   56 -   63 */
+    8192,  8273,  8354,  8434,  8514,  8592,  8670,  8748,  /*   64 -   71 */
+    8825,  8901,  8976,  9051,  9125,  9199,  9272,  9344,  /*   72 -   79 */
+    9416,  9487,  9558,  9628,  9697,  9766,  9835,  9903,  /*   80 -   87 */
+    9970, 10037, 10103, 10169, 10235, 10299, 10364, 10428,  /*   88 -   95 */
+   10491, 10554, 10616, 10678, 10740, 10801, 10861, 10921,  /*   96 -  103 */
+   10981, 11040, 11099, 11157, 11215, 11273, 11330, 11386,  /*  104 -  111 */
+   11442, 11498, 11554, 11609, 11663, 11717, 11771, 11825,  /*  112 -  119 */
+   11878, 11930, 11982, 12034, 12086, 12137, 12188, 12238,  /*  120 -  127 */
+   12288, 12338, 12387, 12436, 12484, 12533, 12581, 12628,  /*  128 -  135 */
+   12675, 12722, 12769, 12815, 12861, 12906, 12952, 12996,  /*  136 -  143 */
+   13041, 13085, 13129, 13173, 13216, 13259, 13302, 13344,  /*  144 -  151 */
+   13386, 13428, 13469, 13510, 13551, 13592, 13632, 13672,  /*  152 -  159 */
+   13712, 13751, 13790, 13829, 13868, 13906, 13944, 13982,  /*  160 -  167 */
+   14019, 14056, 14093, 14130, 14166, 14202, 14238, 14273,  /*  168 -  175 */
+   14308, 14343, 14378, 14413, 14447, 14481, 14515, 14548,  /*  176 -  183 */
+   14581, 14614, 14647, 14679, 14712, 14744, 14775, 14807,  /*  184 -  191 */
+   14838, 14869, 14900, 14930, 14961, 14991, 15020, 15050,  /*  192 -  199 */
+   15079, 15108, 15137, 15166, 15194, 15223, 15251, 15278,  /*  200 -  207 */
+   15306, 15333, 15360, 15387, 15414, 15440, 15466, 15492,  /*  208 -  215 */
+   15518, 15544, 15569, 15594, 15619, 15644, 15668, 15693,  /*  216 -  223 */
+   15717, 15741, 15764, 15788, 15811, 15834, 15857, 15880,  /*  224 -  231 */
+   15902, 15925, 15947, 15969, 15990, 16012, 16033, 16054,  /*  232 -  239 */
+   16075, 16096, 16116, 16137, 16157, 16177, 16197, 16216,  /*  240 -  247 */
+   16236, 16255, 16274, 16293, 16311, 16330, 16348, 16366,  /*  248 -  255 */
+   16384, 16402, 16419, 16437, 16454, 16471, 16488, 16504,  /*  256 -  263 */
+   16521, 16537, 16553, 16569, 16585, 16601, 16616, 16632,  /*  264 -  271 */
+   16647, 16662, 16676, 16691, 16706, 16720, 16734, 16748,  /*  272 -  279 */
+   16762, 16775, 16789, 16802, 16815, 16828, 16841, 16854,  /*  280 -  287 */
+   16866, 16878, 16890, 16902, 16914, 16926, 16937, 16949,  /*  288 -  295 */
+   16960, 16971, 16982, 16993, 17003, 17014, 17024, 17034,  /*  296 -  303 */
+   17044, 17054, 17064, 17073, 17083, 17092, 17101, 17110,  /*  304 -  311 */
+   17119, 17127, 17136, 17144, 17152, 17160, 17168, 17176,  /*  312 -  319 */
+   17183, 17191, 17198, 17205, 17212, 17219, 17226, 17233,  /*  320 -  327 */
+   17239, 17245, 17252, 17258, 17264, 17269, 17275, 17280,  /*  328 -  335 */
+   17286, 17291, 17296, 17301, 17306, 17311, 17315, 17319,  /*  336 -  343 */
+   17324, 17328, 17332, 17336, 17339, 17343, 17346, 17350,  /*  344 -  351 */
+   17353, 17356, 17359, 17362, 17364, 17367, 17369, 17372,  /*  352 -  359 */
+   17374, 17376, 17378, 17380, 17381, 17383, 17384, 17385,  /*  360 -  367 */
+   17387, 17388, 17388, 17389, 17390, 17390, 17391, 17391,  /*  368 -  375 */
+   17391, 17391, 17391, 17391, 17391, 17390, 17390, 17389,  /*  376 -  383 */
+   17388, 17387, 17386, 17385, 17384, 17382, 17381, 17379,  /*  384 -  391 */
+   17377, 17375, 17373, 17371, 17369, 17366, 17364, 17361,  /*  392 -  399 */
+   17359, 17356, 17353, 17350, 17347, 17343, 17340, 17336,  /*  400 -  407 */
+   17333, 17329, 17325, 17321, 17317, 17313, 17309, 17304,  /*  408 -  415 */
+   17300, 17295, 17290, 17286, 17281, 17275, 17270, 17265,  /*  416 -  423 */
+   17260, 17254, 17248, 17243, 17237, 17231, 17225, 17219,  /*  424 -  431 */
+   17212, 17206, 17200, 17193, 17186, 17180, 17173, 17166,  /*  432 -  439 */
+   17158, 17151, 17144, 17136, 17129, 17121, 17114, 17106,  /*  440 -  447 */
+   17098, 17090, 17082, 17073, 17065, 17056, 17048, 17039,  /*  448 -  455 */
+   17030, 17022, 17013, 17004, 16994, 16985, 16976, 16966,  /*  456 -  463 */
+   16957, 16947, 16937, 16927, 16917, 16907, 16897, 16887,  /*  464 -  471 */
+   16877, 16866, 16856, 16845, 16834, 16823, 16812, 16801,  /*  472 -  479 */
+   16790, 16779, 16768, 16756, 16745, 16733, 16721, 16710,  /*  480 -  487 */
+   16698, 16686, 16674, 16661, 16649, 16637, 16624, 16612,  /*  488 -  495 */
+   16599, 16586, 16573, 16560, 16547, 16534, 16521, 16508,  /*  496 -  503 */
+   16494, 16481, 16467, 16454, 16440, 16426, 16412, 16398,  /*  504 -  511 */
+   16384, 16370, 16355, 16341, 16327, 16312, 16297, 16283,  /*  512 -  519 */
+   16268, 16253, 16238, 16223, 16208, 16192, 16177, 16161,  /*  520 -  527 */
+   16146, 16130, 16115, 16099, 16083, 16067, 16051, 16035,  /*  528 -  535 */
+   16018, 16002, 15986, 15969, 15953, 15936, 15919, 15902,  /*  536 -  543 */
+   15885, 15868, 15851, 15834, 15817, 15800, 15782, 15765,  /*  544 -  551 */
+   15747, 15729, 15712, 15694, 15676, 15658, 15640, 15622,  /*  552 -  559 */
+   15603, 15585, 15566, 15548, 15529, 15511, 15492, 15473,  /*  560 -  567 */
+   15454, 15435, 15416, 15397, 15378, 15358, 15339, 15320,  /*  568 -  575 */
+   15300, 15280, 15261, 15241, 15221, 15201, 15181, 15161,  /*  576 -  583 */
+   15141, 15120, 15100, 15079, 15059, 15038, 15018, 14997,  /*  584 -  591 */
+   14976, 14955, 14934, 14913, 14892, 14871, 14850, 14828,  /*  592 -  599 */
+   14807, 14785, 14764, 14742, 14720, 14698, 14676, 14654,  /*  600 -  607 */
+   14632, 14610, 14588, 14566, 14543, 14521, 14498, 14476,  /*  608 -  615 */
+   14453, 14430, 14408, 14385, 14362, 14339, 14316, 14292,  /*  616 -  623 */
+   14269, 14246, 14222, 14199, 14175, 14152, 14128, 14104,  /*  624 -  631 */
+   14080, 14056, 14032, 14008, 13984, 13960, 13936, 13911,  /*  632 -  639 */
+   13887, 13862, 13838, 13813, 13788, 13764, 13739, 13714,  /*  640 -  647 */
+   13689, 13664, 13639, 13613, 13588, 13563, 13537, 13512,  /*  648 -  655 */
+   13486, 13461, 13435, 13409, 13383, 13357, 13331, 13305,  /*  656 -  663 */
+   13279, 13253, 13227, 13200, 13174, 13147, 13121, 13094,  /*  664 -  671 */
+   13068, 13041, 13014, 12987, 12960, 12933, 12906, 12879,  /*  672 -  679 */
+   12852, 12824, 12797, 12770, 12742, 12714, 12687, 12659,  /*  680 -  687 */
+   12631, 12604, 12576, 12548, 12520, 12492, 12463, 12435,  /*  688 -  695 */
+   12407, 12378, 12350, 12321, 12293, 12264, 12236, 12207,  /*  696 -  703 */
+   12178, 12149, 12120, 12091, 12062, 12033, 12004, 11974,  /*  704 -  711 */
+   11945, 11915, 11886, 11856, 11827, 11797, 11767, 11738,  /*  712 -  719 */
+   11708, 11678, 11648, 11618, 11588, 11557, 11527, 11497,  /*  720 -  727 */
+   11466, 11436, 11405, 11375, 11344, 11314, 11283, 11252,  /*  728 -  735 */
+   11221, 11190, 11159, 11128, 11097, 11066, 11034, 11003,  /*  736 -  743 */
+   10972, 10940, 10909, 10877, 10846, 10814, 10782, 10750,  /*  744 -  751 */
+   10718, 10686, 10654, 10622, 10590, 10558, 10526, 10494,  /*  752 -  759 */
+   10461, 10429, 10396, 10364, 10331, 10298, 10266, 10233,  /*  760 -  767 */
+   10200, 10167, 10134, 10101, 10068, 10035, 10002,  9968,  /*  768 -  775 */
+    9935,  9902,  9868,  9835,  9801,  9767,  9734,  9700,  /*  776 -  783 */
+    9666,  9632,  9598,  9564,  9530,  9496,  9462,  9428,  /*  784 -  791 */
+    9394,  9359,  9325,  9290,  9256,  9221,  9187,  9152,  /*  792 -  799 */
+    9117,  9082,  9048,  9013,  8978,  8943,  8908,  8873,  /*  800 -  807 */
+    8837,  8802,  8767,  8731,  8696,  8660,  8625,  8589,  /*  808 -  815 */
+    8554,  8518,  8482,  8446,  8410,  8375,  8339,  8302,  /*  816 -  823 */
+    8266,  8230,  8194,  8158,  8121,  8085,  8049,  8012,  /*  824 -  831 */
+    7976,  7939,  7902,  7866,  7829,  7792,  7755,  7718,  /*  832 -  839 */
+    7681,  7644,  7607,  7570,  7533,  7495,  7458,  7421,  /*  840 -  847 */
+    7383,  7346,  7308,  7271,  7233,  7195,  7157,  7120,  /*  848 -  855 */
+    7082,  7044,  7006,  6968,  6930,  6892,  6853,  6815,  /*  856 -  863 */
+    6777,  6739,  6700,  6662,  6623,  6585,  6546,  6507,  /*  864 -  871 */
+    6469,  6430,  6391,  6352,  6313,  6274,  6235,  6196,  /*  872 -  879 */
+    6157,  6118,  6078,  6039,  6000,  5960,  5921,  5881,  /*  880 -  887 */
+    5842,  5802,  5763,  5723,  5683,  5643,  5603,  5564,  /*  888 -  895 */
+    5524,  5484,  5443,  5403,  5363,  5323,  5283,  5242,  /*  896 -  903 */
+    5202,  5161,  5121,  5080,  5040,  4999,  4958,  4918,  /*  904 -  911 */
+    4877,  4836,  4795,  4754,  4713,  4672,  4631,  4590,  /*  912 -  919 */
+    4549,  4508,  4466,  4425,  4383,  4342,  4301,  4259,  /*  920 -  927 */
+    4217,  4176,  4134,  4092,  4051,  4009,  3967,  3925,  /*  928 -  935 */
+    3883,  3841,  3799,  3757,  3714,  3672,  3630,  3588,  /*  936 -  943 */
+    3545,  3503,  3460,  3418,  3375,  3332,  3290,  3247,  /*  944 -  951 */
+    3204,  3161,  3119,  3076,  3033,  2990,  2947,  2904,  /*  952 -  959 */
+    2860,  2817,  2774,  2731,  2687,  2644,  2600,  2557,  /*  960 -  967 */
+    2513,  2470,  2426,  2382,  2339,  2295,  2251,  2207,  /*  968 -  975 */
+    2163,  2119,  2075,  2031,  1987,  1943,  1899,  1854,  /*  976 -  983 */
+    1810,  1766,  1721,  1677,  1632,  1588,  1543,  1499,  /*  984 -  991 */
+    1454,  1409,  1365,  1320,  1275,  1230,  1185,  1140,  /*  992 -  999 */
+    1095,  1050,  1005,   959,   914,   869,   824,   778,  /* 1000 - 1007 */
+     733,   687,   642,   596,   551,   505,   459,   414,  /* 1008 - 1015 */
+     368,   322,   276,   230,   184,   138,    92,    46   /* 1016 - 1023 */
+};
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Decides if a channel is to be sent raw, HistogramModel::choose
+          with the saved models disabled
+  \retval != 0, the estimated coded size is no smaller than the raw size
+  \retval == 0, code the channel
+
+  \param[in]     bins  The channel's histogram
+  \param[in]   nobits  The width of its overflow values
+  \param[in] nsamples  The number of samples, a power of 2
+
+  \par
+   The estimate, in units of 1/1024 bits, is the exact size of the
+   histogram and overflows plus the entropy of the coded symbols. The
+   table is for 1024 samples, the coder normalizes to \a nsamples, so
+   each symbol costs log2 (1024 / nsamples) bits less.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline int wibEncode_isRaw (uint16_t const *bins,
+                                   int           nobits,
+                                   int         nsamples)
+{
+   int maxcnt = 0;
+   for (int ibin = 0; ibin < WIBDECODE_K_NBINS; ibin++)
+   {
+      if (bins[ibin] > maxcnt) maxcnt = bins[ibin];
+   }
+
+   int      mbits = wibEncode_nbits (maxcnt);
+   uint32_t scale = (11 - wibEncode_nbits (nsamples)) * WIBDECODE_K_NBINS;
+   uint32_t hbits = 32;
+   uint32_t ebits = 0;
+   int      total = 0;
+   for (int ibin = 0; ibin < WIBDECODE_K_NBINS; ibin++)
+   {
+      int nbits = wibEncode_nbits (nsamples - 1 - total);
+      hbits    += nbits > mbits ? mbits : nbits;
+      ebits    += WibEncode_etable[bins[ibin]] - scale * bins[ibin];
+      total    += bins[ibin];
+   }
+
+   uint32_t cost = (hbits << 10)
+                 + ebits * (1024 / WIBDECODE_K_NBINS)
+                 + ((bins[0] * nobits) << 10);
+
+   return cost >= WIBENCODE_K_RAWBITS (nsamples) << 10;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief Encodes a raw channel, its header followed by the values the
+         coder would have seen, 12 bits each
+
+  \param[in,out]   bs  The output bit stream
+  \param[in]    first  The first ADC
+  \param[in]     syms  The symbols, symbol t is syms[t * stride]
+  \param[in]   stride  The distance between symbols
+  \param[in] nsamples  The number of samples, a power of 2
+
+  \par
+   With the predictors, these values are the running sums of the
+   prediction errors, z[t] in WibDecode.h, so they are rebuilt from
+   the symbols. With the default predictor they are the ADCs.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline void wibEncode_raw (WibEncodeBits       *bs,
+                                  int               first,
+                                  uint16_t const    *syms,
+                                  int              stride,
+                                  int            nsamples)
+{
+   uint32_t hdr = (WIBDECODE_K_FMTRAW       << 28)
+                | ((WIBDECODE_K_NBINS - 1)  << 20)
+                | (first                    <<  4);
+   wibEncodeBits_insert (bs, hdr, 32);
+
+   int z = first;
+   for (int isample = 1; isample < nsamples; isample++)
+   {
+      z = (z + wibDecode_restore (syms[isample * stride])) & 0xfff;
+      wibEncodeBits_insert (bs, z, 12);
+   }
+
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Encodes one channel
+  \return The bit index of the end of the channel
+
+  \param[in,out]  bs  The output bit stream
+  \param[in]    adcs  The \a nsamples ADCs, only the lower 12 bits are
+                      used.
+  \param[in] nsamples The number of samples, a power of 2
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline uint32_t wibEncode_channel (WibEncodeBits       *bs,
+                                          uint16_t const    *adcs,
+                                          int            nsamples)
+{
+   uint16_t syms[WIBDECODE_K_MAXSAMPLES];
+   uint16_t bins[WIBDECODE_K_NBINS];
+   int      maxovr = 0;
+   int      maxcnt = 0;
+
+   // ------------------------------------------------
+   // Histogram the symbols, Histogram::bump
+   // ------------------------------------------------
+   memset (bins, 0, sizeof (bins));
+   int prv = adcs[0] & 0xfff;
+   for (int isample = 1; isample < nsamples; isample++)
+   {
+      int cur = adcs[isample] & 0xfff;
+      int sym = wibEncode_symbol (cur, prv);
+      int bin = sym;
+      prv     = cur;
+
+      if (sym >= WIBDECODE_K_NBINS)
+      {
+         int ovr = sym - WIBDECODE_K_NBINS;
+         if (ovr > maxovr) maxovr = ovr;
+         bin = 0;
+      }
+
+      syms[isample] = sym;
+      bins[bin]    += 1;
+      if (bins[bin] > maxcnt) maxcnt = bins[bin];
+   }
+
+
+   // ----------------------------------------------------------
+   // The histogram header and bins, Histogram::encode
+   //   Format(4) | NBins-1(8) | MBits(4) | First(12) | NOvr(4)
+   // ----------------------------------------------------------
+   int mbits  = wibEncode_nbits (maxcnt);
+   int nobits = wibEncode_nbits (maxovr);
+   int first  = adcs[0] & 0xfff;
+   if (wibEncode_isRaw (bins, nobits, nsamples))
+   {
+      wibEncode_raw (bs, first, syms, 1, nsamples);
+      return bs->idx;
+   }
+
+   WibEncodeBits beg = *bs;
+   uint32_t      hdr = (0                   << 28)
+                     | ((WIBDECODE_K_NBINS - 1) << 20)
+                     | (mbits                   << 16)
+                     | (first                   <<  4)
+                     | (nobits                  <<  0);
+   wibEncodeBits_insert (bs, hdr, 32);
+
+   uint16_t table[WIBDECODE_K_NBINS + 1];
+   int      total = 0;
+   for (int ibin = 0; ibin < WIBDECODE_K_NBINS; ibin++)
+   {
+      int nbits = wibEncode_nbits (nsamples - 1 - total);
+      if (nbits > mbits) nbits = mbits;
+
+      wibEncodeBits_insert (bs, bins[ibin], nbits);
+      table[ibin] = total;
+      total      += bins[ibin];
+   }
+   table[WIBDECODE_K_NBINS] = total;
+
+
+   // -------------------
+   // The overflow values
+   // -------------------
+   if (bins[0])
+   {
+      for (int isample = 1; isample < nsamples; isample++)
+      {
+         if (syms[isample] >= WIBDECODE_K_NBINS)
+         {
+            wibEncodeBits_insert (bs, syms[isample] - WIBDECODE_K_NBINS, nobits);
+         }
+      }
+   }
+
+
+   // ----------------------------------------------------
+   // The arithmetic coding, APE_encode with APE_checker's
+   // reduction of the code value limits
+   // ----------------------------------------------------
+   int      norm     = 31 - __builtin_clz (nsamples);
+   int      cbits    = norm + 2;
+   uint32_t all      = (1 << cbits) - 1;
+   uint32_t q1       =  1 << (cbits - 2);
+   uint32_t half     =  2 * q1;
+   uint32_t q3       =  3 * q1;
+   uint32_t lo       = 0;
+   uint32_t hi       = all;
+   uint32_t npending = 0;
+
+   for (int isample = 1; isample < nsamples; isample++)
+   {
+      int      idx   = syms[isample] >= WIBDECODE_K_NBINS ? 0 : syms[isample];
+      uint32_t range = hi - lo + 1;
+
+      hi = lo + ((range * table[idx + 1]) >> norm) - 1;
+      lo = lo + ((range * table[idx    ]) >> norm);
+
+      while (1)
+      {
+         if (hi < half)
+         {
+            wibEncodeBits_follow (bs, 0, npending);
+            npending = 0;
+         }
+         else if (lo >= half)
+         {
+            wibEncodeBits_follow (bs, 1, npending);
+            npending = 0;
+         }
+         else if (lo >= q1 && hi < q3)
+         {
+            npending += 1;
+            lo       -= q1;
+            hi       -= q1;
+         }
+         else
+         {
+            break;
+         }
+
+         lo = (lo << 1)     & all;
+         hi = (hi << 1 | 1) & all;
+      }
+   }
+
+
+   // APE_finish
+   wibEncodeBits_follow (bs, (lo >> (cbits - 2)) & 1, npending + 1);
+
+
+   // The coding did not pay, start over and send it raw
+   if (bs->idx - beg.idx > WIBENCODE_K_RAWBITS (nsamples))
+   {
+      *bs = beg;
+      wibEncode_raw (bs, first, syms, 1, nsamples);
+   }
+
+   return bs->idx;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Writes the record header, PacketContext::commit
+  \return The bit index of the first channel
+
+  \param[out]   pkt  The output packet
+  \param[in]   hdrs  The WIB header words
+  \param[in]  nhdrs  The number of header words
+  \param[in] status  The summary status
+
+  \par
+   The header is  status(32) | #exc(8) | n64(16) | RecType(4) | Fmt(4)
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline uint32_t wibEncode_header (uint64_t             *pkt,
+                                         uint64_t const      *hdrs,
+                                         int                 nhdrs,
+                                         uint32_t           status)
+{
+   pkt[0] = ((uint64_t)status << 32)
+          | ((uint64_t)(nhdrs + 1) << 8)
+          | (WIBDECODE_K_HDRRECTYPE << 4)
+          | (WIBDECODE_K_HDRFMT     << 0);
+   memcpy (pkt + 1, hdrs, nhdrs * sizeof (*hdrs));
+
+   return (nhdrs + 1) * 64;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Writes the TOC, write_toc, and the epilogue, epilogue
+  \return The length of the packet in 64-bit words, 0 if it did not fit
+
+  \param[out]      pkt  The output packet
+  \param[in]    maxn64  The size of \a pkt in 64-bit words
+  \param[in]   offsets  The bit offsets of the \a nchans channels,
+                        offsets[nchans] is the end of the last channel.
+                        offsets[nchans + 1] is used as padding.
+  \param[in]    nchans  The number of channels
+  \param[in]  nsamples  The number of samples
+  \param[in] predictor  The predictor
+  \param[in]    status  The summary status
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline uint32_t wibEncode_trailer (uint64_t            *pkt,
+                                          uint32_t          maxn64,
+                                          uint32_t        *offsets,
+                                          int               nchans,
+                                          int             nsamples,
+                                          int            predictor,
+                                          uint32_t          status)
+{
+   uint32_t ntoc = (nchans + 2) / 2 + 1;
+   uint32_t  odx = (offsets[nchans] + 63) >> 6;
+   if (odx + ntoc + 2 > maxn64) return 0;
+
+   offsets[nchans + 1] = 0;
+   for (int ichan = 0; ichan <= nchans; ichan += 2)
+   {
+      pkt[odx++] = offsets[ichan] | ((uint64_t)offsets[ichan + 1] << 32);
+   }
+
+   pkt[odx++] = ((uint64_t)predictor      << 52)
+              | ((uint64_t)(nchans   - 1) << 40)
+              | ((uint64_t)(nsamples - 1) << 28)
+              | (ntoc                     <<  8)
+              | (WIBDECODE_K_TOCRECTYPE   <<  4)
+              | (WIBDECODE_K_HDRFMT       <<  0);
+
+   uint32_t nbytes = odx * sizeof (uint64_t) + 2 * sizeof (uint64_t);
+   pkt[odx++] = ((uint64_t)status << 32) | (1 << 28) | (3 << 24) | nbytes;
+   pkt[odx++] = ((uint64_t)0x708b309e << 32) | (1 << 24);
+
+   return odx;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Encodes a packet of \a nchans channels
+  \return The length of the packet in 64-bit words, including the
+          epilogue. If 0, the packet did not fit in \a maxn64 words.
+
+  \param[out]     pkt  The output packet
+  \param[in]   maxn64  The size of \a pkt in 64-bit words, see
+                       WIBENCODE_K_MAXN64.
+  \param[in]     adcs  The ADCs, channel \a ichan, tick \a t is at
+                       adcs[ichan * pitch + t]
+  \param[in]    pitch  The distance, in ADCs, between channels
+  \param[in]   nchans  The number of channels
+  \param[in] nsamples  The number of samples, a power of 2, <= 1024
+  \param[in]     hdrs  The WIB header words to place in the header
+                       record. For a packet with no errors the firmware
+                       uses words 0-3 and 16-17 of the first frame.
+  \param[in]    nhdrs  The number of header words
+  \param[in]   status  The summary status
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline uint32_t wibEncode_packet (uint64_t             *pkt,
+                                         uint32_t          maxn64,
+                                         uint16_t const      *adcs,
+                                         int                 pitch,
+                                         int                nchans,
+                                         int              nsamples,
+                                         uint64_t const      *hdrs,
+                                         int                 nhdrs,
+                                         uint32_t           status)
+{
+   uint32_t ntoc = (nchans + 2) / 2 + 1;
+   if ((uint32_t)nhdrs + 1 + ntoc + 2 > maxn64) return 0;
+
+
+   // -----------------------------------------------
+   // The channels, back-to-back after the header
+   // -----------------------------------------------
+   uint32_t      offsets[WIBDECODE_K_MAXCHANNELS + 2];
+   WibEncodeBits bs;
+   bitWriter_init (&bs, pkt, maxn64, wibEncode_header (pkt, hdrs, nhdrs, status));
+
+   for (int ichan = 0; ichan < nchans; ichan++)
+   {
+      offsets[ichan] = bs.idx;
+      wibEncode_channel (&bs, adcs + ichan * pitch, nsamples);
+   }
+   offsets[nchans] = wibEncodeBits_flush (&bs);
+
+   return wibEncode_trailer (pkt, maxn64, offsets, nchans, nsamples, 0, status);
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ====================================================================== */
+/* THE FAST ENCODER                                                       */
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief Forms the symbols of one sample of a full block of channels
+
+  \param[out]     syms  The 16 symbols
+  \param[in,out]  movr  The running maximum of the overflows, sym - 32
+  \param[in]       cur  The 16 current ADCs
+  \param[in]       ref  The 16 previous ADCs or predictions
+  \param[in]   modular  If non-zero, the difference is taken modulo 4096,
+                        Histogram::symbol_mod, else Histogram::symbol
+
+  \par
+   With d = ref - cur, the symbol, 2d+1 if d >= 0 else -2d, is
+   ((d << 1) ^ (d >> 15)) + 1 in 16-bit arithmetic.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+#if WIBENCODE_SSE2
+static inline void wibEncode_symbols16 (uint16_t       syms[WIBENCODE_K_BLOCK],
+                                        uint16_t       movr[WIBENCODE_K_BLOCK],
+                                        uint16_t const  cur[WIBENCODE_K_BLOCK],
+                                        uint16_t const  ref[WIBENCODE_K_BLOCK],
+                                        int                           modular)
+{
+   __m128i msk = _mm_set1_epi16 (0xfff);
+   __m128i one = _mm_set1_epi16 (1);
+   __m128i nbn = _mm_set1_epi16 (WIBDECODE_K_NBINS);
+
+   for (int idx = 0; idx < WIBENCODE_K_BLOCK; idx += 8)
+   {
+      __m128i c = _mm_and_si128 (_mm_loadu_si128 ((__m128i const *)(cur + idx)), msk);
+      __m128i r = _mm_and_si128 (_mm_loadu_si128 ((__m128i const *)(ref + idx)), msk);
+      __m128i d = _mm_sub_epi16 (r, c);
+      if (modular) d = _mm_srai_epi16 (_mm_slli_epi16 (d, 4), 4);
+
+      __m128i s = _mm_add_epi16 (_mm_xor_si128 (_mm_slli_epi16 (d, 1),
+                                                _mm_srai_epi16 (d, 15)), one);
+      __m128i m = _mm_loadu_si128 ((__m128i const *)(movr + idx));
+      m         = _mm_max_epi16   (m, _mm_subs_epu16 (s, nbn));
+
+      _mm_storeu_si128 ((__m128i *)(syms + idx), s);
+      _mm_storeu_si128 ((__m128i *)(movr + idx), m);
+   }
+
+   return;
+}
+#elif WIBENCODE_NEON
+static inline void wibEncode_symbols16 (uint16_t       syms[WIBENCODE_K_BLOCK],
+                                        uint16_t       movr[WIBENCODE_K_BLOCK],
+                                        uint16_t const  cur[WIBENCODE_K_BLOCK],
+                                        uint16_t const  ref[WIBENCODE_K_BLOCK],
+                                        int                           modular)
+{
+   uint16x8_t msk = vdupq_n_u16 (0xfff);
+   uint16x8_t nbn = vdupq_n_u16 (WIBDECODE_K_NBINS);
+
+   for (int idx = 0; idx < WIBENCODE_K_BLOCK; idx += 8)
+   {
+      int16x8_t c = vreinterpretq_s16_u16 (vandq_u16 (vld1q_u16 (cur + idx), msk));
+      int16x8_t r = vreinterpretq_s16_u16 (vandq_u16 (vld1q_u16 (ref + idx), msk));
+      int16x8_t d = vsubq_s16 (r, c);
+      if (modular) d = vshrq_n_s16 (vshlq_n_s16 (d, 4), 4);
+
+      uint16x8_t s = vreinterpretq_u16_s16 (
+                     vaddq_s16 (veorq_s16 (vshlq_n_s16 (d, 1), vshrq_n_s16 (d, 15)),
+                                vdupq_n_s16 (1)));
+      uint16x8_t m = vmaxq_u16 (vld1q_u16 (movr + idx), vqsubq_u16 (s, nbn));
+
+      vst1q_u16 (syms + idx, s);
+      vst1q_u16 (movr + idx, m);
+   }
+
+   return;
+}
+#endif
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief Forms the symbols of one sample of a partial block of channels,
+         same as wibEncode_symbols16
+
+  \param[in]    nchans  The number of channels in the block
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline void wibEncode_symbolsN (uint16_t       syms[WIBENCODE_K_BLOCK],
+                                       uint16_t       movr[WIBENCODE_K_BLOCK],
+                                       uint16_t const                   *cur,
+                                       uint16_t const                   *ref,
+                                       int                            nchans,
+                                       int                           modular)
+{
+   for (int idx = 0; idx < nchans; idx++)
+   {
+      int d = (ref[idx] & 0xfff) - (cur[idx] & 0xfff);
+      if (modular) d = (int16_t)(d << 4) >> 4;
+
+      int sym   = d >= 0 ? 2 * d + 1 : -2 * d;
+      int ovr   = sym - WIBDECODE_K_NBINS;
+      syms[idx] = sym;
+      if (ovr > movr[idx]) movr[idx] = ovr;
+   }
+
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \struct _WibEncodeAc
+  \brief   The state of one channel's arithmetic coder
+                                                                          *//*!
+  \typedef WibEncodeAc
+  \brief   Typedef for struct _WibEncodeAc
+                                                                          */
+/* ---------------------------------------------------------------------- */
+typedef struct _WibEncodeAc
+{
+   uint32_t           lo; /*!< The lower code value limit                 */
+   uint32_t           hi; /*!< The upper code value limit                 */
+   uint32_t     npending; /*!< Bits pending the next resolved bit         */
+}
+WibEncodeAc;
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief Arithmetic codes one symbol, same as wibEncode_channel's loop
+
+  \param[in,out]  ac  The coder state
+  \param[in,out]  bs  The channel's bit stream
+  \param[in]   table  The cumulative table
+  \param[in]     sym  The symbol
+  \param[in]    norm  log2 of the number of samples
+
+  \par
+   All the leading bits on which lo and hi agree are output and shifted
+   out at once. After that lo < half <= hi, so only the middle-straddle
+   case remains, and it cannot be followed by another agreeing bit. The
+   straddle steps are also taken at once. This leaves no data dependent
+   loops, whose mispredicted branches dominate the reference's time.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline void wibEncode_code (WibEncodeAc       *ac,
+                                   WibEncodeBits     *bs,
+                                   uint16_t const *table,
+                                   int               sym,
+                                   int              norm)
+{
+   int      cbits = norm + 2;
+   uint32_t all   = (1 << cbits) - 1;
+   uint32_t q1    =  1 << (cbits - 2);
+   int      idx   = sym >= WIBDECODE_K_NBINS ? 0 : sym;
+   uint32_t range = ac->hi - ac->lo + 1;
+   uint32_t lo    = ac->lo + ((range * table[idx    ]) >> norm);
+   uint32_t hi    = ac->lo + ((range * table[idx + 1]) >> norm) - 1;
+
+   // The number of leading bits that agree, cbits if all do
+   int nsame = __builtin_clz (((lo ^ hi) << (32 - cbits)) | (1 << (31 - cbits)));
+   if (nsame)
+   {
+      if (ac->npending)
+      {
+         wibEncodeBits_follow (bs, (lo >> (cbits - 1)) & 1, ac->npending);
+         wibEncodeBits_insert (bs, lo >> (cbits - nsame), nsame - 1);
+         ac->npending = 0;
+      }
+      else
+      {
+         wibEncodeBits_insert (bs, lo >> (cbits - nsame), nsame);
+      }
+
+      lo = (lo << nsame) & all;
+      hi = ((hi << nsame) | ((1 << nsame) - 1)) & all;
+   }
+
+   // -------------------------------------------------------------
+   // Each straddle step, lo = 01..., hi = 10..., drops the second
+   // bit of both. The number of steps is the number of leading 1s
+   // of lo below its first bit that are matched by 0s in hi.
+   // -------------------------------------------------------------
+   uint32_t straddle = (lo << (33 - cbits)) & ~(hi << (33 - cbits));
+   int      nstep    = __builtin_clz (~straddle);
+
+   ac->npending += nstep;
+   lo = (lo << nstep) & (all >> 1);
+   hi = (((hi << nstep) | ((1 << nstep) - 1)) & all) | (2 * q1);
+
+   ac->lo = lo;
+   ac->hi = hi;
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief Encodes a block of up to 16 channels, each into its own bit
+         stream
+
+  \param[out]     blk  The encoded channels
+  \param[in]     adcs  The ADCs, channel \a ichan, tick \a t is at
+                       adcs[t * pitch + ichan]. These are 12-bit values.
+  \param[in]    pitch  The distance, in ADCs, between samples
+  \param[in]   ichan0  The first channel of the block
+  \param[in]   nchans  The number of channels in the block, <= 16
+  \param[in] nsamples  The number of samples, a power of 2, <= 1024
+  \param[in]predictor  The predictor, see Predictor.h
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline void wibEncode_block (WibEncodeBlock      *blk,
+                                    uint16_t const     *adcs,
+                                    int                pitch,
+                                    int               ichan0,
+                                    int               nchans,
+                                    int             nsamples,
+                                    int            predictor)
+{
+   uint16_t syms[WIBDECODE_K_MAXSAMPLES][WIBENCODE_K_BLOCK];
+   uint16_t bins[WIBENCODE_K_BLOCK][WIBDECODE_K_NBINS];
+   uint16_t table[WIBENCODE_K_BLOCK][WIBDECODE_K_NBINS + 1];
+   uint16_t movr[WIBENCODE_K_BLOCK];
+   uint16_t prd [WIBENCODE_K_BLOCK];
+   uint8_t  raw [WIBENCODE_K_BLOCK];
+   int      modular = predictor != 0;
+
+
+   // -----------------------------------------------------------
+   // Form the symbols, a sample of the whole block at a time
+   // -----------------------------------------------------------
+   memset (movr, 0, sizeof (movr));
+   for (int t = 1; t < nsamples; t++)
+   {
+      uint16_t const *cur = adcs + t * pitch + ichan0;
+      uint16_t const *ref = cur - pitch;
+
+      if (modular)
+      {
+         for (int idx = 0; idx < nchans; idx++)
+         {
+            prd[idx] = wibDecode_predict (adcs, 1, pitch, ichan0 + idx, t,
+                                          predictor);
+         }
+         ref = prd;
+      }
+
+#if WIBENCODE_SSE2 || WIBENCODE_NEON
+      if (nchans == WIBENCODE_K_BLOCK)
+      {
+         wibEncode_symbols16 (syms[t], movr, cur, ref, modular);
+         continue;
+      }
+#endif
+      wibEncode_symbolsN (syms[t], movr, cur, ref, nchans, modular);
+   }
+
+
+   // ---------------------------------------------------------
+   // Histogram them, each channel has its own bins
+   // ---------------------------------------------------------
+   memset (bins, 0, sizeof (bins));
+   for (int t = 1; t < nsamples; t++)
+   {
+      for (int idx = 0; idx < nchans; idx++)
+      {
+         int sym = syms[t][idx];
+         bins[idx][sym < WIBDECODE_K_NBINS ? sym : 0] += 1;
+      }
+   }
+
+
+   // ----------------------------------------------------------
+   // The histogram headers, bins and overflows, as the reference.
+   // The channels that will not compress are sent raw now.
+   // ----------------------------------------------------------
+   WibEncodeBits bs[WIBENCODE_K_BLOCK];
+   for (int idx = 0; idx < nchans; idx++)
+   {
+      WibEncodeBits *b = &bs[idx];
+      bitWriter_init (b, blk->bufs[idx],
+                      WIBENCODE_K_CHANNELN64 (WIBDECODE_K_MAXSAMPLES), 0);
+
+      int nobits = wibEncode_nbits (movr[idx]);
+      int first  = adcs[ichan0 + idx] & 0xfff;
+      raw[idx]   = wibEncode_isRaw (bins[idx], nobits, nsamples);
+      if (raw[idx])
+      {
+         wibEncode_raw (b, first, &syms[0][idx], WIBENCODE_K_BLOCK, nsamples);
+         blk->nbits[idx] = wibEncodeBits_flush (b);
+         continue;
+      }
+
+      int maxcnt = 0;
+      for (int ibin = 0; ibin < WIBDECODE_K_NBINS; ibin++)
+      {
+         if (bins[idx][ibin] > maxcnt) maxcnt = bins[idx][ibin];
+      }
+
+      int mbits  = wibEncode_nbits (maxcnt);
+      uint32_t hdr = (WIBDECODE_K_FMTFULL      << 28)
+                   | ((WIBDECODE_K_NBINS - 1)  << 20)
+                   | (mbits                    << 16)
+                   | (first                    <<  4)
+                   | (nobits                   <<  0);
+      wibEncodeBits_insert (b, hdr, 32);
+
+      int total = 0;
+      for (int ibin = 0; ibin < WIBDECODE_K_NBINS; ibin++)
+      {
+         int nbits = wibEncode_nbits (nsamples - 1 - total);
+         if (nbits > mbits) nbits = mbits;
+
+         wibEncodeBits_insert (b, bins[idx][ibin], nbits);
+         table[idx][ibin] = total;
+         total           += bins[idx][ibin];
+      }
+      table[idx][WIBDECODE_K_NBINS] = total;
+
+      if (bins[idx][0])
+      {
+         for (int t = 1; t < nsamples; t++)
+         {
+            int sym = syms[t][idx];
+            if (sym >= WIBDECODE_K_NBINS)
+            {
+               wibEncodeBits_insert (b, sym - WIBDECODE_K_NBINS, nobits);
+            }
+         }
+      }
+   }
+
+
+   // -----------------------------------------------------------
+   // The arithmetic coding, WIBENCODE_K_NCODE channels at a time
+   // -----------------------------------------------------------
+   int norm  = 31 - __builtin_clz (nsamples);
+   int cbits = norm + 2;
+   for (int idx0 = 0; idx0 < nchans; idx0 += WIBENCODE_K_NCODE)
+   {
+      WibEncodeAc ac[WIBENCODE_K_NCODE];
+      int          n = nchans - idx0;
+      if (n > WIBENCODE_K_NCODE) n = WIBENCODE_K_NCODE;
+
+      for (int k = 0; k < n; k++)
+      {
+         ac[k].lo       = 0;
+         ac[k].hi       = (1 << cbits) - 1;
+         ac[k].npending = 0;
+      }
+
+      int nraw = 0;
+      for (int k = 0; k < n; k++) nraw += raw[idx0 + k];
+
+      if (n == WIBENCODE_K_NCODE && nraw == 0)
+      {
+         // Copied to locals so that the coders' state can stay in registers
+         WibEncodeAc   a0 = ac[0],        a1 = ac[1];
+         WibEncodeAc   a2 = ac[2],        a3 = ac[3];
+         WibEncodeBits b0 = bs[idx0 + 0], b1 = bs[idx0 + 1];
+         WibEncodeBits b2 = bs[idx0 + 2], b3 = bs[idx0 + 3];
+         uint16_t const *sym = syms[1] + idx0;
+
+         for (int t = 1; t < nsamples; t++, sym += WIBENCODE_K_BLOCK)
+         {
+            wibEncode_code (&a0, &b0, table[idx0 + 0], sym[0], norm);
+            wibEncode_code (&a1, &b1, table[idx0 + 1], sym[1], norm);
+            wibEncode_code (&a2, &b2, table[idx0 + 2], sym[2], norm);
+            wibEncode_code (&a3, &b3, table[idx0 + 3], sym[3], norm);
+         }
+
+         ac[0]        = a0;  ac[1]        = a1;
+         ac[2]        = a2;  ac[3]        = a3;
+         bs[idx0 + 0] = b0;  bs[idx0 + 1] = b1;
+         bs[idx0 + 2] = b2;  bs[idx0 + 3] = b3;
+      }
+      else
+      {
+         for (int k = 0; k < n; k++)
+         {
+            if (raw[idx0 + k]) continue;
+            for (int t = 1; t < nsamples; t++)
+            {
+               wibEncode_code (&ac[k], &bs[idx0 + k], table[idx0 + k],
+                               syms[t][idx0 + k], norm);
+            }
+         }
+      }
+
+      // APE_finish, if the coding did not pay, send the channel raw
+      for (int k = 0; k < n; k++)
+      {
+         int            idx = idx0 + k;
+         WibEncodeBits   *b = &bs[idx];
+         if (raw[idx]) continue;
+
+         wibEncodeBits_follow (b, (ac[k].lo >> (cbits - 2)) & 1, ac[k].npending + 1);
+         if (b->idx > WIBENCODE_K_RAWBITS (nsamples))
+         {
+            bitWriter_init (b, blk->bufs[idx],
+                            WIBENCODE_K_CHANNELN64 (WIBDECODE_K_MAXSAMPLES), 0);
+            wibEncode_raw  (b, adcs[ichan0 + idx] & 0xfff, &syms[0][idx],
+                            WIBENCODE_K_BLOCK, nsamples);
+         }
+         blk->nbits[idx] = wibEncodeBits_flush (b);
+      }
+   }
+
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief Appends the encoded channels of a block to the packet
+
+  \param[in,out]    bs  The packet's bit stream
+  \param[out]  offsets  Returned as the bit offsets of the channels
+  \param[in]       blk  The encoded block
+  \param[in]    nchans  The number of channels in the block
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline void wibEncode_append (WibEncodeBits            *bs,
+                                     uint32_t            *offsets,
+                                     WibEncodeBlock const    *blk,
+                                     int                   nchans)
+{
+   for (int idx = 0; idx < nchans; idx++)
+   {
+      offsets[idx] = bs->idx;
+      bitWriter_copy (bs, blk->bufs[idx], blk->nbits[idx]);
+   }
+
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Encodes a packet of \a nchans channels from time-major ADCs
+  \return The length of the packet in 64-bit words, including the
+          epilogue. If 0, the packet did not fit in \a maxn64 words.
+
+  \param[out]      pkt  The output packet
+  \param[in]    maxn64  The size of \a pkt in 64-bit words, see
+                        WIBENCODE_K_MAXN64.
+  \param[in]      adcs  The ADCs, channel \a ichan, tick \a t is at
+                        adcs[t * pitch + ichan]. These are 12-bit values.
+  \param[in]     pitch  The distance, in ADCs, between samples
+  \param[in]    nchans  The number of channels
+  \param[in]  nsamples  The number of samples, a power of 2, <= 1024
+  \param[in] predictor  The predictor, see Predictor.h
+  \param[in]      hdrs  The WIB header words, see wibEncode_packet
+  \param[in]     nhdrs  The number of header words
+  \param[in]    status  The summary status
+
+  \par
+   This uses about 100 Kbytes of stack.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline uint32_t wibEncode_packetFast (uint64_t             *pkt,
+                                             uint32_t          maxn64,
+                                             uint16_t const      *adcs,
+                                             int                 pitch,
+                                             int                nchans,
+                                             int              nsamples,
+                                             int             predictor,
+                                             uint64_t const      *hdrs,
+                                             int                 nhdrs,
+                                             uint32_t           status)
+{
+   uint32_t ntoc = (nchans + 2) / 2 + 1;
+   if ((uint32_t)nhdrs + 1 + ntoc + 2 > maxn64) return 0;
+
+   uint32_t      offsets[WIBDECODE_K_MAXCHANNELS + 2];
+   WibEncodeBlock    blk;
+   WibEncodeBits      bs;
+   bitWriter_init (&bs, pkt, maxn64, wibEncode_header (pkt, hdrs, nhdrs, status));
+
+   for (int ichan = 0; ichan < nchans; ichan += WIBENCODE_K_BLOCK)
+   {
+      int n = nchans - ichan;
+      if (n > WIBENCODE_K_BLOCK) n = WIBENCODE_K_BLOCK;
+
+      wibEncode_block  (&blk, adcs, pitch, ichan, n, nsamples, predictor);
+      wibEncode_append (&bs, offsets + ichan, &blk, n);
+   }
+   offsets[nchans] = wibEncodeBits_flush (&bs);
+
+   return wibEncode_trailer (pkt, maxn64, offsets, nchans, nsamples,
+                             predictor, status);
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief Claims and encodes blocks until the current set is exhausted
+
+  \param[in] pool  The encoding pool
+
+  \par
+   Blocks are numbered consecutively across the jobs, block i is
+   encoded into pool->blocks[i].
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline void wibEncodePool_work (WibEncodePool *pool)
+{
+   WibEncodeJob *jobs = pool->jobs;
+   int         nitems = pool->nitems;
+   int           ijob = 0;
+   int           base = 0;
+
+   while (1)
+   {
+      int item = __sync_fetch_and_add (&pool->next, 1);
+      if (item >= nitems) break;
+
+      while (item >= base + (jobs[ijob].nchans + WIBENCODE_K_BLOCK - 1)
+                          / WIBENCODE_K_BLOCK)
+      {
+         base += (jobs[ijob].nchans + WIBENCODE_K_BLOCK - 1) / WIBENCODE_K_BLOCK;
+         ijob += 1;
+      }
+
+      WibEncodeJob const *job = jobs + ijob;
+      int               ichan = (item - base) * WIBENCODE_K_BLOCK;
+      int                   n = job->nchans - ichan;
+      if (n > WIBENCODE_K_BLOCK) n = WIBENCODE_K_BLOCK;
+
+      wibEncode_block (&pool->blocks[item], job->adcs, job->pitch,
+                       ichan, n, job->nsamples, job->predictor);
+   }
+
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  The worker thread's body
+
+  \param[in] arg  The encoding pool
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline void *wibEncodePool_run (void *arg)
+{
+   WibEncodePool *pool = (WibEncodePool *)arg;
+   unsigned       seen = 0;
+
+   pthread_mutex_lock (&pool->mutex);
+   while (1)
+   {
+      while (pool->generation == seen && !pool->stop)
+      {
+         pthread_cond_wait (&pool->start, &pool->mutex);
+      }
+      if (pool->stop) break;
+
+      seen = pool->generation;
+      pthread_mutex_unlock (&pool->mutex);
+
+      wibEncodePool_work (pool);
+
+      pthread_mutex_lock (&pool->mutex);
+      if (--pool->nactive == 0) pthread_cond_signal (&pool->done);
+   }
+   pthread_mutex_unlock (&pool->mutex);
+
+   return NULL;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Creates a pool of encoding threads
+  \retval 0  if successful
+  \retval <0 if a thread could not be created
+
+  \param[out]    pool  The pool to create
+  \param[in] nthreads  The number of encoding threads, including the
+                       caller's. 1 encodes everything in the caller.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline int wibEncodePool_create (WibEncodePool *pool, int nthreads)
+{
+   memset (pool, 0, sizeof (*pool));
+   pthread_mutex_init (&pool->mutex, NULL);
+   pthread_cond_init  (&pool->start, NULL);
+   pthread_cond_init  (&pool->done,  NULL);
+
+   int nworkers = nthreads > 1 ? nthreads - 1 : 0;
+   if (nworkers)
+   {
+      pool->threads = (pthread_t *)malloc (nworkers * sizeof (*pool->threads));
+   }
+
+   for (int idx = 0; idx < nworkers; idx++)
+   {
+      if (pthread_create (&pool->threads[idx], NULL, wibEncodePool_run, pool))
+      {
+         wibEncodePool_destroy (pool);
+         return -1;
+      }
+      pool->nworkers += 1;
+   }
+
+   return 0;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Encodes a set of packets, spreading their blocks of channels
+          over the pool's threads
+  \return The number of packets that did not fit, their n64 is 0, or
+          -1 if the block storage could not be allocated
+
+  \param[in]  pool  The encoding pool
+  \param[in]  jobs  The packets to encode
+  \param[in] njobs  The number of packets
+
+  \par
+   The blocks are encoded in parallel, then the caller appends them to
+   their packets.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline int wibEncodePool_encode (WibEncodePool *pool,
+                                        WibEncodeJob  *jobs,
+                                        int           njobs)
+{
+   int nitems = 0;
+   for (int ijob = 0; ijob < njobs; ijob++)
+   {
+      nitems += (jobs[ijob].nchans + WIBENCODE_K_BLOCK - 1) / WIBENCODE_K_BLOCK;
+   }
+
+   if (nitems > pool->nblocks)
+   {
+      WibEncodeBlock *blocks = (WibEncodeBlock *)
+                               realloc (pool->blocks, nitems * sizeof (*blocks));
+      if (blocks == NULL) return -1;
+
+      pool->blocks  = blocks;
+      pool->nblocks = nitems;
+   }
+
+   pthread_mutex_lock (&pool->mutex);
+   pool->jobs       = jobs;
+   pool->njobs      = njobs;
+   pool->nitems     = nitems;
+   pool->next       = 0;
+   pool->nactive    = pool->nworkers;
+   pool->generation += 1;
+   pthread_cond_broadcast (&pool->start);
+   pthread_mutex_unlock   (&pool->mutex);
+
+   wibEncodePool_work (pool);
+
+   pthread_mutex_lock (&pool->mutex);
+   while (pool->nactive) pthread_cond_wait (&pool->done, &pool->mutex);
+   pthread_mutex_unlock (&pool->mutex);
+
+
+   // ----------------------------------------------------------
+   // Assemble the packets, the offsets depend on all the blocks
+   // ----------------------------------------------------------
+   WibEncodeBlock const *blk = pool->blocks;
+   int                 nfail = 0;
+   for (int ijob = 0; ijob < njobs; ijob++)
+   {
+      WibEncodeJob *job = jobs + ijob;
+      uint32_t     ntoc = (job->nchans + 2) / 2 + 1;
+      int       nblocks = (job->nchans + WIBENCODE_K_BLOCK - 1) / WIBENCODE_K_BLOCK;
+
+      job->n64 = 0;
+      if ((uint32_t)job->nhdrs + 1 + ntoc + 2 > job->maxn64)
+      {
+         blk   += nblocks;
+         nfail += 1;
+         continue;
+      }
+
+      uint32_t      offsets[WIBDECODE_K_MAXCHANNELS + 2];
+      WibEncodeBits bs;
+      bitWriter_init (&bs, job->pkt, job->maxn64,
+                      wibEncode_header (job->pkt, job->hdrs, job->nhdrs,
+                                        job->status));
+
+      for (int ichan = 0; ichan < job->nchans; ichan += WIBENCODE_K_BLOCK)
+      {
+         int n = job->nchans - ichan;
+         if (n > WIBENCODE_K_BLOCK) n = WIBENCODE_K_BLOCK;
+         wibEncode_append (&bs, offsets + ichan, blk++, n);
+      }
+      offsets[job->nchans] = wibEncodeBits_flush (&bs);
+
+      job->n64 = wibEncode_trailer (job->pkt, job->maxn64, offsets,
+                                    job->nchans, job->nsamples,
+                                    job->predictor, job->status);
+      if (job->n64 == 0) nfail += 1;
+   }
+
+   return nfail;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief Stops the pool's threads and frees its resources
+
+  \param[in] pool  The pool to destroy
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline void wibEncodePool_destroy (WibEncodePool *pool)
+{
+   pthread_mutex_lock     (&pool->mutex);
+   pool->stop = 1;
+   pthread_cond_broadcast (&pool->start);
+   pthread_mutex_unlock   (&pool->mutex);
+
+   for (int idx = 0; idx < pool->nworkers; idx++)
+   {
+      pthread_join (pool->threads[idx], NULL);
+   }
+
+   free (pool->threads);
+   free (pool->blocks);
+   pthread_cond_destroy  (&pool->done);
+   pthread_cond_destroy  (&pool->start);
+   pthread_mutex_destroy (&pool->mutex);
+
+   pool->threads  = NULL;
+   pool->nworkers = 0;
+   pool->blocks   = NULL;
+   pool->nblocks  = 0;
+   return;
+}
+/* ====================================================================== */
+
+#endif
@@ -0,0 +1,1135 @@
+// -*-Mode: C;-*-
+
+#ifndef PDD_WIBGENERATE_H
+#define PDD_WIBGENERATE_H
+
+/* ---------------------------------------------------------------------- *//*!
+ *
+ *  @file     WibGenerate.h
+ *  @brief    Generates synthetic WIB frames and timing messages for
+ *            emulation, benchmarks and load tests
+ *  @verbatim
+ *                               Copyright 2018
+ *                                    by
+ *
+ *                       The Board of Trustees of the
+ *                    Leland Stanford Junior University.
+ *                           All rights reserved.
+ *
+ *  @endverbatim
+ *
+ *  @par Facility:
+ *  pdd
+ *
+ *  @author
+ *  <russell@slac.stanford.edu>
+ *
+ *  @par Date created:
+ *  <2018/07/31>
+ *
+ * @par Credits:
+ * SLAC
+ *
+\* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *\
+
+   HISTORY
+   -------
+
+   DATE       WHO WHAT
+   ---------- --- ---------------------------------------------------------
+   2018.07.31 jjr Created, the signal model of the compression test bench
+                  pulled out of the firmware tree and extended
+
+\* ---------------------------------------------------------------------- */
+
+
+/* ---------------------------------------------------------------------- *\
+
+   THE MODEL
+   ---------
+   Each frame is one tick of 128 channels. A channel's ADC is
+
+      pedestal + white + coherent + tracks
+
+   clamped to 12 bits, then possibly corrupted by a stuck code.
+
+     pedestal  Fixed per channel, uniform in [ped_min, ped_max]
+     white     Independent per channel and tick. The RMS is noise,
+               varied per channel by +/- noise_spread, up to 75 ADC. It
+               is the sum of 4 random nibbles, close to a gaussian but
+               cut off at 3.25 sigma.
+     coherent  Shared by each group of coherent_group channels, a first
+               order autoregressive process, so low frequency, with an
+               RMS of coherent and a tick to tick correlation of
+               coherent_corr.
+     tracks    Started at random, track_rate per second. A track crosses
+               a run of channels at a constant number of ticks per
+               channel, depositing a unipolar, collection-like, or a
+               bipolar, induction-like, pulse on each.
+     stuck     A stuck_fraction of the channels have their low 6 bits
+               stuck at 0x00 or 0x3f on a stuck_probability of their
+               samples, as the FE ADCs do.
+
+   Errors are injected after the frame is built, on error_rate of the
+   frames, choosing among the kinds enabled in error_kinds: a non-zero
+   WIB error word, colddata error bits, a flipped ADC bit or a glitched
+   timestamp.
+
+   The white noise, the bulk of the work, uses a xoshiro128++ generator
+   run as 4 independent lanes in a 128-bit vector, two such generators
+   being alternated so that their updates overlap. The channels are
+   then done 8 at a time in 16-bit lanes. All this is written with the
+   compiler's vector extensions, so it maps onto SSE2 and NEON without
+   any intrinsics. Everything else is done per group, per track or per
+   frame.
+
+   TIMING MESSAGES
+   ---------------
+   wibGenerate_timing returns the messages the timing system would have
+   sent up to the latest frame, in the layout DaqBuffer reads: a run
+   start at the first frame, then triggers, either every
+   trigger_period clock ticks or, if trigger_random, at that mean
+   spacing.
+
+   RATES
+   -----
+   The generator runs as fast as it can. WibGeneratePacer holds a
+   producer to a given rate, for example 2 MHz frames for a real WIB
+   link or a multiple of that for a load test.
+
+\* ---------------------------------------------------------------------- */
+
+
+#include "WibUnpack.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <math.h>
+#include <string.h>
+#include <time.h>
+
+
+#define WIBGENERATE_K_NCHANNELS    128  /*!< Channels per WIB frame        */
+#define WIBGENERATE_K_N64FRAME      30  /*!< 64-bit words per WIB frame    */
+#define WIBGENERATE_K_PER_SAMPLE    25  /*!< Clock ticks per frame         */
+#define WIBGENERATE_K_CLOCK_PERIOD  20  /*!< Nanoseconds per clock tick    */
+#define WIBGENERATE_K_NTRACKS       16  /*!< Maximum concurrent tracks     */
+#define WIBGENERATE_K_NSHAPE        32  /*!< Ticks in a track's pulse      */
+#define WIBGENERATE_K_NGROUPS       16  /*!< Maximum coherent groups       */
+#define WIBGENERATE_K_NLANES         8  /*!< Channels per vector           */
+#define WIBGENERATE_K_MAXNOISE      75  /*!< Largest white noise RMS       */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \enum  WibGenerateErrorKinds
+  \brief The kinds of errors that can be injected
+                                                                          */
+/* ---------------------------------------------------------------------- */
+enum WibGenerateErrorKinds
+{
+   WIBGENERATE_M_ERR_WIB       = 0x1, /*!< Non-zero WIB header error word */
+   WIBGENERATE_M_ERR_COLD      = 0x2, /*!< Colddata error bits/register   */
+   WIBGENERATE_M_ERR_FLIP      = 0x4, /*!< A flipped bit in an ADC word   */
+   WIBGENERATE_M_ERR_TIMESTAMP = 0x8, /*!< A glitched timestamp           */
+   WIBGENERATE_M_ERR_ALL       = 0xf  /*!< All of the above               */
+};
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \enum  WibGenerateTimingType
+  \brief The timing message types and states generated, these are the
+         values of DaqBuffer's TimingMsg
+                                                                          */
+/* ---------------------------------------------------------------------- */
+enum WibGenerateTimingType
+{
+   WIBGENERATE_K_TIMING_RUNSTART = 4, /*!< Start of run                   */
+   WIBGENERATE_K_TIMING_TRIGGER  = 8, /*!< A trigger                      */
+   WIBGENERATE_K_TIMING_RUNNING  = 8  /*!< The state, timing is running   */
+};
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \struct _WibGenerateConfig
+  \brief   The parameters of the generated data,
+           see wibGenerateConfig_init for the defaults
+                                                                          */
+/* ---------------------------------------------------------------------- */
+typedef struct _WibGenerateConfig
+{
+   unsigned int         crate;  /*!< The WIB's crate number, 0-31         */
+   unsigned int          slot;  /*!< The WIB's slot  number, 0-7          */
+   unsigned int         fiber;  /*!< The WIB's fiber number, 0-7          */
+   uint64_t         timestamp;  /*!< The timestamp of the first frame     */
+   uint32_t              seed;  /*!< Seeds all the random numbers         */
+
+   int                ped_min;  /*!< The lowest  pedestal, ADC counts     */
+   int                ped_max;  /*!< The highest pedestal, ADC counts     */
+   double               noise;  /*!< The white noise RMS, ADC counts      */
+   double        noise_spread;  /*!< The fractional channel to channel
+                                     variation of noise                   */
+   double            coherent;  /*!< The coherent noise RMS, ADC counts   */
+   int         coherent_group;  /*!< Channels sharing the coherent noise,
+                                     8, 16, 32, 64 or 128                 */
+   double       coherent_corr;  /*!< Its tick to tick correlation, 0-1    */
+
+   double      stuck_fraction;  /*!< The fraction of channels with stuck
+                                     codes                                */
+   double   stuck_probability;  /*!< The fraction of their samples stuck  */
+
+   double          track_rate;  /*!< Tracks started per second            */
+   double     track_amplitude;  /*!< A track's mean pulse height, ADC     */
+
+   double          error_rate;  /*!< The fraction of frames with errors   */
+   unsigned int   error_kinds;  /*!< The WibGenerateErrorKinds to inject  */
+
+   uint32_t    trigger_period;  /*!< Clock ticks between triggers, 0 for
+                                     none                                 */
+   int         trigger_random;  /*!< If non-zero, trigger_period is the
+                                     mean of random spacings              */
+}
+WibGenerateConfig;
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \struct _WibGenerateTiming
+  \brief   A timing message, laid out as DaqBuffer's TimingMsg
+                                                                          */
+/* ---------------------------------------------------------------------- */
+typedef struct _WibGenerateTiming
+{
+   uint64_t timestamp;  /*!< The timestamp                                */
+   uint32_t  sequence;  /*!< The message sequence number                  */
+   uint32_t       tsw;  /*!< The state, bits 4-7, and type, bits 0-3      */
+}
+WibGenerateTiming;
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \struct _WibGenerateTrack
+  \brief   A track crossing a run of channels
+                                                                          */
+/* ---------------------------------------------------------------------- */
+typedef struct _WibGenerateTrack
+{
+   int32_t          age;  /*!< Ticks since it reached its first channel   */
+   int16_t          ch0;  /*!< Its first channel                          */
+   int16_t          dir;  /*!< +1 or -1, the direction across channels    */
+   int32_t          nch;  /*!< The number of channels crossed             */
+   int32_t           lo;  /*!< The first channel whose pulse is not over  */
+   int32_t           hi;  /*!< The last  channel reached                  */
+   int32_t        slope;  /*!< Ticks per channel, 8 fractional bits       */
+   int32_t          amp;  /*!< The pulse height, ADC counts               */
+   int16_t const *shape;  /*!< The pulse shape, 10 fractional bits        */
+}
+WibGenerateTrack;
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- */
+typedef uint32_t WibGenerateU32 __attribute__ ((vector_size (16)));
+typedef int32_t  WibGenerateI32 __attribute__ ((vector_size (16)));
+typedef uint16_t WibGenerateU16 __attribute__ ((vector_size (16)));
+typedef int16_t  WibGenerateI16 __attribute__ ((vector_size (16)));
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \struct _WibGenerate
+  \brief   The generator's state
+                                                                          */
+/* ---------------------------------------------------------------------- */
+typedef struct _WibGenerate
+{
+   WibGenerateConfig      cfg;  /*!< The configuration                    */
+
+   WibGenerateU32   rng[2][4];  /*!< Two vector xoshiro128++ states,
+                                     alternated to overlap their latency  */
+   uint64_t              rng1;  /*!< The scalar generator's state         */
+   uint64_t           rng_trk;  /*!< The same, for the tracks             */
+   uint64_t           rng_err;  /*!< The same, for the injected errors    */
+   uint64_t           rng_trg;  /*!< The same, for the trigger times      */
+
+   /* Per channel, as vectors of WIBGENERATE_K_NLANES channels          */
+   WibGenerateI16    ped[WIBGENERATE_K_NCHANNELS / WIBGENERATE_K_NLANES];
+                                /*!< The pedestals                        */
+   WibGenerateI16  scale[WIBGENERATE_K_NCHANNELS / WIBGENERATE_K_NLANES];
+                                /*!< The white noise scale, 7 fractional
+                                     bits per unit of the nibble sum      */
+   WibGenerateI16  stuck[WIBGENERATE_K_NCHANNELS / WIBGENERATE_K_NLANES];
+                                /*!< The stuck code threshold, 15 bits    */
+   WibGenerateI16    trk[WIBGENERATE_K_NCHANNELS / WIBGENERATE_K_NLANES];
+                                /*!< This tick's track signal             */
+
+   double      cm[WIBGENERATE_K_NGROUPS];
+                                /*!< The coherent noise of each group     */
+   double             cm_keep;  /*!< Its autoregressive coefficient       */
+   double             cm_kick;  /*!< Its innovation per unit of byte sum  */
+   int                 cm_shf;  /*!< log2 (vectors per group)             */
+   int                 nstuck;  /*!< The number of stuck channels         */
+
+   int16_t shape[2][WIBGENERATE_K_NSHAPE];
+                                /*!< Unipolar and bipolar pulse shapes    */
+   WibGenerateTrack tracks[WIBGENERATE_K_NTRACKS];
+                                /*!< The tracks in progress               */
+   int                ntracks;  /*!< The number in progress               */
+   int               trk_used;  /*!< Was trk written this tick            */
+   uint64_t      track_thresh;  /*!< Start a track below this             */
+   uint64_t      error_thresh;  /*!< Inject an error below this           */
+
+   uint64_t         timestamp;  /*!< The next frame's timestamp           */
+   uint16_t            cvtcnt;  /*!< The next frame's convert count       */
+
+   uint64_t      next_trigger;  /*!< The timestamp of the next trigger    */
+   uint32_t          sequence;  /*!< The next timing message's sequence   */
+   int                started;  /*!< Was the run start message sent      */
+
+   uint64_t           nframes;  /*!< Frames generated                     */
+   uint64_t           nerrors;  /*!< Errors injected                      */
+   uint64_t           nstarts;  /*!< Tracks started                       */
+   uint64_t             nmsgs;  /*!< Timing messages sent                 */
+}
+WibGenerate;
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \struct _WibGeneratePacer
+  \brief   Holds a producer to a fixed rate
+                                                                          */
+/* ---------------------------------------------------------------------- */
+typedef struct _WibGeneratePacer
+{
+   uint64_t      beg;  /*!< The start time, ns                            */
+   double ns_per_byte; /*!< The reciprocal of the rate, 0 for no limit    */
+   uint64_t   nbytes;  /*!< The bytes produced so far                     */
+}
+WibGeneratePacer;
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- */
+/* PROTOTYPES                                                             */
+/* ---------------------------------------------------------------------- */
+static inline void wibGenerateConfig_init (WibGenerateConfig        *cfg);
+
+static inline int  wibGenerate_init       (WibGenerate              *gen,
+                                           WibGenerateConfig const  *cfg);
+
+static inline void wibGenerate_adcs       (WibGenerate              *gen,
+                                           uint16_t            adcs[128]);
+
+static inline void wibGenerate_frame      (WibGenerate              *gen,
+                                           uint64_t               *frame);
+
+static inline void wibGenerate_frames     (WibGenerate              *gen,
+                                           uint64_t              *frames,
+                                           int                   nframes,
+                                           int                    stride);
+
+static inline int  wibGenerate_timing     (WibGenerate              *gen,
+                                           WibGenerateTiming       *msgs,
+                                           int                   maxmsgs);
+
+static inline void wibGeneratePacer_init  (WibGeneratePacer       *pacer,
+                                           double                   rate);
+
+static inline void wibGeneratePacer_wait  (WibGeneratePacer       *pacer,
+                                           uint32_t               nbytes);
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief Sets the defaults, a quiet detector: pedestals 400-1000, 3 ADC
+         of white noise, 1 ADC of coherent noise in groups of 16, tracks
+         at 10 kHz, no stuck codes, errors or triggers
+
+  \param[out] cfg  The configuration to initialize
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline void wibGenerateConfig_init (WibGenerateConfig *cfg)
+{
+   memset (cfg, 0, sizeof (*cfg));
+
+   cfg->crate             = 1;
+   cfg->slot              = 0;
+   cfg->fiber             = 0;
+   cfg->timestamp         = 0;
+   cfg->seed              = 1;
+
+   cfg->ped_min           = 400;
+   cfg->ped_max           = 1000;
+   cfg->noise             = 3.0;
+   cfg->noise_spread      = 0.1;
+   cfg->coherent          = 1.0;
+   cfg->coherent_group    = 16;
+   cfg->coherent_corr     = 0.95;
+
+   cfg->track_rate        = 10000.0;
+   cfg->track_amplitude   = 100.0;
+
+   cfg->error_kinds       = WIBGENERATE_M_ERR_ALL;
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Returns the next 64-bit value of a splitmix64 generator
+  \return The value
+
+  \param[in:out] s  The generator's state
+
+  This is the scalar generator, used for the per frame decisions and to
+  seed the vector generator.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline uint64_t wibGenerate_next1 (uint64_t *s)
+{
+   uint64_t z = (*s += 0x9e3779b97f4a7c15ULL);
+   z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+   z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+   return z ^ (z >> 31);
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Returns a uniform random number in [0,1)
+  \return The number
+
+  \param[in:out] s  The scalar generator's state
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline double wibGenerate_uniform (uint64_t *s)
+{
+   return (wibGenerate_next1 (s) >> 11) * (1.0 / 9007199254740992.0);
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Returns an approximately gaussian number, mean 0, RMS 1, from
+          the sum of the 4 bytes of a random word
+  \return The number
+
+  \param[in:out] s  The scalar generator's state
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline double wibGenerate_gauss (uint64_t *s)
+{
+   uint64_t r = wibGenerate_next1 (s);
+   int      g = (int)( (r        & 0xff) + ((r >>  8) & 0xff)
+                      + ((r >> 16) & 0xff) + ((r >> 24) & 0xff)) - 510;
+
+   // The RMS of the sum of 4 uniform bytes is sqrt (4 * (256^2 - 1) / 12)
+   return g * (1.0 / 147.7996);
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Advances the vector generator, returning 4 random words
+  \return The random words
+
+  \param[in:out] s  The xoshiro128++ state, 4 lanes
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline WibGenerateU32 wibGenerate_next (WibGenerateU32 s[4])
+{
+   WibGenerateU32 sum    = s[0] + s[3];
+   WibGenerateU32 result = ((sum << 7) | (sum >> 25)) + s[0];
+   WibGenerateU32 t      = s[1] << 9;
+
+   s[2] ^= s[0];
+   s[3] ^= s[1];
+   s[1] ^= s[2];
+   s[0] ^= s[3];
+   s[2] ^= t;
+   s[3]  = (s[3] << 11) | (s[3] >> 21);
+
+   return result;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Initializes a generator
+  \retval  0, success
+  \retval -1, the configuration is invalid
+
+  \param[out] gen  The generator
+  \param[in]  cfg  Its configuration
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline int wibGenerate_init (WibGenerate             *gen,
+                                    WibGenerateConfig const *cfg)
+{
+   int shf;
+
+   // The coherent groups must be whole vectors and a power of 2, the
+   // white noise must fit the 16-bit arithmetic
+   for (shf = 0; (WIBGENERATE_K_NLANES << shf) < cfg->coherent_group; shf++);
+   if ( (WIBGENERATE_K_NLANES << shf) != cfg->coherent_group
+     || cfg->coherent_group > WIBGENERATE_K_NCHANNELS
+     || cfg->noise * (1.0 + cfg->noise_spread) > WIBGENERATE_K_MAXNOISE
+     || cfg->ped_min < 0 || cfg->ped_max > 0xfff
+     || cfg->ped_min > cfg->ped_max
+     || cfg->coherent_corr < 0 || cfg->coherent_corr >= 1.0)
+   {
+      return -1;
+   }
+
+   memset (gen, 0, sizeof (*gen));
+   gen->cfg     = *cfg;
+   gen->rng1    = cfg->seed;
+   gen->rng_trk = wibGenerate_next1 (&gen->rng1);
+   gen->rng_err = wibGenerate_next1 (&gen->rng1);
+   gen->rng_trg = wibGenerate_next1 (&gen->rng1);
+
+
+   // -------------------------------------------------
+   // Seed the lanes, none may be all 0
+   // -------------------------------------------------
+   for (int j = 0; j < 2; j++)
+   {
+      for (int i = 0; i < 4; i++)
+      {
+         for (int lane = 0; lane < WIBGENERATE_K_NLANES; lane++)
+         {
+            gen->rng[j][i][lane] = (uint32_t)wibGenerate_next1 (&gen->rng1)
+                                 | 1;
+         }
+      }
+   }
+
+
+   // ------------------------------------------------------------------
+   // Per channel pedestal, noise scale and stuck code threshold. The
+   // noise adds (scale * nibble sum + 64) >> 7, rounded, to the ADC
+   // ------------------------------------------------------------------
+   for (int ichan = 0; ichan < WIBGENERATE_K_NCHANNELS; ichan++)
+   {
+      int    iv   = ichan / WIBGENERATE_K_NLANES;
+      int    lane = ichan % WIBGENERATE_K_NLANES;
+      double u    = wibGenerate_uniform (&gen->rng1);
+      double rms  = cfg->noise * (1.0 + cfg->noise_spread * (2 * u - 1));
+      int    stuck;
+
+      gen->ped  [iv][lane] = cfg->ped_min
+                   + (int)(wibGenerate_uniform (&gen->rng1)
+                           * (cfg->ped_max - cfg->ped_min + 1));
+      gen->scale[iv][lane] = (int16_t)(rms * 128.0 / 9.2195 + 0.5);
+
+      stuck = wibGenerate_uniform (&gen->rng1) < cfg->stuck_fraction;
+      gen->stuck[iv][lane] = stuck
+                  ? (int16_t)(cfg->stuck_probability * 32767.0) : 0;
+      gen->nstuck         += stuck;
+   }
+
+
+   // -----------------------------------------------
+   // Coherent noise, an AR(1) with the given RMS
+   // -----------------------------------------------
+   gen->cm_keep = cfg->coherent_corr;
+   gen->cm_kick = cfg->coherent * sqrt (1.0 - cfg->coherent_corr
+                                            * cfg->coherent_corr)
+                / 147.7996;
+   gen->cm_shf  = shf;
+   for (int ig = 0; ig < WIBGENERATE_K_NGROUPS; ig++)
+   {
+      gen->cm[ig] = cfg->coherent * wibGenerate_gauss (&gen->rng1);
+   }
+
+
+   // ---------------------------------------------------------
+   // The pulse shapes, a 4th order CR-RC shaper peaking at 4
+   // ticks, 2 usecs, and its derivative, both scaled to a peak
+   // of 1024
+   // ---------------------------------------------------------
+   {
+      double uni[WIBGENERATE_K_NSHAPE];
+      double bip[WIBGENERATE_K_NSHAPE];
+      double umax = 0;
+      double bmax = 0;
+
+      for (int it = 0; it < WIBGENERATE_K_NSHAPE; it++)
+      {
+         double t = it;
+         uni[it]  = t * t * t * t * exp (-t);
+         bip[it]  = (4 - t) * t * t * t * exp (-t);
+         if (uni[it]      > umax) umax = uni[it];
+         if (fabs (bip[it]) > bmax) bmax = fabs (bip[it]);
+      }
+
+      for (int it = 0; it < WIBGENERATE_K_NSHAPE; it++)
+      {
+         gen->shape[0][it] = (int16_t)lrint (1024.0 * uni[it] / umax);
+         gen->shape[1][it] = (int16_t)lrint (1024.0 * bip[it] / bmax);
+      }
+   }
+
+
+   // ---------------------------------------------------
+   // Per frame probabilities as 64-bit thresholds
+   // ---------------------------------------------------
+   {
+      double frame = WIBGENERATE_K_PER_SAMPLE * WIBGENERATE_K_CLOCK_PERIOD
+                   * 1.e-9;
+      double ptrk  = cfg->track_rate * frame;
+      double perr  = cfg->error_kinds ? cfg->error_rate : 0;
+
+      gen->track_thresh = ptrk >= 1.0 ? UINT64_MAX
+                        : (uint64_t)(ptrk * 18446744073709551616.0);
+      gen->error_thresh = perr >= 1.0 ? UINT64_MAX
+                        : (uint64_t)(perr * 18446744073709551616.0);
+   }
+
+   gen->timestamp    = cfg->timestamp;
+   gen->next_trigger = cfg->timestamp + cfg->trigger_period;
+
+   return 0;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Starts a track
+  \param[in:out] gen  The generator
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline void wibGenerate_trackStart (WibGenerate *gen)
+{
+   WibGenerateTrack *trk = &gen->tracks[gen->ntracks++];
+   uint64_t            r = wibGenerate_next1 (&gen->rng_trk);
+   int               ch0 = r & 0x7f;
+   int               dir = (r >> 7) & 1 ? 1 : -1;
+   int              room = dir > 0 ? WIBGENERATE_K_NCHANNELS - ch0 : ch0 + 1;
+
+   trk->age   = 0;
+   trk->lo    = 0;
+   trk->hi    = -1;
+   trk->ch0   = ch0;
+   trk->dir   = dir;
+   trk->nch   = 1 + (int)((r >> 8) & 0x7f) % room;
+
+   // From isochronous, all channels at once, to 4 ticks per channel
+   trk->slope = (r >> 16) & 0x3ff;
+   trk->shape = gen->shape[(r >> 26) & 1];
+
+   // Landau-like, mostly near the mean with a tail to 4 times it
+   double u   = ((r >> 32) & 0xffff) * (1.0 / 65536.0);
+   trk->amp   = (int32_t)(gen->cfg.track_amplitude * (0.7 + 0.3 / (1.0 - 0.9 * u)));
+
+   gen->nstarts += 1;
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Adds this tick's track signals into gen->trk, retiring those
+          that have crossed all their channels
+
+  \param[in:out] gen  The generator
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline void wibGenerate_tracks (WibGenerate *gen)
+{
+   int16_t *trk = (int16_t *)gen->trk;
+
+   if (gen->trk_used)
+   {
+      memset (gen->trk, 0, sizeof (gen->trk));
+      gen->trk_used = 0;
+   }
+
+   if (gen->ntracks < WIBGENERATE_K_NTRACKS
+   &&  wibGenerate_next1 (&gen->rng_trk) < gen->track_thresh)
+   {
+      wibGenerate_trackStart (gen);
+   }
+
+   for (int it = 0; it < gen->ntracks; )
+   {
+      WibGenerateTrack *t = &gen->tracks[it];
+      int             age = t->age++;
+
+      // -----------------------------------------------------------
+      // The channels whose pulse is in progress, those reached in
+      // the last NSHAPE ticks, slope * i in (age - NSHAPE, age].
+      // Both ends only move forward, so are advanced, not computed
+      // -----------------------------------------------------------
+      while (t->hi + 1 < t->nch && (((t->hi + 1) * t->slope) >> 8) <= age)
+      {
+         t->hi += 1;
+      }
+
+      while (t->lo <= t->hi
+         &&  age - ((t->lo * t->slope) >> 8) >= WIBGENERATE_K_NSHAPE)
+      {
+         t->lo += 1;
+      }
+
+      if (t->lo >= t->nch)
+      {
+         // Done, replace by the last
+         *t = gen->tracks[--gen->ntracks];
+         continue;
+      }
+
+      for (int i = t->lo; i <= t->hi; i++)
+      {
+         int dt = age - ((i * t->slope) >> 8);
+         trk[t->ch0 + t->dir * i] += (t->amp * t->shape[dt]) >> 10;
+      }
+
+      gen->trk_used = 1;
+      it           += 1;
+   }
+
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief Generates the next tick's ADCs as vectors
+
+  \param[in:out] gen  The generator
+  \param[out]   adcs  The 128 ADCs, in frame order, WIBGENERATE_K_NLANES
+                      to a vector
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline void wibGenerate_tick (WibGenerate *gen, WibGenerateI16 *adcs)
+{
+   int const nvecs = WIBGENERATE_K_NCHANNELS / WIBGENERATE_K_NLANES;
+   int16_t   cm[WIBGENERATE_K_NGROUPS];
+
+
+   // -------------------------------------------------------------
+   // Step the coherent noise, its gaussians are byte sums from the
+   // vector generator, and rounded without a call to lrint
+   // -------------------------------------------------------------
+   int ngroups = nvecs >> gen->cm_shf;
+   for (int ig = 0; ig < ngroups; ig += 4)
+   {
+      WibGenerateU32 r = wibGenerate_next (gen->rng[0]);
+      WibGenerateI32 g = (WibGenerateI32)( (r        & 0xff)
+                                         + ((r >>  8) & 0xff)
+                                         + ((r >> 16) & 0xff)
+                                         +  (r >> 24)) - 510;
+
+      for (int lane = 0; lane < 4; lane++)
+      {
+         double c = gen->cm_keep * gen->cm[ig + lane]
+                  + gen->cm_kick * g[lane];
+         gen->cm[ig + lane] = c;
+         cm     [ig + lane] = (int32_t)(c + 4096.5) - 4096;
+      }
+   }
+
+   wibGenerate_tracks (gen);
+
+
+   // -----------------------------------------------------------------
+   // The channels, WIBGENERATE_K_NLANES at a time in 16-bit lanes. A
+   // random word gives 2 channels their white noise, each the sum of
+   // 4 nibbles, RMS 9.2195, which is enough resolution once scaled to
+   // a few ADC counts and rounded
+   // -----------------------------------------------------------------
+   for (int iv = 0; iv < nvecs; iv++)
+   {
+      WibGenerateU16 r = (WibGenerateU16)wibGenerate_next (gen->rng[iv & 1]);
+      WibGenerateI16 g = (WibGenerateI16)( (r        & 0xf)
+                                         + ((r >>  4) & 0xf)
+                                         + ((r >>  8) & 0xf)
+                                         +  (r >> 12)) - 30;
+      WibGenerateI16 v = gen->ped[iv]
+                       + ((g * gen->scale[iv] + 64) >> 7)
+                       + cm[iv >> gen->cm_shf]
+                       + gen->trk[iv];
+
+      // Clamp to 0-0xfff
+      WibGenerateI16 hi = v > 0xfff;
+      v  &= ~(v >> 15);
+      v   = (v & ~hi) | (0xfff & hi);
+
+      if (gen->nstuck)
+      {
+         // Below threshold, the low 6 bits go to 0x00 or 0x3f
+         WibGenerateU16 s   = (WibGenerateU16)wibGenerate_next (gen->rng[~iv & 1]);
+         WibGenerateI16 hit = (WibGenerateI16)(s >> 1) < gen->stuck[iv];
+         WibGenerateI16 to  = -(WibGenerateI16)(s & 1) & 0x3f;
+         v = (v & ~(hit & 0x3f)) | (hit & to);
+      }
+
+      adcs[iv] = v;
+   }
+
+   gen->timestamp += WIBGENERATE_K_PER_SAMPLE;
+   gen->cvtcnt    += 1;
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief Generates the next tick's ADCs
+
+  \param[in:out] gen  The generator
+  \param[out]   adcs  The 128 ADCs, in frame order
+
+  This advances the generator by one frame's time, as wibGenerate_frame
+  does, but no frame is built and no errors are injected.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline void wibGenerate_adcs (WibGenerate *gen, uint16_t adcs[128])
+{
+   WibGenerateI16 v[WIBGENERATE_K_NCHANNELS / WIBGENERATE_K_NLANES];
+
+   wibGenerate_tick (gen, v);
+   memcpy (adcs, v, sizeof (v));
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief Packs the ADCs into the colddata ADC words of a frame
+
+  \param[out] frame  The frame
+  \param[in]   adcs  The 128 ADCs, as generated by wibGenerate_tick
+
+  This is wibPack_frame, see WibUnpack.h for the packing, done a group
+  of 4 ADCs at a time. Taken as a little-endian 64-bit word, a0 in the
+  low 16 bits, each ADC's byte or nibble is masked and shifted into
+  its place in the 48-bit group.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline void wibGenerate_pack (uint64_t              *frame,
+                                     WibGenerateI16 const   *adcs)
+{
+   uint8_t const *src = (uint8_t const *)adcs;
+
+   for (int is = 0; is < 2; is++)
+   {
+      uint8_t *b = (uint8_t *)(frame + (is ? WIBUNPACK_K_STREAM1
+                                           : WIBUNPACK_K_STREAM0));
+
+      for (int ig = 0; ig < 16; ig++, b += 6, src += 8)
+      {
+         uint64_t g;
+         memcpy (&g, src, sizeof (g));
+
+         uint64_t w = ( g        & 0x00000f0000ffULL)    // a0<7:0>, a1<11:8>
+                    | ((g >>  8) & 0x00000000ff00ULL)    // a1<7:0>
+                    | ((g <<  8) & 0x0000000f0000ULL)    // a0<11:8>
+                    | ((g >> 12) & 0xff0000f00000ULL)    // a2<3:0>, a3<11:4>
+                    | ((g >> 20) & 0x0000f0000000ULL)    // a3<3:0>
+                    | ((g >>  4) & 0x00ff00000000ULL);   // a2<11:4>
+
+         memcpy (b, &w, 6);
+      }
+   }
+
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Corrupts a frame with one of the enabled kinds of errors
+
+  \param[in:out]   gen  The generator
+  \param[in:out] frame  The frame
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline void wibGenerate_error (WibGenerate *gen, uint64_t *frame)
+{
+   uint64_t     r = wibGenerate_next1 (&gen->rng_err);
+   unsigned kinds = gen->cfg.error_kinds & WIBGENERATE_M_ERR_ALL;
+   int       pick = r % (unsigned)__builtin_popcount (kinds);
+   unsigned  kind;
+
+   // The pick'th enabled kind
+   for (kind = kinds & -kinds; pick--; kind = kinds & -kinds)
+   {
+      kinds &= ~kind;
+   }
+
+   r >>= 8;
+   if (kind == WIBGENERATE_M_ERR_WIB)
+   {
+      frame[0] |= ((r & 0xffff) | 1) << 48;
+   }
+   else if (kind == WIBGENERATE_M_ERR_COLD)
+   {
+      // Error bits and register of one of the colddata streams
+      int w = (r & 1) ? WIBUNPACK_K_STREAM1 - 2 : WIBUNPACK_K_STREAM0 - 2;
+      frame[w    ] |= ((r >>  1) & 0xff) | 1;
+      frame[w + 1] |= ((r >> 9) & 0xffff) | 1;
+   }
+   else if (kind == WIBGENERATE_M_ERR_FLIP)
+   {
+      int w = ((r & 1) ? WIBUNPACK_K_STREAM1 : WIBUNPACK_K_STREAM0)
+            + ((r >> 1) & 0xff) % 12;
+      frame[w] ^= 1ULL << ((r >> 9) & 0x3f);
+   }
+   else
+   {
+      frame[1] += 1 + ((r & 0xffff) << 4);
+   }
+
+   gen->nerrors += 1;
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief Generates the next frame
+
+  \param[in:out] gen  The generator
+  \param[out]  frame  The frame, WIBGENERATE_K_N64FRAME words
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline void wibGenerate_frame (WibGenerate *gen, uint64_t *frame)
+{
+   WibGenerateI16 adcs[WIBGENERATE_K_NCHANNELS / WIBGENERATE_K_NLANES];
+   uint64_t         id = (gen->cfg.slot  & 0x07) << 8
+                       | (gen->cfg.crate & 0x1f) << 3
+                       | (gen->cfg.fiber & 0x07);
+   uint64_t       cold = (uint64_t)gen->cvtcnt << 48;
+
+   // Header words, the WIB's then each colddata stream's
+   frame[0] = id << 13 | 1 << 8 | 0xbc;
+   frame[1] = gen->timestamp;
+   frame[WIBUNPACK_K_STREAM0 - 2] = cold;
+   frame[WIBUNPACK_K_STREAM0 - 1] = 0;
+   frame[WIBUNPACK_K_STREAM1 - 2] = cold;
+   frame[WIBUNPACK_K_STREAM1 - 1] = 0;
+
+   wibGenerate_tick (gen, adcs);
+   wibGenerate_pack (frame, adcs);
+
+   if (gen->error_thresh
+   &&  wibGenerate_next1 (&gen->rng_err) < gen->error_thresh)
+   {
+      wibGenerate_error (gen, frame);
+   }
+
+   gen->nframes += 1;
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief Generates the next \a nframes frames
+
+  \param[in:out] gen  The generator
+  \param[out] frames  The frames
+  \param[in] nframes  The number of frames
+  \param[in]  stride  The distance, in 64-bit words, between frames,
+                      WIBGENERATE_K_N64FRAME for a packed array
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline void wibGenerate_frames (WibGenerate *gen,
+                                       uint64_t *frames,
+                                       int      nframes,
+                                       int       stride)
+{
+   for (int iframe = 0; iframe < nframes; iframe++)
+   {
+      wibGenerate_frame (gen, frames + iframe * stride);
+   }
+
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Returns the timing messages up to the latest frame
+  \return The number of messages returned
+
+  \param[in:out] gen  The generator
+  \param[out]   msgs  The messages
+  \param[in] maxmsgs  The maximum number to return, any more are
+                      returned by the next call
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline int wibGenerate_timing (WibGenerate       *gen,
+                                      WibGenerateTiming *msgs,
+                                      int             maxmsgs)
+{
+   int        n = 0;
+   uint32_t tsw = WIBGENERATE_K_TIMING_RUNNING << 4;
+
+   if (gen->timestamp == gen->cfg.timestamp) return 0;
+
+   if (!gen->started && n < maxmsgs)
+   {
+      msgs[n].timestamp = gen->cfg.timestamp;
+      msgs[n].sequence  = gen->sequence++;
+      msgs[n].tsw       = tsw | WIBGENERATE_K_TIMING_RUNSTART;
+      gen->started      = 1;
+      n                += 1;
+   }
+
+   if (gen->cfg.trigger_period == 0)
+   {
+      gen->nmsgs += n;
+      return n;
+   }
+
+   while (n < maxmsgs && gen->next_trigger < gen->timestamp)
+   {
+      msgs[n].timestamp = gen->next_trigger;
+      msgs[n].sequence  = gen->sequence++;
+      msgs[n].tsw       = tsw | WIBGENERATE_K_TIMING_TRIGGER;
+      n                += 1;
+
+      if (gen->cfg.trigger_random)
+      {
+         double u = wibGenerate_uniform (&gen->rng_trg);
+         gen->next_trigger += 1 + (uint64_t)(-log (1.0 - u)
+                                            * gen->cfg.trigger_period);
+      }
+      else
+      {
+         gen->next_trigger += gen->cfg.trigger_period;
+      }
+   }
+
+   gen->nmsgs += n;
+   return n;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief Starts pacing
+
+  \param[out] pacer  The pacer
+  \param[in]   rate  The rate, in bytes per second, 0 for no limit
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline void wibGeneratePacer_init (WibGeneratePacer *pacer,
+                                          double             rate)
+{
+   struct timespec ts;
+   clock_gettime (CLOCK_MONOTONIC, &ts);
+
+   pacer->beg         = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+   pacer->ns_per_byte = rate > 0 ? 1.e9 / rate : 0;
+   pacer->nbytes      = 0;
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief Accounts for \a nbytes more, sleeping until they are due
+
+  \param[in:out] pacer  The pacer
+  \param[in]    nbytes  The number of bytes just produced
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline void wibGeneratePacer_wait (WibGeneratePacer *pacer,
+                                          uint32_t         nbytes)
+{
+   pacer->nbytes += nbytes;
+   if (pacer->ns_per_byte == 0) return;
+
+   uint64_t due = pacer->beg
+                + (uint64_t)(pacer->nbytes * pacer->ns_per_byte);
+
+   struct timespec ts;
+   ts.tv_sec  = due / 1000000000ULL;
+   ts.tv_nsec = due % 1000000000ULL;
+   while (clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL)
+          == EINTR);
+
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+#endif
@@ -0,0 +1,403 @@
+// -*-Mode: C;-*-
+
+#ifndef PDD_WIBTRANSPOSED_H
+#define PDD_WIBTRANSPOSED_H
+
+/* ---------------------------------------------------------------------- *//*!
+ *
+ *  @file     WibTransposed.h
+ *  @brief    Builds and reads transposed, channel-major, WIB packets, the
+ *            record type produced by the compression module's
+ *            MODE_K_TRANSPOSE
+ *  @verbatim
+ *                               Copyright 2018
+ *                                    by
+ *
+ *                       The Board of Trustees of the
+ *                    Leland Stanford Junior University.
+ *                           All rights reserved.
+ *
+ *  @endverbatim
+ *
+ *  @par Facility:
+ *  pdd
+ *
+ *  @author
+ *  <russell@slac.stanford.edu>
+ *
+ *  @par Date created:
+ *  <2018/07/30>
+ *
+ * @par Credits:
+ * SLAC
+ *
+\* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *\
+
+   HISTORY
+   -------
+
+   DATE       WHO WHAT
+   ---------- --- ---------------------------------------------------------
+   2018.07.30 jjr Created
+
+\* ---------------------------------------------------------------------- */
+
+
+/* ---------------------------------------------------------------------- *\
+
+   PACKET LAYOUT
+   -------------
+   The framing follows the compressed packets (see WibDecode.h), so that
+   the receivers locate the WIB identifier and timestamps in the same
+   words for both.
+
+     Word 0       Record header
+                     status(32) | #exc(8) | n64(16) | RecType=1 | Fmt=3
+                  n64 includes the record header word itself.
+     Word 1       WIB frame word 0 of the first frame, the identifier
+     Word 2       The timestamp of the first frame
+     Word 3       The timestamp of the last  frame
+
+     Word n64     The channels, channel i starts at word n64 + i * pitch/4
+                  and holds nsamples 16-bit little-endian ADCs. The pitch
+                  is nsamples rounded up to a multiple of 4 so that every
+                  channel starts on a 64-bit boundary; the pad is 0.
+
+     Trailer      Rsvd(12)|NChans-1(12)|NSamples-1(12)|0(4)
+                          |n64=1(16)|RecType=2(4)|Fmt=3(4)
+
+     Epilogue     Status/Identifier and packet trailer, the identifier's
+                  record type is 2, transposed. These may or may not be
+                  present depending on how the packet was transported.
+
+   Since each channel is contiguous, a consumer can use the waveforms
+   in place, wibTransposed_channel returns a pointer into the packet.
+
+\* ---------------------------------------------------------------------- */
+
+
+#include "WibUnpack.h"
+
+#include <inttypes.h>
+#include <string.h>
+
+
+#define WIBTRANSPOSED_K_HDRFMT         3  /*!< Record header format       */
+#define WIBTRANSPOSED_K_HDRRECTYPE     1  /*!< WIB header record type     */
+#define WIBTRANSPOSED_K_TLRRECTYPE     2  /*!< Trailer record type        */
+#define WIBTRANSPOSED_K_NHDRS          3  /*!< WIB header words           */
+#define WIBTRANSPOSED_K_DATATYPE       2  /*!< Identifier record type     */
+#define WIBTRANSPOSED_K_MAXSAMPLES  4096  /*!< Maximum samples/channel    */
+#define WIBTRANSPOSED_K_TICKS         25  /*!< Clock ticks per sample     */
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \def   WIBTRANSPOSED_K_PITCH
+  \brief The distance, in ADCs, between the channels of a packet of
+         \a _nsamples samples
+                                                                          */
+/* ---------------------------------------------------------------------- */
+#define WIBTRANSPOSED_K_PITCH(_nsamples) (((_nsamples) + 3) & ~3)
+/* ---------------------------------------------------------------------- */
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \def   WIBTRANSPOSED_K_N64
+  \brief The length, in 64-bit words, of a transposed packet including
+         its epilogue
+                                                                          */
+/* ---------------------------------------------------------------------- */
+#define WIBTRANSPOSED_K_N64(_nchans, _nsamples)                            \
+   (1 + WIBTRANSPOSED_K_NHDRS                                              \
+      + (_nchans) * WIBTRANSPOSED_K_PITCH (_nsamples) / 4 + 1 + 2)
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \struct _WibTransposed
+  \brief   A validated view of a transposed packet
+                                                                          *//*!
+  \typedef WibTransposed
+  \brief   Typedef for struct _WibTransposed
+                                                                          */
+/* ---------------------------------------------------------------------- */
+typedef struct _WibTransposed
+{
+   uint16_t const      *adcs; /*!< Channel 0, sample 0                    */
+   uint64_t const      *hdrs; /*!< The WIB header words                   */
+   uint64_t    timestamps[2]; /*!< First and last frame timestamps        */
+   uint32_t           status; /*!< The record header's summary status     */
+   int                nchans; /*!< The number of channels                 */
+   int              nsamples; /*!< The number of samples per channel      */
+   int                 pitch; /*!< The distance, in ADCs, between channels*/
+}
+WibTransposed;
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- */
+/* PROTOTYPES                                                             */
+/* ---------------------------------------------------------------------- */
+static inline uint32_t wibTransposed_packet  (uint64_t                *pkt,
+                                              uint32_t             maxn64,
+                                              uint64_t const      *frames,
+                                              int                 nframes,
+                                              int                  stride,
+                                              uint32_t             status);
+
+static inline int      wibTransposed_locate  (WibTransposed          *view,
+                                              uint64_t const          *pkt,
+                                              uint32_t                 n64);
+
+static inline uint16_t const *
+                       wibTransposed_channel (WibTransposed const    *view,
+                                              int                    ichan);
+
+static inline int      wibTransposed_window  (WibTransposed const    *view,
+                                              uint64_t                 beg,
+                                              uint64_t                 end,
+                                              int                   *first,
+                                              int                 *nsamples);
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Builds a transposed packet from a packet of WIB frames, the
+          software equivalent of the firmware's MODE_K_TRANSPOSE
+  \return The length of the packet in 64-bit words, including the
+          epilogue. If 0, the packet did not fit in \a maxn64 words.
+
+  \param[out]     pkt  The output packet
+  \param[in]   maxn64  The size of \a pkt in 64-bit words, see
+                       WIBTRANSPOSED_K_N64
+  \param[in]   frames  The first WIB frame
+  \param[in]  nframes  The number of frames, this is the number of
+                       samples per channel
+  \param[in]   stride  The distance, in 64-bit words, between frames.
+                       This is WIBUNPACK_K_N64FRAME for a packed array
+                       of frames.
+  \param[in]   status  The summary status
+
+  \par
+   The ADCs are unpacked straight into the packet's channel arrays with
+   the vector unpacker, there is no intermediate copy.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline uint32_t wibTransposed_packet (uint64_t            *pkt,
+                                             uint32_t          maxn64,
+                                             uint64_t const  *frames,
+                                             int             nframes,
+                                             int              stride,
+                                             uint32_t         status)
+{
+   int      nchans = WIBUNPACK_K_NCHANNELS;
+   int       pitch = WIBTRANSPOSED_K_PITCH (nframes);
+   uint32_t    n64 = WIBTRANSPOSED_K_N64  (nchans, nframes);
+
+   if (nframes < 1 || nframes > WIBTRANSPOSED_K_MAXSAMPLES || n64 > maxn64)
+   {
+      return 0;
+   }
+
+   uint64_t const *last = frames + (nframes - 1) * stride;
+   pkt[0] = ((uint64_t)status << 32)
+          | ((uint64_t)(WIBTRANSPOSED_K_NHDRS + 1) << 8)
+          | (WIBTRANSPOSED_K_HDRRECTYPE << 4)
+          | (WIBTRANSPOSED_K_HDRFMT     << 0);
+   pkt[1] = frames[0];
+   pkt[2] = frames[1];
+   pkt[3] = last[1];
+
+
+   // -----------------------------------------------------------
+   // Clear the pads then unpack directly into the channel arrays
+   // -----------------------------------------------------------
+   uint16_t *adcs = (uint16_t *)(pkt + 1 + WIBTRANSPOSED_K_NHDRS);
+   if (pitch != nframes)
+   {
+      for (int ichan = 0; ichan < nchans; ichan++)
+      {
+         memset (adcs + ichan * pitch + nframes, 0,
+                 (pitch - nframes) * sizeof (*adcs));
+      }
+   }
+
+   wibUnpack (adcs, pitch, frames, nframes, stride, WIBUNPACK_K_BEST);
+
+
+   uint32_t odx = 1 + WIBTRANSPOSED_K_NHDRS + nchans * pitch / 4;
+   pkt[odx++] = ((uint64_t)(nchans  - 1) << 40)
+              | ((uint64_t)(nframes - 1) << 28)
+              | (1                          <<  8)
+              | (WIBTRANSPOSED_K_TLRRECTYPE <<  4)
+              | (WIBTRANSPOSED_K_HDRFMT     <<  0);
+
+   uint32_t nbytes = (odx + 2) * sizeof (uint64_t);
+   pkt[odx++] = ((uint64_t)status << 32)
+              | (1 << 28)
+              | (WIBTRANSPOSED_K_DATATYPE << 24)
+              | nbytes;
+   pkt[odx++] = ((uint64_t)0x708b309e << 32) | (1 << 24);
+
+   return odx;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Locates and validates the contents of a transposed packet
+  \retval == 0, valid, \a view describes the packet
+  \retval  < 0, not a valid transposed packet
+
+  \param[out] view  The validated view of the packet
+  \param[in]   pkt  The transposed packet, starting with its record
+                    header
+  \param[in]   n64  The length of the packet in 64-bit words
+
+  \par
+   As with the compressed packets, the trailer is either the last word
+   of the packet or, if the epilogue was kept, the third to last.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline int wibTransposed_locate (WibTransposed  *view,
+                                        uint64_t const  *pkt,
+                                        uint32_t         n64)
+{
+   if (n64 < 2) return -1;
+
+   uint64_t  hdr = pkt[0];
+   uint32_t nhdr = (hdr >> 8) & 0xffff;
+   if ( (hdr        & 0xf) != WIBTRANSPOSED_K_HDRFMT
+     || ((hdr >> 4) & 0xf) != WIBTRANSPOSED_K_HDRRECTYPE
+     || nhdr < 1 + WIBTRANSPOSED_K_NHDRS || nhdr >= n64)
+   {
+      return -1;
+   }
+
+
+   static const int Candidates[2] = { 1, 3 };
+   for (int idx = 0; idx < 2; idx++)
+   {
+      if (n64 < (uint32_t)Candidates[idx]) break;
+
+      uint32_t itlr = n64 - Candidates[idx];
+      uint64_t  tlr = pkt[itlr];
+      if ( (tlr        & 0xf) != WIBTRANSPOSED_K_HDRFMT
+        || ((tlr >> 4) & 0xf) != WIBTRANSPOSED_K_TLRRECTYPE)
+      {
+         continue;
+      }
+
+      int   nchans = ((tlr >> 40) & 0xfff) + 1;
+      int nsamples = ((tlr >> 28) & 0xfff) + 1;
+      int    pitch = WIBTRANSPOSED_K_PITCH (nsamples);
+
+      // ------------------------------------------------------
+      // The channels must exactly fill the header to trailer
+      // ------------------------------------------------------
+      if (nhdr + (uint32_t)nchans * pitch / 4 != itlr) return -1;
+
+      view->adcs          = (uint16_t const *)(pkt + nhdr);
+      view->hdrs          = pkt + 1;
+      view->timestamps[0] = pkt[2];
+      view->timestamps[1] = pkt[3];
+      view->status        = hdr >> 32;
+      view->nchans        = nchans;
+      view->nsamples      = nsamples;
+      view->pitch         = pitch;
+
+      return 0;
+   }
+
+   return -1;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Returns channel \a ichan's waveform
+  \return A pointer to the channel's view->nsamples ADCs, this points
+          into the packet, no copy is made. NULL if \a ichan is out of
+          range.
+
+  \param[in]  view  The packet's view, from wibTransposed_locate
+  \param[in] ichan  The channel number
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline uint16_t const *wibTransposed_channel (WibTransposed const *view,
+                                                     int                 ichan)
+{
+   if ((unsigned)ichan >= (unsigned)view->nchans) return NULL;
+   return view->adcs + ichan * view->pitch;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Trims the packet's samples to a time window
+  \return The number of samples in the window, 0 if the packet and the
+          window do not overlap
+
+  \param[in]      view  The packet's view, from wibTransposed_locate
+  \param[in]       beg  The beginning of the window
+  \param[in]       end  The ending of the window, as for the event
+                        window, this is 1 sample beyond the last
+  \param[out]    first  The first sample in the window
+  \param[out] nsamples  The number of samples in the window
+
+  \par
+   With the range record's event window, this gives, for each channel,
+   wibTransposed_channel (view, ichan) + first as the trimmed waveform
+   of nsamples ADCs, again without a copy.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline int wibTransposed_window (WibTransposed const *view,
+                                        uint64_t              beg,
+                                        uint64_t              end,
+                                        int               *first,
+                                        int            *nsamples)
+{
+   uint64_t pktBeg = view->timestamps[0];
+   uint64_t pktEnd = view->timestamps[1] + WIBTRANSPOSED_K_TICKS;
+
+   *first    = 0;
+   *nsamples = 0;
+   if (end <= pktBeg || beg >= pktEnd || end <= beg) return 0;
+
+   int     i0 = beg <= pktBeg ? 0
+              : (int)((beg - pktBeg) / WIBTRANSPOSED_K_TICKS);
+   int     i1 = end >= pktEnd ? view->nsamples
+              : (int)((end - pktBeg + WIBTRANSPOSED_K_TICKS - 1)
+                                    / WIBTRANSPOSED_K_TICKS);
+   if (i1 > view->nsamples) i1 = view->nsamples;
+
+   *first    = i0;
+   *nsamples = i1 - i0;
+
+   return *nsamples;
+}
+/* ---------------------------------------------------------------------- */
+
+
+#endif
@@ -0,0 +1,707 @@
+// -*-Mode: C;-*-
+
+#ifndef PDD_WIBUNPACK_H
+#define PDD_WIBUNPACK_H
+
+/* ---------------------------------------------------------------------- *//*!
+ *
+ *  @file     WibUnpack.h
+ *  @brief    Unpacks the 12-bit ADCs of a packet of WIB frames into
+ *            channel-major 16-bit waveforms
+ *  @verbatim
+ *                               Copyright 2018
+ *                                    by
+ *
+ *                       The Board of Trustees of the
+ *                    Leland Stanford Junior University.
+ *                           All rights reserved.
+ *
+ *  @endverbatim
+ *
+ *  @par Facility:
+ *  pdd
+ *
+ *  @author
+ *  <russell@slac.stanford.edu>
+ *
+ *  @par Date created:
+ *  <2018/07/24>
+ *
+ * @par Credits:
+ * SLAC
+ *
+\* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *\
+
+   HISTORY
+   -------
+
+   DATE       WHO WHAT
+   ---------- --- ---------------------------------------------------------
+   2018.07.24 jjr Created
+
+\* ---------------------------------------------------------------------- */
+
+
+/* ---------------------------------------------------------------------- *\
+
+   ADC PACKING
+   -----------
+   Each of the two colddata streams carries 64 ADCs in 12 64-bit words,
+   (words 4-15 and 18-29 of the frame). Taken as a byte stream, every 6
+   bytes, b[0:5], hold 4 ADCs with their nibbles interleaved
+
+      adc0 = b[2]<3:0> | b[0]
+      adc1 = b[3]<3:0> | b[1]
+      adc2 = b[4]      | b[2]<7:4>
+      adc3 = b[5]      | b[3]<7:4>
+
+   This is the same as extract_adc0-3 in the firmware's
+   WibFrame-Process.h and the channel numbering used here is the same
+   as the compression module, i.e. channel 4*n + i is adc<i> of group n,
+   with stream 1 holding channels 0-63 and stream 2 channels 64-127.
+
+   Viewed as 16-bit little-endian pairs, (b[0],b[2]), (b[1],b[3]),
+   (b[2],b[4]), (b[3],b[5]), the first two are masked to 12 bits and the
+   last two shifted right by 4. The vector versions do exactly this
+   with a byte shuffle, then transpose 8 frames x 8 channel blocks so
+   that each channel's 8 ticks are written with a single store.
+
+\* ---------------------------------------------------------------------- */
+
+
+#include <inttypes.h>
+#include <string.h>
+
+#if defined (__x86_64__) || defined (__i386__)
+#define WIBUNPACK_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined (__ARM_NEON__) || defined (__ARM_NEON)
+#define WIBUNPACK_NEON 1
+#include <arm_neon.h>
+#endif
+
+
+#define WIBUNPACK_K_NCHANNELS  128  /*!< Channels per WIB frame           */
+#define WIBUNPACK_K_N64FRAME    30  /*!< 64-bit words per WIB frame       */
+#define WIBUNPACK_K_STREAM0      4  /*!< First ADC word of colddata 1     */
+#define WIBUNPACK_K_STREAM1     18  /*!< First ADC word of colddata 2     */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \enum  WibUnpackMethod
+  \brief Enumerates the implementations of the unpacker
+                                                                          */
+/* ---------------------------------------------------------------------- */
+enum WibUnpackMethod
+{
+   WIBUNPACK_K_BEST   = 0, /*!< Best available on this machine            */
+   WIBUNPACK_K_SCALAR = 1, /*!< The reference scalar implementation       */
+   WIBUNPACK_K_SSSE3  = 2, /*!< x86 SSSE3                                 */
+   WIBUNPACK_K_AVX2   = 3, /*!< x86 AVX2                                  */
+   WIBUNPACK_K_NEON   = 4  /*!< ARM NEON                                  */
+};
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- */
+/* PROTOTYPES                                                             */
+/* ---------------------------------------------------------------------- */
+static inline void wibUnpack_frame   (uint16_t             adcs[128],
+                                      uint64_t const          *frame);
+
+static inline void wibPack_frame     (uint64_t                *frame,
+                                      uint16_t const       adcs[128]);
+
+static inline int  wibUnpack         (uint16_t                 *adcs,
+                                      int                      pitch,
+                                      uint64_t const         *frames,
+                                      int                    nframes,
+                                      int                     stride,
+                                      enum WibUnpackMethod    method);
+
+static inline void wibUnpack_scalar  (uint16_t                 *adcs,
+                                      int                      pitch,
+                                      uint64_t const         *frames,
+                                      int                    nframes,
+                                      int                     stride);
+
+static inline enum WibUnpackMethod wibUnpack_best ();
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief Unpacks the 128 ADCs of one WIB frame in channel order
+
+  \param[out]  adcs  The 128 unpacked ADCs
+  \param[in]  frame  The WIB frame
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline void wibUnpack_frame (uint16_t adcs[128], uint64_t const *frame)
+{
+   uint8_t const *streams[2] =
+   {
+      (uint8_t const *)(frame + WIBUNPACK_K_STREAM0),
+      (uint8_t const *)(frame + WIBUNPACK_K_STREAM1)
+   };
+
+   for (int is = 0; is < 2; is++)
+   {
+      uint8_t const *b = streams[is];
+      for (int ig = 0; ig < 16; ig++, b += 6, adcs += 4)
+      {
+         adcs[0] = ((b[2] & 0xf) << 8) | b[0];
+         adcs[1] = ((b[3] & 0xf) << 8) | b[1];
+         adcs[2] =  (b[4]        << 4) | (b[2] >> 4);
+         adcs[3] =  (b[5]        << 4) | (b[3] >> 4);
+      }
+   }
+
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief Packs 128 ADCs into the colddata ADC words of a WIB frame. The
+         header words of the frame are not touched.
+
+  \param[out] frame  The WIB frame
+  \param[in]   adcs  The 128 ADCs, only the lower 12 bits are used
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline void wibPack_frame (uint64_t *frame, uint16_t const adcs[128])
+{
+   uint8_t *streams[2] =
+   {
+      (uint8_t *)(frame + WIBUNPACK_K_STREAM0),
+      (uint8_t *)(frame + WIBUNPACK_K_STREAM1)
+   };
+
+   for (int is = 0; is < 2; is++)
+   {
+      uint8_t *b = streams[is];
+      for (int ig = 0; ig < 16; ig++, b += 6, adcs += 4)
+      {
+         b[0] = adcs[0];
+         b[1] = adcs[1];
+         b[2] = ((adcs[0] >> 8) & 0xf) | ((adcs[2] & 0xf) << 4);
+         b[3] = ((adcs[1] >> 8) & 0xf) | ((adcs[3] & 0xf) << 4);
+         b[4] =   adcs[2] >> 4;
+         b[5] =   adcs[3] >> 4;
+      }
+   }
+
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief The reference implementation of the channel-major unpacker
+
+  \param[out]    adcs  The output array, channel \a ichan, tick \a t is
+                       stored at adcs[ichan * pitch + t]
+  \param[in]    pitch  The distance, in ADCs, between channels, must be
+                       >= \a nframes
+  \param[in]   frames  The first WIB frame
+  \param[in]  nframes  The number of frames to unpack
+  \param[in]   stride  The distance, in 64-bit words, between frames.
+                       This is WIBUNPACK_K_N64FRAME for a packed array
+                       of frames.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline void wibUnpack_scalar (uint16_t        *adcs,
+                                     int             pitch,
+                                     uint64_t const *frames,
+                                     int           nframes,
+                                     int            stride)
+{
+   uint16_t tmp[WIBUNPACK_K_NCHANNELS];
+
+   for (int it = 0; it < nframes; it++, frames += stride)
+   {
+      wibUnpack_frame (tmp, frames);
+      for (int ichan = 0; ichan < WIBUNPACK_K_NCHANNELS; ichan++)
+      {
+         adcs[ichan * pitch + it] = tmp[ichan];
+      }
+   }
+
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ====================================================================== */
+#if WIBUNPACK_X86
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief Transposes 8 rows of 8 16-bit values, SSE2
+
+  \param[in,out] r  The 8 rows, returned as the 8 columns
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline void wibUnpack_transpose8_sse2 (__m128i r[8])
+{
+   __m128i t0 = _mm_unpacklo_epi16 (r[0], r[1]);
+   __m128i t1 = _mm_unpackhi_epi16 (r[0], r[1]);
+   __m128i t2 = _mm_unpacklo_epi16 (r[2], r[3]);
+   __m128i t3 = _mm_unpackhi_epi16 (r[2], r[3]);
+   __m128i t4 = _mm_unpacklo_epi16 (r[4], r[5]);
+   __m128i t5 = _mm_unpackhi_epi16 (r[4], r[5]);
+   __m128i t6 = _mm_unpacklo_epi16 (r[6], r[7]);
+   __m128i t7 = _mm_unpackhi_epi16 (r[6], r[7]);
+
+   __m128i u0 = _mm_unpacklo_epi32 (t0, t2);
+   __m128i u1 = _mm_unpackhi_epi32 (t0, t2);
+   __m128i u2 = _mm_unpacklo_epi32 (t1, t3);
+   __m128i u3 = _mm_unpackhi_epi32 (t1, t3);
+   __m128i u4 = _mm_unpacklo_epi32 (t4, t6);
+   __m128i u5 = _mm_unpackhi_epi32 (t4, t6);
+   __m128i u6 = _mm_unpacklo_epi32 (t5, t7);
+   __m128i u7 = _mm_unpackhi_epi32 (t5, t7);
+
+   r[0] = _mm_unpacklo_epi64 (u0, u4);
+   r[1] = _mm_unpackhi_epi64 (u0, u4);
+   r[2] = _mm_unpacklo_epi64 (u1, u5);
+   r[3] = _mm_unpackhi_epi64 (u1, u5);
+   r[4] = _mm_unpacklo_epi64 (u2, u6);
+   r[5] = _mm_unpackhi_epi64 (u2, u6);
+   r[6] = _mm_unpacklo_epi64 (u3, u7);
+   r[7] = _mm_unpackhi_epi64 (u3, u7);
+
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Unpacks 8 ADCs from 12 bytes, SSSE3
+  \return The 8 ADCs
+
+  \param[in]   p  Pointer to 16 readable bytes
+  \param[in] shf  The byte shuffle selecting the 12 bytes
+  \param[in] msk  The lanes to be masked rather than shifted
+                                                                          */
+/* ---------------------------------------------------------------------- */
+__attribute__ ((target ("ssse3")))
+static inline __m128i wibUnpack_8_ssse3 (uint8_t const *p,
+                                         __m128i      shf,
+                                         __m128i      msk)
+{
+   __m128i v = _mm_shuffle_epi8 (_mm_loadu_si128 ((__m128i const *)p), shf);
+   __m128i l = _mm_and_si128    (v, _mm_set1_epi16 (0x0fff));
+   __m128i h = _mm_srli_epi16   (v, 4);
+
+   return _mm_or_si128 (_mm_and_si128 (msk, l), _mm_andnot_si128 (msk, h));
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief Channel-major unpacker, SSSE3. Same interface as
+         wibUnpack_scalar
+
+  \par
+   Only 8 frame blocks are done here, the remainder is left for the
+   caller.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+__attribute__ ((target ("ssse3")))
+static inline int wibUnpack_ssse3 (uint16_t        *adcs,
+                                   int             pitch,
+                                   uint64_t const *frames,
+                                   int           nframes,
+                                   int            stride)
+{
+   // -------------------------------------------------------------
+   // The 16-bit pairs are (0,2),(1,3),(2,4),(3,5) for each group.
+   // The last block of a stream is read 4 bytes early so as not
+   // to read past the end of the frame.
+   // -------------------------------------------------------------
+   __m128i const shf0 = _mm_setr_epi8 (0, 2, 1, 3, 2, 4,  3,  5,
+                                       6, 8, 7, 9, 8,10,  9, 11);
+   __m128i const shf4 = _mm_add_epi8  (shf0, _mm_set1_epi8 (4));
+   __m128i const  msk = _mm_setr_epi16 (-1, -1, 0, 0, -1, -1, 0, 0);
+
+   int nblocks = nframes & ~7;
+   for (int it = 0; it < nblocks; it += 8)
+   {
+      __m128i v[16][8];
+
+      for (int iframe = 0; iframe < 8; iframe++)
+      {
+         uint64_t const *f = frames + (it + iframe) * stride;
+         for (int is = 0; is < 2; is++)
+         {
+            uint8_t const *b = (uint8_t const *)
+                               (f + (is ? WIBUNPACK_K_STREAM1
+                                        : WIBUNPACK_K_STREAM0));
+            for (int ib = 0; ib < 7; ib++)
+            {
+               v[8*is + ib][iframe] = wibUnpack_8_ssse3 (b + 12*ib, shf0, msk);
+            }
+            v[8*is + 7][iframe] = wibUnpack_8_ssse3 (b + 12*7 - 4, shf4, msk);
+         }
+      }
+
+      for (int ib = 0; ib < 16; ib++)
+      {
+         wibUnpack_transpose8_sse2 (v[ib]);
+         uint16_t *dst = adcs + 8 * ib * pitch + it;
+         for (int ic = 0; ic < 8; ic++, dst += pitch)
+         {
+            _mm_storeu_si128 ((__m128i *)dst, v[ib][ic]);
+         }
+      }
+   }
+
+   return nblocks;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief Channel-major unpacker, AVX2. Same interface as wibUnpack_ssse3
+
+  \par
+   Each 256-bit register holds 2 12-byte blocks, one per 128-bit lane,
+   so that the shuffle and the in-lane transpose handle 16 channels at
+   once.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+__attribute__ ((target ("avx2")))
+static inline int wibUnpack_avx2 (uint16_t        *adcs,
+                                  int             pitch,
+                                  uint64_t const *frames,
+                                  int           nframes,
+                                  int            stride)
+{
+   __m256i const shf0 = _mm256_setr_epi8 (0, 2, 1, 3, 2, 4,  3,  5,
+                                          6, 8, 7, 9, 8,10,  9, 11,
+                                          0, 2, 1, 3, 2, 4,  3,  5,
+                                          6, 8, 7, 9, 8,10,  9, 11);
+   __m256i const shfx = _mm256_setr_epi8 (0, 2, 1, 3, 2, 4,  3,  5,
+                                          6, 8, 7, 9, 8,10,  9, 11,
+                                          4, 6, 5, 7, 6, 8,  7,  9,
+                                         10,12,11,13,12,14, 13, 15);
+   __m256i const  msk = _mm256_setr_epi16 (-1, -1, 0, 0, -1, -1, 0, 0,
+                                           -1, -1, 0, 0, -1, -1, 0, 0);
+   __m256i const m12  = _mm256_set1_epi16 (0x0fff);
+
+   int nblocks = nframes & ~7;
+   for (int it = 0; it < nblocks; it += 8)
+   {
+      __m256i v[8][8];
+
+      for (int iframe = 0; iframe < 8; iframe++)
+      {
+         uint64_t const *f = frames + (it + iframe) * stride;
+         for (int is = 0; is < 2; is++)
+         {
+            uint8_t const *b = (uint8_t const *)
+                               (f + (is ? WIBUNPACK_K_STREAM1
+                                        : WIBUNPACK_K_STREAM0));
+            for (int ib = 0; ib < 4; ib++)
+            {
+               // The upper half of the last pair is read 4 bytes early
+               int     last = ib == 3;
+               __m128i   lo = _mm_loadu_si128 ((__m128i const *)(b + 24*ib));
+               __m128i   hi = _mm_loadu_si128 ((__m128i const *)
+                                               (b + 24*ib + 12 - 4*last));
+               __m256i    w = _mm256_inserti128_si256
+                                             (_mm256_castsi128_si256 (lo), hi, 1);
+               __m256i    x = _mm256_shuffle_epi8 (w, last ? shfx : shf0);
+               __m256i    l = _mm256_and_si256 (x, m12);
+               __m256i    h = _mm256_srli_epi16 (x, 4);
+
+               v[4*is + ib][iframe] = _mm256_or_si256
+                                         (_mm256_and_si256    (msk, l),
+                                          _mm256_andnot_si256 (msk, h));
+            }
+         }
+      }
+
+
+      for (int ib = 0; ib < 8; ib++)
+      {
+         __m256i *r  = v[ib];
+         __m256i t0 = _mm256_unpacklo_epi16 (r[0], r[1]);
+         __m256i t1 = _mm256_unpackhi_epi16 (r[0], r[1]);
+         __m256i t2 = _mm256_unpacklo_epi16 (r[2], r[3]);
+         __m256i t3 = _mm256_unpackhi_epi16 (r[2], r[3]);
+         __m256i t4 = _mm256_unpacklo_epi16 (r[4], r[5]);
+         __m256i t5 = _mm256_unpackhi_epi16 (r[4], r[5]);
+         __m256i t6 = _mm256_unpacklo_epi16 (r[6], r[7]);
+         __m256i t7 = _mm256_unpackhi_epi16 (r[6], r[7]);
+
+         __m256i u0 = _mm256_unpacklo_epi32 (t0, t2);
+         __m256i u1 = _mm256_unpackhi_epi32 (t0, t2);
+         __m256i u2 = _mm256_unpacklo_epi32 (t1, t3);
+         __m256i u3 = _mm256_unpackhi_epi32 (t1, t3);
+         __m256i u4 = _mm256_unpacklo_epi32 (t4, t6);
+         __m256i u5 = _mm256_unpackhi_epi32 (t4, t6);
+         __m256i u6 = _mm256_unpacklo_epi32 (t5, t7);
+         __m256i u7 = _mm256_unpackhi_epi32 (t5, t7);
+
+         __m256i c[8];
+         c[0] = _mm256_unpacklo_epi64 (u0, u4);
+         c[1] = _mm256_unpackhi_epi64 (u0, u4);
+         c[2] = _mm256_unpacklo_epi64 (u1, u5);
+         c[3] = _mm256_unpackhi_epi64 (u1, u5);
+         c[4] = _mm256_unpacklo_epi64 (u2, u6);
+         c[5] = _mm256_unpackhi_epi64 (u2, u6);
+         c[6] = _mm256_unpacklo_epi64 (u3, u7);
+         c[7] = _mm256_unpackhi_epi64 (u3, u7);
+
+         // Lower lane is channels 16*ib + 0-7, upper lane 16*ib + 8-15
+         uint16_t *dlo = adcs + 16 * ib * pitch + it;
+         uint16_t *dhi = dlo  +  8 * pitch;
+         for (int ic = 0; ic < 8; ic++, dlo += pitch, dhi += pitch)
+         {
+            _mm_storeu_si128 ((__m128i *)dlo, _mm256_castsi256_si128   (c[ic]));
+            _mm_storeu_si128 ((__m128i *)dhi, _mm256_extracti128_si256 (c[ic], 1));
+         }
+      }
+   }
+
+   return nblocks;
+}
+/* ---------------------------------------------------------------------- */
+#endif
+/* ====================================================================== */
+
+
+
+
+/* ====================================================================== */
+#if WIBUNPACK_NEON
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief Channel-major unpacker, NEON. Same interface as wibUnpack_ssse3
+
+  \par
+   NEON has a per-lane variable shift, so the mask/shift selection of
+   the x86 versions collapses to a single vshlq followed by a mask.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline int wibUnpack_neon (uint16_t        *adcs,
+                                  int             pitch,
+                                  uint64_t const *frames,
+                                  int           nframes,
+                                  int            stride)
+{
+   static const uint8_t  Shf[2][16] =
+   {
+      { 0, 2, 1, 3, 2, 4,  3,  5,  6,  8,  7,  9,  8, 10,  9, 11 },
+      { 4, 6, 5, 7, 6, 8,  7,  9, 10, 12, 11, 13, 12, 14, 13, 15 }
+   };
+   static const int16_t  Shr[8] = { 0, 0, -4, -4, 0, 0, -4, -4 };
+
+   uint8x8_t  const shf0lo = vld1_u8  (Shf[0]);
+   uint8x8_t  const shf0hi = vld1_u8  (Shf[0] + 8);
+   uint8x8_t  const shf4lo = vld1_u8  (Shf[1]);
+   uint8x8_t  const shf4hi = vld1_u8  (Shf[1] + 8);
+   int16x8_t  const    shr = vld1q_s16 (Shr);
+   uint16x8_t const    m12 = vdupq_n_u16 (0x0fff);
+
+   int nblocks = nframes & ~7;
+   for (int it = 0; it < nblocks; it += 8)
+   {
+      uint16x8_t v[16][8];
+
+      for (int iframe = 0; iframe < 8; iframe++)
+      {
+         uint64_t const *f = frames + (it + iframe) * stride;
+         for (int is = 0; is < 2; is++)
+         {
+            uint8_t const *b = (uint8_t const *)
+                               (f + (is ? WIBUNPACK_K_STREAM1
+                                        : WIBUNPACK_K_STREAM0));
+            for (int ib = 0; ib < 8; ib++)
+            {
+               int           last = ib == 7;
+               uint8x16_t       q = vld1q_u8 (b + 12*ib - 4*last);
+               uint8x8x2_t    tbl = { { vget_low_u8 (q), vget_high_u8 (q) } };
+               uint8x8_t       lo = vtbl2_u8 (tbl, last ? shf4lo : shf0lo);
+               uint8x8_t       hi = vtbl2_u8 (tbl, last ? shf4hi : shf0hi);
+               uint16x8_t       x = vreinterpretq_u16_u8 (vcombine_u8 (lo, hi));
+
+               v[8*is + ib][iframe] = vandq_u16 (vshlq_u16 (x, shr), m12);
+            }
+         }
+      }
+
+      for (int ib = 0; ib < 16; ib++)
+      {
+         uint16x8_t  *r = v[ib];
+         uint16x8x2_t b0 = vtrnq_u16 (r[0], r[1]);
+         uint16x8x2_t b1 = vtrnq_u16 (r[2], r[3]);
+         uint16x8x2_t b2 = vtrnq_u16 (r[4], r[5]);
+         uint16x8x2_t b3 = vtrnq_u16 (r[6], r[7]);
+
+         uint32x4x2_t c0 = vtrnq_u32 (vreinterpretq_u32_u16 (b0.val[0]),
+                                      vreinterpretq_u32_u16 (b1.val[0]));
+         uint32x4x2_t c1 = vtrnq_u32 (vreinterpretq_u32_u16 (b0.val[1]),
+                                      vreinterpretq_u32_u16 (b1.val[1]));
+         uint32x4x2_t c2 = vtrnq_u32 (vreinterpretq_u32_u16 (b2.val[0]),
+                                      vreinterpretq_u32_u16 (b3.val[0]));
+         uint32x4x2_t c3 = vtrnq_u32 (vreinterpretq_u32_u16 (b2.val[1]),
+                                      vreinterpretq_u32_u16 (b3.val[1]));
+
+         #define WIBUNPACK_COL(_lohi, _a, _b)                                \
+            vreinterpretq_u16_u32 (vcombine_u32 (vget_##_lohi##_u32 (_a),   \
+                                                 vget_##_lohi##_u32 (_b)))
+         uint16x8_t c[8];
+         c[0] = WIBUNPACK_COL (low,  c0.val[0], c2.val[0]);
+         c[1] = WIBUNPACK_COL (low,  c1.val[0], c3.val[0]);
+         c[2] = WIBUNPACK_COL (low,  c0.val[1], c2.val[1]);
+         c[3] = WIBUNPACK_COL (low,  c1.val[1], c3.val[1]);
+         c[4] = WIBUNPACK_COL (high, c0.val[0], c2.val[0]);
+         c[5] = WIBUNPACK_COL (high, c1.val[0], c3.val[0]);
+         c[6] = WIBUNPACK_COL (high, c0.val[1], c2.val[1]);
+         c[7] = WIBUNPACK_COL (high, c1.val[1], c3.val[1]);
+         #undef WIBUNPACK_COL
+
+         uint16_t *dst = adcs + 8 * ib * pitch + it;
+         for (int ic = 0; ic < 8; ic++, dst += pitch)
+         {
+            vst1q_u16 (dst, c[ic]);
+         }
+      }
+   }
+
+   return nblocks;
+}
+/* ---------------------------------------------------------------------- */
+#endif
+/* ====================================================================== */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Determines the best unpacker for this machine
+  \return The unpacking method
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline enum WibUnpackMethod wibUnpack_best ()
+{
+#if   WIBUNPACK_X86
+   if (__builtin_cpu_supports ("avx2"))  return WIBUNPACK_K_AVX2;
+   if (__builtin_cpu_supports ("ssse3")) return WIBUNPACK_K_SSSE3;
+#elif WIBUNPACK_NEON
+   return WIBUNPACK_K_NEON;
+#endif
+
+   return WIBUNPACK_K_SCALAR;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Unpacks a packet of WIB frames into channel-major waveforms
+  \retval == 0, success
+  \retval  < 0, the requested method is not available on this machine
+
+  \param[out]    adcs  The output array, channel \a ichan, tick \a t is
+                       stored at adcs[ichan * pitch + t]
+  \param[in]    pitch  The distance, in ADCs, between channels, must be
+                       >= \a nframes
+  \param[in]   frames  The first WIB frame
+  \param[in]  nframes  The number of frames to unpack
+  \param[in]   stride  The distance, in 64-bit words, between frames.
+  \param[in]   method  The implementation to use, WIBUNPACK_K_BEST
+                       picks the fastest available
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline int wibUnpack (uint16_t              *adcs,
+                             int                   pitch,
+                             uint64_t const      *frames,
+                             int                 nframes,
+                             int                  stride,
+                             enum WibUnpackMethod method)
+{
+   int ndone = 0;
+
+   if (method == WIBUNPACK_K_BEST) method = wibUnpack_best ();
+
+   switch (method)
+   {
+   case WIBUNPACK_K_SCALAR:
+      break;
+
+#if WIBUNPACK_X86
+   case WIBUNPACK_K_SSSE3:
+      if (!__builtin_cpu_supports ("ssse3")) return -1;
+      ndone = wibUnpack_ssse3 (adcs, pitch, frames, nframes, stride);
+      break;
+
+   case WIBUNPACK_K_AVX2:
+      if (!__builtin_cpu_supports ("avx2")) return -1;
+      ndone = wibUnpack_avx2  (adcs, pitch, frames, nframes, stride);
+      break;
+#endif
+
+#if WIBUNPACK_NEON
+   case WIBUNPACK_K_NEON:
+      ndone = wibUnpack_neon  (adcs, pitch, frames, nframes, stride);
+      break;
+#endif
+
+   default:
+      return -1;
+   }
+
+
+   // ------------------------------------------------
+   // Any frames not in a complete block of 8 frames
+   // ------------------------------------------------
+   if (ndone < nframes)
+   {
+      wibUnpack_scalar (adcs + ndone,
+                        pitch,
+                        frames + ndone * stride,
+                        nframes - ndone,
+                        stride);
+   }
+
+   return 0;
+}
+/* ---------------------------------------------------------------------- */
+
+
+#endif
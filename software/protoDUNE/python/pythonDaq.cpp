@@ -0,0 +1,758 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'LLRF Test Software'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'LLRF Test Software', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#include <Python.h>
+#include <ControlCmdMem.h>
+#include <DataSharedMem.h>
+#include <WibUnpack.h>
+#include <WibDecode.h>
+#include <WibTransposed.h>
+#include <time.h>
+#include <stdlib.h>
+
+static ControlCmdMemory * cmem;
+static DataSharedMemory * dmem;
+static PyObject         * DaqError;
+static bool               toDisable;
+static DataSharedReader   reader;
+
+// Shared data frame last returned, left in the ring
+static uint8_t          * frameData;
+static uint32_t           frameSize;
+
+// Decode models of the compressed streams, kept across frames. They only
+// hold for the frame following the one last decoded, which is recorded by
+// the reader's generation, sequence and missed count after decoding it.
+#define ADC_MAX_STREAMS 64
+#define ADC_MAX_CSF     4096
+static WibDecodeModels  * adcModels[ADC_MAX_CSF];
+static uint32_t           adcGeneration;
+static uint64_t           adcSeq    = ~(uint64_t)0;
+static uint64_t           adcMissed = 0;
+
+// Read-only array exported through the buffer protocol. Every view made
+// from it holds a reference, so the memory, shape and strides stay valid
+// for as long as any view does. The memory is freed with the array when
+// it is owned, a ring frame is only pointed at.
+typedef struct {
+   PyObject_HEAD
+   uint8_t    * data;
+   bool         owned;
+   Py_ssize_t   len;
+   Py_ssize_t   itemsize;
+   int          ndim;
+   Py_ssize_t   shape[2];
+   Py_ssize_t   strides[2];
+   char         format[2];
+} DaqArray;
+
+static PyTypeObject  DaqArrayType = { PyVarObject_HEAD_INIT(NULL,0) };
+static PyBufferProcs DaqArrayBuffer;
+
+// Queue a command, waiting up to 10 seconds for a free slot. Returns the
+// slot or -1. Called without the GIL.
+static int32_t intSubmitCmd (const char type, const char *argA, const char *argB) {
+   time_t    ctme;
+   time_t    stme;
+   int32_t   slot;
+
+   time(&stme);
+   while ( (slot = controlCmdSubmit(cmem,type,argA,argB)) < 0 ) {
+      usleep(100);
+      time(&ctme);
+      if ( (ctme - stme) >= 10) return(-1);
+   }
+   return(slot);
+}
+
+// Result of a command as a python string or integer
+static PyObject *intCmdResult (const char *result, const char *error, bool retString) {
+   uint32_t  ret;
+
+   // Check error buffer
+   if ( strlen(error) != 0 ) {
+      PyErr_SetString(DaqError,error);
+      return(NULL);
+   }
+
+   // Success
+   if ( retString ) return(Py_BuildValue("s",result));
+   else if ( strlen(result) == 0 ) return(Py_BuildValue("i",1));
+   else {
+      ret = (uint32_t)strtoul(result,NULL,0);
+      return(Py_BuildValue("i",ret));
+   }
+}
+
+static PyObject *intSendCmd (const char type, const char *argA, const char *argB, bool retString) {
+   char      result[CONTROL_CMD_RESULT_SIZE];
+   char      error[CONTROL_CMD_ERROR_SIZE];
+   int32_t   slot;
+   int32_t   done = 0;
+
+   if ( cmem == NULL ) return(NULL);
+
+   // Send command and wait for it with timeout, letting other python threads run
+   Py_BEGIN_ALLOW_THREADS
+   if ( (slot = intSubmitCmd(type,argA,argB)) >= 0 ) done = controlCmdWait(cmem,slot,result,error,10000);
+   Py_END_ALLOW_THREADS
+
+   if ( ! done ) {
+      PyErr_SetString(DaqError,"Timeout sending xml string");
+      return(NULL);
+   }
+   return(intCmdResult(result,error,retString));
+}
+
+static PyObject *intSendXml (const char *xml ) {
+   return(intSendCmd (CONTROL_CMD_TYPE_SEND_XML,xml, NULL, false));
+}
+
+static PyObject *daqHardReset (PyObject *self, PyObject *args) {
+   return (intSendXml("<system><command><HardReset/></command></system>\n"));
+}
+
+static PyObject *daqSoftReset (PyObject *self, PyObject *args) {
+   return (intSendXml("<system><command><SoftReset/></command></system>\n"));
+}
+
+static PyObject *daqRefreshstate(PyObject *self, PyObject *args) {
+   return (intSendXml("<system><command><RefreshState/></command></system>\n"));
+}
+
+static PyObject *daqSetDefaults (PyObject *self, PyObject *args) {
+   return (intSendXml("<system><command><SetDefaults/></command></system>\n"));
+}
+
+static PyObject *daqLoadSettings (PyObject *self, PyObject *args) {
+   char         buffer[1024];
+   const char * arg;
+
+   if (!PyArg_ParseTuple(args, "s", &arg)) return NULL;
+
+   sprintf(buffer,"<system><command><ReadXmlFile>%s</ReadXmlFile></command></system>\n",arg);
+   return (intSendXml(buffer));
+}
+
+static PyObject *daqSaveSettings (PyObject *self, PyObject *args) {
+   char         buffer[1024];
+   const char * arg;
+
+   if (!PyArg_ParseTuple(args, "s", &arg)) return NULL;
+
+   sprintf(buffer,"<system><command><WriteConfigXml>%s</WriteConfigXml></command></system>\n",arg);
+   return (intSendXml(buffer));
+}
+
+static PyObject *daqOpenData (PyObject *self, PyObject *args) {
+   char         buffer[1024];
+   const char * arg;
+
+   if (!PyArg_ParseTuple(args, "s", &arg)) return NULL;
+
+   sprintf(buffer,"<system><config><DataFile>%s</DataFile></config><command><OpenDataFile/></command></system>\n",arg);
+   return (intSendXml(buffer));
+}
+
+static PyObject *daqCloseData (PyObject *self, PyObject *args) {
+   return (intSendXml("<system><command><CloseDataFile/></command></system>\n"));
+}
+
+static PyObject *daqSetRunParameters (PyObject *self, PyObject *args) {
+   char         buffer[1024];
+   const char * rate;
+   int          count;
+
+   if (!PyArg_ParseTuple(args, "si", &rate,&count)) return NULL;
+
+   sprintf(buffer,"<system><config><RunRate>%s</RunRate><RunCount>%i</RunCount></config></system>\n",rate,count);
+   return (intSendXml(buffer));
+}
+
+static PyObject *daqSetRunState (PyObject *self, PyObject *args) {
+   char         buffer[1024];
+   const char * state;
+
+   if (!PyArg_ParseTuple(args, "s", &state)) return NULL;
+
+   sprintf(buffer,"<system><command><SetRunState>%s</SetRunState></command></system>\n",state);
+   return (intSendXml(buffer));
+}
+
+static PyObject *daqRunState (PyObject *self, PyObject *args) {
+   return(intSendCmd (CONTROL_CMD_TYPE_GET_STATUS, "RunState", NULL, true));
+}
+
+static PyObject *daqResetCounters (PyObject *self, PyObject *args) {
+   return (intSendXml("<system><command><ResetCount/></command></system>\n"));
+}
+
+static PyObject *daqSendCommand (PyObject *self, PyObject *args) {
+   const char *cmd;
+   const char *arg;
+
+   if (!PyArg_ParseTuple(args, "ss", &cmd,&arg)) return NULL;
+
+   return(intSendCmd (CONTROL_CMD_TYPE_EXEC_COMMAND, cmd, arg, false));
+}
+
+static PyObject *daqReadStatus (PyObject *self, PyObject *args) {
+   return (intSendXml("<system><command><ReadStatus/></command></system>\n"));
+}
+
+static PyObject *daqGetStatus (PyObject *self, PyObject *args) {
+   const char   *var;
+
+   if (!PyArg_ParseTuple(args, "s", &var)) return NULL;
+
+   return(intSendCmd (CONTROL_CMD_TYPE_GET_STATUS, var, NULL, true));
+}
+
+static PyObject *daqReadConfig (PyObject *self, PyObject *args) {
+   return (intSendXml("<system><command><ReadConfig/></command></system>\n"));
+}
+
+static PyObject *daqVerifyConfig (PyObject *self, PyObject *args) {
+   return (intSendXml("<system><command><VerifyConfig/></command></system>\n"));
+}
+
+static PyObject *daqSetConfig (PyObject *self, PyObject *args) {
+   const char   *var;
+   const char   *arg;
+
+   if (!PyArg_ParseTuple(args, "ss", &var,&arg)) return NULL;
+
+   return(intSendCmd (CONTROL_CMD_TYPE_SET_CONFIG, var, arg, false));
+}
+
+static PyObject *daqGetConfig (PyObject *self, PyObject *args) {
+   const char   *var;
+
+   if (!PyArg_ParseTuple(args, "s", &var)) return NULL;
+
+   return(intSendCmd (CONTROL_CMD_TYPE_GET_CONFIG, var, NULL, true));
+}
+
+static PyObject *daqGetError (PyObject *self, PyObject *args) {
+   if ( cmem == NULL ) return(NULL);
+   return(Py_BuildValue("s",controlCmdGetError(cmem)));
+}
+
+static PyObject *daqSendXml (PyObject *self, PyObject *args) {
+   const char *xml;
+
+   if (!PyArg_ParseTuple(args, "s", &xml)) return NULL;
+
+   return (intSendXml(xml));
+}
+
+static PyObject *daqDisableTimeout (PyObject *self, PyObject *args) {
+   toDisable = true;
+   return(Py_BuildValue("i",1));
+}
+
+static PyObject *daqWriteRegister (PyObject *self, PyObject *args) {
+   char          buffer[1024];
+   const char *  dev;
+   const char *  reg;
+   uint32_t      val;
+
+   if (!PyArg_ParseTuple(args, "ssi",&dev,&reg,&val)) return NULL;
+
+   sprintf(buffer,"%s 0x%x",reg,val);
+   return(intSendCmd (CONTROL_CMD_TYPE_SET_REGISTER, dev, buffer, false));
+}
+
+// Write a list of (dev, reg, value) with several writes outstanding at once
+static PyObject *daqWriteRegisters (PyObject *self, PyObject *args) {
+   PyObject    * list;
+   Py_ssize_t    count;
+   Py_ssize_t    x;
+   Py_ssize_t    done;
+   const char  * dev;
+   const char  * reg;
+   uint32_t      val;
+   int32_t       slots[CONTROL_CMD_QUEUE_SIZE];
+   int32_t       ok = 1;
+   char          buffer[1024];
+   char          result[CONTROL_CMD_RESULT_SIZE];
+   char          error[CONTROL_CMD_ERROR_SIZE];
+   uint32_t      npend = 0;
+
+   if (!PyArg_ParseTuple(args, "O",&list)) return NULL;
+   if ( cmem == NULL ) return(NULL);
+   if ( (list = PySequence_Fast(list,"expected a sequence of (dev, reg, value)")) == NULL ) return(NULL);
+
+   count = PySequence_Fast_GET_SIZE(list);
+   error[0] = '\0';
+
+   // The oldest write is waited for once the queue is full, the arguments
+   // are parsed with the GIL held
+   for (x=0, done=0; x < count && ok; x++) {
+      if ( !PyArg_ParseTuple(PySequence_Fast_GET_ITEM(list,x),"ssI",&dev,&reg,&val) ) {
+         ok = -1;
+         break;
+      }
+      sprintf(buffer,"%s 0x%x",reg,val);
+
+      Py_BEGIN_ALLOW_THREADS
+      if ( npend == CONTROL_CMD_QUEUE_SIZE - 1 ) {
+         ok = controlCmdWait(cmem,slots[done % (CONTROL_CMD_QUEUE_SIZE - 1)],result,error,10000) && error[0] == '\0';
+         done++;
+         npend--;
+      }
+      if ( ok ) {
+         slots[x % (CONTROL_CMD_QUEUE_SIZE - 1)] = intSubmitCmd(CONTROL_CMD_TYPE_SET_REGISTER,dev,buffer);
+         if ( slots[x % (CONTROL_CMD_QUEUE_SIZE - 1)] < 0 ) ok = 0;
+         else npend++;
+      }
+      Py_END_ALLOW_THREADS
+   }
+
+   // Drain the remaining writes
+   Py_BEGIN_ALLOW_THREADS
+   while ( npend > 0 ) {
+      char tmp[CONTROL_CMD_ERROR_SIZE];
+      if ( ! controlCmdWait(cmem,slots[done % (CONTROL_CMD_QUEUE_SIZE - 1)],result,tmp,10000) ) ok = 0;
+      else if ( ok > 0 && tmp[0] != '\0' ) {
+         strcpy(error,tmp);
+         ok = 0;
+      }
+      done++;
+      npend--;
+   }
+   Py_END_ALLOW_THREADS
+
+   Py_DECREF(list);
+
+   if ( ok < 0 ) return(NULL);
+   if ( ! ok ) {
+      PyErr_SetString(DaqError,(error[0] != '\0') ? error : "Timeout writing registers");
+      return(NULL);
+   }
+   return(Py_BuildValue("n",done));
+}
+
+static PyObject *daqReadRegister (PyObject *self, PyObject *args) {
+   const char   *dev;
+   const char   *reg;
+
+   if (!PyArg_ParseTuple(args, "ss",&dev,&reg)) return NULL;
+
+   return(intSendCmd (CONTROL_CMD_TYPE_GET_REGISTER, dev, reg, false));
+}
+
+static PyObject *daqOpen (PyObject *self, PyObject *args) {
+   uint32_t     id;
+   const char * system;
+
+   if (!PyArg_ParseTuple(args, "si", &system, &id)) return NULL;
+
+   /* Init shared memory */
+   controlCmdOpenAndMap(&cmem,system,id);
+
+   return(Py_BuildValue("i",1));
+}
+
+static PyObject *daqSharedDataOpen (PyObject *self, PyObject *args) {
+   uint32_t     id;
+   int32_t      ret;
+   const char * system;
+
+   if (!PyArg_ParseTuple(args, "si", &system, &id)) return NULL;
+
+   /* Init shared memory */
+   ret = dataSharedOpenAndMap(&dmem,system,id);
+   dataSharedReaderInit(&reader);
+
+   return(Py_BuildValue("i",ret));
+}
+
+static PyObject *daqSharedDataRead (PyObject *self, PyObject *args) {
+   uint8_t  * data;
+   uint32_t   ret;
+   uint32_t   flag;
+   uint32_t   size;
+   uint32_t   count;
+   uint32_t   type;
+   uint32_t * idata;
+   uint32_t   icount;
+   uint32_t   i;
+
+   if ( dmem == NULL ) ret = 0;
+   else ret = dataSharedReadNext(dmem,&reader,&flag,&data,&size);
+
+   frameData = ret ? data : NULL;
+   frameSize = ret ? size : 0;
+
+   type  = (flag >> 28) & 0xF;
+   count = flag & 0x0FFFFFFF;
+
+   PyObject* tupleA = PyTuple_New(3); 
+
+   if ( ret == 0 ) {
+      PyTuple_SetItem(tupleA,0,Py_BuildValue("i",0));
+      PyTuple_SetItem(tupleA,1,Py_BuildValue("i",0));
+   } else {
+      PyTuple_SetItem(tupleA,0,Py_BuildValue("i",count));
+      PyTuple_SetItem(tupleA,1,Py_BuildValue("i",type));
+   }
+
+   if ( ret == 0 ) {
+      PyTuple_SetItem(tupleA,2,Py_BuildValue("i",0));
+   }
+   else if ( type == 0 ) {
+      idata  = (uint32_t *)data;
+      icount = count;
+
+      PyObject* tupleB = PyTuple_New(icount); 
+
+      for (i=0; i < icount; i++) PyTuple_SetItem(tupleB,i,Py_BuildValue("I",idata[i]));
+
+      PyTuple_SetItem(tupleA,2,tupleB);
+   } else {
+      PyTuple_SetItem(tupleA,2,Py_BuildValue("s#",data,(int)count));
+   }
+
+   // Frame was overwritten while being copied, report nothing read
+   if ( ret != 0 && ! dataSharedReadValid(dmem,&reader) ) {
+      Py_DECREF(tupleA);
+      tupleA = PyTuple_New(3);
+      PyTuple_SetItem(tupleA,0,Py_BuildValue("i",0));
+      PyTuple_SetItem(tupleA,1,Py_BuildValue("i",0));
+      PyTuple_SetItem(tupleA,2,Py_BuildValue("i",0));
+   }
+
+   return tupleA; 
+}
+
+static void intArrayDealloc (PyObject *self) {
+   DaqArray *arr = (DaqArray *)self;
+
+   if ( arr->owned ) free(arr->data);
+   PyObject_Del(self);
+}
+
+static int intArrayGetBuffer (PyObject *self, Py_buffer *view, int flags) {
+   DaqArray *arr = (DaqArray *)self;
+
+   // Takes the reference on the array and refuses writable requests
+   if ( PyBuffer_FillInfo(view,self,arr->data,arr->len,1,flags) < 0 ) return(-1);
+
+   // Consumers that do not ask for a shape get the array as plain bytes
+   if ( (flags & PyBUF_ND) == PyBUF_ND ) {
+      view->format   = arr->format;
+      view->itemsize = arr->itemsize;
+      view->ndim     = arr->ndim;
+      view->shape    = arr->shape;
+      view->strides  = ((flags & PyBUF_STRIDES) == PyBUF_STRIDES) ? arr->strides : NULL;
+   }
+   return(0);
+}
+
+// Row major array of rows x cols items, or of rows items when cols is 0.
+// Allocates and owns the memory when data is NULL.
+static DaqArray *intNewArray (uint8_t *data, const char *format, Py_ssize_t itemsize, Py_ssize_t rows, Py_ssize_t cols) {
+   DaqArray *arr;
+
+   if ( (arr = PyObject_New(DaqArray,&DaqArrayType)) == NULL ) return(NULL);
+
+   arr->ndim       = (cols == 0) ? 1 : 2;
+   arr->shape[0]   = rows;
+   arr->shape[1]   = cols;
+   arr->strides[0] = (cols == 0) ? itemsize : cols * itemsize;
+   arr->strides[1] = itemsize;
+   arr->itemsize   = itemsize;
+   arr->len        = rows * ((cols == 0) ? 1 : cols) * itemsize;
+   arr->format[0]  = format[0];
+   arr->format[1]  = 0;
+   arr->owned      = (data == NULL);
+   arr->data       = data;
+
+   if ( arr->owned && (arr->data = (uint8_t *)malloc(arr->len ? arr->len : 1)) == NULL ) {
+      arr->owned = false;
+      Py_DECREF(arr);
+      PyErr_NoMemory();
+      return(NULL);
+   }
+   return(arr);
+}
+
+// Memoryview of an array, which then lives as long as the view
+static PyObject *intArrayView (DaqArray *arr) {
+   PyObject *view;
+
+   if ( arr == NULL ) return(NULL);
+   view = PyMemoryView_FromObject((PyObject *)arr);
+   Py_DECREF(arr);
+   return(view);
+}
+
+// Wait, without holding the GIL, for the next frame. Returns 1 if there is one.
+static PyObject *daqSharedDataWait (PyObject *self, PyObject *args) {
+   uint32_t timeout = 0;
+   int32_t  ret;
+
+   if (!PyArg_ParseTuple(args, "|I", &timeout)) return NULL;
+   if ( dmem == NULL ) return(Py_BuildValue("i",0));
+
+   Py_BEGIN_ALLOW_THREADS
+   ret = dataSharedWait(dmem,&reader,timeout);
+   Py_END_ALLOW_THREADS
+
+   return(Py_BuildValue("i",ret));
+}
+
+// Next frame as (count, type, view) without copying it, numpy.frombuffer
+// turns the view into an array. The frame can be overwritten at any time,
+// daqSharedDataValid says whether it was intact after it has been used.
+static PyObject *daqSharedDataView (PyObject *self, PyObject *args) {
+   uint8_t  * data;
+   uint32_t   flag;
+   uint32_t   size;
+   PyObject * view;
+
+   if ( dmem == NULL || ! dataSharedReadNext(dmem,&reader,&flag,&data,&size) ) {
+      frameData = NULL;
+      frameSize = 0;
+      return(Py_BuildValue("iiO",0,0,Py_None));
+   }
+
+   frameData = data;
+   frameSize = size;
+
+   if ( (view = intArrayView(intNewArray(data,"B",1,size,0))) == NULL ) return(NULL);
+   return(Py_BuildValue("IIN",flag & 0x0FFFFFFF,(flag >> 28) & 0xF,view));
+}
+
+// Whether the last frame is still intact
+static PyObject *daqSharedDataValid (PyObject *self, PyObject *args) {
+   if ( dmem == NULL || frameData == NULL ) return(Py_BuildValue("i",0));
+   return(Py_BuildValue("i",dataSharedReadValid(dmem,&reader)));
+}
+
+// Frames read, frames missed and frames the writer dropped as too large
+static PyObject *daqSharedDataStats (PyObject *self, PyObject *args) {
+   if ( dmem == NULL ) return(Py_BuildValue("KKK",0ULL,0ULL,0ULL));
+   return(Py_BuildValue("KKK",(unsigned long long)reader.frames,
+                              (unsigned long long)reader.missed,
+                              (unsigned long long)dmem->dropCount));
+}
+
+// Samples in each packet of a TPC stream record, 0 for a bad packet.
+// Returns the number of packets.
+static uint32_t intStreamPackets ( const uint64_t *rec, uint32_t n64, const uint64_t **pkts, uint32_t *pn64s, int *types, int *nsamples ) {
+   const uint32_t *toc   = (const uint32_t *)(rec + 8);
+   uint32_t        tn64  = (toc[0] >>  8) & 0xfff;
+   uint32_t        npkts = (toc[0] >> 24) & 0xff;
+   const uint64_t *data;
+   uint32_t        ndata;
+   uint32_t        i;
+
+   if ( n64 < 10 || tn64 < 1 || 8 + tn64 + 1 > n64 || (npkts + 2) * 4 > tn64 * 8 ) return(0);
+
+   data  = rec + 8 + tn64 + 1;
+   ndata = n64 - (8 + tn64 + 1);
+
+   for (i=0; i < npkts; i++) {
+      uint32_t beg = toc[1 + i] >> 8;
+      uint32_t end = toc[2 + i] >> 8;
+
+      if ( end < beg || end > ndata ) return(i);
+
+      pkts[i]     = data + beg;
+      pn64s[i]    = end - beg;
+      types[i]    = (toc[1 + i] >> 4) & 0xf;
+      nsamples[i] = 0;
+
+      if ( types[i] == 1 ) nsamples[i] = pn64s[i] / WIBUNPACK_K_N64FRAME;
+      else if ( types[i] == 2 ) {
+         WibTransposed view;
+         if ( wibTransposed_locate(&view,pkts[i],pn64s[i]) == 0 && view.nchans == WIBUNPACK_K_NCHANNELS ) nsamples[i] = view.nsamples;
+      }
+      else if ( types[i] == 3 ) {
+         WibDecodeToc dtoc;
+         if ( wibDecode_toc(&dtoc,pkts[i],pn64s[i]) == WIBDECODE_K_OK && dtoc.nchans == WIBUNPACK_K_NCHANNELS ) nsamples[i] = dtoc.nsamples;
+      }
+   }
+   return(npkts);
+}
+
+// Decode the TPC streams of the last frame into channel x tick uint16
+// arrays. Returns a list of (csf, timestamp, view) with one entry per
+// stream, or None if the frame was overwritten. Each view owns its array.
+static PyObject *daqSharedDataAdcs (PyObject *self, PyObject *args) {
+   const uint64_t * frag = (const uint64_t *)frameData;
+   const uint64_t * recs[ADC_MAX_STREAMS];
+   uint32_t         rn64s[ADC_MAX_STREAMS];
+   int              totals[ADC_MAX_STREAMS];
+   DaqArray       * arrays[ADC_MAX_STREAMS];
+   const uint64_t * pkts[256];
+   uint32_t         pn64s[256];
+   int              types[256];
+   int              nsamples[256];
+   uint32_t         n64 = frameSize / 8;
+   uint32_t         nrecs = 0;
+   uint32_t         idx;
+   uint32_t         end;
+   uint32_t         i;
+   uint32_t         p;
+   bool             ok = true;
+
+   if ( frag == NULL ) return(PyList_New(0));
+
+   // A frame was skipped, missed or overwritten since the last one decoded,
+   // or this one is decoded again. The saved models are stale, so drop them,
+   // a packet that refers back to one then fails rather than decoding wrongly.
+   if ( reader.generation != adcGeneration || reader.seq != adcSeq + 1 || reader.missed != adcMissed ) {
+      for (i=0; i < ADC_MAX_CSF; i++)
+         if ( adcModels[i] != NULL ) memset(adcModels[i],0,sizeof(WibDecodeModels));
+   }
+   adcGeneration = reader.generation;
+   adcSeq        = reader.seq;
+   adcMissed     = reader.missed;
+
+   // Locate the stream records behind the header and originator
+   if ( n64 >= 5 && ((frag[0] >> 4) & 0xf) == 2 ) {
+      end = n64 - 1;
+      idx = 1 + ((frag[0] >> 32) & 0xf);
+      if ( idx < end ) idx += ((uint32_t)frag[idx] >> 8) & 0xfff;
+      while ( idx < end && nrecs < ADC_MAX_STREAMS ) {
+         uint32_t sn64 = (frag[idx] >> 8) & 0xffffff;
+         if ( (frag[idx] & 0xf) != 1 || sn64 < 10 || sn64 > end - idx ) break;
+         recs[nrecs]  = frag + idx;
+         rn64s[nrecs] = sn64;
+         nrecs++;
+         idx += sn64;
+      }
+   }
+
+   // Size each stream and allocate its array
+   for (i=0; i < nrecs; i++) {
+      uint32_t npkts = intStreamPackets(recs[i],rn64s[i],pkts,pn64s,types,nsamples);
+      totals[i] = 0;
+      for (p=0; p < npkts; p++) totals[i] += nsamples[p];
+
+      if ( (arrays[i] = intNewArray(NULL,"H",sizeof(uint16_t),WIBUNPACK_K_NCHANNELS,totals[i])) == NULL ) {
+         for (p=0; p < i; p++) Py_DECREF(arrays[p]);
+         return(NULL);
+      }
+   }
+
+   // Unpack, copy or decode each packet into its columns of the stream
+   for (i=0; i < nrecs; i++) {
+      uint32_t   csf   = (recs[i][0] >> 36) & 0xfff;
+      uint32_t   npkts = intStreamPackets(recs[i],rn64s[i],pkts,pn64s,types,nsamples);
+      uint16_t * adcs  = (uint16_t *)arrays[i]->data;
+      int        pitch = totals[i];
+      int        col   = 0;
+
+      for (p=0; p < npkts; p++) {
+         if ( nsamples[p] == 0 ) continue;
+
+         if ( types[p] == 1 )
+            wibUnpack(adcs + col,pitch,pkts[p],nsamples[p],WIBUNPACK_K_N64FRAME,WIBUNPACK_K_BEST);
+         else if ( types[p] == 2 ) {
+            WibTransposed view;
+            wibTransposed_locate(&view,pkts[p],pn64s[p]);
+            for (int c=0; c < WIBUNPACK_K_NCHANNELS; c++)
+               memcpy(adcs + c * pitch + col,view.adcs + c * view.pitch,nsamples[p] * sizeof(uint16_t));
+         }
+         else {
+            WibDecodeToc dtoc;
+            if ( adcModels[csf] == NULL ) adcModels[csf] = (WibDecodeModels *)calloc(1,sizeof(WibDecodeModels));
+            if ( adcModels[csf] == NULL || wibDecode_packet(adcs + col,pitch,pkts[p],pn64s[p],&dtoc,adcModels[csf]) != WIBDECODE_K_OK )
+               for (int c=0; c < WIBUNPACK_K_NCHANNELS; c++) memset(adcs + c * pitch + col,0,nsamples[p] * sizeof(uint16_t));
+         }
+         col += nsamples[p];
+      }
+   }
+
+   // The frame was overwritten while it was being decoded
+   if ( ! dataSharedReadValid(dmem,&reader) ) {
+      for (i=0; i < nrecs; i++) Py_DECREF(arrays[i]);
+      Py_RETURN_NONE;
+   }
+
+   // Each view takes over the reference on its array
+   PyObject *list = PyList_New(nrecs);
+   for (i=0; i < nrecs; i++) {
+      uint32_t   csf  = (recs[i][0] >> 36) & 0xfff;
+      PyObject * view = ok ? intArrayView(arrays[i]) : NULL;
+      if ( view == NULL ) {
+         if ( ok ) ok = false;
+         else Py_DECREF(arrays[i]);
+      }
+      else PyList_SetItem(list,i,Py_BuildValue("IKN",csf,(unsigned long long)frag[2],view));
+   }
+   if ( ! ok ) {
+      Py_DECREF(list);
+      return(NULL);
+   }
+   return(list);
+}
+
+static PyMethodDef DaqMethods[] = {
+   {"daqOpen",             daqOpen,             METH_VARARGS, ""},
+   {"daqHardReset",        daqHardReset,        METH_VARARGS, ""},
+   {"daqSoftReset",        daqSoftReset,        METH_VARARGS, ""},
+   {"daqRefreshState",     daqRefreshstate,     METH_VARARGS, ""},
+   {"daqSetDefaults",      daqSetDefaults,      METH_VARARGS, ""},
+   {"daqLoadSettings",     daqLoadSettings,     METH_VARARGS, ""},
+   {"daqSaveSettings",     daqSaveSettings,     METH_VARARGS, ""},
+   {"daqOpenData",         daqOpenData,         METH_VARARGS, ""},
+   {"daqCloseData",        daqCloseData,        METH_VARARGS, ""},
+   {"daqSetRunParameters", daqSetRunParameters, METH_VARARGS, ""},
+   {"daqSetRunState",      daqSetRunState,      METH_VARARGS, ""},
+   {"daqGetRunState",      daqRunState,         METH_VARARGS, ""},
+   {"daqResetCounters",    daqResetCounters,    METH_VARARGS, ""},
+   {"daqSendCommand",      daqSendCommand,      METH_VARARGS, ""},
+   {"daqReadStatus",       daqReadStatus,       METH_VARARGS, ""},
+   {"daqGetStatus",        daqGetStatus,        METH_VARARGS, ""},
+   {"daqReadConfig",       daqReadConfig,       METH_VARARGS, ""},
+   {"daqVerifyConfig",     daqVerifyConfig,     METH_VARARGS, ""},
+   {"daqSetConfig",        daqSetConfig,        METH_VARARGS, ""},
+   {"daqGetConfig",        daqGetConfig,        METH_VARARGS, ""},
+   {"daqGetError",         daqGetError,         METH_VARARGS, ""},
+   {"daqSendXml",          daqSendXml,          METH_VARARGS, ""},
+   {"daqDisableTimeout",   daqDisableTimeout,   METH_VARARGS, ""},
+   {"daqReadRegister",     daqReadRegister,     METH_VARARGS, ""},
+   {"daqWriteRegister",    daqWriteRegister,    METH_VARARGS, ""},
+   {"daqWriteRegisters",   daqWriteRegisters,   METH_VARARGS, "Write a list of (dev, reg, value), several at a time"},
+   {"daqSharedDataOpen",   daqSharedDataOpen,   METH_VARARGS, ""},
+   {"daqSharedDataRead",   daqSharedDataRead,   METH_VARARGS, ""},
+   {"daqSharedDataWait",   daqSharedDataWait,   METH_VARARGS, "Wait for a frame, timeout in usec, 0 = forever"},
+   {"daqSharedDataView",   daqSharedDataView,   METH_VARARGS, "Next frame as (count, type, view), without a copy"},
+   {"daqSharedDataValid",  daqSharedDataValid,  METH_VARARGS, "Whether the last frame was left intact"},
+   {"daqSharedDataAdcs",   daqSharedDataAdcs,   METH_VARARGS, "Last frame's streams as [(csf, timestamp, channel x tick view)]"},
+   {"daqSharedDataStats",  daqSharedDataStats,  METH_VARARGS, "(frames, missed, dropped)"},
+   {NULL,                  NULL,                0,            NULL} /* Sentinel */
+};
+
+PyMODINIT_FUNC initpythonDaq(void) {
+   PyObject *m;
+
+   DaqArrayBuffer.bf_getbuffer = intArrayGetBuffer;
+   DaqArrayType.tp_name        = "pythonDaq.array";
+   DaqArrayType.tp_basicsize   = sizeof(DaqArray);
+   DaqArrayType.tp_dealloc     = intArrayDealloc;
+   DaqArrayType.tp_as_buffer   = &DaqArrayBuffer;
+   DaqArrayType.tp_flags       = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_NEWBUFFER;
+   if ( PyType_Ready(&DaqArrayType) < 0 ) return;
+
+   m = Py_InitModule("pythonDaq", DaqMethods);
+
+   DaqError = PyErr_NewException("Daq.error",NULL,NULL);
+   Py_INCREF(DaqError);
+   PyModule_AddObject(m,"error",DaqError);
+
+   toDisable = false;
+   cmem = NULL;
+}
+
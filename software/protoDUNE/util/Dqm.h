@@ -0,0 +1,1212 @@
+// -*-Mode: C;-*-
+
+#ifndef _DQM_H_
+#define _DQM_H_
+
+/* ---------------------------------------------------------------------- *//*!
+ *
+ *  @file     Dqm.h
+ *  @brief    Online data quality monitoring of the TPC channels
+ *  @verbatim
+ *                               Copyright 2018
+ *                                    by
+ *
+ *                       The Board of Trustees of the
+ *                    Leland Stanford Junior University.
+ *                           All rights reserved.
+ *
+ *  @endverbatim
+ *
+ *  @par Facility:
+ *  pdd
+ *
+ *  @author
+ *  <russell@slac.stanford.edu>
+ *
+ *  @par Date created:
+ *  <2018/08/27>
+ *
+ * @par Credits:
+ * SLAC
+ *
+ *  @par
+ *  The fragments are given to dqm_fragment as they are received. Each
+ *  TPC stream record is one source, identified by the Crate.Slot.Fiber
+ *  in its bridge, of 128 channels. Its packets, WIB frames, transposed
+ *  or compressed, are unpacked or decoded into the channel ordered
+ *  ADCs of the caller's scratch area and, for each channel, the number
+ *  of samples, the sum and sum of squares of the ADCs and the number
+ *  of samples with a stuck code, the low 6 bits all 0 or all 1, are
+ *  accumulated. These are the vectorized loops. One in every
+ *  fftEvery packets of a source, the power spectrum of the first
+ *  DQM_K_NFFT samples of each channel is accumulated in DQM_K_NBANDS
+ *  equal bands from 0 to the 1 MHz Nyquist frequency.
+ *
+ *  The work is sharded by channel through the sources: the caller must
+ *  ensure that the fragments of a given source are always given by the
+ *  same thread, as the receivers' workers do by connection. The stream
+ *  is accumulated privately in the scratch area and merged into the
+ *  source under its lock, so the lock is only held for the merge.
+ *
+ *  Every cadence ms, a thread takes and clears the accumulators of each
+ *  source and sends a snapshot, one UDP datagram per source, of a
+ *  DqmRecord followed by the 128 DqmChannel's. The quantities are
+ *  scaled to 16 bits so a snapshot of 15360 channels is about 350 KB.
+ *  A final snapshot is sent by dqm_destroy.
+ *
+\* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *\
+
+   HISTORY
+   -------
+
+   DATE       WHO WHAT
+   ---------- --- ---------------------------------------------------------
+   2018.08.27 jjr Created
+
+\* ---------------------------------------------------------------------- */
+
+
+#include "WibUnpack.h"
+#include "WibDecode.h"
+#include "WibTransposed.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+
+
+#define DQM_K_MAGIC      0x314d5144  /*!< "DQM1", little endian           */
+#define DQM_K_VERSION             1  /*!< Snapshot record version         */
+#define DQM_K_MAXSOURCES        128  /*!< Maximum number of sources       */
+#define DQM_K_NCSF             4096  /*!< Number of Crate.Slot.Fiber's    */
+#define DQM_K_NCHANNELS         128  /*!< Channels per source             */
+#define DQM_K_MAXSAMPLES       4096  /*!< Maximum samples per packet      */
+#define DQM_K_NFFT              256  /*!< Samples per power spectrum      */
+#define DQM_K_NBANDS              8  /*!< Number of frequency bands       */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \struct _DqmRecord
+  \brief   The header of a source's snapshot datagram
+                                                                          *//*!
+  \typedef DqmRecord
+  \brief   Typedef for struct _DqmRecord
+
+   The header is followed by nchans DqmChannel's. All fields are little
+   endian.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+struct _DqmRecord
+{
+   uint32_t     magic;  /*!< DQM_K_MAGIC                                  */
+   uint16_t   version;  /*!< DQM_K_VERSION                                */
+   uint16_t       csf;  /*!< The source's Crate.Slot.Fiber                */
+   uint16_t    nchans;  /*!< Number of DqmChannel's that follow           */
+   uint16_t    nbands;  /*!< Number of frequency bands per channel        */
+   uint32_t  sequence;  /*!< Snapshot number                              */
+   uint32_t  interval;  /*!< Time covered by this snapshot, in ms         */
+   uint32_t  npackets;  /*!< Number of packets accumulated                */
+   uint32_t   nerrors;  /*!< Number of packets that could not be used     */
+   uint32_t     nffts;  /*!< Number of spectra accumulated per channel    */
+   uint64_t timestamp;  /*!< WIB timestamp of the last packet             */
+   uint64_t  nsamples;  /*!< Number of samples accumulated per channel    */
+};
+/* ---------------------------------------------------------------------- */
+typedef struct _DqmRecord DqmRecord;
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \struct _DqmChannel
+  \brief   The snapshot of one channel
+                                                                          *//*!
+  \typedef DqmChannel
+  \brief   Typedef for struct _DqmChannel
+
+   Values that do not fit saturate. A channel with no samples has all 0.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+struct _DqmChannel
+{
+   uint16_t         pedestal;  /*!< Mean ADC, in 1/16 ADC counts          */
+   uint16_t              rms;  /*!< RMS, in 1/256 ADC counts              */
+   uint16_t            stuck;  /*!< Fraction of stuck codes, in 1/65535   */
+   int16_t bands[DQM_K_NBANDS];/*!< Mean power per frequency bin of each
+                                    band, in 0.01 dB relative to 1 ADC^2  */
+};
+/* ---------------------------------------------------------------------- */
+typedef struct _DqmChannel DqmChannel;
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \struct _DqmAccum
+  \brief   The accumulators of one source
+                                                                          *//*!
+  \typedef DqmAccum
+  \brief   Typedef for struct _DqmAccum
+                                                                          */
+/* ---------------------------------------------------------------------- */
+struct _DqmAccum
+{
+   uint64_t                     nsamples; /*!< Samples per channel       */
+   uint64_t                    timestamp; /*!< Of the last packet        */
+   uint32_t                     npackets; /*!< Packets accumulated       */
+   uint32_t                      nerrors; /*!< Packets not used          */
+   uint32_t                        nffts; /*!< Spectra accumulated       */
+   uint64_t         sum[DQM_K_NCHANNELS]; /*!< Sum of the ADCs           */
+   uint64_t       sumsq[DQM_K_NCHANNELS]; /*!< Sum of the ADCs squared   */
+   uint32_t       stuck[DQM_K_NCHANNELS]; /*!< Number of stuck codes     */
+   float bands[DQM_K_NCHANNELS][DQM_K_NBANDS];
+                                          /*!< Summed power by band      */
+};
+/* ---------------------------------------------------------------------- */
+typedef struct _DqmAccum DqmAccum;
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \struct _DqmSource
+  \brief   One source, a TPC stream
+                                                                          *//*!
+  \typedef DqmSource
+  \brief   Typedef for struct _DqmSource
+                                                                          */
+/* ---------------------------------------------------------------------- */
+struct _DqmSource
+{
+   pthread_mutex_t       lock;  /*!< Protects the accumulators            */
+   DqmAccum             accum;  /*!< Accumulated since the last snapshot  */
+   uint32_t               csf;  /*!< Its Crate.Slot.Fiber                 */
+   uint32_t          npackets;  /*!< Packets seen, used to pace the FFTs,
+                                     only used by the source's thread     */
+   WibDecodeModels     models;  /*!< Compressed histogram models, only
+                                     used by the source's thread          */
+};
+/* ---------------------------------------------------------------------- */
+typedef struct _DqmSource DqmSource;
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \struct _DqmScratch
+  \brief   The working storage of one calling thread
+                                                                          *//*!
+  \typedef DqmScratch
+  \brief   Typedef for struct _DqmScratch
+                                                                          */
+/* ---------------------------------------------------------------------- */
+struct _DqmScratch
+{
+   uint16_t           *adcs;  /*!< Unpacked ADCs, DQM_K_MAXSAMPLES per
+                                   channel                                */
+   DqmAccum           accum;  /*!< The stream being accumulated           */
+   float     re[DQM_K_NFFT];  /*!< FFT, real      part                    */
+   float     im[DQM_K_NFFT];  /*!< FFT, imaginary part                    */
+};
+/* ---------------------------------------------------------------------- */
+typedef struct _DqmScratch DqmScratch;
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \struct _Dqm
+  \brief   The data quality monitor
+                                                                          *//*!
+  \typedef Dqm
+  \brief   Typedef for struct _Dqm
+                                                                          */
+/* ---------------------------------------------------------------------- */
+struct _Dqm
+{
+   DqmSource               *sources;  /*!< The sources                    */
+   int volatile            nsources;  /*!< Number of sources assigned     */
+   int16_t         map[DQM_K_NCSF];  /*!< Crate.Slot.Fiber to source, -1
+                                          if not assigned                 */
+   pthread_mutex_t          mapLock;  /*!< Protects assigning sources     */
+   int                     fftEvery;  /*!< Packets per spectrum, 0 = none */
+   uint32_t                 cadence;  /*!< Snapshot period, in ms         */
+   float    cos[DQM_K_NFFT / 2];      /*!< FFT twiddles, real      part   */
+   float    sin[DQM_K_NFFT / 2];      /*!< FFT twiddles, imaginary part   */
+   uint16_t reverse[DQM_K_NFFT];      /*!< FFT bit reversed indices       */
+   int                           fd;  /*!< The snapshot socket            */
+   struct sockaddr_storage     addr;  /*!< The snapshot destination       */
+   socklen_t                addrlen;  /*!< Its length                     */
+   pthread_t                 thread;  /*!< The snapshot thread            */
+   pthread_mutex_t             lock;  /*!< Protects stop                  */
+   pthread_cond_t              cond;  /*!< Signals stop                   */
+   int                         stop;  /*!< Set to stop the thread         */
+   uint64_t                    last;  /*!< Time of the last snapshot, ms  */
+   uint32_t                sequence;  /*!< Snapshot number                */
+   uint64_t                   nsent;  /*!< Datagrams sent                 */
+   uint64_t                 nfailed;  /*!< Datagrams that failed to send  */
+   uint64_t               noverflow;  /*!< Streams from too many sources  */
+};
+/* ---------------------------------------------------------------------- */
+typedef struct _Dqm Dqm;
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- */
+/* PROTOTYPES                                                             */
+/* ---------------------------------------------------------------------- */
+static inline int  dqm_create         (Dqm                   *dqm,
+                                       char const           *dest,
+                                       uint32_t           cadence,
+                                       int               fftEvery);
+
+static inline int  dqmScratch_create  (DqmScratch        *scratch);
+
+static inline void dqm_fragment       (Dqm                   *dqm,
+                                       DqmScratch        *scratch,
+                                       uint64_t const       *frag,
+                                       uint32_t               n64);
+
+static inline void dqmScratch_destroy (DqmScratch        *scratch);
+
+static inline void dqm_destroy        (Dqm                   *dqm);
+
+static inline void dqm_print          (Dqm const             *dqm);
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- */
+/* LOCAL PROTOTYPES                                                       */
+/* ---------------------------------------------------------------------- */
+static inline DqmSource *
+                   dqm_source         (Dqm                   *dqm,
+                                       uint32_t               csf);
+
+static inline void dqm_stream         (Dqm                   *dqm,
+                                       DqmScratch        *scratch,
+                                       uint64_t const        *rec,
+                                       uint32_t               n64);
+
+static inline void dqm_channels       (DqmAccum            *accum,
+                                       uint16_t const       *adcs,
+                                       int                  pitch,
+                                       int               nsamples);
+
+static inline void dqm_spectra        (Dqm const             *dqm,
+                                       DqmScratch        *scratch,
+                                       uint16_t const       *adcs,
+                                       int                  pitch);
+
+static inline void dqm_snapshot       (Dqm                   *dqm);
+
+static void       *dqm_run            (void                  *arg);
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Returns a millisecond clock
+  \return The time in ms
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline uint64_t dqm_now (void)
+{
+   struct timespec ts;
+   clock_gettime (CLOCK_MONOTONIC, &ts);
+   return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Creates the monitor and starts its snapshot thread
+  \retval == 0, success
+  \retval != 0, the destination could not be resolved or there was no
+                memory
+
+  \param[out]     dqm  The monitor
+  \param[in]     dest  The snapshot destination, host:port
+  \param[in]  cadence  The snapshot period, in ms
+  \param[in] fftEvery  Accumulate a spectrum every this many packets of a
+                       source, 0 for never
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline int dqm_create (Dqm          *dqm,
+                              char const  *dest,
+                              uint32_t  cadence,
+                              int      fftEvery)
+{
+   memset (dqm, 0, sizeof (*dqm));
+   memset (dqm->map, 0xff, sizeof (dqm->map));
+   dqm->cadence  = cadence ? cadence : 1000;
+   dqm->fftEvery = fftEvery;
+   dqm->fd       = -1;
+
+
+   // -----------------------------------
+   // Resolve the host:port destination
+   // -----------------------------------
+   char        host[256];
+   char const *colon = strrchr (dest, ':');
+   size_t       nhost = colon ? (size_t)(colon - dest) : 0;
+   if (nhost == 0 || nhost >= sizeof (host))
+   {
+      fprintf (stderr, "Dqm: destination %s is not host:port\n", dest);
+      return -1;
+   }
+   memcpy (host, dest, nhost);
+   host[nhost] = 0;
+
+   struct addrinfo  hints;
+   struct addrinfo   *res;
+   memset (&hints, 0, sizeof (hints));
+   hints.ai_family   = AF_INET;
+   hints.ai_socktype = SOCK_DGRAM;
+
+   int status = getaddrinfo (host, colon + 1, &hints, &res);
+   if (status)
+   {
+      fprintf (stderr, "Dqm: can not resolve %s: %s\n",
+               dest, gai_strerror (status));
+      return -1;
+   }
+
+   dqm->fd      = socket (res->ai_family, res->ai_socktype, res->ai_protocol);
+   dqm->addrlen = res->ai_addrlen;
+   memcpy (&dqm->addr, res->ai_addr, res->ai_addrlen);
+   freeaddrinfo (res);
+   if (dqm->fd < 0) return -1;
+
+
+   dqm->sources = (DqmSource *)calloc (DQM_K_MAXSOURCES,
+                                       sizeof (*dqm->sources));
+   if (dqm->sources == NULL) return -1;
+
+   for (int idx = 0; idx < DQM_K_MAXSOURCES; idx++)
+   {
+      pthread_mutex_init (&dqm->sources[idx].lock, NULL);
+   }
+
+
+   // ------------------------------------------------------
+   // The twiddle factors and bit reversal of a radix 2 FFT
+   // ------------------------------------------------------
+   int nbits = 0;
+   while ((1 << nbits) < DQM_K_NFFT) nbits++;
+
+   for (int idx = 0; idx < DQM_K_NFFT; idx++)
+   {
+      int rev = 0;
+      for (int ibit = 0; ibit < nbits; ibit++)
+      {
+         rev |= ((idx >> ibit) & 1) << (nbits - 1 - ibit);
+      }
+      dqm->reverse[idx] = rev;
+   }
+
+   for (int idx = 0; idx < DQM_K_NFFT / 2; idx++)
+   {
+      double phi    = -2.0 * M_PI * idx / DQM_K_NFFT;
+      dqm->cos[idx] = cos (phi);
+      dqm->sin[idx] = sin (phi);
+   }
+
+
+   pthread_condattr_t attr;
+   pthread_condattr_init     (&attr);
+   pthread_condattr_setclock (&attr, CLOCK_MONOTONIC);
+   pthread_mutex_init (&dqm->mapLock, NULL);
+   pthread_mutex_init (&dqm->lock,    NULL);
+   pthread_cond_init  (&dqm->cond,   &attr);
+   pthread_condattr_destroy (&attr);
+
+   dqm->last = dqm_now ();
+   pthread_create (&dqm->thread, NULL, dqm_run, dqm);
+
+   return 0;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Allocates the working storage of one calling thread
+  \retval == 0, success
+  \retval != 0, no memory
+
+  \param[out] scratch  The working storage
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline int dqmScratch_create (DqmScratch *scratch)
+{
+   memset (scratch, 0, sizeof (*scratch));
+   scratch->adcs = (uint16_t *)malloc ((size_t)DQM_K_NCHANNELS
+                                     * DQM_K_MAXSAMPLES
+                                     * sizeof (*scratch->adcs));
+   return scratch->adcs == NULL;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Frees the working storage of one calling thread
+
+  \param[in] scratch  The working storage
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline void dqmScratch_destroy (DqmScratch *scratch)
+{
+   free (scratch->adcs);
+   scratch->adcs = NULL;
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Returns the source with Crate.Slot.Fiber \a csf, assigning it
+          if this is the first time it is seen
+  \return The source, NULL if there are already DQM_K_MAXSOURCES
+
+  \param[in] dqm  The monitor
+  \param[in] csf  The Crate.Slot.Fiber
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline DqmSource *dqm_source (Dqm *dqm, uint32_t csf)
+{
+   int isrc = dqm->map[csf];
+   if (isrc >= 0) return &dqm->sources[isrc];
+
+   pthread_mutex_lock (&dqm->mapLock);
+   isrc = dqm->map[csf];
+   if (isrc < 0 && dqm->nsources < DQM_K_MAXSOURCES)
+   {
+      isrc = dqm->nsources;
+      dqm->sources[isrc].csf = csf;
+      __sync_synchronize ();
+      dqm->map[csf]  = isrc;
+      dqm->nsources  = isrc + 1;
+   }
+   pthread_mutex_unlock (&dqm->mapLock);
+
+   return isrc >= 0 ? &dqm->sources[isrc] : NULL;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Accumulates the channels of each TPC stream in a fragment
+
+  \param[in]      dqm  The monitor
+  \param[in]  scratch  The calling thread's working storage
+  \param[in]     frag  The fragment, beginning with Header0
+  \param[in]      n64  Its length in 64-bit words
+
+  \par
+   Only the record lengths needed to locate the streams are checked,
+   a fragment that fails them is ignored. Use TpcCheck.h for a full
+   check.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline void dqm_fragment (Dqm              *dqm,
+                                 DqmScratch   *scratch,
+                                 uint64_t const  *frag,
+                                 uint32_t          n64)
+{
+   if (n64 < 5 || ((frag[0] >> 4) & 0xf) != 2) return;
+
+   uint32_t  end = n64 - 1;
+   uint32_t  idx = 1 + ((frag[0] >> 32) & 0xf);
+   if (idx >= end) return;
+
+   idx += ((uint32_t)frag[idx] >> 8) & 0xfff;
+   while (idx < end)
+   {
+      uint64_t shdr = frag[idx];
+      uint32_t sn64 = (shdr >> 8) & 0xffffff;
+      if ((shdr & 0xf) != 1 || sn64 < 10 || sn64 > end - idx) return;
+
+      dqm_stream (dqm, scratch, frag + idx, sn64);
+      idx += sn64;
+   }
+
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Accumulates the packets of one TPC stream record
+
+  \param[in]      dqm  The monitor
+  \param[in]  scratch  The calling thread's working storage
+  \param[in]      rec  The stream record, beginning with its Header1
+  \param[in]      n64  Its length in 64-bit words
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline void dqm_stream (Dqm              *dqm,
+                               DqmScratch   *scratch,
+                               uint64_t const   *rec,
+                               uint32_t          n64)
+{
+   uint32_t     csf = (rec[0] >> 36) & 0xfff;
+   DqmSource   *src = dqm_source (dqm, csf);
+   if (src == NULL)
+   {
+      __sync_fetch_and_add (&dqm->noverflow, 1);
+      return;
+   }
+
+   DqmAccum  *accum = &scratch->accum;
+   memset (accum, 0, sizeof (*accum));
+
+
+   // -------------------------------------------------------------
+   // Locate the packets through the Toc, it follows the 7 word
+   // Ranges record.  The packet data follows the Toc and the
+   // packet record's Header1.
+   // -------------------------------------------------------------
+   uint32_t const *toc = (uint32_t const *)(rec + 8);
+   uint32_t       tn64 = (toc[0] >>  8) & 0xfff;
+   uint32_t      npkts = (toc[0] >> 24) & 0xff;
+   if (tn64 < 1 || 8 + tn64 + 1 > n64
+     || (npkts + 2) * sizeof (*toc) > tn64 * sizeof (uint64_t))
+   {
+      accum->nerrors = 1;
+      npkts          = 0;
+   }
+
+   uint64_t const *data = rec + 8 + tn64 + 1;
+   uint32_t       ndata = n64 - (8 + tn64 + 1);
+
+   for (uint32_t ipkt = 0; ipkt < npkts; ipkt++)
+   {
+      uint32_t        beg = toc[1 + ipkt] >> 8;
+      uint32_t        end = toc[2 + ipkt] >> 8;
+      int            type = (toc[1 + ipkt] >> 4) & 0xf;
+      uint64_t const *pkt = data + beg;
+      uint32_t       pn64 = end - beg;
+      uint16_t const *adcs;
+      int           pitch;
+      int        nsamples;
+      uint64_t  timestamp;
+
+      if (end < beg || end > ndata)
+      {
+         accum->nerrors += 1;
+         break;
+      }
+
+
+      // -------------------------------------------------------
+      // Transposed packets are used in place, the others are
+      // unpacked or decoded into the scratch area.
+      // -------------------------------------------------------
+      if (type == 1)
+      {
+         nsamples = pn64 / WIBUNPACK_K_N64FRAME;
+         if (nsamples < 1 || nsamples > DQM_K_MAXSAMPLES)
+         {
+            accum->nerrors += 1;
+            continue;
+         }
+
+         adcs      = scratch->adcs;
+         pitch     = DQM_K_MAXSAMPLES;
+         timestamp = pkt[(nsamples - 1) * WIBUNPACK_K_N64FRAME + 1];
+         wibUnpack (scratch->adcs, pitch, pkt, nsamples,
+                    WIBUNPACK_K_N64FRAME, WIBUNPACK_K_BEST);
+      }
+      else if (type == 2)
+      {
+         WibTransposed view;
+         if (wibTransposed_locate (&view, pkt, pn64)
+           || view.nchans != DQM_K_NCHANNELS)
+         {
+            accum->nerrors += 1;
+            continue;
+         }
+
+         adcs      = view.adcs;
+         pitch     = view.pitch;
+         nsamples  = view.nsamples;
+         timestamp = view.timestamps[1];
+      }
+      else if (type == 3)
+      {
+         WibDecodeToc dtoc;
+         adcs      = scratch->adcs;
+         pitch     = DQM_K_MAXSAMPLES;
+         if (wibDecode_packet (scratch->adcs, pitch, pkt, pn64,
+                               &dtoc, &src->models) != WIBDECODE_K_OK
+           || dtoc.nchans != DQM_K_NCHANNELS)
+         {
+            accum->nerrors += 1;
+            continue;
+         }
+
+         nsamples  = dtoc.nsamples;
+         timestamp = pkt[3];
+      }
+      else
+      {
+         accum->nerrors += 1;
+         continue;
+      }
+
+
+      dqm_channels (accum, adcs, pitch, nsamples);
+
+      if (dqm->fftEvery
+        && (src->npackets % dqm->fftEvery) == 0
+        && nsamples >= DQM_K_NFFT)
+      {
+         dqm_spectra (dqm, scratch, adcs, pitch);
+      }
+
+      src->npackets   += 1;
+      accum->npackets += 1;
+      accum->nsamples += nsamples;
+      accum->timestamp = timestamp;
+   }
+
+
+   // ----------------------------------------------
+   // Merge the stream into the source's accumulators
+   // ----------------------------------------------
+   DqmAccum *dst = &src->accum;
+   pthread_mutex_lock (&src->lock);
+   dst->nsamples += accum->nsamples;
+   dst->npackets += accum->npackets;
+   dst->nerrors  += accum->nerrors;
+   dst->nffts    += accum->nffts;
+   if (accum->npackets) dst->timestamp = accum->timestamp;
+
+   for (int ichan = 0; ichan < DQM_K_NCHANNELS; ichan++)
+   {
+      dst->sum  [ichan] += accum->sum  [ichan];
+      dst->sumsq[ichan] += accum->sumsq[ichan];
+      dst->stuck[ichan] += accum->stuck[ichan];
+   }
+
+   if (accum->nffts)
+   {
+      float       *d = &dst  ->bands[0][0];
+      float const *s = &accum->bands[0][0];
+      for (int idx = 0; idx < DQM_K_NCHANNELS * DQM_K_NBANDS; idx++)
+      {
+         d[idx] += s[idx];
+      }
+   }
+   pthread_mutex_unlock (&src->lock);
+
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Accumulates the sums and stuck codes of the channels,
+          reference version
+
+  \param[in,out] accum  The accumulators
+  \param[in]      adcs  Channel \a ichan, sample t, is adcs[ichan*pitch+t]
+  \param[in]     pitch  The distance, in ADCs, between channels
+  \param[in]     first  The first sample to accumulate
+  \param[in]  nsamples  The number of samples
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline void dqm_channels_scalar (DqmAccum          *accum,
+                                        uint16_t const     *adcs,
+                                        int                pitch,
+                                        int                first,
+                                        int             nsamples)
+{
+   for (int ichan = 0; ichan < DQM_K_NCHANNELS; ichan++)
+   {
+      uint16_t const *p = adcs + ichan * pitch;
+      uint32_t      sum = 0;
+      uint64_t    sumsq = 0;
+      uint32_t    stuck = 0;
+
+      for (int t = first; t < nsamples; t++)
+      {
+         uint32_t adc = p[t] & 0xfff;
+         uint32_t low = adc  & 0x3f;
+         sum   += adc;
+         sumsq += adc * adc;
+         stuck += (low == 0) | (low == 0x3f);
+      }
+
+      accum->sum  [ichan] += sum;
+      accum->sumsq[ichan] += sumsq;
+      accum->stuck[ichan] += stuck;
+   }
+
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+#if WIBUNPACK_X86
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Sums the 8 32-bit lanes of a register
+  \return The sum
+
+  \param[in] v  The register
+                                                                          */
+/* ---------------------------------------------------------------------- */
+__attribute__ ((target ("avx2")))
+static inline uint32_t dqm_hsum_avx2 (__m256i v)
+{
+   __m128i s = _mm_add_epi32 (_mm256_castsi256_si128   (v),
+                              _mm256_extracti128_si256 (v, 1));
+   s = _mm_add_epi32 (s, _mm_shuffle_epi32 (s, 0x4e));
+   s = _mm_add_epi32 (s, _mm_shuffle_epi32 (s, 0xb1));
+   return (uint32_t)_mm_cvtsi128_si32 (s);
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Accumulates the sums and stuck codes of the channels, AVX2
+  \return The number of samples done, a multiple of 16
+
+  \param[in,out] accum  The accumulators
+  \param[in]      adcs  Channel \a ichan, sample t, is adcs[ichan*pitch+t]
+  \param[in]     pitch  The distance, in ADCs, between channels
+  \param[in]  nsamples  The number of samples
+
+  \par
+   Each register holds 16 samples. The sums and squares are formed
+   pairwise by multiply-add into 32-bit lanes. A lane of squares can
+   hold 32 of these, 2 * 4095^2 each, before it must be spilled into
+   the 64-bit total.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+__attribute__ ((target ("avx2")))
+static inline int dqm_channels_avx2 (DqmAccum          *accum,
+                                     uint16_t const     *adcs,
+                                     int                pitch,
+                                     int             nsamples)
+{
+   __m256i const ones = _mm256_set1_epi16 (1);
+   __m256i const mask = _mm256_set1_epi16 (0xfff);
+   __m256i const low6 = _mm256_set1_epi16 (0x3f);
+   __m256i const zero = _mm256_setzero_si256 ();
+   int            n16 = nsamples & ~15;
+
+   for (int ichan = 0; ichan < DQM_K_NCHANNELS; ichan++)
+   {
+      uint16_t const *p = adcs + ichan * pitch;
+      __m256i       sum = zero;
+      __m256i     stuck = zero;
+      uint64_t    sumsq = 0;
+
+      for (int t = 0; t < n16; )
+      {
+         __m256i  sq = zero;
+         int    tend = t + 32 * 16 < n16 ? t + 32 * 16 : n16;
+         for (; t < tend; t += 16)
+         {
+            __m256i x = _mm256_and_si256 (
+                        _mm256_loadu_si256 ((__m256i const *)(p + t)), mask);
+            __m256i l = _mm256_and_si256 (x, low6);
+            __m256i s = _mm256_or_si256  (_mm256_cmpeq_epi16 (l, zero),
+                                          _mm256_cmpeq_epi16 (l, low6));
+            sum   = _mm256_add_epi32 (sum,   _mm256_madd_epi16 (x, ones));
+            sq    = _mm256_add_epi32 (sq,    _mm256_madd_epi16 (x, x));
+            stuck = _mm256_sub_epi16 (stuck, s);
+         }
+         sumsq += dqm_hsum_avx2 (sq);
+      }
+
+      accum->sum  [ichan] += dqm_hsum_avx2 (sum);
+      accum->sumsq[ichan] += sumsq;
+      accum->stuck[ichan] += dqm_hsum_avx2 (_mm256_madd_epi16 (stuck, ones));
+   }
+
+   return n16;
+}
+/* ---------------------------------------------------------------------- */
+#endif
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Accumulates the sums and stuck codes of the channels
+
+  \param[in,out] accum  The accumulators
+  \param[in]      adcs  Channel \a ichan, sample t, is adcs[ichan*pitch+t]
+  \param[in]     pitch  The distance, in ADCs, between channels
+  \param[in]  nsamples  The number of samples
+
+  \par
+   The 16-bit stuck counters of the vector version limit a packet to
+   65535 * 16 samples, far more than DQM_K_MAXSAMPLES.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline void dqm_channels (DqmAccum          *accum,
+                                 uint16_t const     *adcs,
+                                 int                pitch,
+                                 int             nsamples)
+{
+   int ndone = 0;
+
+#if WIBUNPACK_X86
+   if (__builtin_cpu_supports ("avx2"))
+   {
+      ndone = dqm_channels_avx2 (accum, adcs, pitch, nsamples);
+   }
+#endif
+
+   if (ndone < nsamples)
+   {
+      dqm_channels_scalar (accum, adcs, pitch, ndone, nsamples);
+   }
+
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Accumulates the power spectrum of the first DQM_K_NFFT samples
+          of each channel into its bands
+
+  \param[in]      dqm  The monitor, for the FFT tables
+  \param[in]  scratch  The working storage, the result is accumulated in
+                       its accumulators
+  \param[in]     adcs  Channel \a ichan, sample t, is adcs[ichan*pitch+t]
+  \param[in]    pitch  The distance, in ADCs, between channels
+
+  \par
+   The mean is removed first so that the pedestal does not leak into
+   the lowest band. The DC bin is excluded.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline void dqm_spectra (Dqm const         *dqm,
+                                DqmScratch    *scratch,
+                                uint16_t const   *adcs,
+                                int              pitch)
+{
+   float *re = scratch->re;
+   float *im = scratch->im;
+   DqmAccum *accum = &scratch->accum;
+
+   for (int ichan = 0; ichan < DQM_K_NCHANNELS; ichan++)
+   {
+      uint16_t const *p = adcs + ichan * pitch;
+      uint32_t      sum = 0;
+      for (int t = 0; t < DQM_K_NFFT; t++) sum += p[t] & 0xfff;
+      float mean = (float)sum / DQM_K_NFFT;
+
+      for (int t = 0; t < DQM_K_NFFT; t++)
+      {
+         re[dqm->reverse[t]] = (float)(p[t] & 0xfff) - mean;
+         im[t]               = 0;
+      }
+
+
+      // ------------------------------------
+      // Iterative radix 2 decimation in time
+      // ------------------------------------
+      for (int half = 1, step = DQM_K_NFFT / 2; half < DQM_K_NFFT;
+           half <<= 1, step >>= 1)
+      {
+         for (int beg = 0; beg < DQM_K_NFFT; beg += 2 * half)
+         {
+            for (int k = 0; k < half; k++)
+            {
+               int    a = beg + k;
+               int    b = a   + half;
+               float wr = dqm->cos[k * step];
+               float wi = dqm->sin[k * step];
+               float tr = wr * re[b] - wi * im[b];
+               float ti = wr * im[b] + wi * re[b];
+               re[b] = re[a] - tr;
+               im[b] = im[a] - ti;
+               re[a] = re[a] + tr;
+               im[a] = im[a] + ti;
+            }
+         }
+      }
+
+
+      float *bands = accum->bands[ichan];
+      for (int k = 1; k < DQM_K_NFFT / 2; k++)
+      {
+         int band = k * DQM_K_NBANDS / (DQM_K_NFFT / 2);
+         bands[band] += (re[k] * re[k] + im[k] * im[k]) / DQM_K_NFFT;
+      }
+   }
+
+   accum->nffts += 1;
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Saturates a value to 16 bits
+  \return The saturated value
+
+  \param[in] val  The value
+  \param[in] min  The minimum
+  \param[in] max  The maximum
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline int dqm_saturate (double val, int min, int max)
+{
+   if (val < min) return min;
+   if (val > max) return max;
+   return (int)(val + 0.5);
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Takes and clears the accumulators of each source and sends
+          their snapshots
+
+  \param[in] dqm  The monitor
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline void dqm_snapshot (Dqm *dqm)
+{
+   struct
+   {
+      DqmRecord                    record;
+      DqmChannel channels[DQM_K_NCHANNELS];
+   }
+   msg;
+
+   DqmAccum        accum;
+   uint64_t          now = dqm_now ();
+   uint32_t     interval = now - dqm->last;
+   int          nsources = dqm->nsources;
+   int          binsBand = (DQM_K_NFFT / 2) / DQM_K_NBANDS;
+
+   dqm->last      = now;
+   dqm->sequence += 1;
+
+   for (int isrc = 0; isrc < nsources; isrc++)
+   {
+      DqmSource *src = &dqm->sources[isrc];
+      DqmAccum    *a = &accum;
+
+      pthread_mutex_lock   (&src->lock);
+      *a = src->accum;
+      memset (&src->accum, 0, sizeof (src->accum));
+      pthread_mutex_unlock (&src->lock);
+
+
+      DqmRecord *rec = &msg.record;
+      rec->magic     = DQM_K_MAGIC;
+      rec->version   = DQM_K_VERSION;
+      rec->csf       = src->csf;
+      rec->nchans    = DQM_K_NCHANNELS;
+      rec->nbands    = DQM_K_NBANDS;
+      rec->sequence  = dqm->sequence;
+      rec->interval  = interval;
+      rec->npackets  = a->npackets;
+      rec->nerrors   = a->nerrors;
+      rec->nffts     = a->nffts;
+      rec->timestamp = a->timestamp;
+      rec->nsamples  = a->nsamples;
+
+      memset (msg.channels, 0, sizeof (msg.channels));
+      for (int ichan = 0; ichan < DQM_K_NCHANNELS && a->nsamples; ichan++)
+      {
+         DqmChannel *chn = &msg.channels[ichan];
+         double        n = (double)a->nsamples;
+         double     mean = a->sum[ichan] / n;
+         double      var = a->sumsq[ichan] / n - mean * mean;
+
+         chn->pedestal = dqm_saturate (mean * 16, 0, 0xffff);
+         chn->rms      = dqm_saturate (sqrt (var > 0 ? var : 0) * 256,
+                                       0, 0xffff);
+         chn->stuck    = dqm_saturate (a->stuck[ichan] / n * 0xffff,
+                                       0, 0xffff);
+
+         for (int iband = 0; iband < DQM_K_NBANDS && a->nffts; iband++)
+         {
+            double power = a->bands[ichan][iband] / (a->nffts * binsBand);
+            double    db = power > 1.e-30 ? 10.0 * log10 (power) : -300;
+            chn->bands[iband] = dqm_saturate (db * 100, -32768, 32767);
+         }
+      }
+
+      if (sendto (dqm->fd, &msg, sizeof (msg), 0,
+                  (struct sockaddr const *)&dqm->addr, dqm->addrlen) < 0)
+      {
+         dqm->nfailed += 1;
+      }
+      else
+      {
+         dqm->nsent   += 1;
+      }
+   }
+
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  The snapshot thread
+  \return NULL
+
+  \param[in] arg  The monitor
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static void *dqm_run (void *arg)
+{
+   Dqm *dqm = (Dqm *)arg;
+
+   pthread_mutex_lock (&dqm->lock);
+   while (!dqm->stop)
+   {
+      struct timespec until;
+      clock_gettime (CLOCK_MONOTONIC, &until);
+      until.tv_sec  += dqm->cadence / 1000;
+      until.tv_nsec += (dqm->cadence % 1000) * 1000000;
+      if (until.tv_nsec >= 1000000000)
+      {
+         until.tv_sec  += 1;
+         until.tv_nsec -= 1000000000;
+      }
+
+      while (!dqm->stop
+         &&  pthread_cond_timedwait (&dqm->cond, &dqm->lock, &until) == 0);
+
+      pthread_mutex_unlock (&dqm->lock);
+      dqm_snapshot (dqm);
+      pthread_mutex_lock   (&dqm->lock);
+   }
+   pthread_mutex_unlock (&dqm->lock);
+
+   return NULL;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Stops the snapshot thread, after a final snapshot, and frees
+          the monitor's resources
+
+  \param[in] dqm  The monitor
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline void dqm_destroy (Dqm *dqm)
+{
+   if (dqm->sources == NULL) return;
+
+   pthread_mutex_lock   (&dqm->lock);
+   dqm->stop = 1;
+   pthread_cond_signal  (&dqm->cond);
+   pthread_mutex_unlock (&dqm->lock);
+   pthread_join (dqm->thread, NULL);
+
+   for (int idx = 0; idx < DQM_K_MAXSOURCES; idx++)
+   {
+      pthread_mutex_destroy (&dqm->sources[idx].lock);
+   }
+
+   close (dqm->fd);
+   free  (dqm->sources);
+   dqm->sources = NULL;
+
+   pthread_mutex_destroy (&dqm->mapLock);
+   pthread_mutex_destroy (&dqm->lock);
+   pthread_cond_destroy  (&dqm->cond);
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Prints the monitor's summary
+
+  \param[in] dqm  The monitor
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline void dqm_print (Dqm const *dqm)
+{
+   printf ("Dqm: %d sources %" PRIu32 " snapshots %" PRIu64 " datagrams"
+           " %" PRIu64 " failed %" PRIu64 " streams from too many sources\n",
+           dqm->nsources, dqm->sequence, dqm->nsent, dqm->nfailed,
+           dqm->noverflow);
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+#endif
@@ -0,0 +1,771 @@
+// -*-Mode: C;-*-
+
+#ifndef _EVENT_BUILDER_H_
+#define _EVENT_BUILDER_H_
+
+/* ---------------------------------------------------------------------- *//*!
+ *
+ *  @file     EventBuilder.h
+ *  @brief    Assembles the fragments from several RCEs into events
+ *  @verbatim
+ *                               Copyright 2018
+ *                                    by
+ *
+ *                       The Board of Trustees of the
+ *                    Leland Stanford Junior University.
+ *                           All rights reserved.
+ *
+ *  @endverbatim
+ *
+ *  @par Facility:
+ *  pdd
+ *
+ *  @author
+ *  <russell@slac.stanford.edu>
+ *
+ *  @par Date created:
+ *  <2018/08/20>
+ *
+ * @par Credits:
+ * SLAC
+ *
+ *  @par
+ *  Each RCE sends one fragment per trigger. The builder matches the
+ *  fragments from N sources by the trigger sequence number in their
+ *  Identifier, checks that their timestamps agree and hands each event
+ *  to the caller's emit routine when either all N sources have
+ *  contributed or the event has waited longer than the timeout.
+ *
+ *  A source is identified by the Src0 field of the fragment's
+ *  Identifier and is assigned the next free source index the first time
+ *  it is seen. This index is the bit in the contributor mask.
+ *
+ *  The work is split across shards, each with its own thread, by the
+ *  sequence number, so that one event is always built by one shard and
+ *  no locking is needed between shards. Within a shard, the events
+ *  being built are kept in a window indexed directly by the sequence
+ *  number. An event still being built when its window slot is needed
+ *  by a later sequence number is emitted as is.
+ *
+ *  Each slot remembers the sequence number of the last event emitted
+ *  from it. A fragment for that event, or an older one, arrived after
+ *  its event went out, either timed out or pushed out of the window.
+ *  It is counted as late and emitted on its own, as is a duplicate
+ *  fragment, without starting a new event, so neither is counted as
+ *  missing for the other sources.
+ *
+ *  The builder never copies or frees a fragment, it only keeps a
+ *  handle. The emit routine is responsible for releasing the fragments
+ *  of the events it is given, complete or not, and any fragment refused
+ *  by eventBuilder_post stays with the caller.
+ *
+\* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *\
+
+   HISTORY
+   -------
+
+   DATE       WHO WHAT
+   ---------- --- ---------------------------------------------------------
+   2018.08.21 jjr Fragments arriving after their event was emitted are
+                  counted as late and emitted on their own, they no
+                  longer start a new event. Neither these nor the
+                  duplicates count as missing for the other sources.
+   2018.08.20 jjr Created
+
+\* ---------------------------------------------------------------------- */
+
+
+#include "CaptureFile.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+
+#define EB_K_MAXSOURCES   64  /*!< One bit per source in the contributors */
+#define EB_K_MAXSHARDS    16  /*!< Maximum number of builder threads      */
+#define EB_K_NSRC0      4096  /*!< Number of Identifier Src0 values       */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \struct _EbFragment
+  \brief   One fragment, as posted to the builder
+                                                                          *//*!
+  \typedef EbFragment
+  \brief   Typedef for struct _EbFragment
+                                                                          */
+/* ---------------------------------------------------------------------- */
+struct _EbFragment
+{
+   void             *handle;  /*!< The caller's handle for the fragment   */
+   uint8_t const      *data;  /*!< The fragment, beginning with Header0   */
+   uint32_t          nbytes;  /*!< Size of the fragment in bytes          */
+   uint32_t        sequence;  /*!< Its trigger sequence number            */
+   uint64_t       timestamp;  /*!< Its trigger timestamp                  */
+   int               source;  /*!< Its source index                       */
+};
+/* ---------------------------------------------------------------------- */
+typedef struct _EbFragment EbFragment;
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \struct _EbEvent
+  \brief   An event being built
+                                                                          *//*!
+  \typedef EbEvent
+  \brief   Typedef for struct _EbEvent
+                                                                          */
+/* ---------------------------------------------------------------------- */
+struct _EbEvent
+{
+   uint64_t   contributors;  /*!< Bit mask of the sources present, 0 if
+                                  the slot is empty                       */
+   uint32_t       sequence;  /*!< The trigger sequence number             */
+   uint64_t      timestamp;  /*!< The trigger timestamp, from the first
+                                  fragment                                */
+   uint64_t        started;  /*!< Arrival of the first fragment, in ms    */
+   uint32_t        emitted;  /*!< Sequence number of the last event
+                                  emitted from this slot                  */
+   int                used;  /*!< Set once an event has been emitted
+                                  from this slot                          */
+   int          nfragments;  /*!< Number of fragments                     */
+   EbFragment
+     fragments[EB_K_MAXSOURCES]; /*!< The fragments, in arrival order     */
+};
+/* ---------------------------------------------------------------------- */
+typedef struct _EbEvent EbEvent;
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \typedef EbEmit
+  \brief   The routine called with each built event
+
+  \param[in]      arg  The caller's argument given to eventBuilder_create
+  \param[in]    event  The event
+  \param[in] complete  If != 0, all sources contributed
+                                                                          */
+/* ---------------------------------------------------------------------- */
+typedef void (*EbEmit)(void *arg, EbEvent const *event, int complete);
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \struct _EbSourceStats
+  \brief   The statistics kept for each source
+                                                                          *//*!
+  \typedef EbSourceStats
+  \brief   Typedef for struct _EbSourceStats
+                                                                          */
+/* ---------------------------------------------------------------------- */
+struct _EbSourceStats
+{
+   uint64_t  fragments;  /*!< Number of fragments received                */
+   uint64_t    missing;  /*!< Events emitted without this source          */
+   uint32_t duplicates;  /*!< Second fragment for the same event          */
+   uint32_t       late;  /*!< Arrived after its event was emitted         */
+   uint32_t   mismatch;  /*!< Timestamp disagreed with the event's        */
+};
+/* ---------------------------------------------------------------------- */
+typedef struct _EbSourceStats EbSourceStats;
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \struct _EbShard
+  \brief   One builder thread, its input queue and its window of events
+                                                                          *//*!
+  \typedef EbShard
+  \brief   Typedef for struct _EbShard
+                                                                          */
+/* ---------------------------------------------------------------------- */
+struct _EbShard
+{
+   struct _EventBuilder       *eb;  /*!< The owning builder               */
+   pthread_t               thread;  /*!< The shard's thread               */
+   pthread_mutex_t           lock;  /*!< Protects the queue               */
+   pthread_cond_t            cond;  /*!< Signalled when a fragment posted */
+   EbFragment              *queue;  /*!< The posted fragments             */
+   int                      qsize;  /*!< Number of entries in the queue   */
+   int                         rd;  /*!< Queue read  index                */
+   int                         wr;  /*!< Queue write index                */
+   int                       done;  /*!< Set when the shard should exit   */
+   EbEvent                *window;  /*!< The events being built           */
+   int                    nwindow;  /*!< Number of events in the window   */
+   int                    pending;  /*!< Number of events being built     */
+   uint64_t              complete;  /*!< Events emitted complete          */
+   uint64_t            incomplete;  /*!< Events emitted incomplete        */
+   EbSourceStats
+          sources[EB_K_MAXSOURCES];  /*!< Per source statistics            */
+};
+/* ---------------------------------------------------------------------- */
+typedef struct _EbShard EbShard;
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \struct _EventBuilder
+  \brief   The event builder
+                                                                          *//*!
+  \typedef EventBuilder
+  \brief   Typedef for struct _EventBuilder
+                                                                          */
+/* ---------------------------------------------------------------------- */
+struct _EventBuilder
+{
+   int                   nsources;  /*!< Number of sources in an event    */
+   int                    nshards;  /*!< Number of builder threads        */
+   uint32_t               timeout;  /*!< Event timeout, in ms             */
+   EbEmit                    emit;  /*!< Called with each built event     */
+   void                      *arg;  /*!< Passed to emit                   */
+   pthread_mutex_t        mapLock;  /*!< Protects assigning source indices*/
+   int16_t       map[EB_K_NSRC0];  /*!< Src0 -> source index, -1 if none  */
+   uint16_t src0[EB_K_MAXSOURCES];  /*!< Source index -> Src0             */
+   int                      nsrc0;  /*!< Number of sources seen           */
+   uint64_t               unknown;  /*!< Fragments that were refused      */
+   EbShard shards[EB_K_MAXSHARDS];  /*!< The shards                       */
+};
+/* ---------------------------------------------------------------------- */
+typedef struct _EventBuilder EventBuilder;
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- */
+/* PROTOTYPES                                                             */
+/* ---------------------------------------------------------------------- */
+static inline int  eventBuilder_create  (EventBuilder       *eb,
+                                         int           nsources,
+                                         int            nshards,
+                                         int         maxPending,
+                                         uint32_t       timeout,
+                                         EbEmit            emit,
+                                         void              *arg);
+
+static inline int  eventBuilder_post    (EventBuilder       *eb,
+                                         void           *handle,
+                                         uint8_t const    *data,
+                                         uint32_t        nbytes);
+
+static inline void eventBuilder_destroy (EventBuilder       *eb);
+
+static inline void eventBuilder_print   (EventBuilder const *eb);
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Returns a millisecond clock, used to time out events
+  \return The time in ms
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline uint64_t eb_now (void)
+{
+   struct timespec ts;
+   clock_gettime (CLOCK_MONOTONIC, &ts);
+   return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Emits an event, updating the statistics, and empties its slot
+
+  \param[in] shard  The shard building the event
+  \param[in] event  The event
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline void ebShard_emit (EbShard *shard, EbEvent *event)
+{
+   EventBuilder *eb = shard->eb;
+   uint64_t     all = (eb->nsources == 64) ? ~0ULL
+                                           : (1ULL << eb->nsources) - 1;
+   uint64_t missing = all & ~event->contributors;
+   int     complete = missing == 0;
+
+   if (complete)
+   {
+      shard->complete   += 1;
+   }
+   else
+   {
+      shard->incomplete += 1;
+      while (missing)
+      {
+         int src = __builtin_ctzll (missing);
+         shard->sources[src].missing += 1;
+         missing &= missing - 1;
+      }
+   }
+
+   eb->emit (eb->arg, event, complete);
+
+   event->emitted      = event->sequence;
+   event->used         = 1;
+   event->contributors = 0;
+   event->nfragments   = 0;
+   shard->pending     -= 1;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Emits a fragment that cannot join its event as an incomplete
+          event of its own. This is not counted as an event, nor as
+          missing the other sources.
+
+  \param[in] shard  The shard
+  \param[in]  frag  The fragment
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline void ebShard_emitAlone (EbShard *shard, EbFragment const *frag)
+{
+   EventBuilder *eb = shard->eb;
+   EbEvent    alone;
+
+   alone.contributors = 1ULL << frag->source;
+   alone.sequence     = frag->sequence;
+   alone.timestamp    = frag->timestamp;
+   alone.started      = eb_now ();
+   alone.emitted      = 0;
+   alone.used         = 0;
+   alone.nfragments   = 1;
+   alone.fragments[0] = *frag;
+
+   eb->emit (eb->arg, &alone, 0);
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Adds one fragment to its event, emitting the event if it is
+          now complete
+
+  \param[in] shard  The shard
+  \param[in]  frag  The fragment
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline void ebShard_add (EbShard *shard, EbFragment const *frag)
+{
+   EventBuilder *eb = shard->eb;
+   uint32_t    slot = (frag->sequence / eb->nshards) % shard->nwindow;
+   EbEvent   *event = &shard->window[slot];
+   uint64_t     bit = 1ULL << frag->source;
+
+   shard->sources[frag->source].fragments += 1;
+
+
+   // ---------------------------------------------------------------
+   // A fragment for an event already emitted from this slot, or for
+   // one older than the slot now holds, is late. Starting a new event
+   // with it would count every other source as missing twice.
+   // ---------------------------------------------------------------
+   uint32_t last = event->contributors ? event->sequence : event->emitted;
+   int32_t   age = (event->contributors || event->used)
+                 ? (int32_t)(frag->sequence - last) : 1;
+   if (age < 0 || (age == 0 && event->contributors == 0))
+   {
+      shard->sources[frag->source].late += 1;
+      ebShard_emitAlone (shard, frag);
+      return;
+   }
+
+
+   // ---------------------------------------------------------------
+   // If the slot holds an older event, its missing fragments are not
+   // coming within the window, so it goes out as is
+   // ---------------------------------------------------------------
+   if (event->contributors && age > 0)
+   {
+      ebShard_emit (shard, event);
+   }
+
+   if (event->contributors == 0)
+   {
+      event->sequence  = frag->sequence;
+      event->timestamp = frag->timestamp;
+      event->started   = eb_now ();
+      shard->pending  += 1;
+   }
+   else if (event->contributors & bit)
+   {
+      // --------------------------------------------------------
+      // A second fragment from the same source can only be sent
+      // on as an event of its own
+      // --------------------------------------------------------
+      shard->sources[frag->source].duplicates += 1;
+      ebShard_emitAlone (shard, frag);
+      return;
+   }
+   else if (event->timestamp != frag->timestamp)
+   {
+      shard->sources[frag->source].mismatch += 1;
+   }
+
+   event->fragments[event->nfragments++] = *frag;
+   event->contributors                  |= bit;
+
+   if (event->nfragments == eb->nsources)
+   {
+      ebShard_emit (shard, event);
+   }
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Emits all the events older than the timeout, or all the
+          events if \a flush is set
+
+  \param[in] shard  The shard
+  \param[in] flush  If != 0, emit everything
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline void ebShard_expire (EbShard *shard, int flush)
+{
+   uint64_t now = eb_now ();
+
+   for (int idx = 0; idx < shard->nwindow && shard->pending; idx++)
+   {
+      EbEvent *event = &shard->window[idx];
+      if (event->contributors
+      && (flush || now - event->started >= shard->eb->timeout))
+      {
+         ebShard_emit (shard, event);
+      }
+   }
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  The shard's thread, builds the events from the posted
+          fragments
+
+  \param[in] arg  The shard
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline void *ebShard_run (void *arg)
+{
+   EbShard       *shard = (EbShard *)arg;
+   uint32_t     timeout = shard->eb->timeout;
+   uint32_t        tick = timeout < 40 ? 10 : timeout / 4;
+   uint64_t      expire = eb_now () + tick;
+
+   pthread_mutex_lock (&shard->lock);
+   while (1)
+   {
+      // -----------------------------------------------------------
+      // Take the fragments out of the queue while holding the lock,
+      // build without it
+      // -----------------------------------------------------------
+      while (shard->rd != shard->wr)
+      {
+         EbFragment frag = shard->queue[shard->rd];
+         shard->rd       = (shard->rd + 1) % shard->qsize;
+
+         pthread_mutex_unlock (&shard->lock);
+         ebShard_add          (shard, &frag);
+         pthread_mutex_lock   (&shard->lock);
+      }
+
+      if (shard->done) break;
+
+
+      uint64_t now = eb_now ();
+      if (now >= expire)
+      {
+         pthread_mutex_unlock (&shard->lock);
+         ebShard_expire       (shard, 0);
+         pthread_mutex_lock   (&shard->lock);
+         expire = now + tick;
+         continue;
+      }
+
+
+      struct timespec ts;
+      clock_gettime (CLOCK_MONOTONIC, &ts);
+      uint64_t ns = ts.tv_nsec + (expire - now) * 1000000;
+      ts.tv_sec  += ns / 1000000000;
+      ts.tv_nsec  = ns % 1000000000;
+      pthread_cond_timedwait (&shard->cond, &shard->lock, &ts);
+   }
+   pthread_mutex_unlock (&shard->lock);
+
+   ebShard_expire (shard, 1);
+   return NULL;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Creates the builder and starts its threads
+  \retval == 0, success
+  \retval != 0, failure
+
+  \param[out]        eb  The event builder
+  \param[in]   nsources  The number of sources contributing to an event
+  \param[in]    nshards  The number of builder threads
+  \param[in] maxPending  The maximum number of fragments the caller can
+                         have outstanding. This sizes the queues and the
+                         windows so that neither can overflow.
+  \param[in]    timeout  How long, in ms, an event waits for its missing
+                         fragments
+  \param[in]       emit  Called with each event
+  \param[in]        arg  Passed to emit
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline int eventBuilder_create (EventBuilder       *eb,
+                                       int           nsources,
+                                       int            nshards,
+                                       int         maxPending,
+                                       uint32_t       timeout,
+                                       EbEmit            emit,
+                                       void              *arg)
+{
+   if (nsources < 1 || nsources > EB_K_MAXSOURCES) return -1;
+   if (nshards  < 1 || nshards  > EB_K_MAXSHARDS ) return -1;
+
+   memset (eb, 0, sizeof (*eb));
+   eb->nsources = nsources;
+   eb->nshards  = nshards;
+   eb->timeout  = timeout;
+   eb->emit     = emit;
+   eb->arg      = arg;
+   memset (eb->map, 0xff, sizeof (eb->map));
+   pthread_mutex_init (&eb->mapLock, NULL);
+
+
+   pthread_condattr_t attr;
+   pthread_condattr_init     (&attr);
+   pthread_condattr_setclock (&attr, CLOCK_MONOTONIC);
+
+   for (int idx = 0; idx < nshards; idx++)
+   {
+      EbShard *shard = &eb->shards[idx];
+      shard->eb      = eb;
+      shard->qsize   = maxPending + 1;
+      shard->queue   = (EbFragment *)malloc (shard->qsize
+                                           * sizeof (*shard->queue));
+      shard->nwindow = maxPending;
+      shard->window  = (EbEvent    *)calloc (shard->nwindow,
+                                             sizeof (*shard->window));
+      if (shard->queue == NULL || shard->window == NULL) return -1;
+
+      pthread_mutex_init (&shard->lock, NULL);
+      pthread_cond_init  (&shard->cond, &attr);
+      pthread_create     (&shard->thread, NULL, ebShard_run, shard);
+   }
+
+   pthread_condattr_destroy (&attr);
+   return 0;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Posts a fragment to the shard building its event
+  \retval == 0, the fragment was accepted
+  \retval != 0, the fragment was refused, either it is not a data
+                fragment or it comes from one source too many. The
+                caller keeps it.
+
+  \param[in]     eb  The event builder
+  \param[in] handle  The caller's handle, returned with the event
+  \param[in]   data  The fragment
+  \param[in] nbytes  The number of bytes in the fragment
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline int eventBuilder_post (EventBuilder       *eb,
+                                     void           *handle,
+                                     uint8_t const    *data,
+                                     uint32_t        nbytes)
+{
+   EbFragment frag;
+
+   if (capture_identify (data, nbytes, &frag.sequence, &frag.timestamp))
+   {
+      __sync_fetch_and_add (&eb->unknown, 1);
+      return -1;
+   }
+
+
+   // ----------------------------------------------------------
+   // Map the Identifier's Src0 to a source index, assigning the
+   // next one the first time a source is seen
+   // ----------------------------------------------------------
+   uint16_t src0   = (((uint64_t const *)data)[1] >> 8) & 0xfff;
+   int      source = eb->map[src0];
+   if (source < 0)
+   {
+      pthread_mutex_lock (&eb->mapLock);
+      source = eb->map[src0];
+      if (source < 0 && eb->nsrc0 < eb->nsources)
+      {
+         source           = eb->nsrc0++;
+         eb->src0[source] = src0;
+         eb->map[src0]    = source;
+      }
+      pthread_mutex_unlock (&eb->mapLock);
+
+      if (source < 0)
+      {
+         __sync_fetch_and_add (&eb->unknown, 1);
+         return -1;
+      }
+   }
+
+   frag.handle = handle;
+   frag.data   = data;
+   frag.nbytes = nbytes;
+   frag.source = source;
+
+
+   EbShard *shard = &eb->shards[frag.sequence % eb->nshards];
+   pthread_mutex_lock   (&shard->lock);
+   shard->queue[shard->wr] = frag;
+   shard->wr = (shard->wr + 1) % shard->qsize;
+   pthread_cond_signal  (&shard->cond);
+   pthread_mutex_unlock (&shard->lock);
+
+   return 0;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Stops the builder, emitting every event still being built
+
+  \param[in] eb  The event builder
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline void eventBuilder_destroy (EventBuilder *eb)
+{
+   for (int idx = 0; idx < eb->nshards; idx++)
+   {
+      EbShard *shard = &eb->shards[idx];
+
+      pthread_mutex_lock     (&shard->lock);
+      shard->done = 1;
+      pthread_cond_broadcast (&shard->cond);
+      pthread_mutex_unlock   (&shard->lock);
+
+      pthread_join          (shard->thread, NULL);
+      pthread_cond_destroy  (&shard->cond);
+      pthread_mutex_destroy (&shard->lock);
+      free (shard->queue);
+      free (shard->window);
+   }
+
+   pthread_mutex_destroy (&eb->mapLock);
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Prints the event and per source statistics
+
+  \param[in] eb  The event builder
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline void eventBuilder_print (EventBuilder const *eb)
+{
+   uint64_t   complete = 0;
+   uint64_t incomplete = 0;
+   int         pending = 0;
+
+   for (int idx = 0; idx < eb->nshards; idx++)
+   {
+      complete   += eb->shards[idx].complete;
+      incomplete += eb->shards[idx].incomplete;
+      pending    += eb->shards[idx].pending;
+   }
+
+   printf ("Events: %" PRIu64 " complete %" PRIu64 " incomplete %d pending"
+           " %" PRIu64 " refused fragments\n",
+           complete, incomplete, pending, eb->unknown);
+
+   puts (" Src Src0  Fragments    Missing  Dups  Late TsErr\n"
+         " --- ---- ---------- ---------- ----- ----- -----");
+
+   for (int src = 0; src < eb->nsources; src++)
+   {
+      EbSourceStats sum;
+      memset (&sum, 0, sizeof (sum));
+
+      for (int idx = 0; idx < eb->nshards; idx++)
+      {
+         EbSourceStats const *s = &eb->shards[idx].sources[src];
+         sum.fragments  += s->fragments;
+         sum.missing    += s->missing;
+         sum.duplicates += s->duplicates;
+         sum.late       += s->late;
+         sum.mismatch   += s->mismatch;
+      }
+
+      if (src < eb->nsrc0) printf (" %3d  %3.3" PRIx16, src, eb->src0[src]);
+      else                 printf (" %3d  ---",         src);
+
+      printf (" %10" PRIu64 " %10" PRIu64 " %5" PRIu32 " %5" PRIu32
+              " %5" PRIu32 "\n",
+              sum.fragments,
+              sum.missing,
+              sum.duplicates,
+              sum.late,
+              sum.mismatch);
+   }
+
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+#endif
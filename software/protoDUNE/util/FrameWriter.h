@@ -0,0 +1,583 @@
+// -*-Mode: C;-*-
+
+#ifndef _FRAME_WRITER_H_
+#define _FRAME_WRITER_H_
+
+/* ---------------------------------------------------------------------- *//*!
+ *
+ *  @file     FrameWriter.h
+ *  @brief    Allocation free access to and writing of the incoming frames
+ *            for the RSSI receivers
+ *  @verbatim
+ *                               Copyright 2018
+ *                                    by
+ *
+ *                       The Board of Trustees of the
+ *                    Leland Stanford Junior University.
+ *                           All rights reserved.
+ *
+ *  @endverbatim
+ *
+ *  @par Facility:
+ *  util
+ *
+ *  @author
+ *  <russell@slac.stanford.edu>
+ *
+ *  @par Date created:
+ *  <2018/08/21>
+ *
+ * @par Credits:
+ * SLAC
+ *
+ *  @par
+ *  Two pieces, both meant to keep the receive callback, acceptFrame,
+ *  from allocating or doing I/O:
+ *
+ *    - frame_data gives a contiguous view of a rogue frame. When the
+ *      frame is a single buffer, which is the usual case, the data is
+ *      used in place. Otherwise it is gathered into a FrameArena, a
+ *      buffer owned by the receiving thread that only ever grows.
+ *
+ *    - FrameWriter moves the file writing to its own thread. Frames are
+ *      copied into one of a small number of large, page aligned staging
+ *      buffers. When one fills, it is handed to the writer thread which
+ *      writes it with a single call, or, for the indexed capture
+ *      format, fragment by fragment. The receive thread only waits if
+ *      all the staging buffers are queued for writing. Another thread,
+ *      typically the one printing the rates, may call flush to push out
+ *      what is staged when the data stops.
+ *
+\* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *\
+
+   HISTORY
+   -------
+
+   DATE       WHO WHAT
+   ---------- --- ---------------------------------------------------------
+   2018.08.21 jjr Created
+
+\* ---------------------------------------------------------------------- */
+
+
+#include "CaptureFile.h"
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <pthread.h>
+#include <unistd.h>
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+   \brief A reusable, grow only, buffer used to gather the frames that
+          arrive in more than one piece
+                                                                          */
+/* ---------------------------------------------------------------------- */
+class FrameArena
+{
+public:
+   FrameArena  () : m_data (NULL), m_size (0), m_grown (0) { return; }
+   ~FrameArena () { free (m_data); }
+
+public:
+   uint8_t *reserve  (size_t nbytes);
+   uint32_t getGrown () const { return m_grown; }
+
+private:
+   uint8_t   *m_data;  /*!< The buffer                                    */
+   size_t     m_size;  /*!< Its size in bytes                             */
+   uint32_t  m_grown;  /*!< Number of times it was grown                  */
+};
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Returns a buffer of at least \a nbytes
+  \return The buffer
+
+  \param[in] nbytes  The number of bytes needed
+
+  \par
+   The buffer is grown to the next power of 2, so after the first few
+   frames it is never reallocated.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+inline uint8_t *FrameArena::reserve (size_t nbytes)
+{
+   if (nbytes > m_size)
+   {
+      size_t size = 64 * 1024;
+      while (size < nbytes) size *= 2;
+
+      void *data;
+      if (posix_memalign (&data, 4096, size))
+      {
+         fprintf (stderr, "Error allocating %zu bytes for a frame\n", size);
+         exit (-1);
+      }
+
+      free (m_data);
+      m_data   = (uint8_t *)data;
+      m_size   = size;
+      m_grown += 1;
+   }
+
+   return m_data;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Returns a contiguous view of the frame's payload
+  \return Pointer to the payload, either in the frame itself or in
+          \a arena
+
+  \param[in]  frame  The rogue frame
+  \param[in] nbytes  The frame's payload size
+  \param[in]  arena  Used to gather a frame of more than one buffer
+
+  \par
+   This is a template only to avoid dragging the rogue headers into
+   this file; \a FramePtr is the usual rogue frame shared pointer.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+template<class FramePtr>
+inline uint8_t const *frame_data (FramePtr const &frame,
+                                  size_t         nbytes,
+                                  FrameArena     &arena)
+{
+   auto iter = frame->beginRead ();
+   auto  end = frame->endRead   ();
+
+   // -----------------------------------------
+   // Single buffer, the usual case, use as is
+   // -----------------------------------------
+   if (iter.remBuffer () >= nbytes)
+   {
+      return (uint8_t const *)iter.ptr ();
+   }
+
+
+   // -----------------------------------------
+   // Gather the contiguous pieces
+   // -----------------------------------------
+   uint8_t *buff = arena.reserve (nbytes);
+   uint8_t  *dst = buff;
+   while (iter != end)
+   {
+      auto  nxt = iter.endBuffer ();
+      auto size = iter.remBuffer ();
+      memcpy (dst, iter.ptr (), size);
+      dst  += size;
+      iter  = nxt;
+   }
+
+   return buff;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+   \brief Writes the frames to the output file from a dedicated thread
+                                                                          */
+/* ---------------------------------------------------------------------- */
+class FrameWriter
+{
+public:
+   FrameWriter (int                  fd,
+                CaptureWriter  *capture,
+                size_t           bufSize = 16 * 1024 * 1024,
+                int                nbufs = 4);
+  ~FrameWriter ();
+
+public:
+   void     write    (void const *data, uint32_t nbytes);
+   void     flush    ();
+   uint32_t getWaits () const { return m_waits; }
+
+
+private:
+   /* ------------------------------------------------------------------- *//*!
+
+      \brief One staging buffer
+                                                                          */
+   /* ------------------------------------------------------------------- */
+   struct Staging
+   {
+      uint8_t     *data;  /*!< The buffer, page aligned                   */
+      size_t     nbytes;  /*!< Number of bytes staged                     */
+      uint32_t  *sizes;   /*!< Size of each staged frame                  */
+      uint32_t  nframes;  /*!< Number of frames staged                    */
+   };
+   /* ------------------------------------------------------------------- */
+
+   static void *run      (void *arg);
+   void         output   (Staging *staging);
+   void         output   (void const *data, size_t nbytes);
+   void         submit   ();
+   void         drain    ();
+
+private:
+   int                  m_fd;  /*!< Output file descriptor                */
+   CaptureWriter  *m_capture;  /*!< If non-NULL, the indexed writer       */
+   size_t         m_bufSize;  /*!< Size of each staging buffer            */
+   uint32_t     m_maxFrames;  /*!< Frames that fit in a staging buffer    */
+   int              m_nbufs;  /*!< Number of staging buffers              */
+   Staging       *m_staging;  /*!< The staging buffers                    */
+   int                m_cur;  /*!< The one being filled                   */
+   int                 m_rd;  /*!< Next to write                          */
+   int             m_queued;  /*!< Number queued for writing              */
+   bool              m_done;  /*!< Set to stop the writer thread          */
+   uint32_t         m_waits;  /*!< Times the receiver waited              */
+   pthread_mutex_t   m_lock;  /*!< Protects the queue and m_cur           */
+   pthread_cond_t   m_ready;  /*!< Signalled when a buffer is queued      */
+   pthread_cond_t    m_free;  /*!< Signalled when a buffer is written     */
+   pthread_t       m_thread;  /*!< The writer thread                      */
+};
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief Allocates the staging buffers and starts the writer thread
+
+  \param[in]      fd  The output file descriptor, used if \a capture is
+                      NULL
+  \param[in] capture  If non-NULL, write in the indexed capture format
+  \param[in] bufSize  The size of each staging buffer
+  \param[in]   nbufs  The number of staging buffers
+                                                                          */
+/* ---------------------------------------------------------------------- */
+inline FrameWriter::FrameWriter (int                  fd,
+                                 CaptureWriter  *capture,
+                                 size_t          bufSize,
+                                 int               nbufs) :
+   m_fd        (fd),
+   m_capture   (capture),
+   m_bufSize   (bufSize),
+   m_maxFrames (bufSize / 64),
+   m_nbufs     (nbufs),
+   m_cur       (0),
+   m_rd        (0),
+   m_queued    (0),
+   m_done      (false),
+   m_waits     (0)
+{
+   m_staging = new Staging[nbufs];
+   for (int idx = 0; idx < nbufs; idx++)
+   {
+      void *data;
+      if (posix_memalign (&data, 4096, bufSize))
+      {
+         fprintf (stderr, "Error allocating the output staging buffers\n");
+         exit (-1);
+      }
+
+      m_staging[idx].data    = (uint8_t *)data;
+      m_staging[idx].nbytes  = 0;
+      m_staging[idx].nframes = 0;
+      m_staging[idx].sizes   = new uint32_t[m_maxFrames];
+   }
+
+   pthread_mutex_init (&m_lock,  NULL);
+   pthread_cond_init  (&m_ready, NULL);
+   pthread_cond_init  (&m_free,  NULL);
+   pthread_create     (&m_thread, NULL, run, this);
+
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief Writes whatever is staged and stops the writer thread
+                                                                          */
+/* ---------------------------------------------------------------------- */
+inline FrameWriter::~FrameWriter ()
+{
+   flush ();
+
+   pthread_mutex_lock   (&m_lock);
+   m_done = true;
+   pthread_cond_signal  (&m_ready);
+   pthread_mutex_unlock (&m_lock);
+   pthread_join         (m_thread, NULL);
+
+   for (int idx = 0; idx < m_nbufs; idx++)
+   {
+      free     (m_staging[idx].data);
+      delete[]  m_staging[idx].sizes;
+   }
+   delete[] m_staging;
+
+   pthread_cond_destroy  (&m_free);
+   pthread_cond_destroy  (&m_ready);
+   pthread_mutex_destroy (&m_lock);
+
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief Stages one frame for writing
+
+  \param[in]   data  The frame
+  \param[in] nbytes  The number of bytes in the frame
+
+  \par
+   This is called from the receive thread. It copies the frame and
+   returns; only if every staging buffer is waiting to be written does
+   it block. A frame larger than a staging buffer is written directly,
+   after everything before it has gone out.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+inline void FrameWriter::write (void const *data, uint32_t nbytes)
+{
+   pthread_mutex_lock (&m_lock);
+
+   Staging *staging = &m_staging[m_cur];
+   if (staging->nbytes + nbytes > m_bufSize
+   ||  staging->nframes        == m_maxFrames)
+   {
+      submit ();
+      staging = &m_staging[m_cur];
+   }
+
+   if (nbytes > m_bufSize)
+   {
+      drain  ();
+      output (data, nbytes);
+   }
+   else
+   {
+      memcpy (staging->data + staging->nbytes, data, nbytes);
+      staging->nbytes                    += nbytes;
+      staging->sizes[staging->nframes++]  = nbytes;
+   }
+
+   pthread_mutex_unlock (&m_lock);
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief Queues the current staging buffer, if it has anything in it, and
+         waits for the next one to be free
+
+  \par
+   Called with the lock held.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+inline void FrameWriter::submit ()
+{
+   if (m_staging[m_cur].nbytes == 0) return;
+
+   m_queued += 1;
+   m_cur     = (m_cur + 1) % m_nbufs;
+   pthread_cond_signal (&m_ready);
+
+   if (m_queued == m_nbufs) m_waits += 1;
+   while (m_queued == m_nbufs)
+   {
+      pthread_cond_wait (&m_free, &m_lock);
+   }
+
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief Queues the current staging buffer and waits until everything
+         has been written
+
+  \par
+   Called with the lock held.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+inline void FrameWriter::drain ()
+{
+   submit ();
+   while (m_queued) pthread_cond_wait (&m_free, &m_lock);
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief Writes out everything staged so far, waiting until it is done
+                                                                          */
+/* ---------------------------------------------------------------------- */
+inline void FrameWriter::flush ()
+{
+   pthread_mutex_lock   (&m_lock);
+   drain                ();
+   pthread_mutex_unlock (&m_lock);
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief The writer thread
+
+  \param[in] arg  The FrameWriter
+                                                                          */
+/* ---------------------------------------------------------------------- */
+inline void *FrameWriter::run (void *arg)
+{
+   FrameWriter *writer = (FrameWriter *)arg;
+
+   pthread_mutex_lock (&writer->m_lock);
+   while (1)
+   {
+      while (writer->m_queued == 0 && !writer->m_done)
+      {
+         pthread_cond_wait (&writer->m_ready, &writer->m_lock);
+      }
+
+      if (writer->m_queued == 0) break;
+
+
+      // -------------------------------------------
+      // Write without the lock, the receive thread
+      // does not touch a queued buffer
+      // -------------------------------------------
+      Staging *staging = &writer->m_staging[writer->m_rd];
+      pthread_mutex_unlock (&writer->m_lock);
+
+      writer->output (staging);
+      staging->nbytes  = 0;
+      staging->nframes = 0;
+
+      pthread_mutex_lock (&writer->m_lock);
+      writer->m_rd      = (writer->m_rd + 1) % writer->m_nbufs;
+      writer->m_queued -= 1;
+      pthread_cond_broadcast (&writer->m_free);
+   }
+   pthread_mutex_unlock (&writer->m_lock);
+
+   return NULL;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief Writes one staging buffer
+
+  \param[in] staging  The staging buffer
+                                                                          */
+/* ---------------------------------------------------------------------- */
+inline void FrameWriter::output (Staging *staging)
+{
+   if (m_capture == NULL)
+   {
+      output (staging->data, staging->nbytes);
+      return;
+   }
+
+
+   uint8_t const *data = staging->data;
+   for (uint32_t idx = 0; idx < staging->nframes; idx++)
+   {
+      uint32_t nbytes = staging->sizes[idx];
+      int      status = captureWriter_write (m_capture, data, nbytes, 0);
+      if (status)
+      {
+         fprintf (stderr, "Error %d writing the output file\n", status);
+         exit (status);
+      }
+
+      data += nbytes;
+   }
+
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief Writes a contiguous block of frames, retrying on short writes
+
+  \param[in]   data  The frames
+  \param[in] nbytes  The number of bytes to write
+                                                                          */
+/* ---------------------------------------------------------------------- */
+inline void FrameWriter::output (void const *data, size_t nbytes)
+{
+   if (m_capture)
+   {
+      int status = captureWriter_write (m_capture, data, nbytes, 0);
+      if (status)
+      {
+         fprintf (stderr, "Error %d writing the output file\n", status);
+         exit (status);
+      }
+      return;
+   }
+
+
+   uint8_t const *src = (uint8_t const *)data;
+   while (nbytes)
+   {
+      ssize_t nwrote = ::write (m_fd, src, nbytes);
+      if (nwrote < 0)
+      {
+         if (errno == EINTR) continue;
+         fprintf (stderr, "Error %d writing the output file\n", errno);
+         exit (errno);
+      }
+
+      src    += nwrote;
+      nbytes -= nwrote;
+   }
+
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+#endif
@@ -1,43 +1,218 @@
+// -*-Mode: C;-*-
+
 #ifndef _TPC_CHECK_H_
 #define _TPC_CHECK_H_
 
+/* ---------------------------------------------------------------------- *//*!
+ *
+ *  @file     TpcCheck.h
+ *  @brief    Streaming integrity checks of the TPC data fragments
+ *  @verbatim
+ *                               Copyright 2018
+ *                                    by
+ *
+ *                       The Board of Trustees of the
+ *                    Leland Stanford Junior University.
+ *                           All rights reserved.
+ *
+ *  @endverbatim
+ *
+ *  @par Facility:
+ *  pdd
+ *
+ *  @author
+ *  <russell@slac.stanford.edu>
+ *
+ *  @par Date created:
+ *  <2018/05/16>
+ *
+ * @par Credits:
+ * SLAC
+ *
+ *  @par
+ *  Each fragment is walked record by record, Header0, Identifier,
+ *  Originator and then the TPC stream records, each with its Ranges,
+ *  Toc and Packet records. Every length must land exactly on the next
+ *  record and the last on the trailer, which must be the complement of
+ *  Header0. The trigger sequence number and timestamp must increase
+ *  from fragment to fragment.
+ *
+ *  Within a stream record, the packets located by the Toc are checked
+ *  according to their type. WIB frames must have the comma character
+ *  and timestamps stepping by one sample. Compressed and transposed
+ *  packets must have a valid trailer and first and last timestamps
+ *  consistent with their number of samples. The packets of a stream
+ *  must be contiguous in time and span the untrimmed range given in
+ *  its Ranges record.
+ *
+ *  The result is a bit mask of the classes of errors found, see
+ *  TpcCheckError. No message is printed and nothing but the 2 header
+ *  words of each WIB frame is touched, so that the check can be left
+ *  on at the full link rate. All state is in the TpcCheck context, one
+ *  of which is needed for each source, e.g. each connection.
+ *
+\* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *\
+
+   HISTORY
+   -------
+
+   DATE       WHO WHAT
+   ---------- --- ---------------------------------------------------------
+   2018.08.24 jjr Replaced the stub checkHeader and the raw WIB frame
+                  checkData with a full check of the fragment format.
+                  The state, formerly static, is now in a per source
+                  TpcCheck context.
+   2018.05.16 jjr Created, moved from tcp_receiver.c
+
+\* ---------------------------------------------------------------------- */
+
+
+#include "WibDecode.h"
+#include "WibTransposed.h"
+
 #include <inttypes.h>
 #include <stdio.h>
+#include <string.h>
 
-struct _Ctx;
 
+#define TPCCHECK_K_PATTERN    0x8b309e  /*!< Header0 bridge pattern       */
+#define TPCCHECK_K_DATATYPE          2  /*!< Header0 type, Data           */
+#define TPCCHECK_K_NAUX64            2  /*!< Identifier words             */
+#define TPCCHECK_K_RANGESN64         7  /*!< Length of a Ranges record    */
+#define TPCCHECK_K_N64PERFRAME      30  /*!< Length of a WIB frame        */
+#define TPCCHECK_K_TICKS            25  /*!< Clock ticks per sample       */
+#define TPCCHECK_K_COMMA          0xbc  /*!< WIB frame comma character    */
 
-static inline unsigned int checkHeader (struct _Ctx    *ctx,
-                                        uint8_t const *data,
-                                        int           ndata);
 
-static inline unsigned int checkData (struct _Ctx      *ctx,
-                                      uint8_t  const *bytes,
-                                      int            nbytes);
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \enum  _TpcCheckError
+  \brief The classes of errors, these are the bits of the returned mask
+                                                                          *//*!
+  \typedef TpcCheckError
+  \brief   Typedef for enum _TpcCheckError
+                                                                          */
+/* ---------------------------------------------------------------------- */
+enum _TpcCheckError
+{
+   TPCCHECK_V_HEADER     =  0, /*!< Header0 format, type or pattern       */
+   TPCCHECK_V_LENGTH     =  1, /*!< Header0 length vs the data received   */
+   TPCCHECK_V_TRAILER    =  2, /*!< Trailer is not the complement of hdr  */
+   TPCCHECK_V_ORIGINATOR =  3, /*!< Originator header or length           */
+   TPCCHECK_V_STREAM     =  4, /*!< Stream header, length or left count   */
+   TPCCHECK_V_RANGES     =  5, /*!< Ranges header, ordering or span       */
+   TPCCHECK_V_TOC        =  6, /*!< Toc header, count or offsets          */
+   TPCCHECK_V_PACKET     =  7, /*!< Packet header or length               */
+   TPCCHECK_V_SEQUENCE   =  8, /*!< Trigger sequence did not increase     */
+   TPCCHECK_V_TIMESTAMP  =  9, /*!< Trigger timestamp did not increase    */
+   TPCCHECK_V_COMMA      = 10, /*!< WIB frame without the comma           */
+   TPCCHECK_V_CADENCE    = 11, /*!< WIB timestamps not 1 sample apart     */
+   TPCCHECK_V_COMPRESSED = 12, /*!< Compressed/transposed packet trailer  */
+   TPCCHECK_K_NCLASSES   = 13, /*!< Number of error classes               */
+
+   TPCCHECK_M_HEADER     = 1 << TPCCHECK_V_HEADER,
+   TPCCHECK_M_LENGTH     = 1 << TPCCHECK_V_LENGTH,
+   TPCCHECK_M_TRAILER    = 1 << TPCCHECK_V_TRAILER,
+   TPCCHECK_M_ORIGINATOR = 1 << TPCCHECK_V_ORIGINATOR,
+   TPCCHECK_M_STREAM     = 1 << TPCCHECK_V_STREAM,
+   TPCCHECK_M_RANGES     = 1 << TPCCHECK_V_RANGES,
+   TPCCHECK_M_TOC        = 1 << TPCCHECK_V_TOC,
+   TPCCHECK_M_PACKET     = 1 << TPCCHECK_V_PACKET,
+   TPCCHECK_M_SEQUENCE   = 1 << TPCCHECK_V_SEQUENCE,
+   TPCCHECK_M_TIMESTAMP  = 1 << TPCCHECK_V_TIMESTAMP,
+   TPCCHECK_M_COMMA      = 1 << TPCCHECK_V_COMMA,
+   TPCCHECK_M_CADENCE    = 1 << TPCCHECK_V_CADENCE,
+   TPCCHECK_M_COMPRESSED = 1 << TPCCHECK_V_COMPRESSED
+};
+/* ---------------------------------------------------------------------- */
+typedef enum _TpcCheckError TpcCheckError;
+/* ---------------------------------------------------------------------- */
 
 
 
 /* ---------------------------------------------------------------------- *//*!
 
-  \brief  Checks the integrity of a header packet
-  \retval == 0, all is okay
-  \retval != 0, a bit map of the errors
+  \struct _TpcCheck
+  \brief   The check context of one source
+                                                                          *//*!
+  \typedef TpcCheck
+  \brief   Typedef for struct _TpcCheck
 
-  \param[in]   ctx  The check context
-  \param[in]  data  The data to check
-  \param[in] ndata  The number of bytes in the header
+   Zero it, or call tpcCheck_init, before the first fragment. Since
+   there is no locking, only one thread may check a given source.
                                                                           */
 /* ---------------------------------------------------------------------- */
-static inline unsigned int checkHeader (struct _Ctx    *ctx,
-                                        uint8_t const *data,
-                                        int           ndata)
+struct _TpcCheck
 {
-   unsigned int reason = 0;
+   uint64_t        timestamp;  /*!< Trigger timestamp of the last fragment*/
+   uint32_t         sequence;  /*!< Trigger sequence  of the last fragment*/
+   int                primed;  /*!< Set once a fragment has been seen     */
+   uint32_t           errors;  /*!< Or of all the error masks             */
+   uint64_t         nchecked;  /*!< Number of fragments checked           */
+   uint64_t          nfailed;  /*!< Number of fragments with errors       */
+   uint64_t
+     counts[TPCCHECK_K_NCLASSES]; /*!< Number of fragments by error class */
+};
+/* ---------------------------------------------------------------------- */
+typedef struct _TpcCheck TpcCheck;
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- */
+/* PROTOTYPES                                                             */
+/* ---------------------------------------------------------------------- */
+static inline void         tpcCheck_init     (TpcCheck             *chk);
+
+static inline uint32_t     tpcCheck_header   (uint64_t           header);
+
+static inline uint32_t     tpcCheck_fragment (TpcCheck             *chk,
+                                              uint64_t const      *frag,
+                                              uint32_t              n64);
+
+static inline char const  *tpcCheck_name     (int                iclass);
+
+static inline void         tpcCheck_print    (TpcCheck const       *chk,
+                                              char const        *prefix);
+/* ---------------------------------------------------------------------- */
 
-   //uint64_t header = get_w64 (data);
 
 
-   return reason;
+/* ---------------------------------------------------------------------- */
+/* LOCAL PROTOTYPES                                                       */
+/* ---------------------------------------------------------------------- */
+static inline uint32_t     tpcCheck_stream   (uint64_t const       *rec,
+                                              uint32_t              n64);
+
+static inline uint32_t     tpcCheck_packet   (uint64_t const       *pkt,
+                                              uint32_t              n64,
+                                              int                  type,
+                                              uint64_t         range[2]);
+
+static inline uint32_t     tpcCheck_frames   (uint64_t const       *pkt,
+                                              uint32_t              n64,
+                                              uint64_t         range[2]);
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Initializes a check context
+
+  \param[out] chk  The check context
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline void tpcCheck_init (TpcCheck *chk)
+{
+   memset (chk, 0, sizeof (*chk));
+   return;
 }
 /* ---------------------------------------------------------------------- */
 
@@ -46,155 +221,501 @@ static inline unsigned int checkHeader (struct _Ctx    *ctx,
 
 /* ---------------------------------------------------------------------- *//*!
 
-  \brief  Checks the integrity of a data packet
+  \brief  Checks a fragment's Header0
   \retval == 0, all is okay
-  \retval != 0, a bit map of the errors
+  \retval != 0, a mask of TPCCHECK_M_HEADER and TPCCHECK_M_LENGTH
 
-  \param[in]   ctx  The check context
-  \param[in]  data  The data to check
-  \param[in] ndata  The number of bytes in the data
+  \param[in] header  The Header0 word
+
+  \par
+   This is all that is available before the body is read. A receiver
+   should not trust the length to read the body if this fails. It
+   does not change the context, the whole fragment is rechecked and
+   counted by tpcCheck_fragment.
                                                                           */
 /* ---------------------------------------------------------------------- */
-static inline unsigned int checkData (struct _Ctx      *ctx,
-                                      uint8_t  const *bytes,
-                                      int            nbytes)
+static inline uint32_t tpcCheck_header (uint64_t header)
 {
-#  define N64_PER_FRAME 30
-#  define NBYTES (unsigned int)(((1 + N64_PER_FRAME * 1024) + 1) * sizeof (uint64_t))
+   uint32_t  errs = 0;
+   uint32_t   n64 = (header >>  8) & 0xffffff;
+   int    subtype = (header >> 36) & 0xf;
+
+   if ( (header        & 0xf)      != 0
+     || ((header >>  4) & 0xf)     != TPCCHECK_K_DATATYPE
+     || ((header >> 32) & 0xf)     != TPCCHECK_K_NAUX64
+     || (subtype != 2 && subtype   != 3)
+     || ((header >> 40) & 0xffffff)!= TPCCHECK_K_PATTERN)
+   {
+      errs |= TPCCHECK_M_HEADER;
+   }
+
+   // ----------------------------------------------------
+   // Header0 + Identifier + Originator + trailer at least
+   // ----------------------------------------------------
+   if (n64 < 1 + TPCCHECK_K_NAUX64 + 1 + 1)
+   {
+      errs |= TPCCHECK_M_LENGTH;
+   }
+
+   return errs;
+}
+/* ---------------------------------------------------------------------- */
 
 
-   struct History_s
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Checks a complete fragment
+  \retval == 0, all is okay
+  \retval != 0, a mask of the TpcCheckError classes found
+
+  \param[in,out] chk  The source's check context
+  \param[in]    frag  The fragment, beginning with Header0
+  \param[in]     n64  The number of 64-bit words received
+
+  \par
+   Once a record's length is found to be bad, the records following
+   it cannot be located and are not checked.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline uint32_t tpcCheck_fragment (TpcCheck        *chk,
+                                          uint64_t const *frag,
+                                          uint32_t         n64)
+{
+   uint64_t header = frag[0];
+   uint32_t   errs = tpcCheck_header (header);
+
+   if ( ((header >> 8) & 0xffffff) != n64) errs |= TPCCHECK_M_LENGTH;
+
+
+   if ((errs & TPCCHECK_M_LENGTH) == 0)
    {
-      uint64_t  timestamp;
-      uint16_t convert[2];
-   };
+      if (frag[n64 - 1] != ~header) errs |= TPCCHECK_M_TRAILER;
+
+
+      // -----------------------------------------------------
+      // The trigger sequence number and timestamp must both
+      // advance. The sequence is compared modulo 2**32.
+      // -----------------------------------------------------
+      uint32_t  sequence = frag[1] >> 32;
+      uint64_t timestamp = frag[2];
+      if (chk->primed)
+      {
+         if ((int32_t)(sequence - chk->sequence) <= 0)
+         {
+            errs |= TPCCHECK_M_SEQUENCE;
+         }
+
+         if (timestamp <= chk->timestamp) errs |= TPCCHECK_M_TIMESTAMP;
+      }
+
+      chk->sequence  = sequence;
+      chk->timestamp = timestamp;
+      chk->primed    = 1;
 
-   static struct History_s History[2] = { {0, {0, 0}}, {0, {0,0}} };
-   static unsigned int        Counter = 0;
-   uint64_t const               *data = (uint64_t const *)bytes;
-   int                            n64 = nbytes / sizeof (*data) - 1;
-   int                           dest = 0;  
 
+      // -------------------------------------------------
+      // The Originator is a Header2 record, format 2,
+      // type 1, with at least the location, serial number
+      // and versions in its body.
+      // -------------------------------------------------
+      uint32_t   end = n64 - 1;
+      uint32_t   idx = 1 + TPCCHECK_K_NAUX64;
+      uint32_t  orig = (uint32_t)frag[idx];
+      uint32_t  on64 = (orig >> 8) & 0xfff;
 
-   // ------------------------------------
-   // Check for the correct amount of data
-   // ------------------------------------
-   if (nbytes != NBYTES)
+      if ( (orig        & 0xf) != 2
+        || ((orig >> 4) & 0xf) != 1
+        || on64 < 3 || on64 > end - idx)
+      {
+         errs |= TPCCHECK_M_ORIGINATOR;
+      }
+      else
+      {
+         // ----------------------------------------------------
+         // The stream records, one per contributor, follow the
+         // Originator.  Their left counts must decrease to 0.
+         // ----------------------------------------------------
+         int  left = -1;
+         idx      += on64;
+         while (idx < end)
+         {
+            uint64_t shdr = frag[idx];
+            uint32_t sn64 = (shdr >> 8) & 0xffffff;
+            int     stype = (shdr >> 4) & 0xf;
+            int     sleft = (shdr >> 48) & 0xff;
+
+            if ( (shdr & 0xf) != 1 || (stype != 2 && stype != 3)
+              || sn64 < 1 + TPCCHECK_K_RANGESN64 + 1 + 1
+              || sn64 > end - idx)
+            {
+               errs |= TPCCHECK_M_STREAM;
+               break;
+            }
+
+            if (left >= 0 && sleft != left - 1) errs |= TPCCHECK_M_STREAM;
+            left = sleft;
+
+            errs |= tpcCheck_stream (frag + idx, sn64);
+            idx  += sn64;
+         }
+
+         if (idx == end && left > 0) errs |= TPCCHECK_M_STREAM;
+      }
+   }
+
+
+   // -------------------------
+   // Accumulate the statistics
+   // -------------------------
+   chk->nchecked += 1;
+   if (errs)
    {
-      printf ("Aborting @ %2u.%6u %u != %u incorrect amount of data received\n",
-              dest, Counter, nbytes, NBYTES);
-      return 1;
+      chk->nfailed += 1;
+      chk->errors  |= errs;
+      for (int iclass = 0; iclass < TPCCHECK_K_NCLASSES; iclass++)
+      {
+         chk->counts[iclass] += (errs >> iclass) & 1;
+      }
    }
 
-   // SKip FPGA header
-   data += 1;
-   n64  -= 1;
+   return errs;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Checks one TPC stream record
+  \retval == 0, all is okay
+  \retval != 0, a mask of the TpcCheckError classes found
+
+  \param[in] rec  The stream record, beginning with its Header1
+  \param[in] n64  The length of the stream record, already checked to
+                  be within the fragment and large enough to hold the
+                  Ranges, a minimal Toc and the Packet header.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline uint32_t tpcCheck_stream (uint64_t const *rec, uint32_t n64)
+{
+   uint32_t errs = 0;
 
    // -------------------------------------------------------------
-   // Seed predicted sequence number with either
-   //   1) The GPS timestamp of the previous packet
-   //   2) The GPS timestamp of the first frame
+   // Ranges, the Header2 is followed by the 3 packet indices, the
+   // untrimmed beginning and ending timestamps and the window.
    // -------------------------------------------------------------
-   uint16_t   predicted_cvt_0;
-   uint16_t   predicted_cvt_1;
-   uint64_t   predicted_ts = History[dest].timestamp;
-   if (predicted_ts)
+   uint64_t const *ranges = rec + 1;
+   uint32_t const    *r32 = (uint32_t const *)ranges;
+   uint32_t          rhdr = r32[0];
+   if ( (rhdr        & 0xf)   != 2
+     || ((rhdr >> 4) & 0xf)   != 2
+     || ((rhdr >> 8) & 0xfff) != TPCCHECK_K_RANGESN64)
    {
-      predicted_ts    = data[ 1];
-      predicted_cvt_0 = data[ 2] >> 48;
-      predicted_cvt_1 = data[16] >> 48;
+      return TPCCHECK_M_RANGES;
    }
-   else
+
+   uint32_t idxBeg = r32[1];
+   uint32_t idxEnd = r32[2];
+   uint32_t idxTrg = r32[3];
+   uint64_t  tsBeg = ranges[2];
+   uint64_t  tsEnd = ranges[3];
+   uint64_t winBeg = ranges[4];
+   uint64_t winEnd = ranges[5];
+   uint64_t winTrg = ranges[6];
+
+   if (winBeg > winTrg || winTrg > winEnd || tsBeg > tsEnd)
+   {
+      errs |= TPCCHECK_M_RANGES;
+   }
+
+
+   // ------------------------------------------------------------
+   // Toc, the Header2 bridge holds the number of packets, it is
+   // followed by that many descriptors plus the terminator.
+   // ------------------------------------------------------------
+   uint32_t      itoc = 1 + TPCCHECK_K_RANGESN64;
+   uint32_t const *t32 = (uint32_t const *)(rec + itoc);
+   uint32_t       thdr = t32[0];
+   uint32_t       tn64 = (thdr >>  8) & 0xfff;
+   uint32_t      npkts = (thdr >> 24) & 0xff;
+
+   if ( (thdr        & 0xf) != 2
+     || ((thdr >> 4) & 0xf) != 1
+     || tn64 != (sizeof (*t32) * (1 + npkts + 1) + 7) / 8
+     || tn64 >  n64 - itoc - 1)
+   {
+      return errs | TPCCHECK_M_TOC;
+   }
+
+
+   // -------------------------------------------------------
+   // Packet, must exactly fill the rest of the stream record
+   // -------------------------------------------------------
+   uint32_t       irec = itoc + tn64;
+   uint64_t       phdr = rec[irec];
+   uint32_t       pn64 = (phdr >> 8) & 0xffffff;
+   if ( (phdr        & 0xf) != 1
+     || ((phdr >> 4) & 0xf) != 3
+     || pn64 < 1
+     || irec + pn64 != n64)
    {
-      predicted_cvt_0 = History[dest].convert[0];
-      predicted_cvt_1 = History[dest].convert[1];
+      return errs | TPCCHECK_M_PACKET;
    }
 
 
-   // --------------------
-   // Loop over each frame
-   // --------------------
-   unsigned int    frame = 0;
-   for (int idx = 0; idx < n64; idx += N64_PER_FRAME)
+   // ----------------------------------------------------------
+   // The descriptor offsets must start at 0, be non-decreasing
+   // and the terminator must be the length of the packet data.
+   // ----------------------------------------------------------
+   uint32_t const *dscs = t32 + 1;
+   uint32_t       ndata = pn64 - 1;
+
+   if ((dscs[0] >> 8) != 0 || (dscs[npkts] >> 8) != ndata)
    {
-      uint64_t d = data[idx];
+      return errs | TPCCHECK_M_TOC;
+   }
 
-      // -------------------------
-      // Check the comma character
-      // -------------------------
-      if ((d & 0xff) != 0xbc)
+   for (uint32_t ipkt = 0; ipkt < npkts; ipkt++)
+   {
+      int type = (dscs[ipkt] >> 4) & 0xf;
+      if ((dscs[ipkt + 1] >> 8) < (dscs[ipkt] >> 8) || type < 1 || type > 3)
       {
-         printf ("Error frame @ %2u.%6u.%4u: %16.16" PRIx64 "\n",
-                 dest, Counter, frame, d);
+         return errs | TPCCHECK_M_TOC;
       }
+   }
+
+   if (npkts == 0) return errs;
+
+
+   // ---------------------------------------------------------
+   // The indices are packet.sample, a trigger index of -1 means
+   // the trigger was not in the data.
+   // ---------------------------------------------------------
+   if ( (idxBeg >> 16) >= npkts
+     || (idxEnd >> 16) >= npkts
+     ||  idxBeg > idxEnd
+     || (idxTrg != 0xffffffff && (idxTrg >> 16) >= npkts))
+   {
+      errs |= TPCCHECK_M_RANGES;
+   }
+
+
+   // -----------------------------------------------------
+   // The packets must be contiguous in time and together
+   // span the untrimmed range.  The ending time is one
+   // sample beyond the last timestamp.
+   // -----------------------------------------------------
+   uint64_t const *data = rec + irec + 1;
+   uint64_t        first = 0;
+   uint64_t         next = 0;
+   for (uint32_t ipkt = 0; ipkt < npkts; ipkt++)
+   {
+      uint32_t   beg = dscs[ipkt    ] >> 8;
+      uint32_t   end = dscs[ipkt + 1] >> 8;
+      uint64_t range[2];
+      uint32_t  perr = tpcCheck_packet (data + beg,
+                                        end  - beg,
+                                        (dscs[ipkt] >> 4) & 0xf,
+                                        range);
+      errs |= perr;
+      if (perr) return errs;
+
+      if      (ipkt     == 0) first = range[0];
+      else if (range[0] != next) errs |= TPCCHECK_M_CADENCE;
+
+      next = range[1];
+   }
+
+   if (first != tsBeg || next != tsEnd) errs |= TPCCHECK_M_RANGES;
+
+   return errs;
+}
+/* ---------------------------------------------------------------------- */
+
 
-      // -----------------------------------
-      // Form and check the sequence counter
-      // ----------------------------------
-      uint64_t timestamp = data[idx+1];
-      uint16_t     cvt_0 = data[idx +  2] >> 48;
-      uint16_t     cvt_1 = data[idx + 16] >> 48;
 
-      int error = ((timestamp != predicted_ts   ) << 0)
-                | ((cvt_0     != predicted_cvt_0) << 1)
-                | ((cvt_1     != predicted_cvt_1) << 2);
 
-      if (error)
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Checks one data packet
+  \retval == 0, all is okay
+  \retval != 0, a mask of the TpcCheckError classes found
+
+  \param[in]     pkt  The packet
+  \param[in]     n64  Its length, in 64-bit words
+  \param[in]    type  Its Toc type, 1 = WIB frames, 2 = transposed,
+                      3 = compressed
+  \param[out] range   The timestamp of its first sample and one sample
+                      beyond its last. Only valid if no error.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline uint32_t tpcCheck_packet (uint64_t const *pkt,
+                                        uint32_t        n64,
+                                        int            type,
+                                        uint64_t   range[2])
+{
+   if (type == 1)
+   {
+      return tpcCheck_frames (pkt, n64, range);
+   }
+
+
+   // -----------------------------------------------------------
+   // Compressed and transposed packets carry the timestamps of
+   // their first and last frames in words 2 and 3.
+   // -----------------------------------------------------------
+   int nsamples;
+   if (type == 2)
+   {
+      WibTransposed view;
+      if (wibTransposed_locate (&view, pkt, n64) != 0)
       {
-         printf ("Error  seq @ %2u.%6u.%4u: "
-                 "ts: %16.16" PRIx64 " %c= %16.16" PRIx64 " "
-                 "cvt: %4.4" PRIx16 " %c= %4.4" PRIx16 " "
-                 "cvt: %4.4" PRIx16 " %c= %4.4" PRIx16 "\n",
-                 dest, Counter, frame, 
-                 timestamp, (error&1) ? '!' : '=', predicted_ts,
-                 cvt_0    , (error&2) ? '!' : '=', predicted_cvt_0,
-                 cvt_1    , (error&4) ? '!' : '=', predicted_cvt_1);
-
-         // -----------------------------------------------------
-         // In case of error, resynch the predicted to the actual
-         // -----------------------------------------------------
-         predicted_ts    = timestamp;
-         predicted_cvt_0 = cvt_0;
-         predicted_cvt_1 = cvt_1;
+         return TPCCHECK_M_COMPRESSED;
       }
-      else if (1 && ((Counter % (1024)) == 0) && ((frame % 256) == 0))
+      nsamples = view.nsamples;
+   }
+   else
+   {
+      WibDecodeToc toc;
+      if (wibDecode_toc (&toc, pkt, n64) != WIBDECODE_K_OK)
       {
-         // --------------------------------------
-         // Print reassuring message at about 2 Hz
-         // --------------------------------------
-         printf ("Spot check @ %2u.%6u.%4u: "
-                 "ts: %16.16" PRIx64 " == %16.16" PRIx64 " "
-                 "cvt: %4.4" PRIx16 " == %4.4" PRIx16 " "
-                 "cvt: %4.4" PRIx16 " == %4.4" PRIx16 "\n",
-                 dest, Counter, frame, 
-                 timestamp, predicted_ts,
-                 cvt_0    , predicted_cvt_0,
-                 cvt_1    , predicted_cvt_1);
+         return TPCCHECK_M_COMPRESSED;
       }
+      nsamples = toc.nsamples;
+   }
 
+   range[0] = pkt[2];
+   range[1] = pkt[3] + TPCCHECK_K_TICKS;
 
-      // -------------------------------------
-      // Advance the predicted sequence number
-      // Advance the frame counter
-      // -------------------------------------
-      predicted_ts     = timestamp + 500;
-      predicted_cvt_0 += 1;
-      predicted_cvt_1 += 1;
-      frame           += 1;
+   if (range[1] - range[0] != (uint64_t)nsamples * TPCCHECK_K_TICKS)
+   {
+      return TPCCHECK_M_CADENCE;
    }
 
-   // -----------------------------------------------
-   // Keep track of the number of time called and
-   // the expected sequence number of the next packet
-   // for this destination.
-   // -----------------------------------------------
-   Counter                 += 1;
-   History[dest].timestamp  = predicted_ts    +  500;
-   History[dest].convert[0] = predicted_cvt_0 +    1;
-   History[dest].convert[1] = predicted_cvt_1 +    1;
-
    return 0;
 }
 /* ---------------------------------------------------------------------- */
 
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Checks a packet of WIB frames
+  \retval == 0, all is okay
+  \retval != 0, a mask of TPCCHECK_M_PACKET, TPCCHECK_M_COMMA and
+                TPCCHECK_M_CADENCE
+
+  \param[in]     pkt  The packet
+  \param[in]     n64  Its length, in 64-bit words
+  \param[out] range   The timestamp of its first frame and one sample
+                      beyond its last.
+
+  \par
+   This is the only loop that scales with the data, so it touches only
+   the first 2 words of each frame and accumulates the differences
+   without branching.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline uint32_t tpcCheck_frames (uint64_t const *pkt,
+                                        uint32_t        n64,
+                                        uint64_t   range[2])
+{
+   uint32_t nframes = n64 / TPCCHECK_K_N64PERFRAME;
+   if (nframes == 0 || nframes * TPCCHECK_K_N64PERFRAME != n64)
+   {
+      return TPCCHECK_M_PACKET;
+   }
+
+   uint64_t      ts = pkt[1];
+   uint64_t   comma = 0;
+   uint64_t cadence = 0;
+   range[0]         = ts;
+
+   for (uint32_t iframe = 0; iframe < nframes; iframe++)
+   {
+      comma   |= (pkt[0] & 0xff) ^ TPCCHECK_K_COMMA;
+      cadence |=  pkt[1] ^ ts;
+      ts      += TPCCHECK_K_TICKS;
+      pkt     += TPCCHECK_K_N64PERFRAME;
+   }
+
+   range[1] = ts;
+
+   return (comma   ? TPCCHECK_M_COMMA   : 0)
+        | (cadence ? TPCCHECK_M_CADENCE : 0);
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Returns the name of an error class
+  \return The name, "???" if unknown
+
+  \param[in] iclass  The error class, a TPCCHECK_V_xxx value
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline char const *tpcCheck_name (int iclass)
+{
+   static char const *Names[TPCCHECK_K_NCLASSES] =
+   {
+      [TPCCHECK_V_HEADER    ] = "Header",
+      [TPCCHECK_V_LENGTH    ] = "Length",
+      [TPCCHECK_V_TRAILER   ] = "Trailer",
+      [TPCCHECK_V_ORIGINATOR] = "Originator",
+      [TPCCHECK_V_STREAM    ] = "Stream",
+      [TPCCHECK_V_RANGES    ] = "Ranges",
+      [TPCCHECK_V_TOC       ] = "Toc",
+      [TPCCHECK_V_PACKET    ] = "Packet",
+      [TPCCHECK_V_SEQUENCE  ] = "Sequence",
+      [TPCCHECK_V_TIMESTAMP ] = "Timestamp",
+      [TPCCHECK_V_COMMA     ] = "Comma",
+      [TPCCHECK_V_CADENCE   ] = "Cadence",
+      [TPCCHECK_V_COMPRESSED] = "Compressed"
+   };
+
+   if ((unsigned)iclass >= TPCCHECK_K_NCLASSES) return "???";
+   return Names[iclass];
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Prints the number of fragments checked and those failing by
+          error class
+
+  \param[in]    chk  The check context
+  \param[in] prefix  Printed at the beginning of the line
+
+  \par
+   Only the classes with failures are printed.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline void tpcCheck_print (TpcCheck const *chk, char const *prefix)
+{
+   printf ("%sChecked %" PRIu64 " failed %" PRIu64,
+           prefix, chk->nchecked, chk->nfailed);
+
+   for (int iclass = 0; iclass < TPCCHECK_K_NCLASSES; iclass++)
+   {
+      if (chk->counts[iclass])
+      {
+         printf (" %s:%" PRIu64, tpcCheck_name (iclass), chk->counts[iclass]);
+      }
+   }
+
+   putchar ('\n');
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
 #endif
@@ -0,0 +1,411 @@
+// -*-Mode: C;-*-
+
+/* ---------------------------------------------------------------------- *//*!
+ *
+ *  @file     bitio_bench.cpp
+ *  @brief    Validates and times the BitIO.h bit stream writer and reader
+ *  @verbatim
+ *                               Copyright 2018
+ *                                    by
+ *
+ *                       The Board of Trustees of the
+ *                    Leland Stanford Junior University.
+ *                           All rights reserved.
+ *
+ *  @endverbatim
+ *
+ *  @par Facility:
+ *  util
+ *
+ *  @author
+ *  <russell@slac.stanford.edu>
+ *
+ *  @par Date created:
+ *  <2018/07/31>
+ *
+ * @par Credits:
+ * SLAC
+ *
+\* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *\
+
+   HISTORY
+   -------
+
+   DATE       WHO WHAT
+   ---------- --- ---------------------------------------------------------
+   2018.07.31 jjr Created
+
+\* ---------------------------------------------------------------------- */
+
+
+/* ---------------------------------------------------------------------- *\
+
+   A stream of random fields is written and read back with
+
+     word     the word at a time stuffer BitIO.h replaced and
+              wibDecode_peek
+     bitio    bitWriter_insert and bitReader_read
+     bulk     bitWriter_insertN, fixed width fields only
+
+   The field widths follow what the coders emit, mostly a few bits
+   with the occasional wide header. All writers must produce the same
+   words and all readers must return the fields.
+
+\* ---------------------------------------------------------------------- */
+
+
+// This must go first in order to get things like PRIx32 defined
+#include <cinttypes>
+
+#include "BitIO.h"
+#include "WibDecode.h"
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Returns the current monotonic time in nanoseconds
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline uint64_t now_ns ()
+{
+   struct timespec ts;
+   clock_gettime (CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \struct _WordBits
+  \brief   The word at a time stuffer that BitIO.h replaced
+                                                                          */
+/* ---------------------------------------------------------------------- */
+typedef struct _WordBits
+{
+   uint64_t   *buf;  /*!< The output buffer                               */
+   uint32_t    n64;  /*!< Its capacity in 64-bit words                    */
+   uint32_t    idx;  /*!< The current bit index                           */
+   uint64_t    cur;  /*!< The staging word, idx & 0x3f bits are valid     */
+}
+WordBits;
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- */
+static inline void wordBits_insert (WordBits *bs, uint64_t bits, int nbits)
+{
+   if (nbits == 0) return;
+   if (nbits < 64) bits &= (1ULL << nbits) - 1;
+
+   int room = 64 - (bs->idx & 0x3f);
+   if (nbits < room)
+   {
+      bs->cur  = (bs->cur << nbits) | bits;
+      bs->idx += nbits;
+      return;
+   }
+
+   int       over = nbits - room;
+   uint64_t     w = (room == 64 ? 0 : bs->cur << room) | (bits >> over);
+   uint32_t    iw = bs->idx >> 6;
+   if (iw < bs->n64) bs->buf[iw] = w;
+
+   bs->cur  = bits;
+   bs->idx += nbits;
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- */
+static inline uint32_t wordBits_flush (WordBits *bs)
+{
+   int used = bs->idx & 0x3f;
+   if (used)
+   {
+      uint32_t iw = bs->idx >> 6;
+      if (iw < bs->n64) bs->buf[iw] = bs->cur << (64 - used);
+   }
+
+   return bs->idx;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief Prints one timing line
+
+  \param[in]   what  The method
+  \param[in]    dir  "write" or "read"
+  \param[in]  nsyms  The number of fields per iteration
+  \param[in]  niter  The number of iterations
+  \param[in]     ns  The elapsed time in nanoseconds
+  \param[in]     ok  Did the result match
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static void report (char const *what,
+                    char const  *dir,
+                    int        nsyms,
+                    int        niter,
+                    uint64_t      ns,
+                    bool          ok)
+{
+   double rate = (double)nsyms * niter / (ns * 1.e-9);
+   printf ("%-6s %-5s %-8s %8.1f Msymbols/s %6.2f ns/symbol\n",
+           what, dir, ok ? "ok" : "MISMATCH",
+           rate * 1.e-6, 1.e9 / rate);
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Writes and reads back \a nsyms fields of the given widths
+  \return The number of mismatches
+
+  \param[in]   vals  The field values
+  \param[in] widths  The field widths
+  \param[in]  nsyms  The number of fields
+  \param[in]  niter  The number of iterations
+  \param[in]  label  The description of the widths
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static int bench (uint64_t const   *vals,
+                  uint8_t const  *widths,
+                  int              nsyms,
+                  int              niter,
+                  char const      *label)
+{
+   uint32_t   n64 = (nsyms * 64 + 63) / 64 + 1;
+   uint64_t *ref  = (uint64_t *)calloc (n64, sizeof (*ref));
+   uint64_t *buf  = (uint64_t *)calloc (n64, sizeof (*buf));
+   uint64_t  sum  = 0;
+   int       nerr = 0;
+
+   printf ("%s\n", label);
+
+
+   // ---------------------------------------------
+   // Writers, the word at a time one is the reference
+   // ---------------------------------------------
+   uint32_t nbits = 0;
+   uint64_t beg   = now_ns ();
+   for (int iter = 0; iter < niter; iter++)
+   {
+      WordBits bs = { ref, n64, 0, 0 };
+      for (int isym = 0; isym < nsyms; isym++)
+      {
+         wordBits_insert (&bs, vals[isym], widths[isym]);
+      }
+      nbits = wordBits_flush (&bs);
+   }
+   report ("word", "write", nsyms, niter, now_ns () - beg, true);
+
+   beg = now_ns ();
+   for (int iter = 0; iter < niter; iter++)
+   {
+      BitWriter bw;
+      bitWriter_init (&bw, buf, n64, 0);
+      for (int isym = 0; isym < nsyms; isym++)
+      {
+         bitWriter_insert (&bw, vals[isym], widths[isym]);
+      }
+      bitWriter_flush (&bw);
+   }
+   bool ok = memcmp (ref, buf, ((nbits + 63) >> 6) * sizeof (*buf)) == 0;
+   report ("bitio", "write", nsyms, niter, now_ns () - beg, ok);
+   nerr += !ok;
+
+
+   // ---------------------------------------------
+   // Readers
+   // ---------------------------------------------
+   uint32_t nw = (nbits + 63) >> 6;
+   beg = now_ns ();
+   for (int iter = 0; iter < niter; iter++)
+   {
+      uint32_t pos = 0;
+      for (int isym = 0; isym < nsyms; isym++)
+      {
+         int      n = widths[isym];
+         uint64_t w = wibDecode_peek (ref, nw, pos);
+         sum += n ? w >> (64 - n) : 0;
+         pos += n;
+      }
+   }
+   report ("word", "read", nsyms, niter, now_ns () - beg, true);
+
+   uint64_t chk = 0;
+   ok  = true;
+   beg = now_ns ();
+   for (int iter = 0; iter < niter; iter++)
+   {
+      BitReader br;
+      bitReader_init (&br, ref, nw, 0);
+      for (int isym = 0; isym < nsyms; isym++)
+      {
+         chk += bitReader_read (&br, widths[isym]);
+      }
+   }
+   uint64_t elapsed = now_ns () - beg;
+   ok = chk == sum;
+   report ("bitio", "read", nsyms, niter, elapsed, ok);
+   nerr += !ok;
+
+   free (buf);
+   free (ref);
+   return nerr;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Times bitWriter_insertN against single inserts
+  \return The number of mismatches
+
+  \param[in]   vals  The field values
+  \param[in]  nsyms  The number of fields
+  \param[in]  nbits  The field width
+  \param[in]  niter  The number of iterations
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static int bulk (uint16_t const *vals,
+                 int            nsyms,
+                 int            nbits,
+                 int            niter)
+{
+   uint32_t   n64 = (nsyms * nbits + 63) / 64 + 1;
+   uint64_t *ref  = (uint64_t *)calloc (n64, sizeof (*ref));
+   uint64_t *buf  = (uint64_t *)calloc (n64, sizeof (*buf));
+
+   printf ("%d-bit fields, bulk\n", nbits);
+
+   uint64_t beg = now_ns ();
+   for (int iter = 0; iter < niter; iter++)
+   {
+      BitWriter bw;
+      bitWriter_init (&bw, ref, n64, 0);
+      for (int isym = 0; isym < nsyms; isym++)
+      {
+         bitWriter_insert (&bw, vals[isym], nbits);
+      }
+      bitWriter_flush (&bw);
+   }
+   report ("bitio", "write", nsyms, niter, now_ns () - beg, true);
+
+   beg = now_ns ();
+   for (int iter = 0; iter < niter; iter++)
+   {
+      BitWriter bw;
+      bitWriter_init (&bw, buf, n64, 0);
+      bitWriter_insertN (&bw, vals, nsyms, nbits);
+      bitWriter_flush (&bw);
+   }
+   bool ok = memcmp (ref, buf, n64 * sizeof (*buf)) == 0;
+   report ("bulk", "write", nsyms, niter, now_ns () - beg, ok);
+
+   free (buf);
+   free (ref);
+   return !ok;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Main entry point
+  \retval 0, all the methods agree
+  \retval 1, a mismatch was found
+
+  \param[in] argc The count of command line arguments
+  \param[in] argv The vector of command line arguments
+                                                                          */
+/* ---------------------------------------------------------------------- */
+int main (int argc, char *const argv[])
+{
+   int nsyms = 1 << 16;
+   int niter = 200;
+   int c;
+
+   while ( (c = getopt (argc, argv, "s:n:")) != EOF)
+   {
+      if      (c == 's') nsyms = strtol (optarg, NULL, 0);
+      else if (c == 'n') niter = strtol (optarg, NULL, 0);
+      else
+      {
+         printf ("Usage: bitio_bench [-s symbols] [-n iterations]\n");
+         return -1;
+      }
+   }
+
+   uint64_t *vals   = (uint64_t *)malloc (nsyms * sizeof (*vals));
+   uint16_t *vals16 = (uint16_t *)malloc (nsyms * sizeof (*vals16));
+   uint8_t  *widths = (uint8_t  *)malloc (nsyms);
+   int       nerr   = 0;
+
+   if (nsyms <= 0 || !vals || !vals16 || !widths)
+   {
+      printf ("Can not allocate %d symbols\n", nsyms);
+      return -1;
+   }
+
+   srand48 (1);
+   for (int isym = 0; isym < nsyms; isym++)
+   {
+      vals  [isym] = ((uint64_t)mrand48 () << 32) ^ mrand48 ();
+      vals16[isym] = vals[isym];
+   }
+
+   printf ("Stream: %d symbols, %d iterations\n", nsyms, niter);
+
+   // The coders' renormalization, 0-12 bits, 1 in 64 a 32-bit header
+   for (int isym = 0; isym < nsyms; isym++)
+   {
+      widths[isym] = (lrand48 () & 0x3f) ? lrand48 () % 13 : 32;
+   }
+   nerr += bench (vals, widths, nsyms, niter, "Coder-like fields, 0-12 bits");
+
+   // Full range, exercises the word crossings
+   for (int isym = 0; isym < nsyms; isym++)
+   {
+      widths[isym] = lrand48 () % 65;
+   }
+   nerr += bench (vals, widths, nsyms, niter, "Random fields, 0-64 bits");
+
+   nerr += bulk (vals16, nsyms,  4, niter);
+   nerr += bulk (vals16, nsyms, 12, niter);
+
+   free (widths);
+   free (vals16);
+   free (vals);
+
+   printf ("%s\n", nerr ? "FAILED" : "ok");
+   return nerr ? 1 : 0;
+}
+/* ---------------------------------------------------------------------- */
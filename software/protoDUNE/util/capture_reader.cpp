@@ -0,0 +1,274 @@
+// -*-Mode: C;-*-
+
+/* ---------------------------------------------------------------------- *//*!
+ *
+ *  @file     capture_reader.cpp
+ *  @brief    Lists and extracts fragments from an indexed capture file
+ *  @verbatim
+ *                               Copyright 2018
+ *                                    by
+ *
+ *                       The Board of Trustees of the
+ *                    Leland Stanford Junior University.
+ *                           All rights reserved.
+ *
+ *  @endverbatim
+ *
+ *  @par Facility:
+ *  util
+ *
+ *  @author
+ *  <russell@slac.stanford.edu>
+ *
+ *  @par Date created:
+ *  <2018/07/23>
+ *
+ * @par Credits:
+ * SLAC
+ *
+\* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *\
+
+   HISTORY
+   -------
+
+   DATE       WHO WHAT
+   ---------- --- ---------------------------------------------------------
+   2018.07.23 jjr Created
+
+\* ---------------------------------------------------------------------- */
+
+// This must go first in order to get things like PRIx32 defined
+#include <cinttypes>
+
+#include "TpcPrinter.h"
+#include "CaptureFile.h"
+
+#include <getopt.h>
+#include <stdlib.h>
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \struct _Prms
+  \brief   The command line parameters
+                                                                          */
+/* ---------------------------------------------------------------------- */
+struct _Prms
+{
+   char const *ifilename;  /*!< The capture file                          */
+   char const *ofilename;  /*!< If non-NULL, file to extract fragments to */
+   int64_t     sequence;   /*!< If >= 0, first sequence number to select  */
+   uint64_t   timestamp;   /*!< If != 0, first timestamp to select        */
+   int           first;    /*!< First fragment to select                  */
+   int          nfrags;    /*!< Number of fragments to select, -1 = all   */
+   bool          print;    /*!< Print the fragments' records              */
+};
+/* ---------------------------------------------------------------------- */
+typedef struct _Prms Prms;
+/* ---------------------------------------------------------------------- */
+
+
+
+static void getPrms     (Prms *prms, int argc, char *const argv[]);
+static void reportUsage ();
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+   \brief  Lists the selected range of fragments and optionally prints
+           and extracts them
+
+   \param[in] argc The  count of command line arguments
+   \param[in] argv The vector of command line arguments
+                                                                          */
+/* ---------------------------------------------------------------------- */
+int main (int argc, char *const argv[])
+{
+   Prms prms;
+   getPrms (&prms, argc, argv);
+
+   CaptureReader reader;
+   int status = captureReader_open (&reader, prms.ifilename);
+   if (status)
+   {
+      fprintf (stderr, "Error opening capture file: %s err = %d\n",
+               prms.ifilename, status);
+      exit (-1);
+   }
+
+   printf ("File: %s  %" PRIu32 " fragments%s\n",
+           prms.ifilename, reader.nentries,
+           reader.recovered ? " (index recovered)" : "");
+
+
+   // --------------------------------------
+   // Locate the first fragment to select
+   // --------------------------------------
+   int first = prms.first;
+   if      (prms.sequence  >= 0) first = captureReader_findSequence  (&reader, prms.sequence);
+   else if (prms.timestamp != 0) first = captureReader_findTimestamp (&reader, prms.timestamp);
+
+   if (first < 0 || (uint32_t)first >= reader.nentries)
+   {
+      fprintf (stderr, "Error: no fragment matches the selection\n");
+      captureReader_close (&reader);
+      exit (-1);
+   }
+
+   uint32_t nfrags = reader.nentries - first;
+   if (prms.nfrags >= 0 && (uint32_t)prms.nfrags < nfrags) nfrags = prms.nfrags;
+
+   captureReader_advise (&reader, first, nfrags);
+
+
+   CaptureWriter writer;
+   if (prms.ofilename)
+   {
+      status = captureWriter_open (&writer, prms.ofilename,
+                                   reader.hdr->interval, reader.hdr->source);
+      if (status)
+      {
+         fprintf (stderr, "Error opening output file: %s err = %d\n",
+                  prms.ofilename, status);
+         exit (-1);
+      }
+   }
+
+
+   puts ("  Index   Sequence        Timestamp       Offset   nBytes     Contributors");
+   for (uint32_t idx = first; idx < first + nfrags; idx++)
+   {
+      CaptureIndexEntry const *entry = reader.entries + idx;
+      uint32_t                nbytes = 0;
+      uint64_t const           *frag = (uint64_t const *)
+                                       captureReader_fragment (&reader, idx, &nbytes);
+      if (frag == NULL)
+      {
+         fprintf (stderr, "Error locating fragment %" PRIu32 "\n", idx);
+         break;
+      }
+
+      printf ("%7" PRIu32 " %10" PRIu32 " %16.16" PRIx64 " %12" PRIu64 " %8" PRIu32
+              " %16.16" PRIx64 "\n",
+              idx,
+              entry->sequence,
+              entry->timestamp,
+              entry->offset,
+              entry->nbytes,
+              entry->contributors);
+
+      if (prms.print)
+      {
+         print_hdr    (frag[0]);
+         print_id     (frag + 1);
+         print_record (frag + 1, nbytes / sizeof (*frag) - 1);
+      }
+
+      if (prms.ofilename)
+      {
+         status = captureWriter_writeId (&writer, frag, nbytes,
+                                         entry->sequence,
+                                         entry->timestamp,
+                                         entry->contributors);
+         if (status)
+         {
+            fprintf (stderr, "Error %d writing the output file\n", status);
+            exit (-1);
+         }
+      }
+   }
+
+   if (prms.ofilename) captureWriter_close (&writer);
+   captureReader_close (&reader);
+
+   return 0;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief Parse out the command line parameters
+
+  \param[out] prms  The parsed parameters
+  \param[in]  argc  The  count of command line parameters
+  \param[in]  argv  The vector of command line parameters
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static void getPrms (Prms *prms, int argc, char *const argv[])
+{
+   int c;
+
+   prms->ifilename = NULL;
+   prms->ofilename = NULL;
+   prms->sequence  = -1;
+   prms->timestamp =  0;
+   prms->first     =  0;
+   prms->nfrags    = -1;
+   prms->print     = false;
+
+   while ( (c = getopt (argc, argv, "f:n:o:ps:t:")) != EOF)
+   {
+      if      (c == 'f') prms->first     = strtol   (optarg, NULL, 0);
+      else if (c == 'n') prms->nfrags    = strtol   (optarg, NULL, 0);
+      else if (c == 'o') prms->ofilename = optarg;
+      else if (c == 'p') prms->print     = true;
+      else if (c == 's') prms->sequence  = strtoll  (optarg, NULL, 0);
+      else if (c == 't') prms->timestamp = strtoull (optarg, NULL, 0);
+      else
+      {
+         reportUsage ();
+         exit (-1);
+      }
+   }
+
+   if (optind < argc)
+   {
+      prms->ifilename = argv[optind];
+   }
+   else
+   {
+      fprintf (stderr, "Error: The capture file was not specified\n\n");
+      reportUsage ();
+      exit (-1);
+   }
+
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief Report the command line usage
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static void reportUsage ()
+{
+   printf (
+"Usage:\n"
+"$ capture_reader [f:n:o:ps:t:] filename\n"
+"  where:\n"
+"      f:  The first fragment number to select, default = 0\n"
+"      n:  The number of fragments to select, default = all\n"
+"      s:  Select starting at this trigger sequence number\n"
+"      t:  Select starting at the first timestamp at or after this\n"
+"      p:  Print the records of each selected fragment\n"
+"      o:  Extract the selected fragments to this capture file\n"
+"\n"
+" Example:\n"
+" $ capture_reader -s 1000 -n 10 -p /tmp/dump.dat\n");
+
+   return;
+}
+/* ---------------------------------------------------------------------- */
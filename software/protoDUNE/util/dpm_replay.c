@@ -0,0 +1,1363 @@
+// -*-Mode: C;-*-
+
+/* ---------------------------------------------------------------------- *//*!
+ *
+ *  @file     dpm_replay.c
+ *  @brief    Replays captured fragments as if they came from the DPMs
+ *  @verbatim
+ *                               Copyright 2018
+ *                                    by
+ *
+ *                       The Board of Trustees of the
+ *                    Leland Stanford Junior University.
+ *                           All rights reserved.
+ *
+ *  @endverbatim
+ *
+ *  @par Facility:
+ *  pdd
+ *
+ *  @author
+ *  <russell@slac.stanford.edu>
+ *
+ *  @par Date created:
+ *  <2018/08/23>
+ *
+ * @par Credits:
+ * SLAC
+ *
+ *  @par
+ *  Reads one or more files of fragments, either indexed capture files
+ *  (CaptureFile.h) or the raw output of tcp_receiver, and sends them
+ *  again so that the receivers, the event builder and the monitors can
+ *  be exercised without hardware.
+ *
+ *  The files are memory mapped and every page is touched, (optionally
+ *  locked with -L), before anything is sent, so that the replay is never
+ *  waiting on the disk. The fragments are sent directly from the mapped
+ *  files; when a fragment's identification must be changed only its
+ *  first 3 words are copied and patched, the rest is gathered from the
+ *  mapping.
+ *
+ *  Each of the -n streams is its own thread and connection and sends
+ *  the whole set of fragments. By default the streams connect over TCP,
+ *  as a DPM does, to the -p port(s) on the -H host. With -U <path>, they
+ *  connect instead to an AF_UNIX SOCK_SEQPACKET socket, a local stand-in
+ *  for RSSI. As with RSSI, each fragment is delivered as a sequence of
+ *  framed segments, of at most -z bytes, that arrive reliably and in
+ *  order. tcp_multi_receiver -U listens on such a socket.
+ *
+ *  The fragments are sent
+ *    - as fast as possible, the default
+ *    - at -r <rate> fragments per second per stream
+ *    - with -T <speed>, at the recorded timing, as given by the trigger
+ *      timestamps, scaled by speed, (2 = twice as fast). Gaps longer
+ *      than a second, e.g. between runs, are cut to a second.
+ *
+ *  The set is sent -l times, 0 being until stopped. Each pass after the
+ *  first advances the trigger sequence numbers and timestamps by the
+ *  span of the set, so that downstream they continue to increase. With
+ *  -u each stream offsets the Src0/Src1 fields of the Identifier by its
+ *  stream number so the streams look like different RCEs to the event
+ *  builder. Only the fragment header is rewritten, the timestamps of the
+ *  WIB frames within the fragment are as recorded.
+ *
+\* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *\
+
+   HISTORY
+   -------
+
+   DATE       WHO WHAT
+   ---------- --- ---------------------------------------------------------
+   2018.08.23 jjr Created
+
+\* ---------------------------------------------------------------------- */
+
+#define _GNU_SOURCE
+
+#include "CaptureFile.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <inttypes.h>
+#include <getopt.h>
+#include <errno.h>
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \enum  Limits
+  \brief Compile time limits
+                                                                          */
+/* ---------------------------------------------------------------------- */
+enum Limits
+{
+   MAX_K_PORTS    =  8,         /*!< Maximum number of destination ports  */
+   MAX_K_STREAMS  = 64,         /*!< Maximum number of streams            */
+   MAX_K_FILES    = 256,        /*!< Maximum number of input files        */
+   MAX_K_GAP      = 50000000,   /*!< Longest recorded gap, in clock ticks,
+                                     that is honored, 1 second            */
+   NSEC_PER_TICK  = 20          /*!< Nanoseconds per timestamp tick       */
+};
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \struct _Prms
+  \brief   The configuration parameters
+                                                                          *//*!
+  \typedef Prms
+  \brief   Typedef for struct _Prms
+                                                                          */
+/* ---------------------------------------------------------------------- */
+struct _Prms
+{
+   char const           *host;  /*!< The receiving host                   */
+   int                 nports;  /*!< Number of destination ports          */
+   int     ports[MAX_K_PORTS];  /*!< The ports, assigned round robin      */
+   char const      *framePath;  /*!< If non-NULL, the RSSI stand-in socket*/
+   uint32_t           segSize;  /*!< Maximum size of a framed segment     */
+   int                sndSize;  /*!< Size of the send buffer, 0 = default */
+   int                nodelay;  /*!< Value of the TCP_NODELAY parameter   */
+   int               nstreams;  /*!< Number of parallel streams           */
+   double                rate;  /*!< Fragments/sec/stream, 0 = unpaced    */
+   double               speed;  /*!< If != 0, replay at the recorded
+                                     timing scaled by this                */
+   uint32_t            nloops;  /*!< Passes over the set, 0 = forever     */
+   char                unique;  /*!< Give each stream its own source ids  */
+   char                  lock;  /*!< Lock the mapped files in memory      */
+   int                 nfiles;  /*!< Number of input files                */
+   char const *const   *files;  /*!< The input files                      */
+};
+/* ---------------------------------------------------------------------- */
+typedef struct _Prms Prms;
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \struct _Fragment
+  \brief   Locates and identifies one fragment in the mapped files
+                                                                          *//*!
+  \typedef Fragment
+  \brief   Typedef for struct _Fragment
+                                                                          */
+/* ---------------------------------------------------------------------- */
+struct _Fragment
+{
+   uint8_t const     *data;  /*!< The fragment in its mapped file          */
+   uint32_t         nbytes;  /*!< Its size in bytes                        */
+   uint32_t       sequence;  /*!< Its trigger sequence number              */
+   uint64_t      timestamp;  /*!< Its trigger timestamp                    */
+   uint32_t            gap;  /*!< Ticks since the previous fragment,
+                                  limited to MAX_K_GAP                     */
+   int               valid;  /*!< Recognized, so its header may be patched */
+};
+/* ---------------------------------------------------------------------- */
+typedef struct _Fragment Fragment;
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \struct _Mapping
+  \brief   One memory mapped input file
+                                                                          *//*!
+  \typedef Mapping
+  \brief   Typedef for struct _Mapping
+                                                                          */
+/* ---------------------------------------------------------------------- */
+struct _Mapping
+{
+   uint8_t const      *base;  /*!< Base address of the mapping            */
+   size_t            nbytes;  /*!< Size of the mapping                    */
+   CaptureReader     reader;  /*!< The reader, if a capture file          */
+   int              capture;  /*!< If != 0, a capture file                */
+};
+/* ---------------------------------------------------------------------- */
+typedef struct _Mapping Mapping;
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \struct _Statistics
+  \brief   Keeps track of what one stream has sent
+                                                                          *//*!
+  \typedef Statistics
+  \brief   Typedef for struct _Statistics
+                                                                          */
+/* ---------------------------------------------------------------------- */
+struct _Statistics
+{
+   uint64_t     nfrags;  /*!< The number of fragments sent                */
+   uint64_t     nbytes;  /*!< The number of bytes sent                    */
+   uint64_t      nlate;  /*!< Fragments sent after their scheduled time   */
+   uint32_t     nloops;  /*!< Number of completed passes                  */
+};
+/* ---------------------------------------------------------------------- */
+typedef struct _Statistics Statistics;
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \struct _Replay
+  \brief   The set of fragments, shared read-only by all the streams
+                                                                          *//*!
+  \typedef Replay
+  \brief   Typedef for struct _Replay
+                                                                          */
+/* ---------------------------------------------------------------------- */
+struct _Replay
+{
+   Prms const            *prms;  /*!< The control parameters              */
+   Mapping maps[MAX_K_FILES];    /*!< The mapped input files              */
+   int                   nmaps;  /*!< Number of mapped files              */
+   Fragment             *frags;  /*!< The fragments, in file order        */
+   uint32_t             nfrags;  /*!< Number of fragments                 */
+   uint32_t          allocated;  /*!< Number of allocated Fragments       */
+   uint64_t             nbytes;  /*!< Total size of the fragments         */
+   uint32_t            seqSpan;  /*!< Sequence advance for each pass      */
+   uint64_t             tsSpan;  /*!< Timestamp advance for each pass     */
+};
+/* ---------------------------------------------------------------------- */
+typedef struct _Replay Replay;
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \struct _Stream
+  \brief   The context of one stream
+                                                                          *//*!
+  \typedef Stream
+  \brief   Typedef for struct _Stream
+                                                                          */
+/* ---------------------------------------------------------------------- */
+struct _Stream
+{
+   Replay const        *replay;  /*!< The fragments to send               */
+   int                   which;  /*!< The stream number                   */
+   int                      fd;  /*!< Its socket                          */
+   pthread_t            thread;  /*!< Its thread                          */
+   int                    done;  /*!< Set when the stream has finished    */
+   int                  status;  /*!< Its completion status, an errno     */
+   uint64_t              ended;  /*!< When it finished, in ns             */
+   Statistics            stats;  /*!< What it has sent                    */
+};
+/* ---------------------------------------------------------------------- */
+typedef struct _Stream Stream;
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- */
+/* LOCAL PROTOTYPES                                                       */
+/* ---------------------------------------------------------------------- */
+static void    getPrms           (Prms         *prms,
+                                  int           argc,
+                                  char *const argv[]);
+static void    reportUsage       ();
+
+static int     replay_load       (Replay     *replay,
+                                  Prms const   *prms);
+static void    replay_unload     (Replay     *replay);
+static int     replay_map        (Replay     *replay,
+                                  char const *filename);
+static void    replay_scan       (Replay     *replay,
+                                  uint8_t const  *beg,
+                                  uint8_t const  *end);
+static void    replay_finish     (Replay     *replay);
+static void    replay_preload    (Mapping       *map,
+                                  int           lock);
+
+static int     open_stream       (Prms const   *prms,
+                                  int          which);
+static void   *stream            (void          *arg);
+static int     send_fragment     (int              fd,
+                                  struct iovec   *iov,
+                                  int            niov,
+                                  uint32_t     nbytes,
+                                  uint32_t    segSize);
+static int     send_all          (int              fd,
+                                  struct iovec   *iov,
+                                  int            niov);
+
+static void    print_statistics_title    ();
+static void    print_statistics          (Stream const   *streams,
+                                          int            nstreams,
+                                          Statistics         *prv,
+                                          char                eol);
+
+static inline uint64_t get_w64   (uint8_t const *data);
+static inline uint64_t now_ns    ();
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- */
+/* Set by the SIGINT/SIGTERM handler to stop the replay                   */
+/* ---------------------------------------------------------------------- */
+static volatile sig_atomic_t Stop = 0;
+
+static void stop_handler (int signo)
+{
+   Stop = 1;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Replay the captured fragments
+
+  \param[in]  argc   Command line argument count
+  \param[in]  argv   Vector of command line parameters
+                                                                          */
+/* ---------------------------------------------------------------------- */
+int main (int argc, char *const argv[])
+{
+   static Replay Rpl;
+   static Stream Streams[MAX_K_STREAMS];
+
+   Prms prms;
+   getPrms (&prms, argc, argv);
+
+   struct sigaction sa;
+   memset (&sa, 0, sizeof (sa));
+   sa.sa_handler = stop_handler;
+   sigaction (SIGINT,  &sa, NULL);
+   sigaction (SIGTERM, &sa, NULL);
+   signal    (SIGPIPE, SIG_IGN);
+
+
+   // ---------------------------------------------
+   // Map, index and preload all the fragments
+   // ---------------------------------------------
+   Replay *replay = &Rpl;
+   if (replay_load (replay, &prms)) return -1;
+
+   printf ("Loaded %" PRIu32 " fragments, %" PRIu64 " bytes from %d files\n"
+           "Each pass advances the sequence by %" PRIu32
+           " and the timestamp by %" PRIu64 "\n",
+           replay->nfrags, replay->nbytes, replay->nmaps,
+           replay->seqSpan, replay->tsSpan);
+
+
+   // --------------------------------------------------
+   // Connect all the streams before any are started so
+   // that they begin together
+   // --------------------------------------------------
+   int idx;
+   for (idx = 0; idx < prms.nstreams; idx++)
+   {
+      Stream *s = &Streams[idx];
+      s->replay = replay;
+      s->which  = idx;
+      s->fd     = open_stream (&prms, idx);
+      if (s->fd < 0)
+      {
+         while (--idx >= 0) close (Streams[idx].fd);
+         replay_unload (replay);
+         return -1;
+      }
+   }
+
+   for (idx = 0; idx < prms.nstreams; idx++)
+   {
+      pthread_create (&Streams[idx].thread, NULL, stream, &Streams[idx]);
+   }
+
+
+   // --------------------------------------------------
+   // Report the aggregate rates once a second until all
+   // the streams are done
+   // --------------------------------------------------
+   Statistics prv;
+   memset (&prv, 0, sizeof (prv));
+
+   uint64_t beg   = now_ns ();
+   int      Eject = 60;
+   int      ndone = 0;
+
+   print_statistics_title ();
+   while (ndone < prms.nstreams)
+   {
+      sleep (1);
+
+      if (Stop)
+      {
+         // Unblock any stream waiting on a stalled receiver
+         for (idx = 0; idx < prms.nstreams; idx++)
+         {
+            shutdown (Streams[idx].fd, SHUT_RDWR);
+         }
+      }
+
+      char eol = '\r';
+      if (Eject-- == 0)
+      {
+         eol   = '\n';
+         Eject = 60;
+      }
+
+      print_statistics (Streams, prms.nstreams, &prv, eol);
+
+      for (ndone = 0, idx = 0; idx < prms.nstreams; idx++)
+      {
+         ndone += __atomic_load_n (&Streams[idx].done, __ATOMIC_ACQUIRE);
+      }
+   }
+
+
+   // -----------------------------
+   // Collect and report the totals
+   // -----------------------------
+   uint64_t   ended = beg;
+   int       status = 0;
+
+   putchar ('\n');
+   memset (&prv, 0, sizeof (prv));
+   for (idx = 0; idx < prms.nstreams; idx++)
+   {
+      Stream *s = &Streams[idx];
+      pthread_join (s->thread, NULL);
+      close        (s->fd);
+
+      if (s->status)
+      {
+         printf ("Stream %2d failed err = %d\n", idx, s->status);
+         status = -1;
+      }
+
+      prv.nfrags += s->stats.nfrags;
+      prv.nbytes += s->stats.nbytes;
+      prv.nlate  += s->stats.nlate;
+      if (s->ended > ended) ended = s->ended;
+   }
+
+   double secs = (ended - beg) * 1.e-9;
+   printf ("Sent %" PRIu64 " fragments, %" PRIu64 " bytes in %.3f secs"
+           " = %.1f frags/sec %.3f Gbps, %" PRIu64 " late\n",
+           prv.nfrags, prv.nbytes, secs,
+           prv.nfrags / secs, prv.nbytes * 8.e-9 / secs, prv.nlate);
+
+   replay_unload (replay);
+   return status;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Sends the set of fragments the requested number of times
+  \return NULL
+
+  \param[in] arg  The stream
+
+  \par
+   Each fragment has a deadline. For a fixed rate it is the start time
+   plus the fragment count over the rate; for recorded timing it is the
+   previous deadline plus the recorded gap. Keeping the deadlines
+   absolute means a stream that falls behind catches up rather than
+   drifting. A fragment sent more than a millisecond after its deadline
+   is counted as late.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static void *stream (void *arg)
+{
+   Stream             *s = (Stream *)arg;
+   Replay const  *replay = s->replay;
+   Prms const      *prms = replay->prms;
+   uint64_t         tick = 0;
+   uint64_t     deadline = now_ns ();
+   uint64_t        start = deadline;
+   uint32_t         loop;
+   int            status = 0;
+
+   double  nsPerFrag = prms->rate  > 0 ? 1.e9 / prms->rate : 0;
+   double  nsPerTick = prms->speed > 0 ? NSEC_PER_TICK / prms->speed : 0;
+
+
+   for (loop = 0; (prms->nloops == 0 || loop < prms->nloops) && !Stop; loop++)
+   {
+      uint32_t seqAdd = loop * replay->seqSpan;
+      uint64_t  tsAdd = loop * replay->tsSpan;
+      int       patch = (loop > 0 || prms->unique);
+
+      for (uint32_t idx = 0; idx < replay->nfrags && !Stop; idx++)
+      {
+         Fragment const *frag = replay->frags + idx;
+
+         // --------------------------------------
+         // Wait until this fragment is scheduled
+         // --------------------------------------
+         if (nsPerFrag)
+         {
+            deadline = start + (uint64_t)(tick * nsPerFrag);
+         }
+         else if (nsPerTick)
+         {
+            deadline += (uint64_t)(frag->gap * nsPerTick);
+         }
+
+         if (nsPerFrag || nsPerTick)
+         {
+            uint64_t now = now_ns ();
+            if (deadline > now)
+            {
+               struct timespec ts;
+               ts.tv_sec  = deadline / 1000000000;
+               ts.tv_nsec = deadline % 1000000000;
+               clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+            }
+            else if (now - deadline > 1000000)
+            {
+               s->stats.nlate += 1;
+            }
+         }
+
+
+         // ---------------------------------------------------------
+         // Either send straight from the mapping or patch a copy of
+         // the Header0, Identifier and timestamp words
+         // ---------------------------------------------------------
+         uint64_t     hdr[3];
+         struct iovec iov[2];
+         int         niov;
+
+         if (patch && frag->valid)
+         {
+            memcpy (hdr, frag->data, sizeof (hdr));
+
+            uint64_t id = (hdr[1] & 0xffffffff)
+                        | (uint64_t)(frag->sequence + seqAdd) << 32;
+
+            if (prms->unique)
+            {
+               uint64_t src0 = ((id >>  8) + s->which) & 0xfff;
+               uint64_t src1 = ((id >> 20) + s->which) & 0xfff;
+               id = (id & ~0xffffff00ULL) | (src0 << 8) | (src1 << 20);
+            }
+
+            hdr[1]          = id;
+            hdr[2]          = frag->timestamp + tsAdd;
+            iov[0].iov_base = hdr;
+            iov[0].iov_len  = sizeof (hdr);
+            iov[1].iov_base = (void *)(frag->data + sizeof (hdr));
+            iov[1].iov_len  = frag->nbytes        - sizeof (hdr);
+            niov            = 2;
+         }
+         else
+         {
+            iov[0].iov_base = (void *)frag->data;
+            iov[0].iov_len  = frag->nbytes;
+            niov            = 1;
+         }
+
+         status = send_fragment (s->fd, iov, niov, frag->nbytes,
+                                 prms->framePath ? prms->segSize : 0);
+         if (status) break;
+
+         s->stats.nfrags += 1;
+         s->stats.nbytes += frag->nbytes;
+         tick            += 1;
+      }
+
+      if (status) break;
+      s->stats.nloops += 1;
+   }
+
+
+   // A send interrupted by stopping is not a failure
+   s->status = Stop ? 0 : status;
+   s->ended  = now_ns ();
+   __atomic_store_n (&s->done, 1, __ATOMIC_RELEASE);
+
+   return NULL;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Sends one fragment
+  \retval == 0, success
+  \retval != 0, the errno of the failure
+
+  \param[in]      fd  The socket
+  \param[in]     iov  The pieces of the fragment
+  \param[in]    niov  The number of pieces
+  \param[in]  nbytes  The size of the fragment
+  \param[in] segSize  If 0, the socket is a stream and the fragment is
+                      sent as is, else the socket is framed and the
+                      fragment is sent as segments of at most this size
+
+  \par
+   A segment is a slice of the gathered pieces, so a segment may span
+   the patched header and the mapped data.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static int send_fragment (int              fd,
+                          struct iovec   *iov,
+                          int            niov,
+                          uint32_t     nbytes,
+                          uint32_t    segSize)
+{
+   if (segSize == 0) return send_all (fd, iov, niov);
+
+   int      cur = 0;
+   size_t   off = 0;
+
+   while (nbytes)
+   {
+      struct iovec  seg[2];
+      int          nseg = 0;
+      uint32_t     left = nbytes < segSize ? nbytes : segSize;
+
+      nbytes -= left;
+      while (left)
+      {
+         size_t  n = iov[cur].iov_len - off;
+         if (n > left) n = left;
+
+         seg[nseg].iov_base = (uint8_t *)iov[cur].iov_base + off;
+         seg[nseg].iov_len  = n;
+         nseg += 1;
+         left -= n;
+         off  += n;
+
+         if (off == iov[cur].iov_len)
+         {
+            cur += 1;
+            off  = 0;
+         }
+      }
+
+      struct msghdr msg;
+      memset (&msg, 0, sizeof (msg));
+      msg.msg_iov    = seg;
+      msg.msg_iovlen = nseg;
+
+      while (sendmsg (fd, &msg, MSG_NOSIGNAL) < 0)
+      {
+         if (errno != EINTR || Stop) return errno;
+      }
+   }
+
+   return 0;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Sends the pieces on a stream socket, retrying on short sends
+  \retval == 0, success
+  \retval != 0, the errno of the failure
+
+  \param[in]   fd  The socket
+  \param[in]  iov  The pieces, modified as they are sent
+  \param[in] niov  The number of pieces
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static int send_all (int fd, struct iovec *iov, int niov)
+{
+   while (niov)
+   {
+      struct msghdr msg;
+      memset (&msg, 0, sizeof (msg));
+      msg.msg_iov    = iov;
+      msg.msg_iovlen = niov;
+
+      ssize_t n = sendmsg (fd, &msg, MSG_NOSIGNAL);
+      if (n < 0)
+      {
+         if (errno == EINTR && !Stop) continue;
+         return errno;
+      }
+
+      while (niov && (size_t)n >= iov->iov_len)
+      {
+         n    -= iov->iov_len;
+         iov  += 1;
+         niov -= 1;
+      }
+
+      if (niov)
+      {
+         iov->iov_base  = (uint8_t *)iov->iov_base + n;
+         iov->iov_len  -= n;
+      }
+   }
+
+   return 0;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief   Connects one stream to the receiver
+  \return  The socket or -1 on failure
+
+  \param[in]  prms  The control parameters
+  \param[in] which  The stream number, selects the port
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static int open_stream (Prms const *prms, int which)
+{
+   int fd;
+
+   if (prms->framePath)
+   {
+      struct sockaddr_un adr;
+      memset (&adr, 0, sizeof (adr));
+      adr.sun_family = AF_UNIX;
+      strncpy (adr.sun_path, prms->framePath, sizeof (adr.sun_path) - 1);
+
+      fd = socket (AF_UNIX, SOCK_SEQPACKET, 0);
+
+      // Must hold at least one segment
+      int sndSize = prms->sndSize;
+      if (sndSize < (int)prms->segSize * 2) sndSize = prms->segSize * 2;
+      setsockopt (fd, SOL_SOCKET, SO_SNDBUF, &sndSize, sizeof (sndSize));
+
+      if (connect (fd, (struct sockaddr *)&adr, sizeof (adr)) < 0)
+      {
+         fprintf (stderr, "Stream %2d: failed to connect to %s err = %d\n",
+                  which, prms->framePath, errno);
+         close (fd);
+         return -1;
+      }
+
+      return fd;
+   }
+
+
+   int  port = prms->ports[which % prms->nports];
+   char service[16];
+   snprintf (service, sizeof (service), "%d", port);
+
+   struct addrinfo hints;
+   struct addrinfo *res;
+   memset (&hints, 0, sizeof (hints));
+   hints.ai_family   = AF_INET;
+   hints.ai_socktype = SOCK_STREAM;
+
+   int status = getaddrinfo (prms->host, service, &hints, &res);
+   if (status)
+   {
+      fprintf (stderr, "Stream %2d: can not resolve %s: %s\n",
+               which, prms->host, gai_strerror (status));
+      return -1;
+   }
+
+   fd = socket (res->ai_family, res->ai_socktype, res->ai_protocol);
+   if (prms->sndSize)
+   {
+      setsockopt (fd, SOL_SOCKET, SO_SNDBUF, &prms->sndSize, sizeof (int));
+   }
+   setsockopt (fd, SOL_TCP, TCP_NODELAY, &prms->nodelay, sizeof (int));
+
+   if (connect (fd, res->ai_addr, res->ai_addrlen) < 0)
+   {
+      fprintf (stderr, "Stream %2d: failed to connect to %s:%d err = %d\n",
+               which, prms->host, port, errno);
+      close (fd);
+      fd = -1;
+   }
+
+   freeaddrinfo (res);
+   return fd;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Maps, indexes and preloads all the input files
+  \retval == 0, success
+  \retval != 0, failure
+
+  \param[out] replay  The set of fragments
+  \param[in]    prms  The control parameters
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static int replay_load (Replay *replay, Prms const *prms)
+{
+   memset (replay, 0, sizeof (*replay));
+   replay->prms = prms;
+
+   for (int idx = 0; idx < prms->nfiles; idx++)
+   {
+      if (replay_map (replay, prms->files[idx]))
+      {
+         replay_unload (replay);
+         return -1;
+      }
+
+      replay_preload (&replay->maps[replay->nmaps - 1], prms->lock);
+   }
+
+   if (replay->nfrags == 0)
+   {
+      fprintf (stderr, "Error: no fragments were found\n");
+      replay_unload (replay);
+      return -1;
+   }
+
+   replay_finish (replay);
+   return 0;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Maps one file and adds its fragments to the set
+  \retval == 0, success
+  \retval != 0, failure
+
+  \param[in]  replay  The set of fragments
+  \param[in] filename The file to add
+
+  \par
+   A capture file is read through its index. The body of each record
+   is one fragment or, for a built event, several back to back, so the
+   record is split by the fragments' Header0 sizes. Anything else is
+   taken to be the raw output of tcp_receiver, fragments back to back.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static int replay_map (Replay *replay, char const *filename)
+{
+   if (replay->nmaps == MAX_K_FILES)
+   {
+      fprintf (stderr, "Error: more than %d files\n", MAX_K_FILES);
+      return -1;
+   }
+
+   Mapping *map = &replay->maps[replay->nmaps];
+   memset (map, 0, sizeof (*map));
+
+
+   // ----------------------------------------
+   // First try it as a capture file
+   // ----------------------------------------
+   if (captureReader_open (&map->reader, filename) == 0)
+   {
+      CaptureReader const *reader = &map->reader;
+
+      map->base    = reader->base;
+      map->nbytes  = reader->nbytes;
+      map->capture = 1;
+      replay->nmaps += 1;
+
+      for (uint32_t idx = 0; idx < reader->nentries; idx++)
+      {
+         uint32_t             nbytes;
+         uint8_t const *beg = captureReader_fragment (reader, idx, &nbytes);
+         replay_scan (replay, beg, beg + nbytes);
+      }
+
+      return 0;
+   }
+
+
+   // -----------------------------------
+   // Otherwise, map it as a raw file
+   // -----------------------------------
+   int fd = open (filename, O_RDONLY);
+   if (fd < 0)
+   {
+      fprintf (stderr, "Error opening %s err = %d\n", filename, errno);
+      return -1;
+   }
+
+   struct stat st;
+   if (fstat (fd, &st) < 0 || st.st_size == 0)
+   {
+      fprintf (stderr, "Error: %s is empty or can not be sized\n", filename);
+      close (fd);
+      return -1;
+   }
+
+   void *base = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+   close (fd);
+
+   if (base == MAP_FAILED)
+   {
+      fprintf (stderr, "Error mapping %s err = %d\n", filename, errno);
+      return -1;
+   }
+
+   map->base      = (uint8_t const *)base;
+   map->nbytes    = st.st_size;
+   replay->nmaps += 1;
+
+   replay_scan (replay, map->base, map->base + map->nbytes);
+   return 0;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Adds the fragments found back to back in a range of memory
+
+  \param[in] replay  The set of fragments
+  \param[in]    beg  The beginning of the range
+  \param[in]    end  The end       of the range
+
+  \par
+   A fragment's size, in 64-bit words, is in bits 8-31 of its Header0.
+   Scanning stops at the first header that is not plausible, since the
+   next fragment boundary can not then be found.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static void replay_scan (Replay *replay, uint8_t const *beg, uint8_t const *end)
+{
+   uint8_t const *cur = beg;
+
+   while (cur + sizeof (uint64_t) <= end)
+   {
+      uint64_t header = get_w64 (cur);
+      uint32_t nbytes = ((header >> 8) & 0xffffff) * sizeof (uint64_t);
+
+      if ((header >> 40) != CAPTURE_K_PATTERN
+         || nbytes < 3 * sizeof (uint64_t)
+         || cur + nbytes > end)
+      {
+         fprintf (stderr, "Stopped at offset %zu, header %16.16" PRIx64
+                          " is not that of a fragment\n",
+                  (size_t)(cur - beg), header);
+         return;
+      }
+
+      if (replay->nfrags == replay->allocated)
+      {
+         uint32_t   n = replay->allocated ? 2 * replay->allocated : 4096;
+         Fragment  *f = (Fragment *)realloc (replay->frags, n * sizeof (*f));
+         if (f == NULL)
+         {
+            fprintf (stderr, "Error: no memory for %" PRIu32 " fragments\n",
+                     n);
+            return;
+         }
+
+         replay->frags     = f;
+         replay->allocated = n;
+      }
+
+      Fragment *frag = replay->frags + replay->nfrags++;
+      frag->data   = cur;
+      frag->nbytes = nbytes;
+      frag->gap    = 0;
+      frag->valid  = capture_identify (cur, nbytes,
+                                       &frag->sequence,
+                                       &frag->timestamp) == 0;
+
+      replay->nbytes += nbytes;
+      cur            += nbytes;
+   }
+
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Computes the recorded gaps and the advance for each pass
+
+  \param[in] replay  The set of fragments
+
+  \par
+   The sequence advance is the span of sequence numbers. The timestamp
+   advance is the span of timestamps plus their average spacing, so
+   the first fragment of the next pass follows the last as it would
+   have. The gap of the first fragment is this spacing.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static void replay_finish (Replay *replay)
+{
+   uint32_t seqMin = UINT32_MAX, seqMax = 0;
+   uint64_t  tsMin = UINT64_MAX,  tsMax = 0;
+   uint64_t   prev = 0;
+
+   for (uint32_t idx = 0; idx < replay->nfrags; idx++)
+   {
+      Fragment *frag = replay->frags + idx;
+
+      if (!frag->valid)
+      {
+         // Unrecognized, send it with the one before
+         frag->timestamp = prev;
+         continue;
+      }
+
+      if (frag->sequence  < seqMin) seqMin = frag->sequence;
+      if (frag->sequence  > seqMax) seqMax = frag->sequence;
+      if (frag->timestamp <  tsMin)  tsMin = frag->timestamp;
+      if (frag->timestamp >  tsMax)  tsMax = frag->timestamp;
+
+      if (idx > 0 && prev && frag->timestamp > prev)
+      {
+         uint64_t gap = frag->timestamp - prev;
+         frag->gap    = gap > MAX_K_GAP ? MAX_K_GAP : gap;
+      }
+
+      prev = frag->timestamp;
+   }
+
+   if (seqMax < seqMin)
+   {
+      // Nothing was recognized, there is nothing to advance
+      return;
+   }
+
+   uint64_t spacing = seqMax > seqMin ? (tsMax - tsMin) / (seqMax - seqMin)
+                                      : 0;
+
+   replay->seqSpan  = seqMax - seqMin + 1;
+   replay->tsSpan   = tsMax  - tsMin  + spacing;
+   replay->frags[0].gap = spacing > MAX_K_GAP ? MAX_K_GAP : spacing;
+
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Brings all of a mapped file into memory
+
+  \param[in]  map  The mapped file
+  \param[in] lock  If != 0, also lock it there
+
+  \par
+   The kernel is asked to read the file ahead and then every page is
+   touched, so that nothing is faulted in while sending.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static void replay_preload (Mapping *map, int lock)
+{
+   long    pgsize = sysconf (_SC_PAGESIZE);
+   uint8_t    sum = 0;
+
+   madvise ((void *)map->base, map->nbytes, MADV_WILLNEED);
+
+   for (size_t off = 0; off < map->nbytes; off += pgsize)
+   {
+      sum += ((uint8_t const volatile *)map->base)[off];
+   }
+
+   if (lock && mlock (map->base, map->nbytes) < 0)
+   {
+      fprintf (stderr, "Warning: could not lock %zu bytes err = %d\n",
+               map->nbytes, errno);
+   }
+
+   (void)sum;
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Unmaps the files and frees the fragment list
+
+  \param[in] replay  The set of fragments
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static void replay_unload (Replay *replay)
+{
+   for (int idx = 0; idx < replay->nmaps; idx++)
+   {
+      Mapping *map = &replay->maps[idx];
+      if (map->capture) captureReader_close (&map->reader);
+      else              munmap ((void *)map->base, map->nbytes);
+   }
+
+   free (replay->frags);
+   replay->frags  = NULL;
+   replay->nmaps  = 0;
+   replay->nfrags = 0;
+
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief Puts of the statistics/status title line
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static void print_statistics_title ()
+{
+   puts ("Streams   Rate        bps    Late Passes    NFrags         NBytes\n"
+         "------- ------ ---------- ------- ------ --------- --------------");
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief Prints the aggregate statistics since the last call
+
+  \param[in]  streams  The streams
+  \param[in] nstreams  The number of streams
+  \param[in]      prv  The totals at the previous call, used to form the
+                       rates; updated to the current totals
+  \param[in]      eol  Either a '\n' or '\r'
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static void print_statistics (Stream const *streams,
+                              int          nstreams,
+                              Statistics       *prv,
+                              char              eol)
+{
+   Statistics cur;
+   int      nbusy = 0;
+   uint32_t loops = UINT32_MAX;
+
+   memset (&cur, 0, sizeof (cur));
+   for (int idx = 0; idx < nstreams; idx++)
+   {
+      Statistics const *s = &streams[idx].stats;
+      cur.nfrags += s->nfrags;
+      cur.nbytes += s->nbytes;
+      cur.nlate  += s->nlate;
+      if (s->nloops < loops) loops = s->nloops;
+      nbusy      += !streams[idx].done;
+   }
+
+   printf (" %6d %6" PRIu64 " %10" PRIu64 " %7" PRIu64 " %6" PRIu32
+           " %9" PRIu64 " %14" PRIu64 "%c",
+           nbusy,
+           cur.nfrags - prv->nfrags,
+           (cur.nbytes - prv->nbytes) * 8,
+           cur.nlate,
+           loops,
+           cur.nfrags,
+           cur.nbytes,
+           eol);
+   fflush (stdout);
+
+  *prv = cur;
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Retrieve or set defaults for the governing parameters
+
+  \par
+   The input files follow the options. -p takes a comma separated list
+   of ports, the streams are assigned to them round robin.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static void getPrms (Prms *prms, int argc, char *const argv[])
+{
+    int c;
+    char const *host       =    "127.0.0.1";
+    char const *ports      =         "8991";
+    char const *framePath  =           NULL;
+    uint32_t    segSize    =       8 * 1024;
+    int         sndSize    =              0;
+    int         nodelay    =              0;
+    int         nstreams   =              1;
+    double      rate       =              0;
+    double      speed      =              0;
+    uint32_t    nloops     =              1;
+    char        unique     =              0;
+    char        lock       =              0;
+
+
+    while ( (c = getopt (argc, argv, "H:Lp:U:z:w:N:n:r:T:l:u")) != EOF)
+    {
+       if       (c == 'H') host       = optarg;
+       else if  (c == 'L') lock       = 1;
+       else if  (c == 'p') ports      = optarg;
+       else if  (c == 'U') framePath  = optarg;
+       else if  (c == 'z') segSize    = strtoul (optarg, NULL, 0);
+       else if  (c == 'w') sndSize    = strtoul (optarg, NULL, 0);
+       else if  (c == 'N') nodelay    = strtoul (optarg, NULL, 0);
+       else if  (c == 'n') nstreams   = strtoul (optarg, NULL, 0);
+       else if  (c == 'r') rate       = strtod  (optarg, NULL);
+       else if  (c == 'T') speed      = strtod  (optarg, NULL);
+       else if  (c == 'l') nloops     = strtoul (optarg, NULL, 0);
+       else if  (c == 'u') unique     = 1;
+       else
+       {
+          reportUsage ();
+          exit (-1);
+       }
+    }
+
+    if (optind >= argc)
+    {
+       fprintf (stderr, "Error: No input files were specified\n\n");
+       reportUsage ();
+       exit (-1);
+    }
+
+
+    // -----------------------------
+    // Parse the list of ports
+    // -----------------------------
+    prms->nports = 0;
+    while (*ports && prms->nports < MAX_K_PORTS)
+    {
+       char *end;
+       int  port = strtoul (ports, &end, 0);
+       if (end == ports) break;
+
+       prms->ports[prms->nports++] = port;
+       ports = (*end == ',') ? end + 1 : end;
+    }
+
+    if (prms->nports == 0)
+    {
+       prms->ports[0] = 8991;
+       prms->nports   = 1;
+    }
+
+    if (nstreams < 1)              nstreams = 1;
+    if (nstreams > MAX_K_STREAMS)  nstreams = MAX_K_STREAMS;
+    if (segSize  < 64)             segSize  = 64;
+
+    prms->host       = host;
+    prms->framePath  = framePath;
+    prms->segSize    = segSize;
+    prms->sndSize    = sndSize;
+    prms->nodelay    = nodelay != 0;
+    prms->nstreams   = nstreams;
+    prms->rate       = rate;
+    prms->speed      = rate > 0 ? 0 : speed;
+    prms->nloops     = nloops;
+    prms->unique     = unique;
+    prms->lock       = lock;
+    prms->nfiles     = argc - optind;
+    prms->files      = (char const *const *)argv + optind;
+
+    return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief Report the command line usage
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static void reportUsage ()
+{
+   printf (
+"Usage:\n"
+"$ dpm_replay [H:Lp:U:z:w:N:n:r:T:l:u] file [file ...]\n"
+"  where:\n"
+"      H:  The receiving host, default = 127.0.0.1\n"
+"      p:  Comma separated list of ports, default = 8991\n"
+"      U:  Send to this AF_UNIX SOCK_SEQPACKET socket, the RSSI stand-in,\n"
+"          instead of over TCP\n"
+"      z:  Maximum size of one segment on the stand-in, default = 8192\n"
+"      w:  Size of the socket send buffer, default = system\n"
+"      N:  Value of TCP_NODELAY, default = 0\n"
+"      n:  Number of parallel streams, default = 1\n"
+"      r:  Fragments per second per stream, default = as fast as possible\n"
+"      T:  Replay at the recorded timing, sped up by this factor\n"
+"      l:  Number of passes over the files, 0 = until stopped, default = 1\n"
+"      u:  Give each stream its own Src0/Src1 source identifiers\n"
+"      L:  Lock the files in memory\n"
+"\n"
+"  The files are indexed capture files or raw tcp_receiver output.\n"
+"\n"
+" Example, 4 RCEs at 200 Hz each, forever:\n"
+" $ dpm_replay -n 4 -u -r 200 -l 0 /tmp/run.dat\n");
+
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Extracts one 64-bit word from the \a data stream
+  \return The extracted 64-bit word
+
+  \param[in] data  The data stream
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline uint64_t get_w64 (uint8_t const *data)
+{
+   uint64_t w;
+   memcpy (&w, data, sizeof (w));
+   return w;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Returns the monotonic time
+  \return The monotonic time in nanoseconds
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline uint64_t now_ns ()
+{
+   struct timespec ts;
+   clock_gettime (CLOCK_MONOTONIC, &ts);
+   return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+/* ---------------------------------------------------------------------- */
@@ -0,0 +1,456 @@
+// -*-Mode: C;-*-
+
+/* ---------------------------------------------------------------------- *//*!
+ *
+ *  @file     dqm_monitor.c
+ *  @brief    Displays the channel snapshots sent by the receivers' monitor
+ *  @verbatim
+ *                               Copyright 2018
+ *                                    by
+ *
+ *                       The Board of Trustees of the
+ *                    Leland Stanford Junior University.
+ *                           All rights reserved.
+ *
+ *  @endverbatim
+ *
+ *  @par Facility:
+ *  pdd
+ *
+ *  @author
+ *  <russell@slac.stanford.edu>
+ *
+ *  @par Date created:
+ *  <2018/08/27>
+ *
+ * @par Credits:
+ * SLAC
+ *
+ *  @par
+ *  Listens on a UDP port for the snapshots sent by tcp_multi_receiver -d,
+ *  (see Dqm.h), keeps the latest one from each source and every -t
+ *  seconds prints one line per source: its pedestal, median RMS and the
+ *  number of dead, noisy and stuck channels together with the mean
+ *  noise power in each frequency band. With -v the flagged channels
+ *  are also listed.
+ *
+ *  A channel is dead if its RMS is below -D, noisy if it is above -N and
+ *  stuck if the fraction of its samples with a stuck code is above -s.
+ *
+\* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *\
+
+   HISTORY
+   -------
+
+   DATE       WHO WHAT
+   ---------- --- ---------------------------------------------------------
+   2018.08.27 jjr Created
+
+\* ---------------------------------------------------------------------- */
+
+#define _GNU_SOURCE
+
+#include "Dqm.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <inttypes.h>
+#include <getopt.h>
+#include <errno.h>
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \struct _Prms
+  \brief   The configuration parameters
+                                                                          *//*!
+  \typedef Prms
+  \brief   Typedef for struct _Prms
+                                                                          */
+/* ---------------------------------------------------------------------- */
+struct _Prms
+{
+   int               port;  /*!< The UDP port to listen on                */
+   int             period;  /*!< Seconds between reports                  */
+   int           nreports;  /*!< Reports before exiting, 0 = never        */
+   double            dead;  /*!< RMS below which a channel is dead        */
+   double           noisy;  /*!< RMS above which a channel is noisy       */
+   double           stuck;  /*!< Stuck fraction above which it is stuck   */
+   int            verbose;  /*!< List the flagged channels                */
+};
+/* ---------------------------------------------------------------------- */
+typedef struct _Prms Prms;
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \struct _Snapshot
+  \brief   The latest snapshot of one source
+                                                                          *//*!
+  \typedef Snapshot
+  \brief   Typedef for struct _Snapshot
+                                                                          */
+/* ---------------------------------------------------------------------- */
+struct _Snapshot
+{
+   DqmRecord                    record;  /*!< Its header                  */
+   DqmChannel channels[DQM_K_NCHANNELS]; /*!< Its channels                */
+};
+/* ---------------------------------------------------------------------- */
+typedef struct _Snapshot Snapshot;
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- */
+/* LOCAL PROTOTYPES                                                       */
+/* ---------------------------------------------------------------------- */
+static void getPrms       (Prms                 *prms,
+                           int                   argc,
+                           char *const         argv[]);
+
+static void reportUsage   ();
+
+static int  open_socket   (int                   port);
+
+static void print_report  (Snapshot * const      *snaps,
+                           Prms const            *prms);
+
+static void print_source  (Snapshot const         *snap,
+                           Prms const             *prms);
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- */
+/* Set by the SIGINT/SIGTERM handler to stop the monitor                  */
+/* ---------------------------------------------------------------------- */
+static volatile sig_atomic_t Stop = 0;
+
+static void stop_handler (int signo)
+{
+   Stop = 1;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Displays the channel snapshots
+
+  \param[in]  argc   Command line argument count
+  \param[in]  argv   Vector of command line parameters
+                                                                          */
+/* ---------------------------------------------------------------------- */
+int main (int argc, char *const argv[])
+{
+   static Snapshot *Snaps[DQM_K_NCSF];
+
+   Prms prms;
+   getPrms (&prms, argc, argv);
+
+   struct sigaction sa;
+   memset (&sa, 0, sizeof (sa));
+   sa.sa_handler = stop_handler;
+   sigaction (SIGINT,  &sa, NULL);
+   sigaction (SIGTERM, &sa, NULL);
+
+   int fd = open_socket (prms.port);
+   if (fd < 0) return -1;
+
+   printf ("Listening for snapshots on port %d\n", prms.port);
+
+   time_t   last = time (NULL);
+   int  nreports = 0;
+   uint64_t nbad = 0;
+
+   while (!Stop)
+   {
+      struct pollfd pfd = { fd, POLLIN, 0 };
+      if (poll (&pfd, 1, 250) > 0)
+      {
+         Snapshot msg;
+         ssize_t nread = recv (fd, &msg, sizeof (msg), 0);
+
+         // ---------------------------------------------------
+         // Keep only what is recognizably a complete snapshot
+         // ---------------------------------------------------
+         if (nread != sizeof (msg)
+           || msg.record.magic   != DQM_K_MAGIC
+           || msg.record.version != DQM_K_VERSION
+           || msg.record.nchans  != DQM_K_NCHANNELS
+           || msg.record.nbands  != DQM_K_NBANDS
+           || msg.record.csf     >= DQM_K_NCSF)
+         {
+            if (nread >= 0) nbad += 1;
+            continue;
+         }
+
+         Snapshot **snap = &Snaps[msg.record.csf];
+         if (*snap == NULL) *snap = (Snapshot *)malloc (sizeof (**snap));
+         if (*snap) **snap = msg;
+      }
+
+      time_t now = time (NULL);
+      if (now - last >= prms.period)
+      {
+         print_report (Snaps, &prms);
+         if (nbad) printf ("Ignored %" PRIu64 " unrecognized datagrams\n",
+                           nbad);
+         last = now;
+         if (prms.nreports && ++nreports >= prms.nreports) break;
+      }
+   }
+
+   close (fd);
+   return 0;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Opens the UDP socket the snapshots are received on
+  \return The socket, < 0 on failure
+
+  \param[in] port  The port
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static int open_socket (int port)
+{
+   int fd = socket (AF_INET, SOCK_DGRAM, 0);
+   if (fd < 0)
+   {
+      fprintf (stderr, "Failed to create the socket err = %d\n", errno);
+      return -1;
+   }
+
+   // A full snapshot of every source arrives as one burst
+   int rcvSize = 8 * 1024 * 1024;
+   setsockopt (fd, SOL_SOCKET, SO_RCVBUF, &rcvSize, sizeof (rcvSize));
+
+   struct sockaddr_in addr;
+   memset (&addr, 0, sizeof (addr));
+   addr.sin_family      = AF_INET;
+   addr.sin_addr.s_addr = htonl (INADDR_ANY);
+   addr.sin_port        = htons (port);
+
+   if (bind (fd, (struct sockaddr *)&addr, sizeof (addr)) < 0)
+   {
+      fprintf (stderr, "Failed to bind to port %d err = %d\n", port, errno);
+      close (fd);
+      return -1;
+   }
+
+   return fd;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- */
+static int compare_u16 (void const *a, void const *b)
+{
+   return (int)*(uint16_t const *)a - (int)*(uint16_t const *)b;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Prints the latest snapshot of every source
+
+  \param[in] snaps  The snapshots, indexed by Crate.Slot.Fiber
+  \param[in]  prms  The control parameters
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static void print_report (Snapshot * const *snaps, Prms const *prms)
+{
+   printf ("\n"
+" Csf  Snap  Pkts Errs   Samples Pedestal    Rms Dead Noisy Stuck"
+"  Band power, dB\n"
+" --- ----- ----- ---- --------- -------- ------ ---- ----- -----"
+"  -----------------------------------------------\n");
+
+   for (int csf = 0; csf < DQM_K_NCSF; csf++)
+   {
+      if (snaps[csf]) print_source (snaps[csf], prms);
+   }
+
+   fflush (stdout);
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Prints the summary line of one source and, if verbose, its
+          flagged channels
+
+  \param[in] snap  The source's snapshot
+  \param[in] prms  The control parameters
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static void print_source (Snapshot const *snap, Prms const *prms)
+{
+   DqmRecord  const *rec = &snap->record;
+   DqmChannel const *chn =  snap->channels;
+   uint16_t   rms[DQM_K_NCHANNELS];
+   double     bands[DQM_K_NBANDS];
+   double  pedestal = 0;
+   int        ndead = 0;
+   int       nnoisy = 0;
+   int       nstuck = 0;
+
+   memset (bands, 0, sizeof (bands));
+
+   for (int ichan = 0; ichan < DQM_K_NCHANNELS; ichan++)
+   {
+      double r = chn[ichan].rms / 256.;
+      pedestal   += chn[ichan].pedestal / 16.;
+      rms[ichan]  = chn[ichan].rms;
+      ndead      += r <  prms->dead;
+      nnoisy     += r >  prms->noisy;
+      nstuck     += chn[ichan].stuck / 65535. > prms->stuck;
+
+      for (int iband = 0; iband < DQM_K_NBANDS; iband++)
+      {
+         bands[iband] += chn[ichan].bands[iband] / 100.;
+      }
+   }
+
+   qsort (rms, DQM_K_NCHANNELS, sizeof (rms[0]), compare_u16);
+
+   printf (" %3.3" PRIx16 " %5" PRIu32 " %5" PRIu32 " %4" PRIu32
+           " %9" PRIu64 " %8.2f %6.2f %4d %5d %5d ",
+           rec->csf, rec->sequence, rec->npackets, rec->nerrors,
+           rec->nsamples,
+           pedestal / DQM_K_NCHANNELS,
+           rms[DQM_K_NCHANNELS / 2] / 256.,
+           ndead, nnoisy, nstuck);
+
+   for (int iband = 0; iband < DQM_K_NBANDS; iband++)
+   {
+      if (rec->nffts) printf (" %5.1f", bands[iband] / DQM_K_NCHANNELS);
+      else            printf ("    --");
+   }
+   putchar ('\n');
+
+
+   if (!prms->verbose || rec->nsamples == 0) return;
+
+   for (int ichan = 0; ichan < DQM_K_NCHANNELS; ichan++)
+   {
+      double     r = chn[ichan].rms   / 256.;
+      double     s = chn[ichan].stuck / 65535.;
+      char const *why = r < prms->dead   ? "dead"
+                      : r > prms->noisy  ? "noisy"
+                      : s > prms->stuck  ? "stuck"
+                      : NULL;
+      if (why)
+      {
+         printf ("      %3.3" PRIx16 ".%-3d %-5s pedestal %8.2f rms %6.2f"
+                 " stuck %5.3f\n",
+                 rec->csf, ichan, why, chn[ichan].pedestal / 16., r, s);
+      }
+   }
+
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Extract the command line parameters
+
+  \param[out] prms  The extracted parameters
+  \param[in]  argc  The count of command line parameters
+  \param[in]  argv  The vector of command line parameters
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static void getPrms (Prms *prms, int argc, char *const argv[])
+{
+    int c;
+    int         port     = 8990;
+    int         period   =    1;
+    int         nreports =    0;
+    double      dead     =  0.5;
+    double      noisy    = 20.0;
+    double      stuck    =  0.1;
+    int         verbose  =    0;
+
+    while ( (c = getopt (argc, argv, "p:t:n:D:N:s:vh")) != EOF)
+    {
+       if       (c == 'p') port     = strtoul (optarg, NULL, 0);
+       else if  (c == 't') period   = strtoul (optarg, NULL, 0);
+       else if  (c == 'n') nreports = strtoul (optarg, NULL, 0);
+       else if  (c == 'D') dead     = strtod  (optarg, NULL);
+       else if  (c == 'N') noisy    = strtod  (optarg, NULL);
+       else if  (c == 's') stuck    = strtod  (optarg, NULL);
+       else if  (c == 'v') verbose  = 1;
+       else
+       {
+          reportUsage ();
+          exit (c == 'h' ? 0 : -1);
+       }
+    }
+
+    prms->port     = port;
+    prms->period   = period > 0 ? period : 1;
+    prms->nreports = nreports;
+    prms->dead     = dead;
+    prms->noisy    = noisy;
+    prms->stuck    = stuck;
+    prms->verbose  = verbose;
+
+    return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- */
+static void reportUsage ()
+{
+   printf (
+"Usage:\n"
+"$ dqm_monitor [p:t:n:D:N:s:v]\n"
+"  where:\n"
+"      p:  The UDP port to listen on, default = 8990\n"
+"      t:  Seconds between reports, default = 1\n"
+"      n:  Number of reports before exiting, 0 = never, default = 0\n"
+"      D:  RMS, in ADC counts, below which a channel is dead,"
+" default = 0.5\n"
+"      N:  RMS, in ADC counts, above which a channel is noisy,"
+" default = 20\n"
+"      s:  Fraction of stuck codes above which a channel is stuck,"
+" default = 0.1\n"
+"      v:  List the flagged channels\n"
+"\n"
+" Example, with the receiver sending a snapshot every 2 seconds:\n"
+" $ tcp_multi_receiver -p 8991,8990 -d daq01:8990 -c 2000\n"
+" $ dqm_monitor -p 8990 -t 2 -v\n");
+
+   return;
+}
+/* ---------------------------------------------------------------------- */
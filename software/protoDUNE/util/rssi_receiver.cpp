@@ -37,6 +37,13 @@
   
    DATE       WHO WHAT
    ---------- --- ---------------------------------------------------------
+   2018.08.21 jjr acceptFrame no longer allocates. Single buffer frames
+                  are used in place, others are gathered into a reusable
+                  arena, and the output file is written from its own
+                  thread through large page aligned staging buffers
+                  (FrameWriter.h).
+   2018.07.23 jjr Added the -i option to write the output file in the
+                  indexed capture format (CaptureFile.h)
    2018.06.05 jjr Added documentation/history header.
                   Modified the copying/accessing of the data in acceptFrame
                   to use a faster access.  This allowed the rate to go to
@@ -48,6 +55,8 @@
 #include <cinttypes>
 
 #include "TpcPrinter.h"
+#include "CaptureFile.h"
+#include "FrameWriter.h"
 
 #include <rogue/protocols/udp/Core.h>
 #include <rogue/protocols/udp/Client.h>
@@ -90,6 +99,7 @@ public:
    int          getNedump       () const { return       m_nedump; }
    int          getDisplay      () const { return      m_display; }
    char const  *getOfilename    () const { return    m_ofilename; }
+   bool         getIndexFlag    () const { return        m_index; }
    int32_t      getLoggingLevel () const { return m_loggingLevel; }
    char const  *getLoggingName  () const { return  m_loggingName; }
    int          getRefresh      () const { return      m_refresh; }
@@ -110,6 +120,7 @@ public:
    int             m_display;
    bool               m_copy;
    bool              m_quiet;
+   bool              m_index;
    int32_t    m_loggingLevel;
    char const *m_loggingName;
 };
@@ -138,7 +149,8 @@ public:
              int             nedump = 0,
              int           ndisplay = 0,
              bool      copyFlag = false, 
-             int          outputFd = -1);
+             int          outputFd = -1,
+             CaptureWriter *capture = NULL);
 
 
 public:
@@ -183,7 +195,8 @@ public:
    int                m_display;  /*!< Current value of display countdown */
    int           m_displayCount;  /*!< Refresh display countdown value    */
    bool                  m_copy;  /*!< Copy flag, set true, if fd >= 0    */
-   int                     m_fd;  /*!< Output file descriptor             */
+   FrameArena           m_arena;  /*!< Gathers multi-buffer frames        */
+   FrameWriter        *m_writer;  /*!< If non-NULL, writes the output     */
 };
 /* ---------------------------------------------------------------------- */
 
@@ -254,7 +267,29 @@ int main (int argc, char **argv)
    bool            copyFlag = prms.getCopyFlag ();
    char const    *ofilename = prms.getOfilename();
    int32_t     loggingLevel = prms.getLoggingLevel ();
-   int                   fd = ofilename ? create_file (ofilename) : -1;
+   bool           indexFlag = prms.getIndexFlag ();
+   int                   fd = -1;
+   CaptureWriter    capture;
+   CaptureWriter  *pCapture = NULL;
+
+   if (ofilename)
+   {
+      if (indexFlag)
+      {
+         int status = captureWriter_open (&capture, ofilename, 0, 0);
+         if (status)
+         {
+            fprintf (stderr, "Error opening output file: %s err = %d\n",
+                     ofilename, status);
+            exit (-1);
+         }
+         pCapture = &capture;
+      }
+      else
+      {
+         fd = create_file (ofilename);
+      }
+   }
 
   
    if (loggingLevel > 0)
@@ -273,7 +308,8 @@ int main (int argc, char **argv)
                                                   nedump,
                                                   ndisplay,
                                                   copyFlag, 
-                                                  fd);
+                                                  fd,
+                                                  pCapture);
    connection.connect (receiver);
 
 
@@ -290,6 +326,13 @@ int main (int argc, char **argv)
       print_statistics (&stats, &prv, connection.m_rssi->getOpen (), '\n');
 
 
+      // Once the data stops, push out whatever is still staged
+      if (receiver->m_writer && stats.m_rxBytes == prv.m_rxBytes)
+      {
+         receiver->m_writer->flush ();
+      }
+
+
       // Hold on to the previous copy
       prv = stats;
 
@@ -324,12 +367,13 @@ Parameters::Parameters (int argc, char *const argv[]) :
    m_display         (0),
    m_copy        (false),
    m_quiet       (false),
+   m_index       (false),
    m_loggingLevel   (-1),
    m_loggingName ("-- None --")
 {
    int c;
 
-   while ( (c = getopt (argc, argv, "cd:e:n:o:l:s:q")) != EOF)
+   while ( (c = getopt (argc, argv, "cd:e:in:o:l:s:q")) != EOF)
    {
       if      (c == 's') { m_nsdump       = strtol (optarg, NULL, 0);         }
       else if (c == 'd') { m_display      = strtol (optarg, NULL, 0);         }
@@ -341,6 +385,7 @@ Parameters::Parameters (int argc, char *const argv[]) :
                                                              &m_loggingName); }
       else if (c == 'r') { m_refresh      = strtol (optarg, NULL, 0);         }
       else if (c == 'q') { m_quiet        = true;                             }
+      else if (c == 'i') { m_index        = true;                             }
    }
 
 
@@ -429,6 +474,7 @@ void Parameters::echo () const
    << "  Logging level       : "  << m_loggingName           << std::endl
    << "  Output file name    : "  << (m_ofilename ? m_ofilename : "-- None --") 
    << std::endl
+   << "  Output file indexed : "  << (m_index ? "Yes" : "No") << std::endl
    << std::endl;
 
 
@@ -449,15 +495,17 @@ void Parameters::reportUsage ()
    using namespace std;
    cout 
 << "Usage:" << endl
-<< "$ rssi_receiver [cd:e:ln:os:r:] ip" << endl
+<< "$ rssi_receiver [cd:e:iln:os:r:] ip" << endl
 << "  where:" << std::endl
-<< "      c:  If present, the frame data is copied into a temporary buffer"   << endl
+<< "      c:  If present, the frame data is accessed, gathering it into a"    << endl
+<< "          reusable buffer if it arrives in pieces"                         << endl
 << "      d:  Display every nth event, default = 0, do not display"           << endl
 << "      e:  Number of 64-bit words to dump for erroring frames"             << endl
 << "      s:  Number of 64-bit words to dump for non-erroring frames"         << endl
 << "      n:  The number of incoming frames to buffer, default = 64"          << endl
 << "      l:  The logging level, one of Critical, Error, Warning Info, Debug" << endl
 << "      o:  If present, then name of an output file"                        << endl
+<< "      i:  Write the output file in the indexed capture format"            << endl
 << "      r:  The display refresh rate in seconds (default = second)"         << endl
 << "     ip:  The ip address of data source"                                  << endl
 <<                endl
@@ -538,6 +586,8 @@ static int create_file (char const *filename)
   \param[in]   ndisplay  Display every nth frame (0 = never)
   \param[in]   copyFlag  Flags indicating whether to copy the data or not
   \param[in]   outputFd  If >= 0, a file descriptor to write the output to
+  \param[in]    capture  If non-NULL, write the output as an indexed
+                         capture file. This supersedes \a outputFd
                                                                           */
 /* ---------------------------------------------------------------------- */
 inline Receiver::Receiver (RssiConnection *connection, 
@@ -545,7 +595,8 @@ inline Receiver::Receiver (RssiConnection *connection,
                            int                 nedump,
                            int               ndisplay,
                            bool              copyFlag,
-                           int               outputFd) :
+                           int               outputFd,
+                           CaptureWriter     *capture) :
    m_connection (connection),
    m_stats                (),
    m_nsdump         (nsdump),
@@ -553,8 +604,13 @@ inline Receiver::Receiver (RssiConnection *connection,
    m_display      (ndisplay),
    m_displayCount (ndisplay),
    m_copy         (copyFlag),
-   m_fd           (outputFd)
+   m_writer           (NULL)
 {
+   if (outputFd >= 0 || capture)
+   {
+      m_writer = new FrameWriter (outputFd, capture);
+   }
+
    return;
 }
 /* ---------------------------------------------------------------------- */
@@ -594,32 +650,14 @@ void Receiver::
 
    m_display -= 1;
 
-   // Copy to buffer
-   if (m_copy || m_nsdump || m_nedump || m_fd >= 0 || m_display == 0)
+   // Look at the data
+   if (m_copy || m_nsdump || m_nedump || m_writer || m_display == 0)
    {
-      ///std::cout << "Copying nbytes: " << nbytes << std::endl;
-
-
-      // Iterator to start of buffer
-      rogue::interfaces::stream::Frame::iterator iter = frame->beginRead();
-      rogue::interfaces::stream::Frame::iterator  end = frame->endRead();
-
-
-      uint8_t *buff = (uint8_t *)malloc (nbytes);
-      uint8_t  *dst = buff;
-
-
-      //Iterate through contigous buffers
-      while ( iter != end ) {
-         rogue::interfaces::stream::Frame::iterator nxt = iter.endBuffer();
-         auto size = iter.remBuffer ();
-         auto *src = iter.ptr       ();
-         memcpy(dst, src, size);
-         dst += size;
-         iter = nxt;
-      }
-
-
+      // ----------------------------------------------------------
+      // In place if the frame is a single buffer, otherwise it is
+      // gathered into the arena. Either way, nothing is allocated.
+      // ----------------------------------------------------------
+      uint8_t  const   *buff = frame_data (frame, nbytes, m_arena);
       uint64_t const *header = (uint64_t const *)buff;
       uint64_t const      *d = (uint64_t const *)buff;
       uint64_t const   *data = header + 1;
@@ -643,14 +681,12 @@ void Receiver::
             dump (d, m_nsdump);
          }
 
-         if (m_fd >= 0)
+         // -------------------------------------------------
+         // Only staged here, the writer thread does the I/O
+         // -------------------------------------------------
+         if (m_writer)
          {
-            ssize_t nwrote = write (m_fd, buff, nbytes);
-            if (nwrote != nbytes)
-            {
-               fprintf (stderr, "Error %d writing the output file\n", errno);
-               exit (errno);
-            }
+            m_writer->write (buff, nbytes);
          }
 
          if (m_display == 0)
@@ -661,8 +697,6 @@ void Receiver::
             print_record (data, ndata);
          }
       }
-
-      free(buff);
    }
 
    return;
@@ -38,6 +38,9 @@
   
    DATE       WHO WHAT
    ---------- --- ---------------------------------------------------------
+   2018.08.21 jjr Removed the per frame malloc/copy. Frames are used in
+                  place, or gathered into a reusable arena if in pieces,
+                  and written from a separate thread (FrameWriter.h)
    2018.06.05 jjr Added documentation/history header.
                   Modified the copying/accessing of the data in acceptFrame
                   to use a faster access.  This allowed the rate to go to
@@ -47,6 +50,8 @@
 
 #include <cinttypes>
 
+#include "FrameWriter.h"
+
 #include <rogue/protocols/udp/Core.h>
 #include <rogue/protocols/udp/Client.h>
 #include <rogue/protocols/rssi/Client.h>
@@ -206,7 +211,8 @@ void Parameters::reportUsage ()
 << "     ip:  The ip address of data source"                                << endl
 << "      a:  Number of hex words to dump (debugging aid)"                  << endl
 << "      n:  The number of incoming frames to buffer, default = 64"        << endl
-<< "      c:  If present, the frame data is copied into a temporary buffer" << endl
+<< "      c:  If present, the frame data is accessed, gathering it into a"  << endl
+<< "          reusable buffer if it arrives in pieces"                       << endl
 << "      o:  If present, then name of an output file"                      << endl
 << "      r:  The display refresh rate in seconds (default = 1 second)"     << endl
 << endl
@@ -263,12 +269,13 @@ class TestSink : public rogue::interfaces::stream::Slave {
 
 
    public:
-      uint32_t rxCount;
-      uint64_t rxBytes;
-      uint32_t  rxLast;
-      int        ndump;
-      bool        copy;
-      int           fd;
+      uint32_t    rxCount;
+      uint64_t    rxBytes;
+      uint32_t     rxLast;
+      int           ndump;
+      bool           copy;
+      FrameArena    arena;
+      FrameWriter *writer;
 
    TestSink(bool copyFlag = false, int ndump = 0, int outputFd = -1) {
          rxCount = 0;
@@ -276,7 +283,7 @@ class TestSink : public rogue::interfaces::stream::Slave {
          rxLast  = 0;
          ndump   = 0;
          copy    = copyFlag;
-         fd      = outputFd;
+         writer  = outputFd >= 0 ? new FrameWriter (outputFd, NULL) : NULL;
    }
 
    void acceptFrame ( boost::shared_ptr<rogue::interfaces::stream::Frame> frame ) {
@@ -293,39 +300,15 @@ class TestSink : public rogue::interfaces::stream::Slave {
       //std::cout << "Got:" << rxLast << " bytes" << std::endl;
 
       
-      // Copy to buffer
+      // Access the data, in place unless it arrived in pieces
       if (copy)
       {
-         // std::cout << "Copying nbytes: " << rxLast << std::endl;
-
-         // iterator to start of buffer
-         rogue::interfaces::stream::Frame::iterator iter = frame->beginRead();
-         rogue::interfaces::stream::Frame::iterator  end = frame->endRead  ();
-
-
-         uint8_t  *buff = (uint8_t *)malloc(frame->getPayload());
-         uint8_t   *dst = buff;
-
+         uint8_t const *buff = frame_data (frame, rxLast, arena);
 
-         //Iterate through contigous buffers
-         while ( iter != end ) {
-            rogue::interfaces::stream::Frame::iterator nxt = iter.endBuffer();
-            auto size = iter.remBuffer ();
-            auto *src = iter.ptr       ();
-            memcpy(dst, src, size);
-            dst += size;
-            iter = nxt;
-         }
-
-
-         if (fd >= 0)
+         // Staged for the writer thread
+         if (writer)
          {
-            ssize_t nwrote = write (fd, buff, rxLast);
-            if (nwrote != rxLast)
-            {
-               fprintf (stderr, "Error %d writing the output file\n", errno);
-               exit (errno);
-            }
+            writer->write (buff, rxLast);
          }
 
 
@@ -333,8 +316,6 @@ class TestSink : public rogue::interfaces::stream::Slave {
          {
             dump ((uint64_t const *)buff, ndump);
          }
-         
-         free(buff);
       }
    }
 };
@@ -417,6 +398,9 @@ int main (int argc, char **argv) {
       diffBytes = sink->rxBytes - lastBytes;
       lastBytes = sink->rxBytes;
 
+      // Once the data stops, push out whatever is still staged
+      if (sink->writer && diffBytes == 0) sink->writer->flush ();
+
       timeDiff = (double)diff.tv_sec + ((double)diff.tv_usec / 1e6);
       bw = (((float)diffBytes * 8.0) / timeDiff) / 1e9;
 
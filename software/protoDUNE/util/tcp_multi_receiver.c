@@ -0,0 +1,1917 @@
+// -*-Mode: C;-*-
+
+/* ---------------------------------------------------------------------- *//*!
+ *
+ *  @file     tcp_multi_receiver.c
+ *  @brief    TCP/IP receiver for data from many RCEs in one process
+ *  @verbatim
+ *                               Copyright 2018
+ *                                    by
+ *
+ *                       The Board of Trustees of the
+ *                    Leland Stanford Junior University.
+ *                           All rights reserved.
+ *
+ *  @endverbatim
+ *
+ *  @par Facility:
+ *  pdd
+ *
+ *  @author
+ *  <russell@slac.stanford.edu>
+ *
+ *  @par Date created:
+ *  <2018/08/17>
+ *
+ * @par Credits:
+ * SLAC
+ *
+ *  @par
+ *  Where tcp_receiver serves exactly one RCE on one port, this accepts
+ *  any number of streams, on one or more ports, in one process.
+ *
+ *  A single thread services all the sockets using epoll. Each connection
+ *  reassembles its fragments, an 8 byte header giving the size followed
+ *  by the body, directly into buffers taken from a pool allocated up
+ *  front, backed by huge pages when the system has them. Completed
+ *  fragments are passed to a pool of worker threads that check and,
+ *  optionally, write them. The fragments of a given connection always
+ *  go to the same worker, so they are checked and written in the order
+ *  they arrived.
+ *
+ *  When all buffers are in use, the receiving thread waits for one to be
+ *  returned. This stops the reads on all sockets and lets TCP flow
+ *  control push back on the RCEs, rather than dropping data.
+ *
+ *  With -e <nsources>, the fragments are not written as they arrive but
+ *  are passed to the event builder, EventBuilder.h, which matches the
+ *  fragments from nsources RCEs by their trigger sequence number. Each
+ *  event, complete or, after the -T timeout, incomplete, is written as
+ *  one record with its contributor mask. The builder is split across
+ *  -S threads by sequence number.
+ *
+ *  With -a, the output is written through an AsyncFile: the fragments
+ *  are copied into large aligned blocks which are written with O_DIRECT
+ *  and AIO, so a slow disk does not hold up the workers. -R <MB> and
+ *  -Q <seconds> rotate the output by size and age, implying -a. What is
+ *  buffered is pushed out whenever the data stops for a second.
+ *
+ *  With -U <path>, it also listens on an AF_UNIX SOCK_SEQPACKET socket,
+ *  a local stand-in for RSSI used by dpm_replay. On such a connection
+ *  each message is one segment of a fragment and the fragment is the
+ *  segments up to the size given in its Header0.
+ *
+ *  With -d <host:port>, the channels are monitored, Dqm.h. Each worker
+ *  accumulates the pedestal, RMS, stuck codes and, every -F packets of
+ *  a source, the noise spectrum of its fragments' channels. Every -c ms
+ *  a snapshot of each source is sent as a UDP datagram to host:port,
+ *  where dqm_monitor can display it.
+ *
+ *  Once a second, the aggregate rates are updated on the status line.
+ *  The per connection rates are printed every -t seconds and whenever
+ *  a connection is made or lost.
+ *
+\* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *\
+
+   HISTORY
+   -------
+
+   DATE       WHO WHAT
+   ---------- --- ---------------------------------------------------------
+   2018.08.27 jjr Added -d, -c and -F to monitor the channels online and
+                  send snapshots of their statistics, see Dqm.h
+   2018.08.24 jjr The -x check is now the full fragment format check of
+                  TpcCheck, one context per connection, replacing the
+                  globally locked raw frame check. The failing error
+                  classes are listed with the connections.
+   2018.08.23 jjr Added -U to also accept framed connections on a local
+                  socket, the RSSI stand-in that dpm_replay sends to
+   2018.08.22 jjr Added -a to write the output through an AsyncFile,
+                  O_DIRECT and AIO off the worker threads, and -R/-Q to
+                  rotate it by size/age
+   2018.08.20 jjr Added event building, -e, matching the fragments from
+                  the RCEs by trigger sequence number (EventBuilder.h)
+   2018.08.17 jjr Created
+
+\* ---------------------------------------------------------------------- */
+
+#define _GNU_SOURCE
+
+#include "TpcCheck.h"
+#include "CaptureFile.h"
+#include "EventBuilder.h"
+#include "Dqm.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <inttypes.h>
+#include <getopt.h>
+#include <errno.h>
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \enum  Limits
+  \brief Compile time limits
+                                                                          */
+/* ---------------------------------------------------------------------- */
+enum Limits
+{
+   MAX_K_PORTS       =  8,   /*!< Maximum number of listening ports       */
+   MAX_K_CONNECTIONS = 64,   /*!< Maximum number of simultaneous streams  */
+   MAX_K_WORKERS     = 16,   /*!< Maximum number of worker threads        */
+   MAX_K_EVENTS      = 64    /*!< Maximum events returned by one wait     */
+};
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \class _Prms
+  \brief  The configuration parameters
+                                                                          *//*!
+  \typedef Prms
+  \brief   Typedef for struct _Prms
+                                                                          */
+/* ---------------------------------------------------------------------- */
+struct _Prms
+{
+   int                  nports;  /*!< Number of ports to listen on        */
+   int   ports[MAX_K_PORTS];     /*!< The ports to listen on              */
+   int                 rcvSize;  /*!< Size of the receiver buffer in bytes*/
+   int                 nodelay;  /*!< Value of the TCP_NODELAY parameter  */
+   int                nworkers;  /*!< Number of worker threads            */
+   int                nbuffers;  /*!< Number of fragment buffers          */
+   uint32_t           maxBytes;  /*!< Maximum size of a fragment          */
+   int                  period;  /*!< Seconds between connection reports  */
+   int               nfailures;  /*!< Maximum number of failure messages  */
+   int                nsources;  /*!< Sources to build events from, 0 to
+                                      write the fragments as they come    */
+   int                 nshards;  /*!< Number of event builder threads     */
+   uint32_t            timeout;  /*!< Event builder timeout, in ms        */
+   char                chkData;  /*!< Perform the data check              */
+   char                  index;  /*!< Write the output in capture format  */
+   char                  async;  /*!< Write the output through AsyncFile  */
+   uint32_t          maxMBytes;  /*!< Rotate the output at this many MB   */
+   uint32_t         maxSeconds;  /*!< Rotate the output at this age       */
+   char const       *ofilename;  /*!< Output file name                    */
+   char const       *framePath;  /*!< If non-NULL, also listen for framed
+                                      connections on this local socket    */
+   char const         *dqmDest;  /*!< If non-NULL, monitor the channels
+                                      and send the snapshots, host:port   */
+   uint32_t         dqmCadence;  /*!< Snapshot period, in ms              */
+   int                dqmEvery;  /*!< Packets per spectrum, 0 for none    */
+};
+/* ---------------------------------------------------------------------- */
+typedef struct _Prms Prms;
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \struct _Statistics
+  \brief   Keeps track of the statistics of one connection
+                                                                          *//*!
+  \typedef Statistics
+  \brief   Typedef for struct _Statistics
+                                                                          */
+/* ---------------------------------------------------------------------- */
+struct _Statistics
+{
+   uint64_t    datCnt;  /*!< The number of fragments received             */
+   uint64_t    rcvSiz;  /*!< The number of bytes received                 */
+   uint64_t    rcvCnt;  /*!< The number of calls to recv                  */
+   uint32_t    datErr;  /*!< Fragments failing the data check, updated by
+                             the worker threads                           */
+   uint32_t    hdrErr;  /*!< Fragments with a bad size in the header      */
+};
+/* ---------------------------------------------------------------------- */
+typedef struct _Statistics Statistics;
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \struct _Buffer
+  \brief   One fragment buffer from the pool
+                                                                          *//*!
+  \typedef Buffer
+  \brief   Typedef for struct _Buffer
+                                                                          */
+/* ---------------------------------------------------------------------- */
+struct _Buffer
+{
+   struct _Buffer  *next;  /*!< Link on the free list                     */
+   uint8_t         *data;  /*!< The buffer's memory                       */
+   uint32_t       nbytes;  /*!< Number of valid bytes                     */
+   int              conn;  /*!< The connection that filled it             */
+};
+/* ---------------------------------------------------------------------- */
+typedef struct _Buffer Buffer;
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \struct _Pool
+  \brief   The pool of fragment buffers
+                                                                          *//*!
+  \typedef Pool
+  \brief   Typedef for struct _Pool
+                                                                          */
+/* ---------------------------------------------------------------------- */
+struct _Pool
+{
+   pthread_mutex_t   lock;  /*!< Protects the free list                   */
+   pthread_cond_t    cond;  /*!< Signalled when a buffer is returned      */
+   Buffer           *free;  /*!< The free list                            */
+   Buffer         *buffers; /*!< The buffer descriptors                   */
+   uint8_t          *base;  /*!< The mapped memory                        */
+   size_t          nbytes;  /*!< Size of the mapped memory                */
+   uint32_t         bsize;  /*!< Size of one buffer                       */
+   int              count;  /*!< Number of buffers                        */
+   int          available;  /*!< Number of buffers on the free list       */
+   int               huge;  /*!< Backed by MAP_HUGETLB pages              */
+   uint32_t         waits;  /*!< Times the receiver waited for a buffer   */
+};
+/* ---------------------------------------------------------------------- */
+typedef struct _Pool Pool;
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \struct _Queue
+  \brief   A worker's queue of completed fragments
+
+  \par
+   There are never more fragments outstanding than there are buffers,
+   so a ring the size of the pool can not overflow.
+                                                                          *//*!
+  \typedef Queue
+  \brief   Typedef for struct _Queue
+                                                                          */
+/* ---------------------------------------------------------------------- */
+struct _Queue
+{
+   pthread_mutex_t   lock;  /*!< Protects the ring                        */
+   pthread_cond_t    cond;  /*!< Signalled when a fragment is added       */
+   Buffer          **ring;  /*!< The queued fragments                     */
+   int               size;  /*!< Number of entries in the ring            */
+   int                 rd;  /*!< Read  index                              */
+   int                 wr;  /*!< Write index                              */
+   int               done;  /*!< Set when the worker should exit          */
+};
+/* ---------------------------------------------------------------------- */
+typedef struct _Queue Queue;
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \struct _Ctx
+  \brief   The context of one connection
+                                                                          *//*!
+  \typedef Ctx
+  \brief   Typedef for struct _Ctx
+                                                                          */
+/* ---------------------------------------------------------------------- */
+struct _Ctx
+{
+   int               fd;  /*!< The socket, < 0 if the slot is free        */
+   int             port;  /*!< The listening port it connected on         */
+   int           frames;  /*!< If != 0, a framed, segmented, connection   */
+   char        peer[32];  /*!< The peer's address:port                    */
+   uint8_t       hdr[8];  /*!< The header, until it is complete           */
+   uint32_t        nhdr;  /*!< Number of header bytes received            */
+   Buffer         *frag;  /*!< The fragment being reassembled, if any     */
+   uint32_t    dataSize;  /*!< Size of the fragment being reassembled     */
+   time_t     connected;  /*!< When the connection was accepted           */
+   time_t      reported;  /*!< When the connection was last reported      */
+   Statistics     stats;  /*!< The current  statistics                    */
+   Statistics       prv;  /*!< The statistics at the last report          */
+   TpcCheck       check;  /*!< The fragment check, only used by the
+                               connection's worker                        */
+};
+/* ---------------------------------------------------------------------- */
+typedef struct _Ctx Ctx;
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \struct _Receiver
+  \brief   Everything shared between the receiving and worker threads
+                                                                          *//*!
+  \typedef Receiver
+  \brief   Typedef for struct _Receiver
+                                                                          */
+/* ---------------------------------------------------------------------- */
+struct _Receiver
+{
+   Prms const             *prms;  /*!< The control parameters             */
+   int                     epfd;  /*!< The epoll descriptor               */
+   int   listenFds[MAX_K_PORTS];  /*!< The listening sockets              */
+   Pool                    pool;  /*!< The fragment buffers               */
+   Queue  queues[MAX_K_WORKERS];  /*!< One queue per worker               */
+   pthread_t
+         workers[MAX_K_WORKERS];  /*!< The worker threads                 */
+   Ctx  conns[MAX_K_CONNECTIONS]; /*!< The connections                    */
+   pthread_mutex_t    writeLock;  /*!< Serializes the output              */
+   int                       fd;  /*!< Output file, < 0 if none           */
+   CaptureWriter        capture;  /*!< The indexed output, if requested   */
+   AsyncFile             *async;  /*!< The asynchronous writer, if any    */
+   AsyncFile          asyncFile;  /*!< Storage for the asynchronous writer*/
+   int                nfailures;  /*!< Number of failure messages so far  */
+   Statistics               tot;  /*!< Totals of the closed connections   */
+   EventBuilder         builder;  /*!< The event builder, if building     */
+   Dqm                      dqm;  /*!< The channel monitor, if monitoring */
+};
+/* ---------------------------------------------------------------------- */
+typedef struct _Receiver Receiver;
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- */
+/* LOCAL PROTOTYPES                                                       */
+/* ---------------------------------------------------------------------- */
+
+static void    getPrms           (Prms         *prms,
+                                  int           argc,
+                                  char *const argv[]);
+
+static int     receive           (Prms const   *prms);
+
+static int     pool_create       (Pool         *pool,
+                                  int        nbuffers,
+                                  uint32_t   maxBytes);
+static void    pool_destroy      (Pool         *pool);
+static Buffer *pool_get          (Pool         *pool);
+static void    pool_put          (Pool         *pool,
+                                  Buffer     *buffer);
+
+static void    queue_create      (Queue       *queue,
+                                  int           size);
+static void    queue_destroy     (Queue       *queue);
+static void    queue_put         (Queue       *queue,
+                                  Buffer     *buffer);
+static Buffer *queue_get         (Queue       *queue);
+static void    queue_finish      (Queue       *queue);
+
+static void   *worker            (void          *arg);
+
+static int     open_output       (Receiver    *rcv);
+static void    write_output      (Receiver    *rcv,
+                                  Buffer   *buffer);
+static void    close_output      (Receiver    *rcv);
+static void    emit_event        (void        *arg,
+                                  EbEvent const *event,
+                                  int       complete);
+
+static int     open_listener     (int        portno);
+static int     open_frame_listener
+                                 (char const   *path);
+static void    accept_clients    (Receiver    *rcv,
+                                  int      listenFd,
+                                  int          port);
+static void    close_connection  (Receiver    *rcv,
+                                  Ctx         *ctx,
+                                  char const  *msg);
+static int     read_connection   (Receiver    *rcv,
+                                  Ctx         *ctx);
+static int     read_frames       (Receiver    *rcv,
+                                  Ctx         *ctx);
+static int     check_header      (Receiver    *rcv,
+                                  Ctx         *ctx,
+                                  uint8_t const *hdr,
+                                  uint32_t *dataSize);
+
+static void    set_nonblocking   (int            fd);
+
+static void    statistics_add    (Statistics       *sum,
+                                  Statistics const *add);
+static void    print_statistics_title    ();
+static void    print_statistics          (Receiver const *rcv,
+                                          Statistics     *prv,
+                                          char            eol);
+static void    print_connections         (Receiver       *rcv);
+
+static inline uint64_t get_w64    (uint8_t const *data);
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- */
+/* The receiver, shared by the receiving and worker threads               */
+/* ---------------------------------------------------------------------- */
+static Receiver Rcv;
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- */
+/* Set by the SIGINT/SIGTERM handler to stop the receiver                 */
+/* ---------------------------------------------------------------------- */
+static volatile sig_atomic_t Stop = 0;
+
+static void stop_handler (int signo)
+{
+   Stop = 1;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Receive data from many RCEs
+
+  \param[in]  argc   Command line argument count
+  \param[in]  argv   Vector of command line parameters
+                                                                          */
+/* ---------------------------------------------------------------------- */
+int main (int argc, char *const argv[])
+{
+   Prms prms;
+   getPrms (&prms, argc, argv);
+
+   struct sigaction sa;
+   memset (&sa, 0, sizeof (sa));
+   sa.sa_handler = stop_handler;
+   sigaction (SIGINT,  &sa, NULL);
+   sigaction (SIGTERM, &sa, NULL);
+   signal    (SIGPIPE, SIG_IGN);
+
+   return receive (&prms);
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Services all the connections until stopped
+  \retval == 0, success
+  \retval != 0, failure in the setup
+
+  \param[in] prms  The control parameters
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static int receive (Prms const *prms)
+{
+   Receiver *rcv = &Rcv;
+   int        idx;
+
+   memset (rcv, 0, sizeof (*rcv));
+   rcv->prms = prms;
+   for (idx = 0; idx < MAX_K_CONNECTIONS; idx++) rcv->conns[idx].fd = -1;
+
+   pthread_mutex_init (&rcv->writeLock, NULL);
+
+
+   if (pool_create (&rcv->pool, prms->nbuffers, prms->maxBytes))
+   {
+      return -1;
+   }
+
+   if (open_output (rcv) < 0 && prms->ofilename)
+   {
+      return -1;
+   }
+
+
+   // -------------------------------------------------
+   // Open the listening sockets and add them to epoll.
+   // The event data is the port index for the
+   // listeners and MAX_K_PORTS + slot for connections.
+   // -------------------------------------------------
+   rcv->epfd = epoll_create1 (0);
+   if (rcv->epfd < 0)
+   {
+      fprintf (stderr, "Error creating epoll descriptor err = %d\n", errno);
+      return -1;
+   }
+
+   for (idx = 0; idx < prms->nports; idx++)
+   {
+      int fd = open_listener (prms->ports[idx]);
+      if (fd < 0) return -1;
+
+      struct epoll_event ev;
+      ev.events   = EPOLLIN;
+      ev.data.u64 = idx;
+      epoll_ctl (rcv->epfd, EPOLL_CTL_ADD, fd, &ev);
+      rcv->listenFds[idx] = fd;
+   }
+
+   // The framed listener follows the ports, it has no port number
+   if (prms->framePath)
+   {
+      int fd = open_frame_listener (prms->framePath);
+      if (fd < 0) return -1;
+
+      struct epoll_event ev;
+      ev.events   = EPOLLIN;
+      ev.data.u64 = prms->nports;
+      epoll_ctl (rcv->epfd, EPOLL_CTL_ADD, fd, &ev);
+      rcv->listenFds[prms->nports] = fd;
+   }
+
+
+   if (prms->nsources
+   &&  eventBuilder_create (&rcv->builder,
+                            prms->nsources,
+                            prms->nshards,
+                            prms->nbuffers,
+                            prms->timeout,
+                            emit_event,
+                            rcv))
+   {
+      fprintf (stderr, "Error creating the event builder\n");
+      return -1;
+   }
+
+
+   if (prms->dqmDest
+      && dqm_create (&rcv->dqm,
+                     prms->dqmDest,
+                     prms->dqmCadence,
+                     prms->dqmEvery))
+   {
+      fprintf (stderr, "Error creating the channel monitor\n");
+      return -1;
+   }
+
+
+   // -------------------------------
+   // Start the workers and receive
+   // -------------------------------
+   for (idx = 0; idx < prms->nworkers; idx++)
+   {
+      queue_create   (&rcv->queues[idx], prms->nbuffers);
+      pthread_create (&rcv->workers[idx], NULL, worker, &rcv->queues[idx]);
+   }
+
+
+   Statistics prv;
+   memset (&prv, 0, sizeof (prv));
+
+   time_t   now      = time (NULL);
+   time_t   lastRate = now;
+   time_t   lastConn = now;
+   int      Eject    = 60;
+
+   print_statistics_title ();
+
+   while (!Stop)
+   {
+      struct epoll_event events[MAX_K_EVENTS];
+      int nevents = epoll_wait (rcv->epfd, events, MAX_K_EVENTS, 250);
+
+      if (nevents < 0 && errno != EINTR)
+      {
+         fprintf (stderr, "Error waiting on epoll err = %d\n", errno);
+         break;
+      }
+
+      for (idx = 0; idx < nevents; idx++)
+      {
+         uint64_t which = events[idx].data.u64;
+
+         if (which < MAX_K_PORTS)
+         {
+            int port = which < (uint64_t)prms->nports ? prms->ports[which] : 0;
+            accept_clients (rcv, rcv->listenFds[which], port);
+            print_connections (rcv);
+         }
+         else
+         {
+            Ctx *ctx = &rcv->conns[which - MAX_K_PORTS];
+            if (ctx->fd >= 0 && read_connection (rcv, ctx))
+            {
+               print_connections (rcv);
+            }
+         }
+      }
+
+
+      // --------------------------------------------------------
+      // Once a second update the aggregate rates, every period
+      // seconds print the per connection rates
+      // --------------------------------------------------------
+      now = time (NULL);
+      if (now != lastRate)
+      {
+         uint64_t rcvSiz = prv.rcvSiz;
+         char        eol = '\r';
+         if (Eject-- == 0)
+         {
+            rcv->nfailures = 0;
+            eol            = '\n';
+            Eject          = 60;
+         }
+
+         print_statistics (rcv, &prv, eol);
+         lastRate = now;
+
+         // Nothing new, push out what the asynchronous writer holds
+         if (rcv->async && prv.rcvSiz == rcvSiz) asyncFile_flush (rcv->async);
+      }
+
+      if (prms->period > 0 && now - lastConn >= prms->period)
+      {
+         print_connections (rcv);
+         lastConn = now;
+      }
+   }
+
+
+   // ------------------------------------------------------------
+   // Shutdown, close the connections, drain the queues and write
+   // out whatever the workers had.
+   // ------------------------------------------------------------
+   putchar ('\n');
+   for (idx = 0; idx < MAX_K_CONNECTIONS; idx++)
+   {
+      if (rcv->conns[idx].fd >= 0)
+      {
+         close_connection (rcv, &rcv->conns[idx], "stopping");
+      }
+   }
+
+   for (idx = 0; idx < prms->nworkers; idx++)
+   {
+      queue_finish  (&rcv->queues[idx]);
+      pthread_join  (rcv->workers[idx], NULL);
+      queue_destroy (&rcv->queues[idx]);
+   }
+
+   // ------------------------------------------------------
+   // With the workers gone nothing more is posted, flush
+   // out the events still being built
+   // ------------------------------------------------------
+   if (prms->nsources)
+   {
+      eventBuilder_destroy (&rcv->builder);
+      eventBuilder_print   (&rcv->builder);
+   }
+
+   if (prms->dqmDest)
+   {
+      dqm_destroy (&rcv->dqm);
+      dqm_print   (&rcv->dqm);
+   }
+
+   print_statistics (rcv, &prv, '\n');
+   printf ("Waited for a buffer %" PRIu32 " times\n", rcv->pool.waits);
+
+   for (idx = 0; idx < prms->nports; idx++) close (rcv->listenFds[idx]);
+   if (prms->framePath)
+   {
+      close  (rcv->listenFds[prms->nports]);
+      unlink (prms->framePath);
+   }
+   close (rcv->epfd);
+
+   close_output (rcv);
+   pool_destroy (&rcv->pool);
+
+   return 0;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Reads what is available on one connection
+  \retval == 0, the connection is still open
+  \retval != 0, the connection was closed
+
+  \param[in] rcv  The receiver
+  \param[in] ctx  The connection
+
+  \par
+   Only one recv is done per wakeup; the sockets are level triggered so
+   a connection with more data is reported again on the next wait. This
+   keeps one busy RCE from starving the others.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static int read_connection (Receiver *rcv, Ctx *ctx)
+{
+   Prms const *prms = rcv->prms;
+   ssize_t    nread;
+
+   if (ctx->frames) return read_frames (rcv, ctx);
+
+   // -------------------------------------------------------------
+   // Until the 8 byte header is complete, read into the connection
+   // -------------------------------------------------------------
+   if (ctx->frag == NULL)
+   {
+      nread = recv (ctx->fd,
+                    ctx->hdr + ctx->nhdr,
+                    sizeof (ctx->hdr) - ctx->nhdr,
+                    0);
+   }
+   else
+   {
+      uint32_t nbytes = ctx->frag->nbytes;
+      nread = recv (ctx->fd,
+                    ctx->frag->data + nbytes,
+                    ctx->dataSize   - nbytes,
+                    0);
+   }
+
+
+   if (nread <= 0)
+   {
+      if (nread < 0 && (errno == EAGAIN || errno == EINTR)) return 0;
+
+      close_connection (rcv, ctx, nread == 0 ? "disconnect" : "recv error");
+      return 1;
+   }
+
+   ctx->stats.rcvCnt += 1;
+   ctx->stats.rcvSiz += nread;
+
+
+   if (ctx->frag == NULL)
+   {
+      ctx->nhdr += nread;
+      if (ctx->nhdr < sizeof (ctx->hdr)) return 0;
+
+      uint32_t dataSize;
+      if (check_header (rcv, ctx, ctx->hdr, &dataSize)) return 1;
+
+      ctx->dataSize = dataSize;
+      ctx->frag     = pool_get (&rcv->pool);
+      memcpy (ctx->frag->data, ctx->hdr, sizeof (ctx->hdr));
+      ctx->frag->nbytes = sizeof (ctx->hdr);
+      ctx->frag->conn   = ctx - rcv->conns;
+      ctx->nhdr         = 0;
+      return 0;
+   }
+
+
+   // ------------------------------------------------
+   // Reading the body, when complete hand it off to
+   // this connection's worker
+   // ------------------------------------------------
+   Buffer *frag  = ctx->frag;
+   frag->nbytes += nread;
+   if (frag->nbytes == ctx->dataSize)
+   {
+      ctx->stats.datCnt += 1;
+      queue_put (&rcv->queues[frag->conn % prms->nworkers], frag);
+      ctx->frag = NULL;
+   }
+
+   return 0;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Reads one segment on a framed connection
+  \retval == 0, the connection is still open
+  \retval != 0, the connection was closed
+
+  \param[in] rcv  The receiver
+  \param[in] ctx  The connection
+
+  \par
+   Each message is one segment, so the segments are received directly
+   into the fragment's buffer. The first must hold at least the Header0,
+   whose size says how many more make up the fragment. MSG_TRUNC returns
+   the true size of a segment so one that overruns the fragment is
+   caught rather than silently cut.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static int read_frames (Receiver *rcv, Ctx *ctx)
+{
+   if (ctx->frag == NULL)
+   {
+      ctx->frag         = pool_get (&rcv->pool);
+      ctx->frag->nbytes = 0;
+      ctx->frag->conn   = ctx - rcv->conns;
+      ctx->dataSize     = 0;
+   }
+
+   Buffer *frag  = ctx->frag;
+   ssize_t nread = recv (ctx->fd,
+                         frag->data     + frag->nbytes,
+                         rcv->pool.bsize - frag->nbytes,
+                         MSG_TRUNC);
+
+   if (nread <= 0)
+   {
+      if (nread < 0 && (errno == EAGAIN || errno == EINTR)) return 0;
+
+      close_connection (rcv, ctx, nread == 0 ? "disconnect" : "recv error");
+      return 1;
+   }
+
+   ctx->stats.rcvCnt += 1;
+   ctx->stats.rcvSiz += nread;
+   frag->nbytes      += nread;
+
+
+   // ---------------------------------------------
+   // The first segment of a fragment has its size
+   // ---------------------------------------------
+   if (ctx->dataSize == 0)
+   {
+      uint8_t const *hdr = frag->data;
+      uint8_t    none[8] = { 0 };
+
+      // Too short to have a header, let check_header reject it
+      if (frag->nbytes < sizeof (ctx->hdr)) hdr = none;
+
+      if (check_header (rcv, ctx, hdr, &ctx->dataSize)) return 1;
+   }
+
+   if (frag->nbytes > ctx->dataSize)
+   {
+      ctx->stats.hdrErr += 1;
+      close_connection (rcv, ctx, "segment overruns the fragment");
+      return 1;
+   }
+
+   if (frag->nbytes == ctx->dataSize)
+   {
+      ctx->stats.datCnt += 1;
+      queue_put (&rcv->queues[frag->conn % rcv->prms->nworkers], frag);
+      ctx->frag = NULL;
+   }
+
+   return 0;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Validates a fragment's Header0 and extracts its size
+  \retval == 0, the header is valid
+  \retval != 0, the header is invalid and the connection was closed
+
+  \param[in]       rcv  The receiver
+  \param[in]       ctx  The connection
+  \param[in]       hdr  The 8 byte Header0
+  \param[out] dataSize  The size of the fragment, in bytes
+
+  \par
+   The size is in 64-bit words and includes the header itself.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static int check_header (Receiver       *rcv,
+                         Ctx            *ctx,
+                         uint8_t const  *hdr,
+                         uint32_t  *dataSize)
+{
+   Prms const *prms = rcv->prms;
+   uint64_t  header = get_w64 (hdr);
+
+   *dataSize = ((header >> 8) & 0xffffff) * sizeof (uint64_t);
+
+   if (tpcCheck_header (header)
+      || *dataSize <= sizeof (ctx->hdr)
+      || *dataSize >  prms->maxBytes)
+   {
+      // -----------------------------------------------------
+      // There is no way to resynchronize a stream, the next
+      // fragment boundary is unknown, so drop the connection
+      // -----------------------------------------------------
+      ctx->stats.hdrErr += 1;
+      if (rcv->nfailures++ < prms->nfailures)
+      {
+         printf ("\n%s: bad header %16.16" PRIx64 " size = %" PRIu32 "\n",
+                 ctx->peer, header, *dataSize);
+      }
+      close_connection (rcv, ctx, "bad header");
+      return 1;
+   }
+
+   return 0;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Checks and writes the fragments on one queue
+
+  \param[in] arg  The worker's queue
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static void *worker (void *arg)
+{
+   Queue      *queue = (Queue *)arg;
+   Receiver     *rcv = &Rcv;
+   Prms const  *prms = rcv->prms;
+   Buffer      *frag;
+   DqmScratch   dqms;
+
+   // ------------------------------------------------------------
+   // A source's fragments come in on one connection, so the
+   // monitor's work is sharded by channel across the workers.
+   // ------------------------------------------------------------
+   int dqm = prms->dqmDest && dqmScratch_create (&dqms) == 0;
+
+   while ( (frag = queue_get (queue)) != NULL)
+   {
+      Ctx *ctx = &rcv->conns[frag->conn];
+
+      if (prms->chkData)
+      {
+         // -------------------------------------------------------
+         // A connection's fragments always go to the same worker,
+         // so its check context needs no locking.
+         // -------------------------------------------------------
+         uint32_t err = tpcCheck_fragment (&ctx->check,
+                                           (uint64_t const *)frag->data,
+                                           frag->nbytes / sizeof (uint64_t));
+         if (err) __sync_fetch_and_add (&ctx->stats.datErr, 1);
+      }
+
+      if (dqm)
+      {
+         dqm_fragment (&rcv->dqm,
+                       &dqms,
+                       (uint64_t const *)frag->data,
+                       frag->nbytes / sizeof (uint64_t));
+      }
+
+      // -------------------------------------------------------
+      // When building, the buffer is returned when the event is
+      // written. Fragments the builder refuses are dropped.
+      // -------------------------------------------------------
+      if (prms->nsources)
+      {
+         if (eventBuilder_post (&rcv->builder,
+                                frag,
+                                frag->data,
+                                frag->nbytes) == 0) continue;
+      }
+      else
+      {
+         write_output (rcv, frag);
+      }
+
+      pool_put (&rcv->pool, frag);
+   }
+
+   if (dqm) dqmScratch_destroy (&dqms);
+   return NULL;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Allocates the fragment buffers
+  \retval == 0, success
+  \retval != 0, failure
+
+  \param[out]    pool  The pool to create
+  \param[in] nbuffers  The number of buffers
+  \param[in] maxBytes  The size of each buffer
+
+  \par
+   The buffers are allocated as one mapping, each a whole number of
+   cache lines and the whole rounded up to a 2MB huge page. Explicit huge pages, MAP_HUGETLB, are tried first; these
+   must have been reserved, /proc/sys/vm/nr_hugepages. Failing that,
+   ordinary pages are used with a hint that transparent huge pages are
+   wanted. Either way the memory is touched up front so no page faults
+   are taken while receiving.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static int pool_create (Pool *pool, int nbuffers, uint32_t maxBytes)
+{
+   size_t const HugePage = 2 * 1024 * 1024;
+
+   memset (pool, 0, sizeof (*pool));
+   pthread_mutex_init (&pool->lock, NULL);
+   pthread_cond_init  (&pool->cond, NULL);
+
+   pool->bsize  = (maxBytes + 63) & ~63;
+   pool->count  = nbuffers;
+   pool->nbytes = ((size_t)pool->bsize * nbuffers + HugePage - 1)
+                & ~(HugePage - 1);
+   pool->huge   = 1;
+   pool->base   = (uint8_t *)mmap (NULL, pool->nbytes,
+                                   PROT_READ | PROT_WRITE,
+                                   MAP_PRIVATE | MAP_ANONYMOUS
+                                 | MAP_HUGETLB | MAP_POPULATE,
+                                   -1, 0);
+   if (pool->base == MAP_FAILED)
+   {
+      pool->huge = 0;
+      pool->base = (uint8_t *)mmap (NULL, pool->nbytes,
+                                    PROT_READ | PROT_WRITE,
+                                    MAP_PRIVATE | MAP_ANONYMOUS,
+                                    -1, 0);
+      if (pool->base == MAP_FAILED)
+      {
+         fprintf (stderr, "Error allocating %zu bytes of buffers err = %d\n",
+                  pool->nbytes, errno);
+         return -1;
+      }
+
+      madvise (pool->base, pool->nbytes, MADV_HUGEPAGE);
+      memset  (pool->base, 0, pool->nbytes);
+   }
+
+
+   // ---------------------------------
+   // Carve up and link onto free list
+   // ---------------------------------
+   pool->buffers = (Buffer *)malloc (nbuffers * sizeof (*pool->buffers));
+   pool->free    = NULL;
+   for (int idx = nbuffers; --idx >= 0; )
+   {
+      Buffer *buffer = &pool->buffers[idx];
+      buffer->data   = pool->base + (size_t)idx * pool->bsize;
+      buffer->nbytes = 0;
+      buffer->conn   = -1;
+      buffer->next   = pool->free;
+      pool->free     = buffer;
+   }
+   pool->available = nbuffers;
+
+   printf ("Buffers: %d x %" PRIu32 " bytes, %s pages\n",
+           nbuffers, pool->bsize, pool->huge ? "huge" : "normal");
+
+   return 0;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- */
+static void pool_destroy (Pool *pool)
+{
+   munmap (pool->base, pool->nbytes);
+   free   (pool->buffers);
+   pthread_cond_destroy  (&pool->cond);
+   pthread_mutex_destroy (&pool->lock);
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Takes a buffer from the pool, waiting for one if necessary
+  \return The buffer
+
+  \param[in] pool  The buffer pool
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static Buffer *pool_get (Pool *pool)
+{
+   pthread_mutex_lock (&pool->lock);
+
+   if (pool->free == NULL) pool->waits += 1;
+   while (pool->free == NULL)
+   {
+      pthread_cond_wait (&pool->cond, &pool->lock);
+   }
+
+   Buffer *buffer   = pool->free;
+   pool->free       = buffer->next;
+   pool->available -= 1;
+
+   pthread_mutex_unlock (&pool->lock);
+
+   buffer->nbytes = 0;
+   return buffer;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- */
+static void pool_put (Pool *pool, Buffer *buffer)
+{
+   pthread_mutex_lock   (&pool->lock);
+   buffer->next     = pool->free;
+   pool->free       = buffer;
+   pool->available += 1;
+   pthread_cond_signal  (&pool->cond);
+   pthread_mutex_unlock (&pool->lock);
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- */
+static void queue_create (Queue *queue, int size)
+{
+   pthread_mutex_init (&queue->lock, NULL);
+   pthread_cond_init  (&queue->cond, NULL);
+   queue->ring = (Buffer **)malloc ((size + 1) * sizeof (*queue->ring));
+   queue->size = size + 1;
+   queue->rd   = 0;
+   queue->wr   = 0;
+   queue->done = 0;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- */
+static void queue_destroy (Queue *queue)
+{
+   free (queue->ring);
+   pthread_cond_destroy  (&queue->cond);
+   pthread_mutex_destroy (&queue->lock);
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- */
+static void queue_put (Queue *queue, Buffer *buffer)
+{
+   pthread_mutex_lock   (&queue->lock);
+   queue->ring[queue->wr] = buffer;
+   queue->wr = (queue->wr + 1) % queue->size;
+   pthread_cond_signal  (&queue->cond);
+   pthread_mutex_unlock (&queue->lock);
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Waits for the next fragment on the queue
+  \return The fragment or NULL if the queue is empty and finished
+
+  \param[in] queue  The queue
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static Buffer *queue_get (Queue *queue)
+{
+   Buffer *buffer = NULL;
+
+   pthread_mutex_lock (&queue->lock);
+   while (queue->rd == queue->wr && !queue->done)
+   {
+      pthread_cond_wait (&queue->cond, &queue->lock);
+   }
+
+   if (queue->rd != queue->wr)
+   {
+      buffer    = queue->ring[queue->rd];
+      queue->rd = (queue->rd + 1) % queue->size;
+   }
+   pthread_mutex_unlock (&queue->lock);
+
+   return buffer;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- */
+static void queue_finish (Queue *queue)
+{
+   pthread_mutex_lock     (&queue->lock);
+   queue->done = 1;
+   pthread_cond_broadcast (&queue->cond);
+   pthread_mutex_unlock   (&queue->lock);
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  If requested, create the output file
+  \return The file descriptor or -1 if no output file was requested or
+          it could not be created
+
+  \param[in] rcv  The receiver
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static int open_output (Receiver *rcv)
+{
+   Prms const *prms = rcv->prms;
+   int       status;
+
+   rcv->fd         = -1;
+   rcv->async      = NULL;
+   rcv->capture.fd = -1;
+
+   if (prms->ofilename == NULL) return -1;
+
+   if (prms->async)
+   {
+      AsyncFileCfg cfg;
+      asyncFileCfg_init (&cfg);
+      cfg.maxBytes   = (uint64_t)prms->maxMBytes << 20;
+      cfg.maxSeconds = prms->maxSeconds;
+
+      status = asyncFile_open (&rcv->asyncFile, prms->ofilename, &cfg);
+      if (status)
+      {
+         fprintf (stderr, "Error opening output file: %s err = %d\n",
+                  prms->ofilename, status);
+         return -1;
+      }
+
+      rcv->async = &rcv->asyncFile;
+      rcv->fd    = asyncFile_fd (rcv->async);
+   }
+
+   if (prms->index)
+   {
+      status = rcv->async
+             ? captureWriter_openAsync (&rcv->capture, rcv->async, 0, 0)
+             : captureWriter_open      (&rcv->capture, prms->ofilename, 0, 0);
+      if (status)
+      {
+         fprintf (stderr, "Error opening output file: %s err = %d\n",
+                  prms->ofilename, status);
+         if (rcv->async) asyncFile_close (rcv->async);
+         rcv->async = NULL;
+         rcv->fd    = -1;
+         return -1;
+      }
+
+      rcv->fd = rcv->capture.fd;
+   }
+   else if (rcv->async == NULL)
+   {
+      rcv->fd = creat (prms->ofilename,  S_IRUSR | S_IWUSR
+                                       | S_IRGRP | S_IWGRP
+                                       | S_IROTH);
+      if (rcv->fd < 0)
+      {
+         fprintf (stderr, "Error opening output file: %s err = %d\n",
+                  prms->ofilename, errno);
+         return -1;
+      }
+   }
+
+   fprintf (stderr, "Output file is: %s%s%s\n",
+            prms->ofilename,
+            prms->index ? " (indexed)"      : "",
+            rcv->async  ? " (asynchronous)" : "");
+
+   return rcv->fd;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief Writes one fragment to the output file, if any
+
+  \param[in]    rcv  The receiver
+  \param[in] buffer  The fragment
+
+  \par
+   In the indexed format, the contributor mask records which connection
+   slot the fragment came in on.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static void write_output (Receiver *rcv, Buffer *buffer)
+{
+   if (rcv->fd < 0) return;
+
+   pthread_mutex_lock (&rcv->writeLock);
+
+   if (rcv->capture.fd >= 0)
+   {
+      int status = captureWriter_write (&rcv->capture,
+                                        buffer->data,
+                                        buffer->nbytes,
+                                        1ULL << buffer->conn);
+      if (status)
+      {
+         fprintf (stderr, "Error %d writing output\n", status);
+         exit (-1);
+      }
+   }
+   else if (rcv->async)
+   {
+      struct iovec iov;
+      iov.iov_base = buffer->data;
+      iov.iov_len  = buffer->nbytes;
+
+      int status = asyncFile_writeRecord (rcv->async, &iov, 1);
+      if (status)
+      {
+         fprintf (stderr, "Error %d writing output\n", status);
+         exit (-1);
+      }
+   }
+   else
+   {
+      ssize_t nwrote = write (rcv->fd, buffer->data, buffer->nbytes);
+      if (nwrote != buffer->nbytes)
+      {
+         fprintf (stderr,
+                  "Error %d writing output %zd != %" PRIu32
+                  " bytes to write\n",
+                  errno, nwrote, buffer->nbytes);
+         exit (-1);
+      }
+   }
+
+   pthread_mutex_unlock (&rcv->writeLock);
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- */
+static void close_output (Receiver *rcv)
+{
+   if      (rcv->capture.fd >= 0) captureWriter_close (&rcv->capture);
+   else if (rcv->async == NULL
+         && rcv->fd         >= 0) close               (rcv->fd);
+
+   if (rcv->async)
+   {
+      int status = asyncFile_close (rcv->async);
+      asyncFile_print (rcv->async, stdout);
+      if (status) fprintf (stderr, "Error %d writing output\n", status);
+      rcv->async = NULL;
+   }
+
+   rcv->fd = -1;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Writes a built event, if there is an output file, and returns
+          its fragments to the pool
+
+  \param[in]      arg  The receiver
+  \param[in]    event  The event
+  \param[in] complete  If != 0, all sources contributed; unused, the
+                       contributor mask records this
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static void emit_event (void *arg, EbEvent const *event, int complete)
+{
+   Receiver *rcv = (Receiver *)arg;
+   int       idx;
+
+   if (rcv->fd >= 0)
+   {
+      struct iovec iov[EB_K_MAXSOURCES];
+      size_t    nbytes = 0;
+
+      for (idx = 0; idx < event->nfragments; idx++)
+      {
+         iov[idx].iov_base = (void *)event->fragments[idx].data;
+         iov[idx].iov_len  =         event->fragments[idx].nbytes;
+         nbytes           +=         event->fragments[idx].nbytes;
+      }
+
+      pthread_mutex_lock (&rcv->writeLock);
+
+      int status = (rcv->capture.fd >= 0)
+                 ? captureWriter_writevId (&rcv->capture,
+                                           iov,
+                                           event->nfragments,
+                                           event->sequence,
+                                           event->timestamp,
+                                           event->contributors)
+                 : rcv->async
+                 ? asyncFile_writeRecord  (rcv->async, iov, event->nfragments)
+                 : capture_writev (rcv->fd, iov, event->nfragments, nbytes);
+
+      pthread_mutex_unlock (&rcv->writeLock);
+
+      if (status)
+      {
+         fprintf (stderr, "Error %d writing output\n", status);
+         exit (-1);
+      }
+   }
+
+   for (idx = 0; idx < event->nfragments; idx++)
+   {
+      pool_put (&rcv->pool, (Buffer *)event->fragments[idx].handle);
+   }
+
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief   Opens a non-blocking listening socket on the specified port
+  \return  The socket or -1 on failure
+
+  \param[in]  portno  The port number
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static int open_listener (int portno)
+{
+   int listenFd = socket (AF_INET, SOCK_STREAM, 0);
+   int       on = 1;
+
+   setsockopt (listenFd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof (on));
+
+   struct sockaddr_in srvAdr;
+   memset (&srvAdr, 0, sizeof (srvAdr));
+   srvAdr.sin_family      = AF_INET;
+   srvAdr.sin_addr.s_addr = INADDR_ANY;
+   srvAdr.sin_port        = htons (portno);
+
+   if (bind (listenFd, (struct sockaddr *) &srvAdr, sizeof (srvAdr)) < 0)
+   {
+      printf ("Failed to bind socket %5d err = %d\n", portno, errno);
+      close  (listenFd);
+      return -1;
+   }
+
+   listen          (listenFd, MAX_K_CONNECTIONS);
+   set_nonblocking (listenFd);
+
+   printf ("Listening for connections on port %5d\n", portno);
+   return listenFd;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief   Opens a non-blocking listening socket for framed connections
+  \return  The socket or -1 on failure
+
+  \param[in]  path  The path of the local socket, replaced if it exists
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static int open_frame_listener (char const *path)
+{
+   int listenFd = socket (AF_UNIX, SOCK_SEQPACKET, 0);
+
+   struct sockaddr_un srvAdr;
+   memset (&srvAdr, 0, sizeof (srvAdr));
+   srvAdr.sun_family = AF_UNIX;
+   strncpy (srvAdr.sun_path, path, sizeof (srvAdr.sun_path) - 1);
+
+   unlink (path);
+   if (bind (listenFd, (struct sockaddr *) &srvAdr, sizeof (srvAdr)) < 0)
+   {
+      printf ("Failed to bind socket %s err = %d\n", path, errno);
+      close  (listenFd);
+      return -1;
+   }
+
+   listen          (listenFd, MAX_K_CONNECTIONS);
+   set_nonblocking (listenFd);
+
+   printf ("Listening for framed connections on %s\n", path);
+   return listenFd;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Accepts all pending connections on a listening socket
+
+  \param[in]      rcv  The receiver
+  \param[in] listenFd  The listening socket
+  \param[in]     port  Its port number, 0 for the framed listener
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static void accept_clients (Receiver *rcv, int listenFd, int port)
+{
+   Prms const *prms = rcv->prms;
+
+   while (1)
+   {
+      struct sockaddr_in cliAddr;
+      socklen_t           cliLen = sizeof (cliAddr);
+      memset (&cliAddr, 0, sizeof (cliAddr));
+      int cliFd = accept (listenFd, (struct sockaddr *)&cliAddr, &cliLen);
+      if (cliFd < 0) return;
+
+
+      // ----------------------
+      // Find a free connection
+      // ----------------------
+      int slot;
+      for (slot = 0; slot < MAX_K_CONNECTIONS; slot++)
+      {
+         if (rcv->conns[slot].fd < 0) break;
+      }
+
+      if (slot == MAX_K_CONNECTIONS)
+      {
+         printf ("\nRefusing connection, all %d in use\n", MAX_K_CONNECTIONS);
+         close (cliFd);
+         continue;
+      }
+
+
+      setsockopt (cliFd, SOL_SOCKET, SO_RCVBUF,   &prms->rcvSize, sizeof (int));
+      if (port)
+      {
+         setsockopt (cliFd, SOL_TCP, TCP_NODELAY, &prms->nodelay, sizeof (int));
+      }
+      set_nonblocking (cliFd);
+
+      Ctx *ctx = &rcv->conns[slot];
+      memset (ctx, 0, sizeof (*ctx));
+      ctx->fd        = cliFd;
+      ctx->port      = port;
+      ctx->frames    = (port == 0);
+      ctx->connected = time (NULL);
+      ctx->reported  = ctx->connected;
+      if (ctx->frames)
+      {
+         snprintf (ctx->peer, sizeof (ctx->peer), "framed.%d", slot);
+      }
+      else
+      {
+         snprintf (ctx->peer, sizeof (ctx->peer), "%s:%d",
+                   inet_ntoa (cliAddr.sin_addr), ntohs (cliAddr.sin_port));
+      }
+
+      struct epoll_event ev;
+      ev.events   = EPOLLIN | EPOLLRDHUP;
+      ev.data.u64 = MAX_K_PORTS + slot;
+      epoll_ctl (rcv->epfd, EPOLL_CTL_ADD, cliFd, &ev);
+
+      printf ("\nAccepted connection %2d from %s on port %d\n",
+              slot, ctx->peer, port);
+   }
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Closes a connection, discarding any partial fragment
+
+  \param[in] rcv  The receiver
+  \param[in] ctx  The connection
+  \param[in] msg  The reason for closing it
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static void close_connection (Receiver *rcv, Ctx *ctx, char const *msg)
+{
+   printf ("\nClosing connection %2d from %s: %s\n",
+           (int)(ctx - rcv->conns), ctx->peer, msg);
+
+   epoll_ctl (rcv->epfd, EPOLL_CTL_DEL, ctx->fd, NULL);
+   close     (ctx->fd);
+
+   if (ctx->frag)
+   {
+      pool_put (&rcv->pool, ctx->frag);
+      ctx->frag = NULL;
+   }
+
+   statistics_add (&rcv->tot, &ctx->stats);
+   memset (&ctx->stats, 0, sizeof (ctx->stats));
+   ctx->fd = -1;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- */
+static void set_nonblocking (int fd)
+{
+   int flags = fcntl (fd, F_GETFL, 0);
+   fcntl (fd, F_SETFL, flags | O_NONBLOCK);
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- */
+static void statistics_add (Statistics *sum, Statistics const *add)
+{
+   sum->datCnt += add->datCnt;
+   sum->rcvSiz += add->rcvSiz;
+   sum->rcvCnt += add->rcvCnt;
+   sum->datErr += add->datErr;
+   sum->hdrErr += add->hdrErr;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief Puts of the statistics/status title line
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static void print_statistics_title ()
+{
+   puts (
+   " Conns   Rate        bps HdrErrs DatErrs  Free    NData          Bytes\n"
+   " ----- ------ ---------- ------- ------- ----- -------- --------------");
+
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief Prints the aggregate statistics over all connections
+
+  \param[in]     rcv  The receiver
+  \param[in,out] prv  The totals at the previous call, used to form the
+                      rates; updated to the current totals
+  \param[in]     eol  Either a '\n' or '\r'
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static void print_statistics (Receiver const *rcv, Statistics *prv, char eol)
+{
+   Statistics cur = rcv->tot;
+   int      nconn = 0;
+
+   for (int idx = 0; idx < MAX_K_CONNECTIONS; idx++)
+   {
+      if (rcv->conns[idx].fd >= 0)
+      {
+         statistics_add (&cur, &rcv->conns[idx].stats);
+         nconn += 1;
+      }
+   }
+
+   printf (" %5d %6" PRIu64 " %10" PRIu64 " %7" PRIu32 " %7" PRIu32
+           " %5d %8" PRIu64 " %14" PRIu64 "%c",
+           nconn,
+           cur.datCnt - prv->datCnt,
+           (cur.rcvSiz - prv->rcvSiz) * 8,
+           cur.hdrErr,
+           cur.datErr,
+           rcv->pool.available,
+           cur.datCnt,
+           cur.rcvSiz,
+           eol);
+   fflush (stdout);
+
+  *prv = cur;
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief Prints the rates of each connection since it was last reported
+
+  \param[in] rcv  The receiver
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static void print_connections (Receiver *rcv)
+{
+   time_t now = time (NULL);
+
+   puts ("\n"
+   " Conn Peer                   Port   Rate        bps  Reads/s"
+   " HdrErrs DatErrs    NData   Up\n"
+   " ---- --------------------- ----- ------ ---------- --------"
+   " ------- ------- -------- ----");
+
+   for (int idx = 0; idx < MAX_K_CONNECTIONS; idx++)
+   {
+      Ctx *ctx = &rcv->conns[idx];
+      if (ctx->fd < 0) continue;
+
+      Statistics const *cur = &ctx->stats;
+      Statistics const *prv = &ctx->prv;
+      uint64_t        dt = now > ctx->reported ? now - ctx->reported : 1;
+
+      printf (" %4d %-21s %5d %6" PRIu64 " %10" PRIu64 " %8" PRIu64
+              " %7" PRIu32 " %7" PRIu32 " %8" PRIu64 " %4ld\n",
+              idx,
+              ctx->peer,
+              ctx->port,
+              (cur->datCnt - prv->datCnt) / dt,
+              (cur->rcvSiz - prv->rcvSiz) * 8 / dt,
+              (cur->rcvCnt - prv->rcvCnt) / dt,
+              cur->hdrErr,
+              cur->datErr,
+              cur->datCnt,
+              (long)(now - ctx->connected));
+
+      if (ctx->check.nfailed)
+      {
+         tpcCheck_print (&ctx->check, "      ");
+      }
+
+      ctx->prv      = *cur;
+      ctx->reported = now;
+   }
+
+   if (rcv->prms->nsources)
+   {
+      putchar ('\n');
+      eventBuilder_print (&rcv->builder);
+   }
+
+   if (rcv->async)
+   {
+      putchar ('\n');
+      asyncFile_print (rcv->async, stdout);
+   }
+
+   putchar ('\n');
+   print_statistics_title ();
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Retrieve or set defaults for the governing parameters
+
+  \par
+   -p takes a comma separated list of ports, e.g. -p 8991,8992
+   -e gives the number of sources to build events from, -S the number
+   of event builder threads and -T the event timeout in ms.
+   -a writes the output through an AsyncFile, -R and -Q rotate it
+   every so many MB or seconds. -U also accepts framed connections on
+   the given local socket path.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static void getPrms (Prms *prms, int argc, char *const argv[])
+{
+    int c;
+    char const *ports      =         "8991";
+    int         rcvSize    =     128 * 1024;
+    int         nodelay    =              0;
+    int         nworkers   =              2;
+    int         nbuffers   =             64;
+    uint32_t    maxBytes   = 8 * 1024 * 1024;
+    int         period     =             10;
+    int         nfailures  =             25;
+    int         nsources   =              0;
+    int         nshards    =              1;
+    uint32_t    timeout    =           1000;
+    char        chkData    =              0;
+    char        index      =              0;
+    char        async      =              0;
+    uint32_t    maxMBytes  =              0;
+    uint32_t    maxSeconds =              0;
+    char const *ofilename  =           NULL;
+    char const *framePath  =           NULL;
+    char const *dqmDest    =           NULL;
+    uint32_t    dqmCadence =           1000;
+    int         dqmEvery   =             16;
+
+
+    while ( (c = getopt (argc, argv, "aib:c:d:e:f:n:o:p:r:s:t:w:xF:Q:R:S:T:U:")) != EOF)
+    {
+       if       (c == 'b') nbuffers   = strtoul (optarg, NULL, 0);
+       else if  (c == 'e') nsources   = strtoul (optarg, NULL, 0);
+       else if  (c == 'f') nfailures  = strtoul (optarg, NULL, 0);
+       else if  (c == 'n') nodelay    = strtoul (optarg, NULL, 0);
+       else if  (c == 'o') ofilename  = optarg;
+       else if  (c == 'p') ports      = optarg;
+       else if  (c == 'r') rcvSize    = strtoul (optarg, NULL, 0);
+       else if  (c == 's') maxBytes   = strtoul (optarg, NULL, 0);
+       else if  (c == 't') period     = strtoul (optarg, NULL, 0);
+       else if  (c == 'w') nworkers   = strtoul (optarg, NULL, 0);
+       else if  (c == 'x') chkData    = 1;
+       else if  (c == 'i') index      = 1;
+       else if  (c == 'S') nshards    = strtoul (optarg, NULL, 0);
+       else if  (c == 'T') timeout    = strtoul (optarg, NULL, 0);
+       else if  (c == 'a') async      = 1;
+       else if  (c == 'R') maxMBytes  = strtoul (optarg, NULL, 0);
+       else if  (c == 'Q') maxSeconds = strtoul (optarg, NULL, 0);
+       else if  (c == 'U') framePath  = optarg;
+       else if  (c == 'd') dqmDest    = optarg;
+       else if  (c == 'c') dqmCadence = strtoul (optarg, NULL, 0);
+       else if  (c == 'F') dqmEvery   = strtoul (optarg, NULL, 0);
+    }
+
+    // Rotating the output is only done by the asynchronous writer
+    if (maxMBytes || maxSeconds) async = 1;
+
+
+    // -----------------------------
+    // Parse the list of ports
+    // -----------------------------
+    // The framed listener takes the last listening slot
+    int maxPorts = framePath ? MAX_K_PORTS - 1 : MAX_K_PORTS;
+
+    prms->nports = 0;
+    while (*ports && prms->nports < maxPorts)
+    {
+       char *end;
+       int  port = strtoul (ports, &end, 0);
+       if (end == ports) break;
+
+       prms->ports[prms->nports++] = port;
+       ports = (*end == ',') ? end + 1 : end;
+    }
+
+    if (nworkers < 1)             nworkers = 1;
+    if (nworkers > MAX_K_WORKERS) nworkers = MAX_K_WORKERS;
+    if (nbuffers < nworkers)      nbuffers = nworkers;
+
+    prms->rcvSize    = rcvSize;
+    prms->nodelay    = nodelay != 0;
+    prms->nworkers   = nworkers;
+    prms->nbuffers   = nbuffers;
+    prms->maxBytes   = maxBytes;
+    prms->period     = period;
+    prms->nfailures  = nfailures;
+    prms->nsources   = nsources;
+    prms->nshards    = nshards;
+    prms->timeout    = timeout;
+    prms->chkData    = chkData;
+    prms->index      = index;
+    prms->async      = async;
+    prms->maxMBytes  = maxMBytes;
+    prms->maxSeconds = maxSeconds;
+    prms->ofilename  = ofilename;
+    prms->framePath  = framePath;
+    prms->dqmDest    = dqmDest;
+    prms->dqmCadence = dqmCadence;
+    prms->dqmEvery   = dqmEvery;
+
+    return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Extracts one 64-bit word from the \a data stream
+  \return The extracted 64-bit word
+
+  \param[in] data  The data stream
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline uint64_t get_w64 (uint8_t const *data)
+{
+   uint64_t w;
+   memcpy (&w, data, sizeof (w));
+   return w;
+}
+/* ---------------------------------------------------------------------- */
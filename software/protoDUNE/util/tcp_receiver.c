@@ -37,6 +37,17 @@
   
    DATE       WHO WHAT
    ---------- --- ---------------------------------------------------------
+   2018.08.24 jjr The -x option now checks the complete fragment format
+                  with TpcCheck, failures are counted in datVal and a
+                  summary by error class is printed at exit.
+   2018.08.22 jjr Added the -a option to write the output through an
+                  AsyncFile, O_DIRECT and AIO off the receive thread, and
+                  -R/-Q to rotate the output by size/age. SIGINT now
+                  stops the receiver cleanly so that the output is
+                  completely written and, if indexed, closed with its
+                  index.
+   2018.07.23 jjr Added the -i option to write the output file in the
+                  indexed capture format (CaptureFile.h)
    2018.05.16 jjr Major refactoring. Moved record checking and printing 
                   into their own files so that they can be shared with
                   the rssi_receiver.
@@ -53,6 +64,7 @@
 
 #include "TpcPrinter.h"
 #include "TpcCheck.h"
+#include "CaptureFile.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -71,6 +83,7 @@
 #include <inttypes.h>
 #include <getopt.h>
 #include <errno.h>
+#include <signal.h>
 
 
 
@@ -108,6 +121,10 @@ struct _Prms
    int           nodelay;   /*!< Value of the TCP_NODELAY parameter       */
    int         nfailures;   /*!< Maximum number of failure messages       */
    char          chkData;   /*!< Perform the data check                   */
+   char            index;   /*!< Write the output in the capture format   */
+   char            async;   /*!< Write the output through an AsyncFile    */
+   uint32_t    maxMBytes;   /*!< Rotate the output at this many MB, 0=never*/
+   uint32_t   maxSeconds;   /*!< Rotate the output at this age,  0=never  */
    char const *ofilename;   /*!< Output file name                         */
 };
 /* ---------------------------------------------------------------------- */
@@ -116,6 +133,37 @@ typedef struct _Prms Prms;
 
 
 
+/* ---------------------------------------------------------------------- *//*!
+
+  \struct _Output
+  \brief   The output file, in whichever form was requested
+                                                                          *//*!
+  \typedef Output
+  \brief   Typedef for struct _Output
+                                                                          */
+/* ---------------------------------------------------------------------- */
+struct _Output
+{
+   int                fd;  /*!< The output file descriptor, < 0 if none   */
+   CaptureWriter capture;  /*!< The indexed output, if requested          */
+   AsyncFile      *async;  /*!< The asynchronous writer, if requested     */
+   AsyncFile   asyncFile;  /*!< Storage for the asynchronous writer       */
+};
+/* ---------------------------------------------------------------------- */
+typedef struct _Output Output;
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- */
+/* Set by SIGINT, stops the receiving so that the output can be closed    */
+/* ---------------------------------------------------------------------- */
+static volatile sig_atomic_t Stop    = 0;
+static Output               *Closing = NULL;
+/* ---------------------------------------------------------------------- */
+
+
+
 /* ---------------------------------------------------------------------- *//*!
 
    \enum  ERR_M
@@ -209,6 +257,7 @@ struct _Ctx
    Errors           errs;  /*!< The error statistics                      */
    int         nfailures;  /*!< Number of failures                        */
    uint32_t history[256];  /*!< History of sequence number by index       */
+   TpcCheck        check;  /*!< The fragment check context                */
 };
 /* ---------------------------------------------------------------------- */
 typedef struct _Ctx Ctx;
@@ -231,6 +280,17 @@ static int      dump             (Prms const   *prms);
 
 static int     create_file       (char const *filename);
 
+static int     open_output       (Prms const       *prms,
+                                  Output         *output);
+
+static void    write_output      (Output         *output,
+                                  uint8_t const     *data,
+                                  ssize_t          nwrite);
+
+static void    close_output      (void);
+
+static void    stop              (int              signo);
+
 static int     open_client       (int         portno, 
                                   int        rcvSize, 
                                   int        nodelay, 
@@ -347,9 +407,8 @@ static int monitor (Prms const *prms)
     // -----------------------------------------
     // If requested, create a binary output file
     // -----------------------------------------
-    int fd = (prms->ofilename) 
-           ? create_file (prms->ofilename) 
-           : -1;
+    Output output;
+    open_output (prms, &output);
 
 
     unsigned int retries[128];
@@ -367,7 +426,7 @@ static int monitor (Prms const *prms)
     print_socketopts  (rcvFd);
     print_statistics_title ();
 
-    while (1)
+    while (!Stop)
     {
        RcvProfile hdrRcv;
        RcvProfile datRcv;
@@ -387,6 +446,7 @@ static int monitor (Prms const *prms)
        /* Check if had error or a disconnect */
        if (nread <= 0)
        {
+          if (Stop) break;
           need_lf = if_newline (need_lf);
           puts ("Error");
           rcvProfile_print (&hdrRcv, "Hdr");
@@ -411,7 +471,7 @@ static int monitor (Prms const *prms)
        ctx.stats.hdrCnt += 1;
        ctx.stats.hdrSiz += headerSize;
 
-       uint32_t failures = checkHeader (&ctx, rxData, headerSize);
+       uint32_t failures = tpcCheck_header (get_w64 (rxData));
 
 
        if (failures)
@@ -473,6 +533,7 @@ static int monitor (Prms const *prms)
              /* Check if had error or disconnect */
              if (nread <= 0)
              {
+                if (Stop) break;
                 need_lf = if_newline (need_lf);
                 printf ("Error reading %u bytes\n", ndata);
                 printf ("\n");
@@ -491,20 +552,7 @@ static int monitor (Prms const *prms)
              }
 
 
-             if (fd >= 0)
-             {
-                ssize_t nwrite = headerSize + nread;
-                ssize_t nwrote = write (fd, rxData, nwrite);
-                if (nwrote != nwrite)
-                {
-                   fprintf (
-                      stderr,
-                      "Error %d writing output %zd != %zd bytes to write\n",
-                      errno,
-                      nwrite, nwrote);
-                   exit (-1);
-                }
-             }
+             write_output (&output, rxData, headerSize + nread);
 
 
              uint64_t const *pTrailer = (uint64_t const *)
@@ -512,11 +560,19 @@ static int monitor (Prms const *prms)
 
              if (prms->chkData) 
              {
-                unsigned int err = checkData (&ctx, data, ndata);
+                uint32_t err = tpcCheck_fragment (&ctx.check,
+                                                  (uint64_t const *)rxData,
+                                                  dataSize / sizeof (uint64_t));
                 if (err)
                 {
-                   rcvProfile_print (&hdrRcv, "Hdr");
-                   rcvProfile_print (&datRcv, "Dat");
+                   ctx.errs.datVal += 1;
+                   if (ctx.nfailures++ < prms->nfailures)
+                   {
+                      need_lf = if_newline (need_lf);
+                      printf ("Check failure = %4.4" PRIx32 "\n", err);
+                      rcvProfile_print (&hdrRcv, "Hdr");
+                      rcvProfile_print (&datRcv, "Dat");
+                   }
                 }
              }
 
@@ -531,9 +587,12 @@ static int monitor (Prms const *prms)
 
        need_lf = print_statistics_update (&ctx, &prv, need_lf);
     }
+
+    if (prms->chkData) tpcCheck_print (&ctx.check, "\nFragment check: ");
    
     close (srvFd);
     close (rcvFd);
+    close_output ();
 
     return 0;
 }
@@ -567,9 +626,8 @@ static int dump (Prms const *prms)
     // -----------------------------------------
     // If requested, create a binary output file
     // -----------------------------------------
-    int fd = (prms->ofilename) 
-           ? create_file (prms->ofilename) 
-           : -1;
+    Output output;
+    open_output (prms, &output);
 
 
     unsigned int retries[128];
@@ -587,7 +645,7 @@ static int dump (Prms const *prms)
     print_socketopts  (rcvFd);
     print_statistics_title ();
 
-    while (1)
+    while (!Stop)
     {
        RcvProfile hdrRcv;
        RcvProfile datRcv;
@@ -609,6 +667,7 @@ static int dump (Prms const *prms)
        /* Check if had error or a disconnect */
        if (nread <= 0)
        {
+          if (Stop) break;
           need_lf = if_newline (need_lf);
           puts ("Error");
           rcvProfile_print (&hdrRcv, "Hdr");
@@ -629,7 +688,7 @@ static int dump (Prms const *prms)
           exit (-1);
        }
 
-       uint32_t failures = checkHeader (&ctx, rxData, headerSize);
+       uint32_t failures = tpcCheck_header (get_w64 (rxData));
        print_hdr (get_w64 (rxData));
 
 
@@ -692,6 +751,7 @@ static int dump (Prms const *prms)
              /* Check if had error or disconnect */
              if (nread <= 0)
              {
+                if (Stop) break;
                 need_lf = if_newline (need_lf);
                 printf ("Error reading %u bytes\n", ndata);
                 printf ("\n");
@@ -711,31 +771,26 @@ static int dump (Prms const *prms)
 
              print_id ((uint64_t const *)data);
 
-             if (fd >= 0)
-             {
-                ssize_t nwrite = headerSize + nread;
-                ssize_t nwrote = write (fd, rxData, nwrite);
-                if (nwrote != nwrite)
-                {
-                   fprintf (
-                      stderr,
-                      "Error %d writing output %zd != %zd bytes to write\n",
-                      errno,
-                      nwrite, nwrote);
-                   exit (-1);
-                }
-             }
+             write_output (&output, rxData, headerSize + nread);
 
              print_record ((uint64_t const *)data, ndata/sizeof (uint64_t));
 
 
              if (prms->chkData) 
              {
-                unsigned int err = checkData (&ctx, data, ndata);
+                uint32_t err = tpcCheck_fragment (&ctx.check,
+                                                  (uint64_t const *)rxData,
+                                                  dataSize / sizeof (uint64_t));
                 if (err)
                 {
-                   rcvProfile_print (&hdrRcv, "Hdr");
-                   rcvProfile_print (&datRcv, "Dat");
+                   ctx.errs.datVal += 1;
+                   if (ctx.nfailures++ < prms->nfailures)
+                   {
+                      need_lf = if_newline (need_lf);
+                      printf ("Check failure = %4.4" PRIx32 "\n", err);
+                      rcvProfile_print (&hdrRcv, "Hdr");
+                      rcvProfile_print (&datRcv, "Dat");
+                   }
                 }
              }
 
@@ -753,9 +808,12 @@ static int dump (Prms const *prms)
 
        need_lf = print_statistics_update (&ctx, &prv, need_lf);
     }
+
+    if (prms->chkData) tpcCheck_print (&ctx.check, "\nFragment check: ");
    
     close (srvFd);
     close (rcvFd);
+    close_output ();
 
     return 0;
 }
@@ -825,13 +883,17 @@ static void getPrms (Prms *prms, int argc, char *const argv[])
     int         rcvSize    =     128 * 1024;
     int         data       =              0;
     char        chkData    =              0;
+    char        index      =              0;
+    char        async      =              0;
+    uint32_t    maxMBytes  =              0;
+    uint32_t    maxSeconds =              0;
     int         nodelay    =              0;
     int         nfailures  =             25;
     char const *ofilename  =           NULL;
     enum Mode   mode       = MODE_K_MONITOR;
 
 
-    while ( (c = getopt (argc, argv, "dmo:f:p:r:xd:n:")) != EOF)
+    while ( (c = getopt (argc, argv, "adimo:f:p:r:xd:n:Q:R:")) != EOF)
     {
        if       (c == 'f') nfailures  = strtoul (optarg, NULL, 0);
        else if  (c == 'm') mode       = MODE_K_MONITOR;
@@ -842,13 +904,24 @@ static void getPrms (Prms *prms, int argc, char *const argv[])
        else if  (c == 'o') ofilename  = optarg;
        else if  (c == 'r') rcvSize    = strtoul (optarg, NULL, 0);
        else if  (c == 'x') chkData    = 1;
+       else if  (c == 'i') index      = 1;
+       else if  (c == 'a') async      = 1;
+       else if  (c == 'R') maxMBytes  = strtoul (optarg, NULL, 0);
+       else if  (c == 'Q') maxSeconds = strtoul (optarg, NULL, 0);
     }
 
+    /* Rotating the output is only done by the asynchronous writer */
+    if (maxMBytes || maxSeconds) async = 1;
+
     prms->mode       = mode;
     prms->portNumber = portNumber;
     prms->rcvSize    = rcvSize;
     prms->data       = data;
     prms->chkData    = chkData;
+    prms->index      = index;
+    prms->async      = async;
+    prms->maxMBytes  = maxMBytes;
+    prms->maxSeconds = maxSeconds;
     prms->nfailures  = nfailures;
     prms->ofilename  = ofilename;
     prms->nodelay    = nodelay != 0;
@@ -887,6 +960,204 @@ static int create_file (char const *filename)
     return fd;
 }
 /* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  If requested, create the output file
+  \return The file descriptor or -1 if no output file was requested.
+
+  \param[in]     prms  The control parameters
+  \param[out]  output  The output file
+
+  \par
+   When an indexed file is requested, the capture writer owns the file
+   descriptor. When an asynchronous file is requested, the AsyncFile
+   owns it. In both cases it is returned only as an indication that
+   output is to be written.
+
+  \par
+   The output is closed when the receiver exits, including when it is
+   stopped with SIGINT, so that what has been buffered is written out.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static int open_output (Prms const *prms, Output *output)
+{
+    output->fd         = -1;
+    output->async      = NULL;
+    output->capture.fd = -1;
+
+    if (prms->ofilename == NULL) return -1;
+
+    if (prms->async)
+    {
+       AsyncFileCfg cfg;
+       asyncFileCfg_init (&cfg);
+       cfg.maxBytes   = (uint64_t)prms->maxMBytes << 20;
+       cfg.maxSeconds = prms->maxSeconds;
+
+       int status = asyncFile_open (&output->asyncFile, prms->ofilename, &cfg);
+       if (status)
+       {
+          fprintf (stderr, "Error opening output file: %s err = %d\n",
+                   prms->ofilename, status);
+          return -1;
+       }
+
+       output->async = &output->asyncFile;
+       output->fd    = asyncFile_fd (output->async);
+    }
+
+    if (prms->index)
+    {
+       int status = output->async
+                  ? captureWriter_openAsync (&output->capture, output->async, 0, 0)
+                  : captureWriter_open      (&output->capture, prms->ofilename, 0, 0);
+       if (status)
+       {
+          fprintf (stderr, "Error opening output file: %s err = %d\n",
+                   prms->ofilename, status);
+          if (output->async) asyncFile_close (output->async);
+          output->async = NULL;
+          output->fd    = -1;
+          return -1;
+       }
+       output->fd = output->capture.fd;
+    }
+    else if (output->async == NULL)
+    {
+       output->fd = create_file (prms->ofilename);
+       if (output->fd < 0) return -1;
+    }
+
+    if (output->fd >= 0 && (prms->index || output->async))
+    {
+       fprintf (stderr, "Output file is: %s%s%s\n",
+                prms->ofilename,
+                prms->index   ? " (indexed)"      : "",
+                output->async ? " (asynchronous)" : "");
+    }
+
+
+    // -----------------------------------------------------------
+    // Close the output on the way out, SIGINT included, so that
+    // the buffered data is written and an indexed file is indexed
+    // -----------------------------------------------------------
+    Closing = output;
+    atexit (close_output);
+
+    struct sigaction sa;
+    memset (&sa, 0, sizeof (sa));
+    sa.sa_handler = stop;
+    sigaction (SIGINT,  &sa, NULL);
+    sigaction (SIGTERM, &sa, NULL);
+
+    return output->fd;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Signal handler, stops the receiving
+
+  \param[in] signo  The signal number, unused
+
+  \par
+   The handler is installed without SA_RESTART, so the blocked recv or
+   accept returns with EINTR and the receive loop sees Stop.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static void stop (int signo)
+{
+   Stop = 1;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief Writes one fragment to the output file, if any
+
+  \param[in]  output  The output file
+  \param[in]    data  The fragment
+  \param[in]  nwrite  The number of bytes in the fragment
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static void write_output (Output        *output,
+                          uint8_t const   *data,
+                          ssize_t        nwrite)
+{
+    int status;
+
+    if (output->fd < 0) return;
+
+    if (output->capture.fd >= 0)
+    {
+       status = captureWriter_write (&output->capture, data, nwrite, 0);
+    }
+    else if (output->async)
+    {
+       struct iovec iov;
+       iov.iov_base = (void *)data;
+       iov.iov_len  = nwrite;
+       status       = asyncFile_writeRecord (output->async, &iov, 1);
+    }
+    else
+    {
+       ssize_t nwrote = write (output->fd, data, nwrite);
+       if (nwrote != nwrite)
+       {
+          fprintf (stderr,
+                   "Error %d writing output %zd != %zd bytes to write\n",
+                   errno,
+                   nwrite, nwrote);
+          exit (-1);
+       }
+       return;
+    }
+
+    if (status)
+    {
+       fprintf (stderr, "Error %d writing output\n", status);
+       exit (-1);
+    }
+
+    return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief Closes the output file, if any, printing the asynchronous
+         writer's statistics. Called once, at exit.
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static void close_output (void)
+{
+    Output *output = Closing;
+
+    Closing = NULL;
+    if (output == NULL || output->fd < 0) return;
+
+    if (output->capture.fd >= 0) captureWriter_close (&output->capture);
+
+    if (output->async)
+    {
+       int status = asyncFile_close (output->async);
+       asyncFile_print (output->async, stderr);
+       if (status) fprintf (stderr, "Error %d writing output\n", status);
+    }
+    else if (output->capture.fd < 0) close (output->fd);
+
+    output->fd = -1;
+}
+/* ---------------------------------------------------------------------- */
  
 
 
@@ -1194,7 +1465,8 @@ EXIT:
 /* ---------------------------------------------------------------------- */
 static inline void invalidate_ctx (Ctx *ctx)
 {
-   ctx->seqNum = 0xffffffff;
+   ctx->seqNum       = 0xffffffff;
+   ctx->check.primed =          0;
 }
 /* ---------------------------------------------------------------------- */
 
@@ -1260,6 +1532,7 @@ static inline void init_ctx (Ctx *ctx)
 {
    ctx->datMax    = 0x4075c;
    ctx->nfailures =       0;
+   tpcCheck_init      (&ctx->check);
    invalidate_ctx     (ctx);
    clear_ctx          (ctx);
    time   (&ctx->timestamp);
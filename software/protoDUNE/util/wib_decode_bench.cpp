@@ -0,0 +1,322 @@
+// -*-Mode: C;-*-
+
+/* ---------------------------------------------------------------------- *//*!
+ *
+ *  @file     wib_decode_bench.cpp
+ *  @brief    Validates and times the multithreaded decoder of compressed
+ *            WIB packets
+ *  @verbatim
+ *                               Copyright 2018
+ *                                    by
+ *
+ *                       The Board of Trustees of the
+ *                    Leland Stanford Junior University.
+ *                           All rights reserved.
+ *
+ *  @endverbatim
+ *
+ *  @par Facility:
+ *  util
+ *
+ *  @author
+ *  <russell@slac.stanford.edu>
+ *
+ *  @par Date created:
+ *  <2018/07/26>
+ *
+ * @par Credits:
+ * SLAC
+ *
+\* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *\
+
+   HISTORY
+   -------
+
+   DATE       WHO WHAT
+   ---------- --- ---------------------------------------------------------
+   2018.07.26 jjr Created
+
+\* ---------------------------------------------------------------------- */
+
+// This must go first in order to get things like PRIx32 defined
+#include <cinttypes>
+
+#include "WibDecode.h"
+#include "WibEncode.h"
+
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Returns the current monotonic time in nanoseconds
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline uint64_t now_ns ()
+{
+   struct timespec ts;
+   clock_gettime (CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Returns a normally distributed random number
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static double gauss ()
+{
+   double u1 = (lrand48 () + 1.0) / 2147483649.0;
+   double u2 =  lrand48 ()        / 2147483648.0;
+   return sqrt (-2.0 * log (u1)) * cos (2.0 * M_PI * u2);
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief Fills the channel-major ADCs of a packet with a pedestal plus
+         gaussian noise and the occasional pulse
+
+  \param[out]     adcs  The ADCs, adcs[ichan * nsamples + t]
+  \param[in]  nsamples  The number of samples per channel
+  \param[in]     noise  The RMS of the noise, in ADC counts
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static void fill (uint16_t *adcs, int nsamples, double noise)
+{
+   for (int ichan = 0; ichan < WIBDECODE_K_MAXCHANNELS; ichan++)
+   {
+      uint16_t *chan = adcs + ichan * nsamples;
+      double     ped = 400 + (lrand48 () % 1600);
+      int      pulse = lrand48 () % (4 * nsamples);
+
+      for (int it = 0; it < nsamples; it++)
+      {
+         double adc = ped + noise * gauss ();
+
+         // A pulse big enough to exercise the overflow symbols
+         int dt = it - pulse;
+         if (dt >= 0 && dt < 32) adc += 1200.0 * dt * exp (-dt / 4.0) / 4.0;
+
+         if (adc < 0)      adc = 0;
+         if (adc > 0xfff)  adc = 0xfff;
+         chan[it] = (uint16_t)adc;
+      }
+   }
+
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Compares the decoded ADCs to the originals
+  \return The number of mismatches
+
+  \param[in]    name  The name of the method being checked
+  \param[in]    adcs  The decoded  ADCs
+  \param[in]     ref  The original ADCs
+  \param[in]   nadcs  The number of ADCs
+  \param[in] nsamples The number of samples per channel
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static int compare (char const      *name,
+                    uint16_t const  *adcs,
+                    uint16_t const   *ref,
+                    size_t          nadcs,
+                    int          nsamples)
+{
+   int nerrs = 0;
+   for (size_t idx = 0; idx < nadcs; idx++)
+   {
+      if (adcs[idx] != ref[idx])
+      {
+         if (nerrs++ < 10)
+         {
+            printf ("%-8s Error chan:tick %3zu:%4zu %3.3" PRIx16 " != %3.3" PRIx16 "\n",
+                    name, idx / nsamples, idx % nsamples, adcs[idx], ref[idx]);
+         }
+      }
+   }
+
+   return nerrs;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+   \brief  Encodes a set of synthetic packets, checks that the serial
+           and pooled decoders restore them and times the pooled
+           decoder for each of the requested thread counts
+
+   \param[in] argc The  count of command line arguments
+   \param[in] argv The vector of command line arguments
+                                                                          */
+/* ---------------------------------------------------------------------- */
+int main (int argc, char *const argv[])
+{
+   int         npkts    = 16;
+   int         niter    = 20;
+   int         nsamples = 1024;
+   double      noise    = 3.0;
+   char const *threads  = "1,2,4";
+   int c;
+
+   while ( (c = getopt (argc, argv, "p:n:s:r:t:")) != EOF)
+   {
+      if      (c == 'p') npkts    = strtol (optarg, NULL, 0);
+      else if (c == 'n') niter    = strtol (optarg, NULL, 0);
+      else if (c == 's') nsamples = strtol (optarg, NULL, 0);
+      else if (c == 'r') noise    = strtod (optarg, NULL);
+      else if (c == 't') threads  = optarg;
+      else
+      {
+         printf ("Usage: wib_decode_bench [-p npackets] [-n iterations]"
+                 " [-s nsamples] [-r noise rms] [-t nthreads,...]\n");
+         return -1;
+      }
+   }
+
+   if (nsamples < 2 || nsamples > WIBDECODE_K_MAXSAMPLES
+   || (nsamples & (nsamples - 1)))
+   {
+      printf ("Error: nsamples must be a power of 2 <= %d\n",
+              WIBDECODE_K_MAXSAMPLES);
+      return -1;
+   }
+
+
+   // ----------------------------------------------
+   // Generate and encode the packets
+   // ----------------------------------------------
+   int          nchans = WIBDECODE_K_MAXCHANNELS;
+   size_t      npkadcs = (size_t)nchans * nsamples;
+   uint32_t     maxn64 = WIBENCODE_K_MAXN64 (nchans, nsamples, 6);
+   uint16_t       *ref = (uint16_t *)malloc (npkts * npkadcs * sizeof (*ref));
+   uint16_t      *adcs = (uint16_t *)malloc (npkts * npkadcs * sizeof (*adcs));
+   uint64_t      *pkts = (uint64_t *)malloc (npkts * (size_t)maxn64 * sizeof (*pkts));
+   WibDecodeJob  *jobs = (WibDecodeJob *)malloc (npkts * sizeof (*jobs));
+   uint64_t    hdrs[6] = { 0 };
+   size_t     nbytesin = 0;
+
+   srand48 (1);
+   for (int ipkt = 0; ipkt < npkts; ipkt++)
+   {
+      uint16_t *pkref = ref  + ipkt * npkadcs;
+      uint64_t   *pkt = pkts + ipkt * (size_t)maxn64;
+
+      fill (pkref, nsamples, noise);
+      uint32_t n64 = wibEncode_packet (pkt, maxn64, pkref, nsamples,
+                                       nchans, nsamples, hdrs, 6, 0);
+      if (n64 == 0)
+      {
+         printf ("Error: packet %d overflowed its %" PRIu32 " words\n",
+                 ipkt, maxn64);
+         return -1;
+      }
+
+      jobs[ipkt].adcs   = adcs + ipkt * npkadcs;
+      jobs[ipkt].pitch  = nsamples;
+      jobs[ipkt].pkt    = pkt;
+      jobs[ipkt].n64    = n64;
+      jobs[ipkt].models = NULL;
+      nbytesin         += n64 * sizeof (uint64_t);
+   }
+
+   double nbytesout = (double)npkts * npkadcs * sizeof (uint16_t);
+   printf ("Packets: %d x %d channels x %d samples, noise %.1f, %d iterations\n"
+           "Compression: %.2f bits/sample, ratio %.2f (vs 12-bit ADCs)\n",
+           npkts, nchans, nsamples, noise, niter,
+           8.0 * nbytesin / (npkts * npkadcs),
+           12.0 * npkts * npkadcs / (8.0 * nbytesin));
+
+
+   // ---------------------------------
+   // Validate the serial decoder
+   // ---------------------------------
+   int nerrs = 0;
+   memset (adcs, 0xff, npkts * npkadcs * sizeof (*adcs));
+   for (int ipkt = 0; ipkt < npkts; ipkt++)
+   {
+      int status = wibDecode_packet (jobs[ipkt].adcs, nsamples,
+                                     jobs[ipkt].pkt,  jobs[ipkt].n64, NULL, NULL);
+      if (status)
+      {
+         printf ("serial   Error packet %d status %d\n", ipkt, status);
+         nerrs += 1;
+      }
+   }
+   nerrs += compare ("serial", adcs, ref, npkts * npkadcs, nsamples);
+   printf ("%-8s %s\n", "serial", nerrs ? "FAILED" : "ok");
+
+
+   // ------------------------------------------------------------
+   // Validate and time the pooled decoder at each thread count
+   // ------------------------------------------------------------
+   for (char const *p = threads; *p; )
+   {
+      char    *end;
+      int nthreads = strtol (p, &end, 0);
+      p            = *end ? end + 1 : end;
+      if (nthreads <= 0) continue;
+
+      WibDecodePool pool;
+      if (wibDecodePool_create (&pool, nthreads))
+      {
+         printf ("Error: could not create a pool of %d threads\n", nthreads);
+         continue;
+      }
+
+      memset (adcs, 0xff, npkts * npkadcs * sizeof (*adcs));
+      int nbad = wibDecodePool_decode (&pool, jobs, npkts);
+      int  bad = nbad + compare ("pool", adcs, ref, npkts * npkadcs, nsamples);
+
+      uint64_t beg = now_ns ();
+      for (int iter = 0; iter < niter; iter++)
+      {
+         wibDecodePool_decode (&pool, jobs, npkts);
+      }
+      uint64_t elapsed = now_ns () - beg;
+      wibDecodePool_destroy (&pool);
+
+      double secs  = elapsed * 1.e-9;
+      double rate  = (double)niter * nbytesin  / secs * 1.e-6;
+      double orate = (double)niter * nbytesout / secs * 1.e-6;
+      printf ("pool %2d  %6s %9.1f MB/s in %9.1f MB/s out %8.1f MB/s/core"
+              " %9.1f packets/s\n",
+              nthreads, bad ? "FAILED" : "ok",
+              rate, orate, rate / nthreads,
+              (double)niter * npkts / secs);
+      nerrs += bad;
+   }
+
+   free (jobs);
+   free (pkts);
+   free (adcs);
+   free (ref);
+
+   return nerrs ? 1 : 0;
+}
+/* ---------------------------------------------------------------------- */
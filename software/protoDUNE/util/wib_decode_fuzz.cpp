@@ -0,0 +1,327 @@
+// -*-Mode: C;-*-
+
+/* ---------------------------------------------------------------------- *//*!
+ *
+ *  @file     wib_decode_fuzz.cpp
+ *  @brief    Fuzz comparison of the table driven channel decoder against
+ *            the reference decoder and the encoder's input
+ *  @verbatim
+ *                               Copyright 2018
+ *                                    by
+ *
+ *                       The Board of Trustees of the
+ *                    Leland Stanford Junior University.
+ *                           All rights reserved.
+ *
+ *  @endverbatim
+ *
+ *  @par Facility:
+ *  util
+ *
+ *  @author
+ *  <russell@slac.stanford.edu>
+ *
+ *  @par Date created:
+ *  <2018/07/27>
+ *
+ * @par Credits:
+ * SLAC
+ *
+\* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *\
+
+   HISTORY
+   -------
+
+   DATE       WHO WHAT
+   ---------- --- ---------------------------------------------------------
+   2018.08.16 jjr Counts the channels sent raw, these skip the saved
+                  model check
+   2018.07.28 jjr Also checks channels coded with a saved model
+   2018.07.27 jjr Created
+
+\* ---------------------------------------------------------------------- */
+
+// This must go first in order to get things like PRIx32 defined
+#include <cinttypes>
+
+#include "WibDecode.h"
+#include "WibEncode.h"
+
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Returns the current monotonic time in nanoseconds
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline uint64_t now_ns ()
+{
+   struct timespec ts;
+   clock_gettime (CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief Fills a channel with one of several waveform styles, chosen at
+         random, meant to reach all the corners of the coder
+
+  \param[out]     adcs  The ADCs
+  \param[in]  nsamples  The number of samples
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static void fill (uint16_t *adcs, int nsamples)
+{
+   int    style = lrand48 () % 6;
+   int      ped = lrand48 () & 0xfff;
+   double   rms = drand48 () * (style == 1 ? 200.0 : 6.0);
+
+   for (int it = 0; it < nsamples; it++)
+   {
+      double adc;
+
+      switch (style)
+      {
+         // Constant, everything in one bin
+         case 0: adc = ped;                                           break;
+
+         // Uniform noise of random width, many overflows when wide
+         case 1:
+         case 2: adc = ped + rms * (2.0 * drand48 () - 1.0);          break;
+
+         // Full scale random, worst case
+         case 3: adc = lrand48 () & 0xfff;                            break;
+
+         // Ramp with an occasional jump
+         case 4: adc = ped + it + ((lrand48 () % 97) == 0 ? 900 : 0); break;
+
+         // Small noise with rare large spikes
+         default:
+            adc = ped + rms * (2.0 * drand48 () - 1.0);
+            if ((lrand48 () % 251) == 0) adc += (lrand48 () % 4096) - 2048;
+            break;
+      }
+
+      adcs[it] = (uint16_t)((int)adc & 0xfff);
+   }
+
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+   \brief  Encodes random channels at random bit offsets, decodes them
+           with both decoders and checks that they agree with each other
+           and with the original. The channel is also rewritten as if
+           coded with its saved model and must decode the same. The
+           stream is then corrupted and the two decoders must still
+           agree, status and output.
+
+   \param[in] argc The  count of command line arguments
+   \param[in] argv The vector of command line arguments
+                                                                          */
+/* ---------------------------------------------------------------------- */
+int main (int argc, char *const argv[])
+{
+   long  ntrials = 100000;
+   long     seed = 1;
+   int         c;
+
+   while ( (c = getopt (argc, argv, "n:s:")) != EOF)
+   {
+      if      (c == 'n') ntrials = strtol (optarg, NULL, 0);
+      else if (c == 's') seed    = strtol (optarg, NULL, 0);
+      else
+      {
+         printf ("Usage: wib_decode_fuzz [-n trials] [-s seed]\n");
+         return -1;
+      }
+   }
+
+   #define N64 (WIBENCODE_K_MAXN64 (1, WIBDECODE_K_MAXSAMPLES, 0) + 2)
+
+   static uint64_t buf[N64];
+   static uint64_t sbuf[N64];
+   uint16_t        ref[WIBDECODE_K_MAXSAMPLES];
+   uint16_t       slow[WIBDECODE_K_MAXSAMPLES];
+   uint16_t       fast[WIBDECODE_K_MAXSAMPLES];
+   long       nvalid = 0;
+   long        nsame = 0;
+   long         nraw = 0;
+   long    ncorrupt  = 0;
+   long      nerrs   = 0;
+   uint64_t   nbits  = 0;
+   uint64_t   nadcs  = 0;
+   long    nstatus[7] = { 0 };
+   uint64_t   tslow  = 0;
+   uint64_t   tfast  = 0;
+
+   srand48 (seed);
+   for (long itrial = 0; itrial < ntrials; itrial++)
+   {
+      int      nsamples = 4 << (lrand48 () % 9);
+      uint32_t      beg = lrand48 () % 192;
+
+      fill (ref, nsamples);
+
+      WibEncodeBits bs;
+      memset (buf, 0, sizeof (buf));
+      bitWriter_init (&bs, buf, N64, beg & ~0x3f);
+      wibEncodeBits_insert (&bs, lrand48 (), beg & 0x3f);
+      uint32_t end = wibEncode_channel (&bs, ref, nsamples);
+      uint32_t n64 = (wibEncodeBits_flush (&bs) + 63) >> 6;
+      nbits       += end - beg;
+      nadcs       += nsamples;
+
+
+      // -------------------------------------------------
+      // Valid stream, both must restore the original ADCs
+      // -------------------------------------------------
+      memset (slow, 0xff, sizeof (slow));
+      memset (fast, 0xff, sizeof (fast));
+
+      uint64_t t0 = now_ns ();
+      int   sslow = wibDecode_channel     (slow, buf, n64, beg, end, nsamples, NULL);
+      uint64_t t1 = now_ns ();
+      int   sfast = wibDecode_channelFast (fast, buf, n64, beg, end, nsamples, NULL);
+      uint64_t t2 = now_ns ();
+      tslow      += t1 - t0;
+      tfast      += t2 - t1;
+      nvalid     += 1;
+
+      if (sslow || sfast
+      ||  memcmp (slow, ref, nsamples * sizeof (*ref))
+      ||  memcmp (fast, ref, nsamples * sizeof (*ref)))
+      {
+         if (nerrs++ < 10)
+         {
+            printf ("Error trial %ld valid nsamples %d status %d:%d\n",
+                    itrial, nsamples, sslow, sfast);
+         }
+         continue;
+      }
+
+
+      // ------------------------------------------------------------
+      // Rewrite the channel with a same-as-saved-model header, the
+      // bins replaced by the count of overflows, and decode it with
+      // its own histogram as the saved model. Without a model it
+      // must fail. A raw channel has no histogram to save.
+      // ------------------------------------------------------------
+      if (wibDecode_isRaw (buf, n64, beg))
+      {
+         nraw += 1;
+      }
+      else
+      {
+         WibDecodeHist model;
+         uint32_t       hpos = beg;
+         wibDecode_histogram (&model, buf, n64, &hpos, end, nsamples, NULL);
+
+         int         norm = 31 - __builtin_clz (nsamples);
+         WibEncodeBits ss;
+         memset (sbuf, 0, sizeof (sbuf));
+         bitWriter_init (&ss, sbuf, N64, beg & ~0x3f);
+         wibEncodeBits_insert (&ss, lrand48 (), beg & 0x3f);
+         wibEncodeBits_insert (&ss, (WIBDECODE_K_FMTSAME        << 28)
+                                  | ((model.nbins - 1)          << 20)
+                                  | (model.first                <<  4)
+                                  |  model.nobits, 32);
+         wibEncodeBits_insert (&ss, model.table[1] - model.table[0], norm);
+         for (uint32_t p = model.opos; p < end; )
+         {
+            int n = end - p > 16 ? 16 : end - p;
+            wibEncodeBits_insert (&ss, wibDecode_extract (buf, n64, &p, n), n);
+         }
+         uint32_t send = ss.idx;
+         uint32_t sn64 = (wibEncodeBits_flush (&ss) + 63) >> 6;
+
+         WibDecodeHist mslow = model;
+         WibDecodeHist mfast = model;
+         memset (slow, 0xff, sizeof (slow));
+         memset (fast, 0xff, sizeof (fast));
+         sslow = wibDecode_channel     (slow, sbuf, sn64, beg, send, nsamples, &mslow);
+         sfast = wibDecode_channelFast (fast, sbuf, sn64, beg, send, nsamples, &mfast);
+         nsame += 1;
+
+         if (sslow || sfast
+         ||  memcmp (slow, ref, nsamples * sizeof (*ref))
+         ||  memcmp (fast, ref, nsamples * sizeof (*ref))
+         ||  wibDecode_channel     (slow, sbuf, sn64, beg, send, nsamples, NULL)
+                                                         != WIBDECODE_K_NOMODEL
+         ||  wibDecode_channelFast (fast, sbuf, sn64, beg, send, nsamples, NULL)
+                                                         != WIBDECODE_K_NOMODEL)
+         {
+            if (nerrs++ < 10)
+            {
+               printf ("Error trial %ld saved model nsamples %d status %d:%d\n",
+                       itrial, nsamples, sslow, sfast);
+            }
+            continue;
+         }
+      }
+
+
+      // -----------------------------------------------------------
+      // Corrupt the stream by flipping a few bits, or truncating it,
+      // the decoders must agree on whatever they make of it
+      // -----------------------------------------------------------
+      int nflips = 1 + lrand48 () % 4;
+      for (int iflip = 0; iflip < nflips; iflip++)
+      {
+         uint32_t bit = beg + lrand48 () % (end - beg);
+         buf[bit >> 6] ^= 0x8000000000000000ULL >> (bit & 0x3f);
+      }
+      if ((lrand48 () & 7) == 0) n64 = (beg >> 6) + lrand48 () % (n64 - (beg >> 6));
+
+      memset (slow, 0xff, sizeof (slow));
+      memset (fast, 0xff, sizeof (fast));
+      sslow     = wibDecode_channel     (slow, buf, n64, beg, end, nsamples, NULL);
+      sfast     = wibDecode_channelFast (fast, buf, n64, beg, end, nsamples, NULL);
+      ncorrupt += 1;
+      nstatus[-sslow] += 1;
+
+      if (sslow != sfast || memcmp (slow, fast, sizeof (slow)))
+      {
+         if (nerrs++ < 10)
+         {
+            printf ("Error trial %ld corrupt nsamples %d status %d:%d\n",
+                    itrial, nsamples, sslow, sfast);
+         }
+      }
+   }
+
+   printf ("Trials: %ld valid %ld saved model %ld raw %ld corrupt,"
+           " %.2f bits/sample,"
+           " errors %ld %s\n"
+           "Corrupt: %ld decoded, %ld bad histogram, %ld bad length,"
+           " %ld no model\n"
+           "Decode: reference %.1f ns/trial, fast %.1f ns/trial, speedup %.2f\n",
+           nvalid, nsame, nraw, ncorrupt, (double)nbits / nadcs, nerrs,
+           nerrs ? "FAILED" : "ok",
+           nstatus[0], nstatus[-WIBDECODE_K_BADHIST], nstatus[-WIBDECODE_K_LENGTH],
+           nstatus[-WIBDECODE_K_NOMODEL],
+           (double)tslow / nvalid, (double)tfast / nvalid,
+           tfast ? (double)tslow / tfast : 0.0);
+
+   return nerrs ? 1 : 0;
+}
+/* ---------------------------------------------------------------------- */
@@ -0,0 +1,615 @@
+// -*-Mode: C;-*-
+
+/* ---------------------------------------------------------------------- *//*!
+ *
+ *  @file     wib_generate_bench.cpp
+ *  @brief    Validates and times the synthetic WIB data generator
+ *  @verbatim
+ *                               Copyright 2018
+ *                                    by
+ *
+ *                       The Board of Trustees of the
+ *                    Leland Stanford Junior University.
+ *                           All rights reserved.
+ *
+ *  @endverbatim
+ *
+ *  @par Facility:
+ *  util
+ *
+ *  @author
+ *  <russell@slac.stanford.edu>
+ *
+ *  @par Date created:
+ *  <2018/07/31>
+ *
+ * @par Credits:
+ * SLAC
+ *
+\* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *\
+
+   HISTORY
+   -------
+
+   DATE       WHO WHAT
+   ---------- --- ---------------------------------------------------------
+   2018.07.31 jjr Created
+
+\* ---------------------------------------------------------------------- */
+
+
+/* ---------------------------------------------------------------------- *\
+
+   The checks, each on its own generator
+
+     headers   The comma character, version, crate.slot.fiber, the
+               timestamps step by 25 and the convert counts by 1
+     noise     Each channel's mean is its pedestal and its RMS is that
+               of its white and coherent noise, within 3%, and channels
+               are correlated only within their coherent group
+     stuck     The stuck channels, and only those, have their low 6 bits
+               at 0x00 or 0x3f on at least the configured fraction
+     errors    Against a twin without errors, the frames differ only on
+               the injected ones, and only as the kind allows
+     timing    A run start, then the triggers at the configured spacing
+     tracks    The signal above the noise appears on the tracks' channels
+
+   then the rate at which frames are generated is measured, with the
+   defaults and with everything turned on, and, with -r, the rate held
+   by WibGeneratePacer.
+
+\* ---------------------------------------------------------------------- */
+
+
+// This must go first in order to get things like PRIx32 defined
+#include <cinttypes>
+
+#include "WibGenerate.h"
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Returns the current monotonic time in nanoseconds
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline uint64_t now_ns ()
+{
+   struct timespec ts;
+   clock_gettime (CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Prints the result of one check
+  \return 1 if it failed, else 0
+
+  \param[in] what  The check
+  \param[in]   ok  Did it pass
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static int report (char const *what, bool ok)
+{
+   printf ("%-8s %s\n", what, ok ? "ok" : "FAILED");
+   return !ok;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Checks the header words
+  \return The number of failures
+
+  \param[in] nframes  The number of frames to check
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static int check_headers (int nframes)
+{
+   WibGenerateConfig cfg;
+   WibGenerate       gen;
+   uint64_t          frame[WIBGENERATE_K_N64FRAME];
+   int               nbad = 0;
+
+   wibGenerateConfig_init (&cfg);
+   cfg.crate     = 5;
+   cfg.slot      = 3;
+   cfg.fiber     = 2;
+   cfg.timestamp = 0x123456789abcULL;
+   wibGenerate_init (&gen, &cfg);
+
+   for (int iframe = 0; iframe < nframes; iframe++)
+   {
+      wibGenerate_frame (&gen, frame);
+
+      uint64_t ts   = cfg.timestamp + iframe * WIBGENERATE_K_PER_SAMPLE;
+      uint64_t cvt  = (uint16_t)iframe;
+      uint64_t w0   = 0xbc | 1 << 8 | (uint64_t)((3 << 8) | (5 << 3) | 2) << 13;
+
+      nbad += frame[0]  != w0
+           || frame[1]  != ts
+           || frame[2]  != cvt << 48 || frame[3]  != 0
+           || frame[16] != cvt << 48 || frame[17] != 0;
+   }
+
+   return report ("headers", nbad == 0);
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Checks the pedestals, noise and coherent noise
+  \return The number of failures
+
+  \param[in] nframes  The number of frames to check
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static int check_noise (int nframes)
+{
+   enum { NCHANS = WIBGENERATE_K_NCHANNELS };
+   WibGenerateConfig cfg;
+   WibGenerate       gen;
+   uint64_t          frame[WIBGENERATE_K_N64FRAME];
+   uint16_t          adcs[NCHANS];
+   static double     sum[NCHANS];
+   static double     sum2[NCHANS][NCHANS];
+   int               nbad = 0;
+
+   wibGenerateConfig_init (&cfg);
+   cfg.coherent   = 2.0;
+   cfg.track_rate = 0;
+   wibGenerate_init (&gen, &cfg);
+
+   for (int iframe = 0; iframe < nframes; iframe++)
+   {
+      wibGenerate_frame (&gen, frame);
+      wibUnpack_frame   (adcs, frame);
+
+      for (int i = 0; i < NCHANS; i++)
+      {
+         sum[i] += adcs[i];
+         for (int j = 0; j <= i; j++) sum2[i][j] += (double)adcs[i] * adcs[j];
+      }
+   }
+
+   double worst_mean = 0;
+   double worst_rms  = 0;
+   double worst_corr = 0;
+   double cm_var     = cfg.coherent * cfg.coherent + 1.0 / 12;
+   double mean[NCHANS];
+
+   for (int i = 0; i < NCHANS; i++)
+   {
+      mean[i] = sum[i] / nframes;
+   }
+
+   for (int i = 0; i < NCHANS; i++)
+   {
+      int    iv    = i / WIBGENERATE_K_NLANES;
+      int    lane  = i % WIBGENERATE_K_NLANES;
+      double white = gen.scale[iv][lane] * 9.2195 / 128.0;
+      double var   = white * white + 1.0 / 12 + cm_var;
+      double rms   = sqrt (sum2[i][i] / nframes - mean[i] * mean[i]);
+      double dmean = fabs (mean[i] - gen.ped[iv][lane]);
+      double drms  = fabs (rms / sqrt (var) - 1);
+
+      if (dmean > worst_mean) worst_mean = dmean;
+      if (drms  > worst_rms ) worst_rms  = drms;
+
+      // The covariance is the coherent variance within a group, else 0
+      for (int j = 0; j < i; j++)
+      {
+         double cov  = sum2[i][j] / nframes - mean[i] * mean[j];
+         bool   same = i / cfg.coherent_group == j / cfg.coherent_group;
+         double d    = fabs (cov - (same ? cm_var : 0)) / cm_var;
+         if (d > worst_corr) worst_corr = d;
+      }
+   }
+
+   // The coherent noise is low frequency, so its variance converges
+   // slowly, allow more for it
+   nbad += report ("pedestal", worst_mean < 0.1);
+   nbad += report ("noise",    worst_rms  < 0.03);
+   nbad += report ("coherent", worst_corr < 0.15);
+   printf ("         worst mean %.3f ADC, rms %.1f%%, covariance %.1f%%\n",
+           worst_mean, 100 * worst_rms, 100 * worst_corr);
+
+   return nbad;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Checks the stuck codes
+  \return The number of failures
+
+  \param[in] nframes  The number of frames to check
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static int check_stuck (int nframes)
+{
+   enum { NCHANS = WIBGENERATE_K_NCHANNELS };
+   WibGenerateConfig cfg;
+   WibGenerate       gen;
+   uint64_t          frame[WIBGENERATE_K_N64FRAME];
+   uint16_t          adcs[NCHANS];
+   int               nstuck[NCHANS] = { 0 };
+   int               nbad = 0;
+
+   wibGenerateConfig_init (&cfg);
+   cfg.stuck_fraction    = 0.25;
+   cfg.stuck_probability = 0.6;
+   cfg.track_rate        = 0;
+   wibGenerate_init (&gen, &cfg);
+
+   for (int iframe = 0; iframe < nframes; iframe++)
+   {
+      wibGenerate_frame (&gen, frame);
+      wibUnpack_frame   (adcs, frame);
+
+      for (int i = 0; i < NCHANS; i++)
+      {
+         int low = adcs[i] & 0x3f;
+         nstuck[i] += low == 0 || low == 0x3f;
+      }
+   }
+
+   // Noise alone puts at most ~0.3 of the samples on these codes
+   for (int i = 0; i < NCHANS; i++)
+   {
+      bool   is = gen.stuck[i / WIBGENERATE_K_NLANES][i % WIBGENERATE_K_NLANES];
+      double f  = (double)nstuck[i] / nframes;
+      nbad     += is ? f < 0.95 * cfg.stuck_probability : f > 0.45;
+   }
+
+   printf ("         %d of %d channels stuck\n", gen.nstuck, NCHANS);
+   return report ("stuck", nbad == 0 && gen.nstuck > 0);
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Checks the injected errors against a twin without them
+  \return The number of failures
+
+  \param[in] nframes  The number of frames to check
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static int check_errors (int nframes)
+{
+   WibGenerateConfig cfg;
+   WibGenerate       gen;
+   WibGenerate       twin;
+   uint64_t          frame[WIBGENERATE_K_N64FRAME];
+   uint64_t          clean[WIBGENERATE_K_N64FRAME];
+   int               nkind[4] = { 0 };
+   int               nbad     = 0;
+   int               ndiff    = 0;
+
+   wibGenerateConfig_init (&cfg);
+   wibGenerate_init (&twin, &cfg);
+   cfg.error_rate = 0.01;
+   wibGenerate_init (&gen, &cfg);
+
+   for (int iframe = 0; iframe < nframes; iframe++)
+   {
+      uint64_t before = gen.nerrors;
+
+      wibGenerate_frame (&gen,  frame);
+      wibGenerate_frame (&twin, clean);
+
+      int nw   = 0;
+      int kind = -1;
+      for (int iw = 0; iw < WIBGENERATE_K_N64FRAME; iw++)
+      {
+         if (frame[iw] == clean[iw]) continue;
+
+         nw += 1;
+         if      (iw == 0)                               kind = 0;
+         else if (iw == 1)                               kind = 3;
+         else if (iw == 2 || iw == 3 || iw == 16 || iw == 17) kind = 1;
+         else if (__builtin_popcountll (frame[iw] ^ clean[iw]) == 1) kind = 2;
+      }
+
+      bool injected = gen.nerrors != before;
+      ndiff        += nw != 0;
+
+      // An error frame differs in 1 word, or 2 for the colddata errors
+      if (injected != (nw != 0) || (nw && (kind < 0 || nw > 1 + (kind == 1))))
+      {
+         nbad += 1;
+      }
+      else if (injected)
+      {
+         nkind[kind] += 1;
+      }
+   }
+
+   printf ("         %d error frames: %d wib %d colddata %d flip %d timestamp\n",
+           ndiff, nkind[0], nkind[1], nkind[2], nkind[3]);
+   return report ("errors", nbad == 0 && ndiff > 0
+                  && nkind[0] && nkind[1] && nkind[2] && nkind[3]);
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Checks the timing messages
+  \return The number of failures
+
+  \param[in] nframes  The number of frames to check
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static int check_timing (int nframes)
+{
+   int nbad = 0;
+
+   for (int random = 0; random < 2; random++)
+   {
+      WibGenerateConfig cfg;
+      WibGenerate       gen;
+      WibGenerateTiming msgs[4];
+      uint64_t          frame[WIBGENERATE_K_N64FRAME];
+      uint64_t          last = 0;
+      int               nmsgs = 0;
+      int               ntrig = 0;
+
+      wibGenerateConfig_init (&cfg);
+      cfg.timestamp      = 1000;
+      cfg.trigger_period = 25 * 1000;
+      cfg.trigger_random = random;
+      wibGenerate_init (&gen, &cfg);
+
+      for (int iframe = 0; iframe < nframes; iframe++)
+      {
+         wibGenerate_frame (&gen, frame);
+
+         int n;
+         while ( (n = wibGenerate_timing (&gen, msgs, 4)) > 0)
+         {
+            for (int i = 0; i < n; i++, nmsgs++)
+            {
+               int type = msgs[i].tsw & 0xf;
+               nbad += msgs[i].sequence != (uint32_t)nmsgs
+                    || (msgs[i].tsw >> 4) != WIBGENERATE_K_TIMING_RUNNING
+                    ||  msgs[i].timestamp  >= frame[1] + WIBGENERATE_K_PER_SAMPLE
+                    ||  msgs[i].timestamp  < last
+                    || (nmsgs == 0) != (type == WIBGENERATE_K_TIMING_RUNSTART);
+               last   = msgs[i].timestamp;
+               ntrig += type == WIBGENERATE_K_TIMING_TRIGGER;
+            }
+         }
+      }
+
+      // 1 trigger per 1000 frames, allow 10% for the random spacing
+      double expected = nframes / 1000.0;
+      nbad += fabs (ntrig - expected) > 0.1 * expected + 1;
+      printf ("         %s triggers %d, expected %.0f\n",
+              random ? "random  " : "periodic", ntrig, expected);
+   }
+
+   return report ("timing", nbad == 0);
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Checks that the tracks put signal on their channels
+  \return The number of failures
+
+  \param[in] nframes  The number of frames to check
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static int check_tracks (int nframes)
+{
+   enum { NCHANS = WIBGENERATE_K_NCHANNELS };
+   WibGenerateConfig cfg;
+   WibGenerate       gen;
+   WibGenerate       twin;
+   uint16_t          adcs[NCHANS];
+   uint16_t          base[NCHANS];
+   uint64_t          nhits = 0;
+
+   // The twin has no tracks, but otherwise the same noise
+   wibGenerateConfig_init (&cfg);
+   cfg.track_rate = 0;
+   wibGenerate_init (&twin, &cfg);
+   cfg.track_rate = 100000;
+   wibGenerate_init (&gen, &cfg);
+
+   for (int iframe = 0; iframe < nframes; iframe++)
+   {
+      wibGenerate_adcs (&twin, base);
+
+      // The track signal, as it is being added, before the clamp
+      wibGenerate_adcs (&gen,  adcs);
+      int16_t const *trk = (int16_t const *)gen.trk;
+      for (int i = 0; i < NCHANS; i++)
+      {
+         int expect = base[i] + trk[i];
+         if (expect < 0)     expect = 0;
+         if (expect > 0xfff) expect = 0xfff;
+         if (adcs[i] != expect) return report ("tracks", false);
+         nhits += trk[i] != 0;
+      }
+   }
+
+   printf ("         %" PRIu64 " tracks, %.1f%% of the samples with signal\n",
+           gen.nstarts, 100.0 * nhits / ((double)nframes * NCHANS));
+   return report ("tracks", gen.nstarts > 0 && nhits > 0);
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Times the generation of \a nframes frames
+  \return The rate in frames per second
+
+  \param[in]     cfg  The configuration
+  \param[in] nframes  The number of frames
+  \param[in]   label  The description of the configuration
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static double bench (WibGenerateConfig const *cfg,
+                     int                  nframes,
+                     char const            *label)
+{
+   enum { NBUF = 1024 };
+   static uint64_t frames[NBUF][WIBGENERATE_K_N64FRAME];
+   WibGenerate     gen;
+   uint64_t        sum = 0;
+
+   wibGenerate_init (&gen, cfg);
+
+   uint64_t beg = now_ns ();
+   for (int n = 0; n < nframes; n += NBUF)
+   {
+      wibGenerate_frames (&gen, frames[0], NBUF, WIBGENERATE_K_N64FRAME);
+      sum += frames[n & (NBUF - 1)][5];
+   }
+   uint64_t ns = now_ns () - beg;
+
+   double rate = (double)nframes / (ns * 1.e-9);
+   printf ("%-26s %7.2f Mframes/s %6.2f Gb/s %6.1f ns/frame (%" PRIx64 ")\n",
+           label, rate * 1.e-6, rate * sizeof (frames[0]) * 8.e-9,
+           1.e9 / rate, sum & 0xff);
+   return rate;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Holds the generator to \a gbps for about a second
+  \return The number of failures
+
+  \param[in] gbps  The rate, in Gb/s
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static int pace (double gbps)
+{
+   enum { NBUF = 64 };
+   static uint64_t   frames[NBUF][WIBGENERATE_K_N64FRAME];
+   WibGenerateConfig cfg;
+   WibGenerate       gen;
+   WibGeneratePacer  pacer;
+   uint64_t          nbytes = 0;
+
+   wibGenerateConfig_init (&cfg);
+   wibGenerate_init (&gen, &cfg);
+   wibGeneratePacer_init (&pacer, gbps * 1.e9 / 8);
+
+   uint64_t beg = now_ns ();
+   while (now_ns () - beg < 1000000000ULL)
+   {
+      wibGenerate_frames    (&gen, frames[0], NBUF, WIBGENERATE_K_N64FRAME);
+      wibGeneratePacer_wait (&pacer, sizeof (frames));
+      nbytes += sizeof (frames);
+   }
+   double got = nbytes * 8 / ((now_ns () - beg) * 1.e-9) * 1.e-9;
+
+   printf ("paced at %.2f Gb/s, got %.2f Gb/s\n", gbps, got);
+   return report ("pacing", fabs (got / gbps - 1) < 0.05);
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Main entry point
+  \retval 0, all the checks passed
+  \retval 1, a check failed
+
+  \param[in] argc The count of command line arguments
+  \param[in] argv The vector of command line arguments
+                                                                          */
+/* ---------------------------------------------------------------------- */
+int main (int argc, char *const argv[])
+{
+   int    nframes = 1 << 20;
+   int    ncheck  = 1 << 17;
+   double gbps    = 0;
+   int    c;
+
+   while ( (c = getopt (argc, argv, "n:c:r:")) != EOF)
+   {
+      if      (c == 'n') nframes = strtol (optarg, NULL, 0);
+      else if (c == 'c') ncheck  = strtol (optarg, NULL, 0);
+      else if (c == 'r') gbps    = strtod (optarg, NULL);
+      else
+      {
+         printf ("Usage: wib_generate_bench [-n frames to time]"
+                 " [-c frames to check] [-r Gb/s to pace]\n");
+         return -1;
+      }
+   }
+
+   int nbad = 0;
+   nbad += check_headers (ncheck);
+   nbad += check_noise   (ncheck);
+   nbad += check_stuck   (ncheck);
+   nbad += check_errors  (ncheck);
+   nbad += check_timing  (ncheck * 4);
+   nbad += check_tracks  (ncheck);
+
+
+   WibGenerateConfig cfg;
+   wibGenerateConfig_init (&cfg);
+   cfg.track_rate = 0;
+   cfg.coherent   = 0;
+   bench (&cfg, nframes, "White noise");
+
+   wibGenerateConfig_init (&cfg);
+   bench (&cfg, nframes, "Defaults");
+
+   cfg.track_rate        = 100000;
+   cfg.stuck_fraction    = 0.1;
+   cfg.stuck_probability = 0.01;
+   cfg.error_rate        = 1.e-4;
+   bench (&cfg, nframes, "Tracks, stuck codes, errors");
+
+   if (gbps > 0) nbad += pace (gbps);
+
+   printf ("%s\n", nbad ? "FAILED" : "ok");
+   return nbad ? 1 : 0;
+}
+/* ---------------------------------------------------------------------- */
@@ -0,0 +1,325 @@
+// -*-Mode: C;-*-
+
+/* ---------------------------------------------------------------------- *//*!
+ *
+ *  @file     wib_unpack_bench.cpp
+ *  @brief    Validates and times the channel-major WIB frame unpackers
+ *  @verbatim
+ *                               Copyright 2018
+ *                                    by
+ *
+ *                       The Board of Trustees of the
+ *                    Leland Stanford Junior University.
+ *                           All rights reserved.
+ *
+ *  @endverbatim
+ *
+ *  @par Facility:
+ *  util
+ *
+ *  @author
+ *  <russell@slac.stanford.edu>
+ *
+ *  @par Date created:
+ *  <2018/07/24>
+ *
+ * @par Credits:
+ * SLAC
+ *
+\* ---------------------------------------------------------------------- */
+
+
+
+/* ---------------------------------------------------------------------- *\
+
+   HISTORY
+   -------
+
+   DATE       WHO WHAT
+   ---------- --- ---------------------------------------------------------
+   2018.08.17 jjr Exit with a nonzero status if any check fails
+   2018.07.30 jjr Added the transposed packet builder and reader checks
+   2018.07.24 jjr Created
+
+\* ---------------------------------------------------------------------- */
+
+// This must go first in order to get things like PRIx32 defined
+#include <cinttypes>
+
+#include "WibUnpack.h"
+#include "WibTransposed.h"
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Returns the current monotonic time in nanoseconds
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static inline uint64_t now_ns ()
+{
+   struct timespec ts;
+   clock_gettime (CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief Fills a packet of WIB frames with random 12-bit ADCs
+
+  \param[out]  frames  The frames to fill
+  \param[in]  nframes  The number of frames
+  \param[out]     ref  The reference channel-major ADCs
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static void fill (uint64_t *frames, int nframes, uint16_t *ref)
+{
+   uint16_t adcs[WIBUNPACK_K_NCHANNELS];
+
+   for (int it = 0; it < nframes; it++)
+   {
+      uint64_t *f = frames + it * WIBUNPACK_K_N64FRAME;
+      for (int iw = 0; iw < WIBUNPACK_K_N64FRAME; iw++)
+      {
+         f[iw] = ((uint64_t)lrand48 () << 32) | lrand48 ();
+      }
+
+      // The timestamp, word 1, advances one sample per frame
+      f[1] = 0x100000000ULL + (uint64_t)it * WIBTRANSPOSED_K_TICKS;
+
+      for (int ichan = 0; ichan < WIBUNPACK_K_NCHANNELS; ichan++)
+      {
+         adcs[ichan]               = lrand48 () & 0xfff;
+         ref[ichan * nframes + it] = adcs[ichan];
+      }
+
+      wibPack_frame (f, adcs);
+   }
+
+   return;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Validates then times one unpacking method
+  \return The number of errors
+
+  \param[in]     name  The method's name
+  \param[in]   method  The method
+  \param[in]   frames  The packet of WIB frames
+  \param[in]  nframes  The number of frames in the packet
+  \param[in]      ref  The reference channel-major ADCs
+  \param[in]    niter  The number of timing iterations
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static int bench  (char const              *name,
+                   enum WibUnpackMethod   method,
+                   uint64_t const        *frames,
+                   int                   nframes,
+                   uint16_t const           *ref,
+                   int                     niter)
+{
+   size_t    nadcs = (size_t)WIBUNPACK_K_NCHANNELS * nframes;
+   uint16_t  *adcs = (uint16_t *)malloc (nadcs * sizeof (*adcs));
+
+   memset (adcs, 0xff, nadcs * sizeof (*adcs));
+   if (wibUnpack (adcs, nframes, frames, nframes,
+                  WIBUNPACK_K_N64FRAME, method))
+   {
+      printf ("%-8s not available\n", name);
+      free (adcs);
+      return 0;
+   }
+
+   int nerrs = 0;
+   for (size_t idx = 0; idx < nadcs; idx++)
+   {
+      if (adcs[idx] != ref[idx])
+      {
+         if (nerrs++ < 10)
+         {
+            printf ("%-8s Error chan:tick %3zu:%4zu %3.3" PRIx16 " != %3.3" PRIx16 "\n",
+                    name, idx / nframes, idx % nframes, adcs[idx], ref[idx]);
+         }
+      }
+   }
+
+
+   uint64_t beg = now_ns ();
+   for (int iter = 0; iter < niter; iter++)
+   {
+      wibUnpack (adcs, nframes, frames, nframes, WIBUNPACK_K_N64FRAME, method);
+   }
+   uint64_t elapsed = now_ns () - beg;
+
+
+   double nbytes = (double)niter * nframes * WIBUNPACK_K_N64FRAME * sizeof (uint64_t);
+   double   secs = elapsed * 1.e-9;
+   printf ("%-8s %6s %10.1f MB/s %10.3f Mframes/s %8.1f ns/packet\n",
+           name,
+           nerrs ? "FAILED" : "ok",
+           nbytes / secs * 1.e-6,
+           (double)niter * nframes / secs * 1.e-6,
+           (double)elapsed / niter);
+
+   free (adcs);
+   return nerrs;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+  \brief  Builds, validates and times transposed packets
+  \return The number of errors
+
+  \param[in]   frames  The packet of WIB frames
+  \param[in]  nframes  The number of frames in the packet
+  \param[in]      ref  The reference channel-major ADCs
+  \param[in]    niter  The number of timing iterations
+                                                                          */
+/* ---------------------------------------------------------------------- */
+static int transposed  (uint64_t const        *frames,
+                        int                   nframes,
+                        uint16_t const           *ref,
+                        int                     niter)
+{
+   uint32_t maxn64 = WIBTRANSPOSED_K_N64 (WIBUNPACK_K_NCHANNELS, nframes);
+   uint64_t   *pkt = (uint64_t *)malloc (maxn64 * sizeof (*pkt));
+   uint32_t    n64 = wibTransposed_packet (pkt, maxn64, frames, nframes,
+                                           WIBUNPACK_K_N64FRAME, 0);
+   int       nerrs = 0;
+
+
+   // ----------------------------------------------------------
+   // Read it back both with and without the epilogue, then
+   // check the waveforms in place and the window trimming
+   // ----------------------------------------------------------
+   WibTransposed view;
+   if (n64 == 0
+    || wibTransposed_locate (&view, pkt, n64)
+    || wibTransposed_locate (&view, pkt, n64 - 2)
+    || view.nchans   != WIBUNPACK_K_NCHANNELS
+    || view.nsamples != nframes
+    || view.timestamps[0] != frames[1]
+    || view.timestamps[1] != frames[(nframes - 1) * WIBUNPACK_K_N64FRAME + 1])
+   {
+      printf ("transposed: packet did not validate\n");
+      nerrs++;
+   }
+   else
+   {
+      for (int ichan = 0; ichan < view.nchans; ichan++)
+      {
+         uint16_t const *adcs = wibTransposed_channel (&view, ichan);
+         if (memcmp (adcs, ref + ichan * nframes, nframes * sizeof (*adcs)))
+         {
+            if (nerrs++ < 10) printf ("transposed: Error chan %3d\n", ichan);
+         }
+      }
+
+      int first, nsamples;
+      uint64_t beg = view.timestamps[0] + 3 * WIBTRANSPOSED_K_TICKS;
+      int    nwin = nframes < 8 ? nframes - 3 : 5;
+      if (nwin < 0) nwin = 0;
+      if ( wibTransposed_window (&view, beg, beg + 5 * WIBTRANSPOSED_K_TICKS,
+                                 &first, &nsamples) != nwin
+        || (nwin && first != 3)
+        || wibTransposed_window (&view, 0, ~0ULL, &first, &nsamples) != nframes
+        || first != 0)
+      {
+         printf ("transposed: window trimming failed\n");
+         nerrs++;
+      }
+   }
+
+
+   uint64_t beg = now_ns ();
+   for (int iter = 0; iter < niter; iter++)
+   {
+      wibTransposed_packet (pkt, maxn64, frames, nframes,
+                            WIBUNPACK_K_N64FRAME, 0);
+   }
+   uint64_t elapsed = now_ns () - beg;
+
+
+   double nbytes = (double)niter * nframes * WIBUNPACK_K_N64FRAME * sizeof (uint64_t);
+   double   secs = elapsed * 1.e-9;
+   printf ("%-8s %6s %10.1f MB/s %10.3f Mframes/s %8.1f ns/packet\n",
+           "packet",
+           nerrs ? "FAILED" : "ok",
+           nbytes / secs * 1.e-6,
+           (double)niter * nframes / secs * 1.e-6,
+           (double)elapsed / niter);
+
+   free (pkt);
+   return nerrs;
+}
+/* ---------------------------------------------------------------------- */
+
+
+
+
+/* ---------------------------------------------------------------------- *//*!
+
+   \brief  Times the scalar and vector unpackers on random packets
+   \retval 0, every available method reproduced the ADCs
+   \retval 1, a check failed
+
+   \param[in] argc The  count of command line arguments
+   \param[in] argv The vector of command line arguments
+                                                                          */
+/* ---------------------------------------------------------------------- */
+int main (int argc, char *const argv[])
+{
+   int nframes = 1024;
+   int niter   = 1000;
+   int c;
+
+   while ( (c = getopt (argc, argv, "f:n:")) != EOF)
+   {
+      if      (c == 'f') nframes = strtol (optarg, NULL, 0);
+      else if (c == 'n') niter   = strtol (optarg, NULL, 0);
+      else
+      {
+         printf ("Usage: wib_unpack_bench [-f nframes/packet] [-n iterations]\n");
+         return -1;
+      }
+   }
+
+   uint64_t *frames = (uint64_t *)malloc ((size_t)nframes * WIBUNPACK_K_N64FRAME
+                                                          * sizeof (*frames));
+   uint16_t    *ref = (uint16_t *)malloc ((size_t)nframes * WIBUNPACK_K_NCHANNELS
+                                                          * sizeof (*ref));
+   srand48 (1);
+   fill    (frames, nframes, ref);
+
+   printf ("Packet: %d frames, %d iterations\n", nframes, niter);
+   int nerrs = 0;
+   nerrs += bench ("scalar", WIBUNPACK_K_SCALAR, frames, nframes, ref, niter);
+   nerrs += bench ("ssse3",  WIBUNPACK_K_SSSE3,  frames, nframes, ref, niter);
+   nerrs += bench ("avx2",   WIBUNPACK_K_AVX2,   frames, nframes, ref, niter);
+   nerrs += bench ("neon",   WIBUNPACK_K_NEON,   frames, nframes, ref, niter);
+   nerrs += transposed (frames, nframes, ref, niter);
+
+   free (ref);
+   free (frames);
+
+   return nerrs ? 1 : 0;
+}
+/* ---------------------------------------------------------------------- */